@@ -0,0 +1,171 @@
+#include "allocator.h"
+#include "pool.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARENA_ALIGNMENT 16
+
+static void *libc_alloc(void *user, size_t size)
+{
+    (void)user;
+    return malloc(size);
+}
+
+static void *libc_realloc(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+    (void)user;
+    (void)old_size;
+    return realloc(ptr, new_size);
+}
+
+static void libc_free(void *user, void *ptr, size_t size)
+{
+    (void)user;
+    (void)size;
+    free(ptr);
+}
+
+Allocator libc_allocator = { libc_alloc, libc_realloc, libc_free, NULL };
+
+static void *pool_alloc_fn(void *user, size_t size)
+{
+    (void)user;
+    return pool_alloc(size);
+}
+
+static void *pool_realloc_fn(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+    (void)user;
+    return pool_realloc(ptr, old_size, new_size);
+}
+
+static void pool_free_fn(void *user, void *ptr, size_t size)
+{
+    (void)user;
+    pool_free(ptr, size);
+}
+
+Allocator pool_allocator = { pool_alloc_fn, pool_realloc_fn, pool_free_fn, NULL };
+
+void *allocate_zeroed(Allocator *allocator, size_t size)
+{
+    void *ptr = allocate(allocator, size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char *allocate_str(Allocator *allocator, const char *str)
+{
+    size_t size = strlen(str) + 1;
+    char *copy = allocate(allocator, size);
+    memcpy(copy, str, size);
+    return copy;
+}
+
+void deallocate_str(Allocator *allocator, char *str)
+{
+    if (str != NULL) {
+        deallocate(allocator, str, strlen(str) + 1);
+    }
+}
+
+#define ARENA_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+static inline size_t align_arena_size(size_t size)
+{
+    return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+static inline char *block_data(ArenaBlock *block)
+{
+    return (char *)block + ARENA_HEADER_SIZE;
+}
+
+static void *arena_alloc(void *user, size_t size)
+{
+    Arena *arena = user;
+    size_t aligned_size = align_arena_size(size);
+    ArenaBlock *block = arena->blocks;
+    if (block == NULL || block->size - block->used < aligned_size) {
+        // Oversized requests get a block of their own
+        size_t block_size = aligned_size > arena->block_size ? aligned_size : arena->block_size;
+        block = malloc(ARENA_HEADER_SIZE + block_size);
+        block->size = block_size;
+        block->used = 0;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    void *ptr = block_data(block) + block->used;
+    block->used += aligned_size;
+    arena->bytes_allocated += aligned_size;
+    return ptr;
+}
+
+// The most recent allocation grows in place when its block has room, anything else is copied
+static void *arena_realloc(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+    Arena *arena = user;
+    if (ptr == NULL) {
+        return arena_alloc(arena, new_size);
+    }
+
+    ArenaBlock *block = arena->blocks;
+    size_t old_aligned = align_arena_size(old_size);
+    size_t new_aligned = align_arena_size(new_size);
+    if ((char *)ptr + old_aligned == block_data(block) + block->used
+        && block->used - old_aligned + new_aligned <= block->size) {
+        block->used = block->used - old_aligned + new_aligned;
+        arena->bytes_allocated = arena->bytes_allocated - old_aligned + new_aligned;
+        return ptr;
+    }
+
+    void *new_ptr = arena_alloc(arena, new_size);
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+static void arena_free(void *user, void *ptr, size_t size)
+{
+    (void)user;
+    (void)ptr;
+    (void)size;
+}
+
+Arena *make_arena(size_t block_size)
+{
+    Arena *arena = malloc(sizeof(Arena));
+    arena->blocks = NULL;
+    arena->block_size = block_size == 0 ? DEFAULT_ARENA_BLOCK_SIZE : block_size;
+    arena->bytes_allocated = 0;
+    arena->allocator = (Allocator) { arena_alloc, arena_realloc, arena_free, arena };
+    return arena;
+}
+
+// Releases everything allocated from the arena but keeps its first block for the next round
+void reset_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL && block->next != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    if (block != NULL) {
+        block->used = 0;
+    }
+    arena->blocks = block;
+    arena->bytes_allocated = 0;
+}
+
+void cleanup_arena(Arena *arena)
+{
+    ArenaBlock *block = arena->blocks;
+    while (block != NULL) {
+        ArenaBlock *next = block->next;
+        free(block);
+        block = next;
+    }
+    free(arena);
+}
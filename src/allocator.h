@@ -0,0 +1,65 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stddef.h>
+
+// Where the lexer, parser, AST lists, strings and error lists get their memory from. Frees and
+// reallocs are passed the size the block was allocated with, so size-class and arena allocators
+// need no headers. Constructors taking an `Allocator *` treat NULL as the pool allocator.
+typedef struct Allocator {
+    void *(*alloc)(void *user, size_t size);
+    void *(*realloc)(void *user, void *ptr, size_t old_size, size_t new_size);
+    void (*free)(void *user, void *ptr, size_t size);
+    void *user;
+} Allocator;
+
+extern Allocator libc_allocator;
+extern Allocator pool_allocator;
+
+static inline Allocator *resolve_allocator(Allocator *allocator)
+{
+    return allocator == NULL ? &pool_allocator : allocator;
+}
+
+static inline void *allocate(Allocator *allocator, size_t size)
+{
+    return allocator->alloc(allocator->user, size);
+}
+
+static inline void *reallocate(Allocator *allocator, void *ptr, size_t old_size, size_t new_size)
+{
+    return allocator->realloc(allocator->user, ptr, old_size, new_size);
+}
+
+static inline void deallocate(Allocator *allocator, void *ptr, size_t size)
+{
+    allocator->free(allocator->user, ptr, size);
+}
+
+extern void *allocate_zeroed(Allocator *allocator, size_t size);
+extern char *allocate_str(Allocator *allocator, const char *str);
+extern void deallocate_str(Allocator *allocator, char *str);
+
+typedef struct ArenaBlock {
+    struct ArenaBlock *next;
+    size_t size;
+    size_t used;
+} ArenaBlock;
+
+// Bump allocates out of a chain of blocks and ignores frees, everything handed out is released
+// at once by reset_arena or cleanup_arena. Meant for request-scoped parsing, where nothing needs
+// to outlive the request.
+typedef struct Arena {
+    ArenaBlock *blocks; // Newest first, allocations come from the head
+    size_t block_size;
+    size_t bytes_allocated; // Handed out since the last reset
+    Allocator allocator;
+} Arena;
+
+#define DEFAULT_ARENA_BLOCK_SIZE (64 * 1024)
+
+extern Arena *make_arena(size_t block_size);
+extern void reset_arena(Arena *arena);
+extern void cleanup_arena(Arena *arena);
+
+#endif // ALLOCATOR_H
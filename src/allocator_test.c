@@ -0,0 +1,155 @@
+#include "allocator.h"
+#include "ast.h"
+#include "parser.h"
+#include "str_utils.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+// Counts what passes through it and checks every free matches an allocation's size
+typedef struct TrackingAllocator {
+    Allocator allocator;
+    size_t live_blocks;
+    size_t live_bytes;
+    size_t allocations;
+} TrackingAllocator;
+
+static void *tracking_alloc(void *user, size_t size)
+{
+    TrackingAllocator *tracker = user;
+    tracker->live_blocks++;
+    tracker->live_bytes += size;
+    tracker->allocations++;
+    return malloc(size);
+}
+
+static void *tracking_realloc(void *user, void *ptr, size_t old_size, size_t new_size)
+{
+    TrackingAllocator *tracker = user;
+    if (ptr == NULL) {
+        return tracking_alloc(user, new_size);
+    }
+    tracker->live_bytes += new_size - old_size;
+    return realloc(ptr, new_size);
+}
+
+static void tracking_free(void *user, void *ptr, size_t size)
+{
+    TrackingAllocator *tracker = user;
+    if (ptr == NULL) {
+        return;
+    }
+    assert(tracker->live_blocks > 0 && tracker->live_bytes >= size);
+    tracker->live_blocks--;
+    tracker->live_bytes -= size;
+    free(ptr);
+}
+
+static TrackingAllocator make_tracking_allocator(void)
+{
+    TrackingAllocator tracker = { 0 };
+    tracker.allocator = (Allocator) { tracking_alloc, tracking_realloc, tracking_free, NULL };
+    return tracker;
+}
+
+TEST_CASE(parser_allocates_through_its_allocator)
+{
+    TrackingAllocator tracker = make_tracking_allocator();
+    tracker.allocator.user = &tracker;
+
+    // Enough statements to grow the program and the node list, and some errors
+    String *input = make_string(&tracker.allocator);
+    for (int i = 0; i < 100; i++) {
+        copy_str_into_string(input, "let f = fn(a, b, c, d, e) { if (a > b) { c(d, e) } else { a } };");
+    }
+    copy_str_into_string(input, "let = 5; let x 1;");
+    char *input_str = get_str_from_string(input);
+    cleanup_string(input);
+    assert(tracker.live_blocks == 0);
+
+    Parser *parser = make_parser(input_str, &tracker.allocator);
+    Program *program = parse_program(parser);
+    assert(program->size >= 100);
+    assert(parser->errors->size > 0);
+    assert(tracker.live_blocks > 0);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(input_str);
+
+    if (tracker.live_blocks != 0 || tracker.live_bytes != 0) {
+        printf("Leaked %zu blocks, %zu bytes\n", tracker.live_blocks, tracker.live_bytes);
+        assert(1 != 1);
+    }
+}
+
+TEST_CASE(lexer_allocates_through_its_allocator)
+{
+    TrackingAllocator tracker = make_tracking_allocator();
+    tracker.allocator.user = &tracker;
+
+    Lexer *lexer = make_lexer("let x = 5;", &tracker.allocator);
+    assert(tracker.live_bytes == sizeof(Lexer));
+    assert(lex_next_token(lexer).type == TOKEN_LET);
+    cleanup_lexer(lexer);
+    assert(tracker.live_blocks == 0);
+}
+
+TEST_CASE(arena_frees_a_request_in_one_shot)
+{
+    Arena *arena = make_arena(4096);
+
+    for (int request = 0; request < 3; request++) {
+        Parser *parser = make_parser("let add = fn(a, b) { a + b }; add(1, 2); let = ;", &arena->allocator);
+        Program *program = parse_program(parser);
+        assert(program->size > 0);
+        assert(parser->errors->size > 0);
+        assert(arena->bytes_allocated > 0);
+
+        // No cleanup_program or cleanup_parser, everything goes with the arena
+        reset_arena(arena);
+        assert(arena->bytes_allocated == 0);
+        assert(arena->blocks->next == NULL);
+    }
+
+    cleanup_arena(arena);
+}
+
+TEST_CASE(arena_grows_the_last_allocation_in_place)
+{
+    Arena *arena = make_arena(256);
+    Allocator *allocator = &arena->allocator;
+
+    char *first = allocate(allocator, 16);
+    strcpy(first, "hello");
+    char *grown = reallocate(allocator, first, 16, 64);
+    assert(grown == first);
+
+    char *other = allocate(allocator, 8);
+    char *moved = reallocate(allocator, grown, 64, 128);
+    assert(moved != grown && moved != other);
+    assert(strcmp(moved, "hello") == 0);
+
+    // Bigger than a block
+    char *large = allocate_zeroed(allocator, 1000);
+    assert(large[999] == 0);
+
+    cleanup_arena(arena);
+}
+
+TEST_CASE(null_selects_the_pool_allocator)
+{
+    assert(resolve_allocator(NULL) == &pool_allocator);
+    Program *program = make_program(NULL);
+    assert(program->allocator == &pool_allocator);
+    cleanup_program(program);
+
+    char *copy = allocate_str(&libc_allocator, "copied");
+    assert(strcmp(copy, "copied") == 0);
+    deallocate_str(&libc_allocator, copy);
+}
+
+RUN_TESTS()
@@ -0,0 +1,146 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "jit.h"
+#include "object.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "transpiler.h"
+#include "vm.h"
+#include <assert.h>
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// The same programs on the VM, the VM with the JIT and compiled ahead of time through C. The
+// generated code is built as a shared object and run in-process so only execution is timed.
+
+#define ROUNDS 5
+#define AOT_CC "gcc -O2 -w -shared -fPIC -DAOT_NO_MAIN -I src"
+
+typedef bool (*AotRunFn)(Value *result, char *error, size_t error_size);
+
+typedef struct Benchmark {
+    const char *name;
+    char *input;
+} Benchmark;
+
+static Program *parse(Parser *parser)
+{
+    Program *program = parse_program(parser);
+    assert(parser->errors->size == 0);
+    optimize_program(program);
+    return program;
+}
+
+// Returns the fastest of ROUNDS runs in nanoseconds and the result of the last one
+static uint64_t time_vm(char *input, bool jit, int64_t *result)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < ROUNDS; i++) {
+        Parser *parser = make_parser(input, NULL);
+        Program *program = parse(parser);
+        Heap *heap = make_heap();
+        Compiler *compiler = make_compiler(heap);
+        FunctionProto *main = compile_program(compiler, program);
+        assert(main != NULL);
+        VM *vm = make_vm(heap, compiler->constants);
+        vm->jit_enabled = jit;
+
+        uint64_t start = now_ns();
+        VMResult status = run_vm(vm, main);
+        uint64_t elapsed = now_ns() - start;
+        assert(status == VM_OK);
+        (void)status;
+        best = elapsed < best ? elapsed : best;
+        *result = AS_INT(get_last_popped(vm));
+
+        cleanup_vm(vm);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+    return best;
+}
+
+// Also reports how long transpiling and building took
+static uint64_t time_aot(char *input, int64_t *result, uint64_t *build_ns)
+{
+    uint64_t build_start = now_ns();
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse(parser);
+    Transpiler *transpiler = make_transpiler();
+    char *source = transpile_program(transpiler, program);
+    assert(source != NULL);
+
+    char directory[] = "/tmp/monkey_aot_bench_XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/program.c", directory);
+    FILE *file = fopen(path, "w");
+    fputs(source, file);
+    fclose(file);
+
+    char command[1024];
+    snprintf(command, sizeof(command), AOT_CC " %s/program.c -o %s/program.so", directory, directory);
+    int status = system(command);
+    assert(status == 0);
+    (void)status;
+    snprintf(path, sizeof(path), "%s/program.so", directory);
+    void *library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    assert(library != NULL);
+    AotRunFn run = (AotRunFn)dlsym(library, "aot_run");
+    assert(run != NULL);
+    *build_ns = now_ns() - build_start;
+
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < ROUNDS; i++) {
+        Value value;
+        char error[256];
+        uint64_t start = now_ns();
+        bool ok = run(&value, error, sizeof(error));
+        uint64_t elapsed = now_ns() - start;
+        assert(ok);
+        (void)ok;
+        best = elapsed < best ? elapsed : best;
+        *result = AS_INT(value);
+    }
+
+    dlclose(library);
+    snprintf(command, sizeof(command), "rm -rf %s", directory);
+    system(command);
+    free(source);
+    cleanup_transpiler(transpiler);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return best;
+}
+
+int main(void)
+{
+    Benchmark benchmarks[] = {
+        { "fib(27)", "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(27)" },
+        { "tak(18, 12, 6)", "let tak = fn(x, y, z) { if (y < x) { tak(tak(x - 1, y, z), tak(y - 1, z, x), tak(z - 1, x, y)) } else { z } }; tak(18, 12, 6)" },
+        { "tail loop 10^6", "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + n) } }; count(1000000, 0)" },
+        { "while loop 10^6", "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; let s = s + i; } s }; let rep = fn(k) { if (k == 0) { 0 } else { sum(1000) + rep(k - 1) } }; rep(1000)" },
+        { "closures x300000", "let adder = fn(a) { fn(b) { a + b } }; let sum = fn(n, acc) { if (n == 0) { acc } else { sum(n - 1, adder(n)(acc)) } }; let rep = fn(k) { if (k == 0) { 0 } else { sum(3000, 0) + rep(k - 1) } }; rep(100)" },
+    };
+
+    if (!JIT_AVAILABLE) {
+        printf("JIT not available in this build, the JIT column is interpreted\n");
+    }
+    printf("%-18s %9s %9s %9s %10s %10s\n", "benchmark", "VM ms", "JIT ms", "AOT ms", "AOT speedup", "build ms");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        int64_t vm_result, jit_result, aot_result;
+        uint64_t build;
+        uint64_t vm = time_vm(benchmarks[i].input, FALSE, &vm_result);
+        uint64_t jit = time_vm(benchmarks[i].input, TRUE, &jit_result);
+        uint64_t aot = time_aot(benchmarks[i].input, &aot_result, &build);
+        assert(vm_result == jit_result && vm_result == aot_result);
+        printf("%-18s %9.2f %9.2f %9.2f %10.1fx %10.0f\n", benchmarks[i].name, vm / 1e6, jit / 1e6, aot / 1e6,
+            (double)vm / aot, build / 1e6);
+    }
+    return 0;
+}
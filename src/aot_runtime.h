@@ -0,0 +1,555 @@
+#ifndef AOT_RUNTIME_H
+#define AOT_RUNTIME_H
+
+// Runtime support for C files generated by the transpiler (see transpiler.h). It is only ever
+// included by a generated file, so it defines everything itself and the generated program needs
+// nothing but this directory on the include path:
+//
+//     gcc -O2 -I src program.c -o program
+//     gcc -O2 -I src -shared -fPIC -DAOT_NO_MAIN program.c -o program.so
+//
+// Values use the same representation as the VM and runtime errors carry the VM's messages.
+// Closures, captured variables, bignums, strings and collections are never freed, there is no garbage
+// collector.
+
+#include "bigint.h"
+#include "builtins.h"
+#include "number.h"
+#include "object.h"
+#include "persistent.h"
+#include "string_object.h"
+#include "vm.h"
+#include <inttypes.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define AOT_MAX_DEPTH (MAX_FRAMES - 1) // The VM's top-level code takes up a frame too
+#define AOT_ERROR_SIZE 256
+#define AOT_CHUNK_SIZE (64 * 1024)
+
+typedef struct AotClosure AotClosure;
+typedef Value (*AotFn)(AotClosure *self, Value *args);
+
+// Variables some closure captures live in a heap cell instead of a C local, so every closure
+// made by one call of the enclosing function shares them
+struct AotClosure {
+    Object obj;
+    AotFn fn;
+    const char *name;
+    int num_parameters;
+    int num_upvalues;
+    Value *upvalues[];
+};
+
+static Value aot_last; // Value of the last expression statement, like the VM's last popped value
+static int aot_depth;
+
+// A function ending in a call hands the callee and arguments back to aot_call instead of making
+// the call itself, so tail recursion does not grow the C stack
+static AotClosure *aot_tail_callee;
+static Value aot_tail_args[UINT8_MAX + 1];
+static jmp_buf *aot_error_handler;
+static char aot_error_message[AOT_ERROR_SIZE];
+
+static uint8_t *aot_chunk;
+static size_t aot_chunk_left;
+
+// Defined by the generated file
+static void aot_program(void);
+
+// Compiled into the generated program too, so building it stays a single command
+#include "bigint.c"
+#include "builtins.c"
+#include "number.c"
+#include "packed.c"
+#include "persistent.c"
+#include "string_object.c"
+
+static void *aot_alloc(size_t size)
+{
+    size = (size + 15) & ~(size_t)15;
+    if (size > aot_chunk_left) {
+        size_t chunk_size = size > AOT_CHUNK_SIZE ? size : AOT_CHUNK_SIZE;
+        aot_chunk = malloc(chunk_size);
+        aot_chunk_left = chunk_size;
+    }
+    void *ptr = aot_chunk;
+    aot_chunk += size;
+    aot_chunk_left -= size;
+    return ptr;
+}
+
+static void *aot_alloc_object(void *user, size_t size)
+{
+    (void)user;
+    return aot_alloc(size);
+}
+
+static Allocator aot_allocator = { .alloc = aot_alloc_object };
+
+// String literals, made once per run. Equal literals share one, like they share a VM constant.
+static inline Value aot_string(const char *chars, size_t length)
+{
+    return string_from_chars(chars, length, &aot_allocator);
+}
+
+__attribute__((noreturn, format(printf, 1, 2))) static void aot_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vsnprintf(aot_error_message, sizeof(aot_error_message), format, args);
+    va_end(args);
+    longjmp(*aot_error_handler, 1);
+}
+
+static const char *aot_type_name(Value value)
+{
+    switch (value.type) {
+    case VAL_NULL:
+        return "NULL";
+    case VAL_BOOL:
+        return "BOOLEAN";
+    case VAL_INT:
+        return "INTEGER";
+    case VAL_FLOAT:
+        return "FLOAT";
+    case VAL_OBJ:
+        switch (AS_OBJ(value)->type) {
+        case OBJ_BIGINT:
+            return "INTEGER";
+        case OBJ_ARRAY:
+            return "ARRAY";
+        case OBJ_HASH:
+            return "HASH";
+        case OBJ_BUILTIN:
+            return "BUILTIN";
+        case OBJ_STRING:
+        case OBJ_ROPE:
+            return "STRING";
+        default:
+            return "FUNCTION";
+        }
+    }
+    return "UNKNOWN";
+}
+
+static inline bool aot_truthy(Value value)
+{
+    return value.type == VAL_BOOL ? AS_BOOL(value) : value.type != VAL_NULL;
+}
+
+static inline bool aot_equal(Value a, Value b)
+{
+    if (a.type != b.type) {
+        return (IS_FLOAT(a) || IS_FLOAT(b)) && IS_NUMBER(a) && IS_NUMBER(b) && compare_numbers(a, b) == 0;
+    }
+    switch (a.type) {
+    case VAL_NULL:
+        return TRUE;
+    case VAL_BOOL:
+        return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
+    case VAL_FLOAT:
+        return AS_FLOAT(a) == AS_FLOAT(b);
+    default:
+        if (IS_BIGINT(a) && IS_BIGINT(b)) {
+            return bigint_equal(AS_BIGINT(a), AS_BIGINT(b));
+        }
+        if (IS_STRING(a) && IS_STRING(b)) {
+            return strings_equal(a, b);
+        }
+        return AS_OBJ(a) == AS_OBJ(b);
+    }
+}
+
+__attribute__((noreturn, cold)) static void aot_operand_error(Value left, const char *op, Value right)
+{
+    if (left.type != right.type) {
+        aot_error("type mismatch: %s %s %s", aot_type_name(left), op, aot_type_name(right));
+    }
+    aot_error("unknown operator: %s %s %s", aot_type_name(left), op, aot_type_name(right));
+}
+
+// Bignum operands and int64_t results that would overflow, float operands and string concatenation
+typedef Value (*AotBigintFn)(Value left, Value right, Allocator *allocator);
+
+__attribute__((noinline)) static Value aot_bigint(AotBigintFn fn, Value left, const char *op, Value right)
+{
+    if ((IS_FLOAT(left) || IS_FLOAT(right)) && IS_NUMBER(left) && IS_NUMBER(right)) {
+        double a = number_to_double(left);
+        double b = number_to_double(right);
+        return FLOAT_VAL(fn == bigint_add ? a + b : fn == bigint_sub ? a - b : fn == bigint_mul ? a * b : a / b);
+    }
+    if (fn == bigint_add && IS_STRING(left) && IS_STRING(right)) {
+        size_t length = (size_t)string_length(left) + string_length(right);
+        if (length > MAX_STRING_LENGTH) {
+            aot_error("string too long: %zu bytes", length);
+        }
+        return string_concat(left, right, &aot_allocator);
+    }
+    if (!IS_INTEGER(left) || !IS_INTEGER(right)) {
+        aot_operand_error(left, op, right);
+    }
+    if (fn == bigint_div && IS_INT(right) && AS_INT(right) == 0) {
+        aot_error("division by zero");
+    }
+    return fn(left, right, &aot_allocator);
+}
+
+static inline Value aot_add(Value left, Value right)
+{
+    int64_t result;
+    if (!IS_INT(left) || !IS_INT(right) || __builtin_add_overflow(AS_INT(left), AS_INT(right), &result)) {
+        return aot_bigint(bigint_add, left, "+", right);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value aot_sub(Value left, Value right)
+{
+    int64_t result;
+    if (!IS_INT(left) || !IS_INT(right) || __builtin_sub_overflow(AS_INT(left), AS_INT(right), &result)) {
+        return aot_bigint(bigint_sub, left, "-", right);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value aot_mul(Value left, Value right)
+{
+    int64_t result;
+    if (!IS_INT(left) || !IS_INT(right) || __builtin_mul_overflow(AS_INT(left), AS_INT(right), &result)) {
+        return aot_bigint(bigint_mul, left, "*", right);
+    }
+    return INT_VAL(result);
+}
+
+static inline Value aot_div(Value left, Value right)
+{
+    if (!IS_INT(left) || !IS_INT(right) || AS_INT(right) == 0 || (AS_INT(left) == INT64_MIN && AS_INT(right) == -1)) {
+        return aot_bigint(bigint_div, left, "/", right);
+    }
+    return INT_VAL(AS_INT(left) / AS_INT(right));
+}
+
+static inline Value aot_greater(Value left, Value right)
+{
+    if (!IS_INT(left) || !IS_INT(right)) {
+        if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+            aot_error("unknown operator: %s > %s", aot_type_name(left), aot_type_name(right));
+        }
+        return BOOL_VAL(compare_numbers(left, right) == 1);
+    }
+    return BOOL_VAL(AS_INT(left) > AS_INT(right));
+}
+
+static inline Value aot_neg(Value operand)
+{
+    if (!IS_INT(operand) || AS_INT(operand) == INT64_MIN) {
+        if (IS_FLOAT(operand)) {
+            return FLOAT_VAL(-AS_FLOAT(operand));
+        }
+        if (!IS_INTEGER(operand)) {
+            aot_error("unknown operator: -%s", aot_type_name(operand));
+        }
+        return bigint_neg(operand, &aot_allocator);
+    }
+    return INT_VAL(-AS_INT(operand));
+}
+
+static inline Value *aot_cell(Value value)
+{
+    Value *cell = aot_alloc(sizeof(Value));
+    *cell = value;
+    return cell;
+}
+
+static inline AotClosure *aot_closure(AotFn fn, const char *name, int num_parameters, int num_upvalues)
+{
+    AotClosure *closure = aot_alloc(sizeof(AotClosure) + num_upvalues * sizeof(Value *));
+    closure->obj = (Object) { .type = OBJ_CLOSURE };
+    closure->fn = fn;
+    closure->name = name;
+    closure->num_parameters = num_parameters;
+    closure->num_upvalues = num_upvalues;
+    return closure;
+}
+
+static inline Value aot_array(const Value *elements, size_t count)
+{
+    return make_array(elements, count, &aot_allocator);
+}
+
+static inline Value aot_check_key(Value key)
+{
+    if (!is_hashable(key)) {
+        aot_error("unusable as hash key: %s", aot_type_name(key));
+    }
+    return key;
+}
+
+// `pairs` holds each key followed by its value
+static Value aot_hash(const Value *pairs, size_t num_pairs)
+{
+    for (size_t i = 0; i < num_pairs; i++) {
+        aot_check_key(pairs[2 * i]);
+    }
+    Value hash = make_hash(&aot_allocator);
+    for (size_t i = 0; i < num_pairs; i++) {
+        hash = hash_put(AS_HASH(hash), pairs[2 * i], pairs[2 * i + 1], &aot_allocator);
+    }
+    return hash;
+}
+
+static Value aot_index(Value left, Value index)
+{
+    if (IS_ARRAY(left)) {
+        if (!IS_INTEGER(index)) {
+            aot_error("index operator not supported: %s[%s]", aot_type_name(left), aot_type_name(index));
+        }
+        Array *array = AS_ARRAY(left);
+        bool in_range = IS_INT(index) && AS_INT(index) >= 0 && (uint64_t)AS_INT(index) < array->count;
+        return in_range ? array_get(array, (size_t)AS_INT(index)) : NULL_VAL;
+    }
+    if (IS_HASH(left)) {
+        Value value;
+        return hash_get(AS_HASH(left), aot_check_key(index), &value) ? value : NULL_VAL;
+    }
+    if (IS_STRING(left)) {
+        if (!IS_INTEGER(index)) {
+            aot_error("index operator not supported: %s[%s]", aot_type_name(left), aot_type_name(index));
+        }
+        bool in_range = IS_INT(index) && AS_INT(index) >= 0 && (uint64_t)AS_INT(index) < string_length(left);
+        return in_range ? char_string(string_flatten(left, &aot_allocator)->chars[AS_INT(index)]) : NULL_VAL;
+    }
+    aot_error("index operator not supported: %s", aot_type_name(left));
+}
+
+static Value aot_array_argument(Builtin *builtin, Value argument)
+{
+    if (!IS_ARRAY(argument)) {
+        aot_error("argument to `%s` must be ARRAY, got %s", builtin->name, aot_type_name(argument));
+    }
+    return argument;
+}
+
+static inline Value aot_call(Value callee, int num_arguments, Value *args);
+
+// `sum`, `min` and `max`, with the vector kernels on packed arrays. Integers and floats mix as they
+// do in arithmetic and comparisons.
+static Value aot_fold_numbers(Builtin *builtin, Array *array)
+{
+    int64_t sum;
+    if (array->packed && builtin->id != BUILTIN_SUM) {
+        return array->count == 0 ? NULL_VAL : INT_VAL(builtin->id == BUILTIN_MIN ? packed_array_min(array) : packed_array_max(array));
+    }
+    if (array->packed && packed_array_sum(array, &sum)) {
+        return INT_VAL(sum);
+    }
+    Value result = builtin->id == BUILTIN_SUM ? INT_VAL(0) : NULL_VAL;
+    for (size_t i = 0; i < array->count; i++) {
+        Value element = array_get(array, i);
+        if (!IS_NUMBER(element)) {
+            aot_error("elements of `%s` argument must be INTEGER or FLOAT, got %s", builtin->name, aot_type_name(element));
+        }
+        if (builtin->id == BUILTIN_SUM) {
+            result = aot_add(result, element);
+        } else if (IS_NULL(result) || AS_BOOL(builtin->id == BUILTIN_MIN ? aot_greater(result, element) : aot_greater(element, result))) {
+            result = element;
+        }
+    }
+    return result;
+}
+
+// `map` and `filter` call the function for every element, there is no bytecode to recognize
+// lambdas the vector kernels could run from
+static Value aot_map_array(Builtin *builtin, Array *array, Value function)
+{
+    Value result = make_array(NULL, 0, &aot_allocator);
+    for (size_t i = 0; i < array->count; i++) {
+        Value element = array_get(array, i);
+        Value mapped = aot_call(function, 1, &element);
+        if (builtin->id == BUILTIN_MAP) {
+            result = array_push(AS_ARRAY(result), mapped, &aot_allocator);
+        } else if (aot_truthy(mapped)) {
+            result = array_push(AS_ARRAY(result), element, &aot_allocator);
+        }
+    }
+    return result;
+}
+
+// Body of the closures standing in for builtins, which are named after them
+static Value aot_run_builtin(AotClosure *self, Value *args)
+{
+    Builtin *builtin = &builtins[lookup_builtin(self->name)];
+    switch (builtin->id) {
+    case BUILTIN_LEN:
+        if (IS_ARRAY(args[0])) {
+            return INT_VAL((int64_t)AS_ARRAY(args[0])->count);
+        }
+        if (IS_HASH(args[0])) {
+            return INT_VAL((int64_t)AS_HASH(args[0])->count);
+        }
+        if (IS_STRING(args[0])) {
+            return INT_VAL((int64_t)string_length(args[0]));
+        }
+        aot_error("argument to `len` not supported, got %s", aot_type_name(args[0]));
+    case BUILTIN_FIRST: {
+        Array *array = AS_ARRAY(aot_array_argument(builtin, args[0]));
+        return array->count > 0 ? array_get(array, 0) : NULL_VAL;
+    }
+    case BUILTIN_LAST: {
+        Array *array = AS_ARRAY(aot_array_argument(builtin, args[0]));
+        return array->count > 0 ? array_get(array, array->count - 1) : NULL_VAL;
+    }
+    case BUILTIN_REST: {
+        Array *array = AS_ARRAY(aot_array_argument(builtin, args[0]));
+        return array->count > 0 ? array_slice(array, 1, array->count, &aot_allocator) : NULL_VAL;
+    }
+    case BUILTIN_SLICE: {
+        Array *array = AS_ARRAY(aot_array_argument(builtin, args[0]));
+        if (!IS_INTEGER(args[1]) || !IS_INTEGER(args[2])) {
+            aot_error("bounds of `slice` must be INTEGER, got %s", aot_type_name(IS_INTEGER(args[1]) ? args[2] : args[1]));
+        }
+        return array_slice(array, array_bound(args[1], array->count), array_bound(args[2], array->count), &aot_allocator);
+    }
+    case BUILTIN_PUSH:
+        return array_push(AS_ARRAY(aot_array_argument(builtin, args[0])), args[1], &aot_allocator);
+    case BUILTIN_PUT:
+        if (!IS_HASH(args[0])) {
+            aot_error("argument to `put` must be HASH, got %s", aot_type_name(args[0]));
+        }
+        return hash_put(AS_HASH(args[0]), aot_check_key(args[1]), args[2], &aot_allocator);
+    case BUILTIN_SUM:
+    case BUILTIN_MIN:
+    case BUILTIN_MAX:
+        return aot_fold_numbers(builtin, AS_ARRAY(aot_array_argument(builtin, args[0])));
+    case BUILTIN_MAP:
+    case BUILTIN_FILTER:
+        return aot_map_array(builtin, AS_ARRAY(aot_array_argument(builtin, args[0])), args[1]);
+    default:
+        aot_error("unknown builtin: %s", builtin->name);
+    }
+}
+
+// Builtins are called through a closure made for each of them, so calls to them take the same
+// path as calls to closures and the check for them stays off that path
+__attribute__((noinline, cold)) static AotClosure *aot_builtin_closure(Value callee)
+{
+    static AotClosure *closures[NUM_BUILTINS];
+    if (!IS_BUILTIN(callee)) {
+        aot_error("calling non-function: %s", aot_type_name(callee));
+    }
+    Builtin *builtin = AS_BUILTIN(callee);
+    if (closures[builtin->id] == NULL) {
+        closures[builtin->id] = aot_closure(aot_run_builtin, builtin->name, builtin->num_parameters, 0);
+    }
+    return closures[builtin->id];
+}
+
+static inline AotClosure *aot_check_callee(Value callee, int num_arguments)
+{
+    AotClosure *closure = IS_CLOSURE(callee) ? (AotClosure *)AS_OBJ(callee) : aot_builtin_closure(callee);
+    if (num_arguments != closure->num_parameters) {
+        aot_error("wrong number of arguments: want=%d, got=%d", closure->num_parameters, num_arguments);
+    }
+    return closure;
+}
+
+static inline Value aot_call(Value callee, int num_arguments, Value *args)
+{
+    AotClosure *closure = aot_check_callee(callee, num_arguments);
+    if (aot_depth == AOT_MAX_DEPTH) {
+        aot_error("stack overflow");
+    }
+    aot_depth++;
+    Value result = closure->fn(closure, args);
+    // Functions read their arguments on entry, so the shared argument buffer can be passed on
+    while (aot_tail_callee != NULL) {
+        closure = aot_tail_callee;
+        aot_tail_callee = NULL;
+        result = closure->fn(closure, aot_tail_args);
+    }
+    aot_depth--;
+    return result;
+}
+
+// Returned by a function in place of the result of its tail call
+static inline Value aot_tail_call(Value callee, int num_arguments, Value *args)
+{
+    aot_tail_callee = aot_check_callee(callee, num_arguments);
+    memcpy(aot_tail_args, args, num_arguments * sizeof(Value));
+    return NULL_VAL;
+}
+
+// Formats a value the way the VM's inspect_value does, the caller frees the result
+char *aot_inspect(Value value)
+{
+    char buffer[64];
+    switch (value.type) {
+    case VAL_NULL:
+        return strdup("null");
+    case VAL_BOOL:
+        return strdup(AS_BOOL(value) ? "true" : "false");
+    case VAL_INT:
+        snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value));
+        return strdup(buffer);
+    case VAL_FLOAT:
+        format_double(AS_FLOAT(value), buffer, sizeof(buffer));
+        return strdup(buffer);
+    default:
+        if (IS_BIGINT(value)) {
+            return bigint_to_str(value);
+        }
+        if (IS_ARRAY(value) || IS_HASH(value)) {
+            return collection_to_str(value, aot_inspect);
+        }
+        if (IS_STRING(value)) {
+            return string_to_str(value);
+        }
+        if (IS_BUILTIN(value)) {
+            snprintf(buffer, sizeof(buffer), "builtin %s", AS_BUILTIN(value)->name);
+            return strdup(buffer);
+        }
+        snprintf(buffer, sizeof(buffer), "fn %s[%p]", ((AotClosure *)AS_OBJ(value))->name, (void *)AS_OBJ(value));
+        return strdup(buffer);
+    }
+}
+
+// Runs the program once. Returns FALSE and copies the message into `error` on a runtime error.
+bool aot_run(Value *result, char *error, size_t error_size)
+{
+    jmp_buf handler;
+    aot_error_handler = &handler;
+    aot_last = NULL_VAL;
+    aot_depth = 0;
+    aot_tail_callee = NULL;
+    if (setjmp(handler) != 0) {
+        snprintf(error, error_size, "%s", aot_error_message);
+        return FALSE;
+    }
+    aot_program();
+    *result = aot_last;
+    return TRUE;
+}
+
+#ifndef AOT_NO_MAIN
+int main(void)
+{
+    Value result;
+    char error[AOT_ERROR_SIZE];
+    if (!aot_run(&result, error, sizeof(error))) {
+        printf("Runtime error: %s\n", error);
+        return 1;
+    }
+    char *inspected = aot_inspect(result);
+    printf("%s\n", inspected);
+    free(inspected);
+    return 0;
+}
+#endif
+
+#endif // AOT_RUNTIME_H
@@ -1,9 +1,11 @@
 #include "arrlist_utils.h"
 #include <stddef.h>
 
-void *realloc_backing_array(void *array, size_t current_size, size_t new_capacity, size_t type_size)
+// Grows an array that came from `allocator` and zeroes everything past `current_size`. The allocator needs the
+// old capacity to know how big the block is.
+void *realloc_backing_array(Allocator *allocator, void *array, size_t current_size, size_t current_capacity, size_t new_capacity, size_t type_size)
 {
-    void *new_array = realloc(array, new_capacity * type_size);
-    memset(new_array + current_size, 0, (new_capacity - current_size) * type_size);
+    void *new_array = reallocate(resolve_allocator(allocator), array, current_capacity * type_size, new_capacity * type_size);
+    memset((char *)new_array + current_size * type_size, 0, (new_capacity - current_size) * type_size);
     return new_array;
 }
@@ -1,10 +1,11 @@
 #ifndef ARRLIST_UTILS_H
 #define ARRLIST_UTILS_H
 
+#include "allocator.h"
 #include <memory.h>
 #include <stddef.h>
 #include <stdlib.h>
 
-void *realloc_backing_array(void *array, size_t current_size, size_t new_capacity, size_t type_size);
+void *realloc_backing_array(Allocator *allocator, void *array, size_t current_size, size_t current_capacity, size_t new_capacity, size_t type_size);
 
 #endif // ARRLIST_UTILS_H
@@ -8,12 +8,14 @@
 #include <stdlib.h>
 
 #define INITIAL_CAPACITY 50
+#define INITIAL_CHUNK_CAPACITY 16
+#define INITIAL_PTR_LIST_CAPACITY 4
 
 ASTNode *make_ast_node(ASTNodeArrayList *list)
 {
     ASTNode *ast_node;
     if (list == NULL) {
-        ast_node = (ASTNode *)malloc(sizeof(ASTNode));
+        ast_node = (ASTNode *)allocate(resolve_allocator(NULL), sizeof(ASTNode));
     } else {
         ast_node = alloc_node_in_list(list);
     }
@@ -25,25 +27,25 @@ void cleanup_ast_node(ASTNode *node)
     if (node == NULL) {
         return;
     }
-    free(node);
+    deallocate(resolve_allocator(NULL), node, sizeof(ASTNode));
 }
 
-ASTNodeArrayList *make_ast_node_array_list(void)
+ASTNodeArrayList *make_ast_node_array_list(Allocator *allocator)
 {
-    ASTNodeArrayList *list = (ASTNodeArrayList *)malloc(sizeof(ASTNodeArrayList));
-    list->array = (ASTNode *)calloc(INITIAL_CAPACITY, sizeof(ASTNode));
+    allocator = resolve_allocator(allocator);
+    ASTNodeArrayList *list = (ASTNodeArrayList *)allocate(allocator, sizeof(ASTNodeArrayList));
+    list->allocator = allocator;
+    list->chunks = (ASTNode **)allocate_zeroed(allocator, INITIAL_CHUNK_CAPACITY * sizeof(ASTNode *));
+    list->num_chunks = 0;
     list->size = 0;
-    list->capacity = INITIAL_CAPACITY;
+    list->capacity = 0;
     return list;
 }
 
 void add_ast_node_to_list(ASTNodeArrayList *list, ASTNode *node)
 {
-    if (list->size == list->capacity) {
-        list->capacity *= 2;
-        list->array = (ASTNode *)realloc_backing_array(list->array, list->size, list->capacity, sizeof(ASTNode));
-    }
-    list->array[list->size++] = *node;
+    ASTNode *new_node = alloc_node_in_list(list);
+    *new_node = *node;
 }
 
 ASTNode *get_ast_node_from_list(ASTNodeArrayList *list, size_t index)
@@ -52,7 +54,7 @@ ASTNode *get_ast_node_from_list(ASTNodeArrayList *list, size_t index)
         printf("Index out of bounds\n");
         return NULL;
     }
-    return &list->array[index];
+    return &list->chunks[index / AST_NODE_CHUNK_SIZE][index % AST_NODE_CHUNK_SIZE];
 }
 
 void set_ast_node_in_list(ASTNodeArrayList *list, size_t index, ASTNode *node)
@@ -61,28 +63,107 @@ void set_ast_node_in_list(ASTNodeArrayList *list, size_t index, ASTNode *node)
         printf("Index out of bounds\n");
         return;
     }
-    list->array[index] = *node;
+    list->chunks[index / AST_NODE_CHUNK_SIZE][index % AST_NODE_CHUNK_SIZE] = *node;
+}
+
+// The chunk table starts with INITIAL_CHUNK_CAPACITY entries and doubles whenever it fills up
+static size_t chunk_table_capacity(size_t num_chunks)
+{
+    size_t capacity = INITIAL_CHUNK_CAPACITY;
+    while (capacity < num_chunks) {
+        capacity *= 2;
+    }
+    return capacity;
 }
 
 ASTNode *alloc_node_in_list(ASTNodeArrayList *list)
 {
     if (list->size == list->capacity) {
-        list->capacity *= 2;
-        list->array = (ASTNode *)realloc_backing_array(list->array, list->size, list->capacity, sizeof(ASTNode));
+        // The chunk table starts with INITIAL_CHUNK_CAPACITY entries and doubles, so it is full at powers of two
+        bool chunk_table_full = list->num_chunks >= INITIAL_CHUNK_CAPACITY && (list->num_chunks & (list->num_chunks - 1)) == 0;
+        if (chunk_table_full) {
+            list->chunks = (ASTNode **)realloc_backing_array(list->allocator, list->chunks, list->num_chunks, list->num_chunks, list->num_chunks * 2, sizeof(ASTNode *));
+        }
+        list->chunks[list->num_chunks++] = (ASTNode *)allocate_zeroed(list->allocator, AST_NODE_CHUNK_SIZE * sizeof(ASTNode));
+        list->capacity += AST_NODE_CHUNK_SIZE;
+    }
+    size_t index = list->size++;
+    return &list->chunks[index / AST_NODE_CHUNK_SIZE][index % AST_NODE_CHUNK_SIZE];
+}
+
+// Frees the heap storage a node owns besides the nodes it points to (those live in the same list)
+static void release_node_storage(ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_BLOCK_STMT:
+        cleanup_ast_node_ptr_list(node->data.block_stmt);
+        break;
+    case NODE_FUNCTION_LITERAL:
+        cleanup_ast_node_ptr_list(node->data.function_literal.parameters);
+        free(node->data.function_literal.upvalues);
+        break;
+    case NODE_CALL_EXPR:
+        cleanup_ast_node_ptr_list(node->data.call_expr.arguments);
+        break;
+    case NODE_ARRAY_LITERAL:
+        cleanup_ast_node_ptr_list(node->data.array_literal);
+        break;
+    case NODE_HASH_LITERAL:
+        cleanup_ast_node_ptr_list(node->data.hash_literal.keys);
+        cleanup_ast_node_ptr_list(node->data.hash_literal.values);
+        break;
+    default:
+        break;
     }
-    return &list->array[list->size++];
 }
 
 void cleanup_ast_node_list(ASTNodeArrayList *list)
 {
-    free(list->array);
-    free(list);
+    for (size_t i = 0; i < list->size; i++) {
+        release_node_storage(&list->chunks[i / AST_NODE_CHUNK_SIZE][i % AST_NODE_CHUNK_SIZE]);
+    }
+    for (size_t i = 0; i < list->num_chunks; i++) {
+        deallocate(list->allocator, list->chunks[i], AST_NODE_CHUNK_SIZE * sizeof(ASTNode));
+    }
+    deallocate(list->allocator, list->chunks, chunk_table_capacity(list->num_chunks) * sizeof(ASTNode *));
+    deallocate(list->allocator, list, sizeof(ASTNodeArrayList));
+}
+
+ASTNodePtrArrayList *make_ast_node_ptr_array_list(Allocator *allocator)
+{
+    allocator = resolve_allocator(allocator);
+    ASTNodePtrArrayList *list = (ASTNodePtrArrayList *)allocate(allocator, sizeof(ASTNodePtrArrayList));
+    list->allocator = allocator;
+    list->array = (ASTNode **)allocate_zeroed(allocator, INITIAL_PTR_LIST_CAPACITY * sizeof(ASTNode *));
+    list->size = 0;
+    list->capacity = INITIAL_PTR_LIST_CAPACITY;
+    return list;
 }
 
-Program *make_program(void)
+void add_ast_node_ptr_to_list(ASTNodePtrArrayList *list, ASTNode *node)
 {
-    Program *program = (Program *)malloc(sizeof(Program));
-    program->array = (ASTNode **)calloc(INITIAL_CAPACITY, sizeof(ASTNode *));
+    if (list->size == list->capacity) {
+        list->array = (ASTNode **)realloc_backing_array(list->allocator, list->array, list->size, list->capacity, list->capacity * 2, sizeof(ASTNode *));
+        list->capacity *= 2;
+    }
+    list->array[list->size++] = node;
+}
+
+void cleanup_ast_node_ptr_list(ASTNodePtrArrayList *list)
+{
+    if (list == NULL) {
+        return;
+    }
+    deallocate(list->allocator, list->array, list->capacity * sizeof(ASTNode *));
+    deallocate(list->allocator, list, sizeof(ASTNodePtrArrayList));
+}
+
+Program *make_program(Allocator *allocator)
+{
+    allocator = resolve_allocator(allocator);
+    Program *program = (Program *)allocate(allocator, sizeof(Program));
+    program->allocator = allocator;
+    program->array = (ASTNode **)allocate_zeroed(allocator, INITIAL_CAPACITY * sizeof(ASTNode *));
     program->size = 0;
     program->capacity = INITIAL_CAPACITY;
     return program;
@@ -90,15 +171,15 @@ Program *make_program(void)
 
 void cleanup_program(Program *program)
 {
-    free(program->array);
-    free(program);
+    deallocate(program->allocator, program->array, program->capacity * sizeof(ASTNode *));
+    deallocate(program->allocator, program, sizeof(Program));
 }
 
 void add_ast_node_to_program(Program *program, ASTNode *node)
 {
     if (program->size == program->capacity) {
+        program->array = (ASTNode **)realloc_backing_array(program->allocator, program->array, program->size, program->capacity, program->capacity * 2, sizeof(ASTNode *));
         program->capacity *= 2;
-        program->array = (ASTNode **)realloc_backing_array(program->array, program->size, program->capacity, sizeof(ASTNode *));
     }
     program->array[program->size++] = node;
 }
@@ -114,7 +195,7 @@ char *node_to_str(ASTNode *node)
     if (node == NULL) {
         return NULL;
     }
-    String *string = make_string();
+    String *string = make_string(NULL);
     switch (node->type) {
     case NODE_LET_STMT:
         copy_str_into_string(string, "let ");
@@ -132,8 +213,8 @@ char *node_to_str(ASTNode *node)
     case NODE_RETURN_STMT:
         copy_str_into_string(string, "return ");
 
-        if (node->data.return_stmt->data.expr_stmt) {
-            char *value_str = node_to_str(node->data.return_stmt->data.expr_stmt);
+        if (node->data.return_stmt) {
+            char *value_str = node_to_str(node->data.return_stmt);
             copy_str_into_string(string, value_str);
             free(value_str);
         }
@@ -141,6 +222,7 @@ char *node_to_str(ASTNode *node)
         copy_str_into_string(string, ";");
         break;
     case NODE_EXPR_STMT:
+        cleanup_string(string);
         if (node->data.expr_stmt == NULL) {
             return NULL;
         }
@@ -148,6 +230,7 @@ char *node_to_str(ASTNode *node)
     case NODE_IDENTIFIER:
         ASSERT(node->data.literal.value.identifier, "Null identifier in identifier node");
         ASSERT(node->token_literal, "Null token literal in identifier node");
+        cleanup_string(string);
         return strdup(node->token_literal);
     case NODE_PREFIX_EXPR:
         ASSERT(node->data.prefix_expr.operator, "Null operator in prefix expression");
@@ -184,7 +267,146 @@ char *node_to_str(ASTNode *node)
         free(value_str_right);
         break;
     case NODE_LITERAL:
+        if (node->data.literal.type == LITERAL_STRING) {
+            // As written in the source, escapes included
+            StringSpan span = node->data.literal.value.string_value;
+            char *quoted = malloc(span.length + 3);
+            sprintf(quoted, "\"%.*s\"", (int)span.length, span.start);
+            copy_str_into_string(string, quoted);
+            free(quoted);
+        } else {
+            copy_str_into_string(string, node->token_literal);
+        }
+        break;
+    case NODE_BLOCK_STMT:
+        for (size_t i = 0; i < node->data.block_stmt->size; i++) {
+            char *stmt_str = node_to_str(node->data.block_stmt->array[i]);
+            if (stmt_str) {
+                copy_str_into_string(string, stmt_str);
+                free(stmt_str);
+            }
+        }
+        break;
+    case NODE_IF_EXPR:
+        ASSERT(node->data.if_expr.condition, "Null condition in if expression");
+        ASSERT(node->data.if_expr.consequence, "Null consequence in if expression");
+
+        copy_str_into_string(string, "if");
+        char *condition_str = node_to_str(node->data.if_expr.condition);
+        copy_str_into_string(string, condition_str);
+        copy_str_into_string(string, " ");
+        char *consequence_str = node_to_str(node->data.if_expr.consequence);
+        copy_str_into_string(string, consequence_str);
+
+        if (node->data.if_expr.alternative) {
+            copy_str_into_string(string, "else ");
+            char *alternative_str = node_to_str(node->data.if_expr.alternative);
+            copy_str_into_string(string, alternative_str);
+            free(alternative_str);
+        }
+
+        free(condition_str);
+        free(consequence_str);
+        break;
+    case NODE_FUNCTION_LITERAL:
         copy_str_into_string(string, node->token_literal);
+        copy_str_into_string(string, "(");
+        for (size_t i = 0; i < node->data.function_literal.parameters->size; i++) {
+            if (i > 0) {
+                copy_str_into_string(string, ", ");
+            }
+            copy_str_into_string(string, node->data.function_literal.parameters->array[i]->token_literal);
+        }
+        copy_str_into_string(string, ") ");
+
+        if (node->data.function_literal.body == NULL) {
+            // Skipped by a lazy parser
+            copy_str_into_string(string, "{...}");
+            break;
+        }
+        char *body_str = node_to_str(node->data.function_literal.body);
+        copy_str_into_string(string, body_str);
+        free(body_str);
+        break;
+    case NODE_CALL_EXPR:
+        ASSERT(node->data.call_expr.function, "Null function in call expression");
+
+        char *function_str = node_to_str(node->data.call_expr.function);
+        copy_str_into_string(string, function_str);
+        free(function_str);
+
+        copy_str_into_string(string, "(");
+        for (size_t i = 0; i < node->data.call_expr.arguments->size; i++) {
+            if (i > 0) {
+                copy_str_into_string(string, ", ");
+            }
+            char *argument_str = node_to_str(node->data.call_expr.arguments->array[i]);
+            copy_str_into_string(string, argument_str);
+            free(argument_str);
+        }
+        copy_str_into_string(string, ")");
+        break;
+    case NODE_WHILE_STMT:
+        ASSERT(node->data.while_stmt.condition, "Null condition in while statement");
+        ASSERT(node->data.while_stmt.body, "Null body in while statement");
+
+        copy_str_into_string(string, "while");
+        char *loop_condition_str = node_to_str(node->data.while_stmt.condition);
+        copy_str_into_string(string, loop_condition_str);
+        copy_str_into_string(string, " ");
+        char *loop_body_str = node_to_str(node->data.while_stmt.body);
+        copy_str_into_string(string, loop_body_str);
+
+        free(loop_condition_str);
+        free(loop_body_str);
+        break;
+    case NODE_BREAK_STMT:
+    case NODE_CONTINUE_STMT:
+        copy_str_into_string(string, node->token_literal);
+        copy_str_into_string(string, ";");
+        break;
+    case NODE_ARRAY_LITERAL:
+        copy_str_into_string(string, "[");
+        for (size_t i = 0; i < node->data.array_literal->size; i++) {
+            if (i > 0) {
+                copy_str_into_string(string, ", ");
+            }
+            char *element_str = node_to_str(node->data.array_literal->array[i]);
+            copy_str_into_string(string, element_str);
+            free(element_str);
+        }
+        copy_str_into_string(string, "]");
+        break;
+    case NODE_HASH_LITERAL:
+        copy_str_into_string(string, "{");
+        for (size_t i = 0; i < node->data.hash_literal.keys->size; i++) {
+            if (i > 0) {
+                copy_str_into_string(string, ", ");
+            }
+            char *key_str = node_to_str(node->data.hash_literal.keys->array[i]);
+            char *pair_value_str = node_to_str(node->data.hash_literal.values->array[i]);
+            copy_str_into_string(string, key_str);
+            copy_str_into_string(string, ": ");
+            copy_str_into_string(string, pair_value_str);
+            free(key_str);
+            free(pair_value_str);
+        }
+        copy_str_into_string(string, "}");
+        break;
+    case NODE_INDEX_EXPR:
+        ASSERT(node->data.index_expr.left, "Null left node in index expression");
+        ASSERT(node->data.index_expr.index, "Null index in index expression");
+
+        copy_str_into_string(string, "(");
+        char *indexed_str = node_to_str(node->data.index_expr.left);
+        copy_str_into_string(string, indexed_str);
+        copy_str_into_string(string, "[");
+        char *index_str = node_to_str(node->data.index_expr.index);
+        copy_str_into_string(string, index_str);
+        copy_str_into_string(string, "])");
+
+        free(indexed_str);
+        free(index_str);
         break;
     default:
         printf("Node type: %d\n", node->type);
@@ -218,10 +440,20 @@ static const char *NODE_TYPE_STR[] = {
     [NODE_INFIX_EXPR] = "INFIX_EXPR",
     [NODE_LITERAL] = "LITERAL",
     [NODE_IDENTIFIER] = "NODE_IDENTIFIER",
+    [NODE_BLOCK_STMT] = "BLOCK_STMT",
+    [NODE_IF_EXPR] = "IF_EXPR",
+    [NODE_FUNCTION_LITERAL] = "FUNCTION_LITERAL",
+    [NODE_CALL_EXPR] = "CALL_EXPR",
+    [NODE_WHILE_STMT] = "WHILE_STMT",
+    [NODE_BREAK_STMT] = "BREAK_STMT",
+    [NODE_CONTINUE_STMT] = "CONTINUE_STMT",
+    [NODE_ARRAY_LITERAL] = "ARRAY_LITERAL",
+    [NODE_HASH_LITERAL] = "HASH_LITERAL",
+    [NODE_INDEX_EXPR] = "INDEX_EXPR",
 };
 
 const char *node_type_to_str(ASTNodeType t)
 {
-    assert(t >= 0 && t <= NODE_IDENTIFIER);
+    assert(t >= 0 && t <= NODE_INDEX_EXPR);
     return NODE_TYPE_STR[t];
 }
@@ -1,6 +1,7 @@
 #ifndef AST_H
 #define AST_H
 
+#include "allocator.h"
 #include "globals.h"
 #include "token.h"
 #include <stddef.h>
@@ -14,7 +15,17 @@ typedef enum ASTNodeType {
     NODE_PREFIX_EXPR,
     NODE_INFIX_EXPR,
     NODE_LITERAL,
-    NODE_IDENTIFIER
+    NODE_IDENTIFIER,
+    NODE_BLOCK_STMT,
+    NODE_IF_EXPR,
+    NODE_FUNCTION_LITERAL,
+    NODE_CALL_EXPR,
+    NODE_WHILE_STMT,
+    NODE_BREAK_STMT,
+    NODE_CONTINUE_STMT,
+    NODE_ARRAY_LITERAL,
+    NODE_HASH_LITERAL,
+    NODE_INDEX_EXPR
 } ASTNodeType;
 
 typedef enum OperatorType {
@@ -27,9 +38,9 @@ typedef enum OperatorType {
 } OperatorType;
 
 typedef union LiteralValue {
-    int int_value;
-    float float_value;
-    char *string_value;
+    int64_t int_value;
+    double float_value;
+    StringSpan string_value; // Points into the source, which must outlive the AST
     char identifier[MAX_IDENTIFIER_SIZE];
     bool boolean_value;
 } LiteralValue;
@@ -47,6 +58,37 @@ typedef struct Literal {
     LiteralType type;
 } Literal;
 
+typedef enum ResolutionScope {
+    SCOPE_UNRESOLVED,
+    SCOPE_GLOBAL,
+    SCOPE_LOCAL,
+    SCOPE_UPVALUE,
+    SCOPE_BUILTIN
+} ResolutionScope;
+
+// Filled in by the resolver. For locals `index` is the slot in the current frame, for globals it is
+// the slot in the global table, for upvalues it is the index into the enclosing closure's upvalues
+// and for builtins it is the BuiltinId.
+// `depth` is how many function boundaries lie between the use and the declaration.
+typedef struct Resolution {
+    ResolutionScope scope;
+    int index;
+    int depth;
+    bool captured; // Only set on declarations: some inner function closes over this variable
+} Resolution;
+
+typedef struct IdentifierExpr {
+    Literal literal; // Must stay the first member so `data.literal` can be used on identifiers too
+    Resolution resolution;
+} IdentifierExpr;
+
+typedef struct ASTNodePtrArrayList {
+    struct ASTNode **array;
+    size_t size;
+    size_t capacity;
+    Allocator *allocator;
+} ASTNodePtrArrayList;
+
 typedef struct PrefixOpExpr {
     Token token;
     struct ASTNode *right;
@@ -65,6 +107,51 @@ typedef struct LetStmt {
     struct ASTNode *right;
 } LetStmt;
 
+typedef struct IfExpr {
+    struct ASTNode *condition;
+    struct ASTNode *consequence;
+    struct ASTNode *alternative;
+} IfExpr;
+
+typedef struct WhileStmt {
+    struct ASTNode *condition;
+    struct ASTNode *body;
+} WhileStmt;
+
+typedef struct UpvalueDescriptor {
+    bool is_local; // Captured from the enclosing function's frame, otherwise from its upvalues
+    int index;
+} UpvalueDescriptor;
+
+typedef struct FunctionLiteral {
+    ASTNodePtrArrayList *parameters;
+    struct ASTNode *body; // NULL if a lazy parser skipped it, see Parser.lazy_functions
+    // For skipped bodies, the source from the opening parenthesis to the closing brace. It points
+    // into the program, which must outlive the function unless it is compiled by then.
+    StringSpan source;
+    // Filled in by the resolver
+    size_t num_locals;
+    UpvalueDescriptor *upvalues;
+    size_t num_upvalues;
+    size_t upvalue_capacity;
+} FunctionLiteral;
+
+typedef struct CallExpr {
+    struct ASTNode *function;
+    ASTNodePtrArrayList *arguments;
+} CallExpr;
+
+// Pairs in source order, `keys->array[i]` maps to `values->array[i]`
+typedef struct HashLiteral {
+    ASTNodePtrArrayList *keys;
+    ASTNodePtrArrayList *values;
+} HashLiteral;
+
+typedef struct IndexExpr {
+    struct ASTNode *left;
+    struct ASTNode *index;
+} IndexExpr;
+
 typedef struct ASTNode {
     union {
         LetStmt let_stmt;
@@ -73,21 +160,37 @@ typedef struct ASTNode {
         PrefixOpExpr prefix_expr;
         InfixOpExpr infix_expr;
         Literal literal;
+        IdentifierExpr identifier;
+        ASTNodePtrArrayList *block_stmt;
+        IfExpr if_expr;
+        FunctionLiteral function_literal;
+        CallExpr call_expr;
+        WhileStmt while_stmt;
+        ASTNodePtrArrayList *array_literal;
+        HashLiteral hash_literal;
+        IndexExpr index_expr;
     } data;
     ASTNodeType type;
     char token_literal[MAX_TOKEN_LITERAL_SIZE];
 } ASTNode;
 
+#define AST_NODE_CHUNK_SIZE 64
+
+// Nodes are handed out by pointer and linked to each other, so the list grows by adding fixed-size
+// chunks instead of reallocating one backing array (which would move every node already handed out)
 typedef struct ASTNodeArrayList {
-    ASTNode *array;
+    ASTNode **chunks;
+    size_t num_chunks;
     size_t size;
     size_t capacity;
+    Allocator *allocator;
 } ASTNodeArrayList;
 
 typedef struct Program {
     ASTNode **array;
     size_t size;
     size_t capacity;
+    Allocator *allocator;
 } Program;
 
 #define ACCESS_INT(lit) ((lit).value.int_value)
@@ -98,7 +201,7 @@ typedef struct Program {
 
 #define COMPARE_INT(lit, exp) ((lit).value.int_value == (exp))
 #define COMPARE_FLOAT(lit, exp) ((lit).value.float_value == (exp))
-#define COMPARE_STRING(lit, exp) (strcmp((lit).value.string_value, (exp)) == 0)
+#define COMPARE_STRING(lit, exp) ((lit).value.string_value.length == strlen(exp) && memcmp((lit).value.string_value.start, (exp), (lit).value.string_value.length) == 0)
 #define COMPARE_IDENTIFIER(lit, exp) (strcmp((lit).value.identifier, (exp)) == 0)
 #define COMPARE_BOOL(lit, exp) ((lit).value.boolean_value == (exp))
 
@@ -112,7 +215,7 @@ typedef struct Program {
 
 // Type-safe comparison macro
 #define COMPARE_LITERAL_VALUE(lit, type, expected)                                                                                           \
-    ((type) == LITERAL_INT ? COMPARE_INT(lit, (int)(expected)) : (type) == LITERAL_FLOAT ? COMPARE_FLOAT(lit, (float)(expected))             \
+    ((type) == LITERAL_INT ? COMPARE_INT(lit, (int64_t)(expected)) : (type) == LITERAL_FLOAT ? COMPARE_FLOAT(lit, (double)(expected))            \
             : (type) == LITERAL_STRING                                                   ? COMPARE_STRING(lit, (const char *)(expected))     \
             : (type) == LITERAL_IDENTIFIER                                               ? COMPARE_IDENTIFIER(lit, (const char *)(expected)) \
             : (type) == LITERAL_BOOL                                                     ? COMPARE_BOOL(lit, (bool)(expected))               \
@@ -121,14 +224,18 @@ typedef struct Program {
 extern ASTNode *make_ast_node(ASTNodeArrayList *list);
 extern void cleanup_ast_node(ASTNode *node);
 
-extern ASTNodeArrayList *make_ast_node_array_list(void);
+extern ASTNodeArrayList *make_ast_node_array_list(Allocator *allocator);
 extern void add_ast_node_to_list(ASTNodeArrayList *list, ASTNode *node);
 extern ASTNode *get_ast_node_from_list(ASTNodeArrayList *list, size_t index);
 extern void set_ast_node_in_list(ASTNodeArrayList *list, size_t index, ASTNode *node);
 extern ASTNode *alloc_node_in_list(ASTNodeArrayList *list);
 extern void cleanup_ast_node_list(ASTNodeArrayList *list);
 
-extern Program *make_program(void);
+extern ASTNodePtrArrayList *make_ast_node_ptr_array_list(Allocator *allocator);
+extern void add_ast_node_ptr_to_list(ASTNodePtrArrayList *list, ASTNode *node);
+extern void cleanup_ast_node_ptr_list(ASTNodePtrArrayList *list);
+
+extern Program *make_program(Allocator *allocator);
 extern void cleanup_program(Program *program);
 extern void add_ast_node_to_program(Program *program, ASTNode *node);
 extern ASTNode *get_nth_statement(Program *program, size_t n);
@@ -2,14 +2,15 @@
 #include "parser.h"
 #include "test_utils.h"
 #include <assert.h>
+#include <stdlib.h>
 #include <string.h>
 
 INIT_TEST_HARNESS()
 
 TEST_CASE(program_to_str)
 {
-    ASTNodeArrayList *node_list = make_ast_node_array_list();
-    Program *program = make_program();
+    ASTNodeArrayList *node_list = make_ast_node_array_list(NULL);
+    Program *program = make_program(NULL);
 
     ASTNode *let_stmt_node = make_ast_node(node_list);
     let_stmt_node->type = NODE_LET_STMT;
@@ -35,7 +36,9 @@ TEST_CASE(program_to_str)
 
     add_ast_node_to_program(program, let_stmt_node);
 
-    assert(strcmp(program_to_str(program), "let myVar = anotherVar;") == 0);
+    char *program_str = program_to_str(program);
+    assert(strcmp(program_str, "let myVar = anotherVar;") == 0);
+    free(program_str);
 
     cleanup_ast_node_list(node_list);
     cleanup_program(program);
@@ -0,0 +1,52 @@
+#ifndef BENCH_UTILS_H
+#define BENCH_UTILS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Size of the buffer bench_identifier writes to, enough for the first 26^7 names
+#define BENCH_IDENTIFIER_SIZE 8
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Writes a distinct name for every `index` to `name` for generated scripts: a, b, ..., z, ab, bb and
+// so on. Identifiers are letters only, so the names count in base 26, lowest digit first.
+static inline void bench_identifier(int index, char name[BENCH_IDENTIFIER_SIZE])
+{
+    int digit = 0;
+    do {
+        name[digit++] = (char)('a' + index % 26);
+        index /= 26;
+    } while (index > 0 && digit < BENCH_IDENTIFIER_SIZE - 1);
+    name[digit] = '\0';
+}
+
+// Returns a script that defines `count` functions, liba to lib<bench_identifier(count - 1)>, each
+// taking two integers through a small loop, followed by `rest`. Compiled, each function takes two
+// constants, itself and the one integer literal of its own.
+static inline char *bench_library_source(int count, const char *rest)
+{
+    size_t size = (size_t)count * 256 + strlen(rest) + 1;
+    char *input = malloc(size);
+    size_t length = 0;
+    for (int i = 0; i < count; i++) {
+        char name[BENCH_IDENTIFIER_SIZE];
+        bench_identifier(i, name);
+        length += snprintf(input + length, size - length,
+            "let lib%s = fn(a, b) { let c = a * b + %d; let xs = [a, b, c, a + c]; let s = 0; let i = 0; "
+            "while (i < len(xs)) { let s = s + xs[i] * b; let i = i + a; } if (s > c) { s - c } else { c - s } };\n",
+            name, i);
+    }
+    snprintf(input + length, size - length, "%s", rest);
+    return input;
+}
+
+#endif // BENCH_UTILS_H
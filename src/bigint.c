@@ -0,0 +1,497 @@
+#include "bigint.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SCRATCH_LIMBS 16
+#define LIMB_SIZE sizeof(uint64_t)
+#define DECIMAL_CHUNK 10000000000000000000u // Largest power of ten in a limb
+#define DECIMAL_CHUNK_DIGITS 19
+
+typedef unsigned __int128 uint128_t;
+
+size_t karatsuba_threshold = DEFAULT_KARATSUBA_THRESHOLD;
+
+// Sign and magnitude of either kind of integer. A VAL_INT's magnitude lives in `small`, so a
+// Magnitude must not be copied once loaded.
+typedef struct Magnitude {
+    const uint64_t *limbs;
+    size_t size;
+    bool negative;
+    uint64_t small;
+} Magnitude;
+
+// Room for intermediate results, on the stack unless they are large
+typedef struct Scratch {
+    uint64_t *limbs;
+    uint64_t inline_limbs[SCRATCH_LIMBS];
+} Scratch;
+
+static void load_magnitude(Value value, Magnitude *magnitude)
+{
+    if (IS_INT(value)) {
+        int64_t integer = AS_INT(value);
+        magnitude->negative = integer < 0;
+        magnitude->small = magnitude->negative ? 0 - (uint64_t)integer : (uint64_t)integer;
+        magnitude->limbs = &magnitude->small;
+        magnitude->size = magnitude->small != 0;
+        return;
+    }
+    BigInt *bigint = AS_BIGINT(value);
+    magnitude->negative = bigint->negative;
+    magnitude->limbs = bigint->limbs;
+    magnitude->size = bigint->num_limbs;
+}
+
+static uint64_t *scratch_limbs(Scratch *scratch, size_t size)
+{
+    scratch->limbs = size <= SCRATCH_LIMBS ? scratch->inline_limbs : malloc(size * LIMB_SIZE);
+    return scratch->limbs;
+}
+
+static void release_scratch(Scratch *scratch)
+{
+    if (scratch->limbs != scratch->inline_limbs) {
+        free(scratch->limbs);
+    }
+}
+
+static size_t normalized_size(const uint64_t *limbs, size_t size)
+{
+    while (size > 0 && limbs[size - 1] == 0) {
+        size--;
+    }
+    return size;
+}
+
+// Both magnitudes must be normalized
+static int compare_magnitudes(const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    if (a_size != b_size) {
+        return a_size < b_size ? -1 : 1;
+    }
+    for (size_t i = a_size; i-- > 0;) {
+        if (a[i] != b[i]) {
+            return a[i] < b[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+// out = a + b over a_size limbs, returning the carry. Needs a_size >= b_size, `out` may be `a`.
+static uint64_t add_limbs(uint64_t *out, const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    uint64_t carry = 0;
+    size_t i = 0;
+    for (; i < b_size; i++) {
+        uint128_t sum = (uint128_t)a[i] + b[i] + carry;
+        out[i] = (uint64_t)sum;
+        carry = (uint64_t)(sum >> 64);
+    }
+    for (; i < a_size; i++) {
+        out[i] = a[i] + carry;
+        carry = carry && out[i] == 0;
+    }
+    return carry;
+}
+
+// out = a - b over a_size limbs, returning the borrow. Needs a_size >= b_size, `out` may be `a`.
+static uint64_t sub_limbs(uint64_t *out, const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    uint64_t borrow = 0;
+    size_t i = 0;
+    for (; i < b_size; i++) {
+        uint64_t difference = a[i] - b[i];
+        uint64_t next_borrow = a[i] < b[i] || difference < borrow;
+        out[i] = difference - borrow;
+        borrow = next_borrow;
+    }
+    for (; i < a_size; i++) {
+        uint64_t next_borrow = borrow && a[i] == 0;
+        out[i] = a[i] - borrow;
+        borrow = next_borrow;
+    }
+    return borrow;
+}
+
+static void multiply_schoolbook(uint64_t *out, const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    memset(out, 0, (a_size + b_size) * LIMB_SIZE);
+    for (size_t i = 0; i < a_size; i++) {
+        uint64_t carry = 0;
+        for (size_t j = 0; j < b_size; j++) {
+            uint128_t product = (uint128_t)a[i] * b[j] + out[i + j] + carry;
+            out[i + j] = (uint64_t)product;
+            carry = (uint64_t)(product >> 64);
+        }
+        out[i + b_size] = carry;
+    }
+}
+
+// out = a * b, filling all a_size + b_size limbs of `out`, which must not overlap the operands
+static void multiply(uint64_t *out, const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    if (a_size < b_size) {
+        const uint64_t *swap = a;
+        a = b;
+        b = swap;
+        size_t swap_size = a_size;
+        a_size = b_size;
+        b_size = swap_size;
+    }
+    // Below four limbs splitting does not make the operands any smaller
+    if (b_size < karatsuba_threshold || b_size < 4) {
+        multiply_schoolbook(out, a, a_size, b, b_size);
+        return;
+    }
+
+    size_t total = a_size + b_size;
+    if (a_size >= 2 * b_size) {
+        // Cut the longer operand into pieces the size of the shorter one, so every product is balanced
+        memset(out, 0, total * LIMB_SIZE);
+        uint64_t *partial = malloc(2 * b_size * LIMB_SIZE);
+        for (size_t i = 0; i < a_size; i += b_size) {
+            size_t piece = a_size - i < b_size ? a_size - i : b_size;
+            multiply(partial, a + i, piece, b, b_size);
+            add_limbs(out + i, out + i, total - i, partial, piece + b_size);
+        }
+        free(partial);
+        return;
+    }
+
+    // a = a1 * B^half + a0 and b = b1 * B^half + b0, with b1 nonzero as b_size > half. The product
+    // is z2 * B^(2 half) + z1 * B^half + z0 where z1 = (a0 + a1)(b0 + b1) - z0 - z2.
+    size_t half = a_size / 2;
+    size_t a1_size = a_size - half;
+    size_t b1_size = b_size - half;
+    multiply(out, a, half, b, half);
+    multiply(out + 2 * half, a + half, a1_size, b + half, b1_size);
+
+    size_t a_sum_size = a1_size + 1;
+    size_t b_sum_size = (b1_size > half ? b1_size : half) + 1;
+    size_t z1_size = a_sum_size + b_sum_size;
+    uint64_t *buffer = malloc(2 * z1_size * LIMB_SIZE);
+    uint64_t *a_sum = buffer;
+    uint64_t *b_sum = a_sum + a_sum_size;
+    uint64_t *z1 = b_sum + b_sum_size;
+    a_sum[a1_size] = add_limbs(a_sum, a + half, a1_size, a, half);
+    if (b1_size >= half) {
+        b_sum[b_sum_size - 1] = add_limbs(b_sum, b + half, b1_size, b, half);
+    } else {
+        b_sum[b_sum_size - 1] = add_limbs(b_sum, b, half, b + half, b1_size);
+    }
+    multiply(z1, a_sum, a_sum_size, b_sum, b_sum_size);
+    sub_limbs(z1, z1, z1_size, out, normalized_size(out, 2 * half));
+    sub_limbs(z1, z1, z1_size, out + 2 * half, normalized_size(out + 2 * half, total - 2 * half));
+    add_limbs(out + half, out + half, total - half, z1, normalized_size(z1, z1_size));
+    free(buffer);
+}
+
+// quotient = a / divisor over a_size limbs, returning the remainder. `quotient` may be `a`.
+static uint64_t divide_by_limb(uint64_t *quotient, const uint64_t *a, size_t a_size, uint64_t divisor)
+{
+    uint64_t remainder = 0;
+    for (size_t i = a_size; i-- > 0;) {
+        uint128_t current = ((uint128_t)remainder << 64) | a[i];
+        quotient[i] = (uint64_t)(current / divisor);
+        remainder = (uint64_t)(current % divisor);
+    }
+    return remainder;
+}
+
+// Knuth's algorithm D. Fills a_size - b_size + 1 limbs of `quotient`, needs a normalized divisor
+// of at least two limbs and a_size >= b_size.
+static void divide(uint64_t *quotient, const uint64_t *a, size_t a_size, const uint64_t *b, size_t b_size)
+{
+    // Shift both so the divisor's top bit is set, which keeps each estimated digit at most two off
+    int shift = __builtin_clzll(b[b_size - 1]);
+    uint64_t *v = malloc((b_size + a_size + 1) * LIMB_SIZE);
+    uint64_t *u = v + b_size;
+    for (size_t i = b_size - 1; i > 0; i--) {
+        v[i] = (b[i] << shift) | (shift ? b[i - 1] >> (64 - shift) : 0);
+    }
+    v[0] = b[0] << shift;
+    u[a_size] = shift ? a[a_size - 1] >> (64 - shift) : 0;
+    for (size_t i = a_size - 1; i > 0; i--) {
+        u[i] = (a[i] << shift) | (shift ? a[i - 1] >> (64 - shift) : 0);
+    }
+    u[0] = a[0] << shift;
+
+    uint64_t top = v[b_size - 1];
+    for (size_t j = a_size - b_size + 1; j-- > 0;) {
+        uint128_t numerator = ((uint128_t)u[j + b_size] << 64) | u[j + b_size - 1];
+        uint128_t estimate = numerator / top;
+        uint128_t rest = numerator % top;
+        while ((estimate >> 64) != 0 || estimate * v[b_size - 2] > ((rest << 64) | u[j + b_size - 2])) {
+            estimate--;
+            rest += top;
+            if ((rest >> 64) != 0) {
+                break;
+            }
+        }
+
+        // u -= estimate * v, adding v back once if the estimate was still one too large
+        uint64_t carry = 0;
+        uint64_t borrow = 0;
+        for (size_t i = 0; i <= b_size; i++) {
+            uint64_t low = carry;
+            if (i < b_size) {
+                uint128_t product = estimate * v[i] + carry;
+                low = (uint64_t)product;
+                carry = (uint64_t)(product >> 64);
+            }
+            uint64_t difference = u[i + j] - low;
+            uint64_t next_borrow = u[i + j] < low || difference < borrow;
+            u[i + j] = difference - borrow;
+            borrow = next_borrow;
+        }
+        quotient[j] = (uint64_t)estimate;
+        if (borrow) {
+            quotient[j]--;
+            u[j + b_size] += add_limbs(u + j, u + j, b_size, v, b_size);
+        }
+    }
+    free(v);
+}
+
+// Allocates the result unless it fits in a VAL_INT. `limbs` must not point into a heap object,
+// the allocation may move it.
+static Value make_integer(const uint64_t *limbs, size_t size, bool negative, Allocator *allocator)
+{
+    size = normalized_size(limbs, size);
+    if (size == 0) {
+        return INT_VAL(0);
+    }
+    if (size == 1) {
+        if (!negative && limbs[0] <= (uint64_t)INT64_MAX) {
+            return INT_VAL((int64_t)limbs[0]);
+        }
+        if (negative && limbs[0] <= (uint64_t)INT64_MAX + 1) {
+            return INT_VAL((int64_t)(0 - limbs[0]));
+        }
+    }
+
+    BigInt *bigint = allocate(allocator, sizeof(BigInt) + size * LIMB_SIZE);
+    bigint->obj.type = OBJ_BIGINT;
+    bigint->negative = negative;
+    bigint->num_limbs = (uint32_t)size;
+    memcpy(bigint->limbs, limbs, size * LIMB_SIZE);
+    return OBJ_VAL(bigint);
+}
+
+static Value add_signed(Value left, Value right, bool negate_right, Allocator *allocator)
+{
+    Magnitude left_magnitude, right_magnitude;
+    load_magnitude(left, &left_magnitude);
+    load_magnitude(right, &right_magnitude);
+    Magnitude *a = &left_magnitude;
+    Magnitude *b = &right_magnitude;
+    bool a_negative = a->negative;
+    bool b_negative = b->negative != negate_right;
+    if (compare_magnitudes(a->limbs, a->size, b->limbs, b->size) < 0) {
+        Magnitude *swap = a;
+        a = b;
+        b = swap;
+        bool swap_negative = a_negative;
+        a_negative = b_negative;
+        b_negative = swap_negative;
+    }
+
+    // |a| >= |b|, so the result takes the sign of a
+    Scratch scratch;
+    uint64_t *limbs = scratch_limbs(&scratch, a->size + 1);
+    if (a_negative == b_negative) {
+        limbs[a->size] = add_limbs(limbs, a->limbs, a->size, b->limbs, b->size);
+    } else {
+        limbs[a->size] = sub_limbs(limbs, a->limbs, a->size, b->limbs, b->size);
+    }
+    Value result = make_integer(limbs, a->size + 1, a_negative, allocator);
+    release_scratch(&scratch);
+    return result;
+}
+
+Value bigint_add(Value left, Value right, Allocator *allocator)
+{
+    return add_signed(left, right, FALSE, allocator);
+}
+
+Value bigint_sub(Value left, Value right, Allocator *allocator)
+{
+    return add_signed(left, right, TRUE, allocator);
+}
+
+Value bigint_mul(Value left, Value right, Allocator *allocator)
+{
+    Magnitude a, b;
+    load_magnitude(left, &a);
+    load_magnitude(right, &b);
+    if (a.size == 0 || b.size == 0) {
+        return INT_VAL(0);
+    }
+
+    Scratch scratch;
+    uint64_t *limbs = scratch_limbs(&scratch, a.size + b.size);
+    multiply(limbs, a.limbs, a.size, b.limbs, b.size);
+    Value result = make_integer(limbs, a.size + b.size, a.negative != b.negative, allocator);
+    release_scratch(&scratch);
+    return result;
+}
+
+Value bigint_div(Value left, Value right, Allocator *allocator)
+{
+    Magnitude a, b;
+    load_magnitude(left, &a);
+    load_magnitude(right, &b);
+    assert(b.size != 0);
+    if (compare_magnitudes(a.limbs, a.size, b.limbs, b.size) < 0) {
+        return INT_VAL(0);
+    }
+
+    Scratch scratch;
+    size_t size = a.size - b.size + 1;
+    uint64_t *limbs = scratch_limbs(&scratch, size);
+    if (b.size == 1) {
+        divide_by_limb(limbs, a.limbs, a.size, b.limbs[0]);
+    } else {
+        divide(limbs, a.limbs, a.size, b.limbs, b.size);
+    }
+    Value result = make_integer(limbs, size, a.negative != b.negative, allocator);
+    release_scratch(&scratch);
+    return result;
+}
+
+Value bigint_neg(Value operand, Allocator *allocator)
+{
+    Magnitude a;
+    load_magnitude(operand, &a);
+    Scratch scratch;
+    uint64_t *limbs = scratch_limbs(&scratch, a.size);
+    memcpy(limbs, a.limbs, a.size * LIMB_SIZE);
+    Value result = make_integer(limbs, a.size, !a.negative, allocator);
+    release_scratch(&scratch);
+    return result;
+}
+
+int bigint_compare(Value left, Value right)
+{
+    Magnitude a, b;
+    load_magnitude(left, &a);
+    load_magnitude(right, &b);
+    if (a.negative != b.negative) {
+        return a.negative ? -1 : 1;
+    }
+    int comparison = compare_magnitudes(a.limbs, a.size, b.limbs, b.size);
+    return a.negative ? -comparison : comparison;
+}
+
+double bigint_to_double(Value value)
+{
+    Magnitude a;
+    load_magnitude(value, &a);
+    if (a.size <= 1) {
+        double magnitude = a.size == 0 ? 0.0 : (double)a.limbs[0];
+        return a.negative ? -magnitude : magnitude;
+    }
+    // The top 64 bits, with a 1 in the lowest place if any bit below them is set, round the same
+    // as the whole magnitude
+    size_t top = a.size - 1;
+    int zeros = __builtin_clzll(a.limbs[top]);
+    uint64_t high = a.limbs[top] << zeros;
+    if (zeros > 0) {
+        high |= a.limbs[top - 1] >> (64 - zeros);
+    }
+    bool sticky = (a.limbs[top - 1] << zeros) != 0;
+    for (size_t i = 0; i + 1 < top && !sticky; i++) {
+        sticky = a.limbs[i] != 0;
+    }
+    int exponent = (int)(64 * top) - zeros;
+    double magnitude = INFINITY;
+    if (exponent <= 1023) {
+        uint64_t scale_bits = (uint64_t)(exponent + 1023) << 52;
+        double scale;
+        memcpy(&scale, &scale_bits, sizeof(scale));
+        magnitude = (double)(high | sticky) * scale;
+    }
+    return a.negative ? -magnitude : magnitude;
+}
+
+bool bigint_equal(BigInt *a, BigInt *b)
+{
+    return a->negative == b->negative && a->num_limbs == b->num_limbs && memcmp(a->limbs, b->limbs, a->num_limbs * LIMB_SIZE) == 0;
+}
+
+Value bigint_from_str(const char *digits, Allocator *allocator)
+{
+    bool negative = *digits == '-';
+    if (*digits == '-' || *digits == '+') {
+        digits++;
+    }
+    size_t length = strlen(digits);
+
+    // Consume the digits in chunks that fit a limb, the first one taking the odd digits
+    Scratch scratch;
+    uint64_t *limbs = scratch_limbs(&scratch, length / DECIMAL_CHUNK_DIGITS + 1);
+    size_t size = 0;
+    size_t chunk_length = length % DECIMAL_CHUNK_DIGITS;
+    if (chunk_length == 0) {
+        chunk_length = DECIMAL_CHUNK_DIGITS;
+    }
+    for (size_t i = 0; i < length; i += chunk_length, chunk_length = DECIMAL_CHUNK_DIGITS) {
+        uint64_t chunk = 0;
+        uint64_t scale = 1;
+        for (size_t j = 0; j < chunk_length; j++) {
+            chunk = chunk * 10 + (uint64_t)(digits[i + j] - '0');
+            scale *= 10;
+        }
+        uint64_t carry = chunk;
+        for (size_t j = 0; j < size; j++) {
+            uint128_t product = (uint128_t)limbs[j] * scale + carry;
+            limbs[j] = (uint64_t)product;
+            carry = (uint64_t)(product >> 64);
+        }
+        if (carry != 0) {
+            limbs[size++] = carry;
+        }
+    }
+    Value result = make_integer(limbs, size, negative, allocator);
+    release_scratch(&scratch);
+    return result;
+}
+
+char *bigint_to_str(Value value)
+{
+    if (IS_INT(value)) {
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value));
+        return strdup(buffer);
+    }
+
+    // Peel off base 10^19 digits, least significant first. Each one takes more than 63 bits.
+    Magnitude a;
+    load_magnitude(value, &a);
+    size_t max_chunks = 2 * a.size + 1;
+    uint64_t *limbs = malloc((a.size + max_chunks) * LIMB_SIZE);
+    uint64_t *chunks = limbs + a.size;
+    memcpy(limbs, a.limbs, a.size * LIMB_SIZE);
+    size_t size = a.size;
+    size_t num_chunks = 0;
+    while (size > 0) {
+        chunks[num_chunks++] = divide_by_limb(limbs, limbs, size, DECIMAL_CHUNK);
+        size = normalized_size(limbs, size);
+    }
+
+    char *str = malloc(num_chunks * DECIMAL_CHUNK_DIGITS + 2);
+    char *cursor = str;
+    if (a.negative) {
+        *cursor++ = '-';
+    }
+    cursor += sprintf(cursor, "%" PRIu64, chunks[num_chunks - 1]);
+    for (size_t i = num_chunks - 1; i-- > 0;) {
+        cursor += sprintf(cursor, "%019" PRIu64, chunks[i]);
+    }
+    free(limbs);
+    return str;
+}
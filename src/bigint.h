@@ -0,0 +1,39 @@
+#ifndef BIGINT_H
+#define BIGINT_H
+
+#include "allocator.h"
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Arbitrary-precision integer arithmetic. Integers that fit in an int64_t are always VAL_INT
+// and only larger ones are BigInt objects, so the common case stays unboxed and a bignum never
+// equals a small integer. The operations take either kind and return the canonical one.
+//
+// Results are allocated with `allocator->alloc` alone, after the operands were last read, so the
+// allocator may run a moving collection first. It only needs to hand back room for the object.
+
+// Operands with fewer limbs than this are multiplied schoolbook, larger ones by Karatsuba.
+// Only a variable so tests and benchmarks can compare the two.
+#define DEFAULT_KARATSUBA_THRESHOLD 32
+extern size_t karatsuba_threshold;
+
+extern Value bigint_add(Value left, Value right, Allocator *allocator);
+extern Value bigint_sub(Value left, Value right, Allocator *allocator);
+extern Value bigint_mul(Value left, Value right, Allocator *allocator);
+// Truncates towards zero like C. `right` must not be zero.
+extern Value bigint_div(Value left, Value right, Allocator *allocator);
+extern Value bigint_neg(Value operand, Allocator *allocator);
+// Returns a negative number, zero or a positive number like strcmp
+extern int bigint_compare(Value left, Value right);
+extern bool bigint_equal(BigInt *a, BigInt *b);
+// Correctly rounded, infinite if the integer is beyond the range of a double
+extern double bigint_to_double(Value value);
+
+// `digits` is an optionally signed string of decimal digits
+extern Value bigint_from_str(const char *digits, Allocator *allocator);
+// Decimal representation, the caller frees the result
+extern char *bigint_to_str(Value value);
+
+#endif // BIGINT_H
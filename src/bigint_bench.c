@@ -0,0 +1,110 @@
+#include "allocator.h"
+#include "bench_utils.h"
+#include "bigint.h"
+#include "compiler.h"
+#include "object.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Integer arithmetic on the interpreter, small integers and bignums, and bignum multiplication
+// with and without Karatsuba
+
+#define ROUNDS 5
+
+typedef struct Benchmark {
+    const char *name;
+    char *input;
+} Benchmark;
+
+// Returns the fastest of ROUNDS interpreted runs in nanoseconds
+static uint64_t time_program(char *input)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < ROUNDS; i++) {
+        Parser *parser = make_parser(input, NULL);
+        Program *program = parse_program(parser);
+        Heap *heap = make_heap();
+        Compiler *compiler = make_compiler(heap);
+        FunctionProto *main = compile_program(compiler, program);
+        assert(main != NULL);
+        VM *vm = make_vm(heap, compiler->constants);
+        vm->jit_enabled = FALSE;
+
+        uint64_t start = now_ns();
+        VMResult result = run_vm(vm, main);
+        uint64_t elapsed = now_ns() - start;
+        assert(result == VM_OK);
+        (void)result;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+
+        cleanup_vm(vm);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+    return best;
+}
+
+// Returns the fastest of ROUNDS multiplications of two `digits` digit numbers in nanoseconds
+static uint64_t time_multiplication(size_t digits, size_t threshold)
+{
+    Arena *arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    char *text = malloc(digits + 1);
+    for (size_t i = 0; i < digits; i++) {
+        text[i] = (char)('1' + (i * 7919) % 9);
+    }
+    text[digits] = '\0';
+    Value left = bigint_from_str(text, &arena->allocator);
+    text[0] = '9';
+    Value right = bigint_from_str(text, &arena->allocator);
+
+    karatsuba_threshold = threshold;
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < ROUNDS; i++) {
+        uint64_t start = now_ns();
+        Value product = bigint_mul(left, right, &arena->allocator);
+        uint64_t elapsed = now_ns() - start;
+        (void)product;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+    }
+    karatsuba_threshold = DEFAULT_KARATSUBA_THRESHOLD;
+
+    free(text);
+    cleanup_arena(arena);
+    return best;
+}
+
+int main(void)
+{
+    Benchmark benchmarks[] = {
+        // Never leaves int64, so everything stays on the inline fast path
+        { "small-int loop 10^6", "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; let s = s + i * 3 - i / 2; } s }; sum(1000000)" },
+        { "factorial(1000) x20", "let fact = fn(n) { let r = 1; let i = 1; while (i < n + 1) { let r = r * i; let i = i + 1; } r }; let rep = fn(k) { if (k == 0) { 0 } else { fact(1000); rep(k - 1) } }; rep(20)" },
+        { "fibonacci(10000)", "let fib = fn(n) { let a = 0; let b = 1; let i = 0; while (i < n) { let t = b; let b = a + b; let a = t; let i = i + 1; } a }; fib(10000)" },
+        { "3^(2^16)", "let pow = fn(b, e) { if (e == 0) { 1 } else { let h = pow(b, e / 2); if (e / 2 * 2 == e) { h * h } else { h * h * b } } }; pow(3, 65536)" },
+    };
+
+    printf("%-22s %14s\n", "benchmark", "interpreted ms");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        printf("%-22s %14.2f\n", benchmarks[i].name, time_program(benchmarks[i].input) / 1e6);
+    }
+
+    // 19 decimal digits fill a little less than a limb
+    size_t limbs[] = { 32, 64, 128, 256, 512, 2048 };
+    printf("\n%-22s %14s %14s %9s\n", "multiply limbs", "schoolbook us", "karatsuba us", "speedup");
+    for (size_t i = 0; i < sizeof(limbs) / sizeof(limbs[0]); i++) {
+        uint64_t schoolbook = time_multiplication(limbs[i] * 19, SIZE_MAX);
+        uint64_t karatsuba = time_multiplication(limbs[i] * 19, DEFAULT_KARATSUBA_THRESHOLD);
+        printf("%-22zu %14.1f %14.1f %8.1fx\n", limbs[i], schoolbook / 1e3, karatsuba / 1e3, (double)schoolbook / karatsuba);
+    }
+    return 0;
+}
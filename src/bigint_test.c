@@ -0,0 +1,182 @@
+#include "allocator.h"
+#include "bigint.h"
+#include "object.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+typedef Value (*BinaryFn)(Value left, Value right, Allocator *allocator);
+
+static Arena *arena;
+
+static Allocator *test_allocator(void)
+{
+    if (arena == NULL) {
+        arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    }
+    return &arena->allocator;
+}
+
+static void assert_value_str(Value value, const char *expected, const char *context)
+{
+    char *result = bigint_to_str(value);
+    if (strcmp(result, expected) != 0) {
+        printf("%s\nExpected: %s\nGot: %s\n", context, expected, result);
+        assert(1 != 1);
+    }
+    free(result);
+}
+
+// Decimal string of `num_digits` pseudo-random digits
+static char *random_digits(uint64_t *state, size_t num_digits)
+{
+    char *digits = malloc(num_digits + 1);
+    for (size_t i = 0; i < num_digits; i++) {
+        *state = *state * 6364136223846793005u + 1442695040888963407u;
+        digits[i] = (char)('0' + (*state >> 33) % 10);
+    }
+    digits[0] = digits[0] == '0' ? '7' : digits[0];
+    digits[num_digits] = '\0';
+    return digits;
+}
+
+TEST_CASE(strings_round_trip)
+{
+    struct {
+        const char *digits;
+        bool small;
+    } tests[] = {
+        { "0", TRUE },
+        { "-1", TRUE },
+        { "9223372036854775807", TRUE },
+        { "-9223372036854775808", TRUE },
+        { "9223372036854775808", FALSE },
+        { "-9223372036854775809", FALSE },
+        { "18446744073709551616", FALSE },
+        { "10000000000000000000", FALSE },
+        { "123456789012345678901234567890123456789012345678901234567890", FALSE },
+        { "-100000000000000000000000000000000000000000000000000000000001", FALSE },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Value value = bigint_from_str(tests[i].digits, test_allocator());
+        if (IS_INT(value) != tests[i].small || !IS_INTEGER(value)) {
+            printf("Expected %s to be a %s\n", tests[i].digits, tests[i].small ? "small integer" : "bignum");
+            assert(1 != 1);
+        }
+        assert_value_str(value, tests[i].digits, tests[i].digits);
+    }
+    assert_value_str(bigint_from_str("+00042", test_allocator()), "42", "+00042");
+}
+
+TEST_CASE(arithmetic)
+{
+    const char *a = "123456789012345678901234567890";
+    const char *b = "-987654321098765432109876543210";
+    struct {
+        BinaryFn fn;
+        const char *left;
+        const char *right;
+        const char *expected;
+    } tests[] = {
+        { bigint_add, a, b, "-864197532086419753208641975320" },
+        { bigint_sub, a, b, "1111111110111111111011111111100" },
+        { bigint_mul, a, b, "-121932631137021795226185032733622923332237463801111263526900" },
+        { bigint_div, b, a, "-8" },
+        { bigint_div, a, b, "0" },
+        { bigint_sub, a, a, "0" },
+        // Carries and borrows across limbs, and results that shrink back into a small integer
+        { bigint_add, "18446744073709551615", "1", "18446744073709551616" },
+        { bigint_sub, "18446744073709551616", "1", "18446744073709551615" },
+        { bigint_add, "-18446744073709551616", "18446744073709551615", "-1" },
+        { bigint_add, "9223372036854775807", "1", "9223372036854775808" },
+        { bigint_mul, "340282366920938463463374607431768211455", "340282366920938463463374607431768211455", "115792089237316195423570985008687907852589419931798687112530834793049593217025" },
+        { bigint_mul, "-9223372036854775808", "-1", "9223372036854775808" },
+        { bigint_div, "-9223372036854775808", "-1", "9223372036854775808" },
+        { bigint_div, "-170141183460469231731687303715884105728", "1", "-170141183460469231731687303715884105728" },
+        // Single limb and multi-limb divisors, truncating towards zero
+        { bigint_div, "10000000000000000000000000000000000000000", "18446744073709551617", "542101086242752216974" },
+        { bigint_div, "10000000000000000000000000000000000000000", "-55340232221128654855", "-180700362080917405645" },
+        { bigint_div, "1606938044258990275541962092341162602522202993782792835301376", "1267650600228229401496703217721", "1267650600228229401496703193031" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Value left = bigint_from_str(tests[i].left, test_allocator());
+        Value right = bigint_from_str(tests[i].right, test_allocator());
+        char context[512];
+        snprintf(context, sizeof(context), "Test %zu: %s and %s", i, tests[i].left, tests[i].right);
+        assert_value_str(tests[i].fn(left, right, test_allocator()), tests[i].expected, context);
+    }
+
+    assert_value_str(bigint_neg(INT_VAL(INT64_MIN), test_allocator()), "9223372036854775808", "-INT64_MIN");
+    assert_value_str(bigint_neg(bigint_from_str("9223372036854775808", test_allocator()), test_allocator()), "-9223372036854775808", "-(2^63)");
+}
+
+TEST_CASE(comparison)
+{
+    Value big = bigint_from_str("100000000000000000000", test_allocator());
+    Value negative_big = bigint_from_str("-100000000000000000000", test_allocator());
+    Value bigger = bigint_from_str("100000000000000000001", test_allocator());
+
+    assert(bigint_compare(big, bigger) < 0);
+    assert(bigint_compare(bigger, big) > 0);
+    assert(bigint_compare(big, INT_VAL(INT64_MAX)) > 0);
+    assert(bigint_compare(negative_big, INT_VAL(INT64_MIN)) < 0);
+    assert(bigint_compare(negative_big, big) < 0);
+    assert(bigint_compare(INT_VAL(-1), INT_VAL(0)) < 0);
+
+    Value same = bigint_add(bigint_from_str("99999999999999999999", test_allocator()), INT_VAL(1), test_allocator());
+    assert(bigint_compare(big, same) == 0);
+    assert(AS_OBJ(big) != AS_OBJ(same) && bigint_equal(AS_BIGINT(big), AS_BIGINT(same)));
+    assert(values_equal(big, same) && !values_equal(big, bigger));
+}
+
+TEST_CASE(karatsuba_matches_schoolbook)
+{
+    uint64_t state = 42;
+    struct {
+        size_t left_digits;
+        size_t right_digits;
+    } tests[] = {
+        { 1000, 1000 }, // Balanced, about 52 limbs each
+        { 3000, 700 }, // Unbalanced, cut into pieces
+        { 5000, 4900 },
+        { 20000, 20000 }, // Several levels of recursion
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *left_digits = random_digits(&state, tests[i].left_digits);
+        char *right_digits = random_digits(&state, tests[i].right_digits);
+        Value left = bigint_from_str(left_digits, test_allocator());
+        Value right = bigint_from_str(right_digits, test_allocator());
+
+        karatsuba_threshold = SIZE_MAX;
+        Value schoolbook = bigint_mul(left, right, test_allocator());
+        karatsuba_threshold = 4;
+        Value karatsuba = bigint_mul(left, right, test_allocator());
+        karatsuba_threshold = DEFAULT_KARATSUBA_THRESHOLD;
+        Value product = bigint_mul(left, right, test_allocator());
+        if (!bigint_equal(AS_BIGINT(schoolbook), AS_BIGINT(karatsuba)) || !bigint_equal(AS_BIGINT(schoolbook), AS_BIGINT(product))) {
+            printf("Products of %zu and %zu digit numbers differ\n", tests[i].left_digits, tests[i].right_digits);
+            assert(1 != 1);
+        }
+
+        // Division undoes the multiplication, whatever is added below the divisor
+        Value remainder = bigint_sub(right, INT_VAL(1), test_allocator());
+        Value quotient = bigint_div(bigint_add(product, remainder, test_allocator()), right, test_allocator());
+        if (bigint_compare(quotient, left) != 0) {
+            printf("(a * b + b - 1) / b != a for %zu and %zu digit numbers\n", tests[i].left_digits, tests[i].right_digits);
+            assert(1 != 1);
+        }
+        free(left_digits);
+        free(right_digits);
+    }
+    cleanup_arena(arena);
+    arena = NULL;
+}
+
+RUN_TESTS()
@@ -0,0 +1,32 @@
+#include "builtins.h"
+#include <string.h>
+
+#define BUILTIN(id_, num_parameters_, name_) \
+    [id_] = { .obj = { .type = OBJ_BUILTIN, .marked = TRUE }, .id = id_, .num_parameters = num_parameters_, .name = name_ }
+
+Builtin builtins[NUM_BUILTINS] = {
+    BUILTIN(BUILTIN_LEN, 1, "len"),
+    BUILTIN(BUILTIN_FIRST, 1, "first"),
+    BUILTIN(BUILTIN_LAST, 1, "last"),
+    BUILTIN(BUILTIN_REST, 1, "rest"),
+    BUILTIN(BUILTIN_PUSH, 2, "push"),
+    BUILTIN(BUILTIN_PUT, 3, "put"),
+    BUILTIN(BUILTIN_SUM, 1, "sum"),
+    BUILTIN(BUILTIN_MIN, 1, "min"),
+    BUILTIN(BUILTIN_MAX, 1, "max"),
+    BUILTIN(BUILTIN_MAP, 2, "map"),
+    BUILTIN(BUILTIN_FILTER, 2, "filter"),
+    BUILTIN(BUILTIN_SLICE, 3, "slice"),
+};
+
+#undef BUILTIN
+
+int lookup_builtin(const char *name)
+{
+    for (int i = 0; i < NUM_BUILTINS; i++) {
+        if (strcmp(builtins[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
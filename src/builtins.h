@@ -0,0 +1,37 @@
+#ifndef BUILTINS_H
+#define BUILTINS_H
+
+#include "object.h"
+
+typedef enum BuiltinId {
+    BUILTIN_LEN,
+    BUILTIN_FIRST,
+    BUILTIN_LAST,
+    BUILTIN_REST,
+    BUILTIN_PUSH,
+    BUILTIN_PUT,
+    BUILTIN_SUM,
+    BUILTIN_MIN,
+    BUILTIN_MAX,
+    BUILTIN_MAP,
+    BUILTIN_FILTER,
+    BUILTIN_SLICE,
+    NUM_BUILTINS
+} BuiltinId;
+
+// Builtin functions are static objects outside any heap. They start out marked, so collections
+// never trace them, and no heap links them, so they are never swept. The VM and the AOT runtime
+// each implement them.
+typedef struct Builtin {
+    Object obj;
+    BuiltinId id;
+    int num_parameters;
+    const char *name;
+} Builtin;
+
+extern Builtin builtins[NUM_BUILTINS];
+
+// Returns the BuiltinId called `name`, or -1
+extern int lookup_builtin(const char *name);
+
+#endif // BUILTINS_H
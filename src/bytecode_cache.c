@@ -0,0 +1,280 @@
+#include "bytecode_cache.h"
+#include "hash_map.h"
+#include "string_object.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static size_t data_offset(size_t num_functions, size_t num_constants)
+{
+    return sizeof(CacheHeader) + num_functions * sizeof(CachedFunction) + num_constants * sizeof(CachedConstant);
+}
+
+static void write_function(uint8_t *file, CachedFunction *cached, FunctionProto *function, size_t *offset)
+{
+    cached->code_offset = *offset;
+    cached->code_size = function->instructions->size;
+    cached->num_globals = function->num_globals;
+    cached->num_parameters = function->num_parameters;
+    cached->num_locals = function->num_locals;
+    cached->num_upvalues = function->num_upvalues;
+    cached->max_stack = function->max_stack;
+    cached->num_call_caches = function->num_call_caches;
+    cached->num_index_caches = function->num_index_caches;
+    memcpy(cached->name, function->name, sizeof(cached->name));
+    memcpy(file + *offset, function->instructions->array, function->instructions->size);
+    *offset += function->instructions->size;
+}
+
+bool write_cached_program(Compiler *compiler, FunctionProto *main, const char *source, const char *path)
+{
+    ValueArrayList *constants = compiler->constants;
+    size_t num_functions = 1;
+    size_t data_size = main->instructions->size;
+    if (main->lazy != NULL) {
+        return FALSE;
+    }
+    for (size_t i = 0; i < constants->size; i++) {
+        Value constant = constants->array[i];
+        if (IS_FUNCTION(constant)) {
+            if (AS_FUNCTION(constant)->lazy != NULL) {
+                return FALSE;
+            }
+            num_functions++;
+            data_size += AS_FUNCTION(constant)->instructions->size;
+        } else if (IS_FLAT_STRING(constant)) {
+            data_size += AS_STRING(constant)->length;
+        } else if (!IS_INT(constant) && !IS_FLOAT(constant)) {
+            return FALSE;
+        }
+    }
+
+    size_t offset = data_offset(num_functions, constants->size);
+    size_t size = offset + data_size;
+    uint8_t *file = calloc(1, size);
+    CacheHeader *header = (CacheHeader *)file;
+    *header = (CacheHeader) {
+        .magic = BYTECODE_CACHE_MAGIC,
+        .version = BYTECODE_CACHE_VERSION,
+        .source_hash = hash_bytes(source, strlen(source)),
+        .source_length = strlen(source),
+        .size = size,
+        .num_functions = (uint32_t)num_functions,
+        .num_constants = (uint32_t)constants->size,
+    };
+    CachedFunction *functions = (CachedFunction *)(file + sizeof(CacheHeader));
+    CachedConstant *cached_constants = (CachedConstant *)(functions + num_functions);
+
+    write_function(file, &functions[0], main, &offset);
+    size_t function_index = 1;
+    for (size_t i = 0; i < constants->size; i++) {
+        Value constant = constants->array[i];
+        CachedConstant *cached = &cached_constants[i];
+        if (IS_INT(constant)) {
+            *cached = (CachedConstant) { .type = CACHED_INT, .payload = (uint64_t)AS_INT(constant) };
+        } else if (IS_FLOAT(constant)) {
+            cached->type = CACHED_FLOAT;
+            memcpy(&cached->payload, &AS_FLOAT(constant), sizeof(double));
+        } else if (IS_FLAT_STRING(constant)) {
+            StringObject *string = AS_STRING(constant);
+            *cached = (CachedConstant) { .type = CACHED_STRING, .length = string->length, .payload = offset };
+            memcpy(file + offset, string->chars, string->length);
+            offset += string->length;
+        } else {
+            *cached = (CachedConstant) { .type = CACHED_FUNCTION, .payload = function_index };
+            write_function(file, &functions[function_index++], AS_FUNCTION(constant), &offset);
+        }
+    }
+
+    size_t tmp_length = strlen(path) + 32;
+    char *tmp_path = malloc(tmp_length);
+    snprintf(tmp_path, tmp_length, "%s.%ld.tmp", path, (long)getpid());
+    FILE *out = fopen(tmp_path, "wb");
+    bool written = out != NULL && fwrite(file, 1, size, out) == size;
+    if (out != NULL && fclose(out) != 0) {
+        written = FALSE;
+    }
+    if (written) {
+        written = rename(tmp_path, path) == 0;
+    }
+    if (!written && out != NULL) {
+        remove(tmp_path);
+    }
+    free(tmp_path);
+    free(file);
+    return written;
+}
+
+static bool in_file(const CacheHeader *header, uint64_t offset, uint64_t length)
+{
+    return offset <= header->size && length <= header->size - offset;
+}
+
+// Checks everything loading relies on before anything is allocated
+static bool is_valid(const CacheHeader *header, const char *source)
+{
+    size_t source_length = strlen(source);
+    if (header->magic != BYTECODE_CACHE_MAGIC || header->version != BYTECODE_CACHE_VERSION || header->source_length != source_length
+        || header->num_functions == 0 || header->num_constants > MAX_CONSTANTS
+        || !in_file(header, 0, data_offset(header->num_functions, header->num_constants))
+        || header->source_hash != hash_bytes(source, source_length)) {
+        return FALSE;
+    }
+    const CachedFunction *functions = (const CachedFunction *)(header + 1);
+    const CachedConstant *constants = (const CachedConstant *)(functions + header->num_functions);
+    for (uint32_t i = 0; i < header->num_functions; i++) {
+        const CachedFunction *function = &functions[i];
+        if (!in_file(header, function->code_offset, function->code_size) || function->num_call_caches < 0
+            || function->num_call_caches > MAX_CALL_CACHES || function->num_index_caches < 0
+            || function->num_index_caches > MAX_INDEX_CACHES || function->name[MAX_IDENTIFIER_SIZE] != '\0') {
+            return FALSE;
+        }
+    }
+    for (uint32_t i = 0; i < header->num_constants; i++) {
+        const CachedConstant *constant = &constants[i];
+        switch (constant->type) {
+        case CACHED_INT:
+        case CACHED_FLOAT:
+            break;
+        case CACHED_STRING:
+            if (!in_file(header, constant->payload, constant->length)) {
+                return FALSE;
+            }
+            break;
+        case CACHED_FUNCTION:
+            if (constant->payload == 0 || constant->payload >= header->num_functions) {
+                return FALSE;
+            }
+            break;
+        default:
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// The prototype executes the bytecode in the mapping, which its instructions borrow
+static FunctionProto *load_function(Heap *heap, const uint8_t *data, const CachedFunction *cached)
+{
+    FunctionProto *function = (FunctionProto *)allocate_object(heap, sizeof(FunctionProto), OBJ_FUNCTION);
+    function->instructions = malloc(sizeof(Instructions));
+    function->instructions->array = (uint8_t *)data + cached->code_offset;
+    function->instructions->size = cached->code_size;
+    function->instructions->capacity = 0;
+    function->num_globals = cached->num_globals;
+    function->num_parameters = cached->num_parameters;
+    function->num_locals = cached->num_locals;
+    function->num_upvalues = cached->num_upvalues;
+    function->max_stack = cached->max_stack;
+    function->num_call_caches = cached->num_call_caches;
+    if (function->num_call_caches > 0) {
+        function->call_caches = calloc(function->num_call_caches, sizeof(CallCache));
+    }
+    function->num_index_caches = cached->num_index_caches;
+    if (function->num_index_caches > 0) {
+        function->index_caches = calloc(function->num_index_caches, sizeof(IndexCache));
+    }
+    memcpy(function->name, cached->name, sizeof(function->name));
+    return function;
+}
+
+static void *allocate_constant_string(void *user, size_t size)
+{
+    return allocate_object(user, size, OBJ_STRING);
+}
+
+CachedProgram *load_cached_program(Compiler *compiler, const char *source, const char *path)
+{
+    if (compiler->constants->size != 0) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CacheHeader)) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    const CacheHeader *header = data;
+    if (header->size != (uint64_t)st.st_size || !is_valid(header, source)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    const CachedFunction *cached_functions = (const CachedFunction *)(header + 1);
+    const CachedConstant *cached_constants = (const CachedConstant *)(cached_functions + header->num_functions);
+    FunctionProto **functions = malloc(header->num_functions * sizeof(FunctionProto *));
+    for (uint32_t i = 0; i < header->num_functions; i++) {
+        functions[i] = load_function(compiler->heap, data, &cached_functions[i]);
+    }
+    Allocator allocator = { .alloc = allocate_constant_string, .user = compiler->heap };
+    for (uint32_t i = 0; i < header->num_constants; i++) {
+        const CachedConstant *cached = &cached_constants[i];
+        switch (cached->type) {
+        case CACHED_INT:
+            add_value_to_arraylist(compiler->constants, INT_VAL((int64_t)cached->payload));
+            break;
+        case CACHED_FLOAT: {
+            double number;
+            memcpy(&number, &cached->payload, sizeof(double));
+            add_value_to_arraylist(compiler->constants, FLOAT_VAL(number));
+            break;
+        }
+        case CACHED_STRING: {
+            Value string = string_from_chars((const char *)data + cached->payload, cached->length, &allocator);
+            add_interned_string(compiler->strings, AS_STRING(string), (int)i);
+            add_value_to_arraylist(compiler->constants, string);
+            break;
+        }
+        case CACHED_FUNCTION:
+            add_value_to_arraylist(compiler->constants, OBJ_VAL(functions[cached->payload]));
+            break;
+        }
+    }
+
+    CachedProgram *program = malloc(sizeof(CachedProgram));
+    program->data = data;
+    program->size = st.st_size;
+    program->main = functions[0];
+    free(functions);
+    return program;
+}
+
+void cleanup_cached_program(CachedProgram *program)
+{
+    munmap(program->data, program->size);
+    free(program);
+}
+
+char *cached_program_path(const char *source_path, const char *source, const char *cache_dir)
+{
+    size_t length;
+    char *path;
+    if (cache_dir != NULL) {
+        length = strlen(cache_dir) + 64;
+        path = malloc(length);
+        snprintf(path, length, "%s/%016llx-%d.mkc", cache_dir, (unsigned long long)hash_bytes(source, strlen(source)),
+            BYTECODE_CACHE_VERSION);
+        return path;
+    }
+    // Replace the extension, if the file name has one other than the cache's own
+    const char *name = strrchr(source_path, '/');
+    name = name == NULL ? source_path : name + 1;
+    const char *extension = strrchr(name, '.');
+    bool replace = extension != NULL && extension != name && strcmp(extension, ".mkc") != 0;
+    size_t stem = replace ? (size_t)(extension - source_path) : strlen(source_path);
+    length = stem + sizeof(".mkc");
+    path = malloc(length);
+    snprintf(path, length, "%.*s.mkc", (int)stem, source_path);
+    return path;
+}
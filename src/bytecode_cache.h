@@ -0,0 +1,83 @@
+#ifndef BYTECODE_CACHE_H
+#define BYTECODE_CACHE_H
+
+#include "compiler.h"
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Compiled programs saved to `.mkc` files, so a script run again skips the front end. A file holds
+// the program's constants, its function prototypes and their bytecode. Loading maps the file and
+// the prototypes execute the bytecode where it lies in the mapping, only the prototypes and the
+// string constants are made on the heap.
+//
+// A file is only used for the exact source it was compiled from by the same compiler: the header
+// holds a hash and the length of the source and BYTECODE_CACHE_VERSION, anything else is a miss.
+// Files are trusted like the interpreter itself, their bytecode is not checked beyond its bounds.
+
+// Bump whenever the instruction set, the code the compilers emit or the layout below changes
+#define BYTECODE_CACHE_VERSION 2
+#define BYTECODE_CACHE_MAGIC 0x434b4d00 // "\0MKC" read as little endian
+
+typedef struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t source_hash; // hash_bytes of the source
+    uint64_t source_length;
+    uint64_t size; // Of the whole file
+    uint32_t num_functions; // The program's top-level function comes first
+    uint32_t num_constants;
+} CacheHeader;
+
+// Followed by the functions, then the constants, then the bytecode and string contents they point
+// to by offset from the start of the file
+
+typedef struct CachedFunction {
+    uint64_t code_offset;
+    uint64_t code_size;
+    uint64_t num_globals;
+    int32_t num_parameters;
+    int32_t num_locals;
+    int32_t num_upvalues;
+    int32_t max_stack;
+    int32_t num_call_caches;
+    int32_t num_index_caches;
+    char name[MAX_IDENTIFIER_SIZE + 1];
+} CachedFunction;
+
+typedef enum CachedConstantType {
+    CACHED_INT,
+    CACHED_FLOAT,
+    CACHED_STRING,
+    CACHED_FUNCTION
+} CachedConstantType;
+
+typedef struct CachedConstant {
+    uint32_t type;
+    uint32_t length; // Strings only
+    uint64_t payload; // The integer, the bits of the float, the offset of the string or the index of the function
+} CachedConstant;
+
+// A loaded file. Its prototypes point into the mapping, which must outlive the heap holding them.
+typedef struct CachedProgram {
+    void *data;
+    size_t size;
+    FunctionProto *main;
+} CachedProgram;
+
+// Writes the program compiled from `source` by `compiler`, which must not have compiled anything
+// else, to `path`. The file is written next to it and renamed into place, so concurrent runs only
+// ever see whole files. Returns FALSE if it could not be written, or if the program has functions
+// that are not compiled yet (see compile_lazy_function).
+extern bool write_cached_program(Compiler *compiler, FunctionProto *main, const char *source, const char *path);
+// Loads the program compiled from `source` into a compiler that has not compiled anything yet,
+// whose constants the program's become. Returns NULL if there is no usable file at `path`.
+extern CachedProgram *load_cached_program(Compiler *compiler, const char *source, const char *path);
+extern void cleanup_cached_program(CachedProgram *program);
+
+// Where the program in `source_path` is cached: `cache_dir` named by the hash of the source and the
+// version if it is given, otherwise next to the source with the extension `.mkc`. Malloc'd.
+extern char *cached_program_path(const char *source_path, const char *source, const char *cache_dir);
+
+#endif // BYTECODE_CACHE_H
@@ -0,0 +1,211 @@
+#include "bytecode_cache.h"
+#include "compiler.h"
+#include "hash_map.h"
+#include "object.h"
+#include "parser.h"
+#include "single_pass.h"
+#include "test_utils.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+INIT_TEST_HARNESS()
+
+static char *make_temp_path(void)
+{
+    char *path = strdup("/tmp/bytecode_cache_testXXXXXX");
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    return path;
+}
+
+// Runs `main` and returns its result as a string
+static char *run_main(Compiler *compiler, FunctionProto *main)
+{
+    VM *vm = make_vm(compiler->heap, compiler->constants);
+    if (run_vm(vm, main) != VM_OK) {
+        printf("Runtime error: %s\n", vm->error);
+        assert(1 != 1);
+    }
+    char *result = inspect_value(get_last_popped(vm));
+    cleanup_vm(vm);
+    return result;
+}
+
+static void write_program(char *input, const char *path)
+{
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_single_pass(compiler, input);
+    assert(main != NULL);
+    assert(write_cached_program(compiler, main, input, path));
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+}
+
+// Returns whether the file at `path` loads for `input`
+static bool loads(char *input, const char *path)
+{
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    CachedProgram *program = load_cached_program(compiler, input, path);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    if (program == NULL) {
+        return FALSE;
+    }
+    cleanup_cached_program(program);
+    return TRUE;
+}
+
+TEST_CASE(runs_loaded_programs)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "1 + 2 * 3", "7" },
+        { "let s = \"a\\tb\"; [s, \"a\\tb\", \"\", len(s)]", "[a\tb, a\tb, , 3]" },
+        { "let x = 1.5; let y = -9223372036854775807 - 1; [x * 2.0, y]", "[3.0, -9223372036854775808]" },
+        { "let f = fn(a) { fn(b) { a + b } }; let g = fn(n) { if (n < 1) { 0 } else { n + g(n - 1) } }; f(1)(2) + g(100)", "5053" },
+        { "let i = 0; let h = {}; while (i < 3) { let h = put(h, i, i * i); let i = i + 1; } h[2]", "4" },
+    };
+    char *path = make_temp_path();
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        write_program(tests[i].input, path);
+
+        Heap *heap = make_heap();
+        Compiler *compiler = make_compiler(heap);
+        CachedProgram *program = load_cached_program(compiler, tests[i].input, path);
+        assert(program != NULL);
+        // The bytecode is executed from the mapping
+        assert(program->main->instructions->capacity == 0);
+        uint8_t *code = program->main->instructions->array;
+        assert(code >= (uint8_t *)program->data && code < (uint8_t *)program->data + program->size);
+
+        char *result = run_main(compiler, program->main);
+        if (strcmp(result, tests[i].expected) != 0) {
+            printf("Input: %s\nExpected: %s\nGot: %s\n", tests[i].input, tests[i].expected, result);
+            assert(1 != 1);
+        }
+        free(result);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        cleanup_cached_program(program);
+    }
+    unlink(path);
+    free(path);
+}
+
+TEST_CASE(misses_stale_and_broken_files)
+{
+    char *input = "let f = fn(x) { x + 1 }; f(\"a\")";
+    char *path = make_temp_path();
+    write_program(input, path);
+    assert(loads(input, path));
+    assert(!loads("let f = fn(x) { x + 2 }; f(\"a\")", path));
+    assert(!loads("let f = fn(x) { x + 1 }; f(\"a\") ", path));
+
+    // A compiler that has compiled something already numbers its constants differently
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    assert(compile_single_pass(compiler, "\"other\"") != NULL);
+    assert(load_cached_program(compiler, input, path) == NULL);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+
+    FILE *file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    size_t size = ftell(file);
+    rewind(file);
+    uint8_t *contents = malloc(size);
+    assert(fread(contents, 1, size, file) == size);
+    fclose(file);
+
+    // Another compiler version
+    ((CacheHeader *)contents)->version++;
+    file = fopen(path, "wb");
+    fwrite(contents, 1, size, file);
+    fclose(file);
+    assert(!loads(input, path));
+    ((CacheHeader *)contents)->version--;
+
+    // Truncated
+    file = fopen(path, "wb");
+    fwrite(contents, 1, size - 1, file);
+    fclose(file);
+    assert(!loads(input, path));
+
+    // A string pointing past the end
+    CachedConstant *string = (CachedConstant *)(contents + sizeof(CacheHeader) + 2 * sizeof(CachedFunction));
+    while (string->type != CACHED_STRING) {
+        string++;
+    }
+    string->length = (uint32_t)size;
+    file = fopen(path, "wb");
+    fwrite(contents, 1, size, file);
+    fclose(file);
+    assert(!loads(input, path));
+
+    unlink(path);
+    assert(!loads(input, path));
+    free(contents);
+    free(path);
+}
+
+TEST_CASE(does_not_write_lazy_functions)
+{
+    char *input = "let f = fn(x) { x }; 1";
+    Parser *parser = make_parser(input, NULL);
+    parser->lazy_functions = TRUE;
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    char *path = make_temp_path();
+    unlink(path);
+    assert(!write_cached_program(compiler, main, input, path));
+    assert(access(path, F_OK) != 0);
+    free(path);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(cache_paths)
+{
+    struct {
+        const char *source_path;
+        const char *cache_dir;
+        const char *expected;
+    } tests[] = {
+        { "script.mk", NULL, "script.mkc" },
+        { "dir/script", NULL, "dir/script.mkc" },
+        { "dir.d/script", NULL, "dir.d/script.mkc" },
+        { "dir/.hidden", NULL, "dir/.hidden.mkc" },
+        { "script.mkc", NULL, "script.mkc.mkc" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *path = cached_program_path(tests[i].source_path, "1", tests[i].cache_dir);
+        if (strcmp(path, tests[i].expected) != 0) {
+            printf("Expected: %s\nGot: %s\n", tests[i].expected, path);
+            assert(1 != 1);
+        }
+        free(path);
+    }
+
+    // A cache directory holds the files of all scripts by the hash of their source
+    char expected[64];
+    snprintf(expected, sizeof(expected), "/cache/%016llx-%d.mkc", (unsigned long long)hash_bytes("1", 1), BYTECODE_CACHE_VERSION);
+    char *path = cached_program_path("script.mk", "1", "/cache");
+    assert(strcmp(path, expected) == 0);
+    free(path);
+}
+
+RUN_TESTS()
@@ -0,0 +1,179 @@
+#include "code.h"
+#include "arrlist_utils.h"
+#include "str_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define INITIAL_INSTRUCTIONS_CAPACITY 64
+
+static const OpDefinition OP_DEFINITIONS[] = {
+    [OP_CONSTANT] = { "OpConstant", 1, { 2 } },
+    [OP_POP] = { "OpPop", 0, { 0 } },
+    [OP_ADD] = { "OpAdd", 0, { 0 } },
+    [OP_SUB] = { "OpSub", 0, { 0 } },
+    [OP_MUL] = { "OpMul", 0, { 0 } },
+    [OP_DIV] = { "OpDiv", 0, { 0 } },
+    [OP_TRUE] = { "OpTrue", 0, { 0 } },
+    [OP_FALSE] = { "OpFalse", 0, { 0 } },
+    [OP_NULL] = { "OpNull", 0, { 0 } },
+    [OP_EQUAL] = { "OpEqual", 0, { 0 } },
+    [OP_NOT_EQUAL] = { "OpNotEqual", 0, { 0 } },
+    [OP_GREATER_THAN] = { "OpGreaterThan", 0, { 0 } },
+    [OP_NEG] = { "OpNeg", 0, { 0 } },
+    [OP_BANG] = { "OpBang", 0, { 0 } },
+    [OP_JUMP] = { "OpJump", 1, { 2 } },
+    [OP_JUMP_NOT_TRUTHY] = { "OpJumpNotTruthy", 1, { 2 } },
+    [OP_GET_GLOBAL] = { "OpGetGlobal", 1, { 2 } },
+    [OP_SET_GLOBAL] = { "OpSetGlobal", 1, { 2 } },
+    [OP_GET_LOCAL] = { "OpGetLocal", 1, { 1 } },
+    [OP_SET_LOCAL] = { "OpSetLocal", 1, { 1 } },
+    [OP_GET_UPVALUE] = { "OpGetUpvalue", 1, { 1 } },
+    [OP_CALL] = { "OpCall", 2, { 1, 2 } },
+    [OP_TAIL_CALL] = { "OpTailCall", 2, { 1, 2 } },
+    [OP_RETURN_VALUE] = { "OpReturnValue", 0, { 0 } },
+    [OP_RETURN] = { "OpReturn", 0, { 0 } },
+    [OP_CLOSURE] = { "OpClosure", 2, { 2, 1 } },
+    [OP_ARRAY] = { "OpArray", 1, { 2 } },
+    [OP_HASH] = { "OpHash", 1, { 2 } },
+    [OP_INDEX] = { "OpIndex", 1, { 2 } },
+    [OP_GET_BUILTIN] = { "OpGetBuiltin", 1, { 1 } },
+};
+
+const OpDefinition *lookup_op_definition(OpCode op)
+{
+    if (op < 0 || op >= sizeof(OP_DEFINITIONS) / sizeof(OP_DEFINITIONS[0])) {
+        return NULL;
+    }
+    return &OP_DEFINITIONS[op];
+}
+
+Instructions *make_instructions(void)
+{
+    Instructions *instructions = malloc(sizeof(Instructions));
+    instructions->array = calloc(INITIAL_INSTRUCTIONS_CAPACITY, sizeof(uint8_t));
+    instructions->size = 0;
+    instructions->capacity = INITIAL_INSTRUCTIONS_CAPACITY;
+    return instructions;
+}
+
+void cleanup_instructions(Instructions *instructions)
+{
+    if (instructions == NULL) {
+        return;
+    }
+    if (instructions->capacity != 0) {
+        free(instructions->array);
+    }
+    free(instructions);
+}
+
+// Returns the offset the bytes were written at
+size_t add_bytes_to_instructions(Instructions *instructions, const uint8_t *bytes, size_t count)
+{
+    size_t new_capacity = instructions->capacity;
+    while (instructions->size + count > new_capacity) {
+        new_capacity *= 2;
+    }
+    if (new_capacity != instructions->capacity) {
+        instructions->array = realloc_backing_array(&libc_allocator, instructions->array, instructions->size, instructions->capacity, new_capacity, sizeof(uint8_t));
+        instructions->capacity = new_capacity;
+    }
+    size_t position = instructions->size;
+    memcpy(&instructions->array[position], bytes, count);
+    instructions->size += count;
+    return position;
+}
+
+// Encodes a single instruction into `out`, which must hold at least MAX_INSTRUCTION_SIZE bytes.
+// Returns the number of bytes written.
+size_t make_instruction(uint8_t *out, OpCode op, const int *operands)
+{
+    const OpDefinition *def = lookup_op_definition(op);
+    assert(def != NULL);
+
+    size_t offset = 0;
+    out[offset++] = (uint8_t)op;
+    for (int i = 0; i < def->operand_count; i++) {
+        switch (def->operand_widths[i]) {
+        case 2:
+            write_uint16(&out[offset], (uint16_t)operands[i]);
+            break;
+        case 1:
+            out[offset] = (uint8_t)operands[i];
+            break;
+        default:
+            assert(1 != 1);
+        }
+        offset += def->operand_widths[i];
+    }
+    return offset;
+}
+
+// Decodes the operands following an opcode. Returns the number of bytes read.
+size_t read_operands(const OpDefinition *def, const uint8_t *ins, int *operands_out)
+{
+    size_t offset = 0;
+    for (int i = 0; i < def->operand_count; i++) {
+        switch (def->operand_widths[i]) {
+        case 2:
+            operands_out[i] = read_uint16(&ins[offset]);
+            break;
+        case 1:
+            operands_out[i] = ins[offset];
+            break;
+        default:
+            assert(1 != 1);
+        }
+        offset += def->operand_widths[i];
+    }
+    return offset;
+}
+
+char *instructions_to_str(Instructions *instructions)
+{
+    String *string = make_string(NULL);
+    char line[128];
+
+    size_t i = 0;
+    while (i < instructions->size) {
+        uint8_t op = instructions->array[i];
+        const OpDefinition *def = lookup_op_definition(op);
+        if (def == NULL) {
+            snprintf(line, sizeof(line), "ERROR: unknown opcode %d\n", op);
+            copy_str_into_string(string, line);
+            i++;
+            continue;
+        }
+
+        int operands[MAX_OPERANDS] = { 0 };
+        size_t read = read_operands(def, &instructions->array[i + 1], operands);
+
+        switch (def->operand_count) {
+        case 0:
+            snprintf(line, sizeof(line), "%04zu %s\n", i, def->name);
+            break;
+        case 1:
+            snprintf(line, sizeof(line), "%04zu %s %d\n", i, def->name, operands[0]);
+            break;
+        case 2:
+            snprintf(line, sizeof(line), "%04zu %s %d %d\n", i, def->name, operands[0], operands[1]);
+            break;
+        }
+        copy_str_into_string(string, line);
+        i += 1 + read;
+
+        if (op == OP_CLOSURE) {
+            // Upvalue descriptors trail the instruction
+            for (int j = 0; j < operands[1]; j++) {
+                snprintf(line, sizeof(line), "     | %s %d\n", instructions->array[i] ? "local" : "upvalue", instructions->array[i + 1]);
+                copy_str_into_string(string, line);
+                i += 2;
+            }
+        }
+    }
+
+    char *str = get_str_from_string(string);
+    cleanup_string(string);
+    return str;
+}
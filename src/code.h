@@ -0,0 +1,81 @@
+#ifndef CODE_H
+#define CODE_H
+
+#include "globals.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define MAX_OPERANDS 2
+#define MAX_INSTRUCTION_SIZE 4
+
+typedef enum OpCode {
+    OP_CONSTANT,
+    OP_POP,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_TRUE,
+    OP_FALSE,
+    OP_NULL,
+    OP_EQUAL,
+    OP_NOT_EQUAL,
+    OP_GREATER_THAN,
+    OP_NEG,
+    OP_BANG,
+    OP_JUMP,
+    OP_JUMP_NOT_TRUTHY,
+    OP_GET_GLOBAL,
+    OP_SET_GLOBAL,
+    OP_GET_LOCAL,
+    OP_SET_LOCAL,
+    OP_GET_UPVALUE,
+    // Second operand indexes the calling function's call-site cache table
+    OP_CALL,
+    // A call whose result is returned right away, the callee reuses the caller's frame
+    OP_TAIL_CALL,
+    OP_RETURN_VALUE,
+    OP_RETURN,
+    // Followed by one (is_local, index) byte pair per upvalue of the function
+    OP_CLOSURE,
+    // Builds a collection out of the elements, or key-value pairs, on top of the stack
+    OP_ARRAY,
+    OP_HASH,
+    OP_INDEX,
+    OP_GET_BUILTIN,
+} OpCode;
+
+typedef struct OpDefinition {
+    const char *name;
+    int operand_count;
+    int operand_widths[MAX_OPERANDS];
+} OpDefinition;
+
+typedef struct Instructions {
+    uint8_t *array;
+    size_t size;
+    size_t capacity; // 0 when `array` is borrowed, e.g. from a mapped bytecode cache, and is not freed
+} Instructions;
+
+extern const OpDefinition *lookup_op_definition(OpCode op);
+
+extern Instructions *make_instructions(void);
+extern void cleanup_instructions(Instructions *instructions);
+extern size_t add_bytes_to_instructions(Instructions *instructions, const uint8_t *bytes, size_t count);
+
+extern size_t make_instruction(uint8_t *out, OpCode op, const int *operands);
+extern size_t read_operands(const OpDefinition *def, const uint8_t *ins, int *operands_out);
+extern char *instructions_to_str(Instructions *instructions);
+
+static inline uint16_t read_uint16(const uint8_t *ins)
+{
+    return (uint16_t)((ins[0] << 8) | ins[1]);
+}
+
+static inline void write_uint16(uint8_t *ins, uint16_t value)
+{
+    ins[0] = (uint8_t)(value >> 8);
+    ins[1] = (uint8_t)(value & 0xff);
+}
+
+#endif // CODE_H
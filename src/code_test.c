@@ -0,0 +1,91 @@
+#include "code.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+TEST_CASE(make_instruction)
+{
+    struct {
+        OpCode op;
+        int operands[MAX_OPERANDS];
+        size_t expected_length;
+        uint8_t expected[MAX_INSTRUCTION_SIZE];
+    } tests[] = {
+        { OP_CONSTANT, { 65534 }, 3, { OP_CONSTANT, 255, 254 } },
+        { OP_ADD, { 0 }, 1, { OP_ADD } },
+        { OP_GET_LOCAL, { 255 }, 2, { OP_GET_LOCAL, 255 } },
+        { OP_CLOSURE, { 65534, 255 }, 4, { OP_CLOSURE, 255, 254, 255 } },
+        { OP_CALL, { 2, 258 }, 4, { OP_CALL, 2, 1, 2 } },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        uint8_t instruction[MAX_INSTRUCTION_SIZE];
+        size_t length = make_instruction(instruction, tests[i].op, tests[i].operands);
+        assert(length == tests[i].expected_length);
+        assert(memcmp(instruction, tests[i].expected, length) == 0);
+    }
+}
+
+TEST_CASE(read_operands)
+{
+    struct {
+        OpCode op;
+        int operands[MAX_OPERANDS];
+        size_t bytes_read;
+    } tests[] = {
+        { OP_CONSTANT, { 65535 }, 2 },
+        { OP_GET_LOCAL, { 255 }, 1 },
+        { OP_CLOSURE, { 65535, 255 }, 3 },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        uint8_t instruction[MAX_INSTRUCTION_SIZE];
+        make_instruction(instruction, tests[i].op, tests[i].operands);
+
+        const OpDefinition *def = lookup_op_definition(tests[i].op);
+        int operands_read[MAX_OPERANDS] = { 0 };
+        assert(read_operands(def, &instruction[1], operands_read) == tests[i].bytes_read);
+        for (int j = 0; j < def->operand_count; j++) {
+            assert(operands_read[j] == tests[i].operands[j]);
+        }
+    }
+}
+
+TEST_CASE(instructions_to_str)
+{
+    Instructions *instructions = make_instructions();
+    uint8_t instruction[MAX_INSTRUCTION_SIZE];
+
+    size_t length = make_instruction(instruction, OP_ADD, NULL);
+    add_bytes_to_instructions(instructions, instruction, length);
+    length = make_instruction(instruction, OP_GET_LOCAL, (int[]) { 1 });
+    add_bytes_to_instructions(instructions, instruction, length);
+    length = make_instruction(instruction, OP_CONSTANT, (int[]) { 2 });
+    add_bytes_to_instructions(instructions, instruction, length);
+    length = make_instruction(instruction, OP_CONSTANT, (int[]) { 65535 });
+    add_bytes_to_instructions(instructions, instruction, length);
+    length = make_instruction(instruction, OP_CLOSURE, (int[]) { 65535, 2 });
+    add_bytes_to_instructions(instructions, instruction, length);
+    add_bytes_to_instructions(instructions, (uint8_t[]) { 1, 0, 0, 3 }, 4);
+
+    const char *expected = "0000 OpAdd\n"
+                           "0001 OpGetLocal 1\n"
+                           "0003 OpConstant 2\n"
+                           "0006 OpConstant 65535\n"
+                           "0009 OpClosure 65535 2\n"
+                           "     | local 0\n"
+                           "     | upvalue 3\n";
+    char *str = instructions_to_str(instructions);
+    if (strcmp(str, expected) != 0) {
+        printf("Expected:\n%s\nGot:\n%s\n", expected, str);
+        assert(1 != 1);
+    }
+
+    free(str);
+    cleanup_instructions(instructions);
+}
+
+RUN_TESTS()
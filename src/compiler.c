@@ -0,0 +1,716 @@
+#include "compiler.h"
+#include "arrlist_utils.h"
+#include "ast.h"
+#include "code.h"
+#include "object.h"
+#include "resolver.h"
+#include "string_object.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void report_compiler_error(Compiler *compiler, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t total_len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *error = allocate(compiler->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
+    va_start(args, format);
+    vsprintf(error, format, args);
+    va_end(args);
+
+    add_error_to_arraylist(compiler->errors, error);
+}
+
+Compiler *make_compiler(Heap *heap)
+{
+    Compiler *compiler = malloc(sizeof(Compiler));
+    compiler->heap = heap;
+    compiler->resolver = make_resolver();
+    compiler->constants = make_value_arraylist();
+    compiler->strings = make_intern_table();
+    compiler->scope = NULL;
+    compiler->errors = compiler->resolver->errors;
+    return compiler;
+}
+
+void cleanup_compiler(Compiler *compiler)
+{
+    cleanup_resolver(compiler->resolver);
+    cleanup_value_arraylist(compiler->constants);
+    cleanup_intern_table(compiler->strings);
+    free(compiler);
+}
+
+// How many values each instruction leaves on the stack, used to size frames at compile time.
+// Calls are special cased since they depend on their operand.
+static int stack_effect(OpCode op, const int *operands)
+{
+    switch (op) {
+    case OP_CONSTANT:
+    case OP_TRUE:
+    case OP_FALSE:
+    case OP_NULL:
+    case OP_GET_GLOBAL:
+    case OP_GET_LOCAL:
+    case OP_GET_UPVALUE:
+    case OP_CLOSURE:
+    case OP_GET_BUILTIN:
+        return 1;
+    case OP_POP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV:
+    case OP_EQUAL:
+    case OP_NOT_EQUAL:
+    case OP_GREATER_THAN:
+    case OP_JUMP_NOT_TRUTHY:
+    case OP_SET_GLOBAL:
+    case OP_SET_LOCAL:
+    case OP_RETURN_VALUE:
+    case OP_INDEX:
+        return -1;
+    case OP_ARRAY:
+        return 1 - operands[0];
+    case OP_HASH:
+        return 1 - 2 * operands[0];
+    case OP_CALL:
+    case OP_TAIL_CALL:
+        return -operands[0];
+    default:
+        return 0;
+    }
+}
+
+static void adjust_stack_depth(CompilationScope *scope, int delta)
+{
+    scope->stack_depth += delta;
+    if (scope->stack_depth > scope->function->max_stack) {
+        scope->function->max_stack = scope->stack_depth;
+    }
+}
+
+size_t emit_bytes(Compiler *compiler, const uint8_t *bytes, size_t count)
+{
+    return add_bytes_to_instructions(compiler->scope->function->instructions, bytes, count);
+}
+
+size_t emit(Compiler *compiler, OpCode op, ...)
+{
+    const OpDefinition *def = lookup_op_definition(op);
+    int operands[MAX_OPERANDS] = { 0 };
+
+    va_list args;
+    va_start(args, op);
+    for (int i = 0; i < def->operand_count; i++) {
+        operands[i] = va_arg(args, int);
+    }
+    va_end(args);
+
+    uint8_t instruction[MAX_INSTRUCTION_SIZE];
+    size_t length = make_instruction(instruction, op, operands);
+    size_t position = emit_bytes(compiler, instruction, length);
+
+    CompilationScope *scope = compiler->scope;
+    scope->previous_instruction = scope->last_instruction;
+    scope->last_instruction.opcode = op;
+    scope->last_instruction.position = position;
+    adjust_stack_depth(scope, stack_effect(op, operands));
+
+    return position;
+}
+
+bool last_instruction_is(Compiler *compiler, OpCode op)
+{
+    Instructions *instructions = compiler->scope->function->instructions;
+    return instructions->size > 0 && compiler->scope->last_instruction.opcode == op;
+}
+
+void remove_last_pop(Compiler *compiler)
+{
+    CompilationScope *scope = compiler->scope;
+    scope->function->instructions->size = scope->last_instruction.position;
+    scope->last_instruction = scope->previous_instruction;
+    scope->stack_depth++;
+}
+
+static void change_operand(Compiler *compiler, size_t position, int operand)
+{
+    uint8_t *array = compiler->scope->function->instructions->array;
+    uint8_t instruction[MAX_INSTRUCTION_SIZE];
+    size_t length = make_instruction(instruction, array[position], &operand);
+    memcpy(&array[position], instruction, length);
+}
+
+int add_constant(Compiler *compiler, Value value)
+{
+    if (compiler->constants->size >= MAX_CONSTANTS) {
+        report_compiler_error(compiler, "Too many constants in program");
+        return 0;
+    }
+    return (int)add_value_to_arraylist(compiler->constants, value);
+}
+
+static void *allocate_constant_string(void *user, size_t size)
+{
+    return allocate_object(user, size, OBJ_STRING);
+}
+
+// Equal literals share one constant, made straight from the first one's span in the source
+int add_string_constant(Compiler *compiler, StringSpan literal)
+{
+    int constant = find_interned_literal(compiler->strings, literal);
+    if (constant != -1) {
+        return constant;
+    }
+    Allocator allocator = { .alloc = allocate_constant_string, .user = compiler->heap };
+    Value string = string_from_literal(literal, &allocator);
+    size_t num_constants = compiler->constants->size;
+    constant = add_constant(compiler, string);
+    if (compiler->constants->size > num_constants) {
+        add_interned_string(compiler->strings, AS_STRING(string), constant);
+    }
+    return constant;
+}
+
+void patch_jump(Compiler *compiler, size_t jump_position)
+{
+    size_t target = compiler->scope->function->instructions->size;
+    if (target > MAX_JUMP_TARGET) {
+        report_compiler_error(compiler, "Function body too large to jump over");
+        return;
+    }
+    change_operand(compiler, jump_position, (int)target);
+}
+
+void enter_scope(Compiler *compiler, CompilationScope *scope, FunctionProto *function)
+{
+    memset(scope, 0, sizeof(CompilationScope));
+    scope->function = function;
+    scope->enclosing = compiler->scope;
+    compiler->scope = scope;
+}
+
+void leave_scope(Compiler *compiler)
+{
+    FunctionProto *function = compiler->scope->function;
+    if (function->num_call_caches > 0) {
+        function->call_caches = calloc(function->num_call_caches, sizeof(CallCache));
+    }
+    if (function->num_index_caches > 0) {
+        function->index_caches = calloc(function->num_index_caches, sizeof(IndexCache));
+    }
+    compiler->scope = compiler->scope->enclosing;
+}
+
+static void compile_tail_expression(Compiler *compiler, ASTNode *node);
+
+// Compiles a block whose value is used, e.g. the branches of an if expression. In tail position
+// the block's final expression is compiled as a tail expression too.
+static void compile_block_value(Compiler *compiler, ASTNode *block, bool tail)
+{
+    ASTNodePtrArrayList *statements = block->data.block_stmt;
+    if (tail && statements->size > 0 && statements->array[statements->size - 1]->type == NODE_EXPR_STMT) {
+        for (size_t i = 0; i + 1 < statements->size; i++) {
+            compile_node(compiler, statements->array[i]);
+        }
+        compile_tail_expression(compiler, statements->array[statements->size - 1]->data.expr_stmt);
+        return;
+    }
+
+    compile_node(compiler, block);
+    if (last_instruction_is(compiler, OP_POP)) {
+        remove_last_pop(compiler);
+    } else {
+        // Empty blocks and blocks ending in a let statement evaluate to null
+        emit(compiler, OP_NULL);
+    }
+}
+
+static void compile_identifier(Compiler *compiler, ASTNode *node)
+{
+    Resolution *resolution = &node->data.identifier.resolution;
+    switch (resolution->scope) {
+    case SCOPE_GLOBAL:
+        emit(compiler, OP_GET_GLOBAL, resolution->index);
+        break;
+    case SCOPE_LOCAL:
+        emit(compiler, OP_GET_LOCAL, resolution->index);
+        break;
+    case SCOPE_UPVALUE:
+        emit(compiler, OP_GET_UPVALUE, resolution->index);
+        break;
+    case SCOPE_BUILTIN:
+        emit(compiler, OP_GET_BUILTIN, resolution->index);
+        break;
+    default:
+        report_compiler_error(compiler, "Unresolved identifier: %s", node->data.identifier.literal.value.identifier);
+    }
+}
+
+// Compiles the body of `literal` into `function`, which has no code yet
+static void compile_function_body(Compiler *compiler, FunctionProto *function, FunctionLiteral *literal)
+{
+    function->num_parameters = (int)literal->parameters->size;
+    function->num_locals = (int)literal->num_locals;
+    function->num_upvalues = (int)literal->num_upvalues;
+
+    CompilationScope scope;
+    enter_scope(compiler, &scope, function);
+    scope.in_function = TRUE;
+
+    ASTNodePtrArrayList *statements = literal->body->data.block_stmt;
+    if (statements->size > 0 && statements->array[statements->size - 1]->type == NODE_EXPR_STMT) {
+        compile_block_value(compiler, literal->body, TRUE);
+        emit(compiler, OP_RETURN_VALUE);
+    } else {
+        compile_node(compiler, literal->body);
+    }
+    if (!last_instruction_is(compiler, OP_RETURN_VALUE)) {
+        emit(compiler, OP_RETURN);
+    }
+
+    leave_scope(compiler);
+}
+
+// Creates a closure of `function` at runtime, capturing the variables listed by the resolver in `literal`
+void emit_closure(Compiler *compiler, FunctionProto *function, FunctionLiteral *literal)
+{
+    int constant = add_constant(compiler, OBJ_VAL(function));
+    emit(compiler, OP_CLOSURE, constant, (int)literal->num_upvalues);
+    for (size_t i = 0; i < literal->num_upvalues; i++) {
+        uint8_t descriptor[2] = { literal->upvalues[i].is_local ? 1 : 0, (uint8_t)literal->upvalues[i].index };
+        emit_bytes(compiler, descriptor, sizeof(descriptor));
+    }
+}
+
+static void compile_function_literal(Compiler *compiler, ASTNode *node, const char *name)
+{
+    FunctionLiteral *literal = &node->data.function_literal;
+    FunctionProto *function = make_function_proto(compiler->heap, name);
+    if (literal->body != NULL) {
+        compile_function_body(compiler, function, literal);
+    } else {
+        // Only the parameters are known, which is enough to check calls against
+        function->num_parameters = (int)literal->parameters->size;
+        function->lazy = malloc(sizeof(LazyFunction));
+        *function->lazy = (LazyFunction) { .compiler = compiler, .source = literal->source };
+    }
+
+    emit_closure(compiler, function, literal);
+}
+
+static void compile_let_statement(Compiler *compiler, ASTNode *node)
+{
+    ASTNode *identifier = node->data.let_stmt.left;
+    ASTNode *value = node->data.let_stmt.right;
+
+    if (value->type == NODE_FUNCTION_LITERAL) {
+        compile_function_literal(compiler, value, identifier->data.identifier.literal.value.identifier);
+    } else {
+        compile_node(compiler, value);
+    }
+
+    Resolution *resolution = &identifier->data.identifier.resolution;
+    switch (resolution->scope) {
+    case SCOPE_GLOBAL:
+        emit(compiler, OP_SET_GLOBAL, resolution->index);
+        break;
+    case SCOPE_LOCAL:
+        emit(compiler, OP_SET_LOCAL, resolution->index);
+        break;
+    default:
+        report_compiler_error(compiler, "Unresolved let binding: %s", identifier->data.identifier.literal.value.identifier);
+    }
+}
+
+static void compile_prefix_expression(Compiler *compiler, ASTNode *node)
+{
+    compile_node(compiler, node->data.prefix_expr.right);
+
+    switch (node->data.prefix_expr.token.type) {
+    case TOKEN_BANG:
+        emit(compiler, OP_BANG);
+        break;
+    case TOKEN_MINUS:
+        emit(compiler, OP_NEG);
+        break;
+    default:
+        report_compiler_error(compiler, "Unknown operator: %s", node->data.prefix_expr.operator);
+    }
+}
+
+static void compile_infix_expression(Compiler *compiler, ASTNode *node)
+{
+    // There is no less-than instruction, `a < b` is compiled as `b > a`
+    if (node->data.infix_expr.token.type == TOKEN_LT) {
+        compile_node(compiler, node->data.infix_expr.right);
+        compile_node(compiler, node->data.infix_expr.left);
+        emit(compiler, OP_GREATER_THAN);
+        return;
+    }
+
+    compile_node(compiler, node->data.infix_expr.left);
+    compile_node(compiler, node->data.infix_expr.right);
+
+    switch (node->data.infix_expr.token.type) {
+    case TOKEN_PLUS:
+        emit(compiler, OP_ADD);
+        break;
+    case TOKEN_MINUS:
+        emit(compiler, OP_SUB);
+        break;
+    case TOKEN_ASTERISK:
+        emit(compiler, OP_MUL);
+        break;
+    case TOKEN_SLASH:
+        emit(compiler, OP_DIV);
+        break;
+    case TOKEN_GT:
+        emit(compiler, OP_GREATER_THAN);
+        break;
+    case TOKEN_EQ:
+        emit(compiler, OP_EQUAL);
+        break;
+    case TOKEN_NOT_EQ:
+        emit(compiler, OP_NOT_EQUAL);
+        break;
+    default:
+        report_compiler_error(compiler, "Unknown operator: %s", node->data.infix_expr.operator);
+    }
+}
+
+static void compile_if_expression(Compiler *compiler, ASTNode *node, bool tail)
+{
+    compile_node(compiler, node->data.if_expr.condition);
+
+    size_t jump_not_truthy_position = emit(compiler, OP_JUMP_NOT_TRUTHY, 9999);
+    int branch_depth = compiler->scope->stack_depth;
+
+    compile_block_value(compiler, node->data.if_expr.consequence, tail);
+
+    size_t jump_position = emit(compiler, OP_JUMP, 9999);
+    patch_jump(compiler, jump_not_truthy_position);
+
+    // Only one of the branches runs, so the alternative starts from the same depth as the consequence
+    compiler->scope->stack_depth = branch_depth;
+
+    if (node->data.if_expr.alternative == NULL) {
+        emit(compiler, OP_NULL);
+    } else {
+        compile_block_value(compiler, node->data.if_expr.alternative, tail);
+    }
+
+    patch_jump(compiler, jump_position);
+}
+
+// Starts a loop at the current position, its condition comes first. Fails if that is too far
+// into the function to jump back to.
+bool begin_loop(Compiler *compiler, LoopScope *loop)
+{
+    CompilationScope *scope = compiler->scope;
+    *loop = (LoopScope) {
+        .start = scope->function->instructions->size,
+        .enclosing = scope->loop,
+    };
+    if (loop->start > MAX_JUMP_TARGET) {
+        report_compiler_error(compiler, "Function body too large to jump back to loop");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Marks the start of the body, after the condition, where `break` and `continue` apply
+void begin_loop_body(Compiler *compiler, LoopScope *loop)
+{
+    loop->stack_depth = compiler->scope->stack_depth;
+    compiler->scope->loop = loop;
+}
+
+// Jumps back to the condition at the end of the body and sends breaks past it
+void end_loop(Compiler *compiler, LoopScope *loop)
+{
+    emit(compiler, OP_JUMP, (int)loop->start);
+    compiler->scope->loop = loop->enclosing;
+    for (size_t i = 0; i < loop->num_breaks; i++) {
+        patch_jump(compiler, loop->breaks[i]);
+    }
+    free(loop->breaks);
+}
+
+// Loops compile to a conditional exit at the top and a backward jump at the bottom of the body
+static void compile_while_statement(Compiler *compiler, ASTNode *node)
+{
+    LoopScope loop;
+    if (!begin_loop(compiler, &loop)) {
+        return;
+    }
+
+    // `while (true)` needs no test, so only a break leads past the loop
+    ASTNode *condition = node->data.while_stmt.condition;
+    bool infinite = condition->type == NODE_LITERAL && condition->data.literal.type == LITERAL_BOOL && condition->data.literal.value.boolean_value;
+    size_t exit_position = 0;
+    if (!infinite) {
+        compile_node(compiler, condition);
+        exit_position = emit(compiler, OP_JUMP_NOT_TRUTHY, 9999);
+    }
+
+    begin_loop_body(compiler, &loop);
+    compile_node(compiler, node->data.while_stmt.body);
+    end_loop(compiler, &loop);
+
+    if (!infinite) {
+        patch_jump(compiler, exit_position);
+    }
+}
+
+// `break` or `continue`, named by `keyword` in errors
+void emit_loop_control(Compiler *compiler, bool is_break, const char *keyword)
+{
+    CompilationScope *scope = compiler->scope;
+    LoopScope *loop = scope->loop;
+    if (loop == NULL) {
+        report_compiler_error(compiler, "%s outside of a loop", keyword);
+        return;
+    }
+
+    // `break` may sit in an expression that already pushed operands, e.g. `1 + if (x) { break; }`
+    int depth = scope->stack_depth;
+    for (int i = loop->stack_depth; i < depth; i++) {
+        emit(compiler, OP_POP);
+    }
+
+    if (!is_break) {
+        emit(compiler, OP_JUMP, (int)loop->start);
+    } else {
+        if (loop->num_breaks == loop->breaks_capacity) {
+            size_t new_capacity = loop->breaks_capacity == 0 ? 4 : loop->breaks_capacity * 2;
+            loop->breaks = realloc_backing_array(&libc_allocator, loop->breaks, loop->breaks_capacity, loop->breaks_capacity, new_capacity, sizeof(size_t));
+            loop->breaks_capacity = new_capacity;
+        }
+        loop->breaks[loop->num_breaks++] = emit(compiler, OP_JUMP, 9999);
+    }
+
+    // Whatever follows is unreachable, it is compiled as if the expression carried on
+    scope->stack_depth = depth;
+}
+
+static void compile_call_expression(Compiler *compiler, ASTNode *node, bool tail)
+{
+    ASTNodePtrArrayList *arguments = node->data.call_expr.arguments;
+    if (arguments->size > MAX_ARGUMENTS) {
+        report_compiler_error(compiler, "Too many arguments in call, at most %d are allowed", MAX_ARGUMENTS);
+        return;
+    }
+
+    FunctionProto *function = compiler->scope->function;
+    if (function->num_call_caches >= MAX_CALL_CACHES) {
+        report_compiler_error(compiler, "Too many calls in function %s", function->name);
+        return;
+    }
+
+    compile_node(compiler, node->data.call_expr.function);
+    for (size_t i = 0; i < arguments->size; i++) {
+        compile_node(compiler, arguments->array[i]);
+    }
+    emit(compiler, tail ? OP_TAIL_CALL : OP_CALL, (int)arguments->size, function->num_call_caches++);
+}
+
+static void compile_index_expression(Compiler *compiler, ASTNode *node)
+{
+    FunctionProto *function = compiler->scope->function;
+    if (function->num_index_caches >= MAX_INDEX_CACHES) {
+        report_compiler_error(compiler, "Too many index expressions in function %s", function->name);
+        return;
+    }
+
+    compile_node(compiler, node->data.index_expr.left);
+    compile_node(compiler, node->data.index_expr.index);
+    emit(compiler, OP_INDEX, function->num_index_caches++);
+}
+
+static void compile_array_literal(Compiler *compiler, ASTNode *node)
+{
+    ASTNodePtrArrayList *elements = node->data.array_literal;
+    if (elements->size > MAX_LITERAL_ELEMENTS) {
+        report_compiler_error(compiler, "Too many elements in array literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return;
+    }
+    for (size_t i = 0; i < elements->size; i++) {
+        compile_node(compiler, elements->array[i]);
+    }
+    emit(compiler, OP_ARRAY, (int)elements->size);
+}
+
+// Pairs are pushed key first in source order, so a repeated key ends up with its last value
+static void compile_hash_literal(Compiler *compiler, ASTNode *node)
+{
+    HashLiteral *literal = &node->data.hash_literal;
+    if (literal->keys->size > MAX_LITERAL_ELEMENTS) {
+        report_compiler_error(compiler, "Too many pairs in hash literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return;
+    }
+    for (size_t i = 0; i < literal->keys->size; i++) {
+        compile_node(compiler, literal->keys->array[i]);
+        compile_node(compiler, literal->values->array[i]);
+    }
+    emit(compiler, OP_HASH, (int)literal->keys->size);
+}
+
+// Compiles an expression whose value the current function returns. Calls there reuse the
+// caller's frame, so recursion in tail position runs in constant stack space. The top-level
+// code has no caller to hand its frame over to.
+static void compile_tail_expression(Compiler *compiler, ASTNode *node)
+{
+    bool in_function = compiler->scope->in_function;
+    if (in_function && node->type == NODE_CALL_EXPR) {
+        compile_call_expression(compiler, node, TRUE);
+    } else if (in_function && node->type == NODE_IF_EXPR) {
+        compile_if_expression(compiler, node, TRUE);
+    } else {
+        compile_node(compiler, node);
+    }
+}
+
+void compile_node(Compiler *compiler, ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_LET_STMT:
+        compile_let_statement(compiler, node);
+        break;
+    case NODE_RETURN_STMT:
+        compile_tail_expression(compiler, node->data.return_stmt);
+        emit(compiler, OP_RETURN_VALUE);
+        break;
+    case NODE_EXPR_STMT:
+        compile_node(compiler, node->data.expr_stmt);
+        emit(compiler, OP_POP);
+        break;
+    case NODE_PREFIX_EXPR:
+        compile_prefix_expression(compiler, node);
+        break;
+    case NODE_INFIX_EXPR:
+        compile_infix_expression(compiler, node);
+        break;
+    case NODE_LITERAL:
+        switch (node->data.literal.type) {
+        case LITERAL_INT:
+            emit(compiler, OP_CONSTANT, add_constant(compiler, INT_VAL(node->data.literal.value.int_value)));
+            break;
+        case LITERAL_FLOAT:
+            emit(compiler, OP_CONSTANT, add_constant(compiler, FLOAT_VAL(node->data.literal.value.float_value)));
+            break;
+        case LITERAL_BOOL:
+            emit(compiler, node->data.literal.value.boolean_value ? OP_TRUE : OP_FALSE);
+            break;
+        case LITERAL_STRING:
+            emit(compiler, OP_CONSTANT, add_string_constant(compiler, node->data.literal.value.string_value));
+            break;
+        default:
+            report_compiler_error(compiler, "Unsupported literal: %s", node->token_literal);
+        }
+        break;
+    case NODE_IDENTIFIER:
+        compile_identifier(compiler, node);
+        break;
+    case NODE_BLOCK_STMT:
+        for (size_t i = 0; i < node->data.block_stmt->size; i++) {
+            compile_node(compiler, node->data.block_stmt->array[i]);
+        }
+        break;
+    case NODE_IF_EXPR:
+        compile_if_expression(compiler, node, FALSE);
+        break;
+    case NODE_FUNCTION_LITERAL:
+        compile_function_literal(compiler, node, NULL);
+        break;
+    case NODE_CALL_EXPR:
+        compile_call_expression(compiler, node, FALSE);
+        break;
+    case NODE_WHILE_STMT:
+        compile_while_statement(compiler, node);
+        break;
+    case NODE_BREAK_STMT:
+    case NODE_CONTINUE_STMT:
+        emit_loop_control(compiler, node->type == NODE_BREAK_STMT, node->token_literal);
+        break;
+    case NODE_ARRAY_LITERAL:
+        compile_array_literal(compiler, node);
+        break;
+    case NODE_HASH_LITERAL:
+        compile_hash_literal(compiler, node);
+        break;
+    case NODE_INDEX_EXPR:
+        compile_index_expression(compiler, node);
+        break;
+    default:
+        report_compiler_error(compiler, "Cannot compile node of type %s", node_type_to_str(node->type));
+    }
+}
+
+// Returns the program's top-level function, or NULL if resolution or compilation failed
+FunctionProto *compile_program(Compiler *compiler, Program *program)
+{
+    size_t errors_before = compiler->errors->size;
+
+    if (!resolve_program(compiler->resolver, program)) {
+        return NULL;
+    }
+
+    FunctionProto *function = make_function_proto(compiler->heap, "main");
+    CompilationScope scope;
+    enter_scope(compiler, &scope, function);
+
+    for (size_t i = 0; i < program->size; i++) {
+        compile_node(compiler, program->array[i]);
+    }
+    emit(compiler, OP_RETURN);
+
+    leave_scope(compiler);
+    function->num_globals = get_global_count(compiler->resolver);
+
+    if (compiler->errors->size != errors_before) {
+        return NULL;
+    }
+    return function;
+}
+
+// Parses, resolves and compiles a function skipped by a lazy parser, called before it first runs.
+// On errors, which are added to the compiler's, the function is left without code.
+bool compile_lazy_function(FunctionProto *function)
+{
+    LazyFunction *lazy = function->lazy;
+    Compiler *compiler = lazy->compiler;
+    size_t errors_before = compiler->errors->size;
+
+    Parser *parser = make_span_parser((char *)lazy->source.start, lazy->source.length, NULL);
+    ASTNode *node = parse_function_source(parser);
+    for (size_t i = 0; i < parser->errors->size; i++) {
+        add_error_to_arraylist(compiler->errors, allocate_str(compiler->errors->allocator, get_error_from_arraylist(parser->errors, i)));
+    }
+
+    if (node != NULL && compiler->errors->size == errors_before && resolve_lazy_function(compiler->resolver, node)) {
+        compile_function_body(compiler, function, &node->data.function_literal);
+    }
+    cleanup_parser(parser);
+
+    if (compiler->errors->size != errors_before) {
+        function->instructions->size = 0;
+        free(function->call_caches);
+        function->call_caches = NULL;
+        function->num_call_caches = 0;
+        free(function->index_caches);
+        function->index_caches = NULL;
+        function->num_index_caches = 0;
+        function->max_stack = 0;
+        return FALSE;
+    }
+    free(lazy);
+    function->lazy = NULL;
+    return TRUE;
+}
@@ -0,0 +1,86 @@
+#ifndef COMPILER_H
+#define COMPILER_H
+
+#include "ast.h"
+#include "code.h"
+#include "globals.h"
+#include "object.h"
+#include "parser.h"
+#include "resolver.h"
+#include "string_object.h"
+
+#define MAX_CONSTANTS 65536
+#define MAX_JUMP_TARGET 65535
+#define MAX_ARGUMENTS 255
+#define MAX_CALL_CACHES 65536
+#define MAX_INDEX_CACHES 65536
+#define MAX_LITERAL_ELEMENTS 65535
+
+typedef struct EmittedInstruction {
+    OpCode opcode;
+    size_t position;
+} EmittedInstruction;
+
+// The innermost loop being compiled. `break` jumps forwards and is patched once the end of the
+// loop is known, `continue` jumps straight back to the condition.
+typedef struct LoopScope {
+    size_t start;
+    int stack_depth; // Operand stack depth in the body, anything above is unwound when leaving it
+    size_t *breaks;
+    size_t num_breaks;
+    size_t breaks_capacity;
+    struct LoopScope *enclosing;
+} LoopScope;
+
+typedef struct CompilationScope {
+    FunctionProto *function;
+    bool in_function; // Unset for a program's top-level code
+    EmittedInstruction last_instruction;
+    EmittedInstruction previous_instruction;
+    int stack_depth;
+    LoopScope *loop;
+    struct CompilationScope *enclosing;
+} CompilationScope;
+
+// Turns resolved programs into bytecode. One compiler can be fed several programs in a row
+// (e.g. REPL lines), they share the resolver's globals and one constant pool.
+typedef struct Compiler {
+    Heap *heap;
+    Resolver *resolver;
+    ValueArrayList *constants;
+    InternTable *strings; // String constants by contents
+    CompilationScope *scope;
+    ErrorArrayList *errors; // Shared with the resolver so all front-end errors end up in one place
+} Compiler;
+
+// A function whose body a lazy parser skipped, compiled on its first call by the compiler that
+// compiled the code defining it. Both the compiler and the program's source must be around then.
+typedef struct LazyFunction {
+    Compiler *compiler;
+    StringSpan source; // See FunctionLiteral
+} LazyFunction;
+
+extern Compiler *make_compiler(Heap *heap);
+extern void cleanup_compiler(Compiler *compiler);
+extern FunctionProto *compile_program(Compiler *compiler, Program *program);
+extern void compile_node(Compiler *compiler, ASTNode *node);
+extern bool compile_lazy_function(FunctionProto *function);
+
+// Emitting code into the function of the current scope, also used by the single-pass compiler
+extern void report_compiler_error(Compiler *compiler, const char *format, ...);
+extern size_t emit(Compiler *compiler, OpCode op, ...);
+extern size_t emit_bytes(Compiler *compiler, const uint8_t *bytes, size_t count);
+extern bool last_instruction_is(Compiler *compiler, OpCode op);
+extern void remove_last_pop(Compiler *compiler);
+extern int add_constant(Compiler *compiler, Value value);
+extern int add_string_constant(Compiler *compiler, StringSpan literal);
+extern void patch_jump(Compiler *compiler, size_t jump_position);
+extern void enter_scope(Compiler *compiler, CompilationScope *scope, FunctionProto *function);
+extern void leave_scope(Compiler *compiler);
+extern void emit_closure(Compiler *compiler, FunctionProto *function, FunctionLiteral *literal);
+extern bool begin_loop(Compiler *compiler, LoopScope *loop);
+extern void begin_loop_body(Compiler *compiler, LoopScope *loop);
+extern void end_loop(Compiler *compiler, LoopScope *loop);
+extern void emit_loop_control(Compiler *compiler, bool is_break, const char *keyword);
+
+#endif // COMPILER_H
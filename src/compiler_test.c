@@ -0,0 +1,418 @@
+#include "compiler.h"
+#include "errors.h"
+#include "object.h"
+#include "parser.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+typedef struct CompiledProgram {
+    Parser *parser;
+    Program *program;
+    Heap *heap;
+    Compiler *compiler;
+    FunctionProto *main;
+} CompiledProgram;
+
+static CompiledProgram compile_source(char *input)
+{
+    CompiledProgram compiled;
+    compiled.parser = make_parser(input, NULL);
+    compiled.program = parse_program(compiled.parser);
+    assert(compiled.parser->errors->size == 0);
+
+    compiled.heap = make_heap();
+    compiled.compiler = make_compiler(compiled.heap);
+    compiled.main = compile_program(compiled.compiler, compiled.program);
+    return compiled;
+}
+
+static void cleanup_compiled_program(CompiledProgram *compiled)
+{
+    cleanup_compiler(compiled->compiler);
+    cleanup_heap(compiled->heap);
+    cleanup_program(compiled->program);
+    cleanup_parser(compiled->parser);
+}
+
+static void assert_instructions(FunctionProto *function, const char *expected)
+{
+    char *str = instructions_to_str(function->instructions);
+    if (strcmp(str, expected) != 0) {
+        printf("Wrong instructions for %s\nExpected:\n%s\nGot:\n%s\n", function->name, expected, str);
+        assert(1 != 1);
+    }
+    free(str);
+}
+
+static void assert_integer_constant(Compiler *compiler, size_t index, int64_t expected)
+{
+    assert(index < compiler->constants->size);
+    Value value = compiler->constants->array[index];
+    assert(IS_INT(value));
+    assert(AS_INT(value) == expected);
+}
+
+static FunctionProto *function_constant(Compiler *compiler, size_t index)
+{
+    assert(index < compiler->constants->size);
+    Value value = compiler->constants->array[index];
+    assert(IS_FUNCTION(value));
+    return AS_FUNCTION(value);
+}
+
+TEST_CASE(compile_integer_arithmetic)
+{
+    CompiledProgram compiled = compile_source("1 + 2; 1 - 2 * 3; -1; 2 < 1;");
+    assert(compiled.main != NULL);
+
+    assert_instructions(compiled.main,
+        "0000 OpConstant 0\n"
+        "0003 OpConstant 1\n"
+        "0006 OpAdd\n"
+        "0007 OpPop\n"
+        "0008 OpConstant 2\n"
+        "0011 OpConstant 3\n"
+        "0014 OpConstant 4\n"
+        "0017 OpMul\n"
+        "0018 OpSub\n"
+        "0019 OpPop\n"
+        "0020 OpConstant 5\n"
+        "0023 OpNeg\n"
+        "0024 OpPop\n"
+        "0025 OpConstant 6\n"
+        "0028 OpConstant 7\n"
+        "0031 OpGreaterThan\n"
+        "0032 OpPop\n"
+        "0033 OpReturn\n");
+    assert_integer_constant(compiled.compiler, 0, 1);
+    assert_integer_constant(compiled.compiler, 1, 2);
+    // `2 < 1` is compiled as `1 > 2`
+    assert_integer_constant(compiled.compiler, 6, 1);
+    assert_integer_constant(compiled.compiler, 7, 2);
+    assert(compiled.main->max_stack == 3);
+
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_conditionals)
+{
+    CompiledProgram compiled = compile_source("if (true) { 10 }; 3333;");
+    assert(compiled.main != NULL);
+    assert_instructions(compiled.main,
+        "0000 OpTrue\n"
+        "0001 OpJumpNotTruthy 10\n"
+        "0004 OpConstant 0\n"
+        "0007 OpJump 11\n"
+        "0010 OpNull\n"
+        "0011 OpPop\n"
+        "0012 OpConstant 1\n"
+        "0015 OpPop\n"
+        "0016 OpReturn\n");
+    cleanup_compiled_program(&compiled);
+
+    compiled = compile_source("if (true) { 10 } else { 20 };");
+    assert(compiled.main != NULL);
+    assert_instructions(compiled.main,
+        "0000 OpTrue\n"
+        "0001 OpJumpNotTruthy 10\n"
+        "0004 OpConstant 0\n"
+        "0007 OpJump 13\n"
+        "0010 OpConstant 1\n"
+        "0013 OpPop\n"
+        "0014 OpReturn\n");
+    // Only one branch is ever on the stack at a time
+    assert(compiled.main->max_stack == 1);
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_globals)
+{
+    CompiledProgram compiled = compile_source("let one = 1; let two = one; two;");
+    assert(compiled.main != NULL);
+    assert_instructions(compiled.main,
+        "0000 OpConstant 0\n"
+        "0003 OpSetGlobal 0\n"
+        "0006 OpGetGlobal 0\n"
+        "0009 OpSetGlobal 1\n"
+        "0012 OpGetGlobal 1\n"
+        "0015 OpPop\n"
+        "0016 OpReturn\n");
+    assert(compiled.main->num_globals == 2);
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_functions_and_locals)
+{
+    CompiledProgram compiled = compile_source("let add = fn(a, b) { let c = a + b; c }; add(1, 2);");
+    assert(compiled.main != NULL);
+    assert_instructions(compiled.main,
+        "0000 OpClosure 0 0\n"
+        "0004 OpSetGlobal 0\n"
+        "0007 OpGetGlobal 0\n"
+        "0010 OpConstant 1\n"
+        "0013 OpConstant 2\n"
+        "0016 OpCall 2 0\n"
+        "0020 OpPop\n"
+        "0021 OpReturn\n");
+
+    FunctionProto *add = function_constant(compiled.compiler, 0);
+    assert(strcmp(add->name, "add") == 0);
+    assert(add->num_parameters == 2);
+    assert(add->num_locals == 3);
+    assert(add->max_stack == 2);
+    assert_instructions(add,
+        "0000 OpGetLocal 0\n"
+        "0002 OpGetLocal 1\n"
+        "0004 OpAdd\n"
+        "0005 OpSetLocal 2\n"
+        "0007 OpGetLocal 2\n"
+        "0009 OpReturnValue\n");
+    cleanup_compiled_program(&compiled);
+
+    compiled = compile_source("fn() { }; fn() { return 1; 2 };");
+    assert(compiled.main != NULL);
+    assert_instructions(function_constant(compiled.compiler, 0), "0000 OpReturn\n");
+    // A function's own constants are added before the function itself
+    assert_instructions(function_constant(compiled.compiler, 3),
+        "0000 OpConstant 1\n"
+        "0003 OpReturnValue\n"
+        "0004 OpConstant 2\n"
+        "0007 OpReturnValue\n");
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_closures)
+{
+    CompiledProgram compiled = compile_source("fn(a) { fn(b) { fn(c) { a + b + c } } };");
+    assert(compiled.main != NULL);
+
+    // Constants are added innermost function first
+    FunctionProto *innermost = function_constant(compiled.compiler, 0);
+    assert(innermost->num_upvalues == 2);
+    assert_instructions(innermost,
+        "0000 OpGetUpvalue 0\n"
+        "0002 OpGetUpvalue 1\n"
+        "0004 OpAdd\n"
+        "0005 OpGetLocal 0\n"
+        "0007 OpAdd\n"
+        "0008 OpReturnValue\n");
+
+    FunctionProto *middle = function_constant(compiled.compiler, 1);
+    assert(middle->num_upvalues == 1);
+    assert_instructions(middle,
+        "0000 OpClosure 0 2\n"
+        "     | upvalue 0\n"
+        "     | local 0\n"
+        "0008 OpReturnValue\n");
+
+    FunctionProto *outer = function_constant(compiled.compiler, 2);
+    assert(outer->num_upvalues == 0);
+    assert_instructions(outer,
+        "0000 OpClosure 1 1\n"
+        "     | local 0\n"
+        "0006 OpReturnValue\n");
+
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_call_site_caches)
+{
+    CompiledProgram compiled = compile_source("let f = fn(x) { x }; f(1); f(f(2)); let g = fn() { f(3) };");
+    assert(compiled.main != NULL);
+
+    // Every call site gets its own cache, numbered per function
+    assert(compiled.main->num_call_caches == 3);
+    assert(compiled.main->call_caches != NULL);
+    assert(compiled.main->call_caches[0].state == CACHE_UNINITIALIZED);
+
+    FunctionProto *g = function_constant(compiled.compiler, 4);
+    assert(strcmp(g->name, "g") == 0);
+    assert(g->num_call_caches == 1);
+    assert_instructions(g,
+        "0000 OpGetGlobal 0\n"
+        "0003 OpConstant 3\n"
+        "0006 OpTailCall 1 0\n"
+        "0010 OpReturnValue\n");
+
+    FunctionProto *f = function_constant(compiled.compiler, 0);
+    assert(f->num_call_caches == 0);
+    assert(f->call_caches == NULL);
+
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_tail_calls)
+{
+    CompiledProgram compiled = compile_source("let f = fn(n) { if (n > 0) { f(n - 1) } else { let x = f(0); return f(x); } }; f(1);");
+    assert(compiled.main != NULL);
+
+    // Calls in both branches are in tail position, the one whose result is stored is not.
+    // The top-level call has no frame to give away.
+    FunctionProto *f = function_constant(compiled.compiler, 3);
+    assert(strcmp(f->name, "f") == 0);
+    assert_instructions(f,
+        "0000 OpGetLocal 0\n"
+        "0002 OpConstant 0\n"
+        "0005 OpGreaterThan\n"
+        "0006 OpJumpNotTruthy 25\n"
+        "0009 OpGetGlobal 0\n"
+        "0012 OpGetLocal 0\n"
+        "0014 OpConstant 1\n"
+        "0017 OpSub\n"
+        "0018 OpTailCall 1 0\n"
+        "0022 OpJump 48\n"
+        "0025 OpGetGlobal 0\n"
+        "0028 OpConstant 2\n"
+        "0031 OpCall 1 1\n"
+        "0035 OpSetLocal 1\n"
+        "0037 OpGetGlobal 0\n"
+        "0040 OpGetLocal 1\n"
+        "0042 OpTailCall 1 2\n"
+        "0046 OpReturnValue\n"
+        "0047 OpNull\n"
+        "0048 OpReturnValue\n");
+    cleanup_compiled_program(&compiled);
+
+    compiled = compile_source("let g = fn(n) { 1 + g(n) }; g(1);");
+    assert_instructions(function_constant(compiled.compiler, 1),
+        "0000 OpConstant 0\n"
+        "0003 OpGetGlobal 0\n"
+        "0006 OpGetLocal 0\n"
+        "0008 OpCall 1 0\n"
+        "0012 OpAdd\n"
+        "0013 OpReturnValue\n");
+    assert_instructions(compiled.main,
+        "0000 OpClosure 1 0\n"
+        "0004 OpSetGlobal 0\n"
+        "0007 OpGetGlobal 0\n"
+        "0010 OpConstant 2\n"
+        "0013 OpCall 1 0\n"
+        "0017 OpPop\n"
+        "0018 OpReturn\n");
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_loops)
+{
+    CompiledProgram compiled = compile_source("let i = 0; while (i < 10) { if (i == 5) { break; } let i = i + 1; }");
+    assert(compiled.main != NULL);
+
+    // The condition is checked at the top, the end of the body jumps back to it
+    assert_instructions(compiled.main,
+        "0000 OpConstant 0\n"
+        "0003 OpSetGlobal 0\n"
+        "0006 OpConstant 1\n"
+        "0009 OpGetGlobal 0\n"
+        "0012 OpGreaterThan\n"
+        "0013 OpJumpNotTruthy 48\n"
+        "0016 OpGetGlobal 0\n"
+        "0019 OpConstant 2\n"
+        "0022 OpEqual\n"
+        "0023 OpJumpNotTruthy 33\n"
+        "0026 OpJump 48\n"
+        "0029 OpNull\n"
+        "0030 OpJump 34\n"
+        "0033 OpNull\n"
+        "0034 OpPop\n"
+        "0035 OpGetGlobal 0\n"
+        "0038 OpConstant 3\n"
+        "0041 OpAdd\n"
+        "0042 OpSetGlobal 0\n"
+        "0045 OpJump 6\n"
+        "0048 OpReturn\n");
+    cleanup_compiled_program(&compiled);
+
+    // `while (true)` has no test. Leaving the loop from inside an expression drops the operands
+    // the expression already pushed.
+    compiled = compile_source("let f = fn() { while (true) { 1 + if (true) { continue; } else { 2 }; } }; f();");
+    assert_instructions(function_constant(compiled.compiler, 2),
+        "0000 OpConstant 0\n"
+        "0003 OpTrue\n"
+        "0004 OpJumpNotTruthy 15\n"
+        "0007 OpPop\n"
+        "0008 OpJump 0\n"
+        "0011 OpNull\n"
+        "0012 OpJump 18\n"
+        "0015 OpConstant 1\n"
+        "0018 OpAdd\n"
+        "0019 OpPop\n"
+        "0020 OpJump 0\n"
+        "0023 OpReturn\n");
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_collections)
+{
+    CompiledProgram compiled = compile_source("[1, 2][0]; {1: 2}; len([]);");
+    assert(compiled.main != NULL);
+    assert_instructions(compiled.main,
+        "0000 OpConstant 0\n"
+        "0003 OpConstant 1\n"
+        "0006 OpArray 2\n"
+        "0009 OpConstant 2\n"
+        "0012 OpIndex 0\n"
+        "0015 OpPop\n"
+        "0016 OpConstant 3\n"
+        "0019 OpConstant 4\n"
+        "0022 OpHash 1\n"
+        "0025 OpPop\n"
+        "0026 OpGetBuiltin 0\n"
+        "0028 OpArray 0\n"
+        "0031 OpCall 1 0\n"
+        "0035 OpPop\n"
+        "0036 OpReturn\n");
+    // A pair is on the stack at once before the hash replaces it
+    assert(compiled.main->max_stack == 2);
+    assert(compiled.main->num_globals == 0);
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_string_literals)
+{
+    CompiledProgram compiled = compile_source("\"a\"; \"b\\n\"; fn() { \"a\" + \"b\\n\" }; \"a\";");
+    assert(compiled.main != NULL);
+    // Equal literals load the same constant, escapes or not
+    assert_instructions(compiled.main,
+        "0000 OpConstant 0\n"
+        "0003 OpPop\n"
+        "0004 OpConstant 1\n"
+        "0007 OpPop\n"
+        "0008 OpClosure 2 0\n"
+        "0012 OpPop\n"
+        "0013 OpConstant 0\n"
+        "0016 OpPop\n"
+        "0017 OpReturn\n");
+    assert(compiled.compiler->constants->size == 3);
+    Value *constants = compiled.compiler->constants->array;
+    assert(IS_STRING(constants[0]) && strcmp(AS_STRING(constants[0])->chars, "a") == 0);
+    assert(IS_STRING(constants[1]) && AS_STRING(constants[1])->length == 2 && strcmp(AS_STRING(constants[1])->chars, "b\n") == 0);
+    assert_instructions(AS_FUNCTION(constants[2]),
+        "0000 OpConstant 0\n"
+        "0003 OpConstant 1\n"
+        "0006 OpAdd\n"
+        "0007 OpReturnValue\n");
+    cleanup_compiled_program(&compiled);
+}
+
+TEST_CASE(compile_errors)
+{
+    CompiledProgram compiled = compile_source("let a = b;");
+    assert(compiled.main == NULL);
+    assert(compiled.compiler->errors->size == 1);
+    assert(strcmp(get_error_from_arraylist(compiled.compiler->errors, 0), "Identifier not found: b") == 0);
+    cleanup_compiled_program(&compiled);
+
+    // A function defined in a loop cannot leave that loop
+    compiled = compile_source("break; while (true) { let f = fn() { continue; }; break; }");
+    assert(compiled.main == NULL);
+    assert(compiled.compiler->errors->size == 2);
+    assert(strcmp(get_error_from_arraylist(compiled.compiler->errors, 0), "break outside of a loop") == 0);
+    assert(strcmp(get_error_from_arraylist(compiled.compiler->errors, 1), "continue outside of a loop") == 0);
+    cleanup_compiled_program(&compiled);
+}
+
+RUN_TESTS()
@@ -0,0 +1,352 @@
+#include "gc.h"
+#include "marker.h"
+#include "object.h"
+#include "pool.h"
+#include "vm.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INITIAL_GRAY_STACK_CAPACITY 64
+#define INITIAL_REMEMBERED_CAPACITY 64
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void record_pause(Heap *heap, uint64_t start)
+{
+    uint64_t pause = now_ns() - start;
+    heap->stats.total_pause_ns += pause;
+    heap->stats.last_pause_ns = pause;
+    if (pause > heap->stats.max_pause_ns) {
+        heap->stats.max_pause_ns = pause;
+    }
+    heap->stats.pause_samples[heap->stats.num_pauses % GC_PAUSE_SAMPLES] = pause;
+    heap->stats.num_pauses++;
+}
+
+static void push_gray(Heap *heap, Object *object)
+{
+    if (heap->gray_count == heap->gray_capacity) {
+        heap->gray_capacity = heap->gray_capacity == 0 ? INITIAL_GRAY_STACK_CAPACITY : heap->gray_capacity * 2;
+        heap->gray_stack = realloc(heap->gray_stack, heap->gray_capacity * sizeof(Object *));
+    }
+    heap->gray_stack[heap->gray_count++] = object;
+}
+
+void remember_object(Heap *heap, Object *object)
+{
+    if (heap->remembered_count == heap->remembered_capacity) {
+        heap->remembered_capacity = heap->remembered_capacity == 0 ? INITIAL_REMEMBERED_CAPACITY : heap->remembered_capacity * 2;
+        heap->remembered = realloc(heap->remembered, heap->remembered_capacity * sizeof(Object *));
+    }
+    object->remembered = TRUE;
+    heap->remembered[heap->remembered_count++] = object;
+}
+
+// Minor collection
+
+// Returns where a young object lives after promotion, copying it to the old space the first time
+static Object *forward(Heap *heap, Object *object)
+{
+    if (object == NULL || !is_young(heap, object)) {
+        return object;
+    }
+    if (object->marked) {
+        return object->next;
+    }
+
+    size_t size = object_size(object);
+    Object *copy = pool_alloc(size);
+    memcpy(copy, object, size);
+    copy->marked = FALSE;
+    copy->remembered = FALSE;
+    copy->next = heap->objects;
+    heap->objects = copy;
+    heap->bytes_allocated += size;
+
+    // A closed upvalue points at its own copy of the value
+    if (copy->type == OBJ_UPVALUE && ((Upvalue *)object)->location == &((Upvalue *)object)->closed) {
+        ((Upvalue *)copy)->location = &((Upvalue *)copy)->closed;
+    }
+
+    object->marked = TRUE;
+    object->next = copy;
+    heap->stats.objects_promoted++;
+    heap->stats.bytes_promoted += size;
+    push_gray(heap, copy);
+    return copy;
+}
+
+static void forward_value(Heap *heap, Value *value)
+{
+    if (IS_OBJ(*value)) {
+        value->as.obj = forward(heap, AS_OBJ(*value));
+    }
+}
+
+static void forward_references(Heap *heap, Object *object)
+{
+    switch (object->type) {
+    case OBJ_FUNCTION:
+        // Prototypes are never young and only point at other prototypes
+        break;
+    case OBJ_CLOSURE: {
+        Closure *closure = (Closure *)object;
+        for (int i = 0; i < closure->num_upvalues; i++) {
+            closure->upvalues[i] = (Upvalue *)forward(heap, (Object *)closure->upvalues[i]);
+        }
+        break;
+    }
+    case OBJ_UPVALUE: {
+        Upvalue *upvalue = (Upvalue *)object;
+        forward_value(heap, &upvalue->closed);
+        upvalue->next_open = (Upvalue *)forward(heap, (Object *)upvalue->next_open);
+        break;
+    }
+    case OBJ_ARRAY: {
+        Array *array = (Array *)object;
+        array->root = (Node *)forward(heap, (Object *)array->root);
+        array->tail = forward(heap, array->tail);
+        break;
+    }
+    case OBJ_HASH: {
+        Hash *hash = (Hash *)object;
+        hash->root = (Node *)forward(heap, (Object *)hash->root);
+        break;
+    }
+    case OBJ_NODE: {
+        Node *node = (Node *)object;
+        for (uint32_t i = 0; i < node->length; i++) {
+            forward_value(heap, &node->slots[i]);
+        }
+        break;
+    }
+    case OBJ_ROPE: {
+        Rope *rope = (Rope *)object;
+        rope->left = forward(heap, rope->left);
+        rope->right = forward(heap, rope->right);
+        break;
+    }
+    case OBJ_BIGINT:
+    case OBJ_PACKED_NODE:
+    case OBJ_BUILTIN:
+    case OBJ_STRING:
+        break;
+    }
+}
+
+static void evacuate_nursery(VM *vm)
+{
+    Heap *heap = vm->heap;
+
+    for (Value *slot = vm->stack; slot < vm->sp; slot++) {
+        forward_value(heap, slot);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        vm->frames[i].closure = (Closure *)forward(heap, (Object *)vm->frames[i].closure);
+    }
+    for (size_t i = 0; i < vm->globals_capacity; i++) {
+        forward_value(heap, &vm->globals[i]);
+    }
+    // Walked link by link since old open upvalues can be linked to young ones without a barrier
+    for (Upvalue **link = &vm->open_upvalues; *link != NULL; link = &(*link)->next_open) {
+        *link = (Upvalue *)forward(heap, (Object *)*link);
+    }
+    for (size_t i = 0; i < vm->constants->size; i++) {
+        forward_value(heap, &vm->constants->array[i]);
+    }
+    forward_value(heap, &vm->last_popped);
+
+    for (size_t i = 0; i < heap->remembered_count; i++) {
+        heap->remembered[i]->remembered = FALSE;
+        forward_references(heap, heap->remembered[i]);
+    }
+    heap->remembered_count = 0;
+
+    // Cheney-style scan: promoted objects are traced until no new ones appear
+    while (heap->gray_count > 0) {
+        forward_references(heap, heap->gray_stack[--heap->gray_count]);
+    }
+
+    if (heap->stress) {
+        // Anything still pointing into the nursery now reads garbage instead of stale objects
+        memset(heap->nursery, 0xAB, heap->nursery_top - heap->nursery);
+    }
+    heap->nursery_top = heap->nursery;
+    heap->collections++;
+    heap->stats.minor_collections++;
+}
+
+void collect_nursery(VM *vm)
+{
+    uint64_t start = now_ns();
+    evacuate_nursery(vm);
+    record_pause(vm->heap, start);
+}
+
+// Major collection
+
+static MarkerPool *get_marker_pool(Heap *heap)
+{
+    int threads = heap->gc_threads < 1 ? 1 : heap->gc_threads;
+    if (heap->markers != NULL && heap->markers->num_workers != threads) {
+        cleanup_marker_pool(heap->markers);
+        heap->markers = NULL;
+    }
+    if (heap->markers == NULL) {
+        heap->markers = make_marker_pool(threads);
+    }
+    return heap->markers;
+}
+
+static void mark_root_value(MarkerPool *pool, Value value)
+{
+    if (IS_OBJ(value)) {
+        mark_root(pool, AS_OBJ(value));
+    }
+}
+
+static void mark_roots(VM *vm, MarkerPool *pool)
+{
+    for (Value *slot = vm->stack; slot < vm->sp; slot++) {
+        mark_root_value(pool, *slot);
+    }
+    for (int i = 0; i < vm->frame_count; i++) {
+        mark_root(pool, (Object *)vm->frames[i].closure);
+    }
+    for (size_t i = 0; i < vm->globals_capacity; i++) {
+        mark_root_value(pool, vm->globals[i]);
+    }
+    for (Upvalue *upvalue = vm->open_upvalues; upvalue != NULL; upvalue = upvalue->next_open) {
+        mark_root(pool, (Object *)upvalue);
+    }
+    for (size_t i = 0; i < vm->constants->size; i++) {
+        mark_root_value(pool, vm->constants->array[i]);
+    }
+    mark_root_value(pool, vm->last_popped);
+}
+
+// Sweeps up to `budget` objects of the last major collection, returning TRUE once none are left.
+// Survivors move back to the old space with their mark cleared.
+bool sweep_step(Heap *heap, size_t budget)
+{
+    while (heap->unswept != NULL && budget-- > 0) {
+        Object *object = heap->unswept;
+        heap->unswept = object->next;
+
+        if (object->marked) {
+            object->marked = FALSE;
+            object->next = heap->objects;
+            heap->objects = object;
+            continue;
+        }
+
+        size_t bytes_before = heap->bytes_allocated;
+        free_object(heap, object);
+        heap->stats.objects_freed++;
+        heap->stats.bytes_freed += bytes_before - heap->bytes_allocated;
+    }
+
+    if (heap->unswept != NULL) {
+        return FALSE;
+    }
+    // Only now is the surviving size known
+    if (heap->next_gc == SIZE_MAX) {
+        heap->next_gc = (size_t)(heap->bytes_allocated * heap->growth_factor);
+        if (heap->next_gc < GC_MIN_THRESHOLD) {
+            heap->next_gc = GC_MIN_THRESHOLD;
+        }
+    }
+    return TRUE;
+}
+
+void finish_sweep(Heap *heap)
+{
+    sweep_step(heap, SIZE_MAX);
+}
+
+void collect_garbage(VM *vm)
+{
+    Heap *heap = vm->heap;
+    uint64_t start = now_ns();
+
+    // Marks from the previous cycle must be cleared before marking again
+    finish_sweep(heap);
+    // Emptying the nursery first means marking only ever sees old objects
+    evacuate_nursery(vm);
+
+    MarkerPool *pool = get_marker_pool(heap);
+    mark_roots(vm, pool);
+    run_marking(pool);
+
+    // The sweep itself is spread over the following safe points
+    heap->unswept = heap->objects;
+    heap->objects = NULL;
+    heap->next_gc = SIZE_MAX;
+
+    heap->collections++;
+    heap->stats.major_collections++;
+    record_pause(heap, start);
+}
+
+// Statistics
+
+GCStats get_gc_stats(Heap *heap)
+{
+    return heap->stats;
+}
+
+static int compare_pauses(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Percentile (0-100) of the most recent GC_PAUSE_SAMPLES pauses, in nanoseconds
+uint64_t get_gc_pause_percentile(Heap *heap, double percentile)
+{
+    size_t count = heap->stats.num_pauses < GC_PAUSE_SAMPLES ? heap->stats.num_pauses : GC_PAUSE_SAMPLES;
+    if (count == 0) {
+        return 0;
+    }
+
+    uint64_t sorted[GC_PAUSE_SAMPLES];
+    memcpy(sorted, heap->stats.pause_samples, count * sizeof(uint64_t));
+    qsort(sorted, count, sizeof(uint64_t), compare_pauses);
+
+    size_t index = (size_t)(percentile / 100.0 * (count - 1) + 0.5);
+    return sorted[index < count ? index : count - 1];
+}
+
+char *gc_stats_to_str(Heap *heap)
+{
+    GCStats *stats = &heap->stats;
+    double elapsed_s = (now_ns() - stats->start_ns) / 1e9;
+    double allocation_rate = elapsed_s > 0 ? stats->bytes_allocated_total / elapsed_s / (1024.0 * 1024.0) : 0;
+
+    char buffer[512];
+    snprintf(buffer, sizeof(buffer),
+        "minor collections: %zu\n"
+        "major collections: %zu\n"
+        "promoted: %zu objects, %zu bytes\n"
+        "freed: %zu objects, %zu bytes\n"
+        "old space: %zu bytes, nursery: %zu/%d bytes\n"
+        "pause p50/p90/p99/max: %.1f/%.1f/%.1f/%.1f us\n"
+        "allocation rate: %.2f MiB/s\n",
+        stats->minor_collections, stats->major_collections,
+        stats->objects_promoted, stats->bytes_promoted,
+        stats->objects_freed, stats->bytes_freed,
+        heap->bytes_allocated, (size_t)(heap->nursery_top - heap->nursery), NURSERY_SIZE,
+        get_gc_pause_percentile(heap, 50) / 1e3, get_gc_pause_percentile(heap, 90) / 1e3,
+        get_gc_pause_percentile(heap, 99) / 1e3, stats->max_pause_ns / 1e3,
+        allocation_rate);
+    return strdup(buffer);
+}
@@ -0,0 +1,48 @@
+#ifndef GC_H
+#define GC_H
+
+#include "object.h"
+#include "vm.h"
+
+// Generational collection of the VM's heap. Minor collections copy the live part of the nursery
+// into the old space, major collections additionally mark the old space in parallel and leave it
+// to be swept lazily at the following safe points. The roots are the
+// VM stack, call frames, globals, open upvalues, the constant pool and, for minor collections,
+// the remembered set. Collections only happen at safe points in the VM, where every live object
+// is reachable from those roots and no young object is held in a C local.
+extern void collect_garbage(VM *vm);
+extern void collect_nursery(VM *vm);
+extern void remember_object(Heap *heap, Object *object);
+extern bool sweep_step(Heap *heap, size_t budget);
+extern void finish_sweep(Heap *heap);
+
+extern GCStats get_gc_stats(Heap *heap);
+extern uint64_t get_gc_pause_percentile(Heap *heap, double percentile);
+extern char *gc_stats_to_str(Heap *heap);
+
+#define SWEEP_BUDGET 256
+
+// Makes sure an allocation of `size` bytes fits in the nursery, collecting if needed
+static inline void maybe_collect_garbage(VM *vm, size_t size)
+{
+    Heap *heap = vm->heap;
+    if (heap->unswept != NULL) {
+        sweep_step(heap, SWEEP_BUDGET);
+    }
+    if (heap->stress || heap->bytes_allocated > heap->next_gc) {
+        collect_garbage(vm);
+    } else if ((size_t)(heap->nursery_end - heap->nursery_top) < size + OBJECT_ALIGNMENT) {
+        collect_nursery(vm);
+    }
+}
+
+// Must follow every store of `value` into a field of `owner`, except stores into objects that
+// were just allocated. Old objects pointing into the nursery are minor collection roots.
+static inline void write_barrier(Heap *heap, Object *owner, Value value)
+{
+    if (IS_OBJ(value) && !owner->remembered && !is_young(heap, owner) && is_young(heap, AS_OBJ(value))) {
+        remember_object(heap, owner);
+    }
+}
+
+#endif // GC_H
@@ -0,0 +1,84 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "marker.h"
+#include "object.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Major collection pause times over a large old space, at different numbers of marking threads
+
+#define TREE_DEPTH 17
+#define ROUNDS 20
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void run(Compiler *compiler, VM *vm, char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    VMResult result = run_vm(vm, main);
+    assert(result == VM_OK);
+    (void)result;
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+static void bench_threads(int threads)
+{
+    Heap *heap = make_heap();
+    heap->gc_threads = threads;
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+
+    char input[256];
+    snprintf(input, sizeof(input),
+        "let tree = fn(d) { if (d == 0) { fn() { 1 } } else { let l = tree(d - 1); let r = tree(d - 1); fn() { l() + r() } } }; let t = tree(%d);",
+        TREE_DEPTH);
+    run(compiler, vm, input);
+
+    // The first collection promotes the tree, after that every collection marks all of it
+    collect_garbage(vm);
+    finish_sweep(heap);
+
+    uint64_t pauses[ROUNDS];
+    uint64_t sweep_total = 0;
+    for (int i = 0; i < ROUNDS; i++) {
+        uint64_t start = now_ns();
+        collect_garbage(vm);
+        pauses[i] = now_ns() - start;
+
+        start = now_ns();
+        finish_sweep(heap);
+        sweep_total += now_ns() - start;
+    }
+    qsort(pauses, ROUNDS, sizeof(uint64_t), compare_u64);
+
+    printf("%7d %10zu %10.2f %10.2f %10.2f %12.2f %8zu\n", threads, heap->bytes_allocated / 1024,
+        pauses[ROUNDS / 2] / 1e6, pauses[ROUNDS * 9 / 10] / 1e6, pauses[ROUNDS - 1] / 1e6,
+        sweep_total / 1e6 / ROUNDS, heap->markers->steals);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+}
+
+int main(void)
+{
+    printf("%7s %10s %10s %10s %10s %12s %8s\n", "threads", "old KiB", "p50 ms", "p90 ms", "max ms", "sweep ms", "steals");
+    int thread_counts[] = { 1, 2, 4, 8 };
+    for (size_t i = 0; i < sizeof(thread_counts) / sizeof(thread_counts[0]); i++) {
+        bench_threads(thread_counts[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,363 @@
+#include "compiler.h"
+#include "errors.h"
+#include "gc.h"
+#include "marker.h"
+#include "object.h"
+#include "parser.h"
+#include "test_utils.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+typedef struct Session {
+    Heap *heap;
+    Compiler *compiler;
+    VM *vm;
+} Session;
+
+static Session make_session(bool stress)
+{
+    Session session;
+    session.heap = make_heap();
+    session.heap->stress = stress;
+    session.compiler = make_compiler(session.heap);
+    session.vm = make_vm(session.heap, session.compiler->constants);
+    return session;
+}
+
+static void cleanup_session(Session *session)
+{
+    cleanup_vm(session->vm);
+    cleanup_compiler(session->compiler);
+    cleanup_heap(session->heap);
+}
+
+// Runs `input` in the session and returns the inspected result
+static char *run_in_session(Session *session, char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    assert(parser->errors->size == 0);
+
+    FunctionProto *main = compile_program(session->compiler, program);
+    assert(main != NULL);
+    VMResult result = run_vm(session->vm, main);
+    if (result != VM_OK) {
+        printf("Running %s failed: %s\n", input, session->vm->error);
+        assert(1 != 1);
+    }
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return inspect_value(get_last_popped(session->vm));
+}
+
+static size_t count_objects(Heap *heap)
+{
+    size_t count = 0;
+    for (Object *object = heap->objects; object != NULL; object = object->next) {
+        count++;
+    }
+    return count;
+}
+
+static void assert_result(Session *session, char *input, const char *expected)
+{
+    char *result = run_in_session(session, input);
+    if (strcmp(result, expected) != 0) {
+        printf("Input: %s\nExpected: %s\nGot: %s\n", input, expected, result);
+        assert(1 != 1);
+    }
+    free(result);
+}
+
+TEST_CASE(stress_collection_keeps_live_objects)
+{
+    Session session = make_session(TRUE);
+
+    assert_result(&session, "let adder = fn(a, b) { fn(c) { a + b + c } }; let add = adder(1, 2); add(8)", "11");
+    assert_result(&session, "let f = fn(a) { fn(b) { fn(c) { a + b + c } } }; f(1)(2)(3)", "6");
+    assert_result(&session, "let f = fn() { let a = 5; let g = fn() { a }; let h = fn() { a * 2 }; g() + h() }; f()", "15");
+    assert_result(&session, "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(15)", "610");
+    assert_result(&session, "let big = 4294967296 * 4294967296; let fact = fn(n) { if (n == 0) { 1 } else { n * fact(n - 1) } }; fact(25) + big", "15511228490075059693551616");
+    // Closures stored in globals keep their closed upvalues alive across runs, as do bignums
+    assert_result(&session, "add(100)", "103");
+    assert_result(&session, "big * 2", "36893488147419103232");
+
+    assert(get_gc_stats(session.heap).major_collections > 0);
+    cleanup_session(&session);
+}
+
+TEST_CASE(unreachable_objects_are_freed)
+{
+    Session session = make_session(FALSE);
+
+    // Every level creates a closure and an upvalue that die when the level returns
+    assert_result(&session, "let make = fn(n) { if (n == 0) { 0 } else { let f = fn() { n }; f() + make(n - 1) } }; make(200)", "20100");
+    // The closures and upvalues were all bump allocated, only the three prototypes are old
+    assert(count_objects(session.heap) == 3);
+    assert(session.heap->nursery_top > session.heap->nursery);
+
+    collect_garbage(session.vm);
+    // Nothing is swept until the next safe points
+    assert(get_gc_stats(session.heap).objects_freed == 0);
+    assert(count_objects(session.heap) == 0);
+    finish_sweep(session.heap);
+
+    // What survives is the global closure, promoted out of the nursery, and the prototypes in the
+    // constant pool. The top-level prototype of the finished program is freed.
+    GCStats stats = get_gc_stats(session.heap);
+    assert(stats.major_collections == 1);
+    assert(stats.minor_collections == 1);
+    assert(stats.objects_promoted == 1);
+    assert(stats.objects_freed == 1);
+    assert(stats.bytes_freed == sizeof(FunctionProto));
+    assert(count_objects(session.heap) == 1 + 2);
+    assert(session.heap->nursery_top == session.heap->nursery);
+    assert(stats.max_pause_ns >= stats.last_pause_ns);
+    assert(stats.total_pause_ns >= stats.max_pause_ns);
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(growth_factor_sets_next_threshold)
+{
+    Session session = make_session(FALSE);
+    session.heap->growth_factor = 4.0;
+
+    // Allocates well past the minimum threshold so collections are triggered by allocation volume
+    assert_result(&session, "let loop = fn(n) { if (n == 0) { 0 } else { let f = fn() { n }; loop(n - 1) } }; let run = fn(n) { if (n == 0) { 0 } else { loop(1000); run(n - 1) } }; run(300)", "0");
+
+    // Most of what is allocated here dies young, only closures in frames that are live during a
+    // minor collection get promoted
+    GCStats stats = get_gc_stats(session.heap);
+    assert(stats.minor_collections > 0);
+    assert(stats.minor_collections > stats.major_collections);
+    assert(stats.bytes_promoted < stats.bytes_allocated_total / 2);
+    assert(session.heap->next_gc >= GC_MIN_THRESHOLD);
+
+    session.heap->next_gc = 0;
+    session.heap->growth_factor = 1000.0;
+    collect_garbage(session.vm);
+    assert(session.heap->next_gc == SIZE_MAX);
+    finish_sweep(session.heap);
+    size_t expected = (size_t)(session.heap->bytes_allocated * 1000.0);
+    assert(session.heap->next_gc == (expected < GC_MIN_THRESHOLD ? GC_MIN_THRESHOLD : expected));
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(survivors_are_promoted)
+{
+    Session session = make_session(FALSE);
+
+    assert_result(&session, "let counter = fn(a) { fn() { a } }; let c = counter(42);", "null");
+    Value closure = session.vm->globals[1];
+    assert(is_young(session.heap, AS_OBJ(closure)));
+
+    collect_nursery(session.vm);
+
+    // The globals were updated to point at the promoted copies, the closed upvalue moved too
+    Value promoted = session.vm->globals[1];
+    assert(!is_young(session.heap, AS_OBJ(promoted)));
+    Upvalue *upvalue = AS_CLOSURE(promoted)->upvalues[0];
+    assert(!is_young(session.heap, (Object *)upvalue));
+    assert(upvalue->location == &upvalue->closed);
+    assert(AS_INT(upvalue->closed) == 42);
+    assert(get_gc_stats(session.heap).objects_promoted == 3);
+
+    assert_result(&session, "c()", "42");
+    cleanup_session(&session);
+}
+
+TEST_CASE(write_barrier_keeps_young_objects_alive)
+{
+    Session session = make_session(TRUE);
+
+    // Under stress `get` is promoted while capturing `keep`, and the open upvalue is promoted when
+    // the second closure is made. Both then have young objects stored into them: the upvalue
+    // itself, and the closure assigned to `keep` once the frame returns and the upvalue closes.
+    // Only the remembered set keeps those alive through the collections made by `junk`.
+    assert_result(&session, "let f = fn() { let keep = 0; let get = fn() { keep }; let keep = fn() { 1 }; get }; let g = f(); let junk = fn() { 2 }; let junk = fn() { 3 }; g()()", "1");
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(collections_survive_collections)
+{
+    Session session = make_session(TRUE);
+
+    assert_result(&session, "let a = [fn() { 1 }, [2, 3]]; let h = {1: a, 2: fn() { 4 }}; h[1][0]() + h[1][1][1] + h[2]()", "8");
+    assert_result(&session, "let pushed = push(a, fn() { 5 }); let stored = put(h, 3, pushed); stored[3][2]() + len(stored)", "8");
+    assert_result(&session, "let i = 0; let h = {}; while (i < 300) { let h = put(h, i, [i]); let i = i + 1; } h[299][0] + len(h)", "599");
+
+    // Slices share the trie of the array they view. Pushing onto one that ends early copies it,
+    // spilling part of the new trie into the old space when it is too big for the nursery, whose
+    // nodes then point at young ones until the next collection.
+    session.heap->stress = FALSE;
+    assert_result(&session, "let build = fn(n) { let a = []; let i = 0; while (i < n) { let a = push(a, [i]); let i = i + 1; } a }; let big = build(20000);", "null");
+    session.heap->stress = TRUE;
+    assert_result(&session, "let sliced = rest(big); [len(sliced), sliced[0][0], sliced[10000][0], sliced[19998][0]]", "[19999, 1, 10001, 19999]");
+    assert_result(&session, "let copied = push(slice(big, 0, 19999), [-1]); [len(copied), copied[19998][0], copied[19999][0], len(big)]", "[20000, 19998, -1, 20000]");
+    assert_result(&session, "[sliced[5][0], copied[5][0], pushed[1][0], h[150][0]]", "[6, 5, 2, 150]");
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(strings_survive_collections)
+{
+    Session session = make_session(TRUE);
+
+    assert_result(&session, "let join = fn(a, b) { a + \", \" + b }; let s = join(\"x\", join(\"y\", \"z\")); s", "x, y, z");
+    assert_result(&session, "let h = {s: 1}; let i = 0; while (i < 200) { let h = put(h, s + \"!\", i); let i = i + 1; } [h[s], h[\"x, y, z!\"]]", "[1, 199]");
+
+    // Doubling soon makes strings too big for the nursery, they go straight to the old space
+    assert_result(&session, "let long = \"ab\"; let i = 0; while (i < 18) { let long = long + long; let i = i + 1; } len(long)", "524288");
+    assert_result(&session, "len(long + s) + len(h)", "524297");
+    assert_result(&session, "let rope = s + long; [rope[0], rope[524294], rope == s + long]", "[x, b, true]");
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(ropes_survive_collections)
+{
+    Session session = make_session(FALSE);
+
+    assert_result(&session, "let build = fn(n) { let s = \"\"; let i = 0; while (i < n) { let s = s + \"0123456789\"; let i = i + 1; } s }; let r = build(5000); len(r)", "50000");
+    // The rope is old by the time it is flattened into a young string, which the barrier keeps alive
+    collect_garbage(session.vm);
+    finish_sweep(session.heap);
+    assert_result(&session, "let short = r[12]; let pieces = build(100); [short, r[49999]]", "[2, 9]");
+    collect_nursery(session.vm);
+    assert_result(&session, "[r == build(5000), r[25000], len(r + pieces)]", "[true, 0, 51000]");
+    collect_garbage(session.vm);
+    assert_result(&session, "let h = {r: 1}; h[build(5000)]", "1");
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(array_builtins_survive_collections)
+{
+    Session session = make_session(TRUE);
+
+    assert_result(&session, "let build = fn(n) { let a = []; let i = 0; while (i < n) { let a = push(a, i); let i = i + 1; } a }; let a = build(300); [sum(a), min(a), max(a)]", "[44850, 0, 299]");
+    // Functions called back by `map` and `filter` allocate, collecting while the partial result is
+    // only on the stack
+    assert_result(&session, "let strings = map(a, fn(x) { \"n\" + \"x\" }); let boxed = map(a, fn(x) { [x] }); [len(strings), strings[299], boxed[299][0], len(filter(boxed, fn(b) { b[0] > 149 }))]", "[300, nx, 299, 150]");
+    // A sum overflowing the packed kernel allocates bignums as it goes
+    assert_result(&session, "let big = map(a, fn(x) { 9223372036854775807 - x }); sum(big)", "2767011611056432697250");
+    assert_result(&session, "let mixed = push(a, \"x\"); [len(mixed), mixed[150], mixed[300], a[299], boxed[7][0]]", "[301, 150, x, 299, 7]");
+
+    cleanup_session(&session);
+}
+
+// Builds a complete binary tree of closures of the given depth in the global `t`, whose leaves
+// each count one when the tree is called
+static void build_closure_tree(Session *session, int depth)
+{
+    char input[256];
+    snprintf(input, sizeof(input),
+        "let tree = fn(d) { if (d == 0) { fn() { 1 } } else { let l = tree(d - 1); let r = tree(d - 1); fn() { l() + r() } } }; let t = tree(%d);", depth);
+    char *result = run_in_session(session, input);
+    free(result);
+}
+
+TEST_CASE(lazy_sweeping)
+{
+    Session session = make_session(FALSE);
+    build_closure_tree(&session, 8);
+    collect_nursery(session.vm);
+    assert_result(&session, "let t = 0;", "null");
+
+    collect_garbage(session.vm);
+    assert(session.heap->unswept != NULL);
+    size_t swept = 0;
+    while (!sweep_step(session.heap, 1)) {
+        swept++;
+    }
+    assert(swept > 255 * 3);
+    assert(session.heap->unswept == NULL);
+    assert(session.heap->next_gc == GC_MIN_THRESHOLD);
+
+    // Safe points sweep a bounded number of objects each
+    collect_garbage(session.vm);
+    assert_result(&session, "let t = tree(2);", "null");
+    assert(session.heap->unswept == NULL);
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(parallel_marking)
+{
+    size_t survivors[4];
+    int thread_counts[] = { 1, 2, 4, 8 };
+
+    for (int i = 0; i < 4; i++) {
+        Session session = make_session(FALSE);
+        session.heap->gc_threads = thread_counts[i];
+        build_closure_tree(&session, 12);
+
+        // Repeated collections reuse the parked workers and must keep the same objects
+        for (int round = 0; round < 3; round++) {
+            collect_garbage(session.vm);
+            finish_sweep(session.heap);
+        }
+        survivors[i] = count_objects(session.heap);
+        assert(session.heap->markers->num_workers == thread_counts[i]);
+        assert_result(&session, "t()", "4096");
+
+        // Dropping the tree frees it whatever the number of markers
+        assert_result(&session, "let t = 0;", "null");
+        collect_garbage(session.vm);
+        finish_sweep(session.heap);
+        assert(count_objects(session.heap) < survivors[i] / 100);
+
+        cleanup_session(&session);
+    }
+
+    for (int i = 1; i < 4; i++) {
+        assert(survivors[i] == survivors[0]);
+    }
+}
+
+TEST_CASE(parallel_marking_under_stress)
+{
+    Session session = make_session(TRUE);
+    session.heap->gc_threads = 4;
+
+    assert_result(&session, "let adder = fn(a, b) { fn(c) { a + b + c } }; let add = adder(1, 2); add(8)", "11");
+    assert_result(&session, "let f = fn() { let keep = 0; let get = fn() { keep }; let keep = fn() { 1 }; get }; let g = f(); let junk = fn() { 2 }; g()()", "1");
+    build_closure_tree(&session, 6);
+    assert_result(&session, "t()", "64");
+
+    // Changing the thread count restarts the markers
+    session.heap->gc_threads = 3;
+    assert_result(&session, "tree(4)()", "16");
+    assert(session.heap->markers->num_workers == 3);
+
+    cleanup_session(&session);
+}
+
+TEST_CASE(stats_dump)
+{
+    Session session = make_session(TRUE);
+    assert_result(&session, "let f = fn(a) { fn() { a } }; f(1)(); f(2)();", "2");
+
+    assert(get_gc_pause_percentile(session.heap, 50) <= get_gc_pause_percentile(session.heap, 99));
+    assert(get_gc_pause_percentile(session.heap, 99) <= session.heap->stats.max_pause_ns);
+
+    char *dump = gc_stats_to_str(session.heap);
+    assert(strstr(dump, "minor collections: ") != NULL);
+    assert(strstr(dump, "major collections: ") != NULL);
+    assert(strstr(dump, "pause p50/p90/p99/max: ") != NULL);
+    assert(strstr(dump, "allocation rate: ") != NULL);
+    free(dump);
+
+    cleanup_session(&session);
+}
+
+RUN_TESTS()
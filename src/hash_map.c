@@ -0,0 +1,368 @@
+#include "hash_map.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CTRL_EMPTY 0x80 // Full slots hold seven bits of hash, so only empty ones have the top bit set
+
+// Groups of control bytes are matched all at once. A match is a mask with one bit, or one byte,
+// per slot of the group, lowest slot first.
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define GROUP_WIDTH 16
+#define SLOT_SHIFT 0 // Bits per slot in a match, as a shift
+typedef uint32_t GroupMatch;
+
+static inline GroupMatch match_hash(const uint8_t *group, uint8_t h2)
+{
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (GroupMatch)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char)h2)));
+}
+
+static inline GroupMatch match_empty(const uint8_t *group)
+{
+    return (GroupMatch)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+}
+#else
+#define GROUP_WIDTH 8
+#define SLOT_SHIFT 3
+typedef uint64_t GroupMatch;
+
+#define LOW_BITS 0x0101010101010101u
+#define HIGH_BITS 0x8080808080808080u
+
+static inline uint64_t load_group(const uint8_t *group)
+{
+    uint64_t ctrl;
+    memcpy(&ctrl, group, sizeof(ctrl));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    ctrl = __builtin_bswap64(ctrl);
+#endif
+    return ctrl;
+}
+
+// May also report a byte above a real match, the keys are compared anyway
+static inline GroupMatch match_hash(const uint8_t *group, uint8_t h2)
+{
+    uint64_t x = load_group(group) ^ (LOW_BITS * h2);
+    return (x - LOW_BITS) & ~x & HIGH_BITS;
+}
+
+static inline GroupMatch match_empty(const uint8_t *group)
+{
+    return load_group(group) & HIGH_BITS;
+}
+#endif
+
+static inline size_t lowest_slot(GroupMatch match)
+{
+    return (size_t)__builtin_ctzll(match) >> SLOT_SHIFT;
+}
+
+// Slots past the first empty one in a group belong to other runs
+static inline GroupMatch before_first_empty(GroupMatch match, GroupMatch empty)
+{
+    return empty != 0 ? match & ((empty & -empty) - 1) : match;
+}
+
+static inline size_t home_slot(uint64_t hash, size_t capacity)
+{
+    return (size_t)(hash >> 7) & (capacity - 1);
+}
+
+static inline uint8_t hash_bits(uint64_t hash)
+{
+    return (uint8_t)(hash & 0x7f);
+}
+
+static inline void set_ctrl(uint8_t *ctrl, size_t capacity, size_t slot, uint8_t value)
+{
+    ctrl[slot] = value;
+    if (slot < GROUP_WIDTH) {
+        ctrl[capacity + slot] = value;
+    }
+}
+
+static uint8_t *make_ctrl(size_t capacity)
+{
+    uint8_t *ctrl = malloc(capacity + GROUP_WIDTH);
+    memset(ctrl, CTRL_EMPTY, capacity + GROUP_WIDTH);
+    return ctrl;
+}
+
+static size_t find_empty_slot(const uint8_t *ctrl, size_t capacity, uint64_t hash)
+{
+    size_t mask = capacity - 1;
+    for (size_t position = home_slot(hash, capacity);; position = (position + GROUP_WIDTH) & mask) {
+        GroupMatch empty = match_empty(&ctrl[position]);
+        if (empty != 0) {
+            return (position + lowest_slot(empty)) & mask;
+        }
+    }
+}
+
+// Kept at most three quarters full, linear probing gets slow past that
+static inline bool needs_growth(size_t count, size_t capacity)
+{
+    return 4 * (count + 1) > 3 * capacity;
+}
+
+// Whether the entry in `slot`, placed by probing from `home`, may move back into the gap at `hole`
+// without ending up in front of its home slot
+static inline bool fills_hole(size_t home, size_t hole, size_t slot, size_t mask)
+{
+    return ((hole - home) & mask) < ((slot - home) & mask);
+}
+
+// Mixing as in splitmix64, strong enough for keys that differ in only a few bits
+static inline uint64_t mix(uint64_t x)
+{
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+    return x ^ (x >> 31);
+}
+
+uint64_t hash_bytes(const char *bytes, size_t length)
+{
+    uint64_t hash = 0x9e3779b97f4a7c15u ^ length;
+    for (; length >= 8; bytes += 8, length -= 8) {
+        uint64_t word;
+        memcpy(&word, bytes, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdu;
+        hash ^= hash >> 32;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, bytes, length);
+    return mix(hash ^ tail);
+}
+
+uint64_t hash_int(uint64_t key)
+{
+    return mix(key);
+}
+
+// String maps
+
+StringMap *make_string_map(void)
+{
+    StringMap *map = malloc(sizeof(StringMap));
+    map->ctrl = make_ctrl(HASH_MAP_INITIAL_CAPACITY);
+    map->entries = malloc(HASH_MAP_INITIAL_CAPACITY * sizeof(StringMapEntry));
+    map->count = 0;
+    map->capacity = HASH_MAP_INITIAL_CAPACITY;
+    return map;
+}
+
+void cleanup_string_map(StringMap *map)
+{
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->ctrl[i] != CTRL_EMPTY) {
+            free(map->entries[i].key);
+        }
+    }
+    free(map->ctrl);
+    free(map->entries);
+    free(map);
+}
+
+// Returns the slot holding `key`, or -1
+static ptrdiff_t find_string(StringMap *map, const char *key, uint64_t hash)
+{
+    size_t mask = map->capacity - 1;
+    uint8_t h2 = hash_bits(hash);
+    for (size_t position = home_slot(hash, map->capacity);; position = (position + GROUP_WIDTH) & mask) {
+        const uint8_t *group = &map->ctrl[position];
+        GroupMatch empty = match_empty(group);
+        for (GroupMatch match = before_first_empty(match_hash(group, h2), empty); match != 0; match &= match - 1) {
+            size_t slot = (position + lowest_slot(match)) & mask;
+            if (strcmp(map->entries[slot].key, key) == 0) {
+                return (ptrdiff_t)slot;
+            }
+        }
+        if (empty != 0) {
+            return -1;
+        }
+    }
+}
+
+bool string_map_get(StringMap *map, const char *key, int64_t *value)
+{
+    ptrdiff_t slot = find_string(map, key, hash_bytes(key, strlen(key)));
+    if (slot < 0) {
+        return FALSE;
+    }
+    *value = map->entries[slot].value;
+    return TRUE;
+}
+
+static void insert_string_entry(StringMap *map, StringMapEntry entry, uint64_t hash)
+{
+    size_t slot = find_empty_slot(map->ctrl, map->capacity, hash);
+    set_ctrl(map->ctrl, map->capacity, slot, hash_bits(hash));
+    map->entries[slot] = entry;
+    map->count++;
+}
+
+static void grow_string_map(StringMap *map)
+{
+    uint8_t *ctrl = map->ctrl;
+    StringMapEntry *entries = map->entries;
+    size_t capacity = map->capacity;
+    map->capacity *= 2;
+    map->ctrl = make_ctrl(map->capacity);
+    map->entries = malloc(map->capacity * sizeof(StringMapEntry));
+    map->count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (ctrl[i] != CTRL_EMPTY) {
+            insert_string_entry(map, entries[i], hash_bytes(entries[i].key, strlen(entries[i].key)));
+        }
+    }
+    free(ctrl);
+    free(entries);
+}
+
+void string_map_put(StringMap *map, const char *key, int64_t value)
+{
+    uint64_t hash = hash_bytes(key, strlen(key));
+    ptrdiff_t slot = find_string(map, key, hash);
+    if (slot >= 0) {
+        map->entries[slot].value = value;
+        return;
+    }
+    if (needs_growth(map->count, map->capacity)) {
+        grow_string_map(map);
+    }
+    insert_string_entry(map, (StringMapEntry) { .key = strdup(key), .value = value }, hash);
+}
+
+bool string_map_remove(StringMap *map, const char *key)
+{
+    ptrdiff_t found = find_string(map, key, hash_bytes(key, strlen(key)));
+    if (found < 0) {
+        return FALSE;
+    }
+    free(map->entries[found].key);
+
+    size_t mask = map->capacity - 1;
+    size_t hole = (size_t)found;
+    for (size_t slot = (hole + 1) & mask; map->ctrl[slot] != CTRL_EMPTY; slot = (slot + 1) & mask) {
+        StringMapEntry *entry = &map->entries[slot];
+        if (fills_hole(home_slot(hash_bytes(entry->key, strlen(entry->key)), map->capacity), hole, slot, mask)) {
+            map->entries[hole] = *entry;
+            set_ctrl(map->ctrl, map->capacity, hole, map->ctrl[slot]);
+            hole = slot;
+        }
+    }
+    set_ctrl(map->ctrl, map->capacity, hole, CTRL_EMPTY);
+    map->count--;
+    return TRUE;
+}
+
+// Integer maps
+
+IntMap *make_int_map(void)
+{
+    IntMap *map = malloc(sizeof(IntMap));
+    map->ctrl = make_ctrl(HASH_MAP_INITIAL_CAPACITY);
+    map->entries = malloc(HASH_MAP_INITIAL_CAPACITY * sizeof(IntMapEntry));
+    map->count = 0;
+    map->capacity = HASH_MAP_INITIAL_CAPACITY;
+    return map;
+}
+
+void cleanup_int_map(IntMap *map)
+{
+    free(map->ctrl);
+    free(map->entries);
+    free(map);
+}
+
+static ptrdiff_t find_int(IntMap *map, uint64_t key, uint64_t hash)
+{
+    size_t mask = map->capacity - 1;
+    uint8_t h2 = hash_bits(hash);
+    for (size_t position = home_slot(hash, map->capacity);; position = (position + GROUP_WIDTH) & mask) {
+        const uint8_t *group = &map->ctrl[position];
+        GroupMatch empty = match_empty(group);
+        for (GroupMatch match = before_first_empty(match_hash(group, h2), empty); match != 0; match &= match - 1) {
+            size_t slot = (position + lowest_slot(match)) & mask;
+            if (map->entries[slot].key == key) {
+                return (ptrdiff_t)slot;
+            }
+        }
+        if (empty != 0) {
+            return -1;
+        }
+    }
+}
+
+bool int_map_get(IntMap *map, uint64_t key, int64_t *value)
+{
+    ptrdiff_t slot = find_int(map, key, hash_int(key));
+    if (slot < 0) {
+        return FALSE;
+    }
+    *value = map->entries[slot].value;
+    return TRUE;
+}
+
+static void insert_int_entry(IntMap *map, IntMapEntry entry, uint64_t hash)
+{
+    size_t slot = find_empty_slot(map->ctrl, map->capacity, hash);
+    set_ctrl(map->ctrl, map->capacity, slot, hash_bits(hash));
+    map->entries[slot] = entry;
+    map->count++;
+}
+
+static void grow_int_map(IntMap *map)
+{
+    uint8_t *ctrl = map->ctrl;
+    IntMapEntry *entries = map->entries;
+    size_t capacity = map->capacity;
+    map->capacity *= 2;
+    map->ctrl = make_ctrl(map->capacity);
+    map->entries = malloc(map->capacity * sizeof(IntMapEntry));
+    map->count = 0;
+    for (size_t i = 0; i < capacity; i++) {
+        if (ctrl[i] != CTRL_EMPTY) {
+            insert_int_entry(map, entries[i], hash_int(entries[i].key));
+        }
+    }
+    free(ctrl);
+    free(entries);
+}
+
+void int_map_put(IntMap *map, uint64_t key, int64_t value)
+{
+    uint64_t hash = hash_int(key);
+    ptrdiff_t slot = find_int(map, key, hash);
+    if (slot >= 0) {
+        map->entries[slot].value = value;
+        return;
+    }
+    if (needs_growth(map->count, map->capacity)) {
+        grow_int_map(map);
+    }
+    insert_int_entry(map, (IntMapEntry) { .key = key, .value = value }, hash);
+}
+
+bool int_map_remove(IntMap *map, uint64_t key)
+{
+    ptrdiff_t found = find_int(map, key, hash_int(key));
+    if (found < 0) {
+        return FALSE;
+    }
+
+    size_t mask = map->capacity - 1;
+    size_t hole = (size_t)found;
+    for (size_t slot = (hole + 1) & mask; map->ctrl[slot] != CTRL_EMPTY; slot = (slot + 1) & mask) {
+        if (fills_hole(home_slot(hash_int(map->entries[slot].key), map->capacity), hole, slot, mask)) {
+            map->entries[hole] = map->entries[slot];
+            set_ctrl(map->ctrl, map->capacity, hole, map->ctrl[slot]);
+            hole = slot;
+        }
+    }
+    set_ctrl(map->ctrl, map->capacity, hole, CTRL_EMPTY);
+    map->count--;
+    return TRUE;
+}
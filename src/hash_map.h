@@ -0,0 +1,65 @@
+#ifndef HASH_MAP_H
+#define HASH_MAP_H
+
+#include "globals.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Open addressing hash maps in the style of SwissTable. Next to the entries is an array of control
+// bytes, one per slot: EMPTY, or seven bits of the hash of the key stored there. A lookup compares
+// a whole group of control bytes against the wanted seven bits at once, with SSE2 where available
+// and a word at a time otherwise, and only looks at the keys whose bits match.
+//
+// Entries are placed by linear probing from the slot picked by the rest of the hash. A key is never
+// further from that slot than the first empty one, so a lookup ends at the first group with an
+// empty slot. Removing an entry moves later entries of the same run back into the gap rather than
+// leaving a tombstone, so tables that see many removals never need rehashing to stay fast.
+//
+// StringMap copies its keys, IntMap is for keys that are already integers, like symbol ids or
+// addresses.
+
+#define HASH_MAP_INITIAL_CAPACITY 16 // At least one group, and always a power of two
+
+extern uint64_t hash_bytes(const char *bytes, size_t length);
+extern uint64_t hash_int(uint64_t key);
+
+typedef struct StringMapEntry {
+    char *key;
+    int64_t value;
+} StringMapEntry;
+
+typedef struct StringMap {
+    uint8_t *ctrl; // `capacity` control bytes, then a copy of the first group for probes that wrap around
+    StringMapEntry *entries;
+    size_t count;
+    size_t capacity;
+} StringMap;
+
+extern StringMap *make_string_map(void);
+extern void cleanup_string_map(StringMap *map);
+// Returns FALSE if `key` is not in the map, leaving `value` alone
+extern bool string_map_get(StringMap *map, const char *key, int64_t *value);
+// Adds `key` or replaces its value
+extern void string_map_put(StringMap *map, const char *key, int64_t value);
+// Returns FALSE if `key` was not in the map
+extern bool string_map_remove(StringMap *map, const char *key);
+
+typedef struct IntMapEntry {
+    uint64_t key;
+    int64_t value;
+} IntMapEntry;
+
+typedef struct IntMap {
+    uint8_t *ctrl;
+    IntMapEntry *entries;
+    size_t count;
+    size_t capacity;
+} IntMap;
+
+extern IntMap *make_int_map(void);
+extern void cleanup_int_map(IntMap *map);
+extern bool int_map_get(IntMap *map, uint64_t key, int64_t *value);
+extern void int_map_put(IntMap *map, uint64_t key, int64_t value);
+extern bool int_map_remove(IntMap *map, uint64_t key);
+
+#endif // HASH_MAP_H
@@ -0,0 +1,274 @@
+#include "bench_utils.h"
+#include "hash_map.h"
+#include "parser.h"
+#include "resolver.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Group-probed open addressing against a chained table with the same hash functions: inserting
+// keys, then looking up keys that are there and keys that are not, in shuffled order so lookups do
+// not follow the order chain nodes were allocated in. Last, resolving a program declaring many
+// globals, which looks each one up by name.
+
+#define RESOLVED_GLOBALS 20000
+
+// One malloc'd node per key, buckets doubled at a load factor of one. String keys are copied like
+// StringMap does.
+typedef struct ChainNode {
+    struct ChainNode *next;
+    uint64_t hash;
+    char *key; // NULL in integer tables
+    uint64_t int_key;
+    int64_t value;
+} ChainNode;
+
+typedef struct ChainedTable {
+    ChainNode **buckets;
+    size_t count;
+    size_t capacity;
+} ChainedTable;
+
+static ChainedTable *make_chained_table(void)
+{
+    ChainedTable *table = malloc(sizeof(ChainedTable));
+    table->capacity = HASH_MAP_INITIAL_CAPACITY;
+    table->buckets = calloc(table->capacity, sizeof(ChainNode *));
+    table->count = 0;
+    return table;
+}
+
+static void cleanup_chained_table(ChainedTable *table)
+{
+    for (size_t i = 0; i < table->capacity; i++) {
+        for (ChainNode *node = table->buckets[i], *next; node != NULL; node = next) {
+            next = node->next;
+            free(node->key);
+            free(node);
+        }
+    }
+    free(table->buckets);
+    free(table);
+}
+
+static ChainNode *chained_find(ChainedTable *table, uint64_t hash, const char *key, uint64_t int_key)
+{
+    for (ChainNode *node = table->buckets[hash & (table->capacity - 1)]; node != NULL; node = node->next) {
+        if (node->hash == hash && (key != NULL ? strcmp(node->key, key) == 0 : node->int_key == int_key)) {
+            return node;
+        }
+    }
+    return NULL;
+}
+
+static void chained_put(ChainedTable *table, uint64_t hash, const char *key, uint64_t int_key, int64_t value)
+{
+    ChainNode *node = chained_find(table, hash, key, int_key);
+    if (node != NULL) {
+        node->value = value;
+        return;
+    }
+    if (table->count == table->capacity) {
+        ChainNode **buckets = table->buckets;
+        size_t capacity = table->capacity;
+        table->capacity *= 2;
+        table->buckets = calloc(table->capacity, sizeof(ChainNode *));
+        for (size_t i = 0; i < capacity; i++) {
+            for (ChainNode *moved = buckets[i], *next; moved != NULL; moved = next) {
+                next = moved->next;
+                moved->next = table->buckets[moved->hash & (table->capacity - 1)];
+                table->buckets[moved->hash & (table->capacity - 1)] = moved;
+            }
+        }
+        free(buckets);
+    }
+    node = malloc(sizeof(ChainNode));
+    *node = (ChainNode) { .hash = hash, .key = key != NULL ? strdup(key) : NULL, .int_key = int_key, .value = value };
+    node->next = table->buckets[hash & (table->capacity - 1)];
+    table->buckets[hash & (table->capacity - 1)] = node;
+    table->count++;
+}
+
+typedef struct Timings {
+    uint64_t insert;
+    uint64_t hit;
+    uint64_t miss;
+} Timings;
+
+// `keys` holds 2 * count names, the second half is never inserted. Lookups go through `order`, a
+// permutation of 0..count-1.
+static Timings bench_string_map(char **keys, size_t *order, size_t count)
+{
+    Timings timings;
+    int64_t sum = 0, value;
+    StringMap *map = make_string_map();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        string_map_put(map, keys[i], (int64_t)i);
+    }
+    timings.insert = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        sum += string_map_get(map, keys[order[i]], &value) ? value : 0;
+    }
+    timings.hit = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        sum += string_map_get(map, keys[count + order[i]], &value);
+    }
+    timings.miss = now_ns() - start;
+    assert(sum == (int64_t)(count * (count - 1) / 2));
+    cleanup_string_map(map);
+    return timings;
+}
+
+static Timings bench_chained_strings(char **keys, size_t *order, size_t count)
+{
+    Timings timings;
+    int64_t sum = 0;
+    ChainedTable *table = make_chained_table();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        chained_put(table, hash_bytes(keys[i], strlen(keys[i])), keys[i], 0, (int64_t)i);
+    }
+    timings.insert = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        char *key = keys[order[i]];
+        ChainNode *node = chained_find(table, hash_bytes(key, strlen(key)), key, 0);
+        sum += node != NULL ? node->value : 0;
+    }
+    timings.hit = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        char *key = keys[count + order[i]];
+        sum += chained_find(table, hash_bytes(key, strlen(key)), key, 0) != NULL;
+    }
+    timings.miss = now_ns() - start;
+    assert(sum == (int64_t)(count * (count - 1) / 2));
+    cleanup_chained_table(table);
+    return timings;
+}
+
+// Keys spaced like addresses of 16 byte aligned objects
+static Timings bench_int_map(size_t *order, size_t count)
+{
+    Timings timings;
+    int64_t sum = 0, value;
+    IntMap *map = make_int_map();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        int_map_put(map, i * 16, (int64_t)i);
+    }
+    timings.insert = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        sum += int_map_get(map, order[i] * 16, &value) ? value : 0;
+    }
+    timings.hit = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        sum += int_map_get(map, order[i] * 16 + 8, &value);
+    }
+    timings.miss = now_ns() - start;
+    assert(sum == (int64_t)(count * (count - 1) / 2));
+    cleanup_int_map(map);
+    return timings;
+}
+
+static Timings bench_chained_ints(size_t *order, size_t count)
+{
+    Timings timings;
+    int64_t sum = 0;
+    ChainedTable *table = make_chained_table();
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        chained_put(table, hash_int(i * 16), NULL, i * 16, (int64_t)i);
+    }
+    timings.insert = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        ChainNode *node = chained_find(table, hash_int(order[i] * 16), NULL, order[i] * 16);
+        sum += node != NULL ? node->value : 0;
+    }
+    timings.hit = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < count; i++) {
+        sum += chained_find(table, hash_int(order[i] * 16 + 8), NULL, order[i] * 16 + 8) != NULL;
+    }
+    timings.miss = now_ns() - start;
+    assert(sum == (int64_t)(count * (count - 1) / 2));
+    cleanup_chained_table(table);
+    return timings;
+}
+
+static void print_timings(const char *label, size_t count, Timings timings)
+{
+    printf("%-8s %10zu %12.1f %12.1f %12.1f\n", label, count, (double)timings.insert / count, (double)timings.hit / count,
+        (double)timings.miss / count);
+}
+
+static void bench_resolving_globals(void)
+{
+    size_t size = RESOLVED_GLOBALS * 32;
+    char *input = malloc(size);
+    size_t length = 0;
+    for (int i = 0; i < RESOLVED_GLOBALS; i++) {
+        char name[BENCH_IDENTIFIER_SIZE];
+        bench_identifier(i, name);
+        length += snprintf(input + length, size - length, "let g%s = %d; ", name, i);
+    }
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    Resolver *resolver = make_resolver();
+
+    uint64_t start = now_ns();
+    bool resolved = resolve_program(resolver, program);
+    uint64_t elapsed = now_ns() - start;
+    assert(resolved && get_global_count(resolver) == RESOLVED_GLOBALS);
+    (void)resolved;
+    printf("\nresolving %d globals: %.1f ms\n", RESOLVED_GLOBALS, elapsed / 1e6);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(input);
+}
+
+int main(void)
+{
+    printf("%-8s %10s %12s %12s %12s\n", "table", "keys", "insert ns", "hit ns", "miss ns");
+    size_t counts[] = { 1000, 100000, 1000000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        size_t count = counts[i];
+        char **keys = malloc(2 * count * sizeof(char *));
+        for (size_t j = 0; j < 2 * count; j++) {
+            char buffer[32];
+            snprintf(buffer, sizeof(buffer), "identifier_%zu", j);
+            keys[j] = strdup(buffer);
+        }
+        size_t *order = malloc(count * sizeof(size_t));
+        for (size_t j = 0; j < count; j++) {
+            order[j] = j;
+        }
+        srand(1);
+        for (size_t j = count - 1; j > 0; j--) {
+            size_t other = (size_t)rand() % (j + 1);
+            size_t swap = order[j];
+            order[j] = order[other];
+            order[other] = swap;
+        }
+        print_timings("swiss", count, bench_string_map(keys, order, count));
+        print_timings("chained", count, bench_chained_strings(keys, order, count));
+        print_timings("swiss64", count, bench_int_map(order, count));
+        print_timings("chain64", count, bench_chained_ints(order, count));
+        for (size_t j = 0; j < 2 * count; j++) {
+            free(keys[j]);
+        }
+        free(keys);
+        free(order);
+    }
+    bench_resolving_globals();
+    return 0;
+}
@@ -0,0 +1,127 @@
+#include "hash_map.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+TEST_CASE(string_map_put_get_remove)
+{
+    StringMap *map = make_string_map();
+    int64_t value = -1;
+    assert(!string_map_get(map, "x", &value) && value == -1);
+    assert(!string_map_remove(map, "x"));
+
+    // Enough keys to grow the table several times
+    char key[32];
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "name%d", i);
+        string_map_put(map, key, i);
+    }
+    assert(map->count == 10000);
+    assert(map->capacity >= 10000 * 4 / 3);
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "name%d", i);
+        if (!string_map_get(map, key, &value) || value != i) {
+            printf("Expected: %s => %d\n", key, i);
+            assert(1 != 1);
+        }
+    }
+    assert(!string_map_get(map, "name10000", &value));
+    assert(!string_map_get(map, "", &value));
+
+    // Replacing keeps the count, keys are copied so the caller's buffer can change
+    string_map_put(map, "name7", -7);
+    assert(map->count == 10000);
+    assert(string_map_get(map, "name7", &value) && value == -7);
+    string_map_put(map, "", 42);
+    assert(string_map_get(map, "", &value) && value == 42);
+
+    for (int i = 0; i < 10000; i += 2) {
+        snprintf(key, sizeof(key), "name%d", i);
+        assert(string_map_remove(map, key));
+        assert(!string_map_remove(map, key));
+    }
+    assert(map->count == 5001);
+    for (int i = 0; i < 10000; i++) {
+        snprintf(key, sizeof(key), "name%d", i);
+        assert(string_map_get(map, key, &value) == (i % 2 == 1));
+    }
+    cleanup_string_map(map);
+}
+
+// Every key must still be found after any sequence of removals, which move entries around
+TEST_CASE(int_map_matches_reference)
+{
+    enum { KEYS = 4096, STEPS = 200000 };
+    int64_t *reference = malloc(KEYS * sizeof(int64_t)); // -1 for keys not in the map
+    for (int i = 0; i < KEYS; i++) {
+        reference[i] = -1;
+    }
+
+    IntMap *map = make_int_map();
+    size_t count = 0;
+    uint64_t state = 88172645463325252u;
+    for (int step = 0; step < STEPS; step++) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        // Keys spaced like pointers, so only the mixing spreads them out
+        uint64_t key = (state >> 20) % KEYS;
+        switch (state % 3) {
+        case 0:
+            count += reference[key] == -1;
+            int_map_put(map, key * 16, step);
+            reference[key] = step;
+            break;
+        case 1:
+            assert(int_map_remove(map, key * 16) == (reference[key] != -1));
+            count -= reference[key] != -1;
+            reference[key] = -1;
+            break;
+        default: {
+            int64_t value;
+            bool found = int_map_get(map, key * 16, &value);
+            assert(found == (reference[key] != -1));
+            assert(!found || value == reference[key]);
+        }
+        }
+        assert(map->count == count);
+    }
+
+    for (int i = 0; i < KEYS; i++) {
+        int64_t value;
+        assert(int_map_get(map, (uint64_t)i * 16, &value) == (reference[i] != -1));
+        assert(!int_map_get(map, (uint64_t)i * 16 + 1, &value));
+    }
+    cleanup_int_map(map);
+    free(reference);
+}
+
+TEST_CASE(int_map_extreme_keys)
+{
+    IntMap *map = make_int_map();
+    uint64_t keys[] = { 0, 1, UINT64_MAX, (uint64_t)INT64_MIN, 0x8000 };
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        int_map_put(map, keys[i], (int64_t)i);
+    }
+    for (size_t i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+        int64_t value;
+        assert(int_map_get(map, keys[i], &value) && value == (int64_t)i);
+    }
+    assert(map->count == 5);
+    cleanup_int_map(map);
+}
+
+TEST_CASE(hashes_spread_similar_keys)
+{
+    // Keys differing in one byte or one bit differ in the bits picking the home slot
+    assert(hash_bytes("a", 1) != hash_bytes("b", 1));
+    assert(hash_bytes("abcdefgh", 8) >> 7 != hash_bytes("abcdefgi", 8) >> 7);
+    assert(hash_bytes("", 0) != hash_bytes("\0", 1));
+    assert(hash_int(16) >> 7 != hash_int(32) >> 7);
+}
+
+RUN_TESTS()
@@ -0,0 +1,1011 @@
+#include "jit.h"
+#include "code.h"
+
+#if JIT_AVAILABLE
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+// Native frames keep every local and operand stack slot as a raw 64-bit integer in memory,
+// addressed off rbx. The types of the slots are tracked while translating, so the only runtime
+// checks are the guards on what comes from outside: globals, callees and arithmetic results.
+//
+//   rbx  slot 0 (locals first, then the operand stack)
+//   r12  where to write the result
+//   r13  call depth, bail out past MAX_FRAMES
+//   r14  the VM's globals
+
+enum {
+    RAX = 0,
+    RCX = 1,
+    RDX = 2,
+    RBX = 3,
+    RSP = 4,
+    RBP = 5,
+    RSI = 6,
+    RDI = 7,
+    R12 = 12,
+    R13 = 13,
+    R14 = 14,
+};
+
+enum {
+    CC_O = 0x0,
+    CC_AE = 0x3,
+    CC_E = 0x4,
+    CC_NE = 0x5,
+    CC_G = 0xF,
+};
+
+typedef enum SlotKind {
+    SLOT_UNKNOWN, // A local that is only set on some paths, reading it rejects the function
+    SLOT_INT,
+    SLOT_BOOL,
+    SLOT_NULL,
+    SLOT_CALLEE // A function read from a global, only good for calling
+} SlotKind;
+
+typedef struct SlotType {
+    SlotKind kind;
+    FunctionProto *callee;
+} SlotType;
+
+// Types of the locals and the operand stack at one point of the bytecode
+typedef struct AbstractState {
+    int depth;
+    SlotType slots[]; // num_locals + max_stack entries
+} AbstractState;
+
+typedef struct Fixup {
+    size_t position; // Of the rel32 to patch
+    size_t target; // Bytecode offset, or one of the labels below
+} Fixup;
+
+#define LABEL_DEOPT SIZE_MAX
+#define LABEL_EXIT (SIZE_MAX - 1)
+
+typedef struct Assembler {
+    VM *vm;
+    FunctionProto *function;
+    int num_slots;
+
+    uint8_t *code;
+    size_t size;
+    size_t capacity;
+
+    size_t *native_offsets; // Per bytecode offset, SIZE_MAX until translated
+    AbstractState **states; // Per bytecode offset, the state jumps to it arrive with
+    bool *loop_headers; // Per bytecode offset, whether a backward jump goes there
+    Fixup *fixups;
+    size_t num_fixups;
+    size_t fixups_capacity;
+
+    size_t body_offset; // Right after the prologue, where self tail calls loop back to
+    bool has_return;
+    SlotKind return_kind;
+    bool failed;
+} Assembler;
+
+static void emit_byte(Assembler *as, uint8_t byte)
+{
+    if (as->size == as->capacity) {
+        as->capacity = as->capacity == 0 ? 1024 : as->capacity * 2;
+        as->code = realloc(as->code, as->capacity);
+    }
+    as->code[as->size++] = byte;
+}
+
+static void emit_u32(Assembler *as, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        emit_byte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void emit_u64(Assembler *as, uint64_t value)
+{
+    for (int i = 0; i < 8; i++) {
+        emit_byte(as, (uint8_t)(value >> (8 * i)));
+    }
+}
+
+static void emit_rex(Assembler *as, bool wide, int reg, int base)
+{
+    uint8_t rex = 0x40 | (wide ? 0x08 : 0) | ((reg & 8) ? 0x04 : 0) | ((base & 8) ? 0x01 : 0);
+    if (rex != 0x40) {
+        emit_byte(as, rex);
+    }
+}
+
+// ModRM for [base + disp32], `reg` is the register or opcode extension
+static void emit_mem(Assembler *as, int reg, int base, int32_t disp)
+{
+    emit_byte(as, 0x80 | ((reg & 7) << 3) | (base & 7));
+    if ((base & 7) == RSP) {
+        emit_byte(as, 0x24);
+    }
+    emit_u32(as, (uint32_t)disp);
+}
+
+// An instruction of the form `op reg, [base + disp]` (or the reverse, depending on the opcode)
+static void emit_op_mem(Assembler *as, bool wide, const uint8_t *opcode, size_t opcode_len, int reg, int base, int32_t disp)
+{
+    emit_rex(as, wide, reg, base);
+    for (size_t i = 0; i < opcode_len; i++) {
+        emit_byte(as, opcode[i]);
+    }
+    emit_mem(as, reg, base, disp);
+}
+
+static void emit_op_reg(Assembler *as, bool wide, uint8_t opcode, int reg, int rm)
+{
+    emit_rex(as, wide, reg, rm);
+    emit_byte(as, opcode);
+    emit_byte(as, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+}
+
+#define MEM_OP(as, reg, base, disp, ...) \
+    emit_op_mem(as, TRUE, (const uint8_t[]) { __VA_ARGS__ }, sizeof((const uint8_t[]) { __VA_ARGS__ }), reg, base, disp)
+
+static void emit_load(Assembler *as, int reg, int base, int32_t disp)
+{
+    MEM_OP(as, reg, base, disp, 0x8B);
+}
+
+static void emit_store(Assembler *as, int base, int32_t disp, int reg)
+{
+    MEM_OP(as, reg, base, disp, 0x89);
+}
+
+static void emit_store_imm(Assembler *as, int base, int32_t disp, int32_t imm)
+{
+    MEM_OP(as, 0, base, disp, 0xC7);
+    emit_u32(as, (uint32_t)imm);
+}
+
+static void emit_mov_imm64(Assembler *as, int reg, uint64_t imm)
+{
+    emit_rex(as, TRUE, 0, reg);
+    emit_byte(as, 0xB8 + (reg & 7));
+    emit_u64(as, imm);
+}
+
+static void emit_push(Assembler *as, int reg)
+{
+    emit_rex(as, FALSE, 0, reg);
+    emit_byte(as, 0x50 + (reg & 7));
+}
+
+static void emit_pop(Assembler *as, int reg)
+{
+    emit_rex(as, FALSE, 0, reg);
+    emit_byte(as, 0x58 + (reg & 7));
+}
+
+static void emit_fixup(Assembler *as, size_t target)
+{
+    if (as->num_fixups == as->fixups_capacity) {
+        as->fixups_capacity = as->fixups_capacity == 0 ? 64 : as->fixups_capacity * 2;
+        as->fixups = realloc(as->fixups, as->fixups_capacity * sizeof(Fixup));
+    }
+    as->fixups[as->num_fixups++] = (Fixup) { as->size, target };
+    emit_u32(as, 0);
+}
+
+static void emit_jump(Assembler *as, size_t target)
+{
+    emit_byte(as, 0xE9);
+    emit_fixup(as, target);
+}
+
+static void emit_jump_if(Assembler *as, int condition, size_t target)
+{
+    emit_byte(as, 0x0F);
+    emit_byte(as, 0x80 | condition);
+    emit_fixup(as, target);
+}
+
+static inline int32_t slot_disp(int slot)
+{
+    return slot * (int32_t)sizeof(int64_t);
+}
+
+static inline int32_t global_disp(int index)
+{
+    return index * (int32_t)sizeof(Value);
+}
+
+static int frame_bytes(Assembler *as)
+{
+    // Keeps rsp 16 byte aligned for calls, the return address and five pushes make 48 bytes
+    return (as->num_slots * 8 + 15) & ~15;
+}
+
+static void emit_prologue(Assembler *as)
+{
+    emit_push(as, RBP);
+    emit_op_reg(as, TRUE, 0x89, RSP, RBP); // mov rbp, rsp
+    emit_push(as, RBX);
+    emit_push(as, R12);
+    emit_push(as, R13);
+    emit_push(as, R14);
+    emit_rex(as, TRUE, 0, RSP); // sub rsp, frame
+    emit_byte(as, 0x81);
+    emit_byte(as, 0xC0 | (5 << 3) | RSP);
+    emit_u32(as, (uint32_t)frame_bytes(as));
+    emit_op_reg(as, TRUE, 0x89, RSP, RBX); // mov rbx, rsp
+    emit_op_reg(as, TRUE, 0x89, RSI, R12); // mov r12, rsi
+    emit_op_reg(as, TRUE, 0x89, RDX, R13); // mov r13, rdx
+    emit_op_reg(as, TRUE, 0x89, RCX, R14); // mov r14, rcx
+
+    emit_rex(as, TRUE, 0, R13); // cmp r13, MAX_FRAMES
+    emit_byte(as, 0x81);
+    emit_byte(as, 0xC0 | (7 << 3) | (R13 & 7));
+    emit_u32(as, MAX_FRAMES);
+    emit_jump_if(as, CC_AE, LABEL_DEOPT);
+
+    for (int i = 0; i < as->function->num_parameters; i++) {
+        emit_load(as, RAX, RDI, slot_disp(i));
+        emit_store(as, RBX, slot_disp(i), RAX);
+    }
+    as->body_offset = as->size;
+}
+
+// Both exits share the register restore, the deopt one sets eax to 1 first
+static void emit_epilogue(Assembler *as, size_t *exit_offset, size_t *deopt_offset)
+{
+    *deopt_offset = as->size;
+    emit_byte(as, 0xB8); // mov eax, 1
+    emit_u32(as, 1);
+    emit_byte(as, 0xEB); // jmp over the xor
+    emit_byte(as, 2);
+
+    *exit_offset = as->size;
+    emit_byte(as, 0x31); // xor eax, eax
+    emit_byte(as, 0xC0);
+    MEM_OP(as, RSP, RBP, -32, 0x8D); // lea rsp, [rbp - 32]
+    emit_pop(as, R14);
+    emit_pop(as, R13);
+    emit_pop(as, R12);
+    emit_pop(as, RBX);
+    emit_pop(as, RBP);
+    emit_byte(as, 0xC3);
+}
+
+static AbstractState *make_state(Assembler *as)
+{
+    return calloc(1, sizeof(AbstractState) + as->num_slots * sizeof(SlotType));
+}
+
+static AbstractState *copy_state(Assembler *as, AbstractState *state)
+{
+    AbstractState *copy = make_state(as);
+    memcpy(copy, state, sizeof(AbstractState) + as->num_slots * sizeof(SlotType));
+    return copy;
+}
+
+static bool same_type(SlotType a, SlotType b)
+{
+    return a.kind == b.kind && (a.kind != SLOT_CALLEE || a.callee == b.callee);
+}
+
+// Records the state a jump to `target` arrives with. Operand stacks have to agree, locals that
+// differ between paths can no longer be read.
+static void merge_into(Assembler *as, size_t target, AbstractState *state)
+{
+    AbstractState *existing = as->states[target];
+    if (existing == NULL) {
+        as->states[target] = copy_state(as, state);
+        return;
+    }
+    if (existing->depth != state->depth) {
+        as->failed = TRUE;
+        return;
+    }
+    int num_locals = as->function->num_locals;
+    for (int i = 0; i < num_locals; i++) {
+        if (!same_type(existing->slots[i], state->slots[i])) {
+            existing->slots[i] = (SlotType) { SLOT_UNKNOWN, NULL };
+        }
+    }
+    for (int i = num_locals; i < num_locals + state->depth; i++) {
+        if (!same_type(existing->slots[i], state->slots[i])) {
+            as->failed = TRUE;
+        }
+    }
+}
+
+// The body of a loop is translated once, with the state the loop is entered with. A backward jump
+// is only allowed if it cannot bring anything that state does not already allow for.
+static bool fits_loop_header(Assembler *as, size_t target, AbstractState *state)
+{
+    AbstractState *header = as->states[target];
+    if (header == NULL || header->depth != state->depth) {
+        return FALSE;
+    }
+    int num_locals = as->function->num_locals;
+    for (int i = 0; i < num_locals; i++) {
+        if (header->slots[i].kind != SLOT_UNKNOWN && !same_type(header->slots[i], state->slots[i])) {
+            return FALSE;
+        }
+    }
+    for (int i = num_locals; i < num_locals + state->depth; i++) {
+        if (!same_type(header->slots[i], state->slots[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static void find_loop_headers(Assembler *as)
+{
+    Instructions *instructions = as->function->instructions;
+    size_t ip = 0;
+    while (ip < instructions->size) {
+        const OpDefinition *def = lookup_op_definition(instructions->array[ip]);
+        if (def == NULL) {
+            return;
+        }
+        int operands[MAX_OPERANDS] = { 0 };
+        size_t next = ip + 1 + read_operands(def, &instructions->array[ip + 1], operands);
+        if (instructions->array[ip] == OP_JUMP && (size_t)operands[0] <= ip) {
+            as->loop_headers[operands[0]] = TRUE;
+        }
+        ip = next;
+    }
+}
+
+static bool is_value_kind(SlotKind kind)
+{
+    return kind == SLOT_INT || kind == SLOT_BOOL || kind == SLOT_NULL;
+}
+
+// Makes sure a function called from native code has native code too, or will have once the
+// compilation currently in progress finishes. Returns the kind of value it returns.
+static bool prepare_callee(Assembler *as, FunctionProto *callee, SlotKind *return_kind)
+{
+    if (callee->jit_state == JIT_NOT_COMPILED) {
+        jit_compile(as->vm, callee);
+    }
+    switch (callee->jit_state) {
+    case JIT_COMPILING:
+        callee->jit_assumed = TRUE;
+        *return_kind = SLOT_INT;
+        return TRUE;
+    case JIT_COMPILED:
+        switch (callee->jit_return_type) {
+        case VAL_INT:
+            *return_kind = SLOT_INT;
+            return TRUE;
+        case VAL_BOOL:
+            *return_kind = SLOT_BOOL;
+            return TRUE;
+        case VAL_NULL:
+            *return_kind = SLOT_NULL;
+            return TRUE;
+        default:
+            return FALSE;
+        }
+    default:
+        return FALSE;
+    }
+}
+
+static void emit_global_read(Assembler *as, AbstractState *state, int index)
+{
+    int slot = as->function->num_locals + state->depth;
+    if ((size_t)index >= as->vm->globals_capacity) {
+        as->failed = TRUE;
+        return;
+    }
+
+    // Specialised on what the global holds right now, guarded in case it changes
+    Value current = as->vm->globals[index];
+    emit_rex(as, FALSE, 0, R14); // cmp dword [r14 + type], kind
+    emit_byte(as, 0x81);
+    emit_mem(as, 7, R14, global_disp(index) + (int32_t)offsetof(Value, type));
+    emit_u32(as, current.type);
+    emit_jump_if(as, CC_NE, LABEL_DEOPT);
+
+    switch (current.type) {
+    case VAL_INT:
+        emit_load(as, RAX, R14, global_disp(index) + (int32_t)offsetof(Value, as));
+        emit_store(as, RBX, slot_disp(slot), RAX);
+        state->slots[slot] = (SlotType) { SLOT_INT, NULL };
+        break;
+    case VAL_BOOL:
+        emit_op_mem(as, FALSE, (const uint8_t[]) { 0x0F, 0xB6 }, 2, RAX, R14, global_disp(index) + (int32_t)offsetof(Value, as)); // movzx eax, byte
+        emit_store(as, RBX, slot_disp(slot), RAX);
+        state->slots[slot] = (SlotType) { SLOT_BOOL, NULL };
+        break;
+    case VAL_NULL:
+        emit_store_imm(as, RBX, slot_disp(slot), 0);
+        state->slots[slot] = (SlotType) { SLOT_NULL, NULL };
+        break;
+    case VAL_FLOAT:
+        as->failed = TRUE;
+        return;
+    case VAL_OBJ: {
+        if (!IS_CLOSURE(current) || AS_CLOSURE(current)->function->num_upvalues != 0) {
+            as->failed = TRUE;
+            return;
+        }
+        // Closures move when promoted, so the guard checks the prototype they were made from
+        FunctionProto *callee = AS_CLOSURE(current)->function;
+        emit_load(as, RAX, R14, global_disp(index) + (int32_t)offsetof(Value, as));
+        emit_op_mem(as, FALSE, (const uint8_t[]) { 0x81 }, 1, 7, RAX, (int32_t)offsetof(Object, type)); // cmp dword [rax], OBJ_CLOSURE
+        emit_u32(as, OBJ_CLOSURE);
+        emit_jump_if(as, CC_NE, LABEL_DEOPT);
+        emit_mov_imm64(as, RCX, (uint64_t)(uintptr_t)callee);
+        MEM_OP(as, RCX, RAX, (int32_t)offsetof(Closure, function), 0x3B); // cmp rcx, [rax + function]
+        emit_jump_if(as, CC_NE, LABEL_DEOPT);
+        state->slots[slot] = (SlotType) { SLOT_CALLEE, callee };
+        break;
+    }
+    }
+    state->depth++;
+}
+
+static void emit_call(Assembler *as, AbstractState *state, int num_arguments)
+{
+    int num_locals = as->function->num_locals;
+    int callee_slot = num_locals + state->depth - num_arguments - 1;
+    SlotType callee_type = state->slots[callee_slot];
+    if (callee_type.kind != SLOT_CALLEE || callee_type.callee->num_parameters != num_arguments) {
+        as->failed = TRUE;
+        return;
+    }
+    for (int i = callee_slot + 1; i < num_locals + state->depth; i++) {
+        if (state->slots[i].kind != SLOT_INT) {
+            as->failed = TRUE;
+            return;
+        }
+    }
+
+    FunctionProto *callee = callee_type.callee;
+    SlotKind return_kind;
+    if (!prepare_callee(as, callee, &return_kind)) {
+        as->failed = TRUE;
+        return;
+    }
+
+    MEM_OP(as, RDI, RBX, slot_disp(callee_slot + 1), 0x8D); // lea rdi, [arguments]
+    MEM_OP(as, RSI, RBX, slot_disp(callee_slot), 0x8D); // lea rsi, [callee slot]
+    MEM_OP(as, RDX, R13, 1, 0x8D); // lea rdx, [r13 + 1]
+    emit_op_reg(as, TRUE, 0x89, R14, RCX); // mov rcx, r14
+    emit_mov_imm64(as, RAX, (uint64_t)(uintptr_t)&callee->jit_entry);
+    emit_load(as, RAX, RAX, 0);
+    emit_op_reg(as, TRUE, 0x85, RAX, RAX); // test rax, rax
+    emit_jump_if(as, CC_E, LABEL_DEOPT);
+    emit_byte(as, 0xFF); // call rax
+    emit_byte(as, 0xD0);
+    emit_op_reg(as, FALSE, 0x85, RAX, RAX); // test eax, eax
+    emit_jump_if(as, CC_NE, LABEL_DEOPT);
+
+    state->depth -= num_arguments;
+    state->slots[callee_slot] = (SlotType) { return_kind, NULL };
+}
+
+// A function calling itself in tail position stores the new arguments over its parameters and
+// jumps back to the start of its body. The other locals are unknown there, like on entry.
+static bool emit_self_tail_call(Assembler *as, AbstractState *state, int num_arguments)
+{
+    int num_locals = as->function->num_locals;
+    int callee_slot = num_locals + state->depth - num_arguments - 1;
+    SlotType callee_type = state->slots[callee_slot];
+    if (callee_type.kind != SLOT_CALLEE || callee_type.callee != as->function || num_arguments != as->function->num_parameters) {
+        return FALSE;
+    }
+    for (int i = 0; i < num_arguments; i++) {
+        if (state->slots[callee_slot + 1 + i].kind != SLOT_INT) {
+            return FALSE;
+        }
+    }
+
+    for (int i = 0; i < num_arguments; i++) {
+        emit_load(as, RAX, RBX, slot_disp(callee_slot + 1 + i));
+        emit_store(as, RBX, slot_disp(i), RAX);
+    }
+    emit_byte(as, 0xE9); // jmp rel32
+    emit_u32(as, (uint32_t)(int32_t)((int64_t)as->body_offset - (int64_t)(as->size + 4)));
+    return TRUE;
+}
+
+static void emit_arithmetic(Assembler *as, AbstractState *state, OpCode op)
+{
+    int right = as->function->num_locals + state->depth - 1;
+    int left = right - 1;
+    if (state->slots[left].kind != SLOT_INT || state->slots[right].kind != SLOT_INT) {
+        // Always a runtime error, leave it to the interpreter
+        as->failed = TRUE;
+        return;
+    }
+
+    switch (op) {
+    case OP_ADD:
+        emit_load(as, RAX, RBX, slot_disp(left));
+        MEM_OP(as, RAX, RBX, slot_disp(right), 0x03);
+        emit_jump_if(as, CC_O, LABEL_DEOPT);
+        break;
+    case OP_SUB:
+        emit_load(as, RAX, RBX, slot_disp(left));
+        MEM_OP(as, RAX, RBX, slot_disp(right), 0x2B);
+        emit_jump_if(as, CC_O, LABEL_DEOPT);
+        break;
+    case OP_MUL:
+        emit_load(as, RAX, RBX, slot_disp(left));
+        MEM_OP(as, RAX, RBX, slot_disp(right), 0x0F, 0xAF);
+        emit_jump_if(as, CC_O, LABEL_DEOPT);
+        break;
+    default: {
+        // Zero divisors and INT64_MIN / -1 are left to the interpreter to report
+        emit_load(as, RCX, RBX, slot_disp(right));
+        emit_op_reg(as, TRUE, 0x85, RCX, RCX); // test rcx, rcx
+        emit_jump_if(as, CC_E, LABEL_DEOPT);
+        emit_load(as, RAX, RBX, slot_disp(left));
+        emit_rex(as, TRUE, 0, RCX); // cmp rcx, -1
+        emit_byte(as, 0x83);
+        emit_byte(as, 0xC0 | (7 << 3) | RCX);
+        emit_byte(as, 0xFF);
+        emit_byte(as, 0x75); // jne over the negation to the division
+        emit_byte(as, 11);
+        emit_op_reg(as, TRUE, 0xF7, 3, RAX); // neg rax
+        emit_jump_if(as, CC_O, LABEL_DEOPT); // 6 bytes
+        emit_byte(as, 0xEB); // jmp past the division
+        emit_byte(as, 5);
+        emit_byte(as, 0x48); // cqo
+        emit_byte(as, 0x99);
+        emit_op_reg(as, TRUE, 0xF7, 7, RCX); // idiv rcx
+        break;
+    }
+    }
+    emit_store(as, RBX, slot_disp(left), RAX);
+    state->depth--;
+}
+
+static void emit_comparison(Assembler *as, AbstractState *state, OpCode op)
+{
+    int right = as->function->num_locals + state->depth - 1;
+    int left = right - 1;
+    SlotKind left_kind = state->slots[left].kind;
+    SlotKind right_kind = state->slots[right].kind;
+    if (!is_value_kind(left_kind) || !is_value_kind(right_kind)) {
+        as->failed = TRUE;
+        return;
+    }
+
+    if (op == OP_GREATER_THAN) {
+        if (left_kind != SLOT_INT || right_kind != SLOT_INT) {
+            as->failed = TRUE;
+            return;
+        }
+    } else if (left_kind != right_kind) {
+        // Values of different types are never equal
+        emit_store_imm(as, RBX, slot_disp(left), op == OP_NOT_EQUAL);
+        state->slots[left] = (SlotType) { SLOT_BOOL, NULL };
+        state->depth--;
+        return;
+    }
+
+    emit_load(as, RAX, RBX, slot_disp(left));
+    MEM_OP(as, RAX, RBX, slot_disp(right), 0x3B); // cmp rax, [right]
+    int condition = op == OP_EQUAL ? CC_E : op == OP_NOT_EQUAL ? CC_NE : CC_G;
+    emit_byte(as, 0x0F); // setcc al
+    emit_byte(as, 0x90 | condition);
+    emit_byte(as, 0xC0);
+    emit_byte(as, 0x0F); // movzx eax, al
+    emit_byte(as, 0xB6);
+    emit_byte(as, 0xC0);
+    emit_store(as, RBX, slot_disp(left), RAX);
+    state->slots[left] = (SlotType) { SLOT_BOOL, NULL };
+    state->depth--;
+}
+
+static void emit_return(Assembler *as, SlotKind kind, int slot)
+{
+    if (as->has_return && as->return_kind != kind) {
+        as->failed = TRUE;
+        return;
+    }
+    as->has_return = TRUE;
+    as->return_kind = kind;
+    if (slot >= 0) {
+        emit_load(as, RAX, RBX, slot_disp(slot));
+        emit_store(as, R12, 0, RAX);
+    } else {
+        emit_store_imm(as, R12, 0, 0);
+    }
+    emit_jump(as, LABEL_EXIT);
+}
+
+// Translates the function's bytecode in one pass. Apart from the jumps back to the top of a loop
+// bytecode only jumps forwards, so the state at every jump target is known by the time the pass
+// gets there. Code no jump or fall through reaches is skipped.
+static void translate(Assembler *as)
+{
+    FunctionProto *function = as->function;
+    Instructions *instructions = function->instructions;
+    Value *constants = as->vm->constants->array;
+    int num_locals = function->num_locals;
+
+    AbstractState *state = make_state(as);
+    for (int i = 0; i < function->num_parameters; i++) {
+        state->slots[i] = (SlotType) { SLOT_INT, NULL };
+    }
+    bool reachable = TRUE;
+
+    size_t ip = 0;
+    while (ip < instructions->size && !as->failed) {
+        if (reachable && as->loop_headers[ip]) {
+            merge_into(as, ip, state);
+        }
+        if (as->states[ip] != NULL) {
+            if (reachable) {
+                merge_into(as, ip, state);
+            }
+            memcpy(state, as->states[ip], sizeof(AbstractState) + as->num_slots * sizeof(SlotType));
+            reachable = TRUE;
+        }
+
+        OpCode op = instructions->array[ip];
+        const OpDefinition *def = lookup_op_definition(op);
+        if (def == NULL) {
+            as->failed = TRUE;
+            break;
+        }
+        int operands[MAX_OPERANDS] = { 0 };
+        size_t next = ip + 1 + read_operands(def, &instructions->array[ip + 1], operands);
+        if (!reachable) {
+            ip = next;
+            continue;
+        }
+        as->native_offsets[ip] = as->size;
+
+        int top = num_locals + state->depth - 1;
+        if (state->depth + 1 > function->max_stack && (op == OP_CONSTANT || op == OP_TRUE || op == OP_FALSE || op == OP_NULL || op == OP_GET_GLOBAL || op == OP_GET_LOCAL)) {
+            as->failed = TRUE;
+            break;
+        }
+
+        switch (op) {
+        case OP_CONSTANT: {
+            Value constant = constants[operands[0]];
+            if (!IS_INT(constant)) {
+                as->failed = TRUE;
+                break;
+            }
+            emit_mov_imm64(as, RAX, (uint64_t)AS_INT(constant));
+            emit_store(as, RBX, slot_disp(top + 1), RAX);
+            state->slots[top + 1] = (SlotType) { SLOT_INT, NULL };
+            state->depth++;
+            break;
+        }
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_NULL:
+            emit_store_imm(as, RBX, slot_disp(top + 1), op == OP_TRUE);
+            state->slots[top + 1] = (SlotType) { op == OP_NULL ? SLOT_NULL : SLOT_BOOL, NULL };
+            state->depth++;
+            break;
+        case OP_POP:
+            state->depth--;
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV:
+            emit_arithmetic(as, state, op);
+            break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL:
+        case OP_GREATER_THAN:
+            emit_comparison(as, state, op);
+            break;
+        case OP_NEG:
+            if (state->slots[top].kind != SLOT_INT) {
+                as->failed = TRUE;
+                break;
+            }
+            emit_load(as, RAX, RBX, slot_disp(top));
+            emit_op_reg(as, TRUE, 0xF7, 3, RAX); // neg rax
+            emit_jump_if(as, CC_O, LABEL_DEOPT);
+            emit_store(as, RBX, slot_disp(top), RAX);
+            break;
+        case OP_BANG:
+            switch (state->slots[top].kind) {
+            case SLOT_BOOL:
+                MEM_OP(as, 6, RBX, slot_disp(top), 0x83); // xor qword [top], 1
+                emit_byte(as, 1);
+                break;
+            case SLOT_INT:
+            case SLOT_NULL:
+                // Integers are always truthy and null never is
+                emit_store_imm(as, RBX, slot_disp(top), state->slots[top].kind == SLOT_NULL);
+                break;
+            default:
+                as->failed = TRUE;
+            }
+            state->slots[top] = (SlotType) { SLOT_BOOL, NULL };
+            break;
+        case OP_JUMP:
+            if ((size_t)operands[0] <= ip) {
+                as->failed = !fits_loop_header(as, operands[0], state);
+                emit_jump(as, operands[0]);
+                reachable = FALSE;
+                break;
+            }
+            merge_into(as, operands[0], state);
+            emit_jump(as, operands[0]);
+            reachable = FALSE;
+            break;
+        case OP_JUMP_NOT_TRUTHY: {
+            if ((size_t)operands[0] <= ip) {
+                as->failed = TRUE;
+                break;
+            }
+            SlotKind kind = state->slots[top].kind;
+            state->depth--;
+            if (kind == SLOT_BOOL) {
+                MEM_OP(as, 7, RBX, slot_disp(top), 0x83); // cmp qword [top], 0
+                emit_byte(as, 0);
+                merge_into(as, operands[0], state);
+                emit_jump_if(as, CC_E, operands[0]);
+            } else if (kind == SLOT_NULL) {
+                merge_into(as, operands[0], state);
+                emit_jump(as, operands[0]);
+                reachable = FALSE;
+            } else if (kind != SLOT_INT) {
+                as->failed = TRUE;
+            }
+            break;
+        }
+        case OP_GET_GLOBAL:
+            emit_global_read(as, state, operands[0]);
+            break;
+        case OP_GET_LOCAL: {
+            SlotType type = state->slots[operands[0]];
+            if (!is_value_kind(type.kind)) {
+                as->failed = TRUE;
+                break;
+            }
+            emit_load(as, RAX, RBX, slot_disp(operands[0]));
+            emit_store(as, RBX, slot_disp(top + 1), RAX);
+            state->slots[top + 1] = type;
+            state->depth++;
+            break;
+        }
+        case OP_SET_LOCAL:
+            if (!is_value_kind(state->slots[top].kind)) {
+                as->failed = TRUE;
+                break;
+            }
+            emit_load(as, RAX, RBX, slot_disp(top));
+            emit_store(as, RBX, slot_disp(operands[0]), RAX);
+            state->slots[operands[0]] = state->slots[top];
+            state->depth--;
+            break;
+        case OP_TAIL_CALL:
+            if (emit_self_tail_call(as, state, operands[0])) {
+                reachable = FALSE;
+                break;
+            }
+            // Other tail calls are ordinary native calls, the return after them passes the result on
+            emit_call(as, state, operands[0]);
+            break;
+        case OP_CALL:
+            emit_call(as, state, operands[0]);
+            break;
+        case OP_RETURN_VALUE:
+            if (!is_value_kind(state->slots[top].kind)) {
+                as->failed = TRUE;
+                break;
+            }
+            emit_return(as, state->slots[top].kind, top);
+            reachable = FALSE;
+            break;
+        case OP_RETURN:
+            emit_return(as, SLOT_NULL, -1);
+            reachable = FALSE;
+            break;
+        default:
+            // Globals writes, upvalues, closures, collections and builtins are left to the interpreter
+            as->failed = TRUE;
+        }
+        ip = next;
+    }
+    if (reachable && !as->failed) {
+        // Falling off the end of the bytecode cannot happen, every function ends in a return
+        as->failed = TRUE;
+    }
+    free(state);
+}
+
+static bool patch_fixups(Assembler *as, size_t exit_offset, size_t deopt_offset)
+{
+    for (size_t i = 0; i < as->num_fixups; i++) {
+        Fixup *fixup = &as->fixups[i];
+        size_t target;
+        if (fixup->target == LABEL_DEOPT) {
+            target = deopt_offset;
+        } else if (fixup->target == LABEL_EXIT) {
+            target = exit_offset;
+        } else {
+            target = as->native_offsets[fixup->target];
+            if (target == SIZE_MAX) {
+                return FALSE;
+            }
+        }
+        int32_t rel = (int32_t)((int64_t)target - (int64_t)(fixup->position + 4));
+        memcpy(&as->code[fixup->position], &rel, sizeof(rel));
+    }
+    return TRUE;
+}
+
+// Copies the code into its own pages, which are made executable but no longer writable
+static bool install_code(Assembler *as)
+{
+    FunctionProto *function = as->function;
+    size_t size = (as->size + 4095) & ~(size_t)4095;
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        return FALSE;
+    }
+    memcpy(memory, as->code, as->size);
+    if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(memory, size);
+        return FALSE;
+    }
+    function->jit_memory = memory;
+    function->jit_memory_size = size;
+    return TRUE;
+}
+
+static void cleanup_assembler(Assembler *as)
+{
+    size_t num_offsets = as->function->instructions->size + 1;
+    for (size_t i = 0; i < num_offsets; i++) {
+        free(as->states[i]);
+    }
+    free(as->states);
+    free(as->loop_headers);
+    free(as->native_offsets);
+    free(as->fixups);
+    free(as->code);
+}
+
+static ValueType value_type_of(SlotKind kind)
+{
+    switch (kind) {
+    case SLOT_BOOL:
+        return VAL_BOOL;
+    case SLOT_NULL:
+        return VAL_NULL;
+    default:
+        return VAL_INT;
+    }
+}
+
+// Translates `function` if it qualifies, and compiles the functions it calls along the way
+bool jit_compile(VM *vm, FunctionProto *function)
+{
+    if (function->jit_state != JIT_NOT_COMPILED) {
+        return function->jit_state == JIT_COMPILED;
+    }
+    if (function->lazy != NULL) {
+        // Not called yet, so there is no bytecode to translate. It may be by the next attempt.
+        return FALSE;
+    }
+    function->jit_state = JIT_COMPILING;
+
+    Assembler as = { 0 };
+    as.vm = vm;
+    as.function = function;
+    as.num_slots = function->num_locals + function->max_stack;
+    size_t num_offsets = function->instructions->size + 1;
+    as.states = calloc(num_offsets, sizeof(AbstractState *));
+    as.loop_headers = calloc(num_offsets, sizeof(bool));
+    as.native_offsets = malloc(num_offsets * sizeof(size_t));
+    for (size_t i = 0; i < num_offsets; i++) {
+        as.native_offsets[i] = SIZE_MAX;
+    }
+
+    bool ok = function->num_upvalues == 0;
+    if (ok) {
+        find_loop_headers(&as);
+        emit_prologue(&as);
+        translate(&as);
+        size_t exit_offset, deopt_offset;
+        emit_epilogue(&as, &exit_offset, &deopt_offset);
+        ok = !as.failed && as.has_return && patch_fixups(&as, exit_offset, deopt_offset);
+    }
+    // Recursive calls compiled before the return type was known assumed an integer
+    if (ok && function->jit_assumed && as.return_kind != SLOT_INT) {
+        ok = FALSE;
+    }
+    ok = ok && install_code(&as);
+    cleanup_assembler(&as);
+
+    if (!ok) {
+        function->jit_state = JIT_FAILED;
+        vm->jit_stats.functions_rejected++;
+        return FALSE;
+    }
+    function->jit_state = JIT_COMPILED;
+    function->jit_return_type = value_type_of(as.return_kind);
+    function->jit_entry = function->jit_memory;
+    vm->jit_stats.functions_compiled++;
+    return TRUE;
+}
+
+// Runs the native code for a call from the interpreter. Returns FALSE if the interpreter has to
+// run the call instead.
+bool jit_call(VM *vm, FunctionProto *function, Value *args, Value *result)
+{
+    int64_t raw_args[UINT8_MAX + 1];
+    for (int i = 0; i < function->num_parameters; i++) {
+        if (!IS_INT(args[i])) {
+            return FALSE;
+        }
+        raw_args[i] = AS_INT(args[i]);
+    }
+
+    int64_t raw_result;
+    JitFn entry = (JitFn)function->jit_entry;
+    vm->jit_stats.native_calls++;
+    if (entry(raw_args, &raw_result, vm->frame_count, vm->globals) != 0) {
+        vm->jit_stats.deopts++;
+        if (++function->jit_deopts >= JIT_MAX_DEOPTS) {
+            function->jit_entry = NULL;
+        }
+        return FALSE;
+    }
+
+    switch (function->jit_return_type) {
+    case VAL_BOOL:
+        *result = BOOL_VAL(raw_result != 0);
+        break;
+    case VAL_NULL:
+        *result = NULL_VAL;
+        break;
+    default:
+        *result = INT_VAL(raw_result);
+    }
+    return TRUE;
+}
+
+void jit_release(FunctionProto *function)
+{
+    if (function->jit_memory != NULL) {
+        munmap(function->jit_memory, function->jit_memory_size);
+        function->jit_memory = NULL;
+        function->jit_entry = NULL;
+    }
+}
+
+#else
+
+bool jit_compile(VM *vm, FunctionProto *function)
+{
+    (void)vm;
+    function->jit_state = JIT_FAILED;
+    return FALSE;
+}
+
+bool jit_call(VM *vm, FunctionProto *function, Value *args, Value *result)
+{
+    (void)vm;
+    (void)function;
+    (void)args;
+    (void)result;
+    return FALSE;
+}
+
+void jit_release(FunctionProto *function)
+{
+    (void)function;
+}
+
+#endif
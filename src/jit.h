@@ -0,0 +1,42 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include "globals.h"
+#include "object.h"
+#include "vm.h"
+
+// Baseline method JIT for x86-64. Functions that get called often enough are translated from
+// bytecode into machine code if they only do integer arithmetic, comparisons, if/else, locals,
+// global reads and calls to other such functions. These functions have no side effects, so
+// whenever a guard fails (an argument or global of an unexpected type, a redefined callee,
+// overflow, division by zero, deep recursion) the native code bails out and the interpreter
+// simply runs the whole call again.
+//
+// Built with `make JIT=1` (the default). Elsewhere, and with `make JIT=0`, the functions below
+// are stubs and everything is interpreted.
+
+#if defined(ENABLE_JIT) && defined(__x86_64__)
+#define JIT_AVAILABLE 1
+#else
+#define JIT_AVAILABLE 0
+#endif
+
+#define JIT_CALL_THRESHOLD 64
+#define JIT_MAX_DEOPTS 64 // Native code that bails out this often is no longer entered
+
+typedef enum JitState {
+    JIT_NOT_COMPILED,
+    JIT_COMPILING, // Calls to the function while it is compiled assume it returns an integer
+    JIT_COMPILED,
+    JIT_FAILED
+} JitState;
+
+// Native functions receive their arguments as raw integers and write their result through
+// `result`. They return 0, or 1 to make the caller fall back to the interpreter.
+typedef int (*JitFn)(const int64_t *args, int64_t *result, int64_t depth, Value *globals);
+
+extern bool jit_compile(VM *vm, FunctionProto *function);
+extern bool jit_call(VM *vm, FunctionProto *function, Value *args, Value *result);
+extern void jit_release(FunctionProto *function);
+
+#endif // JIT_H
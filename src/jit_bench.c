@@ -0,0 +1,75 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "jit.h"
+#include "object.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Recursive integer functions and a tail-recursive loop, interpreted and with the JIT
+
+#define ROUNDS 5
+
+typedef struct Benchmark {
+    const char *name;
+    char *input;
+} Benchmark;
+
+// Returns the fastest of ROUNDS runs in nanoseconds
+static uint64_t time_run(char *input, bool jit, JitStats *stats)
+{
+    uint64_t best = UINT64_MAX;
+    for (int i = 0; i < ROUNDS; i++) {
+        Parser *parser = make_parser(input, NULL);
+        Program *program = parse_program(parser);
+        Heap *heap = make_heap();
+        Compiler *compiler = make_compiler(heap);
+        FunctionProto *main = compile_program(compiler, program);
+        assert(main != NULL);
+        VM *vm = make_vm(heap, compiler->constants);
+        vm->jit_enabled = jit;
+
+        uint64_t start = now_ns();
+        VMResult result = run_vm(vm, main);
+        uint64_t elapsed = now_ns() - start;
+        assert(result == VM_OK);
+        (void)result;
+        if (elapsed < best) {
+            best = elapsed;
+        }
+        *stats = get_jit_stats(vm);
+
+        cleanup_vm(vm);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+    return best;
+}
+
+int main(void)
+{
+    Benchmark benchmarks[] = {
+        { "fib(27)", "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(27)" },
+        { "tak(18, 12, 6)", "let tak = fn(x, y, z) { if (y < x) { tak(tak(x - 1, y, z), tak(y - 1, z, x), tak(z - 1, x, y)) } else { z } }; tak(18, 12, 6)" },
+        { "tail loop 10^6", "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + n) } }; count(1000000, 0)" },
+        { "while loop 10^6", "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; let s = s + i; } s }; let rep = fn(k) { if (k == 0) { 0 } else { sum(1000) + rep(k - 1) } }; rep(1000)" },
+        { "ackermann(2, 9) x500", "let ack = fn(m, n) { if (m == 0) { n + 1 } else { if (n == 0) { ack(m - 1, 1) } else { ack(m - 1, ack(m, n - 1)) } } }; let rep = fn(k) { if (k == 0) { 0 } else { ack(2, 9) + rep(k - 1) } }; rep(500)" },
+    };
+
+    if (!JIT_AVAILABLE) {
+        printf("JIT not available in this build, both columns are interpreted\n");
+    }
+    printf("%-22s %14s %10s %9s %10s\n", "benchmark", "interpreted ms", "JIT ms", "speedup", "native");
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); i++) {
+        JitStats stats;
+        uint64_t interpreted = time_run(benchmarks[i].input, FALSE, &stats);
+        uint64_t compiled = time_run(benchmarks[i].input, TRUE, &stats);
+        printf("%-22s %14.2f %10.2f %8.1fx %10zu\n", benchmarks[i].name, interpreted / 1e6, compiled / 1e6,
+            (double)interpreted / compiled, stats.native_calls);
+    }
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include "compiler.h"
+#include "jit.h"
+#include "object.h"
+#include "parser.h"
+#include "test_utils.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+// Each program is run with and without the JIT, and the two have to agree on the result or the
+// runtime error. `hot` calls a function often enough to get it compiled.
+#define HOT(body) "let hot = fn(n) { if (n == 0) { " body " } else { " body "; hot(n - 1) } }; hot(100)"
+
+typedef struct RunResult {
+    char *output; // Inspected result, or the runtime error message
+    JitStats stats;
+} RunResult;
+
+static RunResult run_source(char *input, bool jit)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    if (parser->errors->size != 0) {
+        printf("Parsing %s failed: %s\n", input, get_error_from_arraylist(parser->errors, 0));
+        assert(1 != 1);
+    }
+
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = jit;
+    RunResult result;
+    if (run_vm(vm, main) == VM_OK) {
+        result.output = inspect_value(get_last_popped(vm));
+    } else {
+        result.output = strdup(vm->error);
+    }
+    result.stats = get_jit_stats(vm);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return result;
+}
+
+// Returns the stats of the JIT run
+static JitStats assert_same_as_interpreter(char *input, const char *expected)
+{
+    RunResult interpreted = run_source(input, FALSE);
+    RunResult compiled = run_source(input, TRUE);
+    if (strcmp(interpreted.output, expected) != 0 || strcmp(compiled.output, expected) != 0) {
+        printf("Input: %s\nExpected: %s\nInterpreter: %s\nJIT: %s\n", input, expected, interpreted.output, compiled.output);
+        assert(1 != 1);
+    }
+    free(interpreted.output);
+    free(compiled.output);
+    return compiled.stats;
+}
+
+TEST_CASE(integer_functions_match_interpreter)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(20)", "6765" },
+        { "let f = fn(a, b, c) { a * b - c / 2 + -a }; " HOT("f(n, 3, 9)"), "-4" },
+        { "let f = fn(x) { let y = x * 2; let z = y + 1; if (y > 10) { z } else { -z } }; " HOT("f(n)"), "-1" },
+        { "let f = fn(x) { if (x > 1) { return x * 10; } x - 1 }; " HOT("f(n)"), "-1" },
+        { "let f = fn(x) { x / 4 }; " HOT("f(n - 50)"), "-12" },
+        { "let f = fn(x) { x / -1 }; " HOT("f(n + 3)"), "-3" },
+        { "let add = fn(a, b) { a + b }; let twice = fn(x) { add(x, x) }; " HOT("twice(n)"), "0" },
+        { "let a = fn(n) { if (n < 1) { 0 } else { b(n - 1) + 1 } }; let b = fn(n) { if (n < 1) { 0 } else { a(n - 1) + 2 } }; " HOT("a(n)"), "0" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        JitStats stats = assert_same_as_interpreter(tests[i].input, tests[i].expected);
+        if (JIT_AVAILABLE && (stats.functions_compiled == 0 || stats.native_calls == 0)) {
+            printf("Input: %s\nNothing ran natively\n", tests[i].input);
+            assert(1 != 1);
+        }
+    }
+}
+
+TEST_CASE(booleans_and_null_match_interpreter)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "let f = fn(x) { x > 3 }; " HOT("f(n)"), "false" },
+        { "let f = fn(x) { !(x == 3) }; let g = fn(x) { f(x) == true }; " HOT("g(n)"), "true" },
+        { "let f = fn(x) { x == true }; " HOT("f(n)"), "false" },
+        { "let f = fn(x) { x != false }; " HOT("f(n)"), "true" },
+        { "let f = fn(x) { !x }; " HOT("f(n)"), "false" },
+        { "let f = fn(x) { let y = x; }; " HOT("f(n)"), "null" },
+        { "let f = fn(x) { if (x > 1) { 1 } }; " HOT("f(n)"), "null" },
+        { "let f = fn(x) { if (x > 1) { return x; } x == 1 }; " HOT("f(n)"), "false" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        assert_same_as_interpreter(tests[i].input, tests[i].expected);
+    }
+}
+
+TEST_CASE(guards_fall_back_to_interpreter)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        // Overflow is promoted to a bignum and bad divisions are reported by the interpreter
+        { "let sq = fn(x) { x * x }; " HOT("sq(n)") "; sq(sq(65536))", "18446744073709551616" },
+        { "let big = fn() { 4611686018427387904 }; let f = fn(x) { x + big() }; " HOT("f(n)") "; f(big())", "9223372036854775808" },
+        { "let sq = fn(x) { x * x }; " HOT("sq(n)") "; sq(sq(sq(65536)))", "340282366920938463463374607431768211456" },
+        { "let d = fn(a, b) { a / b }; " HOT("d(n, 1)") "; d(1, 0)", "division by zero" },
+        { "let d = fn(a, b) { a / b }; let m = fn() { -65536 * 65536 * 1073741824 * 2 }; " HOT("d(n, 1)") "; d(m(), -1)", "9223372036854775808" },
+        { "let neg = fn(x) { -x }; let m = fn() { -65536 * 65536 * 1073741824 * 2 }; " HOT("neg(n)") "; neg(m())", "9223372036854775808" },
+        // Arguments and globals of other types than when the function was compiled
+        { "let f = fn(x) { x }; " HOT("f(n)") "; f(true)", "true" },
+        { "let f = fn(x) { x * 2 }; " HOT("f(n)") "; f(1.5)", "3.0" },
+        { "let k = 5; let f = fn(x) { x + k }; " HOT("f(n)") "; let k = 0.5; f(1)", "1.5" },
+        { "let k = 5; let f = fn(x) { x + k }; " HOT("f(n)") "; let k = true; f(1)", "type mismatch: INTEGER + BOOLEAN" },
+        { "let g = fn(x) { x + 1 }; let f = fn(x) { g(x) }; " HOT("f(n)") "; let g = fn(x) { x * 100 }; f(2)", "200" },
+        // Recursing deeper than the interpreter allows
+        { "let down = fn(n) { if (n == 0) { 0 } else { 1 + down(n - 1) } }; " HOT("down(n)") "; down(5000)", "stack overflow" },
+        { "let down = fn(n) { if (n == 0) { 0 } else { 1 + down(n - 1) } }; " HOT("down(n)") "; down(4000)", "4000" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        assert_same_as_interpreter(tests[i].input, tests[i].expected);
+    }
+}
+
+TEST_CASE(self_tail_calls_loop_natively)
+{
+    char *input = "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + 2) } }; count(1000000, 0)";
+    JitStats stats = assert_same_as_interpreter(input, "2000000");
+    if (JIT_AVAILABLE && (stats.native_calls == 0 || stats.deopts != 0)) {
+        printf("Input: %s\nExpected the loop to finish in native code\n", input);
+        assert(1 != 1);
+    }
+
+    // Tail calls to other functions are plain native calls, deep chains fall back to the interpreter
+    assert_same_as_interpreter("let a = fn(n) { if (n == 0) { 1 } else { b(n - 1) } }; let b = fn(n) { if (n == 0) { 2 } else { a(n - 1) } }; a(100001)", "2");
+    assert_same_as_interpreter("let f = fn(n) { if (n > 100) { f(n - 1) } else { n * 2 } }; " HOT("f(n + 150)"), "200");
+}
+
+TEST_CASE(loops_run_natively)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; if (i == 3) { continue; } let s = s + i; } s }; " HOT("sum(n)") "; sum(1000)", "500497" },
+        { "let count = fn(n) { let i = 0; while (i < n) { let i = i + 1; } i }; " HOT("count(n)") "; count(1000000)", "1000000" },
+        { "let f = fn(n) { let i = 0; let c = 0; while (i < n) { let j = 0; while (true) { if (j == i) { break; } let j = j + 1; let c = c + 1; } let i = i + 1; } c }; " HOT("f(n)") "; f(10)", "45" },
+        { "let root = fn(n) { let i = 0; while (true) { if (i * i > n) { return i - 1; } let i = i + 1; } }; " HOT("root(n)") "; root(10000)", "100" },
+        { "let f = fn(n) { let i = 0; while (i < n) { let i = i + 1; 1 + if (i > 0) { continue; } else { 0 }; } i }; " HOT("f(n)") "; f(1000)", "1000" },
+        // Overflow inside the loop leaves it to the interpreter to rerun the call with bignums
+        { "let pow = fn(b) { let x = 1; let i = 0; while (i < 70) { let x = x * b; let i = i + 1; } x }; " HOT("pow(1)") "; pow(2)", "1180591620717411303424" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        JitStats stats = assert_same_as_interpreter(tests[i].input, tests[i].expected);
+        if (JIT_AVAILABLE && (stats.native_calls == 0 || stats.functions_rejected != 0)) {
+            printf("Input: %s\nExpected the loop to run natively\n", tests[i].input);
+            assert(1 != 1);
+        }
+    }
+}
+
+TEST_CASE(unsupported_functions_stay_interpreted)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "let adder = fn(a) { fn(b) { a + b } }; let f = fn(x) { adder(x)(1) }; " HOT("f(n)"), "1" },
+        { "let f = fn(x) { if (x > 1) { true } else { 1 } }; " HOT("f(n)"), "1" },
+        { "let apply = fn(g, x) { g(x) }; let inc = fn(x) { x + 1 }; " HOT("apply(inc, n)"), "1" },
+        // Native code only handles integers
+        { "let f = fn(x) { x * 0.5 }; " HOT("f(n)"), "0.0" },
+        { "let half = 0.5; let f = fn(x) { x * half }; " HOT("f(n)"), "0.0" },
+        // The body was translated for an integer `x`, the jump back would bring a boolean
+        { "let f = fn(n) { let x = 0; let i = 0; while (i < n) { let x = true; let i = i + 1; } i }; " HOT("f(n)"), "0" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        JitStats stats = assert_same_as_interpreter(tests[i].input, tests[i].expected);
+        if (JIT_AVAILABLE && stats.functions_rejected == 0) {
+            printf("Input: %s\nExpected a function to be rejected\n", tests[i].input);
+            assert(1 != 1);
+        }
+    }
+}
+
+RUN_TESTS()
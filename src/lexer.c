@@ -5,29 +5,39 @@
 #include <stdlib.h>
 #include <string.h>
 
-static const char *keywords[] = { "fn", "let", "true", "false", "if", "else", "return" };
-static const TokenType keyword_token_map[] = { TOKEN_FUNCTION, TOKEN_LET, TOKEN_TRUE, TOKEN_FALSE, TOKEN_IF, TOKEN_ELSE, TOKEN_RETURN };
+static const char *keywords[] = { "fn", "let", "true", "false", "if", "else", "return", "while", "break", "continue" };
+static const TokenType keyword_token_map[] = { TOKEN_FUNCTION, TOKEN_LET, TOKEN_TRUE, TOKEN_FALSE, TOKEN_IF, TOKEN_ELSE, TOKEN_RETURN, TOKEN_WHILE, TOKEN_BREAK, TOKEN_CONTINUE };
 
 void init_lexer(Lexer *lexer, char *input)
+{
+    init_lexer_span(lexer, input, strlen(input) + 1);
+}
+
+// Lexes only the first `length` characters of `input`, which need not be terminated. String
+// literals are still scanned up to their closing quote, so the span must not cut one off.
+void init_lexer_span(Lexer *lexer, char *input, size_t length)
 {
     lexer->input = input;
-    lexer->input_len = strlen(input) + 1;
+    lexer->input_len = length;
     lexer->position = 0;
     lexer->read_position = 0;
     lexer->curr_char = '\0';
+    lexer->allocator = NULL;
     read_char(lexer);
 }
 
-Lexer *make_lexer(char *input)
+Lexer *make_lexer(char *input, Allocator *allocator)
 {
-    Lexer *lexer = malloc(sizeof(struct Lexer));
+    allocator = resolve_allocator(allocator);
+    Lexer *lexer = allocate(allocator, sizeof(struct Lexer));
     init_lexer(lexer, input);
+    lexer->allocator = allocator;
     return lexer;
 }
 
 void cleanup_lexer(Lexer *lexer)
 {
-    free(lexer);
+    deallocate(lexer->allocator, lexer, sizeof(struct Lexer));
 }
 
 int read_char(Lexer *lexer)
@@ -67,15 +77,87 @@ void read_identifier(Lexer *lexer, char *out)
     out[lexer->position - pos] = '\0';
 }
 
-void read_number(Lexer *lexer, char *out)
+// Digits, optionally followed by a fraction and an exponent as in 1.5e-3, which make a float. A
+// dot or an `e` not followed by digits is left for the next token.
+static void read_number(Lexer *lexer, Token *tok)
 {
     size_t pos = lexer->position;
+    tok->type = TOKEN_INT;
     while (isdigit(lexer->curr_char)) {
         read_char(lexer);
     }
-    assert(lexer->position - pos <= MAX_INT_SIZE);
-    memcpy(out, &lexer->input[pos], lexer->position - pos);
-    out[lexer->position - pos] = '\0';
+    if (lexer->curr_char == '.' && isdigit(peek_char(lexer))) {
+        tok->type = TOKEN_FLOAT;
+        read_char(lexer);
+        while (isdigit(lexer->curr_char)) {
+            read_char(lexer);
+        }
+    }
+    if (lexer->curr_char == 'e' || lexer->curr_char == 'E') {
+        const char *exponent = &lexer->input[lexer->read_position];
+        exponent += *exponent == '+' || *exponent == '-';
+        if (isdigit(*exponent)) {
+            tok->type = TOKEN_FLOAT;
+            lexer->read_position = exponent - lexer->input;
+            read_char(lexer);
+            while (isdigit(lexer->curr_char)) {
+                read_char(lexer);
+            }
+        }
+    }
+
+    size_t length = lexer->position - pos;
+    if (tok->type == TOKEN_FLOAT) {
+        tok->string = (StringSpan) { .start = &lexer->input[pos], .length = (uint32_t)length, .escaped = FALSE };
+    }
+    if (length >= MAX_INT_SIZE) {
+        // Too long for any int64_t, keep the start so the parser can say which literal it rejects.
+        // Floats are read from their span.
+        length = MAX_INT_SIZE - 4;
+        memcpy(tok->literal, &lexer->input[pos], length);
+        strcpy(tok->literal + length, "...");
+        return;
+    }
+    memcpy(tok->literal, &lexer->input[pos], length);
+    tok->literal[length] = '\0';
+}
+
+// Scans for the closing quote and any backslashes, nothing is copied. Leaves the lexer on the
+// closing quote. An unknown escape or a missing quote makes the token illegal, its literal being
+// the offending source text.
+static void read_string(Lexer *lexer, Token *tok)
+{
+    const char *start = &lexer->input[lexer->position + 1];
+    const char *end = start;
+    const char *unknown_escape = NULL;
+    bool escaped = FALSE;
+    for (;;) {
+        end += strcspn(end, "\"\\");
+        if (*end != '\\' || end[1] == '\0') {
+            break;
+        }
+        if (strchr(STRING_ESCAPES, end[1]) == NULL && unknown_escape == NULL) {
+            unknown_escape = end;
+        }
+        escaped = TRUE;
+        end += 2;
+    }
+    end += *end == '\\'; // A backslash right before the end of the input
+    lexer->read_position = end - lexer->input;
+    read_char(lexer);
+
+    size_t length = end - start;
+    if (*end != '"') {
+        tok->type = TOKEN_ILLEGAL;
+        snprintf(tok->literal, MAX_TOKEN_LITERAL_SIZE, "\"%.*s", (int)length, start);
+    } else if (unknown_escape != NULL) {
+        tok->type = TOKEN_ILLEGAL;
+        snprintf(tok->literal, MAX_TOKEN_LITERAL_SIZE, "%.2s", unknown_escape);
+    } else {
+        tok->type = TOKEN_STRING;
+        snprintf(tok->literal, MAX_TOKEN_LITERAL_SIZE, "%.*s", (int)length, start);
+        tok->string = (StringSpan) { .start = start, .length = (uint32_t)length, .escaped = escaped };
+    }
 }
 
 void skip_whitespace(Lexer *lexer)
@@ -164,6 +246,18 @@ Token lex_next_token(Lexer *lexer)
         tok.type = TOKEN_RBRACE;
         strcpy(tok.literal, "}");
         break;
+    case '[':
+        tok.type = TOKEN_LBRACKET;
+        strcpy(tok.literal, "[");
+        break;
+    case ']':
+        tok.type = TOKEN_RBRACKET;
+        strcpy(tok.literal, "]");
+        break;
+    case ':':
+        tok.type = TOKEN_COLON;
+        strcpy(tok.literal, ":");
+        break;
     case ';':
         tok.type = TOKEN_SEMICOLON;
         strcpy(tok.literal, ";");
@@ -172,6 +266,9 @@ Token lex_next_token(Lexer *lexer)
         tok.type = TOKEN_COMMA;
         strcpy(tok.literal, ",");
         break;
+    case '"':
+        read_string(lexer, &tok);
+        break;
     case '\0':
         tok.type = TOKEN_EOF;
         strcpy(tok.literal, "");
@@ -182,8 +279,7 @@ Token lex_next_token(Lexer *lexer)
             tok.type = lookup_keyword(tok.literal);
             return tok;
         } else if (isdigit(lexer->curr_char)) {
-            read_number(lexer, tok.literal);
-            tok.type = TOKEN_INT;
+            read_number(lexer, &tok);
             return tok;
         } else {
             tok.type = TOKEN_ILLEGAL;
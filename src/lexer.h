@@ -1,6 +1,7 @@
 #ifndef LEXER_H
 #define LEXER_H
 
+#include "allocator.h"
 #include "globals.h"
 #include "token.h"
 #include <stddef.h>
@@ -11,10 +12,12 @@ typedef struct Lexer {
     size_t position;
     size_t read_position;
     char curr_char;
+    Allocator *allocator; // Only set for lexers from make_lexer, embedded lexers are owned by their parser
 } Lexer;
 
 extern void init_lexer(Lexer *lexer, char *input);
-extern Lexer *make_lexer(char *input);
+extern void init_lexer_span(Lexer *lexer, char *input, size_t length);
+extern Lexer *make_lexer(char *input, Allocator *allocator);
 extern void cleanup_lexer(Lexer *lexer);
 extern int read_char(Lexer *lexer);
 extern void read_identifier(Lexer *lexer, char *out);
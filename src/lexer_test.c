@@ -17,7 +17,7 @@ static void assert_token(Token *expected, Token *actual)
 TEST_CASE(lex_next_token_basic)
 {
     const char input[] = "=+(){},;";
-    Lexer *l = make_lexer(input);
+    Lexer *l = make_lexer(input, NULL);
 
     struct {
         TokenType expected_type;
@@ -64,7 +64,7 @@ TEST_CASE(lex_next_token_advanced)
                          "10 == 10;\n"
                          "10 != 9;\n";
 
-    Lexer *l = make_lexer(input);
+    Lexer *l = make_lexer(input, NULL);
 
     struct {
         TokenType expected_type;
@@ -163,6 +163,157 @@ TEST_CASE(lex_next_token_advanced)
     cleanup_lexer(l);
 }
 
+TEST_CASE(lex_loop_keywords)
+{
+    char input[] = "while (x) { break; continue; } whiles";
+    Lexer *l = make_lexer(input, NULL);
+
+    struct {
+        TokenType expected_type;
+        char *expected_literal;
+    } tests[] = { { TOKEN_WHILE, "while" }, { TOKEN_LPAREN, "(" }, { TOKEN_IDENT, "x" },
+        { TOKEN_RPAREN, ")" }, { TOKEN_LBRACE, "{" }, { TOKEN_BREAK, "break" },
+        { TOKEN_SEMICOLON, ";" }, { TOKEN_CONTINUE, "continue" }, { TOKEN_SEMICOLON, ";" },
+        { TOKEN_RBRACE, "}" }, { TOKEN_IDENT, "whiles" }, { TOKEN_EOF, "" } };
+
+    int num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (int i = 0; i < num_tests; i++) {
+        Token tok = lex_next_token(l);
+
+        printf("Test %d - expected token type: %s, got: %s\n", i + 1, token_type_to_str(tests[i].expected_type), token_type_to_str(tok.type));
+        printf("Test %d - expected token literal: %s, got: %s\n", i + 1, tests[i].expected_literal, tok.literal);
+
+        assert(tok.type == tests[i].expected_type);
+        assert(strcmp(tok.literal, tests[i].expected_literal) == 0);
+
+        printf("Test %d passed\n", i + 1);
+    }
+
+    cleanup_lexer(l);
+}
+
+TEST_CASE(lex_collection_delimiters)
+{
+    char input[] = "[1, 2][0]; {true: x}";
+    Lexer *l = make_lexer(input, NULL);
+
+    struct {
+        TokenType expected_type;
+        char *expected_literal;
+    } tests[] = { { TOKEN_LBRACKET, "[" }, { TOKEN_INT, "1" }, { TOKEN_COMMA, "," },
+        { TOKEN_INT, "2" }, { TOKEN_RBRACKET, "]" }, { TOKEN_LBRACKET, "[" }, { TOKEN_INT, "0" },
+        { TOKEN_RBRACKET, "]" }, { TOKEN_SEMICOLON, ";" }, { TOKEN_LBRACE, "{" },
+        { TOKEN_TRUE, "true" }, { TOKEN_COLON, ":" }, { TOKEN_IDENT, "x" }, { TOKEN_RBRACE, "}" },
+        { TOKEN_EOF, "" } };
+
+    int num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (int i = 0; i < num_tests; i++) {
+        Token tok = lex_next_token(l);
+
+        printf("Test %d - expected token type: %s, got: %s\n", i + 1, token_type_to_str(tests[i].expected_type), token_type_to_str(tok.type));
+        printf("Test %d - expected token literal: %s, got: %s\n", i + 1, tests[i].expected_literal, tok.literal);
+
+        assert(tok.type == tests[i].expected_type);
+        assert(strcmp(tok.literal, tests[i].expected_literal) == 0);
+
+        printf("Test %d passed\n", i + 1);
+    }
+
+    cleanup_lexer(l);
+}
+
+
+TEST_CASE(lex_numbers)
+{
+    char input[] = "5 1.5 0.25e3 2E-2 7e 3. 1.x 123456789.123456789123456789";
+    Lexer *l = make_lexer(input, NULL);
+
+    struct {
+        TokenType type;
+        const char *literal;
+        size_t length; // Of the span, floats only
+    } tests[] = {
+        { TOKEN_INT, "5", 0 },
+        { TOKEN_FLOAT, "1.5", 3 },
+        { TOKEN_FLOAT, "0.25e3", 6 },
+        { TOKEN_FLOAT, "2E-2", 4 },
+        // A dot or an exponent marker without digits after it is not part of the number
+        { TOKEN_INT, "7", 0 },
+        { TOKEN_IDENT, "e", 0 },
+        { TOKEN_INT, "3", 0 },
+        { TOKEN_ILLEGAL, ".", 0 },
+        { TOKEN_INT, "1", 0 },
+        { TOKEN_ILLEGAL, ".", 0 },
+        { TOKEN_IDENT, "x", 0 },
+        // Too long for the token literal, the span has all of it
+        { TOKEN_FLOAT, "123456789.123456...", 28 },
+        { TOKEN_EOF, "", 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Token tok = lex_next_token(l);
+        if (tok.type != tests[i].type || strcmp(tok.literal, tests[i].literal) != 0) {
+            printf("Expected: %s %s\nGot: %s %s\n", token_type_to_str(tests[i].type), tests[i].literal, token_type_to_str(tok.type), tok.literal);
+            assert(1 != 1);
+        }
+        if (tok.type == TOKEN_FLOAT) {
+            assert(tok.string.length == tests[i].length);
+            assert(strncmp(tok.string.start, tok.literal, tests[i].length < 16 ? tests[i].length : 16) == 0);
+        }
+    }
+    cleanup_lexer(l);
+}
+
+TEST_CASE(lex_strings)
+{
+    char input[] = "\"foo bar\" \"\" \"a\\\"b\\\\c\\n\" \"a string longer than a token literal\"";
+    Lexer *l = make_lexer(input, NULL);
+
+    struct {
+        const char *literal;
+        size_t offset; // Where the span starts in the input
+        size_t length;
+        bool escaped;
+    } tests[] = {
+        { "foo bar", 1, 7, FALSE },
+        { "", 11, 0, FALSE },
+        { "a\\\"b\\\\c\\n", 14, 9, TRUE },
+        { "a string longer tha", 26, 36, FALSE },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Token tok = lex_next_token(l);
+        assert(tok.type == TOKEN_STRING);
+        assert(strcmp(tok.literal, tests[i].literal) == 0);
+        // Nothing is copied, the token points into the input
+        assert(tok.string.start == input + tests[i].offset);
+        assert(tok.string.length == tests[i].length);
+        assert(tok.string.escaped == tests[i].escaped);
+    }
+    assert(lex_next_token(l).type == TOKEN_EOF);
+    cleanup_lexer(l);
+
+    // Bad strings are illegal tokens holding the offending text
+    struct {
+        char *input;
+        const char *literal;
+    } illegal[] = {
+        { "\"unterminated", "\"unterminated" },
+        { "\"ends in a backslash\\", "\"ends in a backslas" },
+        { "\"bad \\q escape\"", "\\q" },
+    };
+    for (size_t i = 0; i < sizeof(illegal) / sizeof(illegal[0]); i++) {
+        l = make_lexer(illegal[i].input, NULL);
+        Token tok = lex_next_token(l);
+        assert(tok.type == TOKEN_ILLEGAL);
+        assert(strcmp(tok.literal, illegal[i].literal) == 0);
+        assert(lex_next_token(l).type == TOKEN_EOF);
+        cleanup_lexer(l);
+    }
+}
+
 // TEST_CASE(simple_assignment)
 // {
 //     const char *input = "let x = 5;";
@@ -0,0 +1,351 @@
+#include "marker.h"
+#include "object.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_DEQUE_CAPACITY 256
+#define MAX_STEAL_BATCH 128
+
+static void init_deque(MarkDeque *deque)
+{
+    deque->array = malloc(INITIAL_DEQUE_CAPACITY * sizeof(Object *));
+    deque->bottom = 0;
+    deque->top = 0;
+    deque->capacity = INITIAL_DEQUE_CAPACITY;
+    pthread_mutex_init(&deque->lock, NULL);
+}
+
+static void cleanup_deque(MarkDeque *deque)
+{
+    free(deque->array);
+    pthread_mutex_destroy(&deque->lock);
+}
+
+// Deques are only shared when there is more than one worker
+static inline void lock_deque(MarkerPool *pool, MarkDeque *deque)
+{
+    if (pool->num_workers > 1) {
+        pthread_mutex_lock(&deque->lock);
+    }
+}
+
+static inline void unlock_deque(MarkerPool *pool, MarkDeque *deque)
+{
+    if (pool->num_workers > 1) {
+        pthread_mutex_unlock(&deque->lock);
+    }
+}
+
+static void push_locked(MarkDeque *deque, Object *object)
+{
+    if (deque->top == deque->capacity) {
+        if (deque->bottom > 0) {
+            // Reclaim the space stolen from the bottom before growing
+            memmove(deque->array, &deque->array[deque->bottom], (deque->top - deque->bottom) * sizeof(Object *));
+            deque->top -= deque->bottom;
+            deque->bottom = 0;
+        }
+        if (deque->top == deque->capacity) {
+            deque->capacity *= 2;
+            deque->array = realloc(deque->array, deque->capacity * sizeof(Object *));
+        }
+    }
+    deque->array[deque->top++] = object;
+}
+
+static void push(MarkerPool *pool, MarkDeque *deque, Object *object)
+{
+    lock_deque(pool, deque);
+    push_locked(deque, object);
+    unlock_deque(pool, deque);
+}
+
+static Object *pop(MarkerPool *pool, MarkDeque *deque)
+{
+    Object *object = NULL;
+    lock_deque(pool, deque);
+    if (deque->top > deque->bottom) {
+        object = deque->array[--deque->top];
+        if (deque->top == deque->bottom) {
+            deque->top = deque->bottom = 0;
+        }
+    }
+    unlock_deque(pool, deque);
+    return object;
+}
+
+static bool deque_is_empty(MarkerPool *pool, MarkDeque *deque)
+{
+    lock_deque(pool, deque);
+    bool empty = deque->top == deque->bottom;
+    unlock_deque(pool, deque);
+    return empty;
+}
+
+// Moves up to half of another worker's objects into `own`. The batch is copied out before
+// touching `own` so two workers stealing from each other never hold both locks.
+static bool steal(MarkerPool *pool, int self)
+{
+    Object *batch[MAX_STEAL_BATCH];
+    for (int i = 1; i < pool->num_workers; i++) {
+        MarkDeque *victim = &pool->deques[(self + i) % pool->num_workers];
+
+        pthread_mutex_lock(&victim->lock);
+        size_t available = victim->top - victim->bottom;
+        size_t count = (available + 1) / 2;
+        if (count > MAX_STEAL_BATCH) {
+            count = MAX_STEAL_BATCH;
+        }
+        memcpy(batch, &victim->array[victim->bottom], count * sizeof(Object *));
+        victim->bottom += count;
+        pthread_mutex_unlock(&victim->lock);
+
+        if (count > 0) {
+            MarkDeque *own = &pool->deques[self];
+            pthread_mutex_lock(&own->lock);
+            for (size_t j = 0; j < count; j++) {
+                push_locked(own, batch[j]);
+            }
+            pthread_mutex_unlock(&own->lock);
+            __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static bool any_work_left(MarkerPool *pool)
+{
+    for (int i = 0; i < pool->num_workers; i++) {
+        if (!deque_is_empty(pool, &pool->deques[i])) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+// Returns TRUE if this call set the mark, so exactly one worker traces each object
+static inline bool try_mark(Object *object)
+{
+    return object != NULL && !__atomic_exchange_n(&object->marked, TRUE, __ATOMIC_RELAXED);
+}
+
+static inline void mark_child(MarkerPool *pool, MarkDeque *deque, Object *object)
+{
+    if (try_mark(object)) {
+        push(pool, deque, object);
+    }
+}
+
+static void trace_references(MarkerPool *pool, MarkDeque *deque, Object *object)
+{
+    switch (object->type) {
+    case OBJ_FUNCTION: {
+        // Constants used by the function live in the shared pool, which is a root already.
+        // Call caches only point at functions that are constants too, but are marked for safety.
+        FunctionProto *function = (FunctionProto *)object;
+        for (int i = 0; i < function->num_call_caches; i++) {
+            CallCache *cache = &function->call_caches[i];
+            for (int j = 0; j < cache->num_entries; j++) {
+                mark_child(pool, deque, (Object *)cache->entries[j].function);
+            }
+        }
+        break;
+    }
+    case OBJ_CLOSURE: {
+        Closure *closure = (Closure *)object;
+        mark_child(pool, deque, (Object *)closure->function);
+        // Upvalues are NULL while OP_CLOSURE is still capturing them
+        for (int i = 0; i < closure->num_upvalues; i++) {
+            mark_child(pool, deque, (Object *)closure->upvalues[i]);
+        }
+        break;
+    }
+    case OBJ_UPVALUE: {
+        // Open upvalues point into the stack, which is marked as a root
+        Value closed = ((Upvalue *)object)->closed;
+        if (IS_OBJ(closed)) {
+            mark_child(pool, deque, AS_OBJ(closed));
+        }
+        break;
+    }
+    case OBJ_ARRAY:
+        mark_child(pool, deque, (Object *)((Array *)object)->root);
+        mark_child(pool, deque, ((Array *)object)->tail);
+        break;
+    case OBJ_HASH:
+        mark_child(pool, deque, (Object *)((Hash *)object)->root);
+        break;
+    case OBJ_NODE: {
+        Node *node = (Node *)object;
+        for (uint32_t i = 0; i < node->length; i++) {
+            if (IS_OBJ(node->slots[i])) {
+                mark_child(pool, deque, AS_OBJ(node->slots[i]));
+            }
+        }
+        break;
+    }
+    case OBJ_ROPE:
+        mark_child(pool, deque, ((Rope *)object)->left);
+        mark_child(pool, deque, ((Rope *)object)->right);
+        break;
+    case OBJ_BIGINT:
+    case OBJ_PACKED_NODE:
+    case OBJ_BUILTIN:
+    case OBJ_STRING:
+        break;
+    }
+}
+
+static void mark_worker(MarkerPool *pool, int self)
+{
+    MarkDeque *own = &pool->deques[self];
+
+    for (;;) {
+        Object *object;
+        while ((object = pop(pool, own)) != NULL) {
+            trace_references(pool, own, object);
+        }
+        if (pool->num_workers == 1) {
+            return;
+        }
+        if (steal(pool, self)) {
+            continue;
+        }
+
+        // Only active workers push, and they go idle with an empty deque. Once no worker is
+        // active every deque is empty and marking is done.
+        __atomic_fetch_sub(&pool->active, 1, __ATOMIC_ACQ_REL);
+        for (;;) {
+            if (__atomic_load_n(&pool->active, __ATOMIC_ACQUIRE) == 0) {
+                return;
+            }
+            if (any_work_left(pool)) {
+                __atomic_fetch_add(&pool->active, 1, __ATOMIC_ACQ_REL);
+                if (steal(pool, self)) {
+                    break;
+                }
+                __atomic_fetch_sub(&pool->active, 1, __ATOMIC_ACQ_REL);
+            }
+            sched_yield();
+        }
+    }
+}
+
+typedef struct WorkerArgs {
+    MarkerPool *pool;
+    int id;
+} WorkerArgs;
+
+static void *worker_thread(void *arg)
+{
+    WorkerArgs args = *(WorkerArgs *)arg;
+    free(arg);
+    MarkerPool *pool = args.pool;
+    uint64_t seen_generation = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->generation == seen_generation) {
+            pthread_cond_wait(&pool->start, &pool->lock);
+        }
+        if (pool->shutdown) {
+            break;
+        }
+        seen_generation = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        mark_worker(pool, args.id);
+
+        pthread_mutex_lock(&pool->lock);
+        pool->num_finished++;
+        pthread_cond_signal(&pool->finished);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+MarkerPool *make_marker_pool(int num_workers)
+{
+    MarkerPool *pool = malloc(sizeof(MarkerPool));
+    pool->num_workers = num_workers < 1 ? 1 : num_workers;
+    pool->deques = malloc(pool->num_workers * sizeof(MarkDeque));
+    for (int i = 0; i < pool->num_workers; i++) {
+        init_deque(&pool->deques[i]);
+    }
+    pool->next_root_deque = 0;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    pool->generation = 0;
+    pool->num_finished = 0;
+    pool->shutdown = FALSE;
+    pool->active = 0;
+    pool->steals = 0;
+
+    pool->threads = malloc(pool->num_workers * sizeof(pthread_t));
+    for (int i = 1; i < pool->num_workers; i++) {
+        WorkerArgs *args = malloc(sizeof(WorkerArgs));
+        args->pool = pool;
+        args->id = i;
+        pthread_create(&pool->threads[i], NULL, worker_thread, args);
+    }
+    return pool;
+}
+
+void cleanup_marker_pool(MarkerPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    for (int i = 1; i < pool->num_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+
+    for (int i = 0; i < pool->num_workers; i++) {
+        cleanup_deque(&pool->deques[i]);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+}
+
+// Marks a root and hands it to the workers round-robin, so they all start with some work
+void mark_root(MarkerPool *pool, Object *object)
+{
+    if (try_mark(object)) {
+        push(pool, &pool->deques[pool->next_root_deque], object);
+        pool->next_root_deque = (pool->next_root_deque + 1) % pool->num_workers;
+    }
+}
+
+// Traces everything reachable from the marked roots, returning once all workers are done
+void run_marking(MarkerPool *pool)
+{
+    if (pool->num_workers == 1) {
+        mark_worker(pool, 0);
+        return;
+    }
+
+    __atomic_store_n(&pool->active, pool->num_workers, __ATOMIC_RELEASE);
+    pthread_mutex_lock(&pool->lock);
+    pool->num_finished = 0;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    mark_worker(pool, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->num_finished < pool->num_workers - 1) {
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    pool->next_root_deque = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef MARKER_H
+#define MARKER_H
+
+#include "globals.h"
+#include "object.h"
+#include <pthread.h>
+#include <stddef.h>
+
+// Objects a mark worker still has to trace. The owner pushes and pops at the top, other workers
+// steal from the bottom.
+typedef struct MarkDeque {
+    Object **array;
+    size_t bottom;
+    size_t top;
+    size_t capacity;
+    pthread_mutex_t lock;
+} MarkDeque;
+
+// Marks the old space with a fixed set of workers. The collecting thread is worker 0 and the
+// others are threads kept parked between collections. Workers that run out of objects steal half
+// of another worker's deque, marking ends once every worker is idle with nothing left to steal.
+typedef struct MarkerPool {
+    int num_workers;
+    MarkDeque *deques;
+    size_t next_root_deque;
+
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    uint64_t generation; // Bumped to start a round of marking
+    int num_finished;
+    bool shutdown;
+
+    int active; // Workers that may still produce work, updated atomically
+    size_t steals; // Successful steals over the pool's lifetime, updated atomically
+} MarkerPool;
+
+extern MarkerPool *make_marker_pool(int num_workers);
+extern void cleanup_marker_pool(MarkerPool *pool);
+extern void mark_root(MarkerPool *pool, Object *object);
+extern void run_marking(MarkerPool *pool);
+
+#endif // MARKER_H
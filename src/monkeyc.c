@@ -0,0 +1,62 @@
+#include "optimizer.h"
+#include "parser.h"
+#include "str_utils.h"
+#include "transpiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Ahead-of-time compiler driver: translates a Monkey source file to C.
+//
+//     bin/monkeyc program.monkey > program.c
+//     gcc -O2 -I src program.c -o program
+
+static void print_errors(const char *stage, ErrorArrayList *errors)
+{
+    for (size_t i = 0; i < errors->size; i++) {
+        fprintf(stderr, "%s error: %s\n", stage, get_error_from_arraylist(errors, i));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 || (argc == 2 && strcmp(argv[1], "-h") == 0)) {
+        fprintf(stderr, "Usage: %s [file]\nReads standard input when no file is given and writes C to standard output.\n", argv[0]);
+        return 2;
+    }
+
+    FILE *file = argc == 2 ? fopen(argv[1], "r") : stdin;
+    if (file == NULL) {
+        perror(argv[1]);
+        return 1;
+    }
+    char *input = read_stream(file);
+    if (file != stdin) {
+        fclose(file);
+    }
+
+    int status = 0;
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    if (parser->errors->size != 0) {
+        print_errors("Parser", parser->errors);
+        status = 1;
+    } else {
+        optimize_program(program);
+        Transpiler *transpiler = make_transpiler();
+        char *source = transpile_program(transpiler, program);
+        if (source == NULL) {
+            print_errors("Compiler", transpiler->errors);
+            status = 1;
+        } else {
+            fputs(source, stdout);
+            free(source);
+        }
+        cleanup_transpiler(transpiler);
+    }
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(input);
+    return status;
+}
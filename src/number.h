@@ -0,0 +1,36 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Floats are IEEE doubles stored unboxed in a Value, like small integers. Literals are converted
+// here rather than with strtod, which depends on the locale and is slower: the first 19
+// significant digits are scaled by a 128-bit power of ten (the Eisel-Lemire algorithm), which
+// settles all but a handful of inputs. Those, with too many digits to decide from 19 or too close
+// to halfway between two doubles, are redone in exact decimal arithmetic. Either way the result is
+// the correctly rounded double.
+
+// Large enough for any double format_double writes
+#define MAX_DOUBLE_LENGTH 32
+
+// Returned by compare_numbers when either operand is NaN
+#define NUMBERS_UNORDERED 2
+
+// Converts a literal of decimal digits with an optional fraction and exponent, as in 12, 1.5 or
+// 25e-1, without a sign. Returns FALSE if it is too large to be finite.
+extern bool parse_double(const char *start, size_t length, double *result);
+// Shortest text that reads back as the same double, always with a decimal point or an exponent
+// so it cannot be mistaken for an integer: 0.1, 2.0, 1e+100, -inf or nan.
+extern void format_double(double value, char *buffer, size_t size);
+
+// `value` must be an integer, small or big, or a float. Bignums beyond the range of a double become
+// infinite.
+extern double number_to_double(Value value);
+// Orders two integers or floats like strcmp, -1, 0 or 1, or NUMBERS_UNORDERED. Integers and floats
+// compare exactly, though a bignum compares as the nearest double.
+extern int compare_numbers(Value left, Value right);
+
+#endif // NUMBER_H
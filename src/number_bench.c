@@ -0,0 +1,120 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "number.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Converting float literals against strtod, on the shortest text of random doubles, on short
+// decimals like prices, and on long literals that need more than 19 digits. Then an interpreted
+// loop summing floats, which allocates nothing since floats are unboxed.
+
+#define LITERALS 1000000
+#define VM_ITERATIONS 1000000
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void bench_literals(const char *label, char **literals, size_t *lengths)
+{
+    double sum = 0, expected = 0, parsed;
+    uint64_t start = now_ns();
+    for (size_t i = 0; i < LITERALS; i++) {
+        parse_double(literals[i], lengths[i], &parsed);
+        sum += parsed;
+    }
+    uint64_t ours = now_ns() - start;
+    start = now_ns();
+    for (size_t i = 0; i < LITERALS; i++) {
+        expected += strtod(literals[i], NULL);
+    }
+    uint64_t reference = now_ns() - start;
+    assert(sum == expected);
+    (void)expected;
+    printf("%-8s %10d %12.1f %12.1f\n", label, LITERALS, (double)ours / LITERALS, (double)reference / LITERALS);
+}
+
+static void bench_program(const char *label, const char *format)
+{
+    char input[512];
+    snprintf(input, sizeof(input), format, VM_ITERATIONS);
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = FALSE;
+
+    uint64_t start = now_ns();
+    VMResult result = run_vm(vm, main);
+    uint64_t elapsed = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+
+    GCStats stats = get_gc_stats(heap);
+    printf("%-8s %10d %10.1f %10.1f %8zu\n", label, VM_ITERATIONS, elapsed / 1e6, (double)elapsed / VM_ITERATIONS,
+        stats.minor_collections);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+int main(void)
+{
+    char **literals = malloc(LITERALS * sizeof(char *));
+    size_t *lengths = malloc(LITERALS * sizeof(size_t));
+    char buffer[64];
+    uint64_t state = 88172645463325252u;
+
+    printf("%-8s %10s %12s %12s\n", "literals", "count", "parse ns", "strtod ns");
+    for (size_t i = 0; i < LITERALS; i++) {
+        uint64_t bits = next_random(&state) % 0x7fe0000000000000u;
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        format_double(value, buffer, sizeof(buffer));
+        literals[i] = strdup(buffer);
+        lengths[i] = strlen(buffer);
+    }
+    bench_literals("random", literals, lengths);
+    for (size_t i = 0; i < LITERALS; i++) {
+        free(literals[i]);
+        snprintf(buffer, sizeof(buffer), "%d.%02d", (int)(next_random(&state) % 10000), (int)(next_random(&state) % 100));
+        literals[i] = strdup(buffer);
+        lengths[i] = strlen(buffer);
+    }
+    bench_literals("short", literals, lengths);
+    for (size_t i = 0; i < LITERALS; i++) {
+        free(literals[i]);
+        int length = snprintf(buffer, sizeof(buffer), "%016llu", (unsigned long long)next_random(&state));
+        length += snprintf(buffer + length, sizeof(buffer) - length, ".%016llue%d", (unsigned long long)next_random(&state),
+            (int)(next_random(&state) % 600) - 300);
+        literals[i] = strdup(buffer);
+        lengths[i] = (size_t)length;
+    }
+    bench_literals("long", literals, lengths);
+    for (size_t i = 0; i < LITERALS; i++) {
+        free(literals[i]);
+    }
+    free(literals);
+    free(lengths);
+
+    printf("\n%-8s %10s %10s %10s %8s\n", "loop", "iterations", "total ms", "ns/iter", "minor");
+    bench_program("int", "let sum = 0; let i = 0; while (i < %d) { let sum = sum + 3; let i = i + 1; } sum");
+    bench_program("float", "let sum = 0.0; let i = 0; while (i < %d) { let sum = sum + 0.5; let i = i + 1; } sum");
+    return 0;
+}
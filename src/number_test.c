@@ -0,0 +1,197 @@
+#include "number.h"
+#include "bigint.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static uint64_t bits_of(double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+static uint64_t next_random(uint64_t *state)
+{
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+// strtod is correctly rounded in glibc, so it serves as the reference
+static void assert_parses_like_strtod(const char *literal)
+{
+    double expected = strtod(literal, NULL);
+    double parsed;
+    bool finite = parse_double(literal, strlen(literal), &parsed);
+    if (isinf(expected) ? finite : !finite || bits_of(parsed) != bits_of(expected)) {
+        printf("Input: %s\nExpected: %a\nGot: %a\n", literal, expected, parsed);
+        assert(1 != 1);
+    }
+}
+
+TEST_CASE(parses_literals)
+{
+    const char *literals[] = {
+        "0", "0.0", "000.000", "1", "1.5", "0.1", "0.3", "3.141592653589793", "2.718281828459045235360287",
+        "1e0", "1e1", "1E+1", "25e-1", "123456789012345678901234567890", "0.000000000000000000000000000001",
+        "9007199254740993", // 2^53 + 1, halfway between two doubles
+        "9007199254740993.0000000000000000000001", // Just above halfway
+        "1.7976931348623157e308", // Largest double
+        "1.7976931348623158e308", // Still rounds down to it
+        "2.2250738585072014e-308", // Smallest normal
+        "2.2250738585072011e-308", // Largest subnormal
+        "4.9406564584124654e-324", // Smallest subnormal
+        "2.4703282292062327e-324", // Below half of it, zero
+        "2.4703282292062328e-324", // Above half of it
+        "1e-400", "0.1e-330", "7.2057594037927933e16", "8.98846567431158e307", "1e23", "8.589973e9",
+        // Exactly halfway with hundreds of digits, only the last one breaking the tie
+        "1.00000000000000011102230246251565404236316680908203125",
+        "1.00000000000000011102230246251565404236316680908203124",
+        "1.00000000000000011102230246251565404236316680908203126",
+        "2.47032822920623272088284396434110686182529901307162382212792841250337753635104375932649918180817"
+        "99694371694244484765384838542853745427856155049478002962453226166524938006016224126396211578891"
+        "10000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000"
+        "00000000000000000000000000000000000000000000000000000000000000000000000000000000000000000000001e-324",
+    };
+    for (size_t i = 0; i < sizeof(literals) / sizeof(literals[0]); i++) {
+        assert_parses_like_strtod(literals[i]);
+    }
+
+    // Too large to be finite
+    double parsed;
+    assert(!parse_double("1e309", 5, &parsed));
+    assert(!parse_double("1.7976931348623159e308", 22, &parsed));
+    assert(!parse_double("1e99999999999", 13, &parsed));
+    // Only the given length is read
+    assert(parse_double("1.5e3", 3, &parsed) && parsed == 1.5);
+}
+
+// Random doubles printed with 17 digits must come back bit for bit, and random digit strings of
+// every length and exponent must round like strtod
+TEST_CASE(matches_strtod)
+{
+    uint64_t state = 88172645463325252u;
+    char literal[64];
+    for (int i = 0; i < 200000; i++) {
+        uint64_t bits = next_random(&state) & ~((uint64_t)1 << 63);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value) || isinf(value)) {
+            continue;
+        }
+        snprintf(literal, sizeof(literal), "%.17g", value);
+        assert_parses_like_strtod(literal);
+        snprintf(literal, sizeof(literal), "%.*e", (int)(next_random(&state) % 25), value);
+        assert_parses_like_strtod(literal);
+    }
+    for (int i = 0; i < 200000; i++) {
+        int digits = 1 + (int)(next_random(&state) % 30);
+        int point = (int)(next_random(&state) % (digits + 1));
+        int length = 0;
+        for (int d = 0; d < digits; d++) {
+            if (d == point && d > 0) {
+                literal[length++] = '.';
+            }
+            literal[length++] = (char)('0' + next_random(&state) % 10);
+        }
+        snprintf(literal + length, sizeof(literal) - length, "e%d", (int)(next_random(&state) % 700) - 350);
+        assert_parses_like_strtod(literal);
+    }
+}
+
+TEST_CASE(formats_shortest)
+{
+    struct {
+        double value;
+        const char *expected;
+    } tests[] = {
+        { 0.0, "0.0" }, { -0.0, "-0.0" }, { 1.0, "1.0" }, { -2.5, "-2.5" }, { 0.1, "0.1" },
+        { 0.1 + 0.2, "0.30000000000000004" }, { 1e100, "1e+100" }, { 123456789012.0, "123456789012.0" },
+        { 1e-7, "1e-07" }, { 1.0 / 3.0, "0.3333333333333333" }, { INFINITY, "inf" }, { -INFINITY, "-inf" },
+        { NAN, "nan" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char buffer[MAX_DOUBLE_LENGTH];
+        format_double(tests[i].value, buffer, sizeof(buffer));
+        if (strcmp(buffer, tests[i].expected) != 0) {
+            printf("Expected: %s\nGot: %s\n", tests[i].expected, buffer);
+            assert(1 != 1);
+        }
+    }
+
+    // Whatever is printed reads back as the same double
+    uint64_t state = 2463534242u;
+    for (int i = 0; i < 100000; i++) {
+        uint64_t bits = next_random(&state);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        if (isnan(value) || isinf(value)) {
+            continue;
+        }
+        char buffer[MAX_DOUBLE_LENGTH];
+        format_double(value, buffer, sizeof(buffer));
+        assert(bits_of(strtod(buffer, NULL)) == bits);
+    }
+}
+
+static void *allocate_test_object(void *user, size_t size)
+{
+    (void)user;
+    return calloc(1, size);
+}
+
+TEST_CASE(compares_across_types)
+{
+    Allocator allocator = { .alloc = allocate_test_object };
+    Value two_to_64 = bigint_from_str("18446744073709551616", &allocator);
+    struct {
+        Value left;
+        Value right;
+        int expected;
+    } tests[] = {
+        { INT_VAL(1), FLOAT_VAL(1.0), 0 },
+        { INT_VAL(1), FLOAT_VAL(1.5), -1 },
+        { FLOAT_VAL(-0.5), INT_VAL(0), -1 },
+        { FLOAT_VAL(-0.0), INT_VAL(0), 0 },
+        // Converting 2^53 + 1 to a double would make these equal
+        { INT_VAL(9007199254740993), FLOAT_VAL(9007199254740992.0), 1 },
+        { INT_VAL(INT64_MAX), FLOAT_VAL(9223372036854775808.0), -1 },
+        { INT_VAL(INT64_MIN), FLOAT_VAL(-9223372036854775808.0), 0 },
+        { two_to_64, FLOAT_VAL(18446744073709551616.0), 0 },
+        { two_to_64, FLOAT_VAL(1e300), -1 },
+        { FLOAT_VAL(NAN), INT_VAL(1), NUMBERS_UNORDERED },
+        { FLOAT_VAL(NAN), FLOAT_VAL(NAN), NUMBERS_UNORDERED },
+        { INT_VAL(2), INT_VAL(3), -1 },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int comparison = compare_numbers(tests[i].left, tests[i].right);
+        if (comparison != tests[i].expected) {
+            printf("Test %zu\nExpected: %d\nGot: %d\n", i, tests[i].expected, comparison);
+            assert(1 != 1);
+        }
+    }
+    free(AS_OBJ(two_to_64));
+
+    // Bignums convert with a single rounding: 2^64 + 2^11 + 1 is just above halfway between
+    // two doubles, 2^64 + 2^11 is exactly halfway and rounds to even
+    Value above = bigint_from_str("18446744073709553665", &allocator);
+    Value halfway = bigint_from_str("18446744073709553664", &allocator);
+    assert(bigint_to_double(above) == 18446744073709555712.0);
+    assert(bigint_to_double(halfway) == 18446744073709551616.0);
+    free(AS_OBJ(above));
+    free(AS_OBJ(halfway));
+}
+
+RUN_TESTS()
@@ -0,0 +1,338 @@
+#include "object.h"
+#include "arrlist_utils.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "jit.h"
+#include "marker.h"
+#include "number.h"
+#include "persistent.h"
+#include "pool.h"
+#include "string_object.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define INITIAL_VALUE_ARRAYLIST_CAPACITY 16
+#define DEFAULT_GC_GROWTH_FACTOR 2.0
+
+Heap *make_heap(void)
+{
+    Heap *heap = malloc(sizeof(Heap));
+    heap->objects = NULL;
+    heap->unswept = NULL;
+    heap->bytes_allocated = 0;
+    heap->next_gc = GC_MIN_THRESHOLD;
+    heap->growth_factor = DEFAULT_GC_GROWTH_FACTOR;
+    heap->stress = FALSE;
+    heap->gc_threads = 1;
+    heap->markers = NULL;
+    heap->snapshot_start = NULL;
+    heap->snapshot_end = NULL;
+    heap->nursery = malloc(NURSERY_SIZE);
+    heap->nursery_top = heap->nursery;
+    heap->nursery_end = heap->nursery + NURSERY_SIZE;
+    heap->remembered = NULL;
+    heap->remembered_count = 0;
+    heap->remembered_capacity = 0;
+    heap->gray_stack = NULL;
+    heap->gray_count = 0;
+    heap->gray_capacity = 0;
+    heap->stats = (GCStats) { 0 };
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    heap->stats.start_ns = (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+    return heap;
+}
+
+size_t object_size(Object *object)
+{
+    switch (object->type) {
+    case OBJ_FUNCTION:
+        return sizeof(FunctionProto);
+    case OBJ_CLOSURE:
+        return sizeof(Closure) + ((Closure *)object)->num_upvalues * sizeof(Upvalue *);
+    case OBJ_UPVALUE:
+        return sizeof(Upvalue);
+    case OBJ_BIGINT:
+        return sizeof(BigInt) + ((BigInt *)object)->num_limbs * sizeof(uint64_t);
+    case OBJ_ARRAY:
+        return sizeof(Array);
+    case OBJ_HASH:
+        return sizeof(Hash);
+    case OBJ_NODE:
+        return sizeof(Node) + ((Node *)object)->length * sizeof(Value);
+    case OBJ_PACKED_NODE:
+        return sizeof(PackedNode) + ((PackedNode *)object)->length * sizeof(int64_t);
+    case OBJ_BUILTIN:
+        return sizeof(Builtin);
+    case OBJ_STRING:
+        return STRING_SIZE(((StringObject *)object)->length);
+    case OBJ_ROPE:
+        return sizeof(Rope);
+    }
+    assert(1 != 1);
+    return 0;
+}
+
+// Releases a single old object, which must already be unlinked from the heap's object list
+void free_object(Heap *heap, Object *object)
+{
+    size_t size = object_size(object);
+    heap->bytes_allocated -= size;
+    switch (object->type) {
+    case OBJ_FUNCTION:
+        cleanup_instructions(((FunctionProto *)object)->instructions);
+        free(((FunctionProto *)object)->call_caches);
+        free(((FunctionProto *)object)->index_caches);
+        free(((FunctionProto *)object)->lazy);
+        jit_release((FunctionProto *)object);
+        break;
+    case OBJ_CLOSURE:
+    case OBJ_UPVALUE:
+    case OBJ_BIGINT:
+    case OBJ_ARRAY:
+    case OBJ_HASH:
+    case OBJ_NODE:
+    case OBJ_PACKED_NODE:
+    case OBJ_BUILTIN:
+    case OBJ_STRING:
+    case OBJ_ROPE:
+        break;
+    }
+    // The snapshot's mapping is released as a whole once the heap is gone
+    if ((uint8_t *)object >= heap->snapshot_start && (uint8_t *)object < heap->snapshot_end) {
+        return;
+    }
+    pool_free(object, size);
+}
+
+static void free_object_list(Heap *heap, Object *object)
+{
+    while (object != NULL) {
+        Object *next = object->next;
+        free_object(heap, object);
+        object = next;
+    }
+}
+
+void cleanup_heap(Heap *heap)
+{
+    if (heap->markers != NULL) {
+        cleanup_marker_pool(heap->markers);
+    }
+    free_object_list(heap, heap->objects);
+    free_object_list(heap, heap->unswept);
+    free(heap->nursery);
+    free(heap->remembered);
+    free(heap->gray_stack);
+    free(heap);
+}
+
+Object *allocate_object(Heap *heap, size_t size, ObjectType type)
+{
+    Object *object = pool_calloc(size);
+    object->type = type;
+    object->next = heap->objects;
+    heap->objects = object;
+    heap->bytes_allocated += size;
+    heap->stats.bytes_allocated_total += size;
+    return object;
+}
+
+// Bump allocates in the nursery. The VM makes room at safe points before allocating, anything
+// that still does not fit is allocated in the old space instead.
+Object *allocate_young_object(Heap *heap, size_t size, ObjectType type)
+{
+    size_t aligned_size = (size + OBJECT_ALIGNMENT - 1) & ~(size_t)(OBJECT_ALIGNMENT - 1);
+    if ((size_t)(heap->nursery_end - heap->nursery_top) < aligned_size) {
+        return allocate_object(heap, size, type);
+    }
+
+    Object *object = (Object *)heap->nursery_top;
+    heap->nursery_top += aligned_size;
+    memset(object, 0, size);
+    object->type = type;
+    heap->stats.bytes_allocated_total += size;
+    return object;
+}
+
+FunctionProto *make_function_proto(Heap *heap, const char *name)
+{
+    FunctionProto *function = (FunctionProto *)allocate_object(heap, sizeof(FunctionProto), OBJ_FUNCTION);
+    function->instructions = make_instructions();
+    if (name != NULL) {
+        strncpy(function->name, name, MAX_IDENTIFIER_SIZE);
+    }
+    return function;
+}
+
+Closure *make_closure(Heap *heap, FunctionProto *function)
+{
+    size_t size = sizeof(Closure) + function->num_upvalues * sizeof(Upvalue *);
+    Closure *closure = (Closure *)allocate_young_object(heap, size, OBJ_CLOSURE);
+    closure->function = function;
+    closure->num_upvalues = function->num_upvalues;
+    return closure;
+}
+
+Upvalue *make_upvalue(Heap *heap, Value *slot)
+{
+    Upvalue *upvalue = (Upvalue *)allocate_young_object(heap, sizeof(Upvalue), OBJ_UPVALUE);
+    upvalue->location = slot;
+    upvalue->closed = NULL_VAL;
+    upvalue->next_open = NULL;
+    return upvalue;
+}
+
+ValueArrayList *make_value_arraylist(void)
+{
+    ValueArrayList *list = malloc(sizeof(ValueArrayList));
+    list->array = calloc(INITIAL_VALUE_ARRAYLIST_CAPACITY, sizeof(Value));
+    list->size = 0;
+    list->capacity = INITIAL_VALUE_ARRAYLIST_CAPACITY;
+    return list;
+}
+
+// Returns the index the value was stored at
+size_t add_value_to_arraylist(ValueArrayList *list, Value value)
+{
+    if (list->size == list->capacity) {
+        list->array = (Value *)realloc_backing_array(&libc_allocator, list->array, list->size, list->capacity, list->capacity * 2, sizeof(Value));
+        list->capacity *= 2;
+    }
+    list->array[list->size] = value;
+    return list->size++;
+}
+
+void cleanup_value_arraylist(ValueArrayList *list)
+{
+    free(list->array);
+    free(list);
+}
+
+bool is_truthy(Value value)
+{
+    switch (value.type) {
+    case VAL_NULL:
+        return FALSE;
+    case VAL_BOOL:
+        return AS_BOOL(value);
+    default:
+        return TRUE;
+    }
+}
+
+bool values_equal(Value a, Value b)
+{
+    if (a.type != b.type) {
+        // 1 == 1.0, though a bignum never equals a small integer
+        return (IS_FLOAT(a) || IS_FLOAT(b)) && IS_NUMBER(a) && IS_NUMBER(b) && compare_numbers(a, b) == 0;
+    }
+    switch (a.type) {
+    case VAL_NULL:
+        return TRUE;
+    case VAL_BOOL:
+        return AS_BOOL(a) == AS_BOOL(b);
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
+    case VAL_FLOAT:
+        return AS_FLOAT(a) == AS_FLOAT(b);
+    case VAL_OBJ:
+        // Bignums are canonical, so an equal one is never a small integer
+        if (IS_BIGINT(a) && IS_BIGINT(b)) {
+            return bigint_equal(AS_BIGINT(a), AS_BIGINT(b));
+        }
+        if (IS_STRING(a) && IS_STRING(b)) {
+            return strings_equal(a, b);
+        }
+        return AS_OBJ(a) == AS_OBJ(b);
+    }
+    return FALSE;
+}
+
+const char *value_type_to_str(Value value)
+{
+    switch (value.type) {
+    case VAL_NULL:
+        return "NULL";
+    case VAL_BOOL:
+        return "BOOLEAN";
+    case VAL_INT:
+        return "INTEGER";
+    case VAL_FLOAT:
+        return "FLOAT";
+    case VAL_OBJ:
+        switch (AS_OBJ(value)->type) {
+        case OBJ_FUNCTION:
+        case OBJ_CLOSURE:
+            return "FUNCTION";
+        case OBJ_UPVALUE:
+            return "UPVALUE";
+        case OBJ_BIGINT:
+            return "INTEGER";
+        case OBJ_ARRAY:
+            return "ARRAY";
+        case OBJ_HASH:
+            return "HASH";
+        case OBJ_NODE:
+        case OBJ_PACKED_NODE:
+            return "NODE";
+        case OBJ_BUILTIN:
+            return "BUILTIN";
+        case OBJ_STRING:
+        case OBJ_ROPE:
+            return "STRING";
+        }
+    }
+    return "UNKNOWN";
+}
+
+char *inspect_value(Value value)
+{
+    char buffer[64];
+
+    switch (value.type) {
+    case VAL_NULL:
+        return strdup("null");
+    case VAL_BOOL:
+        return strdup(AS_BOOL(value) ? "true" : "false");
+    case VAL_INT:
+        snprintf(buffer, sizeof(buffer), "%" PRId64, AS_INT(value));
+        return strdup(buffer);
+    case VAL_FLOAT:
+        format_double(AS_FLOAT(value), buffer, sizeof(buffer));
+        return strdup(buffer);
+    case VAL_OBJ:
+        switch (AS_OBJ(value)->type) {
+        case OBJ_FUNCTION:
+            snprintf(buffer, sizeof(buffer), "fn %s[%p]", AS_FUNCTION(value)->name, (void *)AS_OBJ(value));
+            return strdup(buffer);
+        case OBJ_CLOSURE:
+            snprintf(buffer, sizeof(buffer), "fn %s[%p]", AS_CLOSURE(value)->function->name, (void *)AS_OBJ(value));
+            return strdup(buffer);
+        case OBJ_UPVALUE:
+            return strdup("upvalue");
+        case OBJ_BIGINT:
+            return bigint_to_str(value);
+        case OBJ_ARRAY:
+        case OBJ_HASH:
+            return collection_to_str(value, inspect_value);
+        case OBJ_NODE:
+        case OBJ_PACKED_NODE:
+            return strdup("node");
+        case OBJ_BUILTIN:
+            snprintf(buffer, sizeof(buffer), "builtin %s", AS_BUILTIN(value)->name);
+            return strdup(buffer);
+        case OBJ_STRING:
+        case OBJ_ROPE:
+            return string_to_str(value);
+        }
+    }
+    assert(1 != 1);
+    return NULL;
+}
@@ -0,0 +1,338 @@
+#ifndef OBJECT_H
+#define OBJECT_H
+
+#include "ast.h"
+#include "code.h"
+#include "globals.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum ValueType {
+    VAL_NULL,
+    VAL_BOOL,
+    VAL_INT,
+    VAL_FLOAT,
+    VAL_OBJ
+} ValueType;
+
+// Integers, floats, booleans and null are stored inline, everything else lives on the heap
+// `tag` widens the type to a full word so constructors write no padding. Compilers then keep a
+// Value in two registers instead of masking the type out of a mixed word.
+typedef struct Value {
+    union {
+        ValueType type;
+        uint64_t tag;
+    };
+    union {
+        bool boolean;
+        int64_t integer;
+        double number;
+        struct Object *obj;
+    } as;
+} Value;
+
+typedef enum ObjectType {
+    OBJ_FUNCTION,
+    OBJ_CLOSURE,
+    OBJ_UPVALUE,
+    OBJ_BIGINT,
+    OBJ_ARRAY,
+    OBJ_HASH,
+    OBJ_NODE,
+    OBJ_PACKED_NODE,
+    OBJ_BUILTIN,
+    OBJ_STRING,
+    OBJ_ROPE
+} ObjectType;
+
+// Old objects are linked through `next` so they can be swept. Young objects are not linked,
+// during a minor collection `next` holds the forwarding address of an object that was already
+// promoted, and `marked` says so.
+typedef struct Object {
+    ObjectType type;
+    bool marked;
+    bool remembered; // Old object that may point into the nursery
+    struct Object *next;
+} Object;
+
+typedef struct ValueArrayList {
+    Value *array;
+    size_t size;
+    size_t capacity;
+} ValueArrayList;
+
+#define CALL_CACHE_SIZE 4
+
+typedef enum CallCacheState {
+    CACHE_UNINITIALIZED,
+    CACHE_MONOMORPHIC,
+    CACHE_POLYMORPHIC,
+    CACHE_MEGAMORPHIC // Too many different targets were seen, the site is no longer cached
+} CallCacheState;
+
+// Remembers which functions a call site has already been checked against, so repeat calls
+// skip the callee type and arity checks and the frame size computation
+typedef struct CallCacheEntry {
+    struct FunctionProto *function;
+    int frame_size; // Locals plus the deepest operand stack
+} CallCacheEntry;
+
+typedef struct CallCache {
+    CallCacheState state;
+    int num_entries;
+    CallCacheEntry entries[CALL_CACHE_SIZE];
+} CallCache;
+
+#define INDEX_CACHE_SIZE 4
+
+// Remembers what an index site read from hashes by string key. Literal keys are interned, so a
+// site sees the same string object every time and compares keys by identity. Hashes are immutable,
+// so an entry holds until a collection may free or move its hash; entries are not traced and are
+// dropped once the heap has collected since they were added.
+typedef struct IndexCacheEntry {
+    struct Hash *hash;
+    Object *key;
+    Value value;
+} IndexCacheEntry;
+
+typedef struct IndexCache {
+    CallCacheState state;
+    int num_entries;
+    size_t collections; // The heap's count of collections when the entries were added
+    IndexCacheEntry entries[INDEX_CACHE_SIZE];
+} IndexCache;
+
+typedef struct FunctionProto {
+    Object obj;
+    Instructions *instructions;
+    CallCache *call_caches; // One per OP_CALL in the function, indexed by the instruction's second operand
+    int num_call_caches;
+    IndexCache *index_caches; // One per OP_INDEX in the function, indexed by the instruction's operand
+    int num_index_caches;
+    int num_parameters;
+    int num_locals; // Includes the parameters, which occupy the first slots of the frame
+    int num_upvalues;
+    int max_stack; // Deepest the operand stack gets above the frame's locals
+    size_t num_globals; // Only meaningful for a program's top-level function
+    char name[MAX_IDENTIFIER_SIZE + 1];
+    // Set while a function skipped by a lazy parser has no bytecode yet, see compile_lazy_function
+    struct LazyFunction *lazy;
+
+    // Native code, see jit.h
+    uint32_t call_count;
+    uint32_t jit_deopts;
+    uint8_t jit_state;
+    uint8_t jit_return_type; // ValueType of everything the native code returns
+    bool jit_assumed; // Was called as if returning an integer while being compiled
+    void *jit_entry; // NULL unless the native code may be entered, native callers load it on every call
+    void *jit_memory;
+    size_t jit_memory_size;
+} FunctionProto;
+
+// Upvalues point into the VM stack while the frame owning the variable is live ("open")
+// and take a copy of the value when that frame returns ("closed").
+typedef struct Upvalue {
+    Object obj;
+    Value *location;
+    Value closed;
+    struct Upvalue *next_open;
+} Upvalue;
+
+typedef struct Closure {
+    Object obj;
+    FunctionProto *function;
+    int num_upvalues;
+    Upvalue *upvalues[];
+} Closure;
+
+// Integer too large for an int64_t, see bigint.h. The magnitude is stored least significant
+// limb first without leading zero limbs.
+typedef struct BigInt {
+    Object obj;
+    bool negative;
+    uint32_t num_limbs;
+    uint64_t limbs[];
+} BigInt;
+
+// Trie node shared by arrays and hashes, see persistent.h. Every slot holds a value, child nodes
+// included, so the collector traces all of them without knowing which collection a node is in.
+typedef struct Node {
+    Object obj;
+    uint32_t length; // Number of slots
+    uint32_t datamap; // Hash nodes only: which of the 32 branches hold a key-value pair
+    uint32_t nodemap; // Hash nodes only: which branches hold a child node
+    Value slots[];
+} Node;
+
+// Leaf of an array whose elements are all small integers, stored unboxed so that builtins can run
+// over them with vector instructions. Holds no references.
+typedef struct PackedNode {
+    Object obj;
+    uint32_t length;
+    int64_t elements[];
+} PackedNode;
+
+// Persistent vector: a trie of 32-way nodes plus a tail of up to 32 elements that pushes fill
+// before it is moved into the trie. The leaves and the tail are Nodes, or PackedNodes in a packed
+// array, whose interior nodes are still Nodes.
+//
+// An array is a view of `count` elements of its trie starting at `offset`, so slicing shares the
+// trie rather than copying it. Views reaching the end of the trie are pushed onto in place, others
+// are copied first.
+typedef struct Array {
+    Object obj;
+    size_t count;
+    size_t offset;
+    size_t size; // Elements in the trie and the tail, including those outside the view
+    uint32_t shift; // Bits of the index consumed above the leaves
+    bool packed; // Every element is a small integer. Empty arrays start out packed.
+    Node *root; // NULL until the tail first overflows
+    Object *tail; // NULL while the trie is empty
+} Array;
+
+// Hash array mapped trie
+typedef struct Hash {
+    Object obj;
+    size_t count;
+    Node *root; // NULL while the hash is empty
+} Hash;
+
+// Immutable string, see string_object.h. `chars` holds `length` bytes and a terminating NUL.
+typedef struct StringObject {
+    Object obj;
+    uint32_t length;
+    uint32_t hash; // 0 until first needed
+    char chars[];
+} StringObject;
+
+// String built by concatenation, see string_object.h. Once flattened `right` is NULL and `left`
+// is the flat StringObject holding the same contents.
+typedef struct Rope {
+    Object obj;
+    uint32_t length;
+    uint32_t hash; // 0 until first needed
+    Object *left;
+    Object *right;
+} Rope;
+
+#define GC_MIN_THRESHOLD (1024 * 1024)
+#define NURSERY_SIZE (256 * 1024)
+#define OBJECT_ALIGNMENT 16
+#define GC_PAUSE_SAMPLES 1024
+
+typedef struct GCStats {
+    size_t minor_collections;
+    size_t major_collections;
+    size_t objects_freed; // Old objects released by major collections
+    size_t bytes_freed;
+    size_t objects_promoted;
+    size_t bytes_promoted;
+    size_t bytes_allocated_total;
+    uint64_t total_pause_ns;
+    uint64_t max_pause_ns;
+    uint64_t last_pause_ns;
+    uint64_t pause_samples[GC_PAUSE_SAMPLES]; // Most recent pauses of either kind, as a ring buffer
+    size_t num_pauses;
+    uint64_t start_ns;
+} GCStats;
+
+// Two generations: short-lived objects are bump allocated in the nursery and the survivors of a
+// minor collection are copied out to the old space, a malloc'd list collected by mark-sweep.
+// Function prototypes own their bytecode and are allocated straight into the old space.
+typedef struct Heap {
+    Object *objects; // The old space
+    Object *unswept; // Old objects from before the last major collection that lazy sweeping has not reached
+    size_t bytes_allocated; // Bytes held by the old space
+    size_t next_gc; // A major collection runs at the next safe point once bytes_allocated passes this
+    size_t collections; // Minor and major, any of which may move or free objects
+    double growth_factor; // Once a major collection is swept next_gc is set to the surviving bytes times this
+    bool stress; // Collect at every safe point, for shaking out missing roots in tests
+    int gc_threads; // Threads marking in a major collection, including the collecting one
+    struct MarkerPool *markers; // Started on the first major collection, restarted if gc_threads changes
+    // Old objects loaded from a snapshot (see snapshot.h) lie between these, in its mapping rather
+    // than the pool
+    uint8_t *snapshot_start;
+    uint8_t *snapshot_end;
+
+    uint8_t *nursery;
+    uint8_t *nursery_top; // Next free byte
+    uint8_t *nursery_end;
+
+    // Old objects written to since the last minor collection that may hold young pointers
+    Object **remembered;
+    size_t remembered_count;
+    size_t remembered_capacity;
+
+    // Promoted objects whose references have not been forwarded yet
+    Object **gray_stack;
+    size_t gray_count;
+    size_t gray_capacity;
+
+    GCStats stats;
+} Heap;
+
+#define NULL_VAL ((Value) { .tag = VAL_NULL })
+#define BOOL_VAL(b) ((Value) { .tag = VAL_BOOL, .as.boolean = (b) })
+#define INT_VAL(i) ((Value) { .tag = VAL_INT, .as.integer = (i) })
+#define FLOAT_VAL(d) ((Value) { .tag = VAL_FLOAT, .as.number = (d) })
+#define OBJ_VAL(o) ((Value) { .tag = VAL_OBJ, .as.obj = (Object *)(o) })
+
+#define IS_NULL(v) ((v).type == VAL_NULL)
+#define IS_BOOL(v) ((v).type == VAL_BOOL)
+#define IS_INT(v) ((v).type == VAL_INT)
+#define IS_FLOAT(v) ((v).type == VAL_FLOAT)
+#define IS_OBJ(v) ((v).type == VAL_OBJ)
+#define IS_OBJ_TYPE(v, t) (IS_OBJ(v) && (v).as.obj->type == (t))
+#define IS_FUNCTION(v) IS_OBJ_TYPE(v, OBJ_FUNCTION)
+#define IS_CLOSURE(v) IS_OBJ_TYPE(v, OBJ_CLOSURE)
+#define IS_BIGINT(v) IS_OBJ_TYPE(v, OBJ_BIGINT)
+#define IS_INTEGER(v) (IS_INT(v) || IS_BIGINT(v))
+#define IS_NUMBER(v) (IS_INTEGER(v) || IS_FLOAT(v))
+#define IS_ARRAY(v) IS_OBJ_TYPE(v, OBJ_ARRAY)
+#define IS_HASH(v) IS_OBJ_TYPE(v, OBJ_HASH)
+#define IS_BUILTIN(v) IS_OBJ_TYPE(v, OBJ_BUILTIN)
+#define IS_FLAT_STRING(v) IS_OBJ_TYPE(v, OBJ_STRING)
+#define IS_ROPE(v) IS_OBJ_TYPE(v, OBJ_ROPE)
+#define IS_STRING(v) (IS_FLAT_STRING(v) || IS_ROPE(v))
+
+#define AS_BOOL(v) ((v).as.boolean)
+#define AS_INT(v) ((v).as.integer)
+#define AS_FLOAT(v) ((v).as.number)
+#define AS_OBJ(v) ((v).as.obj)
+#define AS_FUNCTION(v) ((FunctionProto *)AS_OBJ(v))
+#define AS_CLOSURE(v) ((Closure *)AS_OBJ(v))
+#define AS_BIGINT(v) ((BigInt *)AS_OBJ(v))
+#define AS_ARRAY(v) ((Array *)AS_OBJ(v))
+#define AS_HASH(v) ((Hash *)AS_OBJ(v))
+#define AS_NODE(v) ((Node *)AS_OBJ(v))
+#define AS_PACKED_NODE(v) ((PackedNode *)AS_OBJ(v))
+#define AS_BUILTIN(v) ((Builtin *)AS_OBJ(v))
+#define AS_STRING(v) ((StringObject *)AS_OBJ(v))
+#define AS_ROPE(v) ((Rope *)AS_OBJ(v))
+
+extern Heap *make_heap(void);
+extern void cleanup_heap(Heap *heap);
+extern Object *allocate_object(Heap *heap, size_t size, ObjectType type);
+extern Object *allocate_young_object(Heap *heap, size_t size, ObjectType type);
+extern size_t object_size(Object *object);
+extern void free_object(Heap *heap, Object *object);
+
+static inline bool is_young(Heap *heap, Object *object)
+{
+    return (uint8_t *)object >= heap->nursery && (uint8_t *)object < heap->nursery_end;
+}
+
+extern FunctionProto *make_function_proto(Heap *heap, const char *name);
+extern Closure *make_closure(Heap *heap, FunctionProto *function);
+extern Upvalue *make_upvalue(Heap *heap, Value *slot);
+
+extern ValueArrayList *make_value_arraylist(void);
+extern size_t add_value_to_arraylist(ValueArrayList *list, Value value);
+extern void cleanup_value_arraylist(ValueArrayList *list);
+
+extern bool is_truthy(Value value);
+extern bool values_equal(Value a, Value b);
+extern const char *value_type_to_str(Value value);
+extern char *inspect_value(Value value);
+
+#endif // OBJECT_H
@@ -0,0 +1,387 @@
+#include "optimizer.h"
+#include "ast.h"
+#include "globals.h"
+#include "token.h"
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+static bool is_int_literal(ASTNode *node)
+{
+    return node->type == NODE_LITERAL && node->data.literal.type == LITERAL_INT;
+}
+
+static bool is_float_literal(ASTNode *node)
+{
+    return node->type == NODE_LITERAL && node->data.literal.type == LITERAL_FLOAT;
+}
+
+static bool is_bool_literal(ASTNode *node)
+{
+    return node->type == NODE_LITERAL && node->data.literal.type == LITERAL_BOOL;
+}
+
+static bool is_int_literal_with_value(ASTNode *node, int64_t value)
+{
+    return is_int_literal(node) && node->data.literal.value.int_value == value;
+}
+
+// An expression is numeric when it can only ever produce an integer or a float (or a runtime
+// error). Identifiers are never numeric since nothing is known about what they are bound to.
+static bool is_numeric_expression(ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_LITERAL:
+        return node->data.literal.type == LITERAL_INT || node->data.literal.type == LITERAL_FLOAT;
+    case NODE_PREFIX_EXPR:
+        return node->data.prefix_expr.token.type == TOKEN_MINUS;
+    case NODE_INFIX_EXPR:
+        switch (node->data.infix_expr.token.type) {
+        case TOKEN_MINUS:
+        case TOKEN_ASTERISK:
+        case TOKEN_SLASH:
+            return TRUE;
+        case TOKEN_PLUS:
+            // `+` might also mean string concatenation, so both sides have to be known numbers
+            return is_numeric_expression(node->data.infix_expr.left) && is_numeric_expression(node->data.infix_expr.right);
+        default:
+            return FALSE;
+        }
+    default:
+        return FALSE;
+    }
+}
+
+static bool is_boolean_expression(ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_LITERAL:
+        return node->data.literal.type == LITERAL_BOOL;
+    case NODE_PREFIX_EXPR:
+        return node->data.prefix_expr.token.type == TOKEN_BANG;
+    case NODE_INFIX_EXPR:
+        switch (node->data.infix_expr.token.type) {
+        case TOKEN_LT:
+        case TOKEN_GT:
+        case TOKEN_EQ:
+        case TOKEN_NOT_EQ:
+            return TRUE;
+        default:
+            return FALSE;
+        }
+    default:
+        return FALSE;
+    }
+}
+
+// Results that overflow are left for the VM to promote to a bignum. So are the few negative
+// numbers whose text does not fit in a token literal, which keeps INT64_MIN out of literals.
+static bool replace_with_int_literal(ASTNode *node, bool overflow, int64_t value)
+{
+    char literal[MAX_TOKEN_LITERAL_SIZE + 1];
+    if (overflow || snprintf(literal, sizeof(literal), "%" PRId64, value) >= MAX_TOKEN_LITERAL_SIZE) {
+        return FALSE;
+    }
+    node->type = NODE_LITERAL;
+    node->data.literal.type = LITERAL_INT;
+    node->data.literal.value.int_value = value;
+    strcpy(node->token_literal, literal);
+    return TRUE;
+}
+
+static void replace_with_bool_literal(ASTNode *node, bool value)
+{
+    node->type = NODE_LITERAL;
+    node->data.literal.type = LITERAL_BOOL;
+    node->data.literal.value.boolean_value = value;
+    snprintf(node->token_literal, MAX_TOKEN_LITERAL_SIZE, "%s", value ? "true" : "false");
+}
+
+// Returns TRUE if the prefix expression was folded into a literal
+static bool fold_prefix_expression(ASTNode *node)
+{
+    ASTNode *right = node->data.prefix_expr.right;
+
+    switch (node->data.prefix_expr.token.type) {
+    case TOKEN_BANG:
+        if (is_bool_literal(right)) {
+            replace_with_bool_literal(node, !right->data.literal.value.boolean_value);
+            return TRUE;
+        }
+        if (is_int_literal(right) || is_float_literal(right)) {
+            // Numbers are always truthy
+            replace_with_bool_literal(node, FALSE);
+            return TRUE;
+        }
+        return FALSE;
+    case TOKEN_MINUS:
+        // Literals are never INT64_MIN, so negation cannot overflow
+        return is_int_literal(right) && replace_with_int_literal(node, FALSE, -right->data.literal.value.int_value);
+    default:
+        return FALSE;
+    }
+}
+
+static bool fold_int_infix_expression(ASTNode *node, int64_t left, int64_t right)
+{
+    int64_t result;
+    bool overflow;
+
+    switch (node->data.infix_expr.token.type) {
+    case TOKEN_PLUS:
+        overflow = __builtin_add_overflow(left, right, &result);
+        return replace_with_int_literal(node, overflow, result);
+    case TOKEN_MINUS:
+        overflow = __builtin_sub_overflow(left, right, &result);
+        return replace_with_int_literal(node, overflow, result);
+    case TOKEN_ASTERISK:
+        overflow = __builtin_mul_overflow(left, right, &result);
+        return replace_with_int_literal(node, overflow, result);
+    case TOKEN_SLASH:
+        // Division by zero has to fail at runtime, not at compile time. Literals are never
+        // INT64_MIN, so the quotient cannot overflow.
+        if (right == 0) {
+            return FALSE;
+        }
+        return replace_with_int_literal(node, FALSE, left / right);
+    case TOKEN_LT:
+        replace_with_bool_literal(node, left < right);
+        return TRUE;
+    case TOKEN_GT:
+        replace_with_bool_literal(node, left > right);
+        return TRUE;
+    case TOKEN_EQ:
+        replace_with_bool_literal(node, left == right);
+        return TRUE;
+    case TOKEN_NOT_EQ:
+        replace_with_bool_literal(node, left != right);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+static bool fold_bool_infix_expression(ASTNode *node, bool left, bool right)
+{
+    switch (node->data.infix_expr.token.type) {
+    case TOKEN_EQ:
+        replace_with_bool_literal(node, left == right);
+        return TRUE;
+    case TOKEN_NOT_EQ:
+        replace_with_bool_literal(node, left != right);
+        return TRUE;
+    default:
+        // Arithmetic and ordering on booleans are runtime errors
+        return FALSE;
+    }
+}
+
+// Returns TRUE if the infix expression was folded into a literal
+static bool fold_infix_expression(ASTNode *node)
+{
+    ASTNode *left = node->data.infix_expr.left;
+    ASTNode *right = node->data.infix_expr.right;
+
+    if (is_int_literal(left) && is_int_literal(right)) {
+        return fold_int_infix_expression(node, left->data.literal.value.int_value, right->data.literal.value.int_value);
+    }
+    if (is_bool_literal(left) && is_bool_literal(right)) {
+        return fold_bool_infix_expression(node, left->data.literal.value.boolean_value, right->data.literal.value.boolean_value);
+    }
+    return FALSE;
+}
+
+// Returns the node that should replace the infix expression, or NULL if no identity applies
+static ASTNode *simplify_infix_expression(ASTNode *node)
+{
+    ASTNode *left = node->data.infix_expr.left;
+    ASTNode *right = node->data.infix_expr.right;
+
+    // Adding zero is not an identity, since -0.0 + 0 is 0.0
+    switch (node->data.infix_expr.token.type) {
+    case TOKEN_MINUS:
+        if (is_int_literal_with_value(right, 0) && is_numeric_expression(left)) {
+            return left;
+        }
+        return NULL;
+    case TOKEN_ASTERISK:
+        if (is_int_literal_with_value(right, 1) && is_numeric_expression(left)) {
+            return left;
+        }
+        if (is_int_literal_with_value(left, 1) && is_numeric_expression(right)) {
+            return right;
+        }
+        return NULL;
+    case TOKEN_SLASH:
+        if (is_int_literal_with_value(right, 1) && is_numeric_expression(left)) {
+            return left;
+        }
+        return NULL;
+    default:
+        return NULL;
+    }
+}
+
+// Returns the node that should replace the prefix expression, or NULL if no identity applies
+static ASTNode *simplify_prefix_expression(ASTNode *node)
+{
+    ASTNode *right = node->data.prefix_expr.right;
+
+    // `!!b` is only equivalent to `b` when `b` is already a boolean, otherwise it coerces truthiness
+    if (node->data.prefix_expr.token.type == TOKEN_BANG && right->type == NODE_PREFIX_EXPR
+        && right->data.prefix_expr.token.type == TOKEN_BANG && is_boolean_expression(right->data.prefix_expr.right)) {
+        return right->data.prefix_expr.right;
+    }
+    return NULL;
+}
+
+static size_t count_ast_node_list(ASTNodePtrArrayList *list)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < list->size; i++) {
+        count += count_ast_nodes(list->array[i]);
+    }
+    return count;
+}
+
+static void optimize_node_list(ASTNodePtrArrayList *list, OptimizerStats *stats)
+{
+    for (size_t i = 0; i < list->size; i++) {
+        list->array[i] = optimize_node(list->array[i], stats);
+    }
+}
+
+size_t count_ast_nodes(ASTNode *node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    switch (node->type) {
+    case NODE_LET_STMT:
+        return 1 + count_ast_nodes(node->data.let_stmt.left) + count_ast_nodes(node->data.let_stmt.right);
+    case NODE_RETURN_STMT:
+        return 1 + count_ast_nodes(node->data.return_stmt);
+    case NODE_EXPR_STMT:
+        return 1 + count_ast_nodes(node->data.expr_stmt);
+    case NODE_PREFIX_EXPR:
+        return 1 + count_ast_nodes(node->data.prefix_expr.right);
+    case NODE_INFIX_EXPR:
+        return 1 + count_ast_nodes(node->data.infix_expr.left) + count_ast_nodes(node->data.infix_expr.right);
+    case NODE_BLOCK_STMT:
+        return 1 + count_ast_node_list(node->data.block_stmt);
+    case NODE_IF_EXPR:
+        return 1 + count_ast_nodes(node->data.if_expr.condition) + count_ast_nodes(node->data.if_expr.consequence)
+            + count_ast_nodes(node->data.if_expr.alternative);
+    case NODE_FUNCTION_LITERAL:
+        return 1 + count_ast_node_list(node->data.function_literal.parameters) + count_ast_nodes(node->data.function_literal.body);
+    case NODE_CALL_EXPR:
+        return 1 + count_ast_nodes(node->data.call_expr.function) + count_ast_node_list(node->data.call_expr.arguments);
+    case NODE_WHILE_STMT:
+        return 1 + count_ast_nodes(node->data.while_stmt.condition) + count_ast_nodes(node->data.while_stmt.body);
+    case NODE_ARRAY_LITERAL:
+        return 1 + count_ast_node_list(node->data.array_literal);
+    case NODE_HASH_LITERAL:
+        return 1 + count_ast_node_list(node->data.hash_literal.keys) + count_ast_node_list(node->data.hash_literal.values);
+    case NODE_INDEX_EXPR:
+        return 1 + count_ast_nodes(node->data.index_expr.left) + count_ast_nodes(node->data.index_expr.index);
+    default:
+        return 1;
+    }
+}
+
+ASTNode *optimize_node(ASTNode *node, OptimizerStats *stats)
+{
+    if (node == NULL) {
+        return NULL;
+    }
+
+    size_t nodes_before;
+    ASTNode *replacement;
+
+    switch (node->type) {
+    case NODE_LET_STMT:
+        node->data.let_stmt.right = optimize_node(node->data.let_stmt.right, stats);
+        return node;
+    case NODE_RETURN_STMT:
+        node->data.return_stmt = optimize_node(node->data.return_stmt, stats);
+        return node;
+    case NODE_EXPR_STMT:
+        node->data.expr_stmt = optimize_node(node->data.expr_stmt, stats);
+        return node;
+    case NODE_PREFIX_EXPR:
+        node->data.prefix_expr.right = optimize_node(node->data.prefix_expr.right, stats);
+        nodes_before = count_ast_nodes(node);
+
+        if (fold_prefix_expression(node)) {
+            stats->folded_exprs++;
+            stats->nodes_eliminated += nodes_before - 1;
+            return node;
+        }
+        replacement = simplify_prefix_expression(node);
+        if (replacement != NULL) {
+            stats->simplified_exprs++;
+            stats->nodes_eliminated += nodes_before - count_ast_nodes(replacement);
+            return replacement;
+        }
+        return node;
+    case NODE_INFIX_EXPR:
+        node->data.infix_expr.left = optimize_node(node->data.infix_expr.left, stats);
+        node->data.infix_expr.right = optimize_node(node->data.infix_expr.right, stats);
+        nodes_before = count_ast_nodes(node);
+
+        if (fold_infix_expression(node)) {
+            stats->folded_exprs++;
+            stats->nodes_eliminated += nodes_before - 1;
+            return node;
+        }
+        replacement = simplify_infix_expression(node);
+        if (replacement != NULL) {
+            stats->simplified_exprs++;
+            stats->nodes_eliminated += nodes_before - count_ast_nodes(replacement);
+            return replacement;
+        }
+        return node;
+    case NODE_BLOCK_STMT:
+        optimize_node_list(node->data.block_stmt, stats);
+        return node;
+    case NODE_IF_EXPR:
+        node->data.if_expr.condition = optimize_node(node->data.if_expr.condition, stats);
+        node->data.if_expr.consequence = optimize_node(node->data.if_expr.consequence, stats);
+        node->data.if_expr.alternative = optimize_node(node->data.if_expr.alternative, stats);
+        return node;
+    case NODE_FUNCTION_LITERAL:
+        node->data.function_literal.body = optimize_node(node->data.function_literal.body, stats);
+        return node;
+    case NODE_CALL_EXPR:
+        node->data.call_expr.function = optimize_node(node->data.call_expr.function, stats);
+        optimize_node_list(node->data.call_expr.arguments, stats);
+        return node;
+    case NODE_WHILE_STMT:
+        node->data.while_stmt.condition = optimize_node(node->data.while_stmt.condition, stats);
+        node->data.while_stmt.body = optimize_node(node->data.while_stmt.body, stats);
+        return node;
+    case NODE_ARRAY_LITERAL:
+        optimize_node_list(node->data.array_literal, stats);
+        return node;
+    case NODE_HASH_LITERAL:
+        optimize_node_list(node->data.hash_literal.keys, stats);
+        optimize_node_list(node->data.hash_literal.values, stats);
+        return node;
+    case NODE_INDEX_EXPR:
+        node->data.index_expr.left = optimize_node(node->data.index_expr.left, stats);
+        node->data.index_expr.index = optimize_node(node->data.index_expr.index, stats);
+        return node;
+    default:
+        return node;
+    }
+}
+
+OptimizerStats optimize_program(Program *program)
+{
+    OptimizerStats stats = { 0 };
+    for (size_t i = 0; i < program->size; i++) {
+        program->array[i] = optimize_node(program->array[i], &stats);
+    }
+    return stats;
+}
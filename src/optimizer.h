@@ -0,0 +1,17 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ast.h"
+#include <stddef.h>
+
+typedef struct OptimizerStats {
+    size_t folded_exprs; // Literal-only subtrees replaced by a single literal
+    size_t simplified_exprs; // Identities like `x * 1` or `!!b` rewritten to their operand
+    size_t nodes_eliminated; // Total number of nodes no longer reachable from the program
+} OptimizerStats;
+
+extern OptimizerStats optimize_program(Program *program);
+extern ASTNode *optimize_node(ASTNode *node, OptimizerStats *stats);
+extern size_t count_ast_nodes(ASTNode *node);
+
+#endif // OPTIMIZER_H
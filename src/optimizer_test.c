@@ -0,0 +1,143 @@
+#include "optimizer.h"
+#include "parser.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static void check_parser_errors(Parser *parser)
+{
+    if (parser->errors->size == 0) {
+        return;
+    }
+    printf("Parser encountered %zu error(s)\n", parser->errors->size);
+    for (size_t i = 0; i < parser->errors->size; i++) {
+        printf("%s\n", get_error_from_arraylist(parser->errors, i));
+    }
+    assert(1 != 1);
+}
+
+typedef struct OptimizerTest {
+    char *input;
+    char *expected;
+    size_t expected_eliminated;
+} OptimizerTest;
+
+static void run_optimizer_tests(OptimizerTest *tests, size_t num_tests)
+{
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+
+        check_parser_errors(parser);
+
+        OptimizerStats stats = optimize_program(program);
+        char *actual = program_to_str(program);
+
+        if (strcmp(actual, tests[i].expected) != 0 || stats.nodes_eliminated != tests[i].expected_eliminated) {
+            printf("Test failed: input='%s', expected='%s' (%zu eliminated), got='%s' (%zu eliminated)\n",
+                tests[i].input, tests[i].expected, tests[i].expected_eliminated, actual, stats.nodes_eliminated);
+            assert(1 != 1);
+        }
+
+        free(actual);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(constant_folding)
+{
+    OptimizerTest tests[] = {
+        { "5 * 10 + -2", "48", 5 },
+        { "!true", "false", 1 },
+        { "!!false", "false", 2 },
+        { "!5", "false", 1 },
+        { "!0.5", "false", 1 },
+        { "--5", "5", 2 },
+        { "10 / 3", "3", 2 },
+        { "1 + 2 == 3", "true", 4 },
+        { "1 < 2 != 2 > 1", "false", 6 },
+        { "true == false", "false", 2 },
+        { "a + 2 * 3", "(a + 6)", 2 },
+        { "2147483647 * 2147483647", "4611686014132420609", 2 },
+        { "2 * 3; 4 - 1", "63", 4 },
+    };
+
+    run_optimizer_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(folding_preserves_runtime_errors)
+{
+    OptimizerTest tests[] = {
+        { "1 / 0", "(1 / 0)", 0 },
+        { "5 / 0 * 1", "(5 / 0)", 2 },
+        // Overflowing results are promoted to bignums at runtime
+        { "9223372036854775807 + 1", "(9223372036854775807 + 1)", 0 },
+        { "-9223372036854775807 - 2", "((-9223372036854775807) - 2)", 0 },
+        { "4294967296 * 4294967296", "(4294967296 * 4294967296)", 0 },
+        // So are negative results too long for a token literal, INT64_MIN among them
+        { "-999999999999999999 * 10", "(-999999999999999999 * 10)", 1 },
+        { "-true", "(-true)", 0 },
+        { "true + false", "(true + false)", 0 },
+        { "true < false", "(true < false)", 0 },
+    };
+
+    run_optimizer_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(algebraic_simplification)
+{
+    OptimizerTest tests[] = {
+        { "-a * 1", "(-a)", 2 },
+        { "1 * -a", "(-a)", 2 },
+        { "a * b - 0", "(a * b)", 2 },
+        { "-a * 1.5 * 1", "((-a) * 1.5)", 2 },
+        { "a / b - 0", "(a / b)", 2 },
+        { "a * b / 1", "(a * b)", 2 },
+        { "!!!a", "(!a)", 2 },
+        // Nothing is known about the type of a bare identifier, so these have to stay
+        { "a * 1", "(a * 1)", 0 },
+        { "a + 0", "(a + 0)", 0 },
+        { "!!a", "(!(!a))", 0 },
+        // Only `-`, `*` and `/` are guaranteed to produce numbers, `+` might concatenate strings
+        { "a + b - 0", "((a + b) - 0)", 0 },
+        // Numbers might be -0.0, which adding zero turns into 0.0
+        { "a * b + 0", "((a * b) + 0)", 0 },
+        { "0 + -a", "(0 + (-a))", 0 },
+    };
+
+    run_optimizer_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(optimizer_stats)
+{
+    Parser *parser = make_parser("-a * 1 + 2 * 3; !!true", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    size_t nodes_before = 0;
+    for (size_t i = 0; i < program->size; i++) {
+        nodes_before += count_ast_nodes(program->array[i]);
+    }
+
+    OptimizerStats stats = optimize_program(program);
+
+    size_t nodes_after = 0;
+    for (size_t i = 0; i < program->size; i++) {
+        nodes_after += count_ast_nodes(program->array[i]);
+    }
+
+    // `2 * 3`, `!true` and `!false` are folded, `-a * 1` is simplified
+    assert(stats.folded_exprs == 3);
+    assert(stats.simplified_exprs == 1);
+    assert(stats.nodes_eliminated == nodes_before - nodes_after);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+RUN_TESTS()
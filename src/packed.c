@@ -0,0 +1,392 @@
+#include "packed.h"
+#include "persistent.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define X86_KERNELS 1
+#else
+#define X86_KERNELS 0
+#endif
+
+// Plain loops, for processors without vector units and for the elements after the last full vector
+
+static bool sum_scalar(const int64_t *elements, size_t count, int64_t *sum)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (__builtin_add_overflow(*sum, elements[i], sum)) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+static bool map_scalar(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+    bool overflow = FALSE;
+    for (size_t i = 0; i < count; i++) {
+        int64_t x = elements[i];
+        switch (lambda.op) {
+        case INT_LAMBDA_ADD:
+            overflow |= __builtin_add_overflow(x, lambda.constant, &results[i]);
+            break;
+        case INT_LAMBDA_SUB:
+            overflow |= lambda.reversed ? __builtin_sub_overflow(lambda.constant, x, &results[i])
+                                        : __builtin_sub_overflow(x, lambda.constant, &results[i]);
+            break;
+        default:
+            overflow |= __builtin_mul_overflow(x, lambda.constant, &results[i]);
+        }
+    }
+    return !overflow;
+}
+
+static inline bool holds(IntLambda lambda, int64_t x)
+{
+    switch (lambda.op) {
+    case INT_LAMBDA_GREATER:
+        return x > lambda.constant;
+    case INT_LAMBDA_LESS:
+        return x < lambda.constant;
+    case INT_LAMBDA_EQUAL:
+        return x == lambda.constant;
+    default:
+        return x != lambda.constant;
+    }
+}
+
+static size_t filter_scalar(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+    size_t kept = 0;
+    for (size_t i = 0; i < count; i++) {
+        // Stored either way and only kept by moving past it, which saves a branch
+        results[kept] = elements[i];
+        kept += holds(lambda, elements[i]);
+    }
+    return kept;
+}
+
+static int64_t min_max_scalar(const int64_t *elements, size_t count, int64_t best, bool max)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (max ? elements[i] > best : elements[i] < best) {
+            best = elements[i];
+        }
+    }
+    return best;
+}
+
+#if X86_KERNELS
+
+// Signed addition overflows when the sign of the result differs from the signs of both operands,
+// and subtraction when the operands' signs differ and the result's differs from the first one's.
+// The vector loops collect those sign bits over all lanes and check them once at the end.
+
+#define AVX2 __attribute__((target("avx2")))
+
+static inline bool has_avx2(void)
+{
+    return __builtin_cpu_supports("avx2") != 0;
+}
+
+AVX2 static inline bool any_sign_avx2(__m256i lanes)
+{
+    return _mm256_movemask_pd(_mm256_castsi256_pd(lanes)) != 0;
+}
+
+AVX2 static bool sum_avx2(const int64_t *elements, size_t count, int64_t *sum)
+{
+    __m256i total = _mm256_setzero_si256();
+    __m256i overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(elements + i));
+        __m256i result = _mm256_add_epi64(total, x);
+        overflow = _mm256_or_si256(overflow, _mm256_and_si256(_mm256_xor_si256(total, result), _mm256_xor_si256(x, result)));
+        total = result;
+    }
+    if (any_sign_avx2(overflow)) {
+        return FALSE;
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, total);
+    return sum_scalar(lanes, 4, sum) && sum_scalar(elements + i, count - i, sum);
+}
+
+// Addition and subtraction only, AVX2 has no 64-bit multiply
+AVX2 static bool map_avx2(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+    __m256i constant = _mm256_set1_epi64x(lambda.constant);
+    __m256i overflow = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(elements + i));
+        __m256i result, signs;
+        if (lambda.op == INT_LAMBDA_ADD) {
+            result = _mm256_add_epi64(x, constant);
+            signs = _mm256_and_si256(_mm256_xor_si256(x, result), _mm256_xor_si256(constant, result));
+        } else if (!lambda.reversed) {
+            result = _mm256_sub_epi64(x, constant);
+            signs = _mm256_and_si256(_mm256_xor_si256(x, constant), _mm256_xor_si256(x, result));
+        } else {
+            result = _mm256_sub_epi64(constant, x);
+            signs = _mm256_and_si256(_mm256_xor_si256(constant, x), _mm256_xor_si256(constant, result));
+        }
+        overflow = _mm256_or_si256(overflow, signs);
+        _mm256_storeu_si256((__m256i *)(results + i), result);
+    }
+    return !any_sign_avx2(overflow) && map_scalar(lambda, elements + i, count - i, results + i);
+}
+
+// For each mask of kept lanes, the 32-bit halves of those lanes in order, to move them to the front
+static const int32_t compress_lanes[16][8] = {
+    { 0, 0, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 0, 0, 0, 0, 0, 0 },
+    { 2, 3, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 2, 3, 0, 0, 0, 0 },
+    { 4, 5, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 4, 5, 0, 0, 0, 0 },
+    { 2, 3, 4, 5, 0, 0, 0, 0 },
+    { 0, 1, 2, 3, 4, 5, 0, 0 },
+    { 6, 7, 0, 0, 0, 0, 0, 0 },
+    { 0, 1, 6, 7, 0, 0, 0, 0 },
+    { 2, 3, 6, 7, 0, 0, 0, 0 },
+    { 0, 1, 2, 3, 6, 7, 0, 0 },
+    { 4, 5, 6, 7, 0, 0, 0, 0 },
+    { 0, 1, 4, 5, 6, 7, 0, 0 },
+    { 2, 3, 4, 5, 6, 7, 0, 0 },
+    { 0, 1, 2, 3, 4, 5, 6, 7 },
+};
+
+AVX2 static size_t filter_avx2(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+    __m256i constant = _mm256_set1_epi64x(lambda.constant);
+    size_t kept = 0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(elements + i));
+        __m256i hits;
+        switch (lambda.op) {
+        case INT_LAMBDA_GREATER:
+            hits = _mm256_cmpgt_epi64(x, constant);
+            break;
+        case INT_LAMBDA_LESS:
+            hits = _mm256_cmpgt_epi64(constant, x);
+            break;
+        default:
+            hits = _mm256_cmpeq_epi64(x, constant);
+        }
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(hits));
+        if (lambda.op == INT_LAMBDA_NOT_EQUAL) {
+            mask ^= 0xf;
+        }
+        // All four lanes are stored, those past the kept ones are overwritten by the next store.
+        // They never reach past element i + 3, so stay within `count`.
+        __m256i moved = _mm256_permutevar8x32_epi32(x, _mm256_loadu_si256((const __m256i *)compress_lanes[mask]));
+        _mm256_storeu_si256((__m256i *)(results + kept), moved);
+        kept += (size_t)__builtin_popcount(mask);
+    }
+    return kept + filter_scalar(lambda, elements + i, count - i, results + kept);
+}
+
+AVX2 static int64_t min_max_avx2(const int64_t *elements, size_t count, bool max)
+{
+    if (count < 8) {
+        return min_max_scalar(elements + 1, count - 1, elements[0], max);
+    }
+    __m256i best = _mm256_loadu_si256((const __m256i *)elements);
+    size_t i = 4;
+    for (; i + 4 <= count; i += 4) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(elements + i));
+        __m256i better = max ? _mm256_cmpgt_epi64(x, best) : _mm256_cmpgt_epi64(best, x);
+        best = _mm256_blendv_epi8(best, x, better);
+    }
+    int64_t lanes[4];
+    _mm256_storeu_si256((__m256i *)lanes, best);
+    return min_max_scalar(elements + i, count - i, min_max_scalar(lanes + 1, 3, lanes[0], max), max);
+}
+
+// Every x86-64 processor has SSE2, which adds and subtracts two lanes at a time but cannot compare
+// 64-bit lanes, so comparisons fall back to the scalar loops without AVX2
+
+static inline bool any_sign_sse2(__m128i lanes)
+{
+    return _mm_movemask_pd(_mm_castsi128_pd(lanes)) != 0;
+}
+
+static bool sum_sse2(const int64_t *elements, size_t count, int64_t *sum)
+{
+    __m128i total = _mm_setzero_si128();
+    __m128i overflow = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(elements + i));
+        __m128i result = _mm_add_epi64(total, x);
+        overflow = _mm_or_si128(overflow, _mm_and_si128(_mm_xor_si128(total, result), _mm_xor_si128(x, result)));
+        total = result;
+    }
+    if (any_sign_sse2(overflow)) {
+        return FALSE;
+    }
+    int64_t lanes[2];
+    _mm_storeu_si128((__m128i *)lanes, total);
+    return sum_scalar(lanes, 2, sum) && sum_scalar(elements + i, count - i, sum);
+}
+
+static bool map_sse2(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+    __m128i constant = _mm_set1_epi64x(lambda.constant);
+    __m128i overflow = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(elements + i));
+        __m128i result, signs;
+        if (lambda.op == INT_LAMBDA_ADD) {
+            result = _mm_add_epi64(x, constant);
+            signs = _mm_and_si128(_mm_xor_si128(x, result), _mm_xor_si128(constant, result));
+        } else if (!lambda.reversed) {
+            result = _mm_sub_epi64(x, constant);
+            signs = _mm_and_si128(_mm_xor_si128(x, constant), _mm_xor_si128(x, result));
+        } else {
+            result = _mm_sub_epi64(constant, x);
+            signs = _mm_and_si128(_mm_xor_si128(constant, x), _mm_xor_si128(constant, result));
+        }
+        overflow = _mm_or_si128(overflow, signs);
+        _mm_storeu_si128((__m128i *)(results + i), result);
+    }
+    return !any_sign_sse2(overflow) && map_scalar(lambda, elements + i, count - i, results + i);
+}
+
+#endif // X86_KERNELS
+
+bool packed_sum(const int64_t *elements, size_t count, int64_t *sum)
+{
+#if X86_KERNELS
+    return has_avx2() ? sum_avx2(elements, count, sum) : sum_sse2(elements, count, sum);
+#else
+    return sum_scalar(elements, count, sum);
+#endif
+}
+
+int64_t packed_min(const int64_t *elements, size_t count)
+{
+#if X86_KERNELS
+    if (has_avx2()) {
+        return min_max_avx2(elements, count, FALSE);
+    }
+#endif
+    return min_max_scalar(elements + 1, count - 1, elements[0], FALSE);
+}
+
+int64_t packed_max(const int64_t *elements, size_t count)
+{
+#if X86_KERNELS
+    if (has_avx2()) {
+        return min_max_avx2(elements, count, TRUE);
+    }
+#endif
+    return min_max_scalar(elements + 1, count - 1, elements[0], TRUE);
+}
+
+bool packed_map(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+#if X86_KERNELS
+    if (lambda.op != INT_LAMBDA_MUL) {
+        return has_avx2() ? map_avx2(lambda, elements, count, results) : map_sse2(lambda, elements, count, results);
+    }
+#endif
+    return map_scalar(lambda, elements, count, results);
+}
+
+size_t packed_filter(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results)
+{
+#if X86_KERNELS
+    if (has_avx2()) {
+        return filter_avx2(lambda, elements, count, results);
+    }
+#endif
+    return filter_scalar(lambda, elements, count, results);
+}
+
+// Whole arrays
+
+typedef struct LeafContext {
+    IntLambda lambda;
+    int64_t value; // Running sum, minimum or maximum
+    int64_t *results;
+    size_t count; // Results stored so far
+} LeafContext;
+
+static bool sum_leaf(const int64_t *elements, size_t count, void *context)
+{
+    return packed_sum(elements, count, &((LeafContext *)context)->value);
+}
+
+static bool min_leaf(const int64_t *elements, size_t count, void *context)
+{
+    LeafContext *fold = context;
+    int64_t min = packed_min(elements, count);
+    fold->value = min < fold->value ? min : fold->value;
+    return TRUE;
+}
+
+static bool max_leaf(const int64_t *elements, size_t count, void *context)
+{
+    LeafContext *fold = context;
+    int64_t max = packed_max(elements, count);
+    fold->value = max > fold->value ? max : fold->value;
+    return TRUE;
+}
+
+static bool map_leaf(const int64_t *elements, size_t count, void *context)
+{
+    LeafContext *map = context;
+    if (!packed_map(map->lambda, elements, count, map->results + map->count)) {
+        return FALSE;
+    }
+    map->count += count;
+    return TRUE;
+}
+
+static bool filter_leaf(const int64_t *elements, size_t count, void *context)
+{
+    LeafContext *filter = context;
+    filter->count += packed_filter(filter->lambda, elements, count, filter->results + filter->count);
+    return TRUE;
+}
+
+bool packed_array_sum(Array *array, int64_t *sum)
+{
+    LeafContext context = { .value = 0 };
+    if (!packed_array_each(array, sum_leaf, &context)) {
+        return FALSE;
+    }
+    *sum = context.value;
+    return TRUE;
+}
+
+int64_t packed_array_min(Array *array)
+{
+    LeafContext context = { .value = INT64_MAX };
+    packed_array_each(array, min_leaf, &context);
+    return context.value;
+}
+
+int64_t packed_array_max(Array *array)
+{
+    LeafContext context = { .value = INT64_MIN };
+    packed_array_each(array, max_leaf, &context);
+    return context.value;
+}
+
+bool packed_array_map(Array *array, IntLambda lambda, int64_t *results)
+{
+    LeafContext context = { .lambda = lambda, .results = results };
+    return packed_array_each(array, map_leaf, &context);
+}
+
+size_t packed_array_filter(Array *array, IntLambda lambda, int64_t *results)
+{
+    LeafContext context = { .lambda = lambda, .results = results };
+    packed_array_each(array, filter_leaf, &context);
+    return context.count;
+}
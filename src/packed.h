@@ -0,0 +1,56 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Kernels over the unboxed integers in the leaves of packed arrays, see PackedNode in object.h.
+// They run four elements at a time with AVX2 when the processor has it and fall back to SSE2 or
+// plain loops otherwise. None of them allocate: the builtins run them a leaf at a time and build
+// their results themselves.
+
+// The functions `map` and `filter` can run without calling back into the interpreter, recognized
+// from their bytecode by the VM
+typedef enum IntLambdaOp {
+    INT_LAMBDA_ADD,
+    INT_LAMBDA_SUB,
+    INT_LAMBDA_MUL,
+    INT_LAMBDA_GREATER,
+    INT_LAMBDA_LESS,
+    INT_LAMBDA_EQUAL,
+    INT_LAMBDA_NOT_EQUAL
+} IntLambdaOp;
+
+// `fn(x) { x op constant }`, or `constant - x` for a reversed INT_LAMBDA_SUB. Comparisons with the
+// constant on the left are turned around rather than reversed.
+typedef struct IntLambda {
+    IntLambdaOp op;
+    int64_t constant;
+    bool reversed;
+} IntLambda;
+
+#define IS_INT_LAMBDA_COMPARISON(lambda) ((lambda).op >= INT_LAMBDA_GREATER)
+
+// Adds the elements to `sum`. Returns FALSE on overflow, leaving `sum` unspecified.
+extern bool packed_sum(const int64_t *elements, size_t count, int64_t *sum);
+// `count` must not be zero
+extern int64_t packed_min(const int64_t *elements, size_t count);
+extern int64_t packed_max(const int64_t *elements, size_t count);
+// Stores the lambda, which must be arithmetic, of every element in `results`. Returns FALSE on
+// overflow.
+extern bool packed_map(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results);
+// Copies the elements the comparison holds for to `results`, returning how many there are.
+// `results` needs room for `count` elements however many are kept.
+extern size_t packed_filter(IntLambda lambda, const int64_t *elements, size_t count, int64_t *results);
+
+// The same over whole packed arrays, a leaf at a time
+extern bool packed_array_sum(Array *array, int64_t *sum);
+// The array must not be empty
+extern int64_t packed_array_min(Array *array);
+extern int64_t packed_array_max(Array *array);
+extern bool packed_array_map(Array *array, IntLambda lambda, int64_t *results);
+extern size_t packed_array_filter(Array *array, IntLambda lambda, int64_t *results);
+
+#endif // PACKED_H
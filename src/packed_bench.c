@@ -0,0 +1,173 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "packed.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The array builtins over a million integers: recognized lambdas running in the vector kernels
+// against the same work done by calling a function per element, and against loops written in
+// the language. Last, the kernels on their own against loops over boxed values.
+
+#define ELEMENTS 1000000
+#define KERNEL_REPEATS 100
+
+typedef struct Session {
+    Heap *heap;
+    Compiler *compiler;
+    VM *vm;
+    Program *programs[16];
+    Parser *parsers[16];
+    int num_programs;
+} Session;
+
+// Runs `input` in the session, where globals of earlier inputs are still defined, and returns the
+// time it took
+static uint64_t run(Session *session, const char *input, const char *expected)
+{
+    Parser *parser = make_parser((char *)input, NULL);
+    Program *program = parse_program(parser);
+    FunctionProto *main = compile_program(session->compiler, program);
+    assert(main != NULL);
+    session->parsers[session->num_programs] = parser;
+    session->programs[session->num_programs++] = program;
+
+    uint64_t start = now_ns();
+    VMResult result = run_vm(session->vm, main);
+    uint64_t elapsed = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+    char *inspected = inspect_value(get_last_popped(session->vm));
+    if (expected != NULL && strcmp(inspected, expected) != 0) {
+        printf("%s gave %s\n", input, inspected);
+        exit(1);
+    }
+    free(inspected);
+    return elapsed;
+}
+
+static void bench_builtins(void)
+{
+    Session session = { .heap = make_heap() };
+    session.compiler = make_compiler(session.heap);
+    session.vm = make_vm(session.heap, session.compiler->constants);
+
+    char setup[256];
+    snprintf(setup, sizeof(setup), "let a = []; let i = 0; while (i < %d) { let a = push(a, i); let i = i + 1; } let k = 3; len(a)", ELEMENTS);
+    run(&session, setup, NULL);
+
+    struct {
+        const char *label;
+        const char *kernel;
+        const char *per_element;
+        const char *expected;
+    } cases[] = {
+        { "sum", "sum(a)", "let s = 0; let i = 0; while (i < len(a)) { let s = s + a[i]; let i = i + 1; } s", "499999500000" },
+        { "max", "max(a)", "let m = a[0]; let i = 1; while (i < len(a)) { if (a[i] > m) { let m = a[i]; } let i = i + 1; } m", "999999" },
+        { "map", "len(map(a, fn(x) { x * 3 }))", "len(map(a, fn(x) { x * k }))", "1000000" },
+        { "map +", "len(map(a, fn(x) { x + 3 }))", "len(map(a, fn(x) { x + k }))", "1000000" },
+        { "filter", "len(filter(a, fn(x) { x > 500000 }))", "len(filter(a, fn(x) { x > k * 166666 + 2 }))", "499999" },
+    };
+
+    printf("%-8s %12s %12s %9s\n", "builtin", "kernel ms", "per-elem ms", "speedup");
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        uint64_t kernel = run(&session, cases[i].kernel, cases[i].expected);
+        uint64_t per_element = run(&session, cases[i].per_element, cases[i].expected);
+        printf("%-8s %12.2f %12.2f %8.1fx\n", cases[i].label, kernel / 1e6, per_element / 1e6, (double)per_element / kernel);
+    }
+
+    cleanup_vm(session.vm);
+    cleanup_compiler(session.compiler);
+    cleanup_heap(session.heap);
+    for (int i = 0; i < session.num_programs; i++) {
+        cleanup_program(session.programs[i]);
+        cleanup_parser(session.parsers[i]);
+    }
+}
+
+// What a generic array's leaves hold, summed with the type check and overflow check per element
+static uint64_t sum_boxed(const Value *values, size_t count, int64_t *sum)
+{
+    uint64_t start = now_ns();
+    for (int repeat = 0; repeat < KERNEL_REPEATS; repeat++) {
+        *sum = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (!IS_INT(values[i]) || __builtin_add_overflow(*sum, AS_INT(values[i]), sum)) {
+                return 0;
+            }
+        }
+    }
+    return now_ns() - start;
+}
+
+static uint64_t sum_packed(const int64_t *elements, size_t count, int64_t *sum)
+{
+    uint64_t start = now_ns();
+    for (int repeat = 0; repeat < KERNEL_REPEATS; repeat++) {
+        *sum = 0;
+        for (size_t i = 0; i < count; i += 32) {
+            // A leaf at a time, like the builtins run it
+            if (!packed_sum(elements + i, count - i < 32 ? count - i : 32, sum)) {
+                return 0;
+            }
+        }
+    }
+    return now_ns() - start;
+}
+
+static void bench_kernels(void)
+{
+    int64_t *elements = malloc(ELEMENTS * sizeof(int64_t));
+    int64_t *results = malloc(ELEMENTS * sizeof(int64_t));
+    Value *values = malloc(ELEMENTS * sizeof(Value));
+    for (size_t i = 0; i < ELEMENTS; i++) {
+        elements[i] = (int64_t)i;
+        values[i] = INT_VAL((int64_t)i);
+    }
+
+    int64_t packed_total, boxed_total;
+    uint64_t packed = sum_packed(elements, ELEMENTS, &packed_total);
+    uint64_t boxed = sum_boxed(values, ELEMENTS, &boxed_total);
+    assert(packed_total == boxed_total);
+    printf("\n%-8s %12s %12s %9s\n", "kernel", "packed ns/el", "boxed ns/el", "speedup");
+    printf("%-8s %12.3f %12.3f %8.1fx\n", "sum", (double)packed / ((double)ELEMENTS * KERNEL_REPEATS),
+        (double)boxed / ((double)ELEMENTS * KERNEL_REPEATS), (double)boxed / packed);
+
+    IntLambda greater = { INT_LAMBDA_GREATER, ELEMENTS / 2, FALSE };
+    size_t kept = 0;
+    uint64_t start = now_ns();
+    for (int repeat = 0; repeat < KERNEL_REPEATS; repeat++) {
+        kept = packed_filter(greater, elements, ELEMENTS, results);
+    }
+    uint64_t filtered = now_ns() - start;
+    start = now_ns();
+    size_t boxed_kept = 0;
+    for (int repeat = 0; repeat < KERNEL_REPEATS; repeat++) {
+        boxed_kept = 0;
+        for (size_t i = 0; i < ELEMENTS; i++) {
+            if (IS_INT(values[i]) && AS_INT(values[i]) > ELEMENTS / 2) {
+                results[boxed_kept++] = AS_INT(values[i]);
+            }
+        }
+    }
+    uint64_t boxed_filtered = now_ns() - start;
+    assert(kept == boxed_kept);
+    printf("%-8s %12.3f %12.3f %8.1fx\n", "filter", (double)filtered / ((double)ELEMENTS * KERNEL_REPEATS),
+        (double)boxed_filtered / ((double)ELEMENTS * KERNEL_REPEATS), (double)boxed_filtered / filtered);
+
+    free(elements);
+    free(results);
+    free(values);
+}
+
+int main(void)
+{
+    bench_builtins();
+    bench_kernels();
+    return 0;
+}
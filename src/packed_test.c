@@ -0,0 +1,148 @@
+#include "packed.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+INIT_TEST_HARNESS()
+
+#define MAX_LENGTH 40 // Past a leaf, with every remainder after the last full vector
+
+static uint64_t state = 88172645463325252u;
+
+static int64_t next_random(void)
+{
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return (int64_t)state;
+}
+
+// Small values around zero, so comparisons with a small constant go both ways
+static void fill_small(int64_t *elements, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        elements[i] = next_random() % 21 - 10;
+    }
+}
+
+static const IntLambda lambdas[] = {
+    { INT_LAMBDA_ADD, 7, FALSE },
+    { INT_LAMBDA_SUB, 7, FALSE },
+    { INT_LAMBDA_SUB, 7, TRUE },
+    { INT_LAMBDA_MUL, -3, FALSE },
+    { INT_LAMBDA_GREATER, 2, FALSE },
+    { INT_LAMBDA_LESS, -2, FALSE },
+    { INT_LAMBDA_EQUAL, 0, FALSE },
+    { INT_LAMBDA_NOT_EQUAL, 0, FALSE },
+};
+
+static int64_t apply(IntLambda lambda, int64_t x)
+{
+    switch (lambda.op) {
+    case INT_LAMBDA_ADD:
+        return x + lambda.constant;
+    case INT_LAMBDA_SUB:
+        return lambda.reversed ? lambda.constant - x : x - lambda.constant;
+    case INT_LAMBDA_MUL:
+        return x * lambda.constant;
+    case INT_LAMBDA_GREATER:
+        return x > lambda.constant;
+    case INT_LAMBDA_LESS:
+        return x < lambda.constant;
+    case INT_LAMBDA_EQUAL:
+        return x == lambda.constant;
+    default:
+        return x != lambda.constant;
+    }
+}
+
+// Every length, starting at every offset into the buffer so loads are unaligned too
+TEST_CASE(kernels_match_plain_loops)
+{
+    int64_t buffer[MAX_LENGTH + 4], results[MAX_LENGTH];
+    for (int round = 0; round < 20; round++) {
+        fill_small(buffer, MAX_LENGTH + 4);
+        for (size_t offset = 0; offset < 4; offset++) {
+            int64_t *elements = buffer + offset;
+            for (size_t count = 0; count <= MAX_LENGTH; count++) {
+                int64_t sum = 0, expected_sum = 0, min = 0, max = 0;
+                for (size_t i = 0; i < count; i++) {
+                    expected_sum += elements[i];
+                    min = i == 0 || elements[i] < min ? elements[i] : min;
+                    max = i == 0 || elements[i] > max ? elements[i] : max;
+                }
+                assert(packed_sum(elements, count, &sum) && sum == expected_sum);
+                if (count > 0 && (packed_min(elements, count) != min || packed_max(elements, count) != max)) {
+                    printf("Wrong minimum or maximum of %zu elements\n", count);
+                    assert(1 != 1);
+                }
+
+                for (size_t l = 0; l < sizeof(lambdas) / sizeof(lambdas[0]); l++) {
+                    IntLambda lambda = lambdas[l];
+                    if (!IS_INT_LAMBDA_COMPARISON(lambda)) {
+                        assert(packed_map(lambda, elements, count, results));
+                        for (size_t i = 0; i < count; i++) {
+                            assert(results[i] == apply(lambda, elements[i]));
+                        }
+                        continue;
+                    }
+                    size_t kept = packed_filter(lambda, elements, count, results), expected_kept = 0;
+                    for (size_t i = 0; i < count; i++) {
+                        if (apply(lambda, elements[i])) {
+                            if (results[expected_kept++] != elements[i]) {
+                                printf("Filter %zu dropped element %zu of %zu\n", l, i, count);
+                                assert(1 != 1);
+                            }
+                        }
+                    }
+                    assert(kept == expected_kept);
+                }
+            }
+        }
+    }
+}
+
+// Overflow in any lane, or only once the lanes are added up, is reported
+TEST_CASE(overflow_is_detected)
+{
+    int64_t elements[MAX_LENGTH], results[MAX_LENGTH], sum;
+    for (size_t count = 1; count <= MAX_LENGTH; count++) {
+        for (size_t at = 0; at < count; at++) {
+            for (size_t i = 0; i < count; i++) {
+                elements[i] = 1;
+            }
+            elements[at] = INT64_MAX;
+            sum = 0;
+            assert(packed_sum(elements, count, &sum) == (count == 1));
+
+            IntLambda add = { INT_LAMBDA_ADD, 1, FALSE };
+            IntLambda sub = { INT_LAMBDA_SUB, -1, FALSE };
+            IntLambda reversed = { INT_LAMBDA_SUB, -2, TRUE };
+            IntLambda mul = { INT_LAMBDA_MUL, 2, FALSE };
+            assert(!packed_map(add, elements, count, results));
+            assert(!packed_map(sub, elements, count, results));
+            assert(!packed_map(reversed, elements, count, results));
+            assert(!packed_map(mul, elements, count, results));
+            elements[at] = INT64_MIN;
+            IntLambda negate = { INT_LAMBDA_SUB, 0, TRUE };
+            IntLambda decrement = { INT_LAMBDA_SUB, 1, FALSE };
+            assert(!packed_map(negate, elements, count, results));
+            assert(!packed_map(decrement, elements, count, results));
+        }
+    }
+
+    // Lanes that each stay in range but overflow when added together
+    int64_t halves[8] = { INT64_MAX / 2 + 1, 0, 0, 0, INT64_MAX / 2 + 1, 0, 0, 0 };
+    sum = 0;
+    assert(!packed_sum(halves, 8, &sum));
+    // Partial sums may overflow where the total would not, giving up then is fine but a wrong
+    // total is not
+    int64_t cancelling[8] = { INT64_MAX, INT64_MIN, INT64_MAX, INT64_MIN, 1, 2, 3, 4 };
+    sum = 0;
+    assert(packed_sum(cancelling, 8, &sum) == FALSE || sum == 8);
+    int64_t extremes[5] = { 0, INT64_MIN, INT64_MAX, -1, 1 };
+    assert(packed_min(extremes, 5) == INT64_MIN && packed_max(extremes, 5) == INT64_MAX);
+}
+
+RUN_TESTS()
@@ -3,18 +3,22 @@
 #include "ast.h"
 #include "globals.h"
 #include "lexer.h"
+#include "number.h"
 #include <assert.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define INITIAL_ERROR_CAPACITY 25
 
-static Token EMPTY_TOKEN = { TOKEN_ILLEGAL, "\0" };
+static Token EMPTY_TOKEN = { .type = TOKEN_ILLEGAL, .literal = "\0" };
 
 static ParserLookupEntry parser_fns[] = {
     { .type = TOKEN_IDENT, .prefix_fn = parse_identifier, .infix_fn = NULL },
     { .type = TOKEN_INT, .prefix_fn = parse_integer_literal, .infix_fn = NULL },
+    { .type = TOKEN_FLOAT, .prefix_fn = parse_float_literal, .infix_fn = NULL },
+    { .type = TOKEN_STRING, .prefix_fn = parse_string_literal, .infix_fn = NULL },
     { .type = TOKEN_BANG, .prefix_fn = parse_prefix_expression, .infix_fn = NULL },
 
     { .type = TOKEN_PLUS, .prefix_fn = NULL, .infix_fn = parse_infix_expression },
@@ -28,6 +32,12 @@ static ParserLookupEntry parser_fns[] = {
 
     { .type = TOKEN_TRUE, .prefix_fn = parse_boolean, .infix_fn = NULL },
     { .type = TOKEN_FALSE, .prefix_fn = parse_boolean, .infix_fn = NULL },
+
+    { .type = TOKEN_LPAREN, .prefix_fn = parse_grouped_expression, .infix_fn = parse_call_expression },
+    { .type = TOKEN_IF, .prefix_fn = parse_if_expression, .infix_fn = NULL },
+    { .type = TOKEN_FUNCTION, .prefix_fn = parse_function_literal, .infix_fn = NULL },
+    { .type = TOKEN_LBRACKET, .prefix_fn = parse_array_literal, .infix_fn = parse_index_expression },
+    { .type = TOKEN_LBRACE, .prefix_fn = parse_hash_literal, .infix_fn = NULL },
 };
 
 static PrecedenceEntry precedence_map[] = {
@@ -39,17 +49,28 @@ static PrecedenceEntry precedence_map[] = {
     { .type = TOKEN_MINUS, .precedence = PREC_SUM },
     { .type = TOKEN_SLASH, .precedence = PREC_PRODUCT },
     { .type = TOKEN_ASTERISK, .precedence = PREC_PRODUCT },
+    { .type = TOKEN_LPAREN, .precedence = PREC_CALL },
+    { .type = TOKEN_LBRACKET, .precedence = PREC_INDEX },
 };
 
-Parser *make_parser(char *input)
+Parser *make_parser(char *input, Allocator *allocator)
 {
-    Parser *parser = (Parser *)malloc(sizeof(struct Parser));
+    return make_span_parser(input, strlen(input) + 1, allocator);
+}
+
+// Parses the first `length` characters of `input`, see init_lexer_span
+Parser *make_span_parser(char *input, size_t length, Allocator *allocator)
+{
+    allocator = resolve_allocator(allocator);
+    Parser *parser = (Parser *)allocate(allocator, sizeof(struct Parser));
     if (parser == NULL) {
         return NULL;
     }
-    init_lexer(&parser->lexer, input);
-    parser->backing_node_list = make_ast_node_array_list();
-    parser->errors = make_error_arraylist();
+    parser->allocator = allocator;
+    parser->lazy_functions = FALSE;
+    init_lexer_span(&parser->lexer, input, length);
+    parser->backing_node_list = make_ast_node_array_list(allocator);
+    parser->errors = make_error_arraylist(allocator);
     memcpy(&parser->curr_token, &EMPTY_TOKEN, sizeof(Token));
     memcpy(&parser->peek_token, &EMPTY_TOKEN, sizeof(Token));
     parse_next_token(parser);
@@ -61,7 +82,7 @@ void cleanup_parser(Parser *parser)
 {
     cleanup_ast_node_list(parser->backing_node_list);
     cleanup_error_arraylist(parser->errors);
-    free(parser);
+    deallocate(parser->allocator, parser, sizeof(struct Parser));
 }
 
 void parse_next_token(Parser *parser)
@@ -73,7 +94,7 @@ void parse_next_token(Parser *parser)
 
 Program *parse_program(Parser *parser)
 {
-    Program *program = make_program();
+    Program *program = make_program(parser->allocator);
     if (program == NULL) {
         return NULL;
     }
@@ -96,6 +117,13 @@ ASTNode *parse_statement(Parser *parser)
     case TOKEN_RETURN:
         return parse_return_statement(parser);
         break;
+    case TOKEN_WHILE:
+        return parse_while_statement(parser);
+        break;
+    case TOKEN_BREAK:
+    case TOKEN_CONTINUE:
+        return parse_loop_control_statement(parser);
+        break;
     default:
         return parse_expression_statement(parser);
     }
@@ -111,21 +139,20 @@ ASTNode *parse_let_statement(Parser *parser)
         return NULL;
     }
 
-    // Parse identifier
-    ASTNode *identifier_node = make_ast_node(parser->backing_node_list);
-    identifier_node->type = NODE_IDENTIFIER;
+    node->data.let_stmt.left = parse_identifier(parser);
 
-    identifier_node->data.literal.type = LITERAL_IDENTIFIER;
-    strcpy(&identifier_node->data.literal.value, parser->curr_token.literal);
-    strcpy(identifier_node->token_literal, parser->curr_token.literal);
+    if (!expect_peek(parser, TOKEN_ASSIGN)) {
+        return NULL;
+    }
 
-    node->data.let_stmt.left = identifier_node;
+    parse_next_token(parser);
 
-    if (!expect_peek(parser, TOKEN_ASSIGN)) {
+    node->data.let_stmt.right = parse_expression(parser, PREC_LOWEST);
+    if (node->data.let_stmt.right == NULL) {
         return NULL;
     }
 
-    while (!compare_curr_token_type(parser, TOKEN_SEMICOLON)) {
+    if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
         parse_next_token(parser);
     }
 
@@ -140,9 +167,12 @@ ASTNode *parse_return_statement(Parser *parser)
 
     parse_next_token(parser);
 
-    // TODO: Parse expressions
+    node->data.return_stmt = parse_expression(parser, PREC_LOWEST);
+    if (node->data.return_stmt == NULL) {
+        return NULL;
+    }
 
-    while (!compare_curr_token_type(parser, TOKEN_SEMICOLON)) {
+    if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
         parse_next_token(parser);
     }
 
@@ -155,6 +185,55 @@ ASTNode *parse_expression_statement(Parser *parser)
     node->type = NODE_EXPR_STMT;
 
     node->data.expr_stmt = parse_expression(parser, PREC_LOWEST);
+    if (node->data.expr_stmt == NULL) {
+        return NULL;
+    }
+
+    if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
+        parse_next_token(parser);
+    }
+
+    return node;
+}
+
+ASTNode *parse_while_statement(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_WHILE_STMT;
+    strcpy(node->token_literal, parser->curr_token.literal);
+
+    if (!expect_peek(parser, TOKEN_LPAREN)) {
+        return NULL;
+    }
+
+    parse_next_token(parser);
+    node->data.while_stmt.condition = parse_expression(parser, PREC_LOWEST);
+    if (node->data.while_stmt.condition == NULL) {
+        return NULL;
+    }
+
+    if (!expect_peek(parser, TOKEN_RPAREN) || !expect_peek(parser, TOKEN_LBRACE)) {
+        return NULL;
+    }
+
+    node->data.while_stmt.body = parse_block_statement(parser);
+    if (node->data.while_stmt.body == NULL) {
+        return NULL;
+    }
+
+    if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
+        parse_next_token(parser);
+    }
+
+    return node;
+}
+
+// `break` and `continue`, whether they are inside a loop is checked by the resolver
+ASTNode *parse_loop_control_statement(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = compare_curr_token_type(parser, TOKEN_BREAK) ? NODE_BREAK_STMT : NODE_CONTINUE_STMT;
+    strcpy(node->token_literal, parser->curr_token.literal);
 
     if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
         parse_next_token(parser);
@@ -167,10 +246,17 @@ ASTNode *parse_expression(Parser *parser, Precedence precedence)
 {
     PrefixFn prefix_fn = get_prefix_fn(parser->curr_token.type);
     if (prefix_fn == NULL) {
-        report_no_prefix_error(parser, parser->curr_token.type);
+        if (compare_curr_token_type(parser, TOKEN_ILLEGAL)) {
+            report_illegal_token_error(parser);
+        } else {
+            report_no_prefix_error(parser, parser->curr_token.type);
+        }
         return NULL;
     }
     ASTNode *left_expr = prefix_fn(parser);
+    if (left_expr == NULL) {
+        return NULL;
+    }
 
     while (!compare_peek_token_type(parser, TOKEN_SEMICOLON) && precedence < get_peek_precedence(parser)) {
         InfixFn infix_fn = get_infix_fn(parser->peek_token.type);
@@ -181,6 +267,9 @@ ASTNode *parse_expression(Parser *parser, Precedence precedence)
         parse_next_token(parser);
 
         left_expr = infix_fn(parser, left_expr);
+        if (left_expr == NULL) {
+            return NULL;
+        }
     }
 
     return left_expr;
@@ -196,13 +285,69 @@ ASTNode *parse_identifier(Parser *parser)
     return node;
 }
 
+// Converts the current integer token, reporting it if it does not fit. Larger integers can only
+// be computed, the lexer cuts off digits that do not fit a token.
+bool parse_integer_value(Parser *parser, int64_t *value)
+{
+    *value = 0;
+    for (const char *digit = parser->curr_token.literal; *digit != '\0'; digit++) {
+        if (!isdigit(*digit) || __builtin_mul_overflow(*value, 10, value) || __builtin_add_overflow(*value, *digit - '0', value)) {
+            size_t total_len = snprintf(NULL, 0, "Integer literal %s does not fit in 64 bits", parser->curr_token.literal);
+            char *error = allocate(parser->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
+            sprintf(error, "Integer literal %s does not fit in 64 bits", parser->curr_token.literal);
+            add_error_to_arraylist(parser->errors, error);
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Converts the current float token, reporting it if it is too large to be finite
+bool parse_float_value(Parser *parser, double *value)
+{
+    StringSpan text = parser->curr_token.string;
+    if (!parse_double(text.start, text.length, value)) {
+        size_t total_len = snprintf(NULL, 0, "Float literal %s is too large", parser->curr_token.literal);
+        char *error = allocate(parser->errors->allocator, total_len + 1);
+        sprintf(error, "Float literal %s is too large", parser->curr_token.literal);
+        add_error_to_arraylist(parser->errors, error);
+        return FALSE;
+    }
+    return TRUE;
+}
+
 ASTNode *parse_integer_literal(Parser *parser)
 {
     ASTNode *node = make_ast_node(parser->backing_node_list);
     node->type = NODE_LITERAL;
-    strcpy(&node->token_literal, parser->curr_token.literal);
+    strcpy(node->token_literal, parser->curr_token.literal);
     node->data.literal.type = LITERAL_INT;
-    node->data.literal.value.int_value = atoi(parser->curr_token.literal);
+    if (!parse_integer_value(parser, &node->data.literal.value.int_value)) {
+        return NULL;
+    }
+    return node;
+}
+
+ASTNode *parse_float_literal(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_LITERAL;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.literal.type = LITERAL_FLOAT;
+    if (!parse_float_value(parser, &node->data.literal.value.float_value)) {
+        return NULL;
+    }
+    return node;
+}
+
+// The node keeps the token's span into the source, escapes are decoded when it is compiled
+ASTNode *parse_string_literal(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_LITERAL;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.literal.type = LITERAL_STRING;
+    node->data.literal.value.string_value = parser->curr_token.string;
     return node;
 }
 
@@ -227,6 +372,9 @@ ASTNode *parse_prefix_expression(Parser *parser)
     parse_next_token(parser);
 
     node->data.prefix_expr.right = parse_expression(parser, PREC_PREFIX);
+    if (node->data.prefix_expr.right == NULL) {
+        return NULL;
+    }
 
     return node;
 }
@@ -245,6 +393,318 @@ ASTNode *parse_infix_expression(Parser *parser, ASTNode *left)
     parse_next_token(parser);
 
     node->data.infix_expr.right = parse_expression(parser, precedence);
+    if (node->data.infix_expr.right == NULL) {
+        return NULL;
+    }
+
+    return node;
+}
+
+ASTNode *parse_grouped_expression(Parser *parser)
+{
+    parse_next_token(parser);
+
+    ASTNode *node = parse_expression(parser, PREC_LOWEST);
+
+    if (!expect_peek(parser, TOKEN_RPAREN)) {
+        return NULL;
+    }
+
+    return node;
+}
+
+ASTNode *parse_block_statement(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_BLOCK_STMT;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.block_stmt = make_ast_node_ptr_array_list(parser->allocator);
+
+    parse_next_token(parser);
+
+    while (!compare_curr_token_type(parser, TOKEN_RBRACE) && !compare_curr_token_type(parser, TOKEN_EOF)) {
+        ASTNode *statement = parse_statement(parser);
+        if (statement != NULL) {
+            add_ast_node_ptr_to_list(node->data.block_stmt, statement);
+        }
+        parse_next_token(parser);
+    }
+
+    if (!compare_curr_token_type(parser, TOKEN_RBRACE)) {
+        report_unterminated_block_error(parser);
+        return NULL;
+    }
+
+    return node;
+}
+
+ASTNode *parse_if_expression(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_IF_EXPR;
+    strcpy(node->token_literal, parser->curr_token.literal);
+
+    if (!expect_peek(parser, TOKEN_LPAREN)) {
+        return NULL;
+    }
+
+    parse_next_token(parser);
+    node->data.if_expr.condition = parse_expression(parser, PREC_LOWEST);
+    if (node->data.if_expr.condition == NULL) {
+        return NULL;
+    }
+
+    if (!expect_peek(parser, TOKEN_RPAREN) || !expect_peek(parser, TOKEN_LBRACE)) {
+        return NULL;
+    }
+
+    node->data.if_expr.consequence = parse_block_statement(parser);
+    if (node->data.if_expr.consequence == NULL) {
+        return NULL;
+    }
+
+    if (compare_peek_token_type(parser, TOKEN_ELSE)) {
+        parse_next_token(parser);
+
+        if (!expect_peek(parser, TOKEN_LBRACE)) {
+            return NULL;
+        }
+
+        node->data.if_expr.alternative = parse_block_statement(parser);
+        if (node->data.if_expr.alternative == NULL) {
+            return NULL;
+        }
+    }
+
+    return node;
+}
+
+// The peek token is always the last one lexed, so it ends where the lexer stands
+static const char *end_of_peek_token(Parser *parser)
+{
+    return &parser->lexer.input[parser->lexer.position];
+}
+
+// Moves past the body of a function by matching braces, starting on its opening brace and
+// stopping on the closing one. Returns the end of the closing brace, or NULL if there is none.
+// Nothing inside is parsed, so errors there only show up once the function is compiled.
+static const char *skip_function_body(Parser *parser)
+{
+    int depth = 1;
+    for (;;) {
+        switch (parser->peek_token.type) {
+        case TOKEN_LBRACE:
+            depth++;
+            break;
+        case TOKEN_RBRACE:
+            depth--;
+            break;
+        case TOKEN_EOF:
+            parse_next_token(parser);
+            report_unterminated_block_error(parser);
+            return NULL;
+        default:
+            break;
+        }
+        const char *end = end_of_peek_token(parser);
+        parse_next_token(parser);
+        if (depth == 0) {
+            return end;
+        }
+    }
+}
+
+static ASTNode *make_function_node(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_FUNCTION_LITERAL;
+    strcpy(node->token_literal, "fn");
+    node->data.function_literal.parameters = make_ast_node_ptr_array_list(parser->allocator);
+    return node;
+}
+
+// Parses a function from its opening parenthesis, the current token, which starts at `start`
+static ASTNode *parse_parameters_and_body(Parser *parser, ASTNode *node, const char *start)
+{
+    if (!parse_function_parameters(parser, node->data.function_literal.parameters)) {
+        return NULL;
+    }
+
+    if (!expect_peek(parser, TOKEN_LBRACE)) {
+        return NULL;
+    }
+
+    // Functions nested in a skipped body are parsed along with it, as they may capture its variables
+    if (parser->lazy_functions) {
+        const char *end = skip_function_body(parser);
+        if (end == NULL) {
+            return NULL;
+        }
+        node->data.function_literal.source = (StringSpan) { .start = start, .length = (uint32_t)(end - start) };
+        return node;
+    }
+
+    node->data.function_literal.body = parse_block_statement(parser);
+    if (node->data.function_literal.body == NULL) {
+        return NULL;
+    }
+
+    return node;
+}
+
+ASTNode *parse_function_literal(Parser *parser)
+{
+    ASTNode *node = make_function_node(parser);
+
+    // The opening parenthesis has just been lexed
+    const char *start = end_of_peek_token(parser) - 1;
+    if (!expect_peek(parser, TOKEN_LPAREN)) {
+        return NULL;
+    }
+
+    return parse_parameters_and_body(parser, node, start);
+}
+
+// Parses a function skipped in lazy mode from the source it kept, see FunctionLiteral. That
+// starts with the opening parenthesis, so it is the current token of a new parser.
+ASTNode *parse_function_source(Parser *parser)
+{
+    return parse_parameters_and_body(parser, make_function_node(parser), parser->lexer.input);
+}
+
+bool parse_function_parameters(Parser *parser, ASTNodePtrArrayList *parameters)
+{
+    if (compare_peek_token_type(parser, TOKEN_RPAREN)) {
+        parse_next_token(parser);
+        return TRUE;
+    }
+
+    if (!expect_peek(parser, TOKEN_IDENT)) {
+        return FALSE;
+    }
+    add_ast_node_ptr_to_list(parameters, parse_identifier(parser));
+
+    while (compare_peek_token_type(parser, TOKEN_COMMA)) {
+        parse_next_token(parser);
+        if (!expect_peek(parser, TOKEN_IDENT)) {
+            return FALSE;
+        }
+        add_ast_node_ptr_to_list(parameters, parse_identifier(parser));
+    }
+
+    return expect_peek(parser, TOKEN_RPAREN);
+}
+
+ASTNode *parse_call_expression(Parser *parser, ASTNode *function)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_CALL_EXPR;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.call_expr.function = function;
+    node->data.call_expr.arguments = make_ast_node_ptr_array_list(parser->allocator);
+
+    if (!parse_call_arguments(parser, node->data.call_expr.arguments)) {
+        return NULL;
+    }
+
+    return node;
+}
+
+bool parse_call_arguments(Parser *parser, ASTNodePtrArrayList *arguments)
+{
+    return parse_expression_list(parser, arguments, TOKEN_RPAREN);
+}
+
+// Parses comma separated expressions up to and including `end`, starting on the token before the first
+bool parse_expression_list(Parser *parser, ASTNodePtrArrayList *list, TokenType end)
+{
+    if (compare_peek_token_type(parser, end)) {
+        parse_next_token(parser);
+        return TRUE;
+    }
+
+    parse_next_token(parser);
+    ASTNode *element = parse_expression(parser, PREC_LOWEST);
+    if (element == NULL) {
+        return FALSE;
+    }
+    add_ast_node_ptr_to_list(list, element);
+
+    while (compare_peek_token_type(parser, TOKEN_COMMA)) {
+        parse_next_token(parser);
+        parse_next_token(parser);
+        element = parse_expression(parser, PREC_LOWEST);
+        if (element == NULL) {
+            return FALSE;
+        }
+        add_ast_node_ptr_to_list(list, element);
+    }
+
+    return expect_peek(parser, end);
+}
+
+ASTNode *parse_array_literal(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_ARRAY_LITERAL;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.array_literal = make_ast_node_ptr_array_list(parser->allocator);
+
+    if (!parse_expression_list(parser, node->data.array_literal, TOKEN_RBRACKET)) {
+        return NULL;
+    }
+
+    return node;
+}
+
+// `{` only starts a block after `if`, `else`, `fn` and `while`, anywhere else it is a hash literal
+ASTNode *parse_hash_literal(Parser *parser)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_HASH_LITERAL;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.hash_literal.keys = make_ast_node_ptr_array_list(parser->allocator);
+    node->data.hash_literal.values = make_ast_node_ptr_array_list(parser->allocator);
+
+    while (!compare_peek_token_type(parser, TOKEN_RBRACE)) {
+        parse_next_token(parser);
+        ASTNode *key = parse_expression(parser, PREC_LOWEST);
+        if (key == NULL || !expect_peek(parser, TOKEN_COLON)) {
+            return NULL;
+        }
+
+        parse_next_token(parser);
+        ASTNode *value = parse_expression(parser, PREC_LOWEST);
+        if (value == NULL) {
+            return NULL;
+        }
+        add_ast_node_ptr_to_list(node->data.hash_literal.keys, key);
+        add_ast_node_ptr_to_list(node->data.hash_literal.values, value);
+
+        if (!compare_peek_token_type(parser, TOKEN_RBRACE) && !expect_peek(parser, TOKEN_COMMA)) {
+            return NULL;
+        }
+    }
+
+    if (!expect_peek(parser, TOKEN_RBRACE)) {
+        return NULL;
+    }
+
+    return node;
+}
+
+ASTNode *parse_index_expression(Parser *parser, ASTNode *left)
+{
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_INDEX_EXPR;
+    strcpy(node->token_literal, parser->curr_token.literal);
+    node->data.index_expr.left = left;
+
+    parse_next_token(parser);
+    node->data.index_expr.index = parse_expression(parser, PREC_LOWEST);
+    if (node->data.index_expr.index == NULL || !expect_peek(parser, TOKEN_RBRACKET)) {
+        return NULL;
+    }
 
     return node;
 }
@@ -293,10 +753,12 @@ Precedence get_peek_precedence(Parser *parser)
     return PREC_LOWEST;
 }
 
-ErrorArrayList *make_error_arraylist(void)
+ErrorArrayList *make_error_arraylist(Allocator *allocator)
 {
-    ErrorArrayList *list = malloc(sizeof(ErrorArrayList));
-    list->array = calloc(INITIAL_ERROR_CAPACITY, sizeof(char *));
+    allocator = resolve_allocator(allocator);
+    ErrorArrayList *list = allocate(allocator, sizeof(ErrorArrayList));
+    list->allocator = allocator;
+    list->array = allocate_zeroed(allocator, INITIAL_ERROR_CAPACITY * sizeof(char *));
     list->size = 0;
     list->capacity = INITIAL_ERROR_CAPACITY;
     return list;
@@ -305,8 +767,8 @@ ErrorArrayList *make_error_arraylist(void)
 void add_error_to_arraylist(ErrorArrayList *list, char *error)
 {
     if (list->size == list->capacity) {
+        list->array = (char **)realloc_backing_array(list->allocator, list->array, list->size, list->capacity, list->capacity * 2, sizeof(char *));
         list->capacity *= 2;
-        list->array = (char **)realloc_backing_array(list->array, list->size, list->capacity, sizeof(char *));
     }
     list->array[list->size++] = error;
 }
@@ -320,10 +782,10 @@ char *get_error_from_arraylist(ErrorArrayList *list, size_t index)
 void cleanup_error_arraylist(ErrorArrayList *list)
 {
     for (size_t i = 0; i < list->size; i++) {
-        free(list->array[i]);
+        deallocate_str(list->allocator, list->array[i]);
     }
-    free(list->array);
-    free(list);
+    deallocate(list->allocator, list->array, list->capacity * sizeof(char *));
+    deallocate(list->allocator, list, sizeof(ErrorArrayList));
 }
 
 inline bool compare_curr_token_type(Parser *parser, TokenType tok_type)
@@ -350,7 +812,7 @@ inline bool expect_peek(Parser *parser, TokenType tok_type)
 inline void report_peek_error(Parser *parser, TokenType tok_type)
 {
     size_t total_len = snprintf(NULL, 0, "Expected next token to be %s, got %s instead", token_type_to_str(tok_type), token_type_to_str(parser->peek_token.type));
-    char *error = malloc(total_len + 1); // We add one for sentinel character '\0'
+    char *error = allocate(parser->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
     sprintf(error, "Expected next token to be %s, got %s instead", token_type_to_str(tok_type), token_type_to_str(parser->peek_token.type));
     add_error_to_arraylist(parser->errors, error);
 }
@@ -358,7 +820,28 @@ inline void report_peek_error(Parser *parser, TokenType tok_type)
 inline void report_no_prefix_error(Parser *parser, TokenType tok_type)
 {
     size_t total_len = snprintf(NULL, 0, "No prefix parse function for %s found", token_type_to_str(tok_type));
-    char *error = malloc(total_len + 1); // We add one for sentinel character '\0'
+    char *error = allocate(parser->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
     sprintf(error, "No prefix parse function for %s found", token_type_to_str(tok_type));
     add_error_to_arraylist(parser->errors, error);
 }
+
+// The lexer leaves the offending source text in the literal of illegal tokens
+void report_illegal_token_error(Parser *parser)
+{
+    const char *literal = parser->curr_token.literal;
+    const char *format = "Illegal token %s found";
+    if (literal[0] == '"') {
+        format = "Unterminated string literal %s";
+    } else if (literal[0] == '\\') {
+        format = "Unknown escape sequence %s in string literal";
+    }
+    size_t total_len = snprintf(NULL, 0, format, literal);
+    char *error = allocate(parser->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
+    sprintf(error, format, literal);
+    add_error_to_arraylist(parser->errors, error);
+}
+
+void report_unterminated_block_error(Parser *parser)
+{
+    add_error_to_arraylist(parser->errors, allocate_str(parser->errors->allocator, "Expected } before end of input"));
+}
@@ -14,12 +14,14 @@ typedef enum Precedence {
     PREC_PRODUCT, // *
     PREC_PREFIX, // -X or !X
     PREC_CALL, // myFunction(X)
+    PREC_INDEX, // array[index]
 } Precedence;
 
 typedef struct ErrorArrayList {
-    char **array;
+    char **array; // Messages are owned by the list and allocated from its allocator
     size_t size;
     size_t capacity;
+    Allocator *allocator;
 } ErrorArrayList;
 
 typedef struct Parser {
@@ -28,6 +30,10 @@ typedef struct Parser {
     Token peek_token;
     ASTNodeArrayList *backing_node_list;
     ErrorArrayList *errors;
+    Allocator *allocator; // The parser, its node list, errors and the programs it returns all come from here
+    // Only keep the source of function bodies, to be parsed and compiled when first called along
+    // with the functions inside them. Off unless set after make_parser.
+    bool lazy_functions;
 } Parser;
 
 typedef ASTNode *(*PrefixFn)(Parser *parser);
@@ -44,7 +50,8 @@ typedef struct PrecedenceEntry {
     Precedence precedence;
 } PrecedenceEntry;
 
-extern Parser *make_parser(char *input);
+extern Parser *make_parser(char *input, Allocator *allocator);
+extern Parser *make_span_parser(char *input, size_t length, Allocator *allocator);
 extern void cleanup_parser(Parser *parser);
 extern void parse_next_token(Parser *parser);
 
@@ -53,20 +60,38 @@ extern ASTNode *parse_statement(Parser *parser);
 extern ASTNode *parse_let_statement(Parser *parser);
 extern ASTNode *parse_return_statement(Parser *parser);
 extern ASTNode *parse_expression_statement(Parser *parser);
+extern ASTNode *parse_while_statement(Parser *parser);
+extern ASTNode *parse_loop_control_statement(Parser *parser);
 
 extern ASTNode *parse_expression(Parser *parser, Precedence precedence);
 extern ASTNode *parse_identifier(Parser *parser);
+extern bool parse_integer_value(Parser *parser, int64_t *value);
+extern bool parse_float_value(Parser *parser, double *value);
 extern ASTNode *parse_integer_literal(Parser *parser);
+extern ASTNode *parse_float_literal(Parser *parser);
+extern ASTNode *parse_string_literal(Parser *parser);
 extern ASTNode *parse_boolean(Parser *parser);
 extern ASTNode *parse_prefix_expression(Parser *parser);
 extern ASTNode *parse_infix_expression(Parser *parser, ASTNode *left);
+extern ASTNode *parse_grouped_expression(Parser *parser);
+extern ASTNode *parse_block_statement(Parser *parser);
+extern ASTNode *parse_if_expression(Parser *parser);
+extern ASTNode *parse_function_literal(Parser *parser);
+extern ASTNode *parse_function_source(Parser *parser);
+extern bool parse_function_parameters(Parser *parser, ASTNodePtrArrayList *parameters);
+extern ASTNode *parse_call_expression(Parser *parser, ASTNode *function);
+extern bool parse_call_arguments(Parser *parser, ASTNodePtrArrayList *arguments);
+extern bool parse_expression_list(Parser *parser, ASTNodePtrArrayList *list, TokenType end);
+extern ASTNode *parse_array_literal(Parser *parser);
+extern ASTNode *parse_hash_literal(Parser *parser);
+extern ASTNode *parse_index_expression(Parser *parser, ASTNode *left);
 
 extern PrefixFn get_prefix_fn(TokenType type);
 extern InfixFn get_infix_fn(TokenType type);
 extern Precedence get_current_precedence(Parser *parser);
 extern Precedence get_peek_precedence(Parser *parser);
 
-extern ErrorArrayList *make_error_arraylist(void);
+extern ErrorArrayList *make_error_arraylist(Allocator *allocator);
 extern void add_error_to_arraylist(ErrorArrayList *list, char *error);
 extern char *get_error_from_arraylist(ErrorArrayList *list, size_t index);
 extern void cleanup_error_arraylist(ErrorArrayList *list);
@@ -76,5 +101,7 @@ extern inline bool compare_peek_token_type(Parser *parser, TokenType tok_type);
 extern inline bool expect_peek(Parser *parser, TokenType tok_type);
 extern inline void report_peek_error(Parser *parser, TokenType tok_type);
 extern inline void report_no_prefix_error(Parser *parser, TokenType tok_type);
+extern void report_unterminated_block_error(Parser *parser);
+extern void report_illegal_token_error(Parser *parser);
 
 #endif // PARSER_H
@@ -0,0 +1,103 @@
+#include "allocator.h"
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "parser.h"
+#include "vm.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Starting a program that defines a library of functions and calls only a few of them, parsing
+// every body up front against skipping the bodies until their first call. The AST is allocated
+// from an arena to count its bytes.
+
+#define LIBRARY_FUNCTIONS 10000
+#define CALLED_FUNCTIONS 10
+#define RUNS 5
+
+static char *make_library(void)
+{
+    // Calls spread over the library
+    char calls[CALLED_FUNCTIONS * 32 + 32];
+    size_t length = snprintf(calls, sizeof(calls), "let total = 0");
+    for (int i = 0; i < CALLED_FUNCTIONS; i++) {
+        char name[BENCH_IDENTIFIER_SIZE];
+        bench_identifier(i * (LIBRARY_FUNCTIONS / CALLED_FUNCTIONS), name);
+        length += snprintf(calls + length, sizeof(calls) - length, " + lib%s(1, 2)", name);
+    }
+    snprintf(calls + length, sizeof(calls) - length, "; total");
+    return bench_library_source(LIBRARY_FUNCTIONS, calls);
+}
+
+typedef struct Timings {
+    uint64_t parse;
+    uint64_t compile;
+    uint64_t run;
+    size_t ast_bytes;
+    Value result;
+} Timings;
+
+static Timings bench_startup(char *input, bool lazy)
+{
+    Timings timings;
+    Arena *arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    uint64_t start = now_ns();
+    Parser *parser = make_parser(input, &arena->allocator);
+    parser->lazy_functions = lazy;
+    Program *program = parse_program(parser);
+    timings.parse = now_ns() - start;
+    assert(parser->errors->size == 0);
+    timings.ast_bytes = arena->bytes_allocated;
+
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    start = now_ns();
+    FunctionProto *main = compile_program(compiler, program);
+    timings.compile = now_ns() - start;
+    assert(main != NULL);
+
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = FALSE;
+    start = now_ns();
+    VMResult result = run_vm(vm, main);
+    timings.run = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+    timings.result = get_last_popped(vm);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_arena(arena);
+    return timings;
+}
+
+static void print_timings(const char *label, char *input, bool lazy)
+{
+    Timings best = { .parse = UINT64_MAX, .compile = UINT64_MAX, .run = UINT64_MAX };
+    for (int i = 0; i < RUNS; i++) {
+        Timings timings = bench_startup(input, lazy);
+        best.parse = timings.parse < best.parse ? timings.parse : best.parse;
+        best.compile = timings.compile < best.compile ? timings.compile : best.compile;
+        best.run = timings.run < best.run ? timings.run : best.run;
+        best.ast_bytes = timings.ast_bytes;
+        best.result = timings.result;
+    }
+    assert(IS_INT(best.result));
+    printf("%-8s %10.2f %10.2f %10.2f %10.2f %12.1f %10" PRId64 "\n", label, best.parse / 1e6, best.compile / 1e6, best.run / 1e6,
+        (best.parse + best.compile + best.run) / 1e6, best.ast_bytes / 1048576.0, AS_INT(best.result));
+}
+
+int main(void)
+{
+    char *input = make_library();
+    printf("%d functions, %zu bytes of source, %d of them called\n", LIBRARY_FUNCTIONS, strlen(input), CALLED_FUNCTIONS);
+    printf("%-8s %10s %10s %10s %10s %12s %10s\n", "parsing", "parse ms", "compile ms", "run ms", "total ms", "AST MiB", "result");
+    print_timings("eager", input, FALSE);
+    print_timings("lazy", input, TRUE);
+    free(input);
+    return 0;
+}
@@ -2,8 +2,11 @@
 #include "globals.h"
 #include "lexer.h"
 #include "parser.h"
+#include "str_utils.h"
 #include "test_utils.h"
 #include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
 #define ASSERT_LITERAL_EXPRESSION_BOOL(expr, expected_value)                                                                                                                  \
@@ -48,8 +51,8 @@
     do {                                                                                                                                   \
         ASSERT((expr)->type == NODE_LITERAL, "Expected: node of type LITERAL\nGot: node of type %d", (expr)->type);                        \
         char *val = #expected_value;                                                                                                       \
-        ASSERT(COMPARE_LITERAL_VALUE(expr->data.literal, LITERAL_STRING, val), "Incorrect literal string value.\nExpected: %s\nGot: %s\n", \
-            val, ACCESS_STRING(expr->data.literal));                                                                                       \
+        ASSERT(COMPARE_LITERAL_VALUE(expr->data.literal, LITERAL_STRING, val), "Incorrect literal string value.\nExpected: %s\nGot: %.*s\n", \
+            val, (int)ACCESS_STRING(expr->data.literal).length, ACCESS_STRING(expr->data.literal).start);                                    \
         ASSERT(strcmp(expr->token_literal, val) == 0, "Invalid token literal.\nExpected: %s\nGot: %s\n", val, expr->token_literal);        \
     } while (0)
 
@@ -120,6 +123,13 @@ void assert_identifier(ASTNode *expr, char *val)
     assert(strcmp(expr->token_literal, val) == 0);
 }
 
+void assert_expression_str(ASTNode *expr, char *expected)
+{
+    char *actual = node_to_str(expr);
+    ASSERT(strcmp(actual, expected) == 0, "Invalid expression.\nExpected: %s\nGot: %s", expected, actual);
+    free(actual);
+}
+
 void assert_let_statement(ASTNode *expr, char *name)
 {
     ASSERT(strcmp(expr->token_literal, "let") == 0, "Got invalid token literal in let expression.\n\nExpected: %s\nGot: %s", "let", expr->token_literal);
@@ -137,7 +147,7 @@ TEST_CASE(let_statements)
     int num_tests = sizeof(tests) / sizeof(tests[0]);
 
     for (int i = 0; i < num_tests; i++) {
-        Parser *parser = make_parser(tests[i].input);
+        Parser *parser = make_parser(tests[i].input, NULL);
         Program *program = parse_program(parser);
 
         check_parser_errors(parser);
@@ -162,7 +172,7 @@ TEST_CASE(return_statements)
           "return 10;\n"
           "return 993322;\n";
 
-    Parser *parser = make_parser(input);
+    Parser *parser = make_parser(input, NULL);
     Program *program = parse_program(parser);
 
     check_parser_errors(parser);
@@ -185,7 +195,7 @@ TEST_CASE(identifier_expressions)
     const char input[]
         = "foobar;\n";
 
-    Parser *parser = make_parser(input);
+    Parser *parser = make_parser(input, NULL);
     Program *program = parse_program(parser);
 
     check_parser_errors(parser);
@@ -210,7 +220,7 @@ TEST_CASE(integer_literal_expressions)
     const char input[]
         = "10;\n";
 
-    Parser *parser = make_parser(input);
+    Parser *parser = make_parser(input, NULL);
     Program *program = parse_program(parser);
 
     check_parser_errors(parser);
@@ -239,7 +249,7 @@ TEST_CASE(boolean_literal_expressions)
           "let foobar = true;"
           "let barfoo = false;";
 
-    Parser *parser = make_parser(input);
+    Parser *parser = make_parser(input, NULL);
     Program *program = parse_program(parser);
 
     check_parser_errors(parser);
@@ -256,8 +266,8 @@ TEST_CASE(boolean_literal_expressions)
     ASSERT_LITERAL_EXPRESSION_BOOL(statement->data.expr_stmt, FALSE);
 
     statement = get_nth_statement(program, 2);
-    assert(statement->type == NODE_EXPR_STMT);
-    ASSERT_INFIX_EXPRESSION(statement->data.expr_stmt, "foobar", "=", TRUE, IDENTIFIER, BOOL);
+    assert(statement->type == NODE_LET_STMT);
+    assert_let_statement(statement, "foobar");
 
     //     statement = get_nth_statement(program, 3);
     // ASSERT_INFIX_EXPRESSION_IDENTIFIER(statement, TRUE);
@@ -280,7 +290,7 @@ TEST_CASE(parsing_prefix_operators)
     size_t test_count = sizeof(prefix_tests) / sizeof(prefix_tests[0]);
 
     for (size_t i = 0; i < test_count; i++) {
-        Parser *parser = make_parser(prefix_tests[i].input);
+        Parser *parser = make_parser(prefix_tests[i].input, NULL);
         Program *program = parse_program(parser);
 
         check_parser_errors(parser);
@@ -322,7 +332,7 @@ TEST_CASE(parsing_infix_operators)
     size_t test_count = sizeof(infix_tests) / sizeof(infix_tests[0]);
 
     for (size_t i = 0; i < test_count; i++) {
-        Parser *parser = make_parser(infix_tests[i].input);
+        Parser *parser = make_parser(infix_tests[i].input, NULL);
         Program *program = parse_program(parser);
 
         check_parser_errors(parser);
@@ -361,7 +371,18 @@ TEST_CASE(operator_precedence_parsing)
         { "3 + 4; -5 * 5", "(3 + 4)((-5) * 5)" },
         { "5 > 4 == 3 < 4", "((5 > 4) == (3 < 4))" },
         { "5 < 4 != 3 > 4", "((5 < 4) != (3 > 4))" },
-        { "3 + 4 * 5 == 3 * 1 + 4 * 5", "((3 + (4 * 5)) == ((3 * 1) + (4 * 5)))" }
+        { "3 + 4 * 5 == 3 * 1 + 4 * 5", "((3 + (4 * 5)) == ((3 * 1) + (4 * 5)))" },
+        { "1 + (2 + 3) + 4", "((1 + (2 + 3)) + 4)" },
+        { "(5 + 5) * 2", "((5 + 5) * 2)" },
+        { "2 / (5 + 5)", "(2 / (5 + 5))" },
+        { "-(5 + 5)", "(-(5 + 5))" },
+        { "!(true == true)", "(!(true == true))" },
+        { "a + add(b * c) + d", "((a + add((b * c))) + d)" },
+        { "add(a, b, 1, 2 * 3, 4 + 5, add(6, 7 * 8))", "add(a, b, 1, (2 * 3), (4 + 5), add(6, (7 * 8)))" },
+        { "add(a + b + c * d / f + g)", "add((((a + b) + ((c * d) / f)) + g))" },
+        { "a * [1, 2, 3, 4][b * c] * d", "((a * ([1, 2, 3, 4][(b * c)])) * d)" },
+        { "add(a * b[2], b[1], 2 * [1, 2][1])", "add((a * (b[2])), (b[1]), (2 * ([1, 2][1])))" },
+        { "-h[f(x)][0]", "(-((h[f(x)])[0]))" }
     };
 
     size_t num_tests = sizeof(tests) / sizeof(tests[0]);
@@ -369,7 +390,7 @@ TEST_CASE(operator_precedence_parsing)
     int failed = 0;
 
     for (size_t i = 0; i < num_tests; i++) {
-        Parser *parser = make_parser(tests[i].input);
+        Parser *parser = make_parser(tests[i].input, NULL);
         Program *program = parse_program(parser);
 
         check_parser_errors(parser);
@@ -384,6 +405,7 @@ TEST_CASE(operator_precedence_parsing)
             printf("Test failed: input='%s', expected='%s', got='%s'\n",
                 tests[i].input, tests[i].expected, actual);
         }
+        free(actual);
 
         cleanup_program(program);
         cleanup_parser(parser);
@@ -393,4 +415,508 @@ TEST_CASE(operator_precedence_parsing)
     printf("Tests failed: %d\n", failed);
 }
 
+TEST_CASE(let_statement_values)
+{
+    struct {
+        char *input;
+        char *expected_identifier;
+        char *expected_value;
+    } tests[] = {
+        { "let x = 5;", "x", "5" },
+        { "let y = true;", "y", "true" },
+        { "let foobar = y;", "foobar", "y" },
+        { "let z = 1 + 2 * x", "z", "(1 + (2 * x))" },
+    };
+
+    size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+
+        check_parser_errors(parser);
+
+        assert(program->size == 1);
+
+        ASTNode *statement = get_nth_statement(program, 0);
+        assert(statement->type == NODE_LET_STMT);
+        assert_let_statement(statement, tests[i].expected_identifier);
+
+        char *value_str = node_to_str(statement->data.let_stmt.right);
+        ASSERT(strcmp(value_str, tests[i].expected_value) == 0, "Invalid let value.\nExpected: %s\nGot: %s", tests[i].expected_value, value_str);
+        free(value_str);
+
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(return_statement_values)
+{
+    struct {
+        char *input;
+        char *expected_value;
+    } tests[] = {
+        { "return 5;", "5" },
+        { "return true;", "true" },
+        { "return foobar;", "foobar" },
+        { "return a * -b", "(a * (-b))" },
+    };
+
+    size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+
+        check_parser_errors(parser);
+
+        assert(program->size == 1);
+
+        ASTNode *statement = get_nth_statement(program, 0);
+        assert(statement->type == NODE_RETURN_STMT);
+
+        char *value_str = node_to_str(statement->data.return_stmt);
+        ASSERT(strcmp(value_str, tests[i].expected_value) == 0, "Invalid return value.\nExpected: %s\nGot: %s", tests[i].expected_value, value_str);
+        free(value_str);
+
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(if_expression)
+{
+    Parser *parser = make_parser("if (x < y) { x }", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 1);
+
+    ASTNode *statement = get_nth_statement(program, 0);
+    assert(statement->type == NODE_EXPR_STMT);
+
+    ASTNode *if_expr = statement->data.expr_stmt;
+    assert(if_expr->type == NODE_IF_EXPR);
+    assert_expression_str(if_expr->data.if_expr.condition, "(x < y)");
+
+    ASTNode *consequence = if_expr->data.if_expr.consequence;
+    assert(consequence->type == NODE_BLOCK_STMT);
+    assert(consequence->data.block_stmt->size == 1);
+    assert(consequence->data.block_stmt->array[0]->type == NODE_EXPR_STMT);
+    assert_identifier(consequence->data.block_stmt->array[0]->data.expr_stmt, "x");
+
+    assert(if_expr->data.if_expr.alternative == NULL);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(if_else_expression)
+{
+    Parser *parser = make_parser("if (x < y) { x } else { y }", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 1);
+
+    ASTNode *if_expr = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(if_expr->type == NODE_IF_EXPR);
+    assert_expression_str(if_expr->data.if_expr.condition, "(x < y)");
+
+    ASTNode *consequence = if_expr->data.if_expr.consequence;
+    assert(consequence->data.block_stmt->size == 1);
+    assert_identifier(consequence->data.block_stmt->array[0]->data.expr_stmt, "x");
+
+    ASTNode *alternative = if_expr->data.if_expr.alternative;
+    assert(alternative != NULL);
+    assert(alternative->type == NODE_BLOCK_STMT);
+    assert(alternative->data.block_stmt->size == 1);
+    assert_identifier(alternative->data.block_stmt->array[0]->data.expr_stmt, "y");
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(function_literal_parsing)
+{
+    Parser *parser = make_parser("fn(x, y) { x + y; }", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 1);
+
+    ASTNode *function = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(function->type == NODE_FUNCTION_LITERAL);
+
+    ASTNodePtrArrayList *parameters = function->data.function_literal.parameters;
+    assert(parameters->size == 2);
+    assert_identifier(parameters->array[0], "x");
+    assert_identifier(parameters->array[1], "y");
+
+    ASTNode *body = function->data.function_literal.body;
+    assert(body->type == NODE_BLOCK_STMT);
+    assert(body->data.block_stmt->size == 1);
+    assert_expression_str(body->data.block_stmt->array[0]->data.expr_stmt, "(x + y)");
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(function_parameter_parsing)
+{
+    struct {
+        char *input;
+        size_t expected_count;
+        char *expected_params[3];
+    } tests[] = {
+        { "fn() {};", 0, { NULL } },
+        { "fn(x) {};", 1, { "x" } },
+        { "fn(x, y, z) {};", 3, { "x", "y", "z" } },
+    };
+
+    size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+
+        check_parser_errors(parser);
+
+        ASTNode *function = get_nth_statement(program, 0)->data.expr_stmt;
+        assert(function->type == NODE_FUNCTION_LITERAL);
+        assert(function->data.function_literal.parameters->size == tests[i].expected_count);
+
+        for (size_t j = 0; j < tests[i].expected_count; j++) {
+            assert_identifier(function->data.function_literal.parameters->array[j], tests[i].expected_params[j]);
+        }
+
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(call_expression_parsing)
+{
+    Parser *parser = make_parser("add(1, 2 * 3, 4 + 5);", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 1);
+
+    ASTNode *call = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(call->type == NODE_CALL_EXPR);
+    assert_identifier(call->data.call_expr.function, "add");
+
+    ASTNodePtrArrayList *arguments = call->data.call_expr.arguments;
+    assert(arguments->size == 3);
+    assert_integer_literal(arguments->array[0], 1);
+    assert_expression_str(arguments->array[1], "(2 * 3)");
+    assert_expression_str(arguments->array[2], "(4 + 5)");
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(array_literal_parsing)
+{
+    Parser *parser = make_parser("[1, 2 * 2, 3 + 3]; []", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 2);
+
+    ASTNode *array = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(array->type == NODE_ARRAY_LITERAL);
+    assert(array->data.array_literal->size == 3);
+    assert_integer_literal(array->data.array_literal->array[0], 1);
+    assert_expression_str(array->data.array_literal->array[1], "(2 * 2)");
+    assert_expression_str(array->data.array_literal->array[2], "(3 + 3)");
+
+    ASTNode *empty = get_nth_statement(program, 1)->data.expr_stmt;
+    assert(empty->type == NODE_ARRAY_LITERAL && empty->data.array_literal->size == 0);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(hash_literal_parsing)
+{
+    Parser *parser = make_parser("{1: 2 + 3, true: f(x), 4 * 5: []}; {}", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 2);
+
+    ASTNode *hash = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(hash->type == NODE_HASH_LITERAL);
+    assert(hash->data.hash_literal.keys->size == 3 && hash->data.hash_literal.values->size == 3);
+    assert_expression_str(hash, "{1: (2 + 3), true: f(x), (4 * 5): []}");
+
+    ASTNode *empty = get_nth_statement(program, 1)->data.expr_stmt;
+    assert(empty->type == NODE_HASH_LITERAL && empty->data.hash_literal.keys->size == 0);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(index_expression_parsing)
+{
+    Parser *parser = make_parser("array[1 + 1]", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    ASTNode *index = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(index->type == NODE_INDEX_EXPR);
+    assert_identifier(index->data.index_expr.left, "array");
+    assert_expression_str(index->data.index_expr.index, "(1 + 1)");
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(string_literal_parsing)
+{
+    char input[] = "\"hello world\"; \"say \\\"hi\\\"\" + x";
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    ASTNode *literal = get_nth_statement(program, 0)->data.expr_stmt;
+    assert(literal->type == NODE_LITERAL && literal->data.literal.type == LITERAL_STRING);
+    assert(COMPARE_STRING(literal->data.literal, "hello world"));
+    assert(!literal->data.literal.value.string_value.escaped);
+    // The node refers to the source instead of a copy
+    assert(literal->data.literal.value.string_value.start == input + 1);
+
+    ASTNode *infix = get_nth_statement(program, 1)->data.expr_stmt;
+    assert(infix->data.infix_expr.left->data.literal.value.string_value.escaped);
+    assert_expression_str(infix, "(\"say \\\"hi\\\"\" + x)");
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+
+    struct {
+        char *input;
+        const char *error;
+    } tests[] = {
+        { "\"open", "Unterminated string literal \"open" },
+        { "let x = \"a\\0\"", "Unknown escape sequence \\0 in string literal" },
+        { "@", "Illegal token @ found" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        parser = make_parser(tests[i].input, NULL);
+        program = parse_program(parser);
+        ASSERT(parser->errors->size == 1 && strcmp(get_error_from_arraylist(parser->errors, 0), tests[i].error) == 0,
+            "Expected error '%s' for input '%s'", tests[i].error, tests[i].input);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(while_statement_parsing)
+{
+    Parser *parser = make_parser("while (i < n) { let i = i + 1; if (i == 5) { continue; } break; }", NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 1);
+
+    ASTNode *loop = get_nth_statement(program, 0);
+    assert(loop->type == NODE_WHILE_STMT);
+    assert_expression_str(loop->data.while_stmt.condition, "(i < n)");
+
+    ASTNodePtrArrayList *body = loop->data.while_stmt.body->data.block_stmt;
+    assert(body->size == 3);
+    assert(body->array[0]->type == NODE_LET_STMT);
+    ASTNode *consequence = body->array[1]->data.expr_stmt->data.if_expr.consequence;
+    assert(consequence->data.block_stmt->array[0]->type == NODE_CONTINUE_STMT);
+    assert(body->array[2]->type == NODE_BREAK_STMT);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+static void assert_source(ASTNode *function, const char *expected)
+{
+    StringSpan source = function->data.function_literal.source;
+    if (source.length != strlen(expected) || memcmp(source.start, expected, source.length) != 0) {
+        printf("Expected: %s\nGot: %.*s\n", expected, (int)source.length, source.start);
+        assert(1 != 1);
+    }
+}
+
+TEST_CASE(lazy_function_parsing)
+{
+    char *input = "let f = fn(x, y) { let g = fn() { \"}\" }; x + y }; f(1, 2); {\"k\": fn ( ) {}}";
+    Parser *parser = make_parser(input, NULL);
+    parser->lazy_functions = TRUE;
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+    assert(program->size == 3);
+
+    // Only the parameters are parsed, the rest is kept as source
+    ASTNode *function = get_nth_statement(program, 0)->data.let_stmt.right;
+    assert(function->type == NODE_FUNCTION_LITERAL && function->data.function_literal.body == NULL);
+    assert(function->data.function_literal.parameters->size == 2);
+    assert_identifier(function->data.function_literal.parameters->array[1], "y");
+    assert_source(function, "(x, y) { let g = fn() { \"}\" }; x + y }");
+    ASTNode *nested = get_nth_statement(program, 2)->data.expr_stmt->data.hash_literal.values->array[0];
+    assert_source(nested, "( ) {}");
+    char *str = program_to_str(program);
+    assert(strcmp(str, "let f = fn(x, y) {...};f(1, 2){\"k\": fn() {...}}") == 0);
+    free(str);
+
+    // Which is all it takes to parse the function later
+    StringSpan source = function->data.function_literal.source;
+    Parser *later = make_span_parser((char *)source.start, source.length, NULL);
+    function = parse_function_source(later);
+    check_parser_errors(later);
+    assert(function->data.function_literal.parameters->size == 2);
+    str = node_to_str(function);
+    assert(strcmp(str, "fn(x, y) let g = fn() \"}\";(x + y)") == 0);
+    free(str);
+    cleanup_parser(later);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+
+    // Braces still have to match
+    parser = make_parser("let f = fn() { if (x) { 1 }", NULL);
+    parser->lazy_functions = TRUE;
+    program = parse_program(parser);
+    assert(parser->errors->size == 1 && strcmp(get_error_from_arraylist(parser->errors, 0), "Expected } before end of input") == 0);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(parse_errors)
+{
+    char *inputs[] = {
+        "let = 5;",
+        "let x 5;",
+        "if (x { x }",
+        "fn(x, 1) { x }",
+        "add(1, 2",
+        "fn() { x",
+        "while x { x }",
+        "while (x) x",
+        "[1, 2",
+        "a[1",
+        "{1: 2, 3}",
+        "{1 2}",
+        "{1: 2 3: 4}",
+    };
+
+    size_t num_tests = sizeof(inputs) / sizeof(inputs[0]);
+
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(inputs[i], NULL);
+        Program *program = parse_program(parser);
+
+        ASSERT(parser->errors->size > 0, "Expected parse errors for input '%s'", inputs[i]);
+
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(integer_literals_are_64_bit)
+{
+    Parser *parser = make_parser("9223372036854775807", NULL);
+    Program *program = parse_program(parser);
+    ASSERT(parser->errors->size == 0, "Unexpected parse error: %s", get_error_from_arraylist(parser->errors, 0));
+    assert(program->array[0]->data.expr_stmt->data.literal.value.int_value == INT64_MAX);
+    cleanup_program(program);
+    cleanup_parser(parser);
+
+    // Larger integers have to be computed
+    struct {
+        char *input;
+        const char *error;
+    } tests[] = {
+        { "9223372036854775808", "Integer literal 9223372036854775808 does not fit in 64 bits" },
+        { "123456789012345678901234567890", "Integer literal 1234567890123456... does not fit in 64 bits" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        parser = make_parser(tests[i].input, NULL);
+        program = parse_program(parser);
+        ASSERT(parser->errors->size == 1 && strcmp(get_error_from_arraylist(parser->errors, 0), tests[i].error) == 0,
+            "Expected error '%s' for input '%s'", tests[i].error, tests[i].input);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(float_literals)
+{
+    struct {
+        char *input;
+        double expected;
+    } tests[] = {
+        { "1.5", 1.5 },
+        { "0.1", 0.1 },
+        { "25e-1", 2.5 },
+        { "1.7976931348623157e308", 1.7976931348623157e308 },
+        { "3.14159265358979323846264338327950288", 3.14159265358979323846264338327950288 },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+        check_parser_errors(parser);
+        ASTNode *literal = program->array[0]->data.expr_stmt;
+        assert(literal->type == NODE_LITERAL && literal->data.literal.type == LITERAL_FLOAT);
+        ASSERT(COMPARE_FLOAT(literal->data.literal, tests[i].expected), "Incorrect literal float value.\nExpected: %.17g\nGot: %.17g\n",
+            tests[i].expected, ACCESS_FLOAT(literal->data.literal));
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+
+    Parser *parser = make_parser("-1e309", NULL);
+    Program *program = parse_program(parser);
+    ASSERT(parser->errors->size == 1 && strcmp(get_error_from_arraylist(parser->errors, 0), "Float literal 1e309 is too large") == 0,
+        "Expected an error for too large a float");
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(node_pointers_survive_backing_list_growth)
+{
+    // Enough nodes to span several chunks of the parser's backing list
+    String *input = make_string(NULL);
+    for (size_t i = 0; i < 200; i++) {
+        copy_str_into_string(input, "let x = 1 + 2 * 3;");
+    }
+    char *input_str = get_str_from_string(input);
+    cleanup_string(input);
+
+    Parser *parser = make_parser(input_str, NULL);
+    Program *program = parse_program(parser);
+
+    check_parser_errors(parser);
+
+    assert(program->size == 200);
+    for (size_t i = 0; i < program->size; i++) {
+        ASTNode *statement = get_nth_statement(program, i);
+        assert_let_statement(statement, "x");
+
+        char *value_str = node_to_str(statement->data.let_stmt.right);
+        assert(strcmp(value_str, "(1 + (2 * 3))") == 0);
+        free(value_str);
+    }
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(input_str);
+}
+
 RUN_TESTS()
@@ -0,0 +1,578 @@
+#include "persistent.h"
+#include "bigint.h"
+#include "string_object.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_BUFFER_CAPACITY 64
+
+typedef Value (*ElementFn)(const void *source, size_t index);
+
+typedef struct Buffer {
+    char *array;
+    size_t size;
+    size_t capacity;
+} Buffer;
+
+static Node *make_node(uint32_t length, Allocator *allocator)
+{
+    Node *node = allocate(allocator, sizeof(Node) + length * sizeof(Value));
+    node->obj.type = OBJ_NODE;
+    node->length = length;
+    node->datamap = 0;
+    node->nodemap = 0;
+    return node;
+}
+
+// Copies `node`, which may be NULL, into a node of `length` slots. Slots the original does not
+// have start out null.
+static Node *copy_node(Node *node, uint32_t length, Allocator *allocator)
+{
+    Node *copy = make_node(length, allocator);
+    uint32_t kept = 0;
+    if (node != NULL) {
+        kept = node->length < length ? node->length : length;
+        memcpy(copy->slots, node->slots, kept * sizeof(Value));
+        copy->datamap = node->datamap;
+        copy->nodemap = node->nodemap;
+    }
+    for (uint32_t i = kept; i < length; i++) {
+        copy->slots[i] = NULL_VAL;
+    }
+    return copy;
+}
+
+// Arrays
+
+static Array *make_array_object(size_t size, uint32_t shift, bool packed, Node *root, Object *tail, Allocator *allocator)
+{
+    Array *array = allocate(allocator, sizeof(Array));
+    array->obj.type = OBJ_ARRAY;
+    array->count = size;
+    array->offset = 0;
+    array->size = size;
+    array->shift = shift;
+    array->packed = packed;
+    array->root = root;
+    array->tail = tail;
+    return array;
+}
+
+static Object *make_leaf(bool packed, uint32_t length, Allocator *allocator)
+{
+    if (!packed) {
+        return (Object *)make_node(length, allocator);
+    }
+    PackedNode *leaf = allocate(allocator, sizeof(PackedNode) + length * sizeof(int64_t));
+    leaf->obj.type = OBJ_PACKED_NODE;
+    leaf->length = length;
+    return (Object *)leaf;
+}
+
+static uint32_t leaf_length(Object *leaf)
+{
+    return leaf->type == OBJ_PACKED_NODE ? ((PackedNode *)leaf)->length : ((Node *)leaf)->length;
+}
+
+static Value leaf_get(Object *leaf, uint32_t index)
+{
+    return leaf->type == OBJ_PACKED_NODE ? INT_VAL(((PackedNode *)leaf)->elements[index]) : ((Node *)leaf)->slots[index];
+}
+
+static void leaf_set(Object *leaf, uint32_t index, Value element)
+{
+    if (leaf->type == OBJ_PACKED_NODE) {
+        ((PackedNode *)leaf)->elements[index] = AS_INT(element);
+    } else {
+        ((Node *)leaf)->slots[index] = element;
+    }
+}
+
+static size_t tail_offset(Array *array)
+{
+    return array->size - (array->tail == NULL ? 0 : leaf_length(array->tail));
+}
+
+// Copies the path from `parent`, `level` bits above the leaves, down to where the full leaf
+// starting at element `index` goes. Appending only ever extends the rightmost path.
+static Node *insert_leaf(Node *parent, uint32_t level, size_t index, Object *leaf, Allocator *allocator)
+{
+    uint32_t branch = (index >> level) & NODE_MASK;
+    Object *child = leaf;
+    if (level > NODE_BITS) {
+        Node *existing = parent != NULL && branch < parent->length ? AS_NODE(parent->slots[branch]) : NULL;
+        child = (Object *)insert_leaf(existing, level - NODE_BITS, index, leaf, allocator);
+    }
+    Node *copy = copy_node(parent, branch + 1, allocator);
+    copy->slots[branch] = OBJ_VAL(child);
+    return copy;
+}
+
+// Moves a full leaf into the trie, adding a level on top once the root is full
+static void push_leaf(Node **root, uint32_t *shift, size_t index, Object *leaf, Allocator *allocator)
+{
+    if (index == (size_t)1 << (*shift + NODE_BITS)) {
+        Node *new_root = make_node(1, allocator);
+        new_root->slots[0] = OBJ_VAL(*root);
+        *root = new_root;
+        *shift += NODE_BITS;
+    }
+    *root = insert_leaf(*root, *shift, index, leaf, allocator);
+}
+
+// Builds the trie bottom up, leaving the last 1 to NODE_WIDTH elements in the tail. Every element
+// must be a small integer if `packed` is set.
+static Value build_array(const void *source, ElementFn element_at, size_t count, bool packed, Allocator *allocator)
+{
+    Node *root = NULL;
+    uint32_t shift = NODE_BITS;
+    size_t index = 0;
+    for (; count - index > NODE_WIDTH; index += NODE_WIDTH) {
+        Object *leaf = make_leaf(packed, NODE_WIDTH, allocator);
+        for (uint32_t i = 0; i < NODE_WIDTH; i++) {
+            leaf_set(leaf, i, element_at(source, index + i));
+        }
+        push_leaf(&root, &shift, index, leaf, allocator);
+    }
+
+    Object *tail = NULL;
+    if (count > index) {
+        tail = make_leaf(packed, (uint32_t)(count - index), allocator);
+        for (uint32_t i = 0; i < count - index; i++) {
+            leaf_set(tail, i, element_at(source, index + i));
+        }
+    }
+    return OBJ_VAL(make_array_object(count, shift, packed, root, tail, allocator));
+}
+
+static Value element_of_values(const void *source, size_t index)
+{
+    return ((const Value *)source)[index];
+}
+
+static Value element_of_ints(const void *source, size_t index)
+{
+    return INT_VAL(((const int64_t *)source)[index]);
+}
+
+static Value element_of_array(const void *source, size_t index)
+{
+    return array_get((Array *)source, index);
+}
+
+static bool all_small_ints(const void *source, ElementFn element_at, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        if (!IS_INT(element_at(source, i))) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+Value make_array(const Value *elements, size_t count, Allocator *allocator)
+{
+    return build_array(elements, element_of_values, count, all_small_ints(elements, element_of_values, count), allocator);
+}
+
+Value make_packed_array(const int64_t *elements, size_t count, Allocator *allocator)
+{
+    return build_array(elements, element_of_ints, count, TRUE, allocator);
+}
+
+// The leaf or tail holding element `index` of the trie, which views offset their indices into
+static Object *leaf_of(Array *array, size_t index)
+{
+    if (index >= tail_offset(array)) {
+        return array->tail;
+    }
+    Node *node = array->root;
+    for (uint32_t level = array->shift; level > NODE_BITS; level -= NODE_BITS) {
+        node = AS_NODE(node->slots[(index >> level) & NODE_MASK]);
+    }
+    return AS_OBJ(node->slots[(index >> NODE_BITS) & NODE_MASK]);
+}
+
+Value array_get(Array *array, size_t index)
+{
+    // Leaves hold NODE_WIDTH elements and the tail starts right after one
+    index += array->offset;
+    return leaf_get(leaf_of(array, index), index & NODE_MASK);
+}
+
+Value array_push(Array *array, Value element, Allocator *allocator)
+{
+    bool packed = array->packed && IS_INT(element);
+    if (packed != array->packed || array->offset + array->count != array->size) {
+        array = AS_ARRAY(build_array(array, element_of_array, array->count, packed, allocator));
+    }
+    Node *root = array->root;
+    uint32_t shift = array->shift;
+    Object *tail;
+    uint32_t length = array->tail == NULL ? 0 : leaf_length(array->tail);
+    if (length < NODE_WIDTH) {
+        tail = make_leaf(array->packed, length + 1, allocator);
+        for (uint32_t i = 0; i < length; i++) {
+            leaf_set(tail, i, leaf_get(array->tail, i));
+        }
+        leaf_set(tail, length, element);
+    } else {
+        push_leaf(&root, &shift, tail_offset(array), array->tail, allocator);
+        tail = make_leaf(array->packed, 1, allocator);
+        leaf_set(tail, 0, element);
+    }
+    Array *pushed = make_array_object(array->size + 1, shift, array->packed, root, tail, allocator);
+    pushed->offset = array->offset;
+    pushed->count = array->count + 1;
+    return OBJ_VAL(pushed);
+}
+
+Value array_slice(Array *array, size_t start, size_t end, Allocator *allocator)
+{
+    end = end < array->count ? end : array->count;
+    start = start < end ? start : end;
+    Array *slice = make_array_object(array->size, array->shift, array->packed, array->root, array->tail, allocator);
+    slice->offset = array->offset + start;
+    slice->count = end - start;
+    return OBJ_VAL(slice);
+}
+
+size_t array_bound(Value bound, size_t count)
+{
+    if (IS_INT(bound)) {
+        return AS_INT(bound) < 0 ? 0 : (uint64_t)AS_INT(bound) < count ? (size_t)AS_INT(bound) : count;
+    }
+    return AS_BIGINT(bound)->negative ? 0 : count;
+}
+
+bool packed_array_each(Array *array, PackedLeafFn visit, void *context)
+{
+    size_t end = array->offset + array->count;
+    for (size_t index = array->offset; index < end;) {
+        PackedNode *leaf = (PackedNode *)leaf_of(array, index);
+        size_t from = index & NODE_MASK;
+        size_t to = end - index < leaf->length - from ? from + (end - index) : leaf->length;
+        if (!visit(leaf->elements + from, to - from, context)) {
+            return FALSE;
+        }
+        index += to - from;
+    }
+    return TRUE;
+}
+
+// Hashes
+
+static inline uint64_t mix(uint64_t x)
+{
+    // SplitMix64's finalizer, every input bit affects every branch of the trie
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9u;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebu;
+    return x ^ (x >> 31);
+}
+
+static uint64_t hash_key(Value key)
+{
+    if (IS_INT(key)) {
+        return mix((uint64_t)AS_INT(key));
+    }
+    if (IS_BOOL(key)) {
+        return mix(AS_BOOL(key) ? 0x9e3779b97f4a7c15u : 0x7f4a7c159e3779b9u);
+    }
+    if (IS_STRING(key)) {
+        return mix(string_hash(key));
+    }
+    BigInt *bigint = AS_BIGINT(key);
+    uint64_t hash = bigint->negative;
+    for (uint32_t i = 0; i < bigint->num_limbs; i++) {
+        hash = mix(hash ^ bigint->limbs[i]);
+    }
+    return hash;
+}
+
+static bool keys_equal(Value a, Value b)
+{
+    if (a.type != b.type) {
+        return FALSE;
+    }
+    switch (a.type) {
+    case VAL_INT:
+        return AS_INT(a) == AS_INT(b);
+    case VAL_BOOL:
+        return AS_BOOL(a) == AS_BOOL(b);
+    default:
+        if (IS_STRING(a) && IS_STRING(b)) {
+            return strings_equal(a, b);
+        }
+        if (AS_OBJ(a)->type != AS_OBJ(b)->type) {
+            return FALSE;
+        }
+        return bigint_equal(AS_BIGINT(a), AS_BIGINT(b));
+    }
+}
+
+bool is_hashable(Value key)
+{
+    return IS_INTEGER(key) || IS_BOOL(key) || IS_STRING(key);
+}
+
+static inline uint32_t branch_bit(uint64_t hash, uint32_t shift)
+{
+    return 1u << ((hash >> shift) & NODE_MASK);
+}
+
+// Position of the entry for `bit` among the entries `map` says are present
+static inline uint32_t index_below(uint32_t map, uint32_t bit)
+{
+    return (uint32_t)__builtin_popcount(map & (bit - 1));
+}
+
+static inline uint32_t num_pairs(Node *node)
+{
+    return (uint32_t)__builtin_popcount(node->datamap);
+}
+
+static Hash *make_hash_object(size_t count, Node *root, Allocator *allocator)
+{
+    Hash *hash = allocate(allocator, sizeof(Hash));
+    hash->obj.type = OBJ_HASH;
+    hash->count = count;
+    hash->root = root;
+    return hash;
+}
+
+// Node holding two pairs with different keys, nested as deep as their hashes agree
+static Node *merge_pairs(Value key1, Value value1, uint64_t hash1, Value key2, Value value2, uint64_t hash2, uint32_t shift, Allocator *allocator)
+{
+    if (shift >= HASH_BITS) {
+        Node *collisions = make_node(4, allocator);
+        collisions->slots[0] = key1;
+        collisions->slots[1] = value1;
+        collisions->slots[2] = key2;
+        collisions->slots[3] = value2;
+        return collisions;
+    }
+
+    uint32_t bit1 = branch_bit(hash1, shift);
+    uint32_t bit2 = branch_bit(hash2, shift);
+    if (bit1 == bit2) {
+        Node *node = make_node(1, allocator);
+        node->nodemap = bit1;
+        node->slots[0] = OBJ_VAL(merge_pairs(key1, value1, hash1, key2, value2, hash2, shift + NODE_BITS, allocator));
+        return node;
+    }
+
+    Node *node = make_node(4, allocator);
+    node->datamap = bit1 | bit2;
+    int first = bit1 < bit2 ? 0 : 2;
+    node->slots[first] = key1;
+    node->slots[first + 1] = value1;
+    node->slots[2 - first] = key2;
+    node->slots[3 - first] = value2;
+    return node;
+}
+
+// Returns a copy of `node` with `key` mapped to `value`, setting `added` if the key is new
+static Node *put(Node *node, uint32_t shift, Value key, Value value, uint64_t hash, bool *added, Allocator *allocator)
+{
+    if (shift >= HASH_BITS) {
+        for (uint32_t i = 0; i < node->length; i += 2) {
+            if (keys_equal(node->slots[i], key)) {
+                Node *copy = copy_node(node, node->length, allocator);
+                copy->slots[i + 1] = value;
+                return copy;
+            }
+        }
+        Node *copy = copy_node(node, node->length + 2, allocator);
+        copy->slots[node->length] = key;
+        copy->slots[node->length + 1] = value;
+        *added = TRUE;
+        return copy;
+    }
+
+    uint32_t bit = branch_bit(hash, shift);
+    uint32_t pairs = num_pairs(node);
+
+    if (node->nodemap & bit) {
+        uint32_t slot = 2 * pairs + index_below(node->nodemap, bit);
+        Node *child = put(AS_NODE(node->slots[slot]), shift + NODE_BITS, key, value, hash, added, allocator);
+        Node *copy = copy_node(node, node->length, allocator);
+        copy->slots[slot] = OBJ_VAL(child);
+        return copy;
+    }
+
+    uint32_t pair = index_below(node->datamap, bit);
+    if (!(node->datamap & bit)) {
+        Node *copy = make_node(node->length + 2, allocator);
+        copy->datamap = node->datamap | bit;
+        copy->nodemap = node->nodemap;
+        memcpy(copy->slots, node->slots, 2 * pair * sizeof(Value));
+        copy->slots[2 * pair] = key;
+        copy->slots[2 * pair + 1] = value;
+        memcpy(copy->slots + 2 * pair + 2, node->slots + 2 * pair, (node->length - 2 * pair) * sizeof(Value));
+        *added = TRUE;
+        return copy;
+    }
+
+    Value existing_key = node->slots[2 * pair];
+    Value existing_value = node->slots[2 * pair + 1];
+    if (keys_equal(existing_key, key)) {
+        Node *copy = copy_node(node, node->length, allocator);
+        copy->slots[2 * pair + 1] = value;
+        return copy;
+    }
+
+    // The pair already there and the new one move down into a child in place of the pair
+    Node *child = merge_pairs(existing_key, existing_value, hash_key(existing_key), key, value, hash, shift + NODE_BITS, allocator);
+    Node *copy = make_node(node->length - 1, allocator);
+    copy->datamap = node->datamap ^ bit;
+    copy->nodemap = node->nodemap | bit;
+    memcpy(copy->slots, node->slots, 2 * pair * sizeof(Value));
+    memcpy(copy->slots + 2 * pair, node->slots + 2 * pair + 2, 2 * (pairs - pair - 1) * sizeof(Value));
+    Value *children = node->slots + 2 * pairs;
+    Value *copied_children = copy->slots + 2 * (pairs - 1);
+    uint32_t num_children = node->length - 2 * pairs;
+    uint32_t position = index_below(node->nodemap, bit);
+    memcpy(copied_children, children, position * sizeof(Value));
+    copied_children[position] = OBJ_VAL(child);
+    memcpy(copied_children + position + 1, children + position, (num_children - position) * sizeof(Value));
+    *added = TRUE;
+    return copy;
+}
+
+Value make_hash(Allocator *allocator)
+{
+    return OBJ_VAL(make_hash_object(0, NULL, allocator));
+}
+
+Value hash_put(Hash *hash, Value key, Value value, Allocator *allocator)
+{
+    uint64_t key_hash = hash_key(key);
+    bool added = FALSE;
+    Node *root;
+    if (hash->root == NULL) {
+        root = make_node(2, allocator);
+        root->datamap = branch_bit(key_hash, 0);
+        root->slots[0] = key;
+        root->slots[1] = value;
+        added = TRUE;
+    } else {
+        root = put(hash->root, 0, key, value, key_hash, &added, allocator);
+    }
+    return OBJ_VAL(make_hash_object(hash->count + added, root, allocator));
+}
+
+bool hash_get(Hash *hash, Value key, Value *value)
+{
+    uint64_t key_hash = hash_key(key);
+    Node *node = hash->root;
+    for (uint32_t shift = 0; node != NULL; shift += NODE_BITS) {
+        if (shift >= HASH_BITS) {
+            for (uint32_t i = 0; i < node->length; i += 2) {
+                if (keys_equal(node->slots[i], key)) {
+                    *value = node->slots[i + 1];
+                    return TRUE;
+                }
+            }
+            return FALSE;
+        }
+
+        uint32_t bit = branch_bit(key_hash, shift);
+        if (node->datamap & bit) {
+            uint32_t pair = index_below(node->datamap, bit);
+            if (!keys_equal(node->slots[2 * pair], key)) {
+                return FALSE;
+            }
+            *value = node->slots[2 * pair + 1];
+            return TRUE;
+        }
+        if (!(node->nodemap & bit)) {
+            return FALSE;
+        }
+        node = AS_NODE(node->slots[2 * num_pairs(node) + index_below(node->nodemap, bit)]);
+    }
+    return FALSE;
+}
+
+static void visit_node(Node *node, uint32_t shift, void (*visit)(Value key, Value value, void *context), void *context)
+{
+    uint32_t pairs = shift >= HASH_BITS ? node->length / 2 : num_pairs(node);
+    for (uint32_t i = 0; i < pairs; i++) {
+        visit(node->slots[2 * i], node->slots[2 * i + 1], context);
+    }
+    for (uint32_t i = 2 * pairs; i < node->length; i++) {
+        visit_node(AS_NODE(node->slots[i]), shift + NODE_BITS, visit, context);
+    }
+}
+
+void hash_each(Hash *hash, void (*visit)(Value key, Value value, void *context), void *context)
+{
+    if (hash->root != NULL) {
+        visit_node(hash->root, 0, visit, context);
+    }
+}
+
+// Formatting
+
+static void append_str(Buffer *buffer, const char *str)
+{
+    size_t length = strlen(str);
+    if (buffer->size + length + 1 > buffer->capacity) {
+        while (buffer->size + length + 1 > buffer->capacity) {
+            buffer->capacity *= 2;
+        }
+        buffer->array = realloc(buffer->array, buffer->capacity);
+    }
+    memcpy(buffer->array + buffer->size, str, length + 1);
+    buffer->size += length;
+}
+
+typedef struct FormatContext {
+    Buffer *buffer;
+    char *(*inspect)(Value value);
+    bool first;
+} FormatContext;
+
+static void append_value(FormatContext *context, Value value)
+{
+    char *str = context->inspect(value);
+    append_str(context->buffer, str);
+    free(str);
+}
+
+static void append_pair(Value key, Value value, void *context)
+{
+    FormatContext *format = context;
+    if (!format->first) {
+        append_str(format->buffer, ", ");
+    }
+    format->first = FALSE;
+    append_value(format, key);
+    append_str(format->buffer, ": ");
+    append_value(format, value);
+}
+
+char *collection_to_str(Value collection, char *(*inspect)(Value value))
+{
+    Buffer buffer = { .array = malloc(INITIAL_BUFFER_CAPACITY), .size = 0, .capacity = INITIAL_BUFFER_CAPACITY };
+    buffer.array[0] = '\0';
+    FormatContext context = { .buffer = &buffer, .inspect = inspect, .first = TRUE };
+
+    if (IS_ARRAY(collection)) {
+        Array *array = AS_ARRAY(collection);
+        append_str(&buffer, "[");
+        for (size_t i = 0; i < array->count; i++) {
+            if (i > 0) {
+                append_str(&buffer, ", ");
+            }
+            append_value(&context, array_get(array, i));
+        }
+        append_str(&buffer, "]");
+    } else {
+        append_str(&buffer, "{");
+        hash_each(AS_HASH(collection), append_pair, &context);
+        append_str(&buffer, "}");
+    }
+    return buffer.array;
+}
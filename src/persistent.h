@@ -0,0 +1,54 @@
+#ifndef PERSISTENT_H
+#define PERSISTENT_H
+
+#include "allocator.h"
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Immutable arrays and hashes. An update returns a new collection sharing every node it did not
+// change with the old one, so a push or put copies O(log32 n) nodes rather than the collection.
+// Arrays are persistent vectors; hashes are hash array mapped tries whose nodes keep their
+// key-value pairs in front of their child nodes, both compacted by a bitmap.
+//
+// Everything is allocated with `allocator->alloc`. Unlike bigint.h, an operation allocates several
+// nodes and holds on to them in between, so the allocator must not move or free anything itself.
+// The VM collects before calling in and lets its allocator fall back to the old space.
+
+#define NODE_BITS 5
+#define NODE_WIDTH (1 << NODE_BITS)
+#define NODE_MASK (NODE_WIDTH - 1)
+#define HASH_BITS 64 // Hash nodes at this depth or deeper hold colliding pairs in no particular order
+
+// Arrays of small integers only are packed: their leaves hold the integers unboxed
+extern Value make_array(const Value *elements, size_t count, Allocator *allocator);
+extern Value make_packed_array(const int64_t *elements, size_t count, Allocator *allocator);
+// `index` must be less than the array's count
+extern Value array_get(Array *array, size_t index);
+// Pushing anything but a small integer onto a packed array copies it into a generic one first
+extern Value array_push(Array *array, Value element, Allocator *allocator);
+// The elements from `start` up to `end`, clamped to the array. Takes constant time, the slice is a
+// view sharing the array's trie.
+extern Value array_slice(Array *array, size_t start, size_t end, Allocator *allocator);
+// Clamps an integer, which may be a bignum, to a slice bound of an array of `count` elements
+extern size_t array_bound(Value bound, size_t count);
+typedef bool (*PackedLeafFn)(const int64_t *elements, size_t count, void *context);
+// Visits the elements of a packed array a leaf at a time, in order, until `visit` returns FALSE.
+// Returns FALSE if it stopped early.
+extern bool packed_array_each(Array *array, PackedLeafFn visit, void *context);
+
+extern Value make_hash(Allocator *allocator);
+// Integers, booleans and strings can be keys
+extern bool is_hashable(Value key);
+// `key` must be hashable
+extern Value hash_put(Hash *hash, Value key, Value value, Allocator *allocator);
+// Returns FALSE if `key` is not in the hash
+extern bool hash_get(Hash *hash, Value key, Value *value);
+// Visits the pairs in an order only stable for one hash
+extern void hash_each(Hash *hash, void (*visit)(Value key, Value value, void *context), void *context);
+
+// `[1, 2]` or `{1: 2}`, with `inspect` formatting the elements. The caller frees the result.
+extern char *collection_to_str(Value collection, char *(*inspect)(Value value));
+
+#endif // PERSISTENT_H
@@ -0,0 +1,190 @@
+#include "allocator.h"
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "parser.h"
+#include "persistent.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Building collections one update at a time: interpreted programs doing a million pushes and puts,
+// then persistent updates against copying a flat array on every update. Last, taking arrays apart
+// again: an interpreted recursive sum calling `rest` on every step, against copying the rest of a
+// flat array on every step the way `rest` did before slices were views.
+
+#define VM_UPDATES 1000000
+
+static void bench_program(const char *label, const char *format)
+{
+    char input[512];
+    snprintf(input, sizeof(input), format, VM_UPDATES);
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = FALSE;
+
+    uint64_t start = now_ns();
+    VMResult result = run_vm(vm, main);
+    uint64_t elapsed = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+
+    GCStats stats = get_gc_stats(heap);
+    printf("%-6s %10d %10.1f %10.1f %10.1f %8zu %8zu\n", label, VM_UPDATES, elapsed / 1e6, (double)elapsed / VM_UPDATES,
+        stats.total_pause_ns / 1e6, stats.minor_collections, stats.major_collections);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+// Every update allocates a new array one longer than the last and copies the old one into it
+static uint64_t bench_copying(size_t count)
+{
+    uint64_t start = now_ns();
+    Value *array = NULL;
+    for (size_t i = 0; i < count; i++) {
+        Value *copy = malloc((i + 1) * sizeof(Value));
+        if (i > 0) {
+            memcpy(copy, array, i * sizeof(Value));
+        }
+        copy[i] = INT_VAL((int64_t)i);
+        free(array);
+        array = copy;
+    }
+    uint64_t elapsed = now_ns() - start;
+    assert(AS_INT(array[count - 1]) == (int64_t)count - 1);
+    free(array);
+    return elapsed;
+}
+
+static uint64_t bench_persistent_array(size_t count, Arena *arena)
+{
+    uint64_t start = now_ns();
+    Value array = make_array(NULL, 0, &arena->allocator);
+    for (size_t i = 0; i < count; i++) {
+        array = array_push(AS_ARRAY(array), INT_VAL((int64_t)i), &arena->allocator);
+    }
+    uint64_t elapsed = now_ns() - start;
+    assert(AS_ARRAY(array)->count == count);
+    reset_arena(arena);
+    return elapsed;
+}
+
+static uint64_t bench_persistent_hash(size_t count, Arena *arena)
+{
+    uint64_t start = now_ns();
+    Value hash = make_hash(&arena->allocator);
+    for (size_t i = 0; i < count; i++) {
+        hash = hash_put(AS_HASH(hash), INT_VAL((int64_t)i), INT_VAL((int64_t)i), &arena->allocator);
+    }
+    uint64_t elapsed = now_ns() - start;
+    assert(AS_HASH(hash)->count == count);
+    reset_arena(arena);
+    return elapsed;
+}
+
+// Runs `input` on the VM, where globals of earlier inputs are still defined, and returns the time
+// it took
+static uint64_t run_timed(Compiler *compiler, VM *vm, const char *input, Program **program, Parser **parser)
+{
+    *parser = make_parser((char *)input, NULL);
+    *program = parse_program(*parser);
+    FunctionProto *main = compile_program(compiler, *program);
+    assert(main != NULL);
+    uint64_t start = now_ns();
+    VMResult result = run_vm(vm, main);
+    uint64_t elapsed = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+    return elapsed;
+}
+
+static uint64_t bench_recursive_sum(size_t count)
+{
+    char input[256];
+    Program *programs[2];
+    Parser *parsers[2];
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+
+    snprintf(input, sizeof(input), "let a = []; let i = 0; while (i < %zu) { let a = push(a, i); let i = i + 1; } len(a)", count);
+    run_timed(compiler, vm, input, &programs[0], &parsers[0]);
+    uint64_t elapsed = run_timed(compiler, vm, "let total = fn(a, acc) { if (len(a) == 0) { acc } else { total(rest(a), acc + first(a)) } }; total(a, 0)",
+        &programs[1], &parsers[1]);
+    assert(AS_INT(get_last_popped(vm)) == (int64_t)(count * (count - 1) / 2));
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    for (int i = 0; i < 2; i++) {
+        cleanup_program(programs[i]);
+        cleanup_parser(parsers[i]);
+    }
+    return elapsed;
+}
+
+// Every step builds a new array out of all elements but the first
+static uint64_t bench_copying_rest(size_t count, Arena *arena)
+{
+    Value *elements = malloc(count * sizeof(Value));
+    for (size_t i = 0; i < count; i++) {
+        elements[i] = INT_VAL((int64_t)i);
+    }
+    uint64_t start = now_ns();
+    int64_t sum = 0;
+    Value array = make_array(elements, count, &arena->allocator);
+    for (size_t i = 0; i < count; i++) {
+        sum += AS_INT(array_get(AS_ARRAY(array), 0));
+        reset_arena(arena); // Nothing refers to the old array any more
+        array = make_array(elements + i + 1, count - i - 1, &arena->allocator);
+    }
+    uint64_t elapsed = now_ns() - start;
+    assert(sum == (int64_t)(count * (count - 1) / 2));
+    reset_arena(arena);
+    free(elements);
+    return elapsed;
+}
+
+int main(void)
+{
+    printf("%-6s %10s %10s %10s %10s %8s %8s\n", "vm", "updates", "total ms", "ns/update", "gc ms", "minor", "major");
+    bench_program("push", "let a = []; let i = 0; while (i < %d) { let a = push(a, i); let i = i + 1; } len(a)");
+    bench_program("put", "let h = {}; let i = 0; while (i < %d) { let h = put(h, i, i); let i = i + 1; } len(h)");
+
+    printf("\n%10s %14s %14s %14s\n", "elements", "copy ns/op", "vector ns/op", "hamt ns/op");
+    Arena *arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    size_t counts[] = { 1000, 10000, 50000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        size_t count = counts[i];
+        printf("%10zu %14.1f %14.1f %14.1f\n", count, (double)bench_copying(count) / count,
+            (double)bench_persistent_array(count, arena) / count, (double)bench_persistent_hash(count, arena) / count);
+    }
+
+    printf("\n%-6s %10s %10s %10s %14s\n", "rest", "elements", "vm ms", "ns/element", "copy ms");
+    size_t lengths[] = { 1000, 10000, 100000 };
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        size_t count = lengths[i];
+        uint64_t elapsed = bench_recursive_sum(count);
+        // Copying is quadratic, a hundred thousand elements would take seconds
+        char copy[32] = "-";
+        if (count <= 10000) {
+            snprintf(copy, sizeof(copy), "%.1f", bench_copying_rest(count, arena) / 1e6);
+        }
+        printf("%-6s %10zu %10.1f %10.1f %14s\n", "sum", count, elapsed / 1e6, (double)elapsed / count, copy);
+    }
+    cleanup_arena(arena);
+    return 0;
+}
@@ -0,0 +1,306 @@
+#include "allocator.h"
+#include "bigint.h"
+#include "object.h"
+#include "persistent.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static Arena *arena;
+
+static Allocator *test_allocator(void)
+{
+    if (arena == NULL) {
+        arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    }
+    return &arena->allocator;
+}
+
+static char *inspect_element(Value value)
+{
+    char buffer[32];
+    if (IS_BIGINT(value)) {
+        return bigint_to_str(value);
+    }
+    if (IS_ARRAY(value) || IS_HASH(value)) {
+        return collection_to_str(value, inspect_element);
+    }
+    if (IS_BOOL(value)) {
+        return strdup(AS_BOOL(value) ? "true" : "false");
+    }
+    snprintf(buffer, sizeof(buffer), "%lld", (long long)AS_INT(value));
+    return strdup(buffer);
+}
+
+static void assert_collection_str(Value collection, const char *expected)
+{
+    char *result = collection_to_str(collection, inspect_element);
+    if (strcmp(result, expected) != 0) {
+        printf("Expected: %s\nGot: %s\n", expected, result);
+        assert(1 != 1);
+    }
+    free(result);
+}
+
+static Value push_range(Value array, size_t from, size_t to)
+{
+    for (size_t i = from; i < to; i++) {
+        array = array_push(AS_ARRAY(array), INT_VAL((int64_t)i), test_allocator());
+    }
+    return array;
+}
+
+static void assert_range(Array *array, size_t count)
+{
+    assert(array->count == count);
+    for (size_t i = 0; i < count; i++) {
+        Value element = array_get(array, i);
+        if (!IS_INT(element) || AS_INT(element) != (int64_t)i) {
+            printf("Element %zu of %zu is wrong\n", i, count);
+            assert(1 != 1);
+        }
+    }
+}
+
+TEST_CASE(array_literals)
+{
+    Value elements[] = { INT_VAL(1), BOOL_VAL(TRUE), INT_VAL(3) };
+    assert_collection_str(make_array(NULL, 0, test_allocator()), "[]");
+    assert_collection_str(make_array(elements, 3, test_allocator()), "[1, true, 3]");
+
+    // Sizes around where the tail fills up and where the trie grows a level
+    size_t sizes[] = { 31, 32, 33, 64, 65, 1024, 1056, 1057, 32768 + 32, 32768 + 33, 100000 };
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        Value *values = malloc(sizes[i] * sizeof(Value));
+        for (size_t j = 0; j < sizes[i]; j++) {
+            values[j] = INT_VAL((int64_t)j);
+        }
+        assert_range(AS_ARRAY(make_array(values, sizes[i], test_allocator())), sizes[i]);
+        free(values);
+    }
+}
+
+TEST_CASE(array_push_grows_trie)
+{
+    Value array = push_range(make_array(NULL, 0, test_allocator()), 0, 40000);
+    assert_range(AS_ARRAY(array), 40000);
+    // Two levels of nodes hold 32 * 32 * 32 elements, so 40000 take a third
+    assert(AS_ARRAY(array)->shift == 3 * NODE_BITS);
+
+    Value more = push_range(array, 40000, 1100000);
+    assert_range(AS_ARRAY(more), 1100000);
+    assert(AS_ARRAY(more)->shift == 4 * NODE_BITS);
+}
+
+TEST_CASE(array_versions_share_structure)
+{
+    Value base = push_range(make_array(NULL, 0, test_allocator()), 0, 1000);
+    Value longer = push_range(base, 1000, 2000);
+    Value other = array_push(AS_ARRAY(base), INT_VAL(-1), test_allocator());
+
+    // Older versions are unchanged, and versions branching off the same one do not see each other
+    assert_range(AS_ARRAY(base), 1000);
+    assert_range(AS_ARRAY(longer), 2000);
+    assert(AS_ARRAY(other)->count == 1001);
+    assert(AS_INT(array_get(AS_ARRAY(other), 1000)) == -1);
+    assert(AS_INT(array_get(AS_ARRAY(longer), 1000)) == 1000);
+
+    // Full leaves move into the trie as they are, so untouched subtrees are the same nodes
+    Object *base_leaf = AS_OBJ(AS_ARRAY(base)->root->slots[0]);
+    Object *longer_leaf = AS_OBJ(AS_NODE(AS_ARRAY(longer)->root->slots[0])->slots[0]);
+    assert(base_leaf == longer_leaf);
+}
+
+TEST_CASE(array_slices)
+{
+    Value array = push_range(make_array(NULL, 0, test_allocator()), 0, 2000);
+    Value slice = array_slice(AS_ARRAY(array), 1, 2000, test_allocator());
+    assert(AS_ARRAY(slice)->count == 1999);
+    for (size_t i = 0; i < 1999; i++) {
+        assert(AS_INT(array_get(AS_ARRAY(slice), i)) == (int64_t)i + 1);
+    }
+    assert(AS_ARRAY(array_slice(AS_ARRAY(array), 2000, 2000, test_allocator()))->count == 0);
+    assert(AS_ARRAY(array_slice(AS_ARRAY(array), 1500, 1000, test_allocator()))->count == 0);
+    assert(AS_ARRAY(array_slice(AS_ARRAY(array), 0, 5000, test_allocator()))->count == 2000);
+    assert_range(AS_ARRAY(array), 2000);
+
+    // Slices share the trie, slices of slices too
+    Value middle = array_slice(AS_ARRAY(slice), 99, 1099, test_allocator());
+    assert(AS_ARRAY(middle)->root == AS_ARRAY(array)->root && AS_ARRAY(middle)->tail == AS_ARRAY(array)->tail);
+    assert(AS_ARRAY(middle)->count == 1000 && AS_INT(array_get(AS_ARRAY(middle), 0)) == 100);
+    assert(AS_INT(array_get(AS_ARRAY(middle), 999)) == 1099);
+}
+
+TEST_CASE(pushing_onto_slices)
+{
+    Value array = push_range(make_array(NULL, 0, test_allocator()), 0, 100);
+
+    // A slice reaching the end of the trie is pushed onto in place, leaving the original alone
+    Value tail = array_slice(AS_ARRAY(array), 90, 100, test_allocator());
+    Value pushed = array_push(AS_ARRAY(tail), INT_VAL(-1), test_allocator());
+    assert_collection_str(pushed, "[90, 91, 92, 93, 94, 95, 96, 97, 98, 99, -1]");
+    assert(AS_ARRAY(pushed)->root == AS_ARRAY(array)->root);
+    assert(AS_ARRAY(array)->count == 100);
+
+    // One ending early is copied, so the elements after it stay as they were
+    Value head = array_slice(AS_ARRAY(array), 1, 4, test_allocator());
+    assert_collection_str(array_push(AS_ARRAY(head), INT_VAL(-2), test_allocator()), "[1, 2, 3, -2]");
+    assert_collection_str(array_push(AS_ARRAY(head), BOOL_VAL(TRUE), test_allocator()), "[1, 2, 3, true]");
+    assert_collection_str(array_slice(AS_ARRAY(array), 3, 6, test_allocator()), "[3, 4, 5]");
+    assert_range(AS_ARRAY(array), 100);
+
+    // Slices of nothing can be pushed onto like empty arrays
+    Value empty = array_slice(AS_ARRAY(array), 100, 100, test_allocator());
+    assert_collection_str(array_push(AS_ARRAY(empty), INT_VAL(7), test_allocator()), "[7]");
+}
+
+static bool count_slice_leaf(const int64_t *elements, size_t count, void *context)
+{
+    int64_t *next = context;
+    for (size_t i = 0; i < count; i++) {
+        assert(elements[i] == (*next)++);
+    }
+    return TRUE;
+}
+
+TEST_CASE(packed_slices_are_visited_within_bounds)
+{
+    Value array = push_range(make_array(NULL, 0, test_allocator()), 0, 200);
+    size_t bounds[][2] = { { 0, 200 }, { 5, 10 }, { 30, 33 }, { 31, 200 }, { 64, 96 }, { 150, 199 }, { 199, 200 } };
+    for (size_t i = 0; i < sizeof(bounds) / sizeof(bounds[0]); i++) {
+        int64_t next = (int64_t)bounds[i][0];
+        packed_array_each(AS_ARRAY(array_slice(AS_ARRAY(array), bounds[i][0], bounds[i][1], test_allocator())), count_slice_leaf, &next);
+        assert(next == (int64_t)bounds[i][1]);
+    }
+}
+
+TEST_CASE(arrays_of_small_integers_are_packed)
+{
+    Value mixed[] = { INT_VAL(1), BOOL_VAL(TRUE), INT_VAL(3) };
+    Value ints[] = { INT_VAL(1), INT_VAL(2), INT_VAL(3) };
+    assert(AS_ARRAY(make_array(NULL, 0, test_allocator()))->packed);
+    assert(AS_ARRAY(make_array(ints, 3, test_allocator()))->packed);
+    assert(!AS_ARRAY(make_array(mixed, 3, test_allocator()))->packed);
+
+    // Leaves in the trie and the tail are both packed
+    Value array = push_range(make_array(NULL, 0, test_allocator()), 0, 2000);
+    assert(AS_ARRAY(array)->packed);
+    assert(AS_ARRAY(array)->tail->type == OBJ_PACKED_NODE);
+    assert(AS_OBJ(AS_NODE(AS_ARRAY(array)->root->slots[0])->slots[0])->type == OBJ_PACKED_NODE);
+    assert_range(AS_ARRAY(array), 2000);
+
+    // Pushing anything else copies the array into a generic one and leaves the original alone
+    Value generic = array_push(AS_ARRAY(array), BOOL_VAL(FALSE), test_allocator());
+    assert(!AS_ARRAY(generic)->packed);
+    assert(AS_ARRAY(generic)->tail->type == OBJ_NODE);
+    assert(AS_ARRAY(generic)->count == 2001 && IS_BOOL(array_get(AS_ARRAY(generic), 2000)));
+    assert(AS_INT(array_get(AS_ARRAY(generic), 1999)) == 1999);
+    assert(AS_ARRAY(array)->packed);
+    assert_range(AS_ARRAY(array), 2000);
+
+    // A generic array stays generic, bignums are not small integers
+    assert(!AS_ARRAY(array_push(AS_ARRAY(generic), INT_VAL(1), test_allocator()))->packed);
+    Value big = bigint_from_str("9223372036854775808", test_allocator());
+    assert(!AS_ARRAY(array_push(AS_ARRAY(array), big, test_allocator()))->packed);
+
+    // Slices keep the representation of the array they view
+    assert(!AS_ARRAY(array_slice(AS_ARRAY(make_array(mixed, 3, test_allocator())), 2, 3, test_allocator()))->packed);
+
+    int64_t raw[] = { INT64_MIN, -1, INT64_MAX };
+    assert_collection_str(make_packed_array(raw, 3, test_allocator()), "[-9223372036854775808, -1, 9223372036854775807]");
+}
+
+static bool count_leaf(const int64_t *elements, size_t count, void *context)
+{
+    size_t *seen = context;
+    for (size_t i = 0; i < count; i++) {
+        assert(elements[i] == (int64_t)(*seen + i));
+    }
+    *seen += count;
+    return *seen < 1000;
+}
+
+TEST_CASE(packed_leaves_are_visited_in_order)
+{
+    size_t seen = 0;
+    assert(packed_array_each(AS_ARRAY(push_range(make_array(NULL, 0, test_allocator()), 0, 2000)), count_leaf, &seen) == FALSE);
+    assert(seen == 1024); // Stopped after the leaf that reached 1000
+    seen = 0;
+    assert(packed_array_each(AS_ARRAY(push_range(make_array(NULL, 0, test_allocator()), 0, 999)), count_leaf, &seen));
+    assert(seen == 999);
+}
+
+TEST_CASE(hash_put_and_get)
+{
+    Value hash = make_hash(test_allocator());
+    assert_collection_str(hash, "{}");
+    Value value;
+    assert(!hash_get(AS_HASH(hash), INT_VAL(1), &value));
+
+    for (int64_t i = 0; i < 100000; i++) {
+        hash = hash_put(AS_HASH(hash), INT_VAL(i * 7919), INT_VAL(i), test_allocator());
+    }
+    assert(AS_HASH(hash)->count == 100000);
+    for (int64_t i = 0; i < 100000; i++) {
+        assert(hash_get(AS_HASH(hash), INT_VAL(i * 7919), &value));
+        assert(AS_INT(value) == i);
+    }
+    assert(!hash_get(AS_HASH(hash), INT_VAL(1), &value));
+
+    // Replacing a value keeps the count, the old version keeps the old value
+    Value replaced = hash_put(AS_HASH(hash), INT_VAL(7919), INT_VAL(-1), test_allocator());
+    assert(AS_HASH(replaced)->count == 100000);
+    assert(hash_get(AS_HASH(replaced), INT_VAL(7919), &value) && AS_INT(value) == -1);
+    assert(hash_get(AS_HASH(hash), INT_VAL(7919), &value) && AS_INT(value) == 1);
+
+    Value booleans = hash_put(AS_HASH(make_hash(test_allocator())), BOOL_VAL(TRUE), INT_VAL(1), test_allocator());
+    booleans = hash_put(AS_HASH(booleans), BOOL_VAL(FALSE), INT_VAL(0), test_allocator());
+    assert(hash_get(AS_HASH(booleans), BOOL_VAL(FALSE), &value) && AS_INT(value) == 0);
+    assert(!hash_get(AS_HASH(booleans), INT_VAL(1), &value));
+}
+
+static void count_pair(Value key, Value value, void *context)
+{
+    assert(AS_INT(key) == AS_INT(value) * 3);
+    (*(size_t *)context)++;
+}
+
+TEST_CASE(hash_iteration)
+{
+    Value hash = make_hash(test_allocator());
+    for (int64_t i = 0; i < 5000; i++) {
+        hash = hash_put(AS_HASH(hash), INT_VAL(i * 3), INT_VAL(i), test_allocator());
+    }
+    size_t visited = 0;
+    hash_each(AS_HASH(hash), count_pair, &visited);
+    assert(visited == 5000);
+}
+
+TEST_CASE(hash_full_collisions)
+{
+    // Integers hash by value and bignums by sign and limbs, so these three share all 64 bits
+    Value min = INT_VAL(INT64_MIN);
+    Value above = bigint_from_str("9223372036854775808", test_allocator());
+    Value below = bigint_from_str("-9223372036854775809", test_allocator());
+    assert(IS_BIGINT(above) && IS_BIGINT(below));
+
+    Value hash = make_hash(test_allocator());
+    hash = hash_put(AS_HASH(hash), min, INT_VAL(1), test_allocator());
+    hash = hash_put(AS_HASH(hash), above, INT_VAL(2), test_allocator());
+    hash = hash_put(AS_HASH(hash), below, INT_VAL(3), test_allocator());
+    hash = hash_put(AS_HASH(hash), bigint_from_str("9223372036854775808", test_allocator()), INT_VAL(4), test_allocator());
+    assert(AS_HASH(hash)->count == 3);
+
+    Value value;
+    assert(hash_get(AS_HASH(hash), min, &value) && AS_INT(value) == 1);
+    assert(hash_get(AS_HASH(hash), above, &value) && AS_INT(value) == 4);
+    assert(hash_get(AS_HASH(hash), below, &value) && AS_INT(value) == 3);
+    assert(!hash_get(AS_HASH(hash), bigint_from_str("9223372036854775809", test_allocator()), &value));
+    assert_collection_str(hash, "{-9223372036854775808: 1, 9223372036854775808: 4, -9223372036854775809: 3}");
+}
+
+RUN_TESTS()
@@ -0,0 +1,256 @@
+#include "pool.h"
+#include "globals.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON(ptr, size) ASAN_POISON_MEMORY_REGION(ptr, size)
+#define UNPOISON(ptr, size) ASAN_UNPOISON_MEMORY_REGION(ptr, size)
+#else
+#define POISON(ptr, size) ((void)(ptr), (void)(size))
+#define UNPOISON(ptr, size) ((void)(ptr), (void)(size))
+#endif
+
+#define GRANULE 16
+#define LARGE_CLASS NUM_SIZE_CLASSES
+
+static const size_t CLASS_SIZES[NUM_SIZE_CLASSES] = {
+    16, 32, 48, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 448, 512
+};
+
+// Size class for every multiple of GRANULE up to POOL_MAX_SMALL_SIZE
+static const unsigned char CLASS_FOR_GRANULES[POOL_MAX_SMALL_SIZE / GRANULE + 1] = {
+    0, 0, 1, 2, 3, 4, 5, 6, 7, 8, 8, 9, 9, 10, 10, 11, 11,
+    12, 12, 12, 12, 13, 13, 13, 13, 14, 14, 14, 14, 15, 15, 15, 15
+};
+
+typedef struct FreeBlock {
+    struct FreeBlock *next;
+} FreeBlock;
+
+// Slabs are never returned to the system, they are linked here so they stay reachable
+typedef struct Slab {
+    struct Slab *next;
+} Slab;
+
+#define SLAB_HEADER_SIZE ((sizeof(Slab) + GRANULE - 1) / GRANULE * GRANULE)
+
+// Each thread allocates from its own free lists and slab remainder without locking, and keeps its
+// own counters. Only the owning thread writes them, readers sum them over all threads.
+typedef struct ThreadCache {
+    FreeBlock *free_lists[NUM_SIZE_CLASSES];
+    char *bump[NUM_SIZE_CLASSES]; // Uncarved remainder of the class's current slab
+    char *bump_end[NUM_SIZE_CLASSES];
+    SizeClassStats stats[NUM_SIZE_CLASSES + 1];
+    bool registered;
+    struct ThreadCache *next;
+} ThreadCache;
+
+static __thread ThreadCache cache;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static Slab *slabs = NULL;
+static ThreadCache *caches = NULL;
+static SizeClassStats retired_stats[NUM_SIZE_CLASSES + 1]; // Counters of threads that have exited
+static pthread_key_t exit_key;
+static pthread_once_t exit_key_once = PTHREAD_ONCE_INIT;
+
+static inline int size_class_of(size_t size)
+{
+    if (size > POOL_MAX_SMALL_SIZE) {
+        return LARGE_CLASS;
+    }
+    return CLASS_FOR_GRANULES[(size + GRANULE - 1) / GRANULE];
+}
+
+// Single writer, the atomic store only keeps concurrent readers well defined
+#define BUMP_COUNTER(counter, delta) __atomic_store_n(&(counter), (counter) + (delta), __ATOMIC_RELAXED)
+
+static void retire_cache(void *arg)
+{
+    ThreadCache *thread_cache = arg;
+    pthread_mutex_lock(&registry_lock);
+    for (ThreadCache **link = &caches; *link != NULL; link = &(*link)->next) {
+        if (*link == thread_cache) {
+            *link = thread_cache->next;
+            break;
+        }
+    }
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        retired_stats[i].objects_in_use += thread_cache->stats[i].objects_in_use;
+        retired_stats[i].bytes_in_use += thread_cache->stats[i].bytes_in_use;
+        retired_stats[i].total_allocations += thread_cache->stats[i].total_allocations;
+        retired_stats[i].slabs += thread_cache->stats[i].slabs;
+    }
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static void make_exit_key(void)
+{
+    pthread_key_create(&exit_key, retire_cache);
+}
+
+static void register_cache(void)
+{
+    pthread_once(&exit_key_once, make_exit_key);
+    pthread_setspecific(exit_key, &cache);
+    pthread_mutex_lock(&registry_lock);
+    cache.next = caches;
+    caches = &cache;
+    cache.registered = TRUE;
+    pthread_mutex_unlock(&registry_lock);
+}
+
+static inline void count_allocation(int size_class, size_t size)
+{
+    if (!cache.registered) {
+        register_cache();
+    }
+    BUMP_COUNTER(cache.stats[size_class].objects_in_use, 1);
+    BUMP_COUNTER(cache.stats[size_class].bytes_in_use, size);
+    BUMP_COUNTER(cache.stats[size_class].total_allocations, 1);
+}
+
+// Blocks may be freed on another thread than they came from, so a single thread's counters can
+// wrap below zero. The sums over all threads are still right.
+static inline void count_free(int size_class, size_t size)
+{
+    if (!cache.registered) {
+        register_cache();
+    }
+    BUMP_COUNTER(cache.stats[size_class].objects_in_use, -1);
+    BUMP_COUNTER(cache.stats[size_class].bytes_in_use, -size);
+}
+
+static void refill(int size_class)
+{
+    Slab *slab = malloc(POOL_SLAB_SIZE);
+    pthread_mutex_lock(&registry_lock);
+    slab->next = slabs;
+    slabs = slab;
+    pthread_mutex_unlock(&registry_lock);
+    BUMP_COUNTER(cache.stats[size_class].slabs, 1);
+
+    cache.bump[size_class] = (char *)slab + SLAB_HEADER_SIZE;
+    cache.bump_end[size_class] = (char *)slab + POOL_SLAB_SIZE;
+    POISON(cache.bump[size_class], POOL_SLAB_SIZE - SLAB_HEADER_SIZE);
+}
+
+void *pool_alloc(size_t size)
+{
+    int size_class = size_class_of(size);
+    count_allocation(size_class, size);
+    if (size_class == LARGE_CLASS) {
+        return malloc(size);
+    }
+
+    size_t block_size = CLASS_SIZES[size_class];
+    FreeBlock *block = cache.free_lists[size_class];
+    if (block != NULL) {
+        UNPOISON(block, block_size);
+        cache.free_lists[size_class] = block->next;
+        return block;
+    }
+
+    if (cache.bump_end[size_class] - cache.bump[size_class] < (ptrdiff_t)block_size) {
+        refill(size_class);
+    }
+    void *ptr = cache.bump[size_class];
+    cache.bump[size_class] += block_size;
+    UNPOISON(ptr, block_size);
+    return ptr;
+}
+
+void *pool_calloc(size_t size)
+{
+    void *ptr = pool_alloc(size);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+// Blocks that stay in the same size class are returned as is
+void *pool_realloc(void *ptr, size_t old_size, size_t new_size)
+{
+    if (ptr == NULL) {
+        return pool_alloc(new_size);
+    }
+
+    int old_class = size_class_of(old_size);
+    int new_class = size_class_of(new_size);
+    if (old_class == new_class) {
+        count_free(old_class, old_size);
+        count_allocation(new_class, new_size);
+        BUMP_COUNTER(cache.stats[new_class].total_allocations, -1);
+        return old_class == LARGE_CLASS ? realloc(ptr, new_size) : ptr;
+    }
+
+    void *new_ptr = pool_alloc(new_size);
+    memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    pool_free(ptr, old_size);
+    return new_ptr;
+}
+
+void pool_free(void *ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+
+    int size_class = size_class_of(size);
+    count_free(size_class, size);
+    if (size_class == LARGE_CLASS) {
+        free(ptr);
+        return;
+    }
+
+    // Blocks freed on another thread than they came from join this thread's free list
+    FreeBlock *block = ptr;
+    block->next = cache.free_lists[size_class];
+    cache.free_lists[size_class] = block;
+    POISON(block, CLASS_SIZES[size_class]);
+}
+
+SizeClassStats get_size_class_stats(int size_class)
+{
+    assert(size_class >= 0 && size_class <= LARGE_CLASS);
+    pthread_mutex_lock(&registry_lock);
+    SizeClassStats result = retired_stats[size_class];
+    for (ThreadCache *thread_cache = caches; thread_cache != NULL; thread_cache = thread_cache->next) {
+        SizeClassStats *stats = &thread_cache->stats[size_class];
+        result.objects_in_use += __atomic_load_n(&stats->objects_in_use, __ATOMIC_RELAXED);
+        result.bytes_in_use += __atomic_load_n(&stats->bytes_in_use, __ATOMIC_RELAXED);
+        result.total_allocations += __atomic_load_n(&stats->total_allocations, __ATOMIC_RELAXED);
+        result.slabs += __atomic_load_n(&stats->slabs, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&registry_lock);
+    result.block_size = size_class == LARGE_CLASS ? 0 : CLASS_SIZES[size_class];
+    return result;
+}
+
+char *pool_stats_to_str(void)
+{
+    size_t capacity = (NUM_SIZE_CLASSES + 2) * 96;
+    char *str = malloc(capacity);
+    size_t length = snprintf(str, capacity, "%6s %10s %12s %12s %6s\n", "class", "in use", "bytes", "allocations", "slabs");
+
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        SizeClassStats class_stats = get_size_class_stats(i);
+        if (class_stats.total_allocations == 0) {
+            continue;
+        }
+        char name[16];
+        if (i == LARGE_CLASS) {
+            snprintf(name, sizeof(name), "large");
+        } else {
+            snprintf(name, sizeof(name), "%zu", class_stats.block_size);
+        }
+        length += snprintf(str + length, capacity - length, "%6s %10zu %12zu %12zu %6zu\n", name,
+            class_stats.objects_in_use, class_stats.bytes_in_use, class_stats.total_allocations, class_stats.slabs);
+    }
+    return str;
+}
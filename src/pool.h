@@ -0,0 +1,32 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include <stddef.h>
+
+// Size-class pool allocator for small, fixed-size runtime and AST objects. Requests are rounded
+// up to one of NUM_SIZE_CLASSES sizes and served from per-thread free lists carved out of slab
+// pages. Anything larger than POOL_MAX_SMALL_SIZE goes straight to malloc but is still counted.
+// Frees must pass the size the block was allocated with.
+
+#define NUM_SIZE_CLASSES 16
+#define POOL_MAX_SMALL_SIZE 512
+#define POOL_SLAB_SIZE (64 * 1024)
+
+typedef struct SizeClassStats {
+    size_t block_size; // 0 for the large class
+    size_t objects_in_use;
+    size_t bytes_in_use; // Requested bytes, the difference to block_size * objects is internal fragmentation
+    size_t total_allocations;
+    size_t slabs;
+} SizeClassStats;
+
+extern void *pool_alloc(size_t size);
+extern void *pool_calloc(size_t size);
+extern void *pool_realloc(void *ptr, size_t old_size, size_t new_size);
+extern void pool_free(void *ptr, size_t size);
+
+// `size_class` is 0..NUM_SIZE_CLASSES-1, or NUM_SIZE_CLASSES for the large class
+extern SizeClassStats get_size_class_stats(int size_class);
+extern char *pool_stats_to_str(void);
+
+#endif // POOL_H
@@ -0,0 +1,78 @@
+#include "bench_utils.h"
+#include "parser.h"
+#include "pool.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Allocation throughput of the size-class pools against malloc on a mix of small sizes, and the
+// per-class counters after parsing a large program
+
+#define LIVE_BLOCKS 4096
+#define ROUNDS 2000
+
+// Sizes of the runtime objects and AST lists that dominate allocation
+static const size_t SIZES[] = { 24, 32, 40, 48, 56, 64, 96, 120 };
+#define NUM_SIZES (sizeof(SIZES) / sizeof(SIZES[0]))
+
+static void *blocks[LIVE_BLOCKS];
+
+static uint64_t bench_malloc(void)
+{
+    uint64_t start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+            blocks[i] = malloc(SIZES[(i + round) % NUM_SIZES]);
+            *(volatile char *)blocks[i] = 1;
+        }
+        for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+            free(blocks[i]);
+        }
+    }
+    return now_ns() - start;
+}
+
+static uint64_t bench_pool(void)
+{
+    uint64_t start = now_ns();
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+            blocks[i] = pool_alloc(SIZES[(i + round) % NUM_SIZES]);
+            *(volatile char *)blocks[i] = 1;
+        }
+        for (size_t i = 0; i < LIVE_BLOCKS; i++) {
+            pool_free(blocks[i], SIZES[(i + round) % NUM_SIZES]);
+        }
+    }
+    return now_ns() - start;
+}
+
+int main(void)
+{
+    double allocations = (double)LIVE_BLOCKS * ROUNDS;
+    uint64_t malloc_ns = bench_malloc();
+    uint64_t pool_ns = bench_pool();
+    printf("%-8s %12s %10s\n", "", "total ms", "ns/alloc");
+    printf("%-8s %12.2f %10.2f\n", "malloc", malloc_ns / 1e6, malloc_ns / allocations);
+    printf("%-8s %12.2f %10.2f\n", "pool", pool_ns / 1e6, pool_ns / allocations);
+
+    const char *statement = "let add = fn(a, b) { if (a > b) { a - b } else { add(b, a) } }; add(1, 2 * 3);";
+    size_t count = 2000;
+    char *input = malloc(strlen(statement) * count + 1);
+    input[0] = '\0';
+    for (size_t i = 0; i < count; i++) {
+        strcat(input, statement);
+    }
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    printf("\nafter parsing %zu statements:\n", program->size);
+    char *dump = pool_stats_to_str();
+    printf("%s", dump);
+    free(dump);
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(input);
+    return 0;
+}
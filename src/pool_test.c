@@ -0,0 +1,187 @@
+#include "parser.h"
+#include "pool.h"
+#include "str_utils.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+#define LARGE_CLASS NUM_SIZE_CLASSES
+
+static size_t total_objects_in_use(void)
+{
+    size_t total = 0;
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        total += get_size_class_stats(i).objects_in_use;
+    }
+    return total;
+}
+
+static int class_of_block(size_t size)
+{
+    SizeClassStats before[LARGE_CLASS + 1];
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        before[i] = get_size_class_stats(i);
+    }
+    void *ptr = pool_alloc(size);
+    int found = -1;
+    for (int i = 0; i <= LARGE_CLASS; i++) {
+        if (get_size_class_stats(i).objects_in_use == before[i].objects_in_use + 1) {
+            found = i;
+        }
+    }
+    pool_free(ptr, size);
+    return found;
+}
+
+TEST_CASE(sizes_round_up_to_their_class)
+{
+    struct {
+        size_t size;
+        size_t block_size;
+    } tests[] = {
+        { 1, 16 },
+        { 16, 16 },
+        { 17, 32 },
+        { 100, 112 },
+        { 129, 160 },
+        { 257, 320 },
+        { 512, 512 },
+        { 513, 0 },
+        { 4096, 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        int size_class = class_of_block(tests[i].size);
+        size_t block_size = get_size_class_stats(size_class).block_size;
+        if (block_size != tests[i].block_size) {
+            printf("Size %zu: expected block size %zu, got %zu\n", tests[i].size, tests[i].block_size, block_size);
+            assert(1 != 1);
+        }
+    }
+}
+
+TEST_CASE(freed_blocks_are_reused)
+{
+    void *first = pool_alloc(40);
+    memset(first, 0x5A, 40);
+    pool_free(first, 40);
+
+    // Anything in the same class gets the block back
+    void *second = pool_calloc(48);
+    assert(second == first);
+    for (size_t i = 0; i < 48; i++) {
+        assert(((uint8_t *)second)[i] == 0);
+    }
+    pool_free(second, 48);
+}
+
+TEST_CASE(realloc_keeps_contents_across_classes)
+{
+    size_t before = total_objects_in_use();
+
+    char *ptr = pool_alloc(10);
+    strcpy(ptr, "abcdefghi");
+    char *same_class = pool_realloc(ptr, 10, 16);
+    assert(same_class == ptr);
+
+    char *grown = pool_realloc(same_class, 16, 300);
+    assert(strcmp(grown, "abcdefghi") == 0);
+    char *large = pool_realloc(grown, 300, 2000);
+    assert(strcmp(large, "abcdefghi") == 0);
+    char *shrunk = pool_realloc(large, 2000, 24);
+    assert(strcmp(shrunk, "abcdefghi") == 0);
+    pool_free(shrunk, 24);
+
+    assert(total_objects_in_use() == before);
+}
+
+TEST_CASE(counters_track_bytes_per_class)
+{
+    int size_class = class_of_block(64);
+    SizeClassStats before = get_size_class_stats(size_class);
+
+    void *blocks[100];
+    for (int i = 0; i < 100; i++) {
+        blocks[i] = pool_alloc(60);
+    }
+    SizeClassStats during = get_size_class_stats(size_class);
+    assert(during.objects_in_use == before.objects_in_use + 100);
+    assert(during.bytes_in_use == before.bytes_in_use + 6000);
+    assert(during.total_allocations == before.total_allocations + 100);
+
+    for (int i = 0; i < 100; i++) {
+        pool_free(blocks[i], 60);
+    }
+    SizeClassStats after = get_size_class_stats(size_class);
+    assert(after.objects_in_use == before.objects_in_use);
+    assert(after.bytes_in_use == before.bytes_in_use);
+
+    char *dump = pool_stats_to_str();
+    assert(strstr(dump, "allocations") != NULL);
+    assert(strstr(dump, "    64 ") != NULL);
+    free(dump);
+}
+
+TEST_CASE(parser_and_strings_release_everything)
+{
+    size_t before = total_objects_in_use();
+
+    String *string = make_string(NULL);
+    for (int i = 0; i < 50; i++) {
+        copy_str_into_string(string, "let add = fn(a, b) { a + b }; add(1, 2);");
+    }
+    char *input = get_str_from_string(string);
+    cleanup_string(string);
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    assert(program->size == 100);
+    char *program_str = program_to_str(program);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    free(program_str);
+    free(input);
+
+    assert(total_objects_in_use() == before);
+}
+
+#define THREAD_ROUNDS 10000
+
+static void *churn(void *arg)
+{
+    size_t size = (size_t)(uintptr_t)arg;
+    void *blocks[16];
+    for (int round = 0; round < THREAD_ROUNDS; round++) {
+        for (int i = 0; i < 16; i++) {
+            blocks[i] = pool_alloc(size);
+            memset(blocks[i], i, size);
+        }
+        for (int i = 0; i < 16; i++) {
+            assert(((uint8_t *)blocks[i])[size - 1] == i);
+            pool_free(blocks[i], size);
+        }
+    }
+    return NULL;
+}
+
+TEST_CASE(threads_allocate_concurrently)
+{
+    size_t before = total_objects_in_use();
+
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        pthread_create(&threads[i], NULL, churn, (void *)(uintptr_t)(24 + i * 40));
+    }
+    for (int i = 0; i < 4; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    assert(total_objects_in_use() == before);
+}
+
+RUN_TESTS()
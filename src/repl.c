@@ -1,4 +1,14 @@
-#include "lexer.h"
+#include "bytecode_cache.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "pool.h"
+#include "single_pass.h"
+#include "snapshot.h"
+#include "str_utils.h"
+#include "vm.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -30,23 +40,201 @@ char *read_input(void)
     return input;
 }
 
-void eval_and_print(const char *input)
+void print_errors(const char *stage, ErrorArrayList *errors, size_t from)
 {
-    Lexer *l = make_lexer(input);
-    Token tok;
-    while (tok.type != TOKEN_EOF) {
-        tok = lex_next_token(l);
-        printf("{ type: %s, literal: %s }\n", token_type_to_str(tok.type), tok.literal);
+    for (size_t i = from; i < errors->size; i++) {
+        printf("%s error: %s\n", stage, get_error_from_arraylist(errors, i));
     }
-    cleanup_lexer(l);
 }
 
-int main(void)
+// Globals, constants and heap objects outlive a single line so later input can refer to earlier definitions
+void eval_and_print(Compiler *compiler, VM *vm, char *input)
 {
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+
+    if (parser->errors->size != 0) {
+        print_errors("Parser", parser->errors, 0);
+    } else {
+        optimize_program(program);
+
+        size_t errors_before = compiler->errors->size;
+        FunctionProto *main = compile_program(compiler, program);
+        if (main == NULL) {
+            print_errors("Compiler", compiler->errors, errors_before);
+        } else if (run_vm(vm, main) != VM_OK) {
+            printf("Runtime error: %s\n", vm->error);
+        } else {
+            char *result = inspect_value(get_last_popped(vm));
+            printf("%s\n", result);
+            free(result);
+        }
+    }
+
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+static char *read_script(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return NULL;
+    }
+    char *input = read_stream(file);
+    fclose(file);
+    return input;
+}
+
+// Restores the snapshot at `path` unless it is NULL, returning FALSE if it cannot be loaded
+static bool start_from_snapshot(Compiler *compiler, VM *vm, const char *path, Snapshot **snapshot)
+{
+    *snapshot = path != NULL ? load_snapshot(compiler, vm, path) : NULL;
+    if (path != NULL && *snapshot == NULL) {
+        fprintf(stderr, "%s: not a snapshot this interpreter can load\n", path);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Runs a script once and prints its result. It is compiled while it is parsed, which is quickest to
+// the result for code that runs once (see single_pass.h), and the bytecode is cached so that running
+// the same script again skips compiling it (see bytecode_cache.h). The cache is kept next to the
+// script, or in $MONKEY_CACHE_DIR if that is set. Scripts started from a snapshot are not cached,
+// their bytecode refers to the snapshot's globals and constants.
+static int run_file(const char *path, bool use_cache, const char *snapshot_path)
+{
+    char *input = read_script(path);
+    if (input == NULL) {
+        return 1;
+    }
+
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    Snapshot *snapshot;
+    if (!start_from_snapshot(compiler, vm, snapshot_path, &snapshot)) {
+        cleanup_vm(vm);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        free(input);
+        return 1;
+    }
+    int status = 0;
+    char *cache_path = use_cache && snapshot == NULL ? cached_program_path(path, input, getenv("MONKEY_CACHE_DIR")) : NULL;
+    CachedProgram *cached = cache_path != NULL ? load_cached_program(compiler, input, cache_path) : NULL;
+    FunctionProto *main = cached != NULL ? cached->main : compile_single_pass(compiler, input);
+    if (main != NULL && cached == NULL && cache_path != NULL) {
+        // Caching is best effort, the script still runs if the file cannot be written
+        write_cached_program(compiler, main, input, cache_path);
+    }
+    if (main == NULL) {
+        print_errors("Compiler", compiler->errors, 0);
+        status = 1;
+    } else if (run_vm(vm, main) != VM_OK) {
+        printf("Runtime error: %s\n", vm->error);
+        status = 1;
+    } else {
+        char *result = inspect_value(get_last_popped(vm));
+        printf("%s\n", result);
+        free(result);
+    }
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    // The heap's objects and prototypes lived in the mapped files, so they go last
+    if (cached != NULL) {
+        cleanup_cached_program(cached);
+    }
+    if (snapshot != NULL) {
+        cleanup_snapshot(snapshot);
+    }
+    free(cache_path);
+    free(input);
+    return status;
+}
+
+// Runs an initialization script and saves the state it leaves behind, see snapshot.h
+static int make_snapshot(const char *script_path, const char *snapshot_path)
+{
+    char *input = read_script(script_path);
+    if (input == NULL) {
+        return 1;
+    }
+
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    int status = 0;
+    FunctionProto *main = compile_single_pass(compiler, input);
+    if (main == NULL) {
+        print_errors("Compiler", compiler->errors, 0);
+        status = 1;
+    } else if (run_vm(vm, main) != VM_OK) {
+        printf("Runtime error: %s\n", vm->error);
+        status = 1;
+    } else if (!write_snapshot(compiler, vm, snapshot_path)) {
+        fprintf(stderr, "%s: could not write the snapshot\n", snapshot_path);
+        status = 1;
+    }
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    free(input);
+    return status;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "--make-snapshot") == 0) {
+        return make_snapshot(argv[2], argv[3]);
+    }
+    bool use_cache = TRUE;
+    const char *snapshot_path = NULL;
+    const char *file = NULL;
+    bool usage = FALSE;
+    for (int i = 1; i < argc && !usage; i++) {
+        if (strcmp(argv[i], "--no-cache") == 0) {
+            use_cache = FALSE;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshot_path = argv[++i];
+        } else if (argv[i][0] != '-' && file == NULL) {
+            file = argv[i];
+        } else {
+            usage = TRUE;
+        }
+    }
+    if (usage) {
+        fprintf(stderr,
+            "Usage: %s [--no-cache] [--snapshot SNAPSHOT] [file]\n"
+            "       %s --make-snapshot SCRIPT SNAPSHOT\n"
+            "Runs the file and prints its result, or starts a REPL when no file is given.\n"
+            "The compiled file is cached next to it, or in $MONKEY_CACHE_DIR, unless --no-cache is given.\n"
+            "--make-snapshot runs SCRIPT and saves its globals, --snapshot starts from them.\n",
+            argv[0], argv[0]);
+        return 2;
+    }
+    if (file != NULL) {
+        return run_file(file, use_cache, snapshot_path);
+    }
+
     char *input;
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    Snapshot *snapshot;
+    if (!start_from_snapshot(compiler, vm, snapshot_path, &snapshot)) {
+        cleanup_vm(vm);
+        cleanup_compiler(compiler);
+        cleanup_heap(heap);
+        return 1;
+    }
 
     printf("Welcome to the Basic REPL!\n");
-    printf("Type 'exit' to quit.\n");
+    printf("Type 'exit' to quit, 'gc' for garbage collector statistics, 'pool' for allocator statistics.\n");
 
     while (1) {
         print_prompt();
@@ -63,9 +251,25 @@ int main(void)
             break;
         }
 
-        eval_and_print(input);
+        if (strcmp(input, "gc") == 0) {
+            char *stats = gc_stats_to_str(heap);
+            printf("%s", stats);
+            free(stats);
+        } else if (strcmp(input, "pool") == 0) {
+            char *stats = pool_stats_to_str();
+            printf("%s", stats);
+            free(stats);
+        } else {
+            eval_and_print(compiler, vm, input);
+        }
         free(input);
     }
 
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    if (snapshot != NULL) {
+        cleanup_snapshot(snapshot);
+    }
     return 0;
 }
@@ -0,0 +1,433 @@
+#include "resolver.h"
+#include "arrlist_utils.h"
+#include "ast.h"
+#include "builtins.h"
+#include "globals.h"
+#include "hash_map.h"
+#include "parser.h"
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_SYMBOL_CAPACITY 16
+
+static void report_resolver_error(Resolver *resolver, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t total_len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *error = allocate(resolver->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
+    va_start(args, format);
+    vsprintf(error, format, args);
+    va_end(args);
+
+    add_error_to_arraylist(resolver->errors, error);
+}
+
+SymbolArrayList *make_symbol_arraylist(void)
+{
+    SymbolArrayList *list = malloc(sizeof(SymbolArrayList));
+    list->array = calloc(INITIAL_SYMBOL_CAPACITY, sizeof(Symbol));
+    list->size = 0;
+    list->capacity = INITIAL_SYMBOL_CAPACITY;
+    return list;
+}
+
+Symbol *add_symbol_to_arraylist(SymbolArrayList *list, const char *name)
+{
+    if (list->size == list->capacity) {
+        list->array = (Symbol *)realloc_backing_array(&libc_allocator, list->array, list->size, list->capacity, list->capacity * 2, sizeof(Symbol));
+        list->capacity *= 2;
+    }
+    Symbol *symbol = &list->array[list->size];
+    strncpy(symbol->name, name, MAX_IDENTIFIER_SIZE);
+    symbol->name[MAX_IDENTIFIER_SIZE] = '\0';
+    symbol->index = (int)list->size;
+    symbol->declaration = NULL;
+    symbol->defined = FALSE;
+    list->size++;
+    return symbol;
+}
+
+Symbol *find_symbol_in_arraylist(SymbolArrayList *list, const char *name)
+{
+    for (size_t i = 0; i < list->size; i++) {
+        if (strcmp(list->array[i].name, name) == 0) {
+            return &list->array[i];
+        }
+    }
+    return NULL;
+}
+
+void cleanup_symbol_arraylist(SymbolArrayList *list)
+{
+    free(list->array);
+    free(list);
+}
+
+Resolver *make_resolver(void)
+{
+    Resolver *resolver = malloc(sizeof(Resolver));
+    resolver->globals = make_symbol_arraylist();
+    resolver->global_indices = make_string_map();
+    resolver->current = NULL;
+    resolver->loop_depth = 0;
+    resolver->errors = make_error_arraylist(NULL);
+    return resolver;
+}
+
+void cleanup_resolver(Resolver *resolver)
+{
+    cleanup_symbol_arraylist(resolver->globals);
+    cleanup_string_map(resolver->global_indices);
+    cleanup_error_arraylist(resolver->errors);
+    free(resolver);
+}
+
+size_t get_global_count(Resolver *resolver)
+{
+    return resolver->globals->size;
+}
+
+Symbol *lookup_global(Resolver *resolver, const char *name)
+{
+    int64_t index;
+    return string_map_get(resolver->global_indices, name, &index) ? &resolver->globals->array[index] : NULL;
+}
+
+static Symbol *add_global(Resolver *resolver, const char *name)
+{
+    Symbol *symbol = add_symbol_to_arraylist(resolver->globals, name);
+    string_map_put(resolver->global_indices, symbol->name, symbol->index);
+    return symbol;
+}
+
+// Defines a global that code compiled elsewhere set, e.g. one restored from a snapshot
+Symbol *define_global(Resolver *resolver, const char *name)
+{
+    Symbol *symbol = lookup_global(resolver, name);
+    if (symbol == NULL) {
+        symbol = add_global(resolver, name);
+    }
+    symbol->defined = TRUE;
+    return symbol;
+}
+
+static void set_resolution(ASTNode *identifier, ResolutionScope scope, int index, int depth)
+{
+    identifier->data.identifier.resolution.scope = scope;
+    identifier->data.identifier.resolution.index = index;
+    identifier->data.identifier.resolution.depth = depth;
+}
+
+void declare_variable(Resolver *resolver, ASTNode *identifier)
+{
+    const char *name = identifier->data.identifier.literal.value.identifier;
+
+    if (resolver->current == NULL) {
+        Symbol *symbol = lookup_global(resolver, name);
+        if (symbol == NULL) {
+            if (resolver->globals->size >= MAX_GLOBALS) {
+                report_resolver_error(resolver, "Too many global variables, cannot define %s", name);
+                return;
+            }
+            symbol = add_global(resolver, name);
+        }
+        symbol->declaration = identifier;
+        symbol->defined = TRUE;
+        set_resolution(identifier, SCOPE_GLOBAL, symbol->index, 0);
+        return;
+    }
+
+    // Redefining a name inside the same function reuses its slot, like rebinding an environment entry
+    SymbolArrayList *locals = resolver->current->locals;
+    Symbol *symbol = find_symbol_in_arraylist(locals, name);
+    if (symbol == NULL) {
+        if (locals->size >= MAX_LOCALS) {
+            report_resolver_error(resolver, "Too many local variables in function, cannot define %s", name);
+            return;
+        }
+        symbol = add_symbol_to_arraylist(locals, name);
+    }
+    symbol->declaration = identifier;
+    symbol->defined = TRUE;
+    set_resolution(identifier, SCOPE_LOCAL, symbol->index, 0);
+}
+
+static int add_upvalue(Resolver *resolver, FunctionScope *scope, bool is_local, int index)
+{
+    FunctionLiteral *function = &scope->function->data.function_literal;
+
+    for (size_t i = 0; i < function->num_upvalues; i++) {
+        if (function->upvalues[i].is_local == is_local && function->upvalues[i].index == index) {
+            return (int)i;
+        }
+    }
+
+    if (function->num_upvalues >= MAX_UPVALUES) {
+        report_resolver_error(resolver, "Too many captured variables in function");
+        return -1;
+    }
+
+    if (function->num_upvalues == function->upvalue_capacity) {
+        size_t new_capacity = function->upvalue_capacity == 0 ? 4 : function->upvalue_capacity * 2;
+        function->upvalues = realloc_backing_array(&libc_allocator, function->upvalues, function->upvalue_capacity, function->upvalue_capacity, new_capacity, sizeof(UpvalueDescriptor));
+        function->upvalue_capacity = new_capacity;
+    }
+    function->upvalues[function->num_upvalues].is_local = is_local;
+    function->upvalues[function->num_upvalues].index = index;
+    return (int)function->num_upvalues++;
+}
+
+// Walks outwards through the enclosing functions, threading an upvalue through every function in between
+static int resolve_upvalue(Resolver *resolver, FunctionScope *scope, const char *name, int *depth)
+{
+    if (scope->enclosing == NULL) {
+        return -1;
+    }
+
+    Symbol *local = find_symbol_in_arraylist(scope->enclosing->locals, name);
+    if (local != NULL) {
+        if (local->declaration != NULL) {
+            local->declaration->data.identifier.resolution.captured = TRUE;
+        }
+        *depth = 1;
+        return add_upvalue(resolver, scope, TRUE, local->index);
+    }
+
+    int upvalue = resolve_upvalue(resolver, scope->enclosing, name, depth);
+    if (upvalue == -1) {
+        return -1;
+    }
+    (*depth)++;
+    return add_upvalue(resolver, scope, FALSE, upvalue);
+}
+
+static void resolve_identifier(Resolver *resolver, ASTNode *identifier)
+{
+    const char *name = identifier->data.identifier.literal.value.identifier;
+    FunctionScope *scope = resolver->current;
+
+    if (scope != NULL) {
+        Symbol *local = find_symbol_in_arraylist(scope->locals, name);
+        if (local != NULL) {
+            set_resolution(identifier, SCOPE_LOCAL, local->index, 0);
+            return;
+        }
+
+        int depth = 0;
+        int upvalue = resolve_upvalue(resolver, scope, name, &depth);
+        if (upvalue != -1) {
+            set_resolution(identifier, SCOPE_UPVALUE, upvalue, depth);
+            return;
+        }
+    }
+
+    Symbol *global = lookup_global(resolver, name);
+    if (global != NULL && (global->defined || scope != NULL)) {
+        set_resolution(identifier, SCOPE_GLOBAL, global->index, 0);
+        return;
+    }
+
+    // A builtin is only found if no global of the same name has been seen, so programs can shadow them
+    int builtin = lookup_builtin(name);
+    if (global == NULL && builtin != -1) {
+        set_resolution(identifier, SCOPE_BUILTIN, builtin, 0);
+        return;
+    }
+
+    if (scope == NULL) {
+        // Top-level code runs in order, so the global has to exist by now
+        report_resolver_error(resolver, "Identifier not found: %s", name);
+        return;
+    }
+
+    // Function bodies run later, so they may refer to globals that are only defined further down.
+    // The slot is reserved now and checked once the whole program has been resolved.
+    if (resolver->globals->size >= MAX_GLOBALS) {
+        report_resolver_error(resolver, "Too many global variables, cannot reference %s", name);
+        return;
+    }
+    global = add_global(resolver, name);
+    set_resolution(identifier, SCOPE_GLOBAL, global->index, 0);
+}
+
+// Opens the scope of `function`, a function literal node, for its parameters and body. The
+// single-pass compiler resolves functions as it parses them, so it goes through these steps itself.
+void enter_function_scope(Resolver *resolver, FunctionScope *scope, ASTNode *function)
+{
+    *scope = (FunctionScope) {
+        .enclosing = resolver->current,
+        .function = function,
+        .locals = make_symbol_arraylist(),
+        .enclosing_loop_depth = resolver->loop_depth,
+    };
+
+    // Resolving the same tree twice must not duplicate upvalues
+    function->data.function_literal.num_upvalues = 0;
+    resolver->current = scope;
+    // A function body cannot break out of a loop it is defined in
+    resolver->loop_depth = 0;
+}
+
+void declare_parameter(Resolver *resolver, ASTNode *parameter)
+{
+    if (find_symbol_in_arraylist(resolver->current->locals, parameter->data.identifier.literal.value.identifier) != NULL) {
+        report_resolver_error(resolver, "Duplicate parameter: %s", parameter->data.identifier.literal.value.identifier);
+        return;
+    }
+    declare_variable(resolver, parameter);
+}
+
+void leave_function_scope(Resolver *resolver)
+{
+    FunctionScope *scope = resolver->current;
+    scope->function->data.function_literal.num_locals = scope->locals->size;
+    resolver->current = scope->enclosing;
+    resolver->loop_depth = scope->enclosing_loop_depth;
+    cleanup_symbol_arraylist(scope->locals);
+}
+
+static void resolve_function(Resolver *resolver, ASTNode *node)
+{
+    FunctionLiteral *function = &node->data.function_literal;
+    FunctionScope scope;
+    enter_function_scope(resolver, &scope, node);
+    for (size_t i = 0; i < function->parameters->size; i++) {
+        declare_parameter(resolver, function->parameters->array[i]);
+    }
+    resolve_node(resolver, function->body);
+    leave_function_scope(resolver);
+}
+
+void resolve_node(Resolver *resolver, ASTNode *node)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+    case NODE_LET_STMT:
+        // Declaring a function's name first lets its body refer to itself, which is how recursion works
+        if (node->data.let_stmt.right != NULL && node->data.let_stmt.right->type == NODE_FUNCTION_LITERAL) {
+            declare_variable(resolver, node->data.let_stmt.left);
+            resolve_node(resolver, node->data.let_stmt.right);
+        } else {
+            resolve_node(resolver, node->data.let_stmt.right);
+            declare_variable(resolver, node->data.let_stmt.left);
+        }
+        break;
+    case NODE_RETURN_STMT:
+        resolve_node(resolver, node->data.return_stmt);
+        break;
+    case NODE_EXPR_STMT:
+        resolve_node(resolver, node->data.expr_stmt);
+        break;
+    case NODE_PREFIX_EXPR:
+        resolve_node(resolver, node->data.prefix_expr.right);
+        break;
+    case NODE_INFIX_EXPR:
+        resolve_node(resolver, node->data.infix_expr.left);
+        resolve_node(resolver, node->data.infix_expr.right);
+        break;
+    case NODE_LITERAL:
+        break;
+    case NODE_IDENTIFIER:
+        resolve_identifier(resolver, node);
+        break;
+    case NODE_BLOCK_STMT:
+        for (size_t i = 0; i < node->data.block_stmt->size; i++) {
+            resolve_node(resolver, node->data.block_stmt->array[i]);
+        }
+        break;
+    case NODE_IF_EXPR:
+        resolve_node(resolver, node->data.if_expr.condition);
+        resolve_node(resolver, node->data.if_expr.consequence);
+        resolve_node(resolver, node->data.if_expr.alternative);
+        break;
+    case NODE_FUNCTION_LITERAL:
+        resolve_function(resolver, node);
+        break;
+    case NODE_CALL_EXPR:
+        resolve_node(resolver, node->data.call_expr.function);
+        for (size_t i = 0; i < node->data.call_expr.arguments->size; i++) {
+            resolve_node(resolver, node->data.call_expr.arguments->array[i]);
+        }
+        break;
+    case NODE_WHILE_STMT:
+        resolve_node(resolver, node->data.while_stmt.condition);
+        resolver->loop_depth++;
+        resolve_node(resolver, node->data.while_stmt.body);
+        resolver->loop_depth--;
+        break;
+    case NODE_ARRAY_LITERAL:
+        for (size_t i = 0; i < node->data.array_literal->size; i++) {
+            resolve_node(resolver, node->data.array_literal->array[i]);
+        }
+        break;
+    case NODE_HASH_LITERAL:
+        for (size_t i = 0; i < node->data.hash_literal.keys->size; i++) {
+            resolve_node(resolver, node->data.hash_literal.keys->array[i]);
+            resolve_node(resolver, node->data.hash_literal.values->array[i]);
+        }
+        break;
+    case NODE_INDEX_EXPR:
+        resolve_node(resolver, node->data.index_expr.left);
+        resolve_node(resolver, node->data.index_expr.index);
+        break;
+    case NODE_BREAK_STMT:
+    case NODE_CONTINUE_STMT:
+        if (resolver->loop_depth == 0) {
+            report_resolver_error(resolver, "%s outside of a loop", node->token_literal);
+        }
+        break;
+    default:
+        assert(1 != 1);
+    }
+}
+
+// Globals are only ever added at the end, so those from `first` on are the ones referenced or
+// defined since
+void report_undefined_globals(Resolver *resolver, size_t first)
+{
+    for (size_t i = first; i < resolver->globals->size; i++) {
+        Symbol *global = &resolver->globals->array[i];
+        if (!global->defined) {
+            report_resolver_error(resolver, "Identifier not found: %s", global->name);
+            // Only report a dangling forward reference once, its slot just stays empty
+            global->defined = TRUE;
+        }
+    }
+}
+
+bool resolve_program(Resolver *resolver, Program *program)
+{
+    size_t errors_before = resolver->errors->size;
+    size_t globals_before = resolver->globals->size;
+
+    for (size_t i = 0; i < program->size; i++) {
+        resolve_node(resolver, program->array[i]);
+    }
+    report_undefined_globals(resolver, globals_before);
+
+    return resolver->errors->size == errors_before;
+}
+
+// Resolves a function skipped by a lazy parser, once it is parsed on its first call. Only
+// functions outside any other function are skipped, so everything it does not declare itself is a
+// global, and the whole program has been resolved by then.
+bool resolve_lazy_function(Resolver *resolver, ASTNode *function)
+{
+    size_t errors_before = resolver->errors->size;
+    size_t globals_before = resolver->globals->size;
+
+    assert(resolver->current == NULL);
+    resolve_node(resolver, function);
+    report_undefined_globals(resolver, globals_before);
+
+    return resolver->errors->size == errors_before;
+}
@@ -0,0 +1,63 @@
+#ifndef RESOLVER_H
+#define RESOLVER_H
+
+#include "ast.h"
+#include "globals.h"
+#include "hash_map.h"
+#include "parser.h"
+#include <stddef.h>
+
+#define MAX_LOCALS 256
+#define MAX_UPVALUES 256
+#define MAX_GLOBALS 65536
+
+typedef struct Symbol {
+    char name[MAX_IDENTIFIER_SIZE + 1];
+    int index;
+    ASTNode *declaration; // Identifier node that last (re)defined the symbol, NULL for forward references
+    bool defined;
+} Symbol;
+
+typedef struct SymbolArrayList {
+    Symbol *array;
+    size_t size;
+    size_t capacity;
+} SymbolArrayList;
+
+typedef struct FunctionScope {
+    struct FunctionScope *enclosing;
+    ASTNode *function;
+    SymbolArrayList *locals;
+    int enclosing_loop_depth;
+} FunctionScope;
+
+// Maps every identifier to a frame slot, global slot or upvalue index ahead of execution.
+// Globals are kept across calls to `resolve_program` so a REPL can resolve one line at a time.
+typedef struct Resolver {
+    SymbolArrayList *globals;
+    StringMap *global_indices; // Index in `globals` by name, every identifier at any depth may end up looking there
+    FunctionScope *current;
+    int loop_depth; // Loops around the code being resolved, counted within the current function
+    ErrorArrayList *errors;
+} Resolver;
+
+extern Resolver *make_resolver(void);
+extern void cleanup_resolver(Resolver *resolver);
+extern bool resolve_program(Resolver *resolver, Program *program);
+extern bool resolve_lazy_function(Resolver *resolver, ASTNode *function);
+extern void resolve_node(Resolver *resolver, ASTNode *node);
+extern void declare_variable(Resolver *resolver, ASTNode *identifier);
+extern void enter_function_scope(Resolver *resolver, FunctionScope *scope, ASTNode *function);
+extern void declare_parameter(Resolver *resolver, ASTNode *parameter);
+extern void leave_function_scope(Resolver *resolver);
+extern void report_undefined_globals(Resolver *resolver, size_t first);
+extern size_t get_global_count(Resolver *resolver);
+extern Symbol *lookup_global(Resolver *resolver, const char *name);
+extern Symbol *define_global(Resolver *resolver, const char *name);
+
+extern SymbolArrayList *make_symbol_arraylist(void);
+extern Symbol *add_symbol_to_arraylist(SymbolArrayList *list, const char *name);
+extern Symbol *find_symbol_in_arraylist(SymbolArrayList *list, const char *name);
+extern void cleanup_symbol_arraylist(SymbolArrayList *list);
+
+#endif // RESOLVER_H
@@ -0,0 +1,281 @@
+#include "errors.h"
+#include "parser.h"
+#include "resolver.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static void check_parser_errors(Parser *parser)
+{
+    if (parser->errors->size == 0) {
+        return;
+    }
+    printf("Parser encountered %zu error(s)\n", parser->errors->size);
+    for (size_t i = 0; i < parser->errors->size; i++) {
+        printf("%s\n", get_error_from_arraylist(parser->errors, i));
+    }
+    assert(1 != 1);
+}
+
+static void check_resolver_errors(Resolver *resolver)
+{
+    if (resolver->errors->size == 0) {
+        return;
+    }
+    printf("Resolver encountered %zu error(s)\n", resolver->errors->size);
+    for (size_t i = 0; i < resolver->errors->size; i++) {
+        printf("%s\n", get_error_from_arraylist(resolver->errors, i));
+    }
+    assert(1 != 1);
+}
+
+static void assert_resolution(ASTNode *identifier, const char *name, ResolutionScope scope, int index, int depth)
+{
+    assert(identifier->type == NODE_IDENTIFIER);
+    assert(strcmp(identifier->data.identifier.literal.value.identifier, name) == 0);
+    Resolution *resolution = &identifier->data.identifier.resolution;
+    if (resolution->scope != scope || resolution->index != index || resolution->depth != depth) {
+        printf("Resolution of %s: expected (scope %d, index %d, depth %d), got (scope %d, index %d, depth %d)\n",
+            name, scope, index, depth, resolution->scope, resolution->index, resolution->depth);
+        assert(1 != 1);
+    }
+}
+
+// Returns the expression of the nth statement of a block or program statement
+static ASTNode *nth_expr(ASTNode *block, size_t n)
+{
+    ASTNode *statement = block->data.block_stmt->array[n];
+    switch (statement->type) {
+    case NODE_EXPR_STMT:
+        return statement->data.expr_stmt;
+    case NODE_RETURN_STMT:
+        return statement->data.return_stmt;
+    case NODE_LET_STMT:
+        return statement->data.let_stmt.right;
+    default:
+        assert(1 != 1);
+        return NULL;
+    }
+}
+
+TEST_CASE(resolve_globals)
+{
+    Parser *parser = make_parser("let a = 1; let b = a; let a = b; a;", NULL);
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+
+    Resolver *resolver = make_resolver();
+    assert(resolve_program(resolver, program));
+    check_resolver_errors(resolver);
+
+    assert(get_global_count(resolver) == 2);
+    assert_resolution(get_nth_statement(program, 0)->data.let_stmt.left, "a", SCOPE_GLOBAL, 0, 0);
+    assert_resolution(get_nth_statement(program, 1)->data.let_stmt.left, "b", SCOPE_GLOBAL, 1, 0);
+    assert_resolution(get_nth_statement(program, 1)->data.let_stmt.right, "a", SCOPE_GLOBAL, 0, 0);
+    // Redefinition reuses the existing slot
+    assert_resolution(get_nth_statement(program, 2)->data.let_stmt.left, "a", SCOPE_GLOBAL, 0, 0);
+    assert_resolution(get_nth_statement(program, 3)->data.expr_stmt, "a", SCOPE_GLOBAL, 0, 0);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(resolve_locals)
+{
+    Parser *parser = make_parser("let g = 1; fn(a, b) { let c = a + b; let a = c; g + a }", NULL);
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+
+    Resolver *resolver = make_resolver();
+    assert(resolve_program(resolver, program));
+    check_resolver_errors(resolver);
+
+    ASTNode *function = get_nth_statement(program, 1)->data.expr_stmt;
+    FunctionLiteral *literal = &function->data.function_literal;
+    assert(literal->num_locals == 3);
+    assert(literal->num_upvalues == 0);
+
+    assert_resolution(literal->parameters->array[0], "a", SCOPE_LOCAL, 0, 0);
+    assert_resolution(literal->parameters->array[1], "b", SCOPE_LOCAL, 1, 0);
+
+    ASTNode *body = literal->body;
+    ASTNode *let_c = body->data.block_stmt->array[0];
+    assert_resolution(let_c->data.let_stmt.left, "c", SCOPE_LOCAL, 2, 0);
+    assert_resolution(let_c->data.let_stmt.right->data.infix_expr.left, "a", SCOPE_LOCAL, 0, 0);
+    assert_resolution(let_c->data.let_stmt.right->data.infix_expr.right, "b", SCOPE_LOCAL, 1, 0);
+
+    ASTNode *let_a = body->data.block_stmt->array[1];
+    assert_resolution(let_a->data.let_stmt.left, "a", SCOPE_LOCAL, 0, 0);
+
+    ASTNode *sum = nth_expr(body, 2);
+    assert_resolution(sum->data.infix_expr.left, "g", SCOPE_GLOBAL, 0, 0);
+    assert_resolution(sum->data.infix_expr.right, "a", SCOPE_LOCAL, 0, 0);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(resolve_upvalues)
+{
+    char input[]
+        = "fn(a) {\n"
+          "    let b = 2;\n"
+          "    fn(c) {\n"
+          "        fn() { a + b + c }\n"
+          "    }\n"
+          "}";
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+
+    Resolver *resolver = make_resolver();
+    assert(resolve_program(resolver, program));
+    check_resolver_errors(resolver);
+
+    ASTNode *outer = get_nth_statement(program, 0)->data.expr_stmt;
+    ASTNode *middle = nth_expr(outer->data.function_literal.body, 1);
+    ASTNode *inner = nth_expr(middle->data.function_literal.body, 0);
+
+    // Captured declarations are marked so their frames know to close over them
+    assert(outer->data.function_literal.parameters->array[0]->data.identifier.resolution.captured);
+    assert(outer->data.function_literal.body->data.block_stmt->array[0]->data.let_stmt.left->data.identifier.resolution.captured);
+    assert(middle->data.function_literal.parameters->array[0]->data.identifier.resolution.captured);
+
+    assert(outer->data.function_literal.num_upvalues == 0);
+
+    // The middle function only forwards `a` and `b` to the inner one
+    FunctionLiteral *middle_literal = &middle->data.function_literal;
+    assert(middle_literal->num_upvalues == 2);
+    assert(middle_literal->upvalues[0].is_local && middle_literal->upvalues[0].index == 0);
+    assert(middle_literal->upvalues[1].is_local && middle_literal->upvalues[1].index == 1);
+
+    FunctionLiteral *inner_literal = &inner->data.function_literal;
+    assert(inner_literal->num_locals == 0);
+    assert(inner_literal->num_upvalues == 3);
+    assert(!inner_literal->upvalues[0].is_local && inner_literal->upvalues[0].index == 0);
+    assert(!inner_literal->upvalues[1].is_local && inner_literal->upvalues[1].index == 1);
+    assert(inner_literal->upvalues[2].is_local && inner_literal->upvalues[2].index == 0);
+
+    ASTNode *sum = nth_expr(inner_literal->body, 0);
+    assert_resolution(sum->data.infix_expr.left->data.infix_expr.left, "a", SCOPE_UPVALUE, 0, 2);
+    assert_resolution(sum->data.infix_expr.left->data.infix_expr.right, "b", SCOPE_UPVALUE, 1, 2);
+    assert_resolution(sum->data.infix_expr.right, "c", SCOPE_UPVALUE, 2, 1);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(resolve_recursive_functions)
+{
+    char input[]
+        = "let fact = fn(n) { if (n < 2) { 1 } else { n * fact(n - 1) } };\n"
+          "fn() { let loop = fn(i) { loop(i - 1) }; loop(10) }";
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+
+    Resolver *resolver = make_resolver();
+    assert(resolve_program(resolver, program));
+    check_resolver_errors(resolver);
+
+    ASTNode *fact = get_nth_statement(program, 0)->data.let_stmt.right;
+    ASTNode *if_expr = nth_expr(fact->data.function_literal.body, 0);
+    ASTNode *product = nth_expr(if_expr->data.if_expr.alternative, 0);
+    assert_resolution(product->data.infix_expr.right->data.call_expr.function, "fact", SCOPE_GLOBAL, 0, 0);
+
+    ASTNode *outer = get_nth_statement(program, 1)->data.expr_stmt;
+    ASTNode *loop = nth_expr(outer->data.function_literal.body, 0);
+    ASTNode *recursive_call = nth_expr(loop->data.function_literal.body, 0);
+    assert_resolution(recursive_call->data.call_expr.function, "loop", SCOPE_UPVALUE, 0, 1);
+    assert(outer->data.function_literal.body->data.block_stmt->array[0]->data.let_stmt.left->data.identifier.resolution.captured);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(resolve_forward_global_references)
+{
+    Parser *parser = make_parser("let f = fn() { g() }; let g = fn() { 1 }; f();", NULL);
+    Program *program = parse_program(parser);
+    check_parser_errors(parser);
+
+    Resolver *resolver = make_resolver();
+    assert(resolve_program(resolver, program));
+    check_resolver_errors(resolver);
+
+    ASTNode *f = get_nth_statement(program, 0)->data.let_stmt.right;
+    ASTNode *call = nth_expr(f->data.function_literal.body, 0);
+    assert_resolution(call->data.call_expr.function, "g", SCOPE_GLOBAL, 1, 0);
+    assert_resolution(get_nth_statement(program, 1)->data.let_stmt.left, "g", SCOPE_GLOBAL, 1, 0);
+
+    cleanup_resolver(resolver);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(resolve_use_before_definition)
+{
+    struct {
+        char *input;
+        char *expected_error;
+    } tests[] = {
+        { "x;", "Identifier not found: x" },
+        { "let x = x + 1;", "Identifier not found: x" },
+        { "let f = fn() { y }; f();", "Identifier not found: y" },
+        { "fn(a, a) { a }", "Duplicate parameter: a" },
+    };
+
+    size_t num_tests = sizeof(tests) / sizeof(tests[0]);
+
+    for (size_t i = 0; i < num_tests; i++) {
+        Parser *parser = make_parser(tests[i].input, NULL);
+        Program *program = parse_program(parser);
+        check_parser_errors(parser);
+
+        Resolver *resolver = make_resolver();
+        assert(!resolve_program(resolver, program));
+        assert(resolver->errors->size == 1);
+        ASSERT(strcmp(get_error_from_arraylist(resolver->errors, 0), tests[i].expected_error) == 0,
+            "Unexpected resolver error.\nExpected: %s\nGot: %s", tests[i].expected_error, get_error_from_arraylist(resolver->errors, 0));
+
+        cleanup_resolver(resolver);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(resolve_across_programs)
+{
+    Resolver *resolver = make_resolver();
+
+    Parser *first_parser = make_parser("let x = 5;", NULL);
+    Program *first_program = parse_program(first_parser);
+    check_parser_errors(first_parser);
+    assert(resolve_program(resolver, first_program));
+
+    Parser *second_parser = make_parser("let y = x * 2; y;", NULL);
+    Program *second_program = parse_program(second_parser);
+    check_parser_errors(second_parser);
+    assert(resolve_program(resolver, second_program));
+    check_resolver_errors(resolver);
+
+    assert(get_global_count(resolver) == 2);
+    assert_resolution(get_nth_statement(second_program, 0)->data.let_stmt.right->data.infix_expr.left, "x", SCOPE_GLOBAL, 0, 0);
+    assert_resolution(get_nth_statement(second_program, 1)->data.expr_stmt, "y", SCOPE_GLOBAL, 1, 0);
+
+    cleanup_program(first_program);
+    cleanup_parser(first_parser);
+    cleanup_program(second_program);
+    cleanup_parser(second_parser);
+    cleanup_resolver(resolver);
+}
+
+RUN_TESTS()
@@ -0,0 +1,802 @@
+#include "single_pass.h"
+#include "arrlist_utils.h"
+#include "ast.h"
+#include "code.h"
+#include "compiler.h"
+#include "object.h"
+#include "parser.h"
+#include "resolver.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct SinglePass {
+    Parser *parser;
+    Compiler *compiler;
+    // Calls whose value is that of the expression being compiled, e.g. both calls in
+    // `if (c) { f(x) } else { g(x) }`. Those of a function's final expression become tail calls.
+    size_t *tail_calls;
+    size_t num_tail_calls;
+    size_t tail_calls_capacity;
+    // Handed by the expression loop to the infix function of `<`, which moves the left operand
+    size_t left_start;
+    int left_peak; // Deepest the stack got while computing the left operand
+    const char *function_name; // Set by `let f = fn ...` for the function literal about to be compiled
+} SinglePass;
+
+typedef bool (*EmitFn)(SinglePass *pass);
+
+static bool compile_expression(SinglePass *pass, Precedence precedence);
+static bool compile_statement(SinglePass *pass);
+
+static void add_tail_call(SinglePass *pass, size_t position)
+{
+    if (pass->num_tail_calls == pass->tail_calls_capacity) {
+        size_t new_capacity = pass->tail_calls_capacity == 0 ? 8 : pass->tail_calls_capacity * 2;
+        pass->tail_calls = realloc_backing_array(&libc_allocator, pass->tail_calls, pass->tail_calls_capacity, pass->tail_calls_capacity, new_capacity, sizeof(size_t));
+        pass->tail_calls_capacity = new_capacity;
+    }
+    pass->tail_calls[pass->num_tail_calls++] = position;
+}
+
+// The function returns the value of the expression just compiled, so its calls from `first` on
+// can reuse the caller's frame, see compile_tail_expression
+static void make_tail_calls(SinglePass *pass, size_t first)
+{
+    CompilationScope *scope = pass->compiler->scope;
+    if (scope->in_function) {
+        for (size_t i = first; i < pass->num_tail_calls; i++) {
+            scope->function->instructions->array[pass->tail_calls[i]] = OP_TAIL_CALL;
+            if (scope->last_instruction.position == pass->tail_calls[i]) {
+                scope->last_instruction.opcode = OP_TAIL_CALL;
+            }
+        }
+    }
+    pass->num_tail_calls = first;
+}
+
+static void emit_variable(SinglePass *pass, Resolution *resolution)
+{
+    switch (resolution->scope) {
+    case SCOPE_GLOBAL:
+        emit(pass->compiler, OP_GET_GLOBAL, resolution->index);
+        break;
+    case SCOPE_LOCAL:
+        emit(pass->compiler, OP_GET_LOCAL, resolution->index);
+        break;
+    case SCOPE_UPVALUE:
+        emit(pass->compiler, OP_GET_UPVALUE, resolution->index);
+        break;
+    case SCOPE_BUILTIN:
+        emit(pass->compiler, OP_GET_BUILTIN, resolution->index);
+        break;
+    default:
+        // The resolver has reported it
+        break;
+    }
+}
+
+// Uses of a name are resolved through a node on the stack, only declarations need one that lasts
+// (see parse_identifier) since the resolver refers back to them
+static bool compile_identifier(SinglePass *pass)
+{
+    ASTNode identifier;
+    identifier.type = NODE_IDENTIFIER;
+    identifier.data.identifier.literal.type = LITERAL_IDENTIFIER;
+    strcpy(identifier.data.identifier.literal.value.identifier, pass->parser->curr_token.literal);
+    identifier.data.identifier.resolution = (Resolution) { 0 };
+    resolve_node(pass->compiler->resolver, &identifier);
+    emit_variable(pass, &identifier.data.identifier.resolution);
+    return TRUE;
+}
+
+static bool compile_integer_literal(SinglePass *pass)
+{
+    int64_t value;
+    if (!parse_integer_value(pass->parser, &value)) {
+        return FALSE;
+    }
+    emit(pass->compiler, OP_CONSTANT, add_constant(pass->compiler, INT_VAL(value)));
+    return TRUE;
+}
+
+static bool compile_float_literal(SinglePass *pass)
+{
+    double value;
+    if (!parse_float_value(pass->parser, &value)) {
+        return FALSE;
+    }
+    emit(pass->compiler, OP_CONSTANT, add_constant(pass->compiler, FLOAT_VAL(value)));
+    return TRUE;
+}
+
+static bool compile_string_literal(SinglePass *pass)
+{
+    emit(pass->compiler, OP_CONSTANT, add_string_constant(pass->compiler, pass->parser->curr_token.string));
+    return TRUE;
+}
+
+static bool compile_boolean(SinglePass *pass)
+{
+    emit(pass->compiler, compare_curr_token_type(pass->parser, TOKEN_TRUE) ? OP_TRUE : OP_FALSE);
+    return TRUE;
+}
+
+static bool compile_prefix_expression(SinglePass *pass)
+{
+    TokenType operator = pass->parser->curr_token.type;
+    parse_next_token(pass->parser);
+    if (!compile_expression(pass, PREC_PREFIX)) {
+        return FALSE;
+    }
+    emit(pass->compiler, operator == TOKEN_BANG ? OP_BANG : OP_NEG);
+    return TRUE;
+}
+
+// Whether the jump at `position` is a `break` still waiting for the end of its loop
+static bool is_pending_break(CompilationScope *scope, size_t position)
+{
+    for (LoopScope *loop = scope->loop; loop != NULL; loop = loop->enclosing) {
+        for (size_t i = 0; i < loop->num_breaks; i++) {
+            if (loop->breaks[i] == position) {
+                return TRUE;
+            }
+        }
+    }
+    return FALSE;
+}
+
+// Whether the jump at `position`, targeting `target`, leaves the code from `start` to `end`: a
+// `break` still waiting for the end of its loop, or a `continue`
+static bool leaves_code(CompilationScope *scope, size_t position, size_t target, size_t start, size_t end)
+{
+    return is_pending_break(scope, position) || target < start || target > end;
+}
+
+// Where the code of `a` at `position` goes, counting the pops put in front of `exits` before it
+static size_t moved_position(size_t position, size_t offset, const size_t *exits, size_t num_exits)
+{
+    size_t moved = position + offset;
+    for (size_t i = 0; i < num_exits && exits[i] < position; i++) {
+        moved++;
+    }
+    return moved;
+}
+
+// Moves the code of `b` in `a < b`, from `right_start` to the end, in front of the code of `a`
+// from `left_start`, so `b` runs first as in the tree compiler. Jumps within either operand are
+// moved along with it. `b` was compiled at the depth it runs at, but `a` will have the value of
+// `b` below it, so leaving a loop from `a` gets one more pop in front of its jump.
+static void swap_operands(SinglePass *pass, size_t left_start, size_t right_start)
+{
+    Compiler *compiler = pass->compiler;
+    CompilationScope *scope = compiler->scope;
+    Instructions *instructions = scope->function->instructions;
+    uint8_t *code = instructions->array;
+    size_t end = instructions->size;
+    size_t left_length = right_start - left_start;
+    size_t right_length = end - right_start;
+
+    // Jumps in `a` that leave the loop, in order
+    size_t *exits = NULL;
+    size_t num_exits = 0;
+    size_t exits_capacity = 0;
+    size_t position = left_start;
+    while (position < end) {
+        OpCode op = code[position];
+        int operands[MAX_OPERANDS] = { 0 };
+        size_t next = position + 1 + read_operands(lookup_op_definition(op), &code[position + 1], operands);
+        if (op == OP_CLOSURE) {
+            next += 2 * (size_t)operands[1];
+        }
+
+        if (position < right_start) {
+            if (op == OP_JUMP && leaves_code(scope, position, (size_t)operands[0], left_start, right_start)) {
+                if (num_exits == exits_capacity) {
+                    size_t new_capacity = exits_capacity == 0 ? 4 : exits_capacity * 2;
+                    exits = realloc_backing_array(&libc_allocator, exits, exits_capacity, exits_capacity, new_capacity, sizeof(size_t));
+                    exits_capacity = new_capacity;
+                }
+                exits[num_exits++] = position;
+            }
+        } else if ((op == OP_JUMP || op == OP_JUMP_NOT_TRUTHY) && !is_pending_break(scope, position) && (size_t)operands[0] >= right_start) {
+            write_uint16(&code[position + 1], (uint16_t)(operands[0] - left_length));
+        }
+        position = next;
+    }
+
+    // `a` lands after `b`, each exit after a pop of its own
+    size_t offset = right_length;
+    uint8_t *left = malloc(left_length + num_exits);
+    size_t length = 0;
+    size_t exit = 0;
+    position = left_start;
+    while (position < right_start) {
+        OpCode op = code[position];
+        int operands[MAX_OPERANDS] = { 0 };
+        size_t next = position + 1 + read_operands(lookup_op_definition(op), &code[position + 1], operands);
+        if (op == OP_CLOSURE) {
+            next += 2 * (size_t)operands[1];
+        }
+
+        if (exit < num_exits && exits[exit] == position) {
+            left[length++] = OP_POP;
+            exit++;
+        }
+        memcpy(&left[length], &code[position], next - position);
+        size_t target = (size_t)operands[0];
+        if ((op == OP_JUMP || op == OP_JUMP_NOT_TRUTHY) && target >= left_start && target <= right_start && !is_pending_break(scope, position)) {
+            target = moved_position(target, offset, exits, num_exits);
+            if (target > MAX_JUMP_TARGET) {
+                report_compiler_error(compiler, "Function body too large to jump over");
+            }
+            write_uint16(&left[length + 1], (uint16_t)target);
+        }
+        length += next - position;
+        position = next;
+    }
+
+    for (LoopScope *loop = scope->loop; loop != NULL; loop = loop->enclosing) {
+        for (size_t i = 0; i < loop->num_breaks; i++) {
+            if (loop->breaks[i] >= right_start) {
+                loop->breaks[i] -= left_length;
+            } else if (loop->breaks[i] >= left_start) {
+                loop->breaks[i] = moved_position(loop->breaks[i], offset, exits, num_exits) + 1;
+            }
+        }
+    }
+
+    // Grows the code by the pops, which may move it
+    add_bytes_to_instructions(instructions, left, num_exits);
+    code = instructions->array;
+    memmove(&code[left_start], &code[right_start], right_length);
+    memcpy(&code[left_start + right_length], left, length);
+    free(left);
+    free(exits);
+}
+
+static bool compile_infix_expression(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    CompilationScope *scope = pass->compiler->scope;
+    TokenType operator = parser->curr_token.type;
+    Precedence precedence = get_current_precedence(parser);
+    parse_next_token(parser);
+
+    if (operator == TOKEN_LT) {
+        size_t left_start = pass->left_start;
+        int left_peak = pass->left_peak;
+        size_t right_start = scope->function->instructions->size;
+        scope->stack_depth--;
+        bool compiled = compile_expression(pass, precedence);
+        scope->stack_depth++;
+        if (!compiled) {
+            return FALSE;
+        }
+        swap_operands(pass, left_start, right_start);
+        if (left_peak + 1 > scope->function->max_stack) {
+            scope->function->max_stack = left_peak + 1;
+        }
+        emit(pass->compiler, OP_GREATER_THAN);
+        return TRUE;
+    }
+
+    if (!compile_expression(pass, precedence)) {
+        return FALSE;
+    }
+    switch (operator) {
+    case TOKEN_PLUS:
+        emit(pass->compiler, OP_ADD);
+        break;
+    case TOKEN_MINUS:
+        emit(pass->compiler, OP_SUB);
+        break;
+    case TOKEN_ASTERISK:
+        emit(pass->compiler, OP_MUL);
+        break;
+    case TOKEN_SLASH:
+        emit(pass->compiler, OP_DIV);
+        break;
+    case TOKEN_GT:
+        emit(pass->compiler, OP_GREATER_THAN);
+        break;
+    case TOKEN_EQ:
+        emit(pass->compiler, OP_EQUAL);
+        break;
+    case TOKEN_NOT_EQ:
+        emit(pass->compiler, OP_NOT_EQUAL);
+        break;
+    default:
+        assert(1 != 1);
+    }
+    return TRUE;
+}
+
+static bool compile_grouped_expression(SinglePass *pass)
+{
+    parse_next_token(pass->parser);
+    return compile_expression(pass, PREC_LOWEST) && expect_peek(pass->parser, TOKEN_RPAREN);
+}
+
+// Compiles the statements of the block on whose `{` the parser stands
+static bool compile_block(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    size_t tail_calls = pass->num_tail_calls;
+
+    parse_next_token(parser);
+    while (!compare_curr_token_type(parser, TOKEN_RBRACE) && !compare_curr_token_type(parser, TOKEN_EOF)) {
+        pass->num_tail_calls = tail_calls;
+        compile_statement(pass);
+        parse_next_token(parser);
+    }
+
+    if (!compare_curr_token_type(parser, TOKEN_RBRACE)) {
+        report_unterminated_block_error(parser);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Compiles a block whose value is used, that of its final expression statement or null
+static bool compile_block_value(SinglePass *pass)
+{
+    size_t tail_calls = pass->num_tail_calls;
+    if (!compile_block(pass)) {
+        return FALSE;
+    }
+    // Only an expression statement ends in a pop
+    if (last_instruction_is(pass->compiler, OP_POP)) {
+        remove_last_pop(pass->compiler);
+    } else {
+        pass->num_tail_calls = tail_calls;
+        emit(pass->compiler, OP_NULL);
+    }
+    return TRUE;
+}
+
+static bool compile_if_expression(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    Compiler *compiler = pass->compiler;
+    size_t tail_calls = pass->num_tail_calls;
+
+    if (!expect_peek(parser, TOKEN_LPAREN)) {
+        return FALSE;
+    }
+    parse_next_token(parser);
+    if (!compile_expression(pass, PREC_LOWEST) || !expect_peek(parser, TOKEN_RPAREN) || !expect_peek(parser, TOKEN_LBRACE)) {
+        return FALSE;
+    }
+    pass->num_tail_calls = tail_calls;
+
+    size_t jump_not_truthy_position = emit(compiler, OP_JUMP_NOT_TRUTHY, 9999);
+    int branch_depth = compiler->scope->stack_depth;
+    if (!compile_block_value(pass)) {
+        return FALSE;
+    }
+    size_t jump_position = emit(compiler, OP_JUMP, 9999);
+    patch_jump(compiler, jump_not_truthy_position);
+    compiler->scope->stack_depth = branch_depth;
+
+    if (compare_peek_token_type(parser, TOKEN_ELSE)) {
+        parse_next_token(parser);
+        if (!expect_peek(parser, TOKEN_LBRACE) || !compile_block_value(pass)) {
+            return FALSE;
+        }
+    } else {
+        emit(compiler, OP_NULL);
+    }
+
+    patch_jump(compiler, jump_position);
+    return TRUE;
+}
+
+// The function node carries the parameters and what the resolver finds out about the body, which
+// is compiled into its own FunctionProto before the closure is created in the enclosing function
+static bool compile_function_literal(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    Compiler *compiler = pass->compiler;
+    const char *name = pass->function_name;
+    pass->function_name = NULL;
+
+    ASTNode *node = make_ast_node(parser->backing_node_list);
+    node->type = NODE_FUNCTION_LITERAL;
+    strcpy(node->token_literal, "fn");
+    FunctionLiteral *literal = &node->data.function_literal;
+    literal->parameters = make_ast_node_ptr_array_list(parser->allocator);
+    if (!expect_peek(parser, TOKEN_LPAREN) || !parse_function_parameters(parser, literal->parameters) || !expect_peek(parser, TOKEN_LBRACE)) {
+        return FALSE;
+    }
+
+    FunctionProto *function = make_function_proto(compiler->heap, name);
+    FunctionScope function_scope;
+    enter_function_scope(compiler->resolver, &function_scope, node);
+    for (size_t i = 0; i < literal->parameters->size; i++) {
+        declare_parameter(compiler->resolver, literal->parameters->array[i]);
+    }
+    CompilationScope scope;
+    enter_scope(compiler, &scope, function);
+    scope.in_function = TRUE;
+
+    size_t tail_calls = pass->num_tail_calls;
+    bool compiled = compile_block(pass);
+    if (last_instruction_is(compiler, OP_POP)) {
+        remove_last_pop(compiler);
+        make_tail_calls(pass, tail_calls);
+        emit(compiler, OP_RETURN_VALUE);
+    }
+    if (!last_instruction_is(compiler, OP_RETURN_VALUE)) {
+        emit(compiler, OP_RETURN);
+    }
+    pass->num_tail_calls = tail_calls;
+
+    leave_scope(compiler);
+    leave_function_scope(compiler->resolver);
+    function->num_parameters = (int)literal->parameters->size;
+    function->num_locals = (int)literal->num_locals;
+    function->num_upvalues = (int)literal->num_upvalues;
+    emit_closure(compiler, function, literal);
+    return compiled;
+}
+
+// Compiles comma separated expressions up to and including `end`, starting on the token before
+// the first. Returns how many there were, or -1.
+static int compile_expression_list(SinglePass *pass, TokenType end)
+{
+    Parser *parser = pass->parser;
+    if (compare_peek_token_type(parser, end)) {
+        parse_next_token(parser);
+        return 0;
+    }
+
+    int count = 0;
+    do {
+        parse_next_token(parser);
+        if (count > 0) {
+            parse_next_token(parser);
+        }
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return -1;
+        }
+        count++;
+    } while (compare_peek_token_type(parser, TOKEN_COMMA));
+
+    return expect_peek(parser, end) ? count : -1;
+}
+
+static bool compile_call_expression(SinglePass *pass)
+{
+    Compiler *compiler = pass->compiler;
+    int count = compile_expression_list(pass, TOKEN_RPAREN);
+    if (count == -1) {
+        return FALSE;
+    }
+
+    FunctionProto *function = compiler->scope->function;
+    if (count > MAX_ARGUMENTS) {
+        report_compiler_error(compiler, "Too many arguments in call, at most %d are allowed", MAX_ARGUMENTS);
+        return TRUE;
+    }
+    if (function->num_call_caches >= MAX_CALL_CACHES) {
+        report_compiler_error(compiler, "Too many calls in function %s", function->name);
+        return TRUE;
+    }
+    add_tail_call(pass, emit(compiler, OP_CALL, count, function->num_call_caches++));
+    return TRUE;
+}
+
+static bool compile_array_literal(SinglePass *pass)
+{
+    int count = compile_expression_list(pass, TOKEN_RBRACKET);
+    if (count == -1) {
+        return FALSE;
+    }
+    if (count > MAX_LITERAL_ELEMENTS) {
+        report_compiler_error(pass->compiler, "Too many elements in array literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return TRUE;
+    }
+    emit(pass->compiler, OP_ARRAY, count);
+    return TRUE;
+}
+
+// See parse_hash_literal
+static bool compile_hash_literal(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    int count = 0;
+    while (!compare_peek_token_type(parser, TOKEN_RBRACE)) {
+        parse_next_token(parser);
+        if (!compile_expression(pass, PREC_LOWEST) || !expect_peek(parser, TOKEN_COLON)) {
+            return FALSE;
+        }
+        parse_next_token(parser);
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return FALSE;
+        }
+        count++;
+        if (!compare_peek_token_type(parser, TOKEN_RBRACE) && !expect_peek(parser, TOKEN_COMMA)) {
+            return FALSE;
+        }
+    }
+    if (!expect_peek(parser, TOKEN_RBRACE)) {
+        return FALSE;
+    }
+
+    if (count > MAX_LITERAL_ELEMENTS) {
+        report_compiler_error(pass->compiler, "Too many pairs in hash literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return TRUE;
+    }
+    emit(pass->compiler, OP_HASH, count);
+    return TRUE;
+}
+
+static bool compile_index_expression(SinglePass *pass)
+{
+    parse_next_token(pass->parser);
+    if (!compile_expression(pass, PREC_LOWEST) || !expect_peek(pass->parser, TOKEN_RBRACKET)) {
+        return FALSE;
+    }
+    FunctionProto *function = pass->compiler->scope->function;
+    if (function->num_index_caches >= MAX_INDEX_CACHES) {
+        report_compiler_error(pass->compiler, "Too many index expressions in function %s", function->name);
+        return TRUE;
+    }
+    emit(pass->compiler, OP_INDEX, function->num_index_caches++);
+    return TRUE;
+}
+
+// Mirrors the parser's table, see parser_fns
+static EmitFn get_prefix_emit_fn(TokenType type)
+{
+    switch (type) {
+    case TOKEN_IDENT:
+        return compile_identifier;
+    case TOKEN_INT:
+        return compile_integer_literal;
+    case TOKEN_FLOAT:
+        return compile_float_literal;
+    case TOKEN_STRING:
+        return compile_string_literal;
+    case TOKEN_BANG:
+    case TOKEN_MINUS:
+        return compile_prefix_expression;
+    case TOKEN_TRUE:
+    case TOKEN_FALSE:
+        return compile_boolean;
+    case TOKEN_LPAREN:
+        return compile_grouped_expression;
+    case TOKEN_IF:
+        return compile_if_expression;
+    case TOKEN_FUNCTION:
+        return compile_function_literal;
+    case TOKEN_LBRACKET:
+        return compile_array_literal;
+    case TOKEN_LBRACE:
+        return compile_hash_literal;
+    default:
+        return NULL;
+    }
+}
+
+static EmitFn get_infix_emit_fn(TokenType type)
+{
+    switch (type) {
+    case TOKEN_PLUS:
+    case TOKEN_MINUS:
+    case TOKEN_SLASH:
+    case TOKEN_ASTERISK:
+    case TOKEN_EQ:
+    case TOKEN_NOT_EQ:
+    case TOKEN_LT:
+    case TOKEN_GT:
+        return compile_infix_expression;
+    case TOKEN_LPAREN:
+        return compile_call_expression;
+    case TOKEN_LBRACKET:
+        return compile_index_expression;
+    default:
+        return NULL;
+    }
+}
+
+// The Pratt loop of parse_expression. Besides the code it keeps track of the calls that give the
+// expression its value, which only calls, if expressions and parentheses pass on, and of how deep
+// the stack gets so `<` knows what its left operand needs.
+static bool compile_expression(SinglePass *pass, Precedence precedence)
+{
+    Parser *parser = pass->parser;
+    FunctionProto *function = pass->compiler->scope->function;
+    TokenType type = parser->curr_token.type;
+    EmitFn prefix_fn = get_prefix_emit_fn(type);
+    if (prefix_fn == NULL) {
+        if (type == TOKEN_ILLEGAL) {
+            report_illegal_token_error(parser);
+        } else {
+            report_no_prefix_error(parser, type);
+        }
+        return FALSE;
+    }
+
+    size_t tail_calls = pass->num_tail_calls;
+    size_t start = function->instructions->size;
+    int enclosing_peak = function->max_stack;
+    function->max_stack = pass->compiler->scope->stack_depth;
+
+    bool compiled = prefix_fn(pass);
+    if (type != TOKEN_IF && type != TOKEN_LPAREN) {
+        pass->num_tail_calls = tail_calls;
+    }
+
+    while (compiled && !compare_peek_token_type(parser, TOKEN_SEMICOLON) && precedence < get_peek_precedence(parser)) {
+        type = parser->peek_token.type;
+        EmitFn infix_fn = get_infix_emit_fn(type);
+        if (infix_fn == NULL) {
+            break;
+        }
+        parse_next_token(parser);
+
+        pass->num_tail_calls = tail_calls;
+        pass->left_start = start;
+        pass->left_peak = function->max_stack;
+        compiled = infix_fn(pass);
+        if (type != TOKEN_LPAREN) {
+            pass->num_tail_calls = tail_calls;
+        }
+    }
+
+    if (enclosing_peak > function->max_stack) {
+        function->max_stack = enclosing_peak;
+    }
+    return compiled;
+}
+
+static void skip_semicolon(Parser *parser)
+{
+    if (compare_peek_token_type(parser, TOKEN_SEMICOLON)) {
+        parse_next_token(parser);
+    }
+}
+
+// As in the resolver, a function bound by `let` is declared first so it can call itself
+static bool compile_let_statement(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    Compiler *compiler = pass->compiler;
+    if (!expect_peek(parser, TOKEN_IDENT)) {
+        return FALSE;
+    }
+    ASTNode *identifier = parse_identifier(parser);
+    if (!expect_peek(parser, TOKEN_ASSIGN)) {
+        return FALSE;
+    }
+    parse_next_token(parser);
+
+    if (compare_curr_token_type(parser, TOKEN_FUNCTION)) {
+        declare_variable(compiler->resolver, identifier);
+        pass->function_name = identifier->data.identifier.literal.value.identifier;
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return FALSE;
+        }
+    } else {
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return FALSE;
+        }
+        declare_variable(compiler->resolver, identifier);
+    }
+
+    Resolution *resolution = &identifier->data.identifier.resolution;
+    if (resolution->scope == SCOPE_GLOBAL) {
+        emit(compiler, OP_SET_GLOBAL, resolution->index);
+    } else if (resolution->scope == SCOPE_LOCAL) {
+        emit(compiler, OP_SET_LOCAL, resolution->index);
+    }
+    skip_semicolon(parser);
+    return TRUE;
+}
+
+static bool compile_return_statement(SinglePass *pass)
+{
+    size_t tail_calls = pass->num_tail_calls;
+    parse_next_token(pass->parser);
+    if (!compile_expression(pass, PREC_LOWEST)) {
+        return FALSE;
+    }
+    make_tail_calls(pass, tail_calls);
+    emit(pass->compiler, OP_RETURN_VALUE);
+    skip_semicolon(pass->parser);
+    return TRUE;
+}
+
+static bool compile_while_statement(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    Compiler *compiler = pass->compiler;
+    LoopScope loop;
+    if (!begin_loop(compiler, &loop) || !expect_peek(parser, TOKEN_LPAREN)) {
+        return FALSE;
+    }
+    parse_next_token(parser);
+
+    // `while (true)` needs no test, see compile_while_statement in the compiler
+    bool infinite = compare_curr_token_type(parser, TOKEN_TRUE) && compare_peek_token_type(parser, TOKEN_RPAREN);
+    size_t exit_position = 0;
+    if (!infinite) {
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return FALSE;
+        }
+        exit_position = emit(compiler, OP_JUMP_NOT_TRUTHY, 9999);
+    }
+    if (!expect_peek(parser, TOKEN_RPAREN) || !expect_peek(parser, TOKEN_LBRACE)) {
+        return FALSE;
+    }
+
+    begin_loop_body(compiler, &loop);
+    bool compiled = compile_block(pass);
+    end_loop(compiler, &loop);
+    if (!infinite) {
+        patch_jump(compiler, exit_position);
+    }
+    skip_semicolon(parser);
+    return compiled;
+}
+
+static bool compile_statement(SinglePass *pass)
+{
+    Parser *parser = pass->parser;
+    switch (parser->curr_token.type) {
+    case TOKEN_LET:
+        return compile_let_statement(pass);
+    case TOKEN_RETURN:
+        return compile_return_statement(pass);
+    case TOKEN_WHILE:
+        return compile_while_statement(pass);
+    case TOKEN_BREAK:
+    case TOKEN_CONTINUE:
+        emit_loop_control(pass->compiler, compare_curr_token_type(parser, TOKEN_BREAK), parser->curr_token.literal);
+        skip_semicolon(parser);
+        return TRUE;
+    default:
+        if (!compile_expression(pass, PREC_LOWEST)) {
+            return FALSE;
+        }
+        emit(pass->compiler, OP_POP);
+        skip_semicolon(parser);
+        return TRUE;
+    }
+}
+
+FunctionProto *compile_single_pass(Compiler *compiler, char *input)
+{
+    size_t errors_before = compiler->errors->size;
+    size_t globals_before = get_global_count(compiler->resolver);
+    SinglePass pass = { .parser = make_parser(input, NULL), .compiler = compiler };
+
+    FunctionProto *function = make_function_proto(compiler->heap, "main");
+    CompilationScope scope;
+    enter_scope(compiler, &scope, function);
+    while (!compare_curr_token_type(pass.parser, TOKEN_EOF)) {
+        pass.num_tail_calls = 0;
+        compile_statement(&pass);
+        parse_next_token(pass.parser);
+    }
+    emit(compiler, OP_RETURN);
+    leave_scope(compiler);
+    function->num_globals = get_global_count(compiler->resolver);
+    report_undefined_globals(compiler->resolver, globals_before);
+
+    ErrorArrayList *syntax_errors = pass.parser->errors;
+    if (syntax_errors->size > 0) {
+        while (compiler->errors->size > errors_before) {
+            deallocate_str(compiler->errors->allocator, compiler->errors->array[--compiler->errors->size]);
+        }
+        for (size_t i = 0; i < syntax_errors->size; i++) {
+            add_error_to_arraylist(compiler->errors, allocate_str(compiler->errors->allocator, get_error_from_arraylist(syntax_errors, i)));
+        }
+    }
+    cleanup_parser(pass.parser);
+    free(pass.tail_calls);
+
+    return compiler->errors->size == errors_before ? function : NULL;
+}
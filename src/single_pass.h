@@ -0,0 +1,22 @@
+#ifndef SINGLE_PASS_H
+#define SINGLE_PASS_H
+
+#include "compiler.h"
+#include "object.h"
+
+// Compiles source straight to bytecode while parsing it, without building a syntax tree, for
+// programs that only run once and want their result as soon as possible. The parser's tokens drive
+// a second table of prefix and infix functions that emit code where the parser's would build nodes,
+// and identifiers are resolved as they are met through the compiler's resolver. The bytecode is
+// the same as compiling the unoptimized tree, so both can share a compiler, except that:
+// - nothing is folded or simplified, that takes the tree (see optimizer.h)
+// - `a < b` still runs `b` first as `b > a`, so the code of `b` is moved in front of that of `a`
+//   once both are compiled. `break` and `continue` cannot be in `a` then.
+// - `let f = fn ...` lets the function refer to `f` even when it is called right away
+
+// Returns the program's top-level function, or NULL if it has errors, which are added to the
+// compiler's. Syntax errors are reported alone, errors found while compiling a broken program are
+// dropped.
+extern FunctionProto *compile_single_pass(Compiler *compiler, char *input);
+
+#endif // SINGLE_PASS_H
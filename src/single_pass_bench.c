@@ -0,0 +1,111 @@
+#include "allocator.h"
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "single_pass.h"
+#include "vm.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Time from source to result for scripts that run once: parsing into a tree, optimizing and
+// compiling it, as the REPL does, against compiling while parsing. A short script that does a
+// little work, and a long one that defines many functions and calls a few.
+
+#define SHORT_RUNS 2000
+#define LONG_FUNCTIONS 2000
+#define LONG_RUNS 50
+
+static const char *short_script = "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } };\n"
+                                  "let map = fn(xs, f) { let i = 0; let out = []; while (i < len(xs)) { let out = push(out, f(xs[i])); let i = i + 1; } out };\n"
+                                  "let total = fn(xs) { let s = 0; let i = 0; while (i < len(xs)) { let s = s + xs[i]; let i = i + 1; } s };\n"
+                                  "let people = [{\"name\": \"ada\", \"age\": 36}, {\"name\": \"alan\", \"age\": 41}, {\"name\": \"grace\", \"age\": 85}];\n"
+                                  "let ages = map(people, fn(p) { p[\"age\"] });\n"
+                                  "let squares = map([1, 2, 3, 4, 5, 6, 7, 8], fn(x) { x * x });\n"
+                                  "total(ages) + total(squares) + fib(10)";
+
+static char *make_long_script(void)
+{
+    return bench_library_source(LONG_FUNCTIONS, "liba(1, 2) + libb(3, 4)");
+}
+
+typedef struct Timings {
+    uint64_t front_end; // Source to bytecode
+    uint64_t run;
+    Value result;
+} Timings;
+
+static Timings run_script(char *input, bool single_pass)
+{
+    Timings timings;
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    Parser *parser = NULL;
+    Program *program = NULL;
+
+    uint64_t start = now_ns();
+    FunctionProto *main;
+    if (single_pass) {
+        main = compile_single_pass(compiler, input);
+    } else {
+        parser = make_parser(input, NULL);
+        program = parse_program(parser);
+        assert(parser->errors->size == 0);
+        optimize_program(program);
+        main = compile_program(compiler, program);
+    }
+    timings.front_end = now_ns() - start;
+    assert(main != NULL);
+
+    VM *vm = make_vm(heap, compiler->constants);
+    start = now_ns();
+    VMResult result = run_vm(vm, main);
+    timings.run = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+    timings.result = get_last_popped(vm);
+
+    cleanup_vm(vm);
+    if (program != NULL) {
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    return timings;
+}
+
+static void bench_script(const char *label, char *input, int runs)
+{
+    Timings totals[2] = { { 0 } };
+    for (int i = 0; i < runs; i++) {
+        for (int single_pass = 0; single_pass <= 1; single_pass++) {
+            Timings timings = run_script(input, single_pass);
+            totals[single_pass].front_end += timings.front_end;
+            totals[single_pass].run += timings.run;
+            totals[single_pass].result = timings.result;
+        }
+    }
+    assert(AS_INT(totals[0].result) == AS_INT(totals[1].result));
+    for (int single_pass = 0; single_pass <= 1; single_pass++) {
+        double front_end = totals[single_pass].front_end / 1e3 / runs;
+        double run = totals[single_pass].run / 1e3 / runs;
+        printf("%-6s %-12s %12.1f %10.1f %10.1f %10" PRId64 "\n", label, single_pass ? "single pass" : "tree", front_end, run, front_end + run,
+            AS_INT(totals[single_pass].result));
+    }
+}
+
+int main(void)
+{
+    char *long_script = make_long_script();
+    printf("short script: %zu bytes, long script: %zu bytes\n", strlen(short_script), strlen(long_script));
+    printf("%-6s %-12s %12s %10s %10s %10s\n", "script", "front end", "compile us", "run us", "total us", "result");
+    bench_script("short", (char *)short_script, SHORT_RUNS);
+    bench_script("long", long_script, LONG_RUNS);
+    free(long_script);
+    return 0;
+}
@@ -0,0 +1,162 @@
+#include "compiler.h"
+#include "object.h"
+#include "parser.h"
+#include "single_pass.h"
+#include "str_utils.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static void assert_same_str(const char *input, const char *what, char *expected, char *got)
+{
+    if (strcmp(expected, got) != 0) {
+        printf("Input: %s\nDifferent %s\nExpected:\n%s\nGot:\n%s\n", input, what, expected, got);
+        assert(1 != 1);
+    }
+    free(expected);
+    free(got);
+}
+
+static void assert_same_function(const char *input, FunctionProto *expected, FunctionProto *got)
+{
+    assert_same_str(input, "instructions", instructions_to_str(expected->instructions), instructions_to_str(got->instructions));
+    if (strcmp(expected->name, got->name) != 0 || expected->num_parameters != got->num_parameters || expected->num_locals != got->num_locals
+        || expected->num_upvalues != got->num_upvalues || expected->num_call_caches != got->num_call_caches) {
+        printf("Input: %s\nDifferent function %s, got %s\n", input, expected->name, got->name);
+        assert(1 != 1);
+    }
+}
+
+// Compiles `input` from its tree and in a single pass, which must agree on every instruction and
+// constant
+static void assert_same_bytecode(char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    assert(parser->errors->size == 0);
+    Heap *heap = make_heap();
+    Compiler *tree_compiler = make_compiler(heap);
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *expected = compile_program(tree_compiler, program);
+    FunctionProto *got = compile_single_pass(compiler, input);
+    if (expected == NULL || got == NULL) {
+        printf("Input: %s\nFailed to compile\n", input);
+        assert(1 != 1);
+    }
+
+    assert_same_function(input, expected, got);
+    assert(expected->num_globals == got->num_globals);
+    assert(tree_compiler->constants->size == compiler->constants->size);
+    for (size_t i = 0; i < compiler->constants->size; i++) {
+        Value expected_constant = tree_compiler->constants->array[i];
+        Value constant = compiler->constants->array[i];
+        if (IS_FUNCTION(expected_constant) && IS_FUNCTION(constant)) {
+            assert_same_function(input, AS_FUNCTION(expected_constant), AS_FUNCTION(constant));
+        } else {
+            assert_same_str(input, "constants", inspect_value(expected_constant), inspect_value(constant));
+        }
+    }
+
+    cleanup_compiler(tree_compiler);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(same_bytecode_as_tree)
+{
+    char *inputs[] = {
+        "1 + 2 * 3; -4; !true; (5 - 6) / 7 == 8 != false",
+        "let a = 1.5; let s = \"x\\ty\"; let t = \"x\\ty\"; [a, s, t, {s: a, \"k\": [1, 2][0]}]",
+        "if (1 > 2) { 3 } else { 4 }; if (true) { 5 }; if (false) { let x = 1; }",
+        // Locals, upvalues and builtins, forward references to globals and recursion
+        "let f = fn(a, b) { let c = a + b; fn(d) { fn() { a + c + d } } }; f(1, 2)(3)()",
+        "let g = fn() { h() + len([1]) }; let h = fn() { 2 }; g()",
+        "let len = fn(x) { 0 }; len([1])",
+        "let count = fn(n) { if (n == 0) { 0 } else { count(n - 1) } }; count(3)",
+        // Tail calls through if expressions, returns and parentheses, not through operators
+        "let f = fn(n) { if (n > 1) { f(n - 1) } else { if (n > 0) { (f(n - 1)) } else { g(n) } } }; let g = fn(n) { return f(n) + 1; }",
+        "let f = fn(n) { let x = f(n); f(x)[0]; f(x)(1); if (n) { f(1); } else { let y = 2; } }",
+        "let f = fn() { }; let g = fn() { let x = 1; }; let h = fn() { while (false) { } }",
+        // `a < b` moves `b` and jumps within both operands in front of `a`
+        "let i = 0; let s = 0; while (i < 10) { let s = s + i; let i = i + 1; } s",
+        "let f = fn(a, b, c, d) { if (a) { b } else { c } < if (c) { d } else { if (a < d) { b } else { a } } }",
+        "let f = fn(n) { let i = 0; while (true) { if (n < i + if (i > 2) { break; } else { i }) { continue; } let i = i + 1; } i }",
+        "let f = fn(n) { let i = 0; while (i < n) { let i = i + 1; if (i == 3) { continue; } if (i > 8) { break; } } i }",
+        // Leaving the loop from `a` pops the value of `b` below it first
+        "let i = 0; while (i < 3) { let i = i + 1; if ((if (i == 2) { break } else { 1 }) < i) { 5 } } i",
+        "let x = 2; while (true) { if (true) { break; } else { 1 } < x }",
+        "let f = fn(n) { while (n) { if (n) { continue; } else { if (n < 1) { 2 } else { break; } < n } < [n][n]; } }",
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        assert_same_bytecode(inputs[i]);
+    }
+}
+
+// Returns the compiler's errors, one per line
+static char *compile_errors(char *input)
+{
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_single_pass(compiler, input);
+    assert(main == NULL);
+    String *errors = make_string(NULL);
+    for (size_t i = 0; i < compiler->errors->size; i++) {
+        copy_str_into_string(errors, get_error_from_arraylist(compiler->errors, i));
+        copy_str_into_string(errors, "\n");
+    }
+    char *str = get_str_from_string(errors);
+    cleanup_string(errors);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    return str;
+}
+
+TEST_CASE(reports_syntax_errors_alone)
+{
+    char *inputs[] = {
+        "let x = ; y + 1",
+        "let f = fn(x) { x + ",
+        "if (x { 1 }",
+        "\"open",
+        "99999999999999999999 + missing",
+        "let a = [1, 2; let b = {1: 2, 3}; fn(x, 1) { x }",
+    };
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        Parser *parser = make_parser(inputs[i], NULL);
+        Program *program = parse_program(parser);
+        assert(parser->errors->size > 0);
+        String *expected = make_string(NULL);
+        for (size_t j = 0; j < parser->errors->size; j++) {
+            copy_str_into_string(expected, get_error_from_arraylist(parser->errors, j));
+            copy_str_into_string(expected, "\n");
+        }
+        assert_same_str(inputs[i], "errors", get_str_from_string(expected), compile_errors(inputs[i]));
+        cleanup_string(expected);
+        cleanup_program(program);
+        cleanup_parser(parser);
+    }
+}
+
+TEST_CASE(reports_compile_errors)
+{
+    struct {
+        char *input;
+        const char *expected;
+    } tests[] = {
+        { "x + 1", "Identifier not found: x\n" },
+        { "let f = fn() { y + z }; 1", "Identifier not found: y\nIdentifier not found: z\n" },
+        { "let f = fn(a, a) { a }", "Duplicate parameter: a\n" },
+        { "break; continue;", "break outside of a loop\ncontinue outside of a loop\n" },
+        { "while (true) { fn() { break; } }", "break outside of a loop\n" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        assert_same_str(tests[i].input, "errors", strdup(tests[i].expected), compile_errors(tests[i].input));
+    }
+}
+
+RUN_TESTS()
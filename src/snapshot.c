@@ -0,0 +1,787 @@
+#include "snapshot.h"
+#include "builtins.h"
+#include "hash_map.h"
+#include "persistent.h"
+#include "string_object.h"
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A reference in the file is the offset of an object, whose low bits are clear since objects are
+// aligned, or an id tagged in the low bits
+#define REF_OBJECT 0
+#define REF_BUILTIN 1
+#define REF_CHAR 2
+#define REF_TAG_BITS 4
+#define REF_TAG_MASK ((1u << REF_TAG_BITS) - 1)
+
+#define GLOBAL_NAME_SIZE (MAX_IDENTIFIER_SIZE + 1)
+
+// Growable part of the file being written
+typedef struct Section {
+    uint8_t *bytes;
+    size_t size;
+    size_t capacity;
+} Section;
+
+static size_t align(size_t size, size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+// Returns the offset of `size` zeroed bytes added at the given alignment
+static size_t reserve(Section *section, size_t size, size_t alignment)
+{
+    size_t offset = align(section->size, alignment);
+    if (offset + size > section->capacity) {
+        size_t capacity = section->capacity == 0 ? 4096 : section->capacity;
+        while (offset + size > capacity) {
+            capacity *= 2;
+        }
+        section->bytes = realloc(section->bytes, capacity);
+        section->capacity = capacity;
+    }
+    memset(section->bytes + section->size, 0, offset + size - section->size);
+    section->size = offset + size;
+    return offset;
+}
+
+typedef struct SnapshotWriter {
+    size_t objects_start; // Where the objects start in the file
+    Section objects;
+    Section code;
+    IntMap *offsets; // Offset of every object copied so far by its address
+    // Copies whose references still point at the heap
+    size_t *pending;
+    size_t num_pending;
+    size_t pending_capacity;
+    bool failed;
+} SnapshotWriter;
+
+static bool can_write(Object *object)
+{
+    switch (object->type) {
+    case OBJ_FUNCTION:
+        return ((FunctionProto *)object)->lazy == NULL;
+    case OBJ_UPVALUE:
+        // Only closed upvalues, open ones point into a stack that is not saved
+        return ((Upvalue *)object)->location == &((Upvalue *)object)->closed;
+    default:
+        return TRUE;
+    }
+}
+
+// Copies the object into the file the first time it is met
+static uint64_t encode_ref(SnapshotWriter *writer, Object *object)
+{
+    if (object == NULL) {
+        return 0;
+    }
+    if (object->type == OBJ_BUILTIN) {
+        return ((uint64_t)((Builtin *)object)->id << REF_TAG_BITS) | REF_BUILTIN;
+    }
+    if (object->type == OBJ_STRING && ((StringObject *)object)->length == 1) {
+        char c = ((StringObject *)object)->chars[0];
+        if (object == AS_OBJ(char_string(c))) {
+            return ((uint64_t)(uint8_t)c << REF_TAG_BITS) | REF_CHAR;
+        }
+    }
+
+    int64_t offset;
+    if (int_map_get(writer->offsets, (uint64_t)(uintptr_t)object, &offset)) {
+        return writer->objects_start + offset;
+    }
+    if (!can_write(object)) {
+        writer->failed = TRUE;
+        return 0;
+    }
+    size_t size = object_size(object);
+    offset = (int64_t)reserve(&writer->objects, size, OBJECT_ALIGNMENT);
+    memcpy(writer->objects.bytes + offset, object, size);
+    int_map_put(writer->offsets, (uint64_t)(uintptr_t)object, offset);
+    if (writer->num_pending == writer->pending_capacity) {
+        writer->pending_capacity = writer->pending_capacity == 0 ? 64 : writer->pending_capacity * 2;
+        writer->pending = realloc(writer->pending, writer->pending_capacity * sizeof(size_t));
+    }
+    writer->pending[writer->num_pending++] = (size_t)offset;
+    return writer->objects_start + offset;
+}
+
+static Value encode_value(SnapshotWriter *writer, Value value)
+{
+    if (IS_OBJ(value)) {
+        value.as.obj = (Object *)(uintptr_t)encode_ref(writer, AS_OBJ(value));
+    }
+    return value;
+}
+
+// Encoding may move the copies, so fields are addressed by their offset in the section
+static void encode_field(SnapshotWriter *writer, size_t offset)
+{
+    Object *object;
+    memcpy(&object, writer->objects.bytes + offset, sizeof(Object *));
+    uint64_t ref = encode_ref(writer, object);
+    memcpy(writer->objects.bytes + offset, &ref, sizeof(ref));
+}
+
+static void encode_value_field(SnapshotWriter *writer, size_t offset)
+{
+    Value value;
+    memcpy(&value, writer->objects.bytes + offset, sizeof(Value));
+    value = encode_value(writer, value);
+    memcpy(writer->objects.bytes + offset, &value, sizeof(Value));
+}
+
+static void encode_references(SnapshotWriter *writer, size_t offset)
+{
+    Object *object = (Object *)(writer->objects.bytes + offset);
+    object->marked = FALSE;
+    object->remembered = FALSE;
+    object->next = NULL;
+
+    switch (object->type) {
+    case OBJ_FUNCTION: {
+        // The bytecode goes to its own section, call caches and native code start over
+        FunctionProto *function = (FunctionProto *)object;
+        Instructions *instructions = function->instructions;
+        uint64_t length = instructions->size;
+        size_t code = reserve(&writer->code, sizeof(length) + length, sizeof(length));
+        memcpy(writer->code.bytes + code, &length, sizeof(length));
+        memcpy(writer->code.bytes + code + sizeof(length), instructions->array, length);
+        function->instructions = (Instructions *)(uintptr_t)code;
+        function->call_caches = NULL;
+        function->index_caches = NULL;
+        memset(&function->call_count, 0, sizeof(FunctionProto) - offsetof(FunctionProto, call_count));
+        break;
+    }
+    case OBJ_CLOSURE: {
+        int num_upvalues = ((Closure *)object)->num_upvalues;
+        encode_field(writer, offset + offsetof(Closure, function));
+        for (int i = 0; i < num_upvalues; i++) {
+            encode_field(writer, offset + offsetof(Closure, upvalues) + i * sizeof(Upvalue *));
+        }
+        break;
+    }
+    case OBJ_UPVALUE:
+        ((Upvalue *)object)->location = NULL;
+        ((Upvalue *)object)->next_open = NULL;
+        encode_value_field(writer, offset + offsetof(Upvalue, closed));
+        break;
+    case OBJ_ARRAY:
+        encode_field(writer, offset + offsetof(Array, root));
+        encode_field(writer, offset + offsetof(Array, tail));
+        break;
+    case OBJ_HASH:
+        encode_field(writer, offset + offsetof(Hash, root));
+        break;
+    case OBJ_NODE: {
+        uint32_t length = ((Node *)object)->length;
+        for (uint32_t i = 0; i < length; i++) {
+            encode_value_field(writer, offset + offsetof(Node, slots) + i * sizeof(Value));
+        }
+        break;
+    }
+    case OBJ_ROPE:
+        encode_field(writer, offset + offsetof(Rope, left));
+        encode_field(writer, offset + offsetof(Rope, right));
+        break;
+    case OBJ_BIGINT:
+    case OBJ_PACKED_NODE:
+    case OBJ_BUILTIN:
+    case OBJ_STRING:
+        break;
+    }
+}
+
+bool write_snapshot(Compiler *compiler, VM *vm, const char *path)
+{
+    if (vm->frame_count != 0 || vm->open_upvalues != NULL) {
+        return FALSE;
+    }
+    SnapshotWriter writer = { .objects_start = align(sizeof(SnapshotHeader), OBJECT_ALIGNMENT), .offsets = make_int_map() };
+    SymbolArrayList *names = compiler->resolver->globals;
+    ValueArrayList *constants = compiler->constants;
+    Value *globals = malloc((names->size + 1) * sizeof(Value));
+    for (size_t i = 0; i < names->size; i++) {
+        globals[i] = encode_value(&writer, i < vm->globals_capacity ? vm->globals[i] : NULL_VAL);
+    }
+    Value *encoded_constants = malloc((constants->size + 1) * sizeof(Value));
+    for (size_t i = 0; i < constants->size; i++) {
+        encoded_constants[i] = encode_value(&writer, constants->array[i]);
+    }
+    while (writer.num_pending > 0 && !writer.failed) {
+        encode_references(&writer, writer.pending[--writer.num_pending]);
+    }
+
+    bool written = FALSE;
+    if (!writer.failed) {
+        SnapshotHeader header = {
+            .magic = SNAPSHOT_MAGIC,
+            .version = SNAPSHOT_VERSION,
+            .objects_offset = writer.objects_start,
+            .objects_size = writer.objects.size,
+            .code_size = writer.code.size,
+            .num_globals = names->size,
+            .num_constants = constants->size,
+        };
+        header.code_offset = align(header.objects_offset + header.objects_size, sizeof(uint64_t));
+        header.globals_offset = align(header.code_offset + header.code_size, sizeof(uint64_t));
+        header.constants_offset = align(header.globals_offset + names->size * (sizeof(Value) + GLOBAL_NAME_SIZE), sizeof(uint64_t));
+        header.size = header.constants_offset + constants->size * sizeof(Value);
+
+        uint8_t *file = calloc(1, header.size);
+        memcpy(file, &header, sizeof(header));
+        memcpy(file + header.objects_offset, writer.objects.bytes, writer.objects.size);
+        memcpy(file + header.code_offset, writer.code.bytes, writer.code.size);
+        memcpy(file + header.globals_offset, globals, names->size * sizeof(Value));
+        for (size_t i = 0; i < names->size; i++) {
+            memcpy(file + header.globals_offset + names->size * sizeof(Value) + i * GLOBAL_NAME_SIZE, names->array[i].name, GLOBAL_NAME_SIZE);
+        }
+        memcpy(file + header.constants_offset, encoded_constants, constants->size * sizeof(Value));
+
+        FILE *out = fopen(path, "wb");
+        written = out != NULL && fwrite(file, 1, header.size, out) == header.size;
+        if (out != NULL && fclose(out) != 0) {
+            written = FALSE;
+        }
+        free(file);
+    }
+
+    free(globals);
+    free(encoded_constants);
+    free(writer.objects.bytes);
+    free(writer.code.bytes);
+    free(writer.pending);
+    cleanup_int_map(writer.offsets);
+    return written;
+}
+
+// Loading
+
+// Which object types a reference may point to, as bits of (1 << type)
+#define TYPE_BIT(type) (1u << (type))
+#define MAY_BE_NULL (1u << 31)
+// Anything a program can hold: not the parts of closures, arrays and hashes
+#define VALUE_TYPES                                                                                                      \
+    (TYPE_BIT(OBJ_FUNCTION) | TYPE_BIT(OBJ_CLOSURE) | TYPE_BIT(OBJ_BIGINT) | TYPE_BIT(OBJ_ARRAY) | TYPE_BIT(OBJ_HASH) \
+        | TYPE_BIT(OBJ_BUILTIN) | TYPE_BIT(OBJ_STRING) | TYPE_BIT(OBJ_ROPE))
+#define SLOT_TYPES (VALUE_TYPES | TYPE_BIT(OBJ_NODE) | TYPE_BIT(OBJ_PACKED_NODE))
+#define STRING_TYPES (TYPE_BIT(OBJ_STRING) | TYPE_BIT(OBJ_ROPE))
+
+// Deepest trie an array's size_t indices leave room for
+#define MAX_ARRAY_SHIFT (10 * NODE_BITS)
+
+// What is known about each OBJECT_ALIGNMENT bytes of the objects: whether an object starts there
+// and, once a node has been checked, which trie and level it belongs to
+#define ROLE_START 0x01
+#define ROLE_HASH 0x02
+#define ROLE_PACKED 0x04
+#define ROLE_FULL 0x08 // An array node holding NODE_WIDTH leaves' worth of elements, or a full leaf
+#define ROLE_LEVEL_SHIFT 4 // Levels above the leaves of an array, or below the root of a hash, plus one
+
+typedef struct SnapshotReader {
+    SnapshotHeader *header;
+    uint8_t *data;
+    uint8_t *roles;
+} SnapshotReader;
+
+static bool in_file(const SnapshotHeader *header, uint64_t offset, uint64_t length)
+{
+    return offset <= header->size && length <= header->size - offset;
+}
+
+static uint8_t *role_of(SnapshotReader *reader, Object *object)
+{
+    return &reader->roles[((uint8_t *)object - reader->data - reader->header->objects_offset) / OBJECT_ALIGNMENT];
+}
+
+// Turns the reference stored at `field` back into an address, returning FALSE unless it is the
+// start of an object of one of `types`
+static bool decode_field(SnapshotReader *reader, void *field, uint32_t types)
+{
+    const SnapshotHeader *header = reader->header;
+    uint64_t ref;
+    memcpy(&ref, field, sizeof(ref));
+    Object *object = NULL;
+    switch (ref & REF_TAG_MASK) {
+    case REF_OBJECT:
+        if (ref == 0) {
+            if (!(types & MAY_BE_NULL)) {
+                return FALSE;
+            }
+            break;
+        }
+        // Objects are aligned like the tag bits, so the offset is aligned too
+        if (ref < header->objects_offset || ref - header->objects_offset >= header->objects_size
+            || !(reader->roles[(ref - header->objects_offset) / OBJECT_ALIGNMENT] & ROLE_START)) {
+            return FALSE;
+        }
+        object = (Object *)(reader->data + ref);
+        break;
+    case REF_BUILTIN:
+        if ((ref >> REF_TAG_BITS) >= NUM_BUILTINS) {
+            return FALSE;
+        }
+        object = &builtins[ref >> REF_TAG_BITS].obj;
+        break;
+    case REF_CHAR:
+        if ((ref >> REF_TAG_BITS) > UINT8_MAX) {
+            return FALSE;
+        }
+        object = AS_OBJ(char_string((char)(ref >> REF_TAG_BITS)));
+        break;
+    default:
+        return FALSE;
+    }
+    if (object != NULL && !(types & TYPE_BIT(object->type))) {
+        return FALSE;
+    }
+    memcpy(field, &object, sizeof(object));
+    return TRUE;
+}
+
+static bool decode_value(SnapshotReader *reader, Value *value, uint32_t types)
+{
+    if (value->tag > VAL_OBJ) {
+        return FALSE;
+    }
+    return !IS_OBJ(*value) || decode_field(reader, &value->as.obj, types);
+}
+
+// Size of the object's fixed part, which holds what object_size needs
+static size_t fixed_size(ObjectType type)
+{
+    switch (type) {
+    case OBJ_FUNCTION:
+        return sizeof(FunctionProto);
+    case OBJ_CLOSURE:
+        return sizeof(Closure);
+    case OBJ_UPVALUE:
+        return sizeof(Upvalue);
+    case OBJ_BIGINT:
+        return sizeof(BigInt);
+    case OBJ_ARRAY:
+        return sizeof(Array);
+    case OBJ_HASH:
+        return sizeof(Hash);
+    case OBJ_NODE:
+        return sizeof(Node);
+    case OBJ_PACKED_NODE:
+        return sizeof(PackedNode);
+    case OBJ_BUILTIN:
+        return sizeof(Builtin);
+    case OBJ_STRING:
+        return sizeof(StringObject);
+    case OBJ_ROPE:
+        return sizeof(Rope);
+    }
+    return SIZE_MAX;
+}
+
+// Checks the counts the object's size depends on against the `available` bytes, before anything
+// reads past its fixed part, and the fields that hold neither references nor counts of other objects
+static bool check_object(Object *object, size_t available)
+{
+    if (available < sizeof(Object) || available < fixed_size(object->type)) {
+        return FALSE;
+    }
+    available -= fixed_size(object->type);
+    switch (object->type) {
+    case OBJ_FUNCTION: {
+        FunctionProto *function = (FunctionProto *)object;
+        return function->num_call_caches >= 0 && function->num_call_caches <= MAX_CALL_CACHES && function->num_index_caches >= 0
+            && function->num_index_caches <= MAX_INDEX_CACHES && function->num_parameters >= 0
+            && function->num_parameters <= MAX_ARGUMENTS && function->num_locals >= function->num_parameters
+            && function->num_locals <= STACK_SIZE && function->max_stack >= 0 && function->max_stack <= STACK_SIZE
+            && function->num_upvalues >= 0 && function->num_upvalues <= MAX_UPVALUES && function->num_globals <= MAX_GLOBALS
+            && function->lazy == NULL && function->name[MAX_IDENTIFIER_SIZE] == '\0';
+    }
+    case OBJ_CLOSURE: {
+        int num_upvalues = ((Closure *)object)->num_upvalues;
+        return num_upvalues >= 0 && num_upvalues <= MAX_UPVALUES && (size_t)num_upvalues <= available / sizeof(Upvalue *);
+    }
+    case OBJ_BIGINT: {
+        // Normalized like bigint.h leaves them, without leading zero limbs
+        BigInt *bigint = (BigInt *)object;
+        return bigint->num_limbs > 0 && bigint->num_limbs <= available / sizeof(uint64_t) && bigint->limbs[bigint->num_limbs - 1] != 0;
+    }
+    case OBJ_NODE:
+        return ((Node *)object)->length <= available / sizeof(Value);
+    case OBJ_PACKED_NODE:
+        return ((PackedNode *)object)->length <= NODE_WIDTH && ((PackedNode *)object)->length <= available / sizeof(int64_t);
+    case OBJ_STRING: {
+        StringObject *string = (StringObject *)object;
+        return string->length < available && string->chars[string->length] == '\0';
+    }
+    case OBJ_UPVALUE:
+    case OBJ_ARRAY:
+    case OBJ_HASH:
+    case OBJ_ROPE:
+        return TRUE;
+    case OBJ_BUILTIN:
+        // Builtins are static, references to them are saved as their id
+        break;
+    }
+    return FALSE;
+}
+
+// Decodes the object's references and clears what only means something in the process that wrote it
+static bool decode_references(SnapshotReader *reader, Object *object)
+{
+    const SnapshotHeader *header = reader->header;
+    object->marked = FALSE;
+    object->remembered = FALSE;
+    switch (object->type) {
+    case OBJ_FUNCTION: {
+        FunctionProto *function = (FunctionProto *)object;
+        uint64_t code = (uint64_t)(uintptr_t)function->instructions;
+        uint64_t length;
+        if (code % sizeof(length) != 0 || code >= header->code_size || header->code_size - code < sizeof(length)) {
+            return FALSE;
+        }
+        memcpy(&length, reader->data + header->code_offset + code, sizeof(length));
+        function->call_caches = NULL;
+        function->index_caches = NULL;
+        memset(&function->call_count, 0, sizeof(FunctionProto) - offsetof(FunctionProto, call_count));
+        return length <= header->code_size - code - sizeof(length);
+    }
+    case OBJ_CLOSURE: {
+        Closure *closure = (Closure *)object;
+        bool valid = decode_field(reader, &closure->function, TYPE_BIT(OBJ_FUNCTION));
+        for (int i = 0; i < closure->num_upvalues; i++) {
+            valid = valid && decode_field(reader, &closure->upvalues[i], TYPE_BIT(OBJ_UPVALUE));
+        }
+        return valid;
+    }
+    case OBJ_UPVALUE:
+        ((Upvalue *)object)->location = &((Upvalue *)object)->closed;
+        ((Upvalue *)object)->next_open = NULL;
+        return decode_value(reader, &((Upvalue *)object)->closed, VALUE_TYPES);
+    case OBJ_ARRAY:
+        return decode_field(reader, &((Array *)object)->root, TYPE_BIT(OBJ_NODE) | MAY_BE_NULL)
+            && decode_field(reader, &((Array *)object)->tail, TYPE_BIT(OBJ_NODE) | TYPE_BIT(OBJ_PACKED_NODE) | MAY_BE_NULL);
+    case OBJ_HASH:
+        return decode_field(reader, &((Hash *)object)->root, TYPE_BIT(OBJ_NODE) | MAY_BE_NULL);
+    case OBJ_NODE: {
+        // Which slots hold elements and which hold child nodes depends on the trie, see check_structure
+        Node *node = (Node *)object;
+        bool valid = TRUE;
+        for (uint32_t i = 0; i < node->length; i++) {
+            valid = valid && decode_value(reader, &node->slots[i], SLOT_TYPES);
+        }
+        return valid;
+    }
+    case OBJ_ROPE:
+        return decode_field(reader, &((Rope *)object)->left, STRING_TYPES)
+            && decode_field(reader, &((Rope *)object)->right, STRING_TYPES | MAY_BE_NULL);
+    case OBJ_BIGINT:
+    case OBJ_PACKED_NODE:
+    case OBJ_STRING:
+        return TRUE;
+    case OBJ_BUILTIN:
+        break;
+    }
+    return FALSE;
+}
+
+static bool is_value(Value value)
+{
+    return !IS_OBJ(value) || (VALUE_TYPES & TYPE_BIT(AS_OBJ(value)->type));
+}
+
+static uint32_t leaf_length(Object *leaf)
+{
+    return leaf->type == OBJ_PACKED_NODE ? ((PackedNode *)leaf)->length : ((Node *)leaf)->length;
+}
+
+// Checks a node of an array's trie `height` levels above the leaves, or a tail at height 0. Every
+// child but the last must be full, so that the elements are numbered without gaps. A node is only
+// checked the first time it is met, after that it must be met in the same place.
+static bool check_array_node(SnapshotReader *reader, Object *object, uint32_t height, bool packed)
+{
+    // Nodes are never static, so they are in the file
+    if (object->type != (height == 0 && packed ? OBJ_PACKED_NODE : OBJ_NODE)) {
+        return FALSE;
+    }
+    uint8_t role = ROLE_START | (uint8_t)((height + 1) << ROLE_LEVEL_SHIFT) | (packed ? ROLE_PACKED : 0);
+    uint8_t *known = role_of(reader, object);
+    if (*known != ROLE_START) {
+        return (*known & ~ROLE_FULL) == role;
+    }
+    if (leaf_length(object) == 0 || leaf_length(object) > NODE_WIDTH) {
+        return FALSE;
+    }
+    bool full = leaf_length(object) == NODE_WIDTH;
+    if (object->type == OBJ_NODE) {
+        Node *node = (Node *)object;
+        if (node->datamap != 0 || node->nodemap != 0) {
+            return FALSE;
+        }
+        for (uint32_t i = 0; i < node->length; i++) {
+            Value slot = node->slots[i];
+            if (height == 0) {
+                if (!is_value(slot)) {
+                    return FALSE;
+                }
+                continue;
+            }
+            if (!IS_OBJ(slot) || !check_array_node(reader, AS_OBJ(slot), height - 1, packed)) {
+                return FALSE;
+            }
+            bool child_full = *role_of(reader, AS_OBJ(slot)) & ROLE_FULL;
+            if (!child_full && i + 1 < node->length) {
+                return FALSE;
+            }
+            full = full && child_full;
+        }
+    }
+    *known = role | (full ? ROLE_FULL : 0);
+    return TRUE;
+}
+
+// The trie holds full leaves numbered from 0 and the tail holds the rest, together `size` elements
+// of which the array views `count` from `offset`
+static bool check_array(SnapshotReader *reader, Array *array)
+{
+    if (array->packed > TRUE || array->shift % NODE_BITS != 0 || array->shift < NODE_BITS || array->shift > MAX_ARRAY_SHIFT
+        || (array->tail == NULL) != (array->size == 0) || array->count > array->size || array->offset > array->size - array->count) {
+        return FALSE;
+    }
+    if (array->tail == NULL) {
+        return array->root == NULL;
+    }
+    if (!check_array_node(reader, array->tail, 0, array->packed)) {
+        return FALSE;
+    }
+    size_t trie_size = array->size - leaf_length(array->tail);
+    if (array->root == NULL || trie_size == 0) {
+        return array->root == NULL && trie_size == 0;
+    }
+    uint32_t height = array->shift / NODE_BITS;
+    if (!check_array_node(reader, (Object *)array->root, height, array->packed)) {
+        return FALSE;
+    }
+    // Only the rightmost path may be partial
+    size_t elements = 0;
+    Object *node = (Object *)array->root;
+    for (; height > 0; height--) {
+        uint32_t length = ((Node *)node)->length;
+        elements += (size_t)(length - 1) << (height * NODE_BITS);
+        node = AS_OBJ(((Node *)node)->slots[length - 1]);
+    }
+    return leaf_length(node) == NODE_WIDTH && elements + NODE_WIDTH == trie_size;
+}
+
+// Checks a node of a hash's trie `shift` bits below the root, once like check_array_node. Its pairs
+// come first, keys that can be hashed, then its child nodes.
+static bool check_hash_node(SnapshotReader *reader, Object *object, uint32_t shift)
+{
+    if (object->type != OBJ_NODE) {
+        return FALSE;
+    }
+    uint8_t role = ROLE_START | ROLE_HASH | (uint8_t)((shift / NODE_BITS + 1) << ROLE_LEVEL_SHIFT);
+    uint8_t *known = role_of(reader, object);
+    if (*known != ROLE_START) {
+        return *known == role;
+    }
+    Node *node = (Node *)object;
+    uint32_t pairs;
+    if (shift >= HASH_BITS) {
+        // Colliding pairs, in no particular order
+        if (node->datamap != 0 || node->nodemap != 0 || node->length < 4 || node->length % 2 != 0) {
+            return FALSE;
+        }
+        pairs = node->length / 2;
+    } else {
+        pairs = (uint32_t)__builtin_popcount(node->datamap);
+        if ((node->datamap & node->nodemap) != 0 || node->length == 0
+            || node->length != 2 * pairs + (uint32_t)__builtin_popcount(node->nodemap)) {
+            return FALSE;
+        }
+    }
+    for (uint32_t i = 0; i < pairs; i++) {
+        if (!is_hashable(node->slots[2 * i]) || !is_value(node->slots[2 * i]) || !is_value(node->slots[2 * i + 1])) {
+            return FALSE;
+        }
+    }
+    for (uint32_t i = 2 * pairs; i < node->length; i++) {
+        if (!IS_OBJ(node->slots[i]) || !check_hash_node(reader, AS_OBJ(node->slots[i]), shift + NODE_BITS)) {
+            return FALSE;
+        }
+    }
+    *known = role;
+    return TRUE;
+}
+
+static uint32_t piece_length(Object *piece)
+{
+    return piece->type == OBJ_ROPE ? ((Rope *)piece)->length : ((StringObject *)piece)->length;
+}
+
+// Checks what the object's references lead to, once every reference in the file is decoded
+static bool check_structure(SnapshotReader *reader, Object *object)
+{
+    switch (object->type) {
+    case OBJ_CLOSURE:
+        return ((Closure *)object)->num_upvalues == ((Closure *)object)->function->num_upvalues;
+    case OBJ_ARRAY:
+        return check_array(reader, (Array *)object);
+    case OBJ_HASH: {
+        // There are at least two values per pair in the file
+        Hash *hash = (Hash *)object;
+        return (hash->root == NULL) == (hash->count == 0) && hash->count <= reader->header->objects_size / (2 * sizeof(Value))
+            && (hash->root == NULL || check_hash_node(reader, (Object *)hash->root, 0));
+    }
+    case OBJ_ROPE: {
+        // Both pieces are shorter than the rope, so following them ends
+        Rope *rope = (Rope *)object;
+        if (rope->right == NULL) {
+            return rope->left->type == OBJ_STRING && piece_length(rope->left) == rope->length;
+        }
+        return piece_length(rope->left) > 0 && piece_length(rope->right) > 0
+            && (uint64_t)piece_length(rope->left) + piece_length(rope->right) == rope->length;
+    }
+    default:
+        return TRUE;
+    }
+}
+
+// Fixes up every reference in the file and checks that the objects fit together as the writer left
+// them: references lead to the start of an object of a type the field can hold, counts fit the
+// objects holding them, and arrays, hashes and ropes are shaped as their operations expect. Only
+// the bytecode is taken as it is.
+static bool relocate(SnapshotHeader *header)
+{
+    uint8_t *data = (uint8_t *)header;
+    uint64_t globals_size = header->num_globals * (sizeof(Value) + GLOBAL_NAME_SIZE);
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->num_globals > MAX_GLOBALS
+        || header->num_constants > MAX_CONSTANTS || header->objects_offset % OBJECT_ALIGNMENT != 0
+        || header->code_offset % sizeof(uint64_t) != 0 || header->globals_offset % sizeof(uint64_t) != 0
+        || header->constants_offset % sizeof(uint64_t) != 0 || !in_file(header, header->objects_offset, header->objects_size)
+        || !in_file(header, header->code_offset, header->code_size) || !in_file(header, header->globals_offset, globals_size)
+        || !in_file(header, header->constants_offset, header->num_constants * sizeof(Value))) {
+        return FALSE;
+    }
+
+    SnapshotReader reader = { .header = header, .data = data, .roles = calloc(header->objects_size / OBJECT_ALIGNMENT + 1, 1) };
+    uint8_t *objects = data + header->objects_offset;
+    uint64_t size = header->objects_size;
+    bool valid = TRUE;
+    for (uint64_t offset = 0; valid && offset < size;) {
+        Object *object = (Object *)(objects + offset);
+        valid = check_object(object, size - offset);
+        if (valid) {
+            reader.roles[offset / OBJECT_ALIGNMENT] = ROLE_START;
+            offset += align(object_size(object), OBJECT_ALIGNMENT);
+        }
+    }
+    for (uint64_t offset = 0; valid && offset < size; offset += align(object_size((Object *)(objects + offset)), OBJECT_ALIGNMENT)) {
+        valid = decode_references(&reader, (Object *)(objects + offset));
+    }
+
+    Value *globals = (Value *)(data + header->globals_offset);
+    const char *names = (const char *)(globals + header->num_globals);
+    for (uint64_t i = 0; valid && i < header->num_globals; i++) {
+        valid = decode_value(&reader, &globals[i], VALUE_TYPES) && names[i * GLOBAL_NAME_SIZE + MAX_IDENTIFIER_SIZE] == '\0';
+    }
+    Value *constants = (Value *)(data + header->constants_offset);
+    for (uint64_t i = 0; valid && i < header->num_constants; i++) {
+        valid = decode_value(&reader, &constants[i], VALUE_TYPES);
+    }
+
+    for (uint64_t offset = 0; valid && offset < size; offset += align(object_size((Object *)(objects + offset)), OBJECT_ALIGNMENT)) {
+        valid = check_structure(&reader, (Object *)(objects + offset));
+    }
+    free(reader.roles);
+    return valid;
+}
+
+Snapshot *load_snapshot(Compiler *compiler, VM *vm, const char *path)
+{
+    Heap *heap = compiler->heap;
+    if (compiler->constants->size != 0 || get_global_count(compiler->resolver) != 0 || vm->constants != compiler->constants
+        || vm->heap != heap || heap->snapshot_start != NULL) {
+        return NULL;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(SnapshotHeader)) {
+        data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    SnapshotHeader *header = data;
+    if (header->size != (uint64_t)st.st_size || !relocate(header)) {
+        munmap(data, st.st_size);
+        return NULL;
+    }
+
+    // The objects join the old space, prototypes get back what is not saved
+    uint8_t *objects = (uint8_t *)data + header->objects_offset;
+    uint8_t *code = (uint8_t *)data + header->code_offset;
+    for (uint8_t *cursor = objects; cursor < objects + header->objects_size;) {
+        Object *object = (Object *)cursor;
+        size_t size = object_size(object);
+        if (object->type == OBJ_FUNCTION) {
+            FunctionProto *function = (FunctionProto *)object;
+            uint8_t *function_code = code + (uintptr_t)function->instructions;
+            function->instructions = malloc(sizeof(Instructions));
+            memcpy(&function->instructions->size, function_code, sizeof(uint64_t));
+            function->instructions->array = function_code + sizeof(uint64_t);
+            function->instructions->capacity = 0;
+            if (function->num_call_caches > 0) {
+                function->call_caches = calloc(function->num_call_caches, sizeof(CallCache));
+            }
+            if (function->num_index_caches > 0) {
+                function->index_caches = calloc(function->num_index_caches, sizeof(IndexCache));
+            }
+        }
+        object->next = heap->objects;
+        heap->objects = object;
+        heap->bytes_allocated += size;
+        cursor += align(size, OBJECT_ALIGNMENT);
+    }
+    heap->snapshot_start = objects;
+    heap->snapshot_end = objects + header->objects_size;
+    if (heap->next_gc < heap->bytes_allocated * heap->growth_factor) {
+        heap->next_gc = (size_t)(heap->bytes_allocated * heap->growth_factor);
+    }
+
+    Value *globals = (Value *)((uint8_t *)data + header->globals_offset);
+    const char *names = (const char *)(globals + header->num_globals);
+    ensure_globals_capacity(vm, header->num_globals);
+    for (uint64_t i = 0; i < header->num_globals; i++) {
+        define_global(compiler->resolver, names + i * GLOBAL_NAME_SIZE);
+        vm->globals[i] = globals[i];
+    }
+    Value *constants = (Value *)((uint8_t *)data + header->constants_offset);
+    for (uint64_t i = 0; i < header->num_constants; i++) {
+        add_value_to_arraylist(compiler->constants, constants[i]);
+        if (IS_FLAT_STRING(constants[i])) {
+            add_interned_string(compiler->strings, AS_STRING(constants[i]), (int)i);
+        }
+    }
+
+    Snapshot *snapshot = malloc(sizeof(Snapshot));
+    snapshot->data = data;
+    snapshot->size = st.st_size;
+    return snapshot;
+}
+
+void cleanup_snapshot(Snapshot *snapshot)
+{
+    munmap(snapshot->data, snapshot->size);
+    free(snapshot);
+}
@@ -0,0 +1,62 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "compiler.h"
+#include "globals.h"
+#include "object.h"
+#include "vm.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Interpreter state saved after running an initialization script, e.g. a prelude and the libraries
+// a program needs, so that later interpreters start from it instead of running the script again.
+// A snapshot holds the VM's globals, the compiler's constants and global names, and every heap
+// object they reach, prototypes with their bytecode included.
+//
+// The objects are laid out one after the other as they are on the heap, with every reference
+// replaced by the offset of the object it points to in the file. Loading maps the file, adds the
+// address it was mapped at to those offsets and links the objects into the old space, where they
+// are collected like any other object except that their memory goes back with the mapping.
+// References to builtins and the one character strings, which are static objects, are stored as
+// their id or character.
+//
+// Before anything is used, loading checks that every reference leads to the start of an object of
+// a type its field can hold, that counts fit the objects holding them, and that arrays, hashes and
+// ropes are shaped as their operations expect. A damaged file is rejected rather than loaded. The
+// bytecode is only checked to lie within the file, so like bytecode caches the files are trusted
+// as far as the code they run.
+
+// Bump whenever the layout of the file or of any object changes
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_MAGIC 0x504e534d // "MSNP" read as little endian
+
+typedef struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size; // Of the whole file
+    uint64_t objects_offset;
+    uint64_t objects_size;
+    uint64_t code_offset; // Bytecode of the prototypes, each preceded by its length as a uint64_t
+    uint64_t code_size;
+    uint64_t globals_offset; // Values, then names of MAX_IDENTIFIER_SIZE + 1 bytes
+    uint64_t num_globals;
+    uint64_t constants_offset; // Values
+    uint64_t num_constants;
+} SnapshotHeader;
+
+// A loaded snapshot, which must outlive the heap holding its objects
+typedef struct Snapshot {
+    void *data;
+    size_t size;
+} Snapshot;
+
+// Writes what running programs left in `compiler` and `vm`, which must not be running, to `path`.
+// Returns FALSE if it could not be written, or if there are functions whose bodies are not compiled
+// yet (see compile_lazy_function).
+extern bool write_snapshot(Compiler *compiler, VM *vm, const char *path);
+// Restores a snapshot into a compiler and a VM sharing a heap, none of which have been used yet.
+// Returns NULL if the file is missing or is not a snapshot this interpreter can load.
+extern Snapshot *load_snapshot(Compiler *compiler, VM *vm, const char *path);
+extern void cleanup_snapshot(Snapshot *snapshot);
+
+#endif // SNAPSHOT_H
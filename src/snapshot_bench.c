@@ -0,0 +1,105 @@
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "single_pass.h"
+#include "snapshot.h"
+#include "vm.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Cold start of an interpreter whose programs need a prelude: a library of functions plus tables
+// computed when it starts. From nothing every instance compiles and runs the prelude first, from a
+// snapshot it maps the state the prelude left. Both then compile and run the same small program.
+
+#define PRELUDE_FUNCTIONS 500
+#define RUNS 50
+
+static const char *program = "isprime(7919) + len(primes) + squares[99] + table[500] + libb(3, 4)";
+
+static char *make_prelude(void)
+{
+    return bench_library_source(PRELUDE_FUNCTIONS,
+        "let range = fn(n) { let out = []; let i = 0; while (i < n) { let out = push(out, i); let i = i + 1; } out };\n"
+        "let isprime = fn(n) { let d = 2; while (d * d < n + 1) { if (n - (n / d) * d == 0) { return 0; } let d = d + 1; } 1 };\n"
+        "let primes = filter(range(20000), fn(n) { if (n > 1) { isprime(n) == 1 } else { false } });\n"
+        "let squares = map(range(5000), fn(x) { x * x });\n"
+        "let table = {}; let i = 0; while (i < 1000) { let table = put(table, i, i * 3); let i = i + 1; }\n");
+}
+
+static void run(Compiler *compiler, VM *vm, char *input)
+{
+    FunctionProto *main = compile_single_pass(compiler, input);
+    assert(main != NULL);
+    VMResult result = run_vm(vm, main);
+    assert(result == VM_OK);
+    (void)result;
+}
+
+// Returns the time from nothing to the program's result
+static uint64_t cold_start(char *prelude, const char *snapshot_path, Value *result)
+{
+    uint64_t start = now_ns();
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    Snapshot *snapshot = NULL;
+    if (snapshot_path != NULL) {
+        snapshot = load_snapshot(compiler, vm, snapshot_path);
+        assert(snapshot != NULL);
+    } else {
+        run(compiler, vm, prelude);
+    }
+    run(compiler, vm, (char *)program);
+    *result = get_last_popped(vm);
+    uint64_t elapsed = now_ns() - start;
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    if (snapshot != NULL) {
+        cleanup_snapshot(snapshot);
+    }
+    return elapsed;
+}
+
+int main(void)
+{
+    char *prelude = make_prelude();
+    char snapshot_path[] = "/tmp/snapshot_benchXXXXXX";
+    close(mkstemp(snapshot_path));
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    run(compiler, vm, prelude);
+    bool written = write_snapshot(compiler, vm, snapshot_path);
+    assert(written);
+    (void)written;
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    struct stat st;
+    stat(snapshot_path, &st);
+    printf("prelude: %zu bytes of source, snapshot: %lld bytes\n", strlen(prelude), (long long)st.st_size);
+
+    uint64_t totals[2] = { 0 };
+    Value results[2];
+    for (int i = 0; i < RUNS; i++) {
+        for (int from_snapshot = 0; from_snapshot <= 1; from_snapshot++) {
+            totals[from_snapshot] += cold_start(prelude, from_snapshot ? snapshot_path : NULL, &results[from_snapshot]);
+        }
+    }
+    assert(AS_INT(results[0]) == AS_INT(results[1]));
+    printf("%-14s %12s %10s\n", "start", "cold start us", "result");
+    for (int from_snapshot = 0; from_snapshot <= 1; from_snapshot++) {
+        printf("%-14s %12.1f %10" PRId64 "\n", from_snapshot ? "from snapshot" : "from nothing", totals[from_snapshot] / 1e3 / RUNS,
+            AS_INT(results[from_snapshot]));
+    }
+    unlink(snapshot_path);
+    free(prelude);
+    return 0;
+}
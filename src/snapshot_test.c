@@ -0,0 +1,328 @@
+#include "compiler.h"
+#include "object.h"
+#include "parser.h"
+#include "single_pass.h"
+#include "snapshot.h"
+#include "test_utils.h"
+#include "vm.h"
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+INIT_TEST_HARNESS()
+
+// Leaves objects of every kind in globals and constants: closures with upvalues, bigints, floats,
+// flat strings, ropes and one character strings, packed and boxed arrays, hashes and a builtin
+static char *init_script = "let square = fn(x) { x * x };\n"
+                           "let adder = fn(n) { fn(x) { x + n } };\n"
+                           "let addten = adder(10);\n"
+                           "let range = fn(n) { let out = []; let i = 0; while (i < n) { let out = push(out, i); let i = i + 1; } out };\n"
+                           "let numbers = range(100);\n"
+                           "let words = [\"zero\", 1, [2.5, \"three\"], {\"four\": 4}];\n"
+                           "let ages = {\"ada\": 36, \"alan\": 41, \"grace\": 85};\n"
+                           "let big = 9223372036854775807 + 10;\n"
+                           "let double = fn(s, n) { if (n == 0) { s } else { double(s + s, n - 1) } };\n"
+                           "let long = double(\"abcdefgh\", 7);\n"
+                           "let first = long[0];\n"
+                           "let size = len;";
+
+static char *main_script = "[square(7), addten(5), len(numbers), numbers[64], words[2][1], ages[\"grace\"], big, len(long), first, size(words), "
+                           "sum(map(numbers, square))]";
+
+static const char *expected = "[49, 15, 100, 64, three, 85, 9223372036854775817, 1024, a, 4, 328350]";
+
+static char *make_temp_path(void)
+{
+    char *path = strdup("/tmp/snapshot_testXXXXXX");
+    int fd = mkstemp(path);
+    assert(fd != -1);
+    close(fd);
+    return path;
+}
+
+// Runs `input` in a session, returning its result as a string
+static char *run_source(Compiler *compiler, VM *vm, char *input)
+{
+    FunctionProto *main = compile_single_pass(compiler, input);
+    if (main == NULL) {
+        printf("Input: %s\nFailed to compile: %s\n", input, get_error_from_arraylist(compiler->errors, 0));
+        assert(1 != 1);
+    }
+    if (run_vm(vm, main) != VM_OK) {
+        printf("Input: %s\nRuntime error: %s\n", input, vm->error);
+        assert(1 != 1);
+    }
+    return inspect_value(get_last_popped(vm));
+}
+
+static void write_init_snapshot(const char *path)
+{
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    free(run_source(compiler, vm, init_script));
+    assert(write_snapshot(compiler, vm, path));
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+}
+
+typedef struct Session {
+    Heap *heap;
+    Compiler *compiler;
+    VM *vm;
+    Snapshot *snapshot;
+} Session;
+
+static Session start_session(const char *path)
+{
+    Session session;
+    session.heap = make_heap();
+    session.compiler = make_compiler(session.heap);
+    session.vm = make_vm(session.heap, session.compiler->constants);
+    session.snapshot = load_snapshot(session.compiler, session.vm, path);
+    return session;
+}
+
+static void end_session(Session session)
+{
+    cleanup_vm(session.vm);
+    cleanup_compiler(session.compiler);
+    cleanup_heap(session.heap);
+    if (session.snapshot != NULL) {
+        cleanup_snapshot(session.snapshot);
+    }
+}
+
+static uint8_t *read_file(const char *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    fseek(file, 0, SEEK_END);
+    *size = ftell(file);
+    rewind(file);
+    uint8_t *contents = malloc(*size);
+    assert(fread(contents, 1, *size, file) == *size);
+    fclose(file);
+    return contents;
+}
+
+static void write_file(const char *path, const uint8_t *contents, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    assert(fwrite(contents, 1, size, file) == size);
+    fclose(file);
+}
+
+static void assert_rejected(const char *path)
+{
+    Session session = start_session(path);
+    assert(session.snapshot == NULL);
+    end_session(session);
+}
+
+static void assert_result(char *input, const char *expected_result, char *result)
+{
+    if (strcmp(result, expected_result) != 0) {
+        printf("Input: %s\nExpected: %s\nGot: %s\n", input, expected_result, result);
+        assert(1 != 1);
+    }
+    free(result);
+}
+
+TEST_CASE(restores_globals)
+{
+    // The same as running both scripts in one session
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    free(run_source(compiler, vm, init_script));
+    assert_result(main_script, expected, run_source(compiler, vm, main_script));
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+
+    char *path = make_temp_path();
+    write_init_snapshot(path);
+    Session session = start_session(path);
+    assert(session.snapshot != NULL);
+    assert_result(main_script, expected, run_source(session.compiler, session.vm, main_script));
+    // Literals equal to the snapshot's share its constants
+    size_t num_constants = session.compiler->constants->size;
+    assert_result("\"ada\"", "ada", run_source(session.compiler, session.vm, "\"ada\""));
+    assert(session.compiler->constants->size == num_constants);
+    end_session(session);
+    unlink(path);
+    free(path);
+}
+
+TEST_CASE(loads_anywhere)
+{
+    char *path = make_temp_path();
+    write_init_snapshot(path);
+    Session first = start_session(path);
+    Session second = start_session(path);
+    assert(first.snapshot != NULL && second.snapshot != NULL && first.snapshot->data != second.snapshot->data);
+    assert_result(main_script, expected, run_source(first.compiler, first.vm, main_script));
+    assert_result(main_script, expected, run_source(second.compiler, second.vm, main_script));
+    end_session(first);
+    end_session(second);
+    unlink(path);
+    free(path);
+}
+
+TEST_CASE(collects_snapshot_objects)
+{
+    char *path = make_temp_path();
+    write_init_snapshot(path);
+    Session session = start_session(path);
+    assert(session.snapshot != NULL);
+    session.heap->stress = TRUE;
+    session.heap->gc_threads = 2;
+    // Pushing onto a snapshot's array writes young objects into its tail. Rebinding globals lets the
+    // snapshot's objects die, which are then swept without being freed.
+    char *input = "let numbers = push(numbers, [\"young\"]); let i = 0; while (i < 50) { let words = push(words, range(i)); let i = i + 1; } "
+                  "let ages = {}; let long = \"short\"; [numbers[100][0], len(words), words[53][2], addten(1)]";
+    assert_result(input, "[young, 54, 2, 11]", run_source(session.compiler, session.vm, input));
+    assert(session.heap->stats.major_collections > 0);
+    input = "[len(numbers), square(numbers[99]), len(long), ages[\"ada\"], big]";
+    assert_result(input, "[101, 9801, 5, null, 9223372036854775817]", run_source(session.compiler, session.vm, input));
+    end_session(session);
+    unlink(path);
+    free(path);
+}
+
+TEST_CASE(rejects_what_it_cannot_load)
+{
+    char *path = make_temp_path();
+    write_init_snapshot(path);
+
+    // Only into a session that has not run anything yet
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    free(run_source(compiler, vm, "let x = 1"));
+    assert(load_snapshot(compiler, vm, path) == NULL);
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+
+    size_t size;
+    uint8_t *contents = read_file(path, &size);
+    ((SnapshotHeader *)contents)->version++;
+    write_file(path, contents, size);
+    assert_rejected(path);
+    ((SnapshotHeader *)contents)->version--;
+
+    write_file(path, contents, size - 1);
+    assert_rejected(path);
+
+    // A reference past the objects
+    SnapshotHeader *header = (SnapshotHeader *)contents;
+    Value *globals = (Value *)(contents + header->globals_offset);
+    assert(IS_OBJ(globals[0]));
+    globals[0].as.obj = (Object *)(uintptr_t)(header->objects_offset + header->objects_size + OBJECT_ALIGNMENT);
+    write_file(path, contents, size);
+    assert_rejected(path);
+
+    unlink(path);
+    assert_rejected(path);
+    free(contents);
+    free(path);
+}
+
+TEST_CASE(rejects_damaged_files)
+{
+    char *path = make_temp_path();
+    write_init_snapshot(path);
+    size_t size;
+    uint8_t *contents = read_file(path, &size);
+    uint8_t *damaged = malloc(size);
+    SnapshotHeader *header = (SnapshotHeader *)damaged;
+    const SnapshotHeader *original = (const SnapshotHeader *)contents;
+
+    // Truncated, with the header saying so. Objects cut short anywhere lose one that is referenced.
+    for (size_t length = sizeof(SnapshotHeader); length < size; length += 7) {
+        memcpy(damaged, contents, length);
+        header->size = length;
+        write_file(path, damaged, length);
+        assert_rejected(path);
+    }
+    for (uint64_t objects_size = 0; objects_size < original->objects_size; objects_size += 8) {
+        memcpy(damaged, contents, size);
+        header->objects_size = objects_size;
+        write_file(path, damaged, size);
+        assert_rejected(path);
+    }
+
+    // `square` is a closure, the first global
+    memcpy(damaged, contents, size);
+    Value *globals = (Value *)(damaged + header->globals_offset);
+    uint64_t square = (uint64_t)(uintptr_t)globals[0].as.obj;
+    assert(((Object *)(damaged + square))->type == OBJ_CLOSURE && object_size((Object *)(damaged + square)) > OBJECT_ALIGNMENT);
+
+    // A reference into the middle of an object
+    globals[0].as.obj = (Object *)(uintptr_t)(square + OBJECT_ALIGNMENT);
+    write_file(path, damaged, size);
+    assert_rejected(path);
+    globals[0].as.obj = (Object *)(uintptr_t)square;
+    write_file(path, damaged, size);
+    Session session = start_session(path);
+    assert(session.snapshot != NULL);
+    end_session(session);
+
+    // A closure whose function is itself
+    memcpy(damaged + square + offsetof(Closure, function), &square, sizeof(square));
+    write_file(path, damaged, size);
+    assert_rejected(path);
+
+    // An array viewing more elements than it holds, `numbers` is the fifth global
+    memcpy(damaged, contents, size);
+    uint64_t numbers = (uint64_t)(uintptr_t)globals[4].as.obj;
+    Array *array = (Array *)(damaged + numbers);
+    assert(array->obj.type == OBJ_ARRAY && array->count == 100);
+    array->count = SIZE_MAX;
+    write_file(path, damaged, size);
+    assert_rejected(path);
+
+    // Whatever a damaged byte in the objects changes, the file is rejected or loads into a heap that
+    // can be cleaned up
+    srand(42);
+    for (int i = 0; i < 2000; i++) {
+        memcpy(damaged, contents, size);
+        damaged[original->objects_offset + (size_t)rand() % original->objects_size] = (uint8_t)rand();
+        write_file(path, damaged, size);
+        end_session(start_session(path));
+    }
+
+    unlink(path);
+    free(damaged);
+    free(contents);
+    free(path);
+}
+
+TEST_CASE(does_not_write_lazy_functions)
+{
+    char *input = "let f = fn(x) { x }; 1";
+    Parser *parser = make_parser(input, NULL);
+    parser->lazy_functions = TRUE;
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL && run_vm(vm, main) == VM_OK);
+    char *path = make_temp_path();
+    assert(!write_snapshot(compiler, vm, path));
+    unlink(path);
+    free(path);
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+RUN_TESTS()
@@ -26,32 +26,57 @@ char *concat_cstrs(const char **strings, size_t count)
     return result;
 }
 
-String *make_string(void)
+char *read_stream(FILE *file)
 {
-    String *string = malloc(sizeof(String));
+    size_t size = 0;
+    size_t capacity = 4096;
+    char *buffer = malloc(capacity);
+    size_t read;
+    while ((read = fread(buffer + size, 1, capacity - size - 1, file)) > 0) {
+        size += read;
+        if (capacity - size - 1 == 0) {
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+        }
+    }
+    buffer[size] = '\0';
+    return buffer;
+}
+
+String *make_string(Allocator *allocator)
+{
+    allocator = resolve_allocator(allocator);
+    String *string = allocate(allocator, sizeof(String));
+    string->allocator = allocator;
     string->capacity = INITIAL_STRING_CAPACITY;
     string->size = 1;
-    string->array = malloc(string->capacity * sizeof(char));
+    string->array = allocate(allocator, string->capacity * sizeof(char));
     string->array[0] = '\0';
     return string;
 }
 
 void cleanup_string(String *str)
 {
-    free(str->array);
-    free(str);
+    deallocate(str->allocator, str->array, str->capacity * sizeof(char));
+    deallocate(str->allocator, str, sizeof(String));
 }
 
-void concat_strings(String *target, String *source)
+// Makes room for `extra` more chars, doubling the capacity as often as needed
+static void grow_string(String *target, size_t extra)
 {
-    bool should_realloc = FALSE;
-    while (target->size + source->size > target->capacity) {
-        target->capacity *= 2;
-        should_realloc = TRUE;
+    size_t new_capacity = target->capacity;
+    while (target->size + extra > new_capacity) {
+        new_capacity *= 2;
     }
-    if (should_realloc) {
-        target->array = realloc_backing_array(target->array, target->size, target->capacity, sizeof(char));
+    if (new_capacity != target->capacity) {
+        target->array = realloc_backing_array(target->allocator, target->array, target->size, target->capacity, new_capacity, sizeof(char));
+        target->capacity = new_capacity;
     }
+}
+
+void concat_strings(String *target, String *source)
+{
+    grow_string(target, source->size);
     strcpy(&target->array[target->size - 1], source->array); // -1 to account for writing over the sentinel character
     target->size += source->size - 1; // -1 to account for removal of extra sentinel char
     cleanup_string(source);
@@ -60,14 +85,7 @@ void concat_strings(String *target, String *source)
 void copy_str_into_string(String *target, char *source)
 {
     size_t source_len = strlen(source) + 1; // strlen doesn't include null terminator
-    bool should_realloc = FALSE;
-    while (target->size + source_len > target->capacity) {
-        target->capacity *= 2;
-        should_realloc = TRUE;
-    }
-    if (should_realloc) {
-        target->array = realloc_backing_array(target->array, target->size, target->capacity, sizeof(char));
-    }
+    grow_string(target, source_len);
     strcpy(&target->array[target->size - 1], source); // -1 to account for writing over the sentinel character
     target->size += source_len - 1; // -1 to account for removal of extra sentinel char
     // We don't free the source since it might be borrowed
@@ -80,12 +98,15 @@ char *get_str_from_string(String *source)
     return str;
 }
 
-StrArrayList *make_str_arraylist(size_t *initial_capacity)
+StrArrayList *make_str_arraylist(size_t *initial_capacity, Allocator *allocator)
 {
-    StrArrayList *list = malloc(sizeof(StrArrayList));
+    allocator = resolve_allocator(allocator);
+    StrArrayList *list = allocate(allocator, sizeof(StrArrayList));
+    list->allocator = allocator;
     list->capacity = initial_capacity == NULL ? INITIAL_STR_ARRAYLIST_CAPACITY : *initial_capacity;
     list->size = 0;
-    list->array = malloc(list->capacity * sizeof(char *));
+    list->array = allocate(allocator, list->capacity * sizeof(char *));
+    return list;
 }
 
 void cleanup_str_arraylist(StrArrayList *list)
@@ -93,15 +114,15 @@ void cleanup_str_arraylist(StrArrayList *list)
     for (size_t i = 0; i < list->size; i++) {
         free(list->array[i]);
     }
-    free(list->array);
-    free(list);
+    deallocate(list->allocator, list->array, list->capacity * sizeof(char *));
+    deallocate(list->allocator, list, sizeof(StrArrayList));
 }
 
 void add_str_to_arraylist(StrArrayList *list, char *str)
 {
     if (list->size == list->capacity) {
+        list->array = realloc_backing_array(list->allocator, list->array, list->size, list->capacity, list->capacity * 2, sizeof(char *));
         list->capacity *= 2;
-        list->array = realloc_backing_array(list->array, list->size, list->capacity, sizeof(char *));
     }
     list->array[list->size++] = str;
 }
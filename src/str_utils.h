@@ -1,29 +1,35 @@
 #ifndef UTILS_H
 #define UTILS_H
 
+#include "allocator.h"
 #include <stddef.h>
+#include <stdio.h>
 
 typedef struct String {
     char *array;
     size_t size;
     size_t capacity;
+    Allocator *allocator;
 } String;
 
 typedef struct StrArrayList {
     char **array;
     size_t size;
     size_t capacity;
+    Allocator *allocator; // Only for the list itself, the strings it holds are freed with free()
 } StrArrayList;
 
 extern char *concat_cstrs(const char **strings, size_t count);
+// Reads everything left in `file` into a string the caller frees
+extern char *read_stream(FILE *file);
 
-extern String *make_string(void);
+extern String *make_string(Allocator *allocator);
 extern void cleanup_string(String *str);
 extern void concat_strings(String *target, String *source);
 extern void copy_str_into_string(String *target, char *source);
 extern char *get_str_from_string(String *source);
 
-extern StrArrayList *make_str_arraylist(size_t *initial_capacity);
+extern StrArrayList *make_str_arraylist(size_t *initial_capacity, Allocator *allocator);
 extern void cleanup_str_arraylist(StrArrayList *list);
 extern void add_str_to_arraylist(StrArrayList *list, char *str);
 extern char *get_nth_str_from_arraylist(StrArrayList *list, size_t n);
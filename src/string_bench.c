@@ -0,0 +1,102 @@
+#include "allocator.h"
+#include "bench_utils.h"
+#include "compiler.h"
+#include "gc.h"
+#include "object.h"
+#include "parser.h"
+#include "string_object.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Building a string one small append at a time: an interpreted program appending ten bytes a
+// million times and indexing the result, then ropes against copying a flat string on every append
+
+#define VM_APPENDS 1000000
+#define PIECE "0123456789"
+#define PIECE_LENGTH 10
+
+static void bench_program(const char *label, const char *format)
+{
+    char input[512];
+    snprintf(input, sizeof(input), format, VM_APPENDS);
+
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = FALSE;
+
+    uint64_t start = now_ns();
+    VMResult result = run_vm(vm, main);
+    uint64_t elapsed = now_ns() - start;
+    assert(result == VM_OK);
+    (void)result;
+
+    GCStats stats = get_gc_stats(heap);
+    printf("%-8s %10d %10.1f %10.1f %10.1f %8zu %8zu\n", label, VM_APPENDS, elapsed / 1e6, (double)elapsed / VM_APPENDS,
+        stats.total_pause_ns / 1e6, stats.minor_collections, stats.major_collections);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+// Every append allocates a new string and copies both operands into it
+static uint64_t bench_copying(size_t count)
+{
+    uint64_t start = now_ns();
+    char *string = calloc(1, 1);
+    for (size_t i = 0; i < count; i++) {
+        char *copy = malloc((i + 1) * PIECE_LENGTH + 1);
+        memcpy(copy, string, i * PIECE_LENGTH);
+        memcpy(copy + i * PIECE_LENGTH, PIECE, PIECE_LENGTH + 1);
+        free(string);
+        string = copy;
+    }
+    uint64_t elapsed = now_ns() - start;
+    assert(strlen(string) == count * PIECE_LENGTH);
+    free(string);
+    return elapsed;
+}
+
+// Includes flattening the result once at the end
+static uint64_t bench_rope(size_t count, Arena *arena)
+{
+    uint64_t start = now_ns();
+    Value piece = string_from_chars(PIECE, PIECE_LENGTH, &arena->allocator);
+    Value string = string_from_chars("", 0, &arena->allocator);
+    for (size_t i = 0; i < count; i++) {
+        string = string_concat(string, piece, &arena->allocator);
+    }
+    StringObject *flat = string_flatten(string, &arena->allocator);
+    uint64_t elapsed = now_ns() - start;
+    assert(flat->length == count * PIECE_LENGTH);
+    (void)flat;
+    reset_arena(arena);
+    return elapsed;
+}
+
+int main(void)
+{
+    printf("%-8s %10s %10s %10s %10s %8s %8s\n", "vm", "appends", "total ms", "ns/append", "gc ms", "minor", "major");
+    bench_program("append", "let s = \"\"; let i = 0; while (i < %d) { let s = s + \"" PIECE "\"; let i = i + 1; } len(s)");
+    bench_program("+index", "let s = \"\"; let i = 0; while (i < %d) { let s = s + \"" PIECE "\"; let i = i + 1; } s[len(s) - 1]");
+
+    printf("\n%10s %14s %14s\n", "appends", "copy ns/op", "rope ns/op");
+    Arena *arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    size_t counts[] = { 1000, 10000, 50000 };
+    for (size_t i = 0; i < sizeof(counts) / sizeof(counts[0]); i++) {
+        size_t count = counts[i];
+        printf("%10zu %14.1f %14.1f\n", count, (double)bench_copying(count) / count, (double)bench_rope(count, arena) / count);
+    }
+    cleanup_arena(arena);
+    return 0;
+}
@@ -0,0 +1,434 @@
+#include "string_object.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define INITIAL_INTERN_CAPACITY 64
+
+static StringObject *allocate_string(size_t length, Allocator *allocator)
+{
+    StringObject *string = allocate(allocator, STRING_SIZE(length));
+    string->obj.type = OBJ_STRING;
+    string->length = (uint32_t)length;
+    string->hash = 0;
+    string->chars[length] = '\0';
+    return string;
+}
+
+Value string_from_chars(const char *chars, size_t length, Allocator *allocator)
+{
+    StringObject *string = allocate_string(length, allocator);
+    memcpy(string->chars, chars, length);
+    return OBJ_VAL(string);
+}
+
+static inline char decode_escape(char c)
+{
+    switch (c) {
+    case 'n':
+        return '\n';
+    case 't':
+        return '\t';
+    case 'r':
+        return '\r';
+    default:
+        return c; // A quote or a backslash
+    }
+}
+
+size_t literal_length(StringSpan literal)
+{
+    if (!literal.escaped) {
+        return literal.length;
+    }
+    size_t length = literal.length;
+    for (const char *c = literal.start; c < literal.start + literal.length; c++) {
+        if (*c == '\\') {
+            length--;
+            c++;
+        }
+    }
+    return length;
+}
+
+Value string_from_literal(StringSpan literal, Allocator *allocator)
+{
+    if (!literal.escaped) {
+        return string_from_chars(literal.start, literal.length, allocator);
+    }
+
+    StringObject *string = allocate_string(literal_length(literal), allocator);
+    const char *source = literal.start;
+    const char *end = literal.start + literal.length;
+    char *target = string->chars;
+    // The lexer made sure every backslash is followed by a known escape
+    for (const char *backslash; (backslash = memchr(source, '\\', end - source)) != NULL; source = backslash + 2) {
+        memcpy(target, source, backslash - source);
+        target += backslash - source;
+        *target++ = decode_escape(backslash[1]);
+    }
+    memcpy(target, source, end - source);
+    return OBJ_VAL(string);
+}
+
+static struct {
+    StringObject string;
+    char chars[2];
+} char_strings[256];
+
+__attribute__((constructor)) static void init_char_strings(void)
+{
+    for (int c = 0; c < 256; c++) {
+        char_strings[c].string.obj.type = OBJ_STRING;
+        char_strings[c].string.obj.marked = TRUE; // Never collected, like builtins
+        char_strings[c].string.length = 1;
+        char_strings[c].string.chars[0] = (char)c;
+    }
+}
+
+Value char_string(char c)
+{
+    return OBJ_VAL(&char_strings[(uint8_t)c].string);
+}
+
+uint32_t string_length(Value string)
+{
+    return IS_ROPE(string) ? AS_ROPE(string)->length : AS_STRING(string)->length;
+}
+
+// The flat string a rope was flattened into, otherwise the object itself
+static inline Object *resolve(Value string)
+{
+    if (IS_ROPE(string) && AS_ROPE(string)->right == NULL) {
+        return AS_ROPE(string)->left;
+    }
+    return AS_OBJ(string);
+}
+
+static inline bool is_short_leaf(Object *object, uint32_t extra)
+{
+    return object->type == OBJ_STRING && ((StringObject *)object)->length + extra < ROPE_LEAF_LENGTH;
+}
+
+static Value flat_concat(StringObject *left, StringObject *right, Allocator *allocator)
+{
+    StringObject *string = allocate_string((size_t)left->length + right->length, allocator);
+    memcpy(string->chars, left->chars, left->length);
+    memcpy(string->chars + left->length, right->chars, right->length);
+    return OBJ_VAL(string);
+}
+
+static Value make_rope(Object *left, Object *right, Allocator *allocator)
+{
+    Rope *rope = allocate(allocator, sizeof(Rope));
+    rope->obj.type = OBJ_ROPE;
+    rope->length = string_length(OBJ_VAL(left)) + string_length(OBJ_VAL(right));
+    rope->hash = 0;
+    rope->left = left;
+    rope->right = right;
+    return OBJ_VAL(rope);
+}
+
+Value string_concat(Value left, Value right, Allocator *allocator)
+{
+    uint32_t left_length = string_length(left);
+    uint32_t right_length = string_length(right);
+    if (left_length == 0 || right_length == 0) {
+        return left_length == 0 ? right : left;
+    }
+    Object *a = resolve(left);
+    Object *b = resolve(right);
+    if (a->type == OBJ_STRING && b->type == OBJ_STRING && (size_t)left_length + right_length < ROPE_LEAF_LENGTH) {
+        return flat_concat((StringObject *)a, (StringObject *)b, allocator);
+    }
+
+    // Appending a short piece to a rope ending in a short leaf copies the piece into a new leaf
+    // rather than adding a level, and likewise for prepending. A loop of small appends then builds
+    // one level per ROPE_LEAF_LENGTH bytes instead of one per append.
+    if (a->type == OBJ_ROPE && b->type == OBJ_STRING && is_short_leaf(((Rope *)a)->right, right_length)) {
+        Value leaf = flat_concat((StringObject *)((Rope *)a)->right, (StringObject *)b, allocator);
+        return make_rope(((Rope *)a)->left, AS_OBJ(leaf), allocator);
+    }
+    if (a->type == OBJ_STRING && b->type == OBJ_ROPE && is_short_leaf(((Rope *)b)->left, left_length)) {
+        Value leaf = flat_concat((StringObject *)a, (StringObject *)((Rope *)b)->left, allocator);
+        return make_rope(AS_OBJ(leaf), ((Rope *)b)->right, allocator);
+    }
+    return make_rope(a, b, allocator);
+}
+
+// Walks the flat pieces of a string from left to right. Ropes built by appending are as deep as
+// they have leaves, so the pending right children are kept on the heap rather than the C stack.
+typedef struct Chunks {
+    Object **stack;
+    size_t count;
+    size_t capacity;
+    Object *initial[32];
+} Chunks;
+
+static void push_chunk(Chunks *chunks, Object *object)
+{
+    if (chunks->count == chunks->capacity) {
+        chunks->capacity *= 2;
+        if (chunks->stack == chunks->initial) {
+            chunks->stack = malloc(chunks->capacity * sizeof(Object *));
+            memcpy(chunks->stack, chunks->initial, sizeof(chunks->initial));
+        } else {
+            chunks->stack = realloc(chunks->stack, chunks->capacity * sizeof(Object *));
+        }
+    }
+    chunks->stack[chunks->count++] = object;
+}
+
+static void start_chunks(Chunks *chunks, Value string)
+{
+    chunks->stack = chunks->initial;
+    chunks->count = 0;
+    chunks->capacity = sizeof(chunks->initial) / sizeof(chunks->initial[0]);
+    push_chunk(chunks, AS_OBJ(string));
+}
+
+// Returns NULL once every piece was visited
+static StringObject *next_chunk(Chunks *chunks)
+{
+    if (chunks->count == 0) {
+        return NULL;
+    }
+    Object *object = chunks->stack[--chunks->count];
+    // A flattened rope has no right child and its left child is flat
+    while (object->type == OBJ_ROPE) {
+        if (((Rope *)object)->right != NULL) {
+            push_chunk(chunks, ((Rope *)object)->right);
+        }
+        object = ((Rope *)object)->left;
+    }
+    return (StringObject *)object;
+}
+
+static void finish_chunks(Chunks *chunks)
+{
+    if (chunks->stack != chunks->initial) {
+        free(chunks->stack);
+    }
+}
+
+static void copy_chars(Value string, char *target)
+{
+    Chunks chunks;
+    start_chunks(&chunks, string);
+    for (StringObject *chunk; (chunk = next_chunk(&chunks)) != NULL; target += chunk->length) {
+        memcpy(target, chunk->chars, chunk->length);
+    }
+    finish_chunks(&chunks);
+}
+
+StringObject *string_flatten(Value string, Allocator *allocator)
+{
+    Object *object = resolve(string);
+    if (object->type == OBJ_STRING) {
+        return (StringObject *)object;
+    }
+    Rope *rope = (Rope *)object;
+    StringObject *flat = allocate_string(rope->length, allocator);
+    copy_chars(string, flat->chars);
+    flat->hash = rope->hash;
+    // The pieces become garbage unless another string still shares them
+    rope->left = (Object *)flat;
+    rope->right = NULL;
+    return flat;
+}
+
+char *string_to_str(Value string)
+{
+    uint32_t length = string_length(string);
+    char *result = malloc((size_t)length + 1);
+    copy_chars(string, result);
+    result[length] = '\0';
+    return result;
+}
+
+// FNV-1a, fed one byte at a time so literals can be hashed while their escapes are decoded
+
+static inline uint32_t hash_byte(uint32_t hash, char c)
+{
+    return (hash ^ (uint8_t)c) * FNV_PRIME;
+}
+
+static inline uint32_t finish_hash(uint32_t hash)
+{
+    return hash == 0 ? 1 : hash;
+}
+
+static uint32_t flat_hash(StringObject *string)
+{
+    if (string->hash == 0) {
+        uint32_t hash = FNV_OFFSET_BASIS;
+        for (uint32_t i = 0; i < string->length; i++) {
+            hash = hash_byte(hash, string->chars[i]);
+        }
+        string->hash = finish_hash(hash);
+    }
+    return string->hash;
+}
+
+uint32_t string_hash(Value string)
+{
+    if (IS_FLAT_STRING(string)) {
+        return flat_hash(AS_STRING(string));
+    }
+    Rope *rope = AS_ROPE(string);
+    if (rope->hash == 0) {
+        uint32_t hash = FNV_OFFSET_BASIS;
+        Chunks chunks;
+        start_chunks(&chunks, string);
+        for (StringObject *chunk; (chunk = next_chunk(&chunks)) != NULL;) {
+            for (uint32_t i = 0; i < chunk->length; i++) {
+                hash = hash_byte(hash, chunk->chars[i]);
+            }
+        }
+        finish_chunks(&chunks);
+        rope->hash = finish_hash(hash);
+    }
+    return rope->hash;
+}
+
+static inline uint32_t cached_hash(Value string)
+{
+    return IS_ROPE(string) ? AS_ROPE(string)->hash : AS_STRING(string)->hash;
+}
+
+bool strings_equal(Value a, Value b)
+{
+    if (AS_OBJ(a) == AS_OBJ(b)) {
+        return TRUE;
+    }
+    uint32_t length = string_length(a);
+    uint32_t hash_a = cached_hash(a);
+    uint32_t hash_b = cached_hash(b);
+    if (length != string_length(b) || (hash_a != 0 && hash_b != 0 && hash_a != hash_b)) {
+        return FALSE;
+    }
+    Object *flat_a = resolve(a);
+    Object *flat_b = resolve(b);
+    if (flat_a->type == OBJ_STRING && flat_b->type == OBJ_STRING) {
+        return memcmp(((StringObject *)flat_a)->chars, ((StringObject *)flat_b)->chars, length) == 0;
+    }
+
+    // The pieces of the two strings end at different offsets, so compare whatever overlaps next
+    Chunks chunks_a, chunks_b;
+    start_chunks(&chunks_a, a);
+    start_chunks(&chunks_b, b);
+    StringObject *chunk_a = next_chunk(&chunks_a);
+    StringObject *chunk_b = next_chunk(&chunks_b);
+    uint32_t offset_a = 0, offset_b = 0;
+    bool equal = TRUE;
+    while (equal && chunk_a != NULL) {
+        uint32_t left_a = chunk_a->length - offset_a;
+        uint32_t left_b = chunk_b->length - offset_b;
+        uint32_t overlap = left_a < left_b ? left_a : left_b;
+        equal = memcmp(chunk_a->chars + offset_a, chunk_b->chars + offset_b, overlap) == 0;
+        offset_a += overlap;
+        offset_b += overlap;
+        if (offset_a == chunk_a->length) {
+            chunk_a = next_chunk(&chunks_a);
+            offset_a = 0;
+        }
+        if (offset_b == chunk_b->length) {
+            chunk_b = next_chunk(&chunks_b);
+            offset_b = 0;
+        }
+    }
+    finish_chunks(&chunks_a);
+    finish_chunks(&chunks_b);
+    return equal;
+}
+
+static uint32_t literal_hash(StringSpan literal)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (const char *c = literal.start; c < literal.start + literal.length; c++) {
+        hash = hash_byte(hash, *c == '\\' && literal.escaped ? decode_escape(*++c) : *c);
+    }
+    return finish_hash(hash);
+}
+
+static bool literal_equals(StringSpan literal, StringObject *string)
+{
+    if (!literal.escaped) {
+        return literal.length == string->length && memcmp(literal.start, string->chars, literal.length) == 0;
+    }
+    const char *c = literal.start;
+    const char *end = literal.start + literal.length;
+    for (uint32_t i = 0; i < string->length; i++, c++) {
+        if (c == end || string->chars[i] != (*c == '\\' ? decode_escape(*++c) : *c)) {
+            return FALSE;
+        }
+    }
+    return c == end;
+}
+
+// Intern table
+
+InternTable *make_intern_table(void)
+{
+    InternTable *table = malloc(sizeof(InternTable));
+    table->strings = calloc(INITIAL_INTERN_CAPACITY, sizeof(StringObject *));
+    table->indices = malloc(INITIAL_INTERN_CAPACITY * sizeof(int));
+    table->count = 0;
+    table->capacity = INITIAL_INTERN_CAPACITY;
+    return table;
+}
+
+void cleanup_intern_table(InternTable *table)
+{
+    free(table->strings);
+    free(table->indices);
+    free(table);
+}
+
+int find_interned_literal(InternTable *table, StringSpan literal)
+{
+    uint32_t hash = literal_hash(literal);
+    size_t mask = table->capacity - 1;
+    for (size_t slot = hash & mask; table->strings[slot] != NULL; slot = (slot + 1) & mask) {
+        StringObject *string = table->strings[slot];
+        if (flat_hash(string) == hash && literal_equals(literal, string)) {
+            return table->indices[slot];
+        }
+    }
+    return -1;
+}
+
+static void insert_string(InternTable *table, StringObject *string, int index)
+{
+    size_t mask = table->capacity - 1;
+    size_t slot = flat_hash(string) & mask;
+    while (table->strings[slot] != NULL) {
+        slot = (slot + 1) & mask;
+    }
+    table->strings[slot] = string;
+    table->indices[slot] = index;
+    table->count++;
+}
+
+void add_interned_string(InternTable *table, StringObject *string, int index)
+{
+    // Kept at most half full so probe sequences stay short
+    if (2 * (table->count + 1) > table->capacity) {
+        StringObject **strings = table->strings;
+        int *indices = table->indices;
+        size_t capacity = table->capacity;
+        table->capacity *= 2;
+        table->strings = calloc(table->capacity, sizeof(StringObject *));
+        table->indices = malloc(table->capacity * sizeof(int));
+        table->count = 0;
+        for (size_t i = 0; i < capacity; i++) {
+            if (strings[i] != NULL) {
+                insert_string(table, strings[i], indices[i]);
+            }
+        }
+        free(strings);
+        free(indices);
+    }
+    insert_string(table, string, index);
+}
@@ -0,0 +1,67 @@
+#ifndef STRING_OBJECT_H
+#define STRING_OBJECT_H
+
+#include "allocator.h"
+#include "globals.h"
+#include "object.h"
+#include "token.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Immutable strings of bytes. Literals become strings straight from their span in the source:
+// a single copy when they have no escapes, a decoding pass only when they do. Every distinct
+// literal in a program becomes one shared constant, see InternTable.
+//
+// Concatenating builds a Rope over both operands instead of copying them, so building a long
+// string piece by piece is linear. A rope is flattened into one StringObject the first time it is
+// indexed, and keeps that copy. Equality, hashing and output walk the pieces without flattening.
+// The functions below taking a Value accept both representations.
+//
+// Strings are allocated with `allocator->alloc` and written after, so the allocator must not move
+// anything. The VM makes room before calling in, like it does for persistent.h.
+
+#define MAX_STRING_LENGTH UINT32_MAX
+#define STRING_SIZE(length) (sizeof(StringObject) + (length) + 1)
+// Concatenations shorter than this are copied into a flat string, which keeps ropes from
+// degenerating into one node per character
+#define ROPE_LEAF_LENGTH 256
+// Most a single concatenation allocates, with room for aligning both of its objects
+#define STRING_CONCAT_SIZE (sizeof(Rope) + STRING_SIZE(ROPE_LEAF_LENGTH) + OBJECT_ALIGNMENT)
+
+extern Value string_from_chars(const char *chars, size_t length, Allocator *allocator);
+// Length of the literal once its escapes are decoded
+extern size_t literal_length(StringSpan literal);
+extern Value string_from_literal(StringSpan literal, Allocator *allocator);
+// The shared one byte string holding `c`, these are never allocated
+extern Value char_string(char c);
+
+extern uint32_t string_length(Value string);
+// The combined length must not exceed MAX_STRING_LENGTH
+extern Value string_concat(Value left, Value right, Allocator *allocator);
+// Allocates STRING_SIZE(string_length(string)) the first time a rope is flattened. The flat string
+// is stored in the rope, so callers with a generational heap must apply the write barrier.
+extern StringObject *string_flatten(Value string, Allocator *allocator);
+extern bool strings_equal(Value a, Value b);
+// Never 0, computed on first use and kept in the string
+extern uint32_t string_hash(Value string);
+// Copies the contents into a malloc'd NUL terminated string
+extern char *string_to_str(Value string);
+
+// Maps the contents of strings to the index they were added under, for numbering constants.
+// Lookups take a literal's span, so a literal seen before is neither decoded nor copied again.
+typedef struct InternTable {
+    StringObject **strings; // Open addressing, NULL marks a free slot
+    int *indices;
+    size_t count;
+    size_t capacity;
+} InternTable;
+
+extern InternTable *make_intern_table(void);
+// Leaves the strings themselves alone
+extern void cleanup_intern_table(InternTable *table);
+// Returns the index of the string equal to the decoded literal, or -1 if there is none
+extern int find_interned_literal(InternTable *table, StringSpan literal);
+// `string` must live as long as the table
+extern void add_interned_string(InternTable *table, StringObject *string, int index);
+
+#endif // STRING_OBJECT_H
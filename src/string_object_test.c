@@ -0,0 +1,178 @@
+#include "allocator.h"
+#include "object.h"
+#include "string_object.h"
+#include "test_utils.h"
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+static Arena *arena;
+
+static Allocator *test_allocator(void)
+{
+    if (arena == NULL) {
+        arena = make_arena(DEFAULT_ARENA_BLOCK_SIZE);
+    }
+    return &arena->allocator;
+}
+
+static StringSpan span_of(const char *raw)
+{
+    return (StringSpan) { .start = raw, .length = (uint32_t)strlen(raw), .escaped = strchr(raw, '\\') != NULL };
+}
+
+TEST_CASE(literals_decode_escapes)
+{
+    struct {
+        const char *raw;
+        const char *decoded;
+    } tests[] = {
+        { "", "" },
+        { "plain", "plain" },
+        { "\\n", "\n" },
+        { "tab\\there", "tab\there" },
+        { "\\\"quoted\\\"", "\"quoted\"" },
+        { "back\\\\slash\\r\\n", "back\\slash\r\n" },
+        { "\\\\n", "\\n" },
+    };
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        StringSpan literal = span_of(tests[i].raw);
+        StringObject *string = AS_STRING(string_from_literal(literal, test_allocator()));
+        if (string->length != strlen(tests[i].decoded) || strcmp(string->chars, tests[i].decoded) != 0) {
+            printf("Input: %s\nExpected: %s\nGot: %s\n", tests[i].raw, tests[i].decoded, string->chars);
+            assert(1 != 1);
+        }
+        assert(literal_length(literal) == string->length);
+    }
+}
+
+static Value chars(const char *chars)
+{
+    return string_from_chars(chars, strlen(chars), test_allocator());
+}
+
+static void assert_contents(Value string, const char *expected)
+{
+    char *result = string_to_str(string);
+    if (string_length(string) != strlen(expected) || strcmp(result, expected) != 0) {
+        printf("Expected: %s\nGot: %s\n", expected, result);
+        assert(1 != 1);
+    }
+    free(result);
+}
+
+TEST_CASE(concatenation_and_equality)
+{
+    Value joined = string_concat(chars("mon"), chars("key"), test_allocator());
+    assert(IS_FLAT_STRING(joined));
+    assert(AS_STRING(joined)->length == 6 && strcmp(AS_STRING(joined)->chars, "monkey") == 0);
+
+    Value same = chars("monkey");
+    Value other = chars("monkez");
+    assert(strings_equal(joined, same));
+    assert(!strings_equal(joined, other));
+    assert(string_hash(joined) == string_hash(same));
+    assert(string_hash(joined) != 0);
+    // Comparing hashed and unhashed strings
+    assert(!strings_equal(other, joined));
+    assert(strings_equal(chars(""), chars("")));
+    // Empty operands are not copied
+    assert(AS_OBJ(string_concat(chars(""), same, test_allocator())) == AS_OBJ(same));
+    assert(AS_OBJ(string_concat(same, chars(""), test_allocator())) == AS_OBJ(same));
+}
+
+TEST_CASE(ropes)
+{
+    // Appending to a long string builds a rope, and further short appends merge into its last leaf
+    char *expected = malloc(100000 + 1);
+    for (int i = 0; i < 100000; i++) {
+        expected[i] = (char)('a' + i % 26);
+    }
+    expected[100000] = '\0';
+    Value string = chars("");
+    for (int i = 0; i < 100000; i += 2) {
+        char piece[] = { expected[i], expected[i + 1], '\0' };
+        string = string_concat(string, chars(piece), test_allocator());
+    }
+    assert(IS_ROPE(string));
+    assert(AS_ROPE(string)->right->type == OBJ_STRING);
+    assert(((StringObject *)AS_ROPE(string)->right)->length < ROPE_LEAF_LENGTH);
+    assert_contents(string, expected);
+
+    // Built another way round, the pieces end at other offsets
+    Value prepended = chars("");
+    for (int i = 100000; i > 0; i -= 5000) {
+        prepended = string_concat(string_from_chars(expected + i - 5000, 5000, test_allocator()), prepended, test_allocator());
+    }
+    Value flat = chars(expected);
+    assert(strings_equal(string, prepended) && strings_equal(prepended, string));
+    assert(strings_equal(string, flat) && strings_equal(flat, string));
+    assert(string_hash(string) == string_hash(flat));
+    assert(string_hash(prepended) == string_hash(flat));
+    char last = expected[99999];
+    expected[99999] = '!';
+    Value different = chars(expected);
+    assert(!strings_equal(string, different) && !strings_equal(different, prepended));
+    expected[99999] = last;
+
+    // Flattening keeps the contents and the hash, and happens once
+    StringObject *flattened = string_flatten(string, test_allocator());
+    assert(flattened->length == 100000 && memcmp(flattened->chars, expected, 100000) == 0);
+    assert(flattened->hash == string_hash(flat));
+    assert(string_flatten(string, NULL) == flattened);
+    assert(AS_ROPE(string)->right == NULL);
+    assert_contents(string, expected);
+    assert(strings_equal(string, prepended));
+
+    // Appending to a flattened rope starts from its flat copy
+    Value longer = string_concat(string, chars("!"), test_allocator());
+    assert(IS_ROPE(longer) && AS_ROPE(longer)->left == (Object *)flattened);
+    free(expected);
+}
+
+TEST_CASE(char_strings_are_shared)
+{
+    Value a = char_string('a');
+    assert(AS_OBJ(a) == AS_OBJ(char_string('a')));
+    assert_contents(a, "a");
+    assert(strings_equal(a, chars("a")));
+    assert(AS_STRING(char_string('\xff'))->chars[0] == '\xff');
+    assert(AS_OBJ(a)->marked);
+}
+
+TEST_CASE(intern_table_finds_decoded_literals)
+{
+    InternTable *table = make_intern_table();
+    assert(find_interned_literal(table, span_of("a\\nb")) == -1);
+
+    StringObject *string = AS_STRING(string_from_literal(span_of("a\\nb"), test_allocator()));
+    add_interned_string(table, string, 7);
+    assert(find_interned_literal(table, span_of("a\\nb")) == 7);
+    // Another spelling of the same contents, and contents only equal before decoding
+    char raw_newline[] = { 'a', '\n', 'b', '\0' };
+    assert(find_interned_literal(table, span_of(raw_newline)) == 7);
+    assert(find_interned_literal(table, span_of("a\\\\nb")) == -1);
+    assert(find_interned_literal(table, span_of("a\\n")) == -1);
+
+    // Enough strings to grow the table several times
+    char buffer[32];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(buffer, sizeof(buffer), "s%d", i);
+        add_interned_string(table, AS_STRING(string_from_chars(buffer, strlen(buffer), test_allocator())), i);
+    }
+    for (int i = 0; i < 1000; i++) {
+        snprintf(buffer, sizeof(buffer), "s%d", i);
+        assert(find_interned_literal(table, span_of(buffer)) == i);
+    }
+    assert(find_interned_literal(table, span_of("a\\nb")) == 7);
+    assert(find_interned_literal(table, span_of("s1000")) == -1);
+    assert(table->count == 1001);
+
+    cleanup_intern_table(table);
+}
+
+RUN_TESTS()
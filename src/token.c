@@ -8,6 +8,8 @@ static const char *TOKEN_TYPE_STR[] = {
 
     [TOKEN_IDENT] = "IDENT",
     [TOKEN_INT] = "INT",
+    [TOKEN_FLOAT] = "FLOAT",
+    [TOKEN_STRING] = "STRING",
 
     // Operators
     [TOKEN_ASSIGN] = "=",
@@ -29,6 +31,9 @@ static const char *TOKEN_TYPE_STR[] = {
     [TOKEN_RPAREN] = ")",
     [TOKEN_LBRACE] = "{",
     [TOKEN_RBRACE] = "}",
+    [TOKEN_LBRACKET] = "[",
+    [TOKEN_RBRACKET] = "]",
+    [TOKEN_COLON] = ":",
 
     // Keywords
     [TOKEN_FUNCTION] = "FUNCTION",
@@ -38,10 +43,13 @@ static const char *TOKEN_TYPE_STR[] = {
     [TOKEN_IF] = "IF",
     [TOKEN_ELSE] = "ELSE",
     [TOKEN_RETURN] = "RETURN",
+    [TOKEN_WHILE] = "WHILE",
+    [TOKEN_BREAK] = "BREAK",
+    [TOKEN_CONTINUE] = "CONTINUE",
 };
 
 const char *token_type_to_str(TokenType t)
 {
-    assert(t >= 0 && t <= TOKEN_RETURN);
+    assert(t >= 0 && t <= TOKEN_CONTINUE);
     return TOKEN_TYPE_STR[t];
 }
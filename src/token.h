@@ -4,6 +4,11 @@
 #define MAX_IDENTIFIER_SIZE 20
 #define MAX_INT_SIZE 20
 #define MAX_TOKEN_LITERAL_SIZE 20
+// Characters that may follow a backslash in a string literal, as in "\t\"quoted\"\n"
+#define STRING_ESCAPES "ntr\"\\"
+
+#include "globals.h"
+#include <stdint.h>
 
 typedef enum TokenType {
     TOKEN_ILLEGAL,
@@ -12,6 +17,8 @@ typedef enum TokenType {
     // Identifiers + literals
     TOKEN_IDENT,
     TOKEN_INT,
+    TOKEN_FLOAT,
+    TOKEN_STRING,
 
     // Operators
     TOKEN_ASSIGN,
@@ -33,6 +40,9 @@ typedef enum TokenType {
     TOKEN_RPAREN,
     TOKEN_LBRACE,
     TOKEN_RBRACE,
+    TOKEN_LBRACKET,
+    TOKEN_RBRACKET,
+    TOKEN_COLON,
 
     // Keywords
     TOKEN_FUNCTION,
@@ -42,11 +52,24 @@ typedef enum TokenType {
     TOKEN_IF,
     TOKEN_ELSE,
     TOKEN_RETURN,
+    TOKEN_WHILE,
+    TOKEN_BREAK,
+    TOKEN_CONTINUE,
 } TokenType;
 
+// The characters between the quotes of a string literal, left in the source. Escape sequences
+// are only decoded once the literal is turned into a value, and only if there are any. Float
+// literals keep their whole text here too, since it may not fit in the token literal.
+typedef struct StringSpan {
+    const char *start;
+    uint32_t length;
+    bool escaped; // Holds at least one backslash escape
+} StringSpan;
+
 typedef struct Token {
     TokenType type;
-    char literal[MAX_TOKEN_LITERAL_SIZE];
+    char literal[MAX_TOKEN_LITERAL_SIZE]; // For strings only as much of the span as fits
+    StringSpan string; // TOKEN_STRING and TOKEN_FLOAT only
 } Token;
 
 extern const char *token_type_to_str(TokenType t);
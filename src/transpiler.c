@@ -0,0 +1,692 @@
+#include "transpiler.h"
+#include "ast.h"
+#include "resolver.h"
+#include "str_utils.h"
+#include "string_object.h"
+#include <assert.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INDENT_WIDTH 4
+#define MAX_ARGUMENTS 255
+#define MAX_LITERAL_ELEMENTS 65535
+
+struct TranspileScope {
+    String *body;
+    bool *captured; // Per local slot: an inner function closes over it, so it lives in a cell
+    int next_temp;
+    int indent;
+    bool top_level;
+    TranspileScope *enclosing;
+};
+
+static int transpile_expression(Transpiler *transpiler, ASTNode *node);
+static void transpile_statement(Transpiler *transpiler, ASTNode *node);
+static void transpile_tail_expression(Transpiler *transpiler, ASTNode *node);
+
+static void report_transpiler_error(Transpiler *transpiler, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t total_len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    char *error = allocate(transpiler->errors->allocator, total_len + 1); // We add one for sentinel character '\0'
+    va_start(args, format);
+    vsprintf(error, format, args);
+    va_end(args);
+
+    add_error_to_arraylist(transpiler->errors, error);
+}
+
+Transpiler *make_transpiler(void)
+{
+    Transpiler *transpiler = malloc(sizeof(Transpiler));
+    transpiler->resolver = make_resolver();
+    transpiler->functions = NULL;
+    transpiler->prototypes = NULL;
+    transpiler->num_functions = 0;
+    transpiler->strings = NULL;
+    transpiler->string_setup = NULL;
+    transpiler->scope = NULL;
+    transpiler->errors = transpiler->resolver->errors;
+    return transpiler;
+}
+
+void cleanup_transpiler(Transpiler *transpiler)
+{
+    cleanup_resolver(transpiler->resolver);
+    free(transpiler);
+}
+
+static void vappend(String *target, const char *format, va_list args)
+{
+    va_list copy;
+    va_copy(copy, args);
+    size_t total_len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    char *text = malloc(total_len + 1);
+    vsprintf(text, format, args);
+    copy_str_into_string(target, text);
+    free(text);
+}
+
+static void append(String *target, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    vappend(target, format, args);
+    va_end(args);
+}
+
+// Appends one indented line to the body of the function being generated
+static void emit(Transpiler *transpiler, const char *format, ...)
+{
+    TranspileScope *scope = transpiler->scope;
+    append(scope->body, "%*s", scope->indent * INDENT_WIDTH, "");
+    va_list args;
+    va_start(args, format);
+    vappend(scope->body, format, args);
+    va_end(args);
+    copy_str_into_string(scope->body, "\n");
+}
+
+static int new_temp(Transpiler *transpiler)
+{
+    return transpiler->scope->next_temp++;
+}
+
+// Index into the program's `strings` of the literal's value. Equal literals share an entry, whose
+// contents are written out as a C string literal set up when the program starts.
+static int string_index(Transpiler *transpiler, StringSpan literal)
+{
+    int index = find_interned_literal(transpiler->strings, literal);
+    if (index != -1) {
+        return index;
+    }
+    StringObject *string = AS_STRING(string_from_literal(literal, &libc_allocator));
+    index = (int)transpiler->strings->count;
+    add_interned_string(transpiler->strings, string, index);
+
+    append(transpiler->string_setup, "%*sstrings[%d] = aot_string(\"", INDENT_WIDTH, "", index);
+    for (uint32_t i = 0; i < string->length; i++) {
+        unsigned char c = (unsigned char)string->chars[i];
+        if (c == '"' || c == '\\') {
+            append(transpiler->string_setup, "\\%c", c);
+        } else if (c == '\n') {
+            copy_str_into_string(transpiler->string_setup, "\\n");
+        } else if (c < ' ' || c > '~') {
+            append(transpiler->string_setup, "\\%03o", c);
+        } else {
+            append(transpiler->string_setup, "%c", c);
+        }
+    }
+    append(transpiler->string_setup, "\", %" PRIu32 ");\n", string->length);
+    return index;
+}
+
+// Marks the slots of the current function that the functions defined directly inside it capture
+static void find_captured_slots(ASTNode *node, bool *captured)
+{
+    if (node == NULL) {
+        return;
+    }
+
+    switch (node->type) {
+    case NODE_LET_STMT:
+        find_captured_slots(node->data.let_stmt.right, captured);
+        break;
+    case NODE_RETURN_STMT:
+        find_captured_slots(node->data.return_stmt, captured);
+        break;
+    case NODE_EXPR_STMT:
+        find_captured_slots(node->data.expr_stmt, captured);
+        break;
+    case NODE_PREFIX_EXPR:
+        find_captured_slots(node->data.prefix_expr.right, captured);
+        break;
+    case NODE_INFIX_EXPR:
+        find_captured_slots(node->data.infix_expr.left, captured);
+        find_captured_slots(node->data.infix_expr.right, captured);
+        break;
+    case NODE_BLOCK_STMT:
+        for (size_t i = 0; i < node->data.block_stmt->size; i++) {
+            find_captured_slots(node->data.block_stmt->array[i], captured);
+        }
+        break;
+    case NODE_IF_EXPR:
+        find_captured_slots(node->data.if_expr.condition, captured);
+        find_captured_slots(node->data.if_expr.consequence, captured);
+        find_captured_slots(node->data.if_expr.alternative, captured);
+        break;
+    case NODE_FUNCTION_LITERAL:
+        // Anything deeper is threaded through this function's own upvalues
+        for (size_t i = 0; i < node->data.function_literal.num_upvalues; i++) {
+            if (node->data.function_literal.upvalues[i].is_local) {
+                captured[node->data.function_literal.upvalues[i].index] = TRUE;
+            }
+        }
+        break;
+    case NODE_CALL_EXPR:
+        find_captured_slots(node->data.call_expr.function, captured);
+        for (size_t i = 0; i < node->data.call_expr.arguments->size; i++) {
+            find_captured_slots(node->data.call_expr.arguments->array[i], captured);
+        }
+        break;
+    case NODE_WHILE_STMT:
+        find_captured_slots(node->data.while_stmt.condition, captured);
+        find_captured_slots(node->data.while_stmt.body, captured);
+        break;
+    case NODE_ARRAY_LITERAL:
+        for (size_t i = 0; i < node->data.array_literal->size; i++) {
+            find_captured_slots(node->data.array_literal->array[i], captured);
+        }
+        break;
+    case NODE_HASH_LITERAL:
+        for (size_t i = 0; i < node->data.hash_literal.keys->size; i++) {
+            find_captured_slots(node->data.hash_literal.keys->array[i], captured);
+            find_captured_slots(node->data.hash_literal.values->array[i], captured);
+        }
+        break;
+    case NODE_INDEX_EXPR:
+        find_captured_slots(node->data.index_expr.left, captured);
+        find_captured_slots(node->data.index_expr.index, captured);
+        break;
+    default:
+        break;
+    }
+}
+
+// Writes the C lvalue of a resolved variable into `buffer`, builtins are plain values
+static bool variable_reference(Transpiler *transpiler, ASTNode *identifier, char *buffer, size_t size)
+{
+    Resolution *resolution = &identifier->data.identifier.resolution;
+    switch (resolution->scope) {
+    case SCOPE_GLOBAL:
+        snprintf(buffer, size, "globals[%d]", resolution->index);
+        return TRUE;
+    case SCOPE_LOCAL:
+        if (transpiler->scope->captured[resolution->index]) {
+            snprintf(buffer, size, "*c%d", resolution->index);
+        } else {
+            snprintf(buffer, size, "l%d", resolution->index);
+        }
+        return TRUE;
+    case SCOPE_UPVALUE:
+        snprintf(buffer, size, "*self->upvalues[%d]", resolution->index);
+        return TRUE;
+    case SCOPE_BUILTIN:
+        snprintf(buffer, size, "OBJ_VAL(&builtins[%d])", resolution->index);
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// Evaluates a block whose value is used, e.g. the branches of an if expression. Like the
+// compiler, only a trailing expression statement gives the block a value, otherwise it is null.
+static int transpile_block_value(Transpiler *transpiler, ASTNode *block)
+{
+    ASTNodePtrArrayList *statements = block->data.block_stmt;
+    for (size_t i = 0; i + 1 < statements->size; i++) {
+        transpile_statement(transpiler, statements->array[i]);
+    }
+
+    ASTNode *last = statements->size > 0 ? statements->array[statements->size - 1] : NULL;
+    if (last != NULL && last->type == NODE_EXPR_STMT) {
+        return transpile_expression(transpiler, last->data.expr_stmt);
+    }
+    if (last != NULL) {
+        transpile_statement(transpiler, last);
+    }
+    int temp = new_temp(transpiler);
+    emit(transpiler, "Value t%d = NULL_VAL;", temp);
+    return temp;
+}
+
+// Emits a block whose value the current function returns
+static void transpile_tail_block(Transpiler *transpiler, ASTNode *block)
+{
+    ASTNodePtrArrayList *statements = block->data.block_stmt;
+    for (size_t i = 0; i + 1 < statements->size; i++) {
+        transpile_statement(transpiler, statements->array[i]);
+    }
+
+    ASTNode *last = statements->size > 0 ? statements->array[statements->size - 1] : NULL;
+    if (last != NULL && last->type == NODE_EXPR_STMT) {
+        transpile_tail_expression(transpiler, last->data.expr_stmt);
+        return;
+    }
+    if (last != NULL) {
+        transpile_statement(transpiler, last);
+    }
+    emit(transpiler, "return NULL_VAL;");
+}
+
+static int transpile_function_literal(Transpiler *transpiler, ASTNode *node, const char *name)
+{
+    FunctionLiteral *literal = &node->data.function_literal;
+    if (literal->body == NULL) {
+        // The whole program is translated up front, there is no later to compile it in
+        report_transpiler_error(transpiler, "Function bodies must be parsed eagerly to be transpiled");
+        return new_temp(transpiler);
+    }
+    int id = transpiler->num_functions++;
+
+    TranspileScope scope = {
+        .body = make_string(NULL),
+        .captured = calloc(literal->num_locals + 1, sizeof(bool)),
+        .indent = 1,
+        .enclosing = transpiler->scope,
+    };
+    find_captured_slots(literal->body, scope.captured);
+    transpiler->scope = &scope;
+
+    emit(transpiler, "(void)self;");
+    emit(transpiler, "(void)args;");
+    for (size_t i = 0; i < literal->num_locals; i++) {
+        const char *initial = "NULL_VAL";
+        char parameter[32];
+        if (i < literal->parameters->size) {
+            snprintf(parameter, sizeof(parameter), "args[%zu]", i);
+            initial = parameter;
+        }
+        if (scope.captured[i]) {
+            emit(transpiler, "Value *c%zu = aot_cell(%s);", i, initial);
+        } else {
+            emit(transpiler, "Value l%zu = %s;", i, initial);
+        }
+    }
+    transpile_tail_block(transpiler, literal->body);
+
+    transpiler->scope = scope.enclosing;
+    append(transpiler->prototypes, "static Value fn_%d(AotClosure *self, Value *args);\n", id);
+    append(transpiler->functions, "\n// fn %s\nstatic Value fn_%d(AotClosure *self, Value *args)\n{\n", name, id);
+    concat_strings(transpiler->functions, scope.body);
+    copy_str_into_string(transpiler->functions, "}\n");
+    free(scope.captured);
+
+    int closure = new_temp(transpiler);
+    emit(transpiler, "AotClosure *k%d = aot_closure(fn_%d, \"%s\", %zu, %zu);", closure, id, name, literal->parameters->size, literal->num_upvalues);
+    for (size_t i = 0; i < literal->num_upvalues; i++) {
+        if (literal->upvalues[i].is_local) {
+            emit(transpiler, "k%d->upvalues[%zu] = c%d;", closure, i, literal->upvalues[i].index);
+        } else {
+            emit(transpiler, "k%d->upvalues[%zu] = self->upvalues[%d];", closure, i, literal->upvalues[i].index);
+        }
+    }
+    emit(transpiler, "Value t%d = OBJ_VAL(k%d);", closure, closure);
+    return closure;
+}
+
+static int transpile_prefix_expression(Transpiler *transpiler, ASTNode *node)
+{
+    int right = transpile_expression(transpiler, node->data.prefix_expr.right);
+    int temp = new_temp(transpiler);
+
+    switch (node->data.prefix_expr.token.type) {
+    case TOKEN_BANG:
+        emit(transpiler, "Value t%d = BOOL_VAL(!aot_truthy(t%d));", temp, right);
+        break;
+    case TOKEN_MINUS:
+        emit(transpiler, "Value t%d = aot_neg(t%d);", temp, right);
+        break;
+    default:
+        report_transpiler_error(transpiler, "Unknown operator: %s", node->data.prefix_expr.operator);
+    }
+    return temp;
+}
+
+static int transpile_infix_expression(Transpiler *transpiler, ASTNode *node)
+{
+    // Operands are evaluated in the same order as in the VM, which has `a < b` as `b > a`
+    if (node->data.infix_expr.token.type == TOKEN_LT) {
+        int right = transpile_expression(transpiler, node->data.infix_expr.right);
+        int left = transpile_expression(transpiler, node->data.infix_expr.left);
+        int temp = new_temp(transpiler);
+        emit(transpiler, "Value t%d = aot_greater(t%d, t%d);", temp, right, left);
+        return temp;
+    }
+
+    int left = transpile_expression(transpiler, node->data.infix_expr.left);
+    int right = transpile_expression(transpiler, node->data.infix_expr.right);
+    int temp = new_temp(transpiler);
+
+    switch (node->data.infix_expr.token.type) {
+    case TOKEN_PLUS:
+        emit(transpiler, "Value t%d = aot_add(t%d, t%d);", temp, left, right);
+        break;
+    case TOKEN_MINUS:
+        emit(transpiler, "Value t%d = aot_sub(t%d, t%d);", temp, left, right);
+        break;
+    case TOKEN_ASTERISK:
+        emit(transpiler, "Value t%d = aot_mul(t%d, t%d);", temp, left, right);
+        break;
+    case TOKEN_SLASH:
+        emit(transpiler, "Value t%d = aot_div(t%d, t%d);", temp, left, right);
+        break;
+    case TOKEN_GT:
+        emit(transpiler, "Value t%d = aot_greater(t%d, t%d);", temp, left, right);
+        break;
+    case TOKEN_EQ:
+        emit(transpiler, "Value t%d = BOOL_VAL(aot_equal(t%d, t%d));", temp, left, right);
+        break;
+    case TOKEN_NOT_EQ:
+        emit(transpiler, "Value t%d = BOOL_VAL(!aot_equal(t%d, t%d));", temp, left, right);
+        break;
+    default:
+        report_transpiler_error(transpiler, "Unknown operator: %s", node->data.infix_expr.operator);
+    }
+    return temp;
+}
+
+static int transpile_if_expression(Transpiler *transpiler, ASTNode *node)
+{
+    int condition = transpile_expression(transpiler, node->data.if_expr.condition);
+    int temp = new_temp(transpiler);
+    emit(transpiler, "Value t%d;", temp);
+
+    emit(transpiler, "if (aot_truthy(t%d)) {", condition);
+    transpiler->scope->indent++;
+    emit(transpiler, "t%d = t%d;", temp, transpile_block_value(transpiler, node->data.if_expr.consequence));
+    transpiler->scope->indent--;
+    emit(transpiler, "} else {");
+    transpiler->scope->indent++;
+    if (node->data.if_expr.alternative == NULL) {
+        emit(transpiler, "t%d = NULL_VAL;", temp);
+    } else {
+        emit(transpiler, "t%d = t%d;", temp, transpile_block_value(transpiler, node->data.if_expr.alternative));
+    }
+    transpiler->scope->indent--;
+    emit(transpiler, "}");
+    return temp;
+}
+
+// Emits `Value a<temp>[] = { ... };` holding the given temporaries
+static void emit_value_array(Transpiler *transpiler, int temp, const int *values, size_t count)
+{
+    String *list = make_string(NULL);
+    for (size_t i = 0; i < count; i++) {
+        append(list, i == 0 ? "t%d" : ", t%d", values[i]);
+    }
+    emit(transpiler, "Value a%d[] = { %s };", temp, list->array);
+    cleanup_string(list);
+}
+
+// Emits a call, or in tail position returns it to the caller's aot_call to make
+static int transpile_call_expression(Transpiler *transpiler, ASTNode *node, bool tail)
+{
+    ASTNodePtrArrayList *arguments = node->data.call_expr.arguments;
+    if (arguments->size > MAX_ARGUMENTS) {
+        report_transpiler_error(transpiler, "Too many arguments in call, at most %d are allowed", MAX_ARGUMENTS);
+        return new_temp(transpiler);
+    }
+
+    const char *call = tail ? "aot_tail_call" : "aot_call";
+    int callee = transpile_expression(transpiler, node->data.call_expr.function);
+    int *values = malloc((arguments->size + 1) * sizeof(int));
+    for (size_t i = 0; i < arguments->size; i++) {
+        values[i] = transpile_expression(transpiler, arguments->array[i]);
+    }
+
+    int temp = new_temp(transpiler);
+    if (arguments->size == 0) {
+        emit(transpiler, "Value t%d = %s(t%d, 0, NULL);", temp, call, callee);
+    } else {
+        emit_value_array(transpiler, temp, values, arguments->size);
+        emit(transpiler, "Value t%d = %s(t%d, %zu, a%d);", temp, call, callee, arguments->size, temp);
+    }
+    free(values);
+    return temp;
+}
+
+static int transpile_array_literal(Transpiler *transpiler, ASTNode *node)
+{
+    ASTNodePtrArrayList *elements = node->data.array_literal;
+    if (elements->size > MAX_LITERAL_ELEMENTS) {
+        report_transpiler_error(transpiler, "Too many elements in array literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return new_temp(transpiler);
+    }
+
+    int *values = malloc((elements->size + 1) * sizeof(int));
+    for (size_t i = 0; i < elements->size; i++) {
+        values[i] = transpile_expression(transpiler, elements->array[i]);
+    }
+    int temp = new_temp(transpiler);
+    if (elements->size == 0) {
+        emit(transpiler, "Value t%d = aot_array(NULL, 0);", temp);
+    } else {
+        emit_value_array(transpiler, temp, values, elements->size);
+        emit(transpiler, "Value t%d = aot_array(a%d, %zu);", temp, temp, elements->size);
+    }
+    free(values);
+    return temp;
+}
+
+static int transpile_hash_literal(Transpiler *transpiler, ASTNode *node)
+{
+    HashLiteral *literal = &node->data.hash_literal;
+    if (literal->keys->size > MAX_LITERAL_ELEMENTS) {
+        report_transpiler_error(transpiler, "Too many pairs in hash literal, at most %d are allowed", MAX_LITERAL_ELEMENTS);
+        return new_temp(transpiler);
+    }
+
+    int *values = malloc((2 * literal->keys->size + 1) * sizeof(int));
+    for (size_t i = 0; i < literal->keys->size; i++) {
+        values[2 * i] = transpile_expression(transpiler, literal->keys->array[i]);
+        values[2 * i + 1] = transpile_expression(transpiler, literal->values->array[i]);
+    }
+    int temp = new_temp(transpiler);
+    if (literal->keys->size == 0) {
+        emit(transpiler, "Value t%d = aot_hash(NULL, 0);", temp);
+    } else {
+        emit_value_array(transpiler, temp, values, 2 * literal->keys->size);
+        emit(transpiler, "Value t%d = aot_hash(a%d, %zu);", temp, temp, literal->keys->size);
+    }
+    free(values);
+    return temp;
+}
+
+// Emits the code computing `node` into a fresh temporary and returns its number
+static int transpile_expression(Transpiler *transpiler, ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_PREFIX_EXPR:
+        return transpile_prefix_expression(transpiler, node);
+    case NODE_INFIX_EXPR:
+        return transpile_infix_expression(transpiler, node);
+    case NODE_IF_EXPR:
+        return transpile_if_expression(transpiler, node);
+    case NODE_FUNCTION_LITERAL:
+        return transpile_function_literal(transpiler, node, "");
+    case NODE_CALL_EXPR:
+        return transpile_call_expression(transpiler, node, FALSE);
+    case NODE_ARRAY_LITERAL:
+        return transpile_array_literal(transpiler, node);
+    case NODE_HASH_LITERAL:
+        return transpile_hash_literal(transpiler, node);
+    case NODE_INDEX_EXPR: {
+        int left = transpile_expression(transpiler, node->data.index_expr.left);
+        int index = transpile_expression(transpiler, node->data.index_expr.index);
+        int temp = new_temp(transpiler);
+        emit(transpiler, "Value t%d = aot_index(t%d, t%d);", temp, left, index);
+        return temp;
+    }
+    default:
+        break;
+    }
+
+    int temp = new_temp(transpiler);
+    if (node->type == NODE_LITERAL && node->data.literal.type == LITERAL_INT) {
+        emit(transpiler, "Value t%d = INT_VAL(INT64_C(%" PRId64 "));", temp, node->data.literal.value.int_value);
+    } else if (node->type == NODE_LITERAL && node->data.literal.type == LITERAL_FLOAT) {
+        // Hexadecimal, so the C compiler reads back exactly the same double
+        emit(transpiler, "Value t%d = FLOAT_VAL(%a);", temp, node->data.literal.value.float_value);
+    } else if (node->type == NODE_LITERAL && node->data.literal.type == LITERAL_BOOL) {
+        emit(transpiler, "Value t%d = BOOL_VAL(%s);", temp, node->data.literal.value.boolean_value ? "TRUE" : "FALSE");
+    } else if (node->type == NODE_LITERAL && node->data.literal.type == LITERAL_STRING) {
+        emit(transpiler, "Value t%d = strings[%d];", temp, string_index(transpiler, node->data.literal.value.string_value));
+    } else if (node->type == NODE_LITERAL) {
+        report_transpiler_error(transpiler, "Unsupported literal: %s", node->token_literal);
+    } else if (node->type == NODE_IDENTIFIER) {
+        char reference[64];
+        if (variable_reference(transpiler, node, reference, sizeof(reference))) {
+            emit(transpiler, "Value t%d = %s;", temp, reference);
+        } else {
+            report_transpiler_error(transpiler, "Unresolved identifier: %s", node->data.identifier.literal.value.identifier);
+        }
+    } else {
+        report_transpiler_error(transpiler, "Cannot transpile node of type %s", node_type_to_str(node->type));
+    }
+    return temp;
+}
+
+// Emits code returning the value of `node` from the current function. Like the VM, calls there
+// are tail calls and if expressions pass the tail position on to their branches.
+static void transpile_tail_expression(Transpiler *transpiler, ASTNode *node)
+{
+    if (node->type == NODE_CALL_EXPR) {
+        emit(transpiler, "return t%d;", transpile_call_expression(transpiler, node, TRUE));
+    } else if (node->type == NODE_IF_EXPR) {
+        int condition = transpile_expression(transpiler, node->data.if_expr.condition);
+        emit(transpiler, "if (aot_truthy(t%d)) {", condition);
+        transpiler->scope->indent++;
+        transpile_tail_block(transpiler, node->data.if_expr.consequence);
+        transpiler->scope->indent--;
+        emit(transpiler, "}");
+        if (node->data.if_expr.alternative == NULL) {
+            emit(transpiler, "return NULL_VAL;");
+        } else {
+            transpile_tail_block(transpiler, node->data.if_expr.alternative);
+        }
+    } else {
+        emit(transpiler, "return t%d;", transpile_expression(transpiler, node));
+    }
+}
+
+static void transpile_statement(Transpiler *transpiler, ASTNode *node)
+{
+    switch (node->type) {
+    case NODE_LET_STMT: {
+        ASTNode *identifier = node->data.let_stmt.left;
+        ASTNode *value = node->data.let_stmt.right;
+        const char *name = identifier->data.identifier.literal.value.identifier;
+        int temp = value->type == NODE_FUNCTION_LITERAL
+            ? transpile_function_literal(transpiler, value, name)
+            : transpile_expression(transpiler, value);
+
+        char reference[64];
+        if (identifier->data.identifier.resolution.scope != SCOPE_UPVALUE && variable_reference(transpiler, identifier, reference, sizeof(reference))) {
+            emit(transpiler, "%s = t%d;", reference, temp);
+        } else {
+            report_transpiler_error(transpiler, "Unresolved let binding: %s", name);
+        }
+        break;
+    }
+    case NODE_RETURN_STMT:
+        if (transpiler->scope->top_level) {
+            // Returning from the top-level code ends the program
+            emit(transpiler, "aot_last = t%d;", transpile_expression(transpiler, node->data.return_stmt));
+            emit(transpiler, "return;");
+        } else {
+            transpile_tail_expression(transpiler, node->data.return_stmt);
+        }
+        break;
+    case NODE_EXPR_STMT:
+        emit(transpiler, "aot_last = t%d;", transpile_expression(transpiler, node->data.expr_stmt));
+        break;
+    case NODE_BLOCK_STMT:
+        for (size_t i = 0; i < node->data.block_stmt->size; i++) {
+            transpile_statement(transpiler, node->data.block_stmt->array[i]);
+        }
+        break;
+    case NODE_WHILE_STMT:
+        // The condition is computed into temporaries, so it is evaluated inside the loop
+        emit(transpiler, "for (;;) {");
+        transpiler->scope->indent++;
+        emit(transpiler, "if (!aot_truthy(t%d)) {", transpile_expression(transpiler, node->data.while_stmt.condition));
+        emit(transpiler, "%*sbreak;", INDENT_WIDTH, "");
+        emit(transpiler, "}");
+        transpile_statement(transpiler, node->data.while_stmt.body);
+        transpiler->scope->indent--;
+        emit(transpiler, "}");
+        break;
+    case NODE_BREAK_STMT:
+    case NODE_CONTINUE_STMT:
+        // If expressions become C if statements, so the innermost C loop is the Monkey loop
+        emit(transpiler, "%s;", node->token_literal);
+        break;
+    default:
+        transpile_expression(transpiler, node);
+    }
+}
+
+// Returns the generated C source, to be freed by the caller, or NULL if resolution or
+// transpilation failed
+char *transpile_program(Transpiler *transpiler, Program *program)
+{
+    size_t errors_before = transpiler->errors->size;
+
+    if (!resolve_program(transpiler->resolver, program)) {
+        return NULL;
+    }
+
+    transpiler->functions = make_string(NULL);
+    transpiler->prototypes = make_string(NULL);
+    transpiler->num_functions = 0;
+    transpiler->strings = make_intern_table();
+    transpiler->string_setup = make_string(NULL);
+
+    bool no_locals = FALSE;
+    TranspileScope scope = {
+        .body = make_string(NULL),
+        .captured = &no_locals,
+        .indent = 1,
+        .top_level = TRUE,
+    };
+    transpiler->scope = &scope;
+    for (size_t i = 0; i < program->size; i++) {
+        transpile_statement(transpiler, program->array[i]);
+    }
+    transpiler->scope = NULL;
+
+    char *source = NULL;
+    if (transpiler->errors->size == errors_before) {
+        size_t num_globals = get_global_count(transpiler->resolver);
+        String *output = make_string(NULL);
+        copy_str_into_string(output, "// Generated by the Monkey transpiler, build against src/aot_runtime.h\n");
+        copy_str_into_string(output, "#include \"aot_runtime.h\"\n\n");
+        concat_strings(output, transpiler->prototypes);
+        append(output, "\nstatic Value globals[%zu];\n", num_globals > 0 ? num_globals : 1);
+        if (transpiler->strings->count > 0) {
+            append(output, "static Value strings[%zu];\n", transpiler->strings->count);
+        }
+        concat_strings(output, transpiler->functions);
+        copy_str_into_string(output, "\nstatic void aot_program(void)\n{\n");
+        concat_strings(output, transpiler->string_setup);
+        concat_strings(output, scope.body);
+        copy_str_into_string(output, "}\n");
+        source = get_str_from_string(output);
+        cleanup_string(output);
+    } else {
+        cleanup_string(transpiler->prototypes);
+        cleanup_string(transpiler->functions);
+        cleanup_string(scope.body);
+        cleanup_string(transpiler->string_setup);
+    }
+    for (size_t i = 0; i < transpiler->strings->capacity; i++) {
+        if (transpiler->strings->strings[i] != NULL) {
+            deallocate(&libc_allocator, transpiler->strings->strings[i], STRING_SIZE(transpiler->strings->strings[i]->length));
+        }
+    }
+    cleanup_intern_table(transpiler->strings);
+    transpiler->functions = NULL;
+    transpiler->prototypes = NULL;
+    transpiler->strings = NULL;
+    transpiler->string_setup = NULL;
+    return source;
+}
@@ -0,0 +1,31 @@
+#ifndef TRANSPILER_H
+#define TRANSPILER_H
+
+#include "ast.h"
+#include "globals.h"
+#include "parser.h"
+#include "resolver.h"
+#include "str_utils.h"
+#include "string_object.h"
+
+// Ahead-of-time backend: turns a resolved program into a standalone C file built on
+// aot_runtime.h. Every function literal becomes a C function, locals become C locals and values
+// keep the VM's representation, so the generated program behaves like the VM, errors included.
+typedef struct TranspileScope TranspileScope;
+
+typedef struct Transpiler {
+    Resolver *resolver;
+    String *functions; // Finished C functions, in the order their bodies were completed
+    String *prototypes;
+    int num_functions;
+    InternTable *strings; // String literals by contents, numbered by their index in `strings`
+    String *string_setup; // Statements filling in `strings`, run first thing
+    TranspileScope *scope;
+    ErrorArrayList *errors; // Shared with the resolver
+} Transpiler;
+
+extern Transpiler *make_transpiler(void);
+extern void cleanup_transpiler(Transpiler *transpiler);
+extern char *transpile_program(Transpiler *transpiler, Program *program);
+
+#endif // TRANSPILER_H
@@ -0,0 +1,275 @@
+#include "compiler.h"
+#include "object.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "test_utils.h"
+#include "transpiler.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+INIT_TEST_HARNESS()
+
+// Generated programs are built with the system compiler against the runtime header in src/, so
+// these tests have to run from the repository root like `make test` does
+#define AOT_CC "gcc -O1 -w -I src"
+
+typedef struct TranspilerTest {
+    char *input;
+    const char *expected; // What the generated program prints: the result, or the runtime error
+} TranspilerTest;
+
+static Program *parse_or_fail(Parser *parser, char *input)
+{
+    Program *program = parse_program(parser);
+    if (parser->errors->size != 0) {
+        printf("Parsing %s failed: %s\n", input, get_error_from_arraylist(parser->errors, 0));
+        assert(1 != 1);
+    }
+    optimize_program(program);
+    return program;
+}
+
+// Runs `input` on the VM and formats the outcome like a generated program's main() does
+static char *run_on_vm(char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_or_fail(parser, input);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+
+    VM *vm = make_vm(heap, compiler->constants);
+    char *result;
+    if (run_vm(vm, main) == VM_OK) {
+        result = inspect_value(get_last_popped(vm));
+    } else {
+        result = malloc(strlen(vm->error) + sizeof("Runtime error: "));
+        sprintf(result, "Runtime error: %s", vm->error);
+    }
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return result;
+}
+
+// Transpiles `input`, builds the C file and returns the first line the program prints
+static char *run_compiled(char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_or_fail(parser, input);
+    Transpiler *transpiler = make_transpiler();
+    char *source = transpile_program(transpiler, program);
+    if (source == NULL) {
+        printf("Transpiling %s failed: %s\n", input, get_error_from_arraylist(transpiler->errors, 0));
+        assert(1 != 1);
+    }
+
+    char directory[] = "/tmp/monkey_aot_XXXXXX";
+    assert(mkdtemp(directory) != NULL);
+    char path[256];
+    snprintf(path, sizeof(path), "%s/program.c", directory);
+    FILE *file = fopen(path, "w");
+    fputs(source, file);
+    fclose(file);
+
+    char command[1024];
+    snprintf(command, sizeof(command), AOT_CC " %s/program.c -o %s/program && %s/program; rm -rf %s", directory, directory, directory, directory);
+    FILE *output = popen(command, "r");
+    char line[512] = { 0 };
+    if (fgets(line, sizeof(line), output) == NULL) {
+        printf("Generated program for %s printed nothing:\n%s\n", input, source);
+        assert(1 != 1);
+    }
+    pclose(output);
+    line[strcspn(line, "\n")] = '\0';
+
+    free(source);
+    cleanup_transpiler(transpiler);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return strdup(line);
+}
+
+static void run_transpiler_tests(TranspilerTest *tests, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        char *vm_result = run_on_vm(tests[i].input);
+        char *compiled_result = run_compiled(tests[i].input);
+        if (strcmp(compiled_result, tests[i].expected) != 0 || strcmp(vm_result, tests[i].expected) != 0) {
+            printf("Input: %s\nExpected: %s\nVM: %s\nCompiled: %s\n", tests[i].input, tests[i].expected, vm_result, compiled_result);
+            assert(1 != 1);
+        }
+        free(vm_result);
+        free(compiled_result);
+    }
+}
+
+TEST_CASE(expressions)
+{
+    TranspilerTest tests[] = {
+        { "1 + 2 * 3 - 4 / 2", "5" },
+        { "let a = 5; let b = a * 2; -b", "-10" },
+        { "1 < 2 == true", "true" },
+        { "!(1 > 2) != false", "true" },
+        { "if (0) { 10 }", "10" },
+        { "if (false) { 10 }", "null" },
+        { "if (1 > 2) { 10 } else { let x = 1; }", "null" },
+        { "let x = 1; if (x == 1) { 2; 3 } else { 4 }", "3" },
+        { "5; let y = 2;", "5" },
+        { "return 7; 8", "7" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(functions_and_closures)
+{
+    TranspilerTest tests[] = {
+        { "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(20)", "6765" },
+        { "let f = fn() { }; f()", "null" },
+        { "let f = fn(x) { if (x > 1) { return x; } 0 }; f(5) + f(1)", "5" },
+        { "let adder = fn(a) { fn(b) { a + b } }; let addTwo = adder(2); addTwo(3) + adder(10)(1)", "16" },
+        { "let outer = fn(a) { fn(b) { fn(c) { a + b + c } } }; outer(1)(2)(3)", "6" },
+        { "let f = fn(a) { let b = 1; let g = fn() { a + b }; let b = 100; g }; f(1)()", "101" },
+        { "let f = fn() { let count = fn(n) { if (n == 0) { 0 } else { 1 + count(n - 1) } }; count }; f()(10)", "10" },
+        { "let f = fn() { 4; 5 }; let x = f();", "4" },
+        { "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + 1) } }; count(1000000, 0)", "1000000" },
+        { "let isEven = fn(n) { if (n == 0) { true } else { return isOdd(n - 1); } }; let isOdd = fn(n) { if (n == 0) { false } else { isEven(n - 1) } }; isEven(1000001)", "false" },
+        { "let notTail = fn(n) { if (n == 0) { 0 } else { 0 + notTail(n - 1) } }; notTail(1000000)", "Runtime error: stack overflow" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(loops)
+{
+    TranspilerTest tests[] = {
+        { "let i = 0; let s = 0; while (i < 100) { let s = s + i; let i = i + 1; } s", "4950" },
+        { "let i = 0; while (i < 3) { i; let i = i + 1; }", "2" },
+        { "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; if (i == 3) { continue; } if (i > 8) { break; } let s = s + i; } s }; sum(100)", "33" },
+        { "let f = fn(n) { let i = 0; let c = 0; while (i < n) { let j = 0; while (true) { if (j == i) { break; } let j = j + 1; let c = c + 1; } let i = i + 1; } c }; f(10)", "45" },
+        { "let find = fn(n) { let i = 0; while (true) { if (i * i > n) { return i; } let i = i + 1; } }; find(50)", "8" },
+        { "let f = fn() { let i = 0; let s = 0; while (i < 10) { let i = i + 1; let s = s + 100 * if (i > 3) { break; } else { i }; } s }; f()", "600" },
+        { "let f = fn() { let i = 0; let g = 0; while (i < 5) { let g = fn() { i * 10 }; let i = i + 1; } g() }; f()", "50" },
+        { "let f = fn() { while (false) { 1 } }; f()", "null" },
+        { "let i = 0; while (true) { let i = i + 1; i * true; }", "Runtime error: type mismatch: INTEGER * BOOLEAN" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(bignums)
+{
+    TranspilerTest tests[] = {
+        { "let sq = fn(x) { x * x }; sq(sq(65536))", "18446744073709551616" },
+        { "let min = -9223372036854775807 - 1; -min", "9223372036854775808" },
+        { "let big = 4294967296 * 4294967296; big * big / -7", "-48611766702991209066196372490252601636" },
+        { "let big = 9223372036854775807 + 1; big - 1 == 9223372036854775807", "true" },
+        { "let big = 9223372036854775807 + 1; -big < -9223372036854775807", "true" },
+        { "let fact = fn(n) { if (n == 0) { 1 } else { n * fact(n - 1) } }; fact(30)", "265252859812191058636308480000000" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(floats)
+{
+    TranspilerTest tests[] = {
+        { "[0.1 + 0.2, 7 / 2.0, -1.5 * 2, 1.0 / 0, 1e300 * 1e300]", "[0.30000000000000004, 3.5, -3.0, inf, inf]" },
+        { "let big = 9223372036854775807 + 1; [big * 0.5, big == 9223372036854775808.0, 1 == 1.0, 2.5 > 2, 0.5 < 0.25]", "[4.611686018427388e+18, true, true, true, false]" },
+        { "let mean = fn(a, i, total) { if (i == len(a)) { total / len(a) } else { mean(a, i + 1, total + a[i]) } }; mean([1, 2.5, 3], 0, 0.0)", "2.1666666666666665" },
+        { "1.5 + true", "Runtime error: type mismatch: FLOAT + BOOLEAN" },
+        { "{0.5: 1}", "Runtime error: unusable as hash key: FLOAT" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(collections)
+{
+    TranspilerTest tests[] = {
+        { "[1, 2 * 2, [3]]", "[1, 4, [3]]" },
+        { "let a = [1, 2, 3]; [a[0] + a[2], a[3], a[-1]]", "[4, null, null]" },
+        { "let h = {1: true, true: 2, 4294967296 * 4294967296: 3}; [h[1], h[true], h[4294967296 * 4294967296], h[7], len(h)]", "[true, 2, 3, null, 3]" },
+        { "{2: 3, 1: 2, false: 1}", "{1: 2, false: 1, 2: 3}" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, i); let i = i + 1; } [len(a), first(a), last(a), a[500], len(rest(a))]", "[1000, 0, 999, 500, 999]" },
+        { "let h = {}; let i = 0; while (i < 1000) { let h = put(h, i, i * i); let i = i + 1; } [len(h), h[999], put(h, 1, 0)[1], h[1]]", "[1000, 998001, 0, 1]" },
+        { "let sum = fn(a, acc) { if (len(a) == 0) { acc } else { sum(rest(a), acc + first(a)) } }; sum([1, 2, 3, 4], 0)", "10" },
+        { "let f = fn(a) { len(a) }; let g = fn(x) { let get = fn() { x[0] }; get() }; [f([1, 2]), g([5]), len]", "[2, 5, builtin len]" },
+        { "1[0]", "Runtime error: index operator not supported: INTEGER" },
+        { "{1: 2}[[1]]", "Runtime error: unusable as hash key: ARRAY" },
+        { "let f = fn(x) { push(x, 1) }; f({})", "Runtime error: argument to `push` must be ARRAY, got HASH" },
+        { "len(1, 2)", "Runtime error: wrong number of arguments: want=1, got=2" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(array_builtins)
+{
+    TranspilerTest tests[] = {
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, (500 - i) * 2); let i = i + 1; } [sum(a), min(a), max(a), sum([]), min([])]", "[1000, -998, 1000, 0, null]" },
+        { "let big = 9223372036854775807 + 1; [sum([9223372036854775807, 1, -5]), sum([big, -1]), max([1, big]), min([1, -big])]", "[9223372036854775803, 9223372036854775807, 9223372036854775808, -9223372036854775808]" },
+        { "[map([1, 2, 3], fn(x) { 10 - x }), map([1, 9223372036854775807], fn(x) { x + 1 }), map([\"a\"], fn(s) { s + \"!\" }), map([[1], [1, 2]], len)]", "[[9, 8, 7], [2, 9223372036854775808], [a!], [1, 2]]" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, i); let i = i + 1; } [len(filter(a, fn(x) { x > 499 })), filter([1, 5, 2], fn(x) { 3 > x }), filter([1, true], fn(x) { x == true })]", "[500, [1, 2], [true]]" },
+        { "map([1, 2], fn(x) { sum(map([x, x], fn(y) { y * x })) })", "[2, 8]" },
+        { "[sum([0.5, 0.25]), sum([1, 2.5, 3]), min([1.5, 2]), max([3, 2.5, 1]), min([2, -1.5])]", "[0.75, 6.5, 1.5, 3, -1.5]" },
+        { "sum([1, \"a\"])", "Runtime error: elements of `sum` argument must be INTEGER or FLOAT, got STRING" },
+        { "map([1], fn(a, b) { a })", "Runtime error: wrong number of arguments: want=2, got=1" },
+        { "filter(1, len)", "Runtime error: argument to `filter` must be ARRAY, got INTEGER" },
+        { "let a = [1, 2, 3, 4, 5]; [slice(a, 1, 3), slice(a, -1, 2), slice(a, 4, 2), push(slice(a, 0, 2), 9), push(rest(a), 6), sum(slice(a, 2, 5)), a]", "[[2, 3], [1, 2], [], [1, 2, 9], [2, 3, 4, 5, 6], 12, [1, 2, 3, 4, 5]]" },
+        { "slice([1], true, 1)", "Runtime error: bounds of `slice` must be INTEGER, got BOOLEAN" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(strings)
+{
+    TranspilerTest tests[] = {
+        { "\"monkey\"", "monkey" },
+        { "let greet = fn(name) { \"hello \" + name + \"!\" }; [greet(\"a\"), greet(\"b\")]", "[hello a!, hello b!]" },
+        { "\"tab\\tquote\\\"back\\\\slash\"", "tab\tquote\"back\\slash" },
+        { "[\"a\" == \"a\", \"ab\" == \"a\" + \"b\", \"a\" != \"b\", len(\"\\\"ab\\\"\")]", "[true, true, true, 4]" },
+        { "let h = {\"one\": 1, \"two\": 2}; [h[\"t\" + \"wo\"], h[\"three\"], put(h, \"one\", 0)[\"one\"]]", "[2, null, 0]" },
+        { "let s = \"\"; let i = 0; while (i < 1000) { let s = s + \"ab\"; let i = i + 1; } [len(s), s[0], s[1999], s[2000], s == s + \"\"]", "[2000, a, b, null, true]" },
+        { "\"a\" - \"b\"", "Runtime error: unknown operator: STRING - STRING" },
+        { "\"a\" + 1", "Runtime error: type mismatch: STRING + INTEGER" },
+        { "\"a\"[true]", "Runtime error: index operator not supported: STRING[BOOLEAN]" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(runtime_errors)
+{
+    TranspilerTest tests[] = {
+        { "1 + true", "Runtime error: type mismatch: INTEGER + BOOLEAN" },
+        { "true * false", "Runtime error: unknown operator: BOOLEAN * BOOLEAN" },
+        { "true < 1", "Runtime error: unknown operator: INTEGER > BOOLEAN" },
+        { "-true", "Runtime error: unknown operator: -BOOLEAN" },
+        { "let z = 0; 5 / z", "Runtime error: division by zero" },
+        { "let big = 4294967296 * 4294967296; big / 0", "Runtime error: division by zero" },
+        { "let big = 4294967296 * 4294967296; big + true", "Runtime error: type mismatch: INTEGER + BOOLEAN" },
+        { "let x = 1; x()", "Runtime error: calling non-function: INTEGER" },
+        { "fn(a) { a }()", "Runtime error: wrong number of arguments: want=1, got=0" },
+        { "let down = fn(n) { if (n == 0) { 0 } else { 1 + down(n - 1) } }; down(4094)", "4094" },
+        { "let down = fn(n) { if (n == 0) { 0 } else { 1 + down(n - 1) } }; down(4095)", "Runtime error: stack overflow" },
+    };
+    run_transpiler_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(resolution_errors)
+{
+    Parser *parser = make_parser("let f = fn() { g() }; x", NULL);
+    Program *program = parse_program(parser);
+    Transpiler *transpiler = make_transpiler();
+    assert(transpile_program(transpiler, program) == NULL);
+    assert(transpiler->errors->size == 2);
+    assert(strcmp(get_error_from_arraylist(transpiler->errors, 0), "Identifier not found: x") == 0);
+    assert(strcmp(get_error_from_arraylist(transpiler->errors, 1), "Identifier not found: g") == 0);
+    cleanup_transpiler(transpiler);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+RUN_TESTS()
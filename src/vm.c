@@ -0,0 +1,1074 @@
+#include "vm.h"
+#include "bigint.h"
+#include "builtins.h"
+#include "code.h"
+#include "compiler.h"
+#include "gc.h"
+#include "jit.h"
+#include "number.h"
+#include "object.h"
+#include "packed.h"
+#include "persistent.h"
+#include "string_object.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define INITIAL_GLOBALS_CAPACITY 64
+// Room made in the nursery before updating a persistent collection: the new collection plus a
+// copied node per trie level for up to a billion elements. Deeper updates spill into the old space.
+#define COLLECTION_UPDATE_SIZE (sizeof(Array) + 6 * (sizeof(Node) + (NODE_WIDTH + 1) * sizeof(Value)))
+
+VM *make_vm(Heap *heap, ValueArrayList *constants)
+{
+    VM *vm = malloc(sizeof(VM));
+    vm->heap = heap;
+    vm->constants = constants;
+    vm->stack = calloc(STACK_SIZE, sizeof(Value));
+    vm->sp = vm->stack;
+    vm->frames = calloc(MAX_FRAMES, sizeof(Frame));
+    vm->frame_count = 0;
+    vm->globals = calloc(INITIAL_GLOBALS_CAPACITY, sizeof(Value));
+    vm->globals_capacity = INITIAL_GLOBALS_CAPACITY;
+    vm->open_upvalues = NULL;
+    vm->last_popped = NULL_VAL;
+    vm->error = NULL;
+    vm->cache_stats = (InlineCacheStats) { 0 };
+    vm->jit_enabled = JIT_AVAILABLE;
+    vm->jit_stats = (JitStats) { 0 };
+    return vm;
+}
+
+void cleanup_vm(VM *vm)
+{
+    free(vm->stack);
+    free(vm->frames);
+    free(vm->globals);
+    free(vm->error);
+    free(vm);
+}
+
+Value get_last_popped(VM *vm)
+{
+    return vm->last_popped;
+}
+
+InlineCacheStats get_inline_cache_stats(VM *vm)
+{
+    return vm->cache_stats;
+}
+
+JitStats get_jit_stats(VM *vm)
+{
+    return vm->jit_stats;
+}
+
+void ensure_globals_capacity(VM *vm, size_t count)
+{
+    if (count <= vm->globals_capacity) {
+        return;
+    }
+    size_t new_capacity = vm->globals_capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    // Zeroed memory is VAL_NULL, so globals that were never set read as null
+    vm->globals = realloc(vm->globals, new_capacity * sizeof(Value));
+    memset(&vm->globals[vm->globals_capacity], 0, (new_capacity - vm->globals_capacity) * sizeof(Value));
+    vm->globals_capacity = new_capacity;
+}
+
+static void reset_stack(VM *vm)
+{
+    vm->sp = vm->stack;
+    vm->frame_count = 0;
+    vm->open_upvalues = NULL;
+}
+
+static VMResult runtime_error(VM *vm, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    size_t total_len = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    free(vm->error);
+    vm->error = malloc(total_len + 1); // We add one for sentinel character '\0'
+    va_start(args, format);
+    vsprintf(vm->error, format, args);
+    va_end(args);
+
+    reset_stack(vm);
+    return VM_RUNTIME_ERROR;
+}
+
+// Reuses the open upvalue for a slot if a closure already captured it, so all closures share one variable
+static Upvalue *capture_upvalue(VM *vm, Value *local)
+{
+    // Collect before walking the list, a minor collection moves the young upvalues on it
+    maybe_collect_garbage(vm, sizeof(Upvalue));
+
+    Upvalue *previous = NULL;
+    Upvalue *upvalue = vm->open_upvalues;
+    while (upvalue != NULL && upvalue->location > local) {
+        previous = upvalue;
+        upvalue = upvalue->next_open;
+    }
+
+    if (upvalue != NULL && upvalue->location == local) {
+        return upvalue;
+    }
+
+    Upvalue *created = make_upvalue(vm->heap, local);
+    created->next_open = upvalue;
+    if (previous == NULL) {
+        vm->open_upvalues = created;
+    } else {
+        previous->next_open = created;
+    }
+    return created;
+}
+
+// Moves every variable at or above `last` off the stack and into the upvalues capturing it
+static void close_upvalues(VM *vm, Value *last)
+{
+    while (vm->open_upvalues != NULL && vm->open_upvalues->location >= last) {
+        Upvalue *upvalue = vm->open_upvalues;
+        upvalue->closed = *upvalue->location;
+        upvalue->location = &upvalue->closed;
+        write_barrier(vm->heap, (Object *)upvalue, upvalue->closed);
+        vm->open_upvalues = upvalue->next_open;
+        upvalue->next_open = NULL;
+    }
+}
+
+// Functions skipped by a lazy parser only get their bytecode right before their first call
+static VMResult compile_on_first_call(VM *vm, FunctionProto *function)
+{
+    ErrorArrayList *errors = function->lazy->compiler->errors;
+    size_t errors_before = errors->size;
+    if (!compile_lazy_function(function)) {
+        const char *name = function->name[0] != '\0' ? function->name : "anonymous";
+        return runtime_error(vm, "cannot compile function %s: %s", name, get_error_from_arraylist(errors, errors_before));
+    }
+    return VM_OK;
+}
+
+static int frame_size(FunctionProto *function)
+{
+    return function->num_locals + function->max_stack;
+}
+
+static bool push_frame(VM *vm, Closure *closure, Value *slots, int size)
+{
+    FunctionProto *function = closure->function;
+    if (vm->frame_count == MAX_FRAMES || slots + size > vm->stack + STACK_SIZE) {
+        return FALSE;
+    }
+
+    // Parameters are already in place, the remaining locals start out as null
+    for (Value *slot = slots + function->num_parameters; slot < slots + function->num_locals; slot++) {
+        *slot = NULL_VAL;
+    }
+    vm->sp = slots + function->num_locals;
+
+    Frame *frame = &vm->frames[vm->frame_count++];
+    frame->closure = closure;
+    frame->ip = function->instructions->array;
+    frame->slots = slots;
+    return TRUE;
+}
+
+// Returns the cached frame size if the call site has already seen `function`, -1 otherwise
+static inline int lookup_call_cache(CallCache *cache, FunctionProto *function)
+{
+    for (int i = 0; i < cache->num_entries; i++) {
+        if (cache->entries[i].function == function) {
+            return cache->entries[i].frame_size;
+        }
+    }
+    return -1;
+}
+
+static void update_call_cache(CallCache *cache, FunctionProto *function, int size)
+{
+    switch (cache->state) {
+    case CACHE_MEGAMORPHIC:
+        return;
+    case CACHE_UNINITIALIZED:
+        cache->state = CACHE_MONOMORPHIC;
+        break;
+    default:
+        if (cache->num_entries == CALL_CACHE_SIZE) {
+            // Give up on sites calling many different functions rather than thrashing the entries
+            cache->state = CACHE_MEGAMORPHIC;
+            cache->num_entries = 0;
+            return;
+        }
+        cache->state = CACHE_POLYMORPHIC;
+    }
+    cache->entries[cache->num_entries].function = function;
+    cache->entries[cache->num_entries].frame_size = size;
+    cache->num_entries++;
+}
+
+static bool lookup_index_cache(IndexCache *cache, size_t collections, Hash *hash, Object *key, Value *value)
+{
+    if (cache->collections != collections) {
+        return FALSE;
+    }
+    for (int i = 0; i < cache->num_entries; i++) {
+        if (cache->entries[i].hash == hash && cache->entries[i].key == key) {
+            *value = cache->entries[i].value;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void update_index_cache(IndexCache *cache, size_t collections, Hash *hash, Object *key, Value value)
+{
+    if (cache->state == CACHE_MEGAMORPHIC) {
+        return;
+    }
+    if (cache->collections != collections) {
+        // The entries may name freed or moved objects, the site starts over with what it reads next
+        cache->state = CACHE_UNINITIALIZED;
+        cache->num_entries = 0;
+        cache->collections = collections;
+    }
+    switch (cache->state) {
+    case CACHE_UNINITIALIZED:
+        cache->state = CACHE_MONOMORPHIC;
+        break;
+    default:
+        if (cache->num_entries == INDEX_CACHE_SIZE) {
+            // Sites reading many different hashes or keys go straight to the lookup
+            cache->state = CACHE_MEGAMORPHIC;
+            cache->num_entries = 0;
+            return;
+        }
+        cache->state = CACHE_POLYMORPHIC;
+    }
+    cache->entries[cache->num_entries] = (IndexCacheEntry) { .hash = hash, .key = key, .value = value };
+    cache->num_entries++;
+}
+
+static const char *operator_to_str(OpCode op)
+{
+    switch (op) {
+    case OP_ADD:
+        return "+";
+    case OP_SUB:
+        return "-";
+    case OP_MUL:
+        return "*";
+    case OP_DIV:
+        return "/";
+    case OP_EQUAL:
+        return "==";
+    case OP_NOT_EQUAL:
+        return "!=";
+    case OP_GREATER_THAN:
+        return ">";
+    default:
+        return "?";
+    }
+}
+
+static void *allocate_bigint(void *user, size_t size)
+{
+    VM *vm = user;
+    maybe_collect_garbage(vm, size);
+    return allocate_young_object(vm->heap, size, OBJ_BIGINT);
+}
+
+// Arithmetic the inline integer path hands off, on bignum operands or when an int64_t result
+// would overflow. The operands must already be off the stack, bigint.c is done reading them
+// by the time the result is allocated.
+__attribute__((noinline)) static Value bigint_arithmetic(VM *vm, OpCode op, Value left, Value right)
+{
+    Allocator allocator = { .alloc = allocate_bigint, .user = vm };
+    switch (op) {
+    case OP_ADD:
+        return bigint_add(left, right, &allocator);
+    case OP_SUB:
+        return bigint_sub(left, right, &allocator);
+    case OP_MUL:
+        return bigint_mul(left, right, &allocator);
+    default:
+        return bigint_div(left, right, &allocator);
+    }
+}
+
+// Arithmetic with at least one float operand, the other converted if it is an integer. Unlike
+// integer division, dividing by zero gives an infinity or NaN.
+static double float_arithmetic(OpCode op, double left, double right)
+{
+    switch (op) {
+    case OP_ADD:
+        return left + right;
+    case OP_SUB:
+        return left - right;
+    case OP_MUL:
+        return left * right;
+    default:
+        return left / right;
+    }
+}
+
+// Persistent collections and strings allocate several objects per operation and hold on to them
+// in between, so nothing may be collected until they are reachable. The VM makes room before
+// calling in and whatever no longer fits in the nursery goes to the old space, remembered since
+// it may point at young objects.
+static void *allocate_collection_object(void *user, size_t size)
+{
+    VM *vm = user;
+    Heap *heap = vm->heap;
+    size_t aligned_size = (size + OBJECT_ALIGNMENT - 1) & ~(size_t)(OBJECT_ALIGNMENT - 1);
+    if ((size_t)(heap->nursery_end - heap->nursery_top) >= aligned_size) {
+        return allocate_young_object(heap, size, OBJ_NODE);
+    }
+    Object *object = allocate_object(heap, size, OBJ_NODE);
+    remember_object(heap, object);
+    return object;
+}
+
+// The operands are put back on the stack while room is made for the result, since a collection
+// may move them
+__attribute__((noinline)) static VMResult concat_strings(VM *vm, Value left, Value right, Value *result)
+{
+    size_t length = (size_t)string_length(left) + string_length(right);
+    if (length > MAX_STRING_LENGTH) {
+        return runtime_error(vm, "string too long: %zu bytes", length);
+    }
+    *vm->sp++ = left;
+    *vm->sp++ = right;
+    maybe_collect_garbage(vm, STRING_CONCAT_SIZE);
+    right = *--vm->sp;
+    left = *--vm->sp;
+    Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+    *result = string_concat(left, right, &allocator);
+    return VM_OK;
+}
+
+static inline size_t collection_build_size(size_t count)
+{
+    return sizeof(Array) + (count / NODE_WIDTH + 2) * (sizeof(Node) + NODE_WIDTH * sizeof(Value));
+}
+
+// Builds an array out of the top `count` values on the stack, which stay there until it is done
+static Value build_array_from_stack(VM *vm, int count)
+{
+    maybe_collect_garbage(vm, collection_build_size(count));
+    Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+    return make_array(vm->sp - count, count, &allocator);
+}
+
+// Returns FALSE if one of the keys cannot be hashed, in which case nothing has been allocated
+static bool build_hash_from_stack(VM *vm, int num_pairs, Value *result)
+{
+    Value *pairs = vm->sp - 2 * num_pairs;
+    for (int i = 0; i < num_pairs; i++) {
+        if (!is_hashable(pairs[2 * i])) {
+            *result = pairs[2 * i];
+            return FALSE;
+        }
+    }
+
+    maybe_collect_garbage(vm, 2 * collection_build_size(2 * num_pairs));
+    pairs = vm->sp - 2 * num_pairs;
+    Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+    Value hash = make_hash(&allocator);
+    for (int i = 0; i < num_pairs; i++) {
+        hash = hash_put(AS_HASH(hash), pairs[2 * i], pairs[2 * i + 1], &allocator);
+    }
+    *result = hash;
+    return TRUE;
+}
+
+// Ropes are flattened on their first indexing and keep the flat copy for later ones. Making room
+// for it may collect, so the rope is read from its stack slot again after.
+__attribute__((noinline)) static StringObject *flatten_string(VM *vm, Value *slot)
+{
+    if (IS_FLAT_STRING(*slot) || AS_ROPE(*slot)->right == NULL) {
+        return string_flatten(*slot, NULL);
+    }
+    maybe_collect_garbage(vm, STRING_SIZE(AS_ROPE(*slot)->length));
+    Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+    StringObject *flat = string_flatten(*slot, &allocator);
+    write_barrier(vm->heap, AS_OBJ(*slot), OBJ_VAL(flat));
+    return flat;
+}
+
+// `operands` holds the indexed value and the index, which stay on the stack until it is done
+static VMResult index_value(VM *vm, Value *operands, Value *result)
+{
+    Value left = operands[0];
+    Value index = operands[1];
+    if (IS_ARRAY(left)) {
+        if (!IS_INTEGER(index)) {
+            return runtime_error(vm, "index operator not supported: %s[%s]", value_type_to_str(left), value_type_to_str(index));
+        }
+        // Bignum indices are out of range of any array that fits in memory
+        Array *array = AS_ARRAY(left);
+        bool in_range = IS_INT(index) && AS_INT(index) >= 0 && (uint64_t)AS_INT(index) < array->count;
+        *result = in_range ? array_get(array, (size_t)AS_INT(index)) : NULL_VAL;
+        return VM_OK;
+    }
+    if (IS_HASH(left)) {
+        if (!is_hashable(index)) {
+            return runtime_error(vm, "unusable as hash key: %s", value_type_to_str(index));
+        }
+        if (!hash_get(AS_HASH(left), index, result)) {
+            *result = NULL_VAL;
+        }
+        return VM_OK;
+    }
+    if (IS_STRING(left)) {
+        if (!IS_INTEGER(index)) {
+            return runtime_error(vm, "index operator not supported: %s[%s]", value_type_to_str(left), value_type_to_str(index));
+        }
+        if (!IS_INT(index) || AS_INT(index) < 0 || (uint64_t)AS_INT(index) >= string_length(left)) {
+            *result = NULL_VAL;
+            return VM_OK;
+        }
+        *result = char_string(flatten_string(vm, &operands[0])->chars[AS_INT(index)]);
+        return VM_OK;
+    }
+    return runtime_error(vm, "index operator not supported: %s", value_type_to_str(left));
+}
+
+static VMResult execute(VM *vm, int base_frame);
+static VMResult call_builtin(VM *vm, Builtin *builtin, int num_arguments);
+
+// Calls `callee` with one argument from a builtin, running the interpreter until it returns, and
+// leaves the result on top of the stack
+static VMResult call_value(VM *vm, Value callee, Value argument)
+{
+    *vm->sp++ = callee;
+    *vm->sp++ = argument;
+    if (IS_BUILTIN(callee)) {
+        return call_builtin(vm, AS_BUILTIN(callee), 1);
+    }
+    if (!IS_CLOSURE(callee)) {
+        return runtime_error(vm, "calling non-function: %s", value_type_to_str(callee));
+    }
+    FunctionProto *function = AS_CLOSURE(callee)->function;
+    if (function->num_parameters != 1) {
+        return runtime_error(vm, "wrong number of arguments: want=%d, got=1", function->num_parameters);
+    }
+    if (function->lazy != NULL && compile_on_first_call(vm, function) != VM_OK) {
+        return VM_RUNTIME_ERROR;
+    }
+    if (!push_frame(vm, AS_CLOSURE(callee), vm->sp - 1, frame_size(function))) {
+        return runtime_error(vm, "stack overflow");
+    }
+    return execute(vm, vm->frame_count - 1);
+}
+
+// Recognizes `fn(x) { x op constant }` and `fn(x) { constant op x }` from their bytecode, so that
+// `map` and `filter` can run them over packed arrays without calling them for every element
+static bool recognize_int_lambda(VM *vm, Value callee, IntLambda *lambda)
+{
+    if (!IS_CLOSURE(callee) || AS_CLOSURE(callee)->function->num_parameters != 1) {
+        return FALSE;
+    }
+    Instructions *instructions = AS_CLOSURE(callee)->function->instructions;
+    uint8_t *ip = instructions->array;
+    // Two loads of one and three bytes, the operator and the return
+    if (instructions->size != 2 + 3 + 1 + 1) {
+        return FALSE;
+    }
+    bool reversed = ip[0] == OP_CONSTANT;
+    uint8_t *local = reversed ? ip + 3 : ip;
+    uint8_t *constant = reversed ? ip : ip + 2;
+    if (local[0] != OP_GET_LOCAL || local[1] != 0 || constant[0] != OP_CONSTANT || ip[6] != OP_RETURN_VALUE) {
+        return FALSE;
+    }
+    Value value = vm->constants->array[read_uint16(constant + 1)];
+    if (!IS_INT(value)) {
+        return FALSE;
+    }
+    lambda->constant = AS_INT(value);
+    lambda->reversed = FALSE;
+    switch (ip[5]) {
+    case OP_ADD:
+        lambda->op = INT_LAMBDA_ADD;
+        return TRUE;
+    case OP_SUB:
+        lambda->op = INT_LAMBDA_SUB;
+        lambda->reversed = reversed;
+        return TRUE;
+    case OP_MUL:
+        lambda->op = INT_LAMBDA_MUL;
+        return TRUE;
+    case OP_GREATER_THAN:
+        lambda->op = reversed ? INT_LAMBDA_LESS : INT_LAMBDA_GREATER;
+        return TRUE;
+    case OP_EQUAL:
+        lambda->op = INT_LAMBDA_EQUAL;
+        return TRUE;
+    case OP_NOT_EQUAL:
+        lambda->op = INT_LAMBDA_NOT_EQUAL;
+        return TRUE;
+    default:
+        return FALSE;
+    }
+}
+
+// `sum`, `min` and `max` of the array in `slot`, which stays on the stack since adding bignums may
+// collect. Packed arrays are folded with the vector kernels; a sum that overflows them is redone
+// element by element, promoting to a bignum like addition does. Integers and floats mix as they do
+// in arithmetic and comparisons, so the result is only an integer if every element is.
+static VMResult fold_numbers(VM *vm, Builtin *builtin, Value *slot, Value *result)
+{
+    Array *array = AS_ARRAY(*slot);
+    if (array->packed) {
+        int64_t sum;
+        if (builtin->id != BUILTIN_SUM) {
+            *result = array->count == 0 ? NULL_VAL
+                : INT_VAL(builtin->id == BUILTIN_MIN ? packed_array_min(array) : packed_array_max(array));
+            return VM_OK;
+        }
+        if (packed_array_sum(array, &sum)) {
+            *result = INT_VAL(sum);
+            return VM_OK;
+        }
+    }
+
+    // The running result is kept on the stack above the argument
+    *vm->sp++ = builtin->id == BUILTIN_SUM ? INT_VAL(0) : NULL_VAL;
+    for (size_t i = 0; i < AS_ARRAY(*slot)->count; i++) {
+        Value element = array_get(AS_ARRAY(*slot), i);
+        if (!IS_NUMBER(element)) {
+            return runtime_error(vm, "elements of `%s` argument must be INTEGER or FLOAT, got %s", builtin->name, value_type_to_str(element));
+        }
+        Value current = vm->sp[-1];
+        if (builtin->id == BUILTIN_SUM) {
+            int64_t sum;
+            if (IS_INT(current) && IS_INT(element) && !__builtin_add_overflow(AS_INT(current), AS_INT(element), &sum)) {
+                vm->sp[-1] = INT_VAL(sum);
+            } else if (IS_FLOAT(current) || IS_FLOAT(element)) {
+                vm->sp[-1] = FLOAT_VAL(float_arithmetic(OP_ADD, number_to_double(current), number_to_double(element)));
+            } else {
+                Value promoted = bigint_arithmetic(vm, OP_ADD, current, element);
+                vm->sp[-1] = promoted;
+            }
+            continue;
+        }
+        if (IS_NULL(current)) {
+            vm->sp[-1] = element;
+            continue;
+        }
+        // Like `<` and `>`, NaN is neither smaller nor larger than anything, so it is only kept first
+        int order = IS_INT(current) && IS_INT(element) ? (AS_INT(element) > AS_INT(current)) - (AS_INT(element) < AS_INT(current))
+                                                       : compare_numbers(element, current);
+        if (builtin->id == BUILTIN_MIN ? order == -1 : order == 1) {
+            vm->sp[-1] = element;
+        }
+    }
+    *result = *--vm->sp;
+    return VM_OK;
+}
+
+// `map` and `filter` of the array and function in `arguments`. A recognized lambda over a packed
+// array runs in the vector kernels; anything else calls the function for every element, pushing
+// onto a result kept on the stack where the collections those calls trigger can see it.
+static VMResult map_array(VM *vm, Builtin *builtin, Value *arguments, Value *result)
+{
+    bool filter = builtin->id == BUILTIN_FILTER;
+    IntLambda lambda;
+    if (AS_ARRAY(arguments[0])->packed && recognize_int_lambda(vm, arguments[1], &lambda)
+        && IS_INT_LAMBDA_COMPARISON(lambda) == filter) {
+        size_t count = AS_ARRAY(arguments[0])->count;
+        int64_t *results = malloc((count > 0 ? count : 1) * sizeof(int64_t));
+        bool done = TRUE;
+        if (filter) {
+            count = packed_array_filter(AS_ARRAY(arguments[0]), lambda, results);
+        } else {
+            done = packed_array_map(AS_ARRAY(arguments[0]), lambda, results);
+        }
+        if (done) {
+            maybe_collect_garbage(vm, collection_build_size(count));
+            Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+            *result = make_packed_array(results, count, &allocator);
+        }
+        free(results);
+        if (done) {
+            return VM_OK;
+        }
+        // A result overflowed, calling the function promotes it to a bignum
+    }
+
+    maybe_collect_garbage(vm, sizeof(Array));
+    Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+    *vm->sp++ = make_array(NULL, 0, &allocator);
+    for (size_t i = 0; i < AS_ARRAY(arguments[0])->count; i++) {
+        if (call_value(vm, arguments[1], array_get(AS_ARRAY(arguments[0]), i)) != VM_OK) {
+            return VM_RUNTIME_ERROR;
+        }
+        if (filter) {
+            if (!is_truthy(vm->sp[-1])) {
+                vm->sp--;
+                continue;
+            }
+            vm->sp[-1] = array_get(AS_ARRAY(arguments[0]), i);
+        }
+        maybe_collect_garbage(vm, COLLECTION_UPDATE_SIZE);
+        Value pushed = array_push(AS_ARRAY(vm->sp[-2]), vm->sp[-1], &allocator);
+        vm->sp--;
+        vm->sp[-1] = pushed;
+    }
+    *result = *--vm->sp;
+    return VM_OK;
+}
+
+// Runs `builtin` on the arguments on top of the stack and replaces them and the callee with its result
+static VMResult call_builtin(VM *vm, Builtin *builtin, int num_arguments)
+{
+    if (num_arguments != builtin->num_parameters) {
+        return runtime_error(vm, "wrong number of arguments: want=%d, got=%d", builtin->num_parameters, num_arguments);
+    }
+
+    Value *arguments = vm->sp - num_arguments;
+    Value result = NULL_VAL;
+    switch (builtin->id) {
+    case BUILTIN_LEN:
+        if (IS_ARRAY(arguments[0])) {
+            result = INT_VAL((int64_t)AS_ARRAY(arguments[0])->count);
+        } else if (IS_HASH(arguments[0])) {
+            result = INT_VAL((int64_t)AS_HASH(arguments[0])->count);
+        } else if (IS_STRING(arguments[0])) {
+            result = INT_VAL((int64_t)string_length(arguments[0]));
+        } else {
+            return runtime_error(vm, "argument to `len` not supported, got %s", value_type_to_str(arguments[0]));
+        }
+        break;
+    case BUILTIN_FIRST:
+    case BUILTIN_LAST:
+    case BUILTIN_REST:
+    case BUILTIN_SLICE:
+    case BUILTIN_PUSH: {
+        if (!IS_ARRAY(arguments[0])) {
+            return runtime_error(vm, "argument to `%s` must be ARRAY, got %s", builtin->name, value_type_to_str(arguments[0]));
+        }
+        size_t count = AS_ARRAY(arguments[0])->count;
+        if (builtin->id == BUILTIN_FIRST || builtin->id == BUILTIN_LAST) {
+            if (count > 0) {
+                result = array_get(AS_ARRAY(arguments[0]), builtin->id == BUILTIN_FIRST ? 0 : count - 1);
+            }
+            break;
+        }
+        if (builtin->id == BUILTIN_REST && count == 0) {
+            break;
+        }
+        if (builtin->id == BUILTIN_SLICE && (!IS_INTEGER(arguments[1]) || !IS_INTEGER(arguments[2]))) {
+            Value bound = IS_INTEGER(arguments[1]) ? arguments[2] : arguments[1];
+            return runtime_error(vm, "bounds of `slice` must be INTEGER, got %s", value_type_to_str(bound));
+        }
+
+        // Slices are views and only allocate the array object. Pushing onto one that does not reach
+        // the end of its trie copies it, spilling into the old space if it does not fit.
+        maybe_collect_garbage(vm, builtin->id == BUILTIN_PUSH ? COLLECTION_UPDATE_SIZE : sizeof(Array));
+        arguments = vm->sp - num_arguments;
+        Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+        if (builtin->id == BUILTIN_REST) {
+            result = array_slice(AS_ARRAY(arguments[0]), 1, count, &allocator);
+        } else if (builtin->id == BUILTIN_SLICE) {
+            result = array_slice(AS_ARRAY(arguments[0]), array_bound(arguments[1], count), array_bound(arguments[2], count), &allocator);
+        } else {
+            result = array_push(AS_ARRAY(arguments[0]), arguments[1], &allocator);
+        }
+        break;
+    }
+    case BUILTIN_PUT: {
+        if (!IS_HASH(arguments[0])) {
+            return runtime_error(vm, "argument to `put` must be HASH, got %s", value_type_to_str(arguments[0]));
+        }
+        if (!is_hashable(arguments[1])) {
+            return runtime_error(vm, "unusable as hash key: %s", value_type_to_str(arguments[1]));
+        }
+        maybe_collect_garbage(vm, COLLECTION_UPDATE_SIZE);
+        arguments = vm->sp - num_arguments;
+        Allocator allocator = { .alloc = allocate_collection_object, .user = vm };
+        result = hash_put(AS_HASH(arguments[0]), arguments[1], arguments[2], &allocator);
+        break;
+    }
+    case BUILTIN_SUM:
+    case BUILTIN_MIN:
+    case BUILTIN_MAX:
+    case BUILTIN_MAP:
+    case BUILTIN_FILTER: {
+        if (!IS_ARRAY(arguments[0])) {
+            return runtime_error(vm, "argument to `%s` must be ARRAY, got %s", builtin->name, value_type_to_str(arguments[0]));
+        }
+        VMResult status = builtin->id == BUILTIN_MAP || builtin->id == BUILTIN_FILTER ? map_array(vm, builtin, arguments, &result)
+                                                                                      : fold_numbers(vm, builtin, arguments, &result);
+        if (status != VM_OK) {
+            return status;
+        }
+        break;
+    }
+    default:
+        return runtime_error(vm, "unknown builtin: %s", builtin->name);
+    }
+
+    vm->sp -= num_arguments + 1;
+    *vm->sp++ = result;
+    return VM_OK;
+}
+
+// Runs until the frame above `base_frame` returns. The top-level function runs with a base of
+// zero and ends the program; builtins calling back into the interpreter get the result pushed.
+static VMResult execute(VM *vm, int base_frame)
+{
+    Frame *frame = &vm->frames[vm->frame_count - 1];
+    uint8_t *ip = frame->ip;
+    Value *constants = vm->constants->array;
+
+#define PUSH(value) (*vm->sp++ = (value))
+#define POP() (*--vm->sp)
+#define PEEK(distance) (vm->sp[-1 - (distance)])
+#define READ_BYTE() (*ip++)
+#define READ_UINT16() (ip += 2, read_uint16(ip - 2))
+#define SAVE_IP() (frame->ip = ip)
+#define LOAD_FRAME()                              \
+    do {                                          \
+        frame = &vm->frames[vm->frame_count - 1]; \
+        ip = frame->ip;                           \
+    } while (0)
+
+    for (;;) {
+        OpCode op = READ_BYTE();
+        switch (op) {
+        case OP_CONSTANT:
+            PUSH(constants[READ_UINT16()]);
+            break;
+        case OP_POP:
+            vm->last_popped = POP();
+            break;
+        case OP_ADD:
+        case OP_SUB:
+        case OP_MUL:
+        case OP_DIV: {
+            Value right = POP();
+            Value left = POP();
+            if (!IS_INT(left) || !IS_INT(right)) {
+                if ((IS_FLOAT(left) || IS_FLOAT(right)) && IS_NUMBER(left) && IS_NUMBER(right)) {
+                    PUSH(FLOAT_VAL(float_arithmetic(op, number_to_double(left), number_to_double(right))));
+                    break;
+                }
+                if (op == OP_ADD && IS_STRING(left) && IS_STRING(right)) {
+                    Value result;
+                    if (concat_strings(vm, left, right, &result) != VM_OK) {
+                        return VM_RUNTIME_ERROR;
+                    }
+                    PUSH(result);
+                    break;
+                }
+                if (!IS_INTEGER(left) || !IS_INTEGER(right)) {
+                    if (left.type != right.type) {
+                        return runtime_error(vm, "type mismatch: %s %s %s", value_type_to_str(left), operator_to_str(op), value_type_to_str(right));
+                    }
+                    return runtime_error(vm, "unknown operator: %s %s %s", value_type_to_str(left), operator_to_str(op), value_type_to_str(right));
+                }
+                if (op == OP_DIV && IS_INT(right) && AS_INT(right) == 0) {
+                    return runtime_error(vm, "division by zero");
+                }
+                Value result = bigint_arithmetic(vm, op, left, right);
+                PUSH(result);
+                break;
+            }
+
+            int64_t a = AS_INT(left);
+            int64_t b = AS_INT(right);
+            int64_t result;
+            bool overflow = FALSE;
+            switch (op) {
+            case OP_ADD:
+                overflow = __builtin_add_overflow(a, b, &result);
+                break;
+            case OP_SUB:
+                overflow = __builtin_sub_overflow(a, b, &result);
+                break;
+            case OP_MUL:
+                overflow = __builtin_mul_overflow(a, b, &result);
+                break;
+            default:
+                if (b == 0) {
+                    return runtime_error(vm, "division by zero");
+                }
+                overflow = a == INT64_MIN && b == -1;
+                result = overflow ? 0 : a / b;
+            }
+            if (overflow) {
+                Value promoted = bigint_arithmetic(vm, op, left, right);
+                PUSH(promoted);
+                break;
+            }
+            PUSH(INT_VAL(result));
+            break;
+        }
+        case OP_TRUE:
+            PUSH(BOOL_VAL(TRUE));
+            break;
+        case OP_FALSE:
+            PUSH(BOOL_VAL(FALSE));
+            break;
+        case OP_NULL:
+            PUSH(NULL_VAL);
+            break;
+        case OP_EQUAL:
+        case OP_NOT_EQUAL: {
+            Value right = POP();
+            Value left = POP();
+            bool equal = values_equal(left, right);
+            PUSH(BOOL_VAL(op == OP_EQUAL ? equal : !equal));
+            break;
+        }
+        case OP_GREATER_THAN: {
+            Value right = POP();
+            Value left = POP();
+            if (!IS_INT(left) || !IS_INT(right)) {
+                if (!IS_NUMBER(left) || !IS_NUMBER(right)) {
+                    return runtime_error(vm, "unknown operator: %s > %s", value_type_to_str(left), value_type_to_str(right));
+                }
+                PUSH(BOOL_VAL(compare_numbers(left, right) == 1));
+                break;
+            }
+            PUSH(BOOL_VAL(AS_INT(left) > AS_INT(right)));
+            break;
+        }
+        case OP_NEG: {
+            Value operand = POP();
+            if (!IS_INT(operand) || AS_INT(operand) == INT64_MIN) {
+                if (IS_FLOAT(operand)) {
+                    PUSH(FLOAT_VAL(-AS_FLOAT(operand)));
+                    break;
+                }
+                if (!IS_INTEGER(operand)) {
+                    return runtime_error(vm, "unknown operator: -%s", value_type_to_str(operand));
+                }
+                Allocator allocator = { .alloc = allocate_bigint, .user = vm };
+                Value negated = bigint_neg(operand, &allocator);
+                PUSH(negated);
+                break;
+            }
+            PUSH(INT_VAL(-AS_INT(operand)));
+            break;
+        }
+        case OP_BANG: {
+            Value operand = POP();
+            PUSH(BOOL_VAL(!is_truthy(operand)));
+            break;
+        }
+        case OP_JUMP: {
+            uint16_t target = READ_UINT16();
+            ip = frame->closure->function->instructions->array + target;
+            break;
+        }
+        case OP_JUMP_NOT_TRUTHY: {
+            uint16_t target = READ_UINT16();
+            if (!is_truthy(POP())) {
+                ip = frame->closure->function->instructions->array + target;
+            }
+            break;
+        }
+        case OP_GET_GLOBAL:
+            PUSH(vm->globals[READ_UINT16()]);
+            break;
+        case OP_SET_GLOBAL:
+            vm->globals[READ_UINT16()] = POP();
+            break;
+        case OP_GET_LOCAL:
+            PUSH(frame->slots[READ_BYTE()]);
+            break;
+        case OP_SET_LOCAL:
+            frame->slots[READ_BYTE()] = POP();
+            break;
+        case OP_GET_UPVALUE:
+            PUSH(*frame->closure->upvalues[READ_BYTE()]->location);
+            break;
+        case OP_CALL:
+        case OP_TAIL_CALL: {
+            int num_arguments = READ_BYTE();
+            CallCache *cache = &frame->closure->function->call_caches[READ_UINT16()];
+            Value callee = PEEK(num_arguments);
+
+            // A callee the site has already seen was type and arity checked the first time around
+            int size = IS_CLOSURE(callee) ? lookup_call_cache(cache, AS_CLOSURE(callee)->function) : -1;
+            if (size >= 0) {
+                vm->cache_stats.call_hits++;
+            } else {
+                if (IS_BUILTIN(callee)) {
+                    // Builtins run right here, a tail call to one carries on to the caller's return
+                    VMResult result = call_builtin(vm, AS_BUILTIN(callee), num_arguments);
+                    if (result != VM_OK) {
+                        return result;
+                    }
+                    // Functions it called back may have been compiled just now, adding constants
+                    constants = vm->constants->array;
+                    break;
+                }
+                vm->cache_stats.call_misses++;
+                if (!IS_CLOSURE(callee)) {
+                    return runtime_error(vm, "calling non-function: %s", value_type_to_str(callee));
+                }
+                FunctionProto *function = AS_CLOSURE(callee)->function;
+                if (num_arguments != function->num_parameters) {
+                    return runtime_error(vm, "wrong number of arguments: want=%d, got=%d", function->num_parameters, num_arguments);
+                }
+                if (function->lazy != NULL) {
+                    if (compile_on_first_call(vm, function) != VM_OK) {
+                        return VM_RUNTIME_ERROR;
+                    }
+                    constants = vm->constants->array;
+                }
+                size = frame_size(function);
+                update_call_cache(cache, function, size);
+            }
+
+#if JIT_AVAILABLE
+            FunctionProto *function = AS_CLOSURE(callee)->function;
+            if (vm->jit_enabled && function->jit_state != JIT_FAILED) {
+                if (function->jit_state == JIT_NOT_COMPILED && ++function->call_count >= JIT_CALL_THRESHOLD) {
+                    jit_compile(vm, function);
+                }
+                Value result;
+                if (function->jit_entry != NULL && jit_call(vm, function, vm->sp - num_arguments, &result)) {
+                    vm->sp -= num_arguments + 1;
+                    PUSH(result);
+                    break;
+                }
+            }
+#endif
+
+            Value *slots = vm->sp - num_arguments;
+            if (op == OP_TAIL_CALL) {
+                // The caller is done with its frame, so the callee and its arguments move down
+                // into it and the callee returns straight to the caller's caller
+                close_upvalues(vm, frame->slots);
+                memmove(frame->slots - 1, slots - 1, (num_arguments + 1) * sizeof(Value));
+                slots = frame->slots;
+                vm->frame_count--;
+            } else {
+                SAVE_IP();
+            }
+            if (!push_frame(vm, AS_CLOSURE(slots[-1]), slots, size)) {
+                return runtime_error(vm, "stack overflow");
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case OP_RETURN_VALUE:
+        case OP_RETURN: {
+            Value result = op == OP_RETURN_VALUE ? POP() : NULL_VAL;
+            close_upvalues(vm, frame->slots);
+            vm->frame_count--;
+            if (vm->frame_count == 0) {
+                // Returning from the top-level function ends the program
+                if (op == OP_RETURN_VALUE) {
+                    vm->last_popped = result;
+                }
+                vm->sp = vm->stack;
+                return VM_OK;
+            }
+            vm->sp = frame->slots - 1;
+            PUSH(result);
+            if (vm->frame_count == base_frame) {
+                return VM_OK;
+            }
+            LOAD_FRAME();
+            break;
+        }
+        case OP_CLOSURE: {
+            FunctionProto *function = AS_FUNCTION(constants[READ_UINT16()]);
+            int num_upvalues = READ_BYTE();
+            maybe_collect_garbage(vm, sizeof(Closure) + num_upvalues * sizeof(Upvalue *));
+            // Pushed before capturing so a collection triggered by capture_upvalue can see, and move, it
+            PUSH(OBJ_VAL(make_closure(vm->heap, function)));
+            for (int i = 0; i < num_upvalues; i++) {
+                bool is_local = READ_BYTE();
+                int index = READ_BYTE();
+                Upvalue *upvalue = is_local ? capture_upvalue(vm, frame->slots + index) : frame->closure->upvalues[index];
+                Closure *closure = AS_CLOSURE(PEEK(0));
+                closure->upvalues[i] = upvalue;
+                write_barrier(vm->heap, (Object *)closure, OBJ_VAL(upvalue));
+            }
+            break;
+        }
+        case OP_ARRAY: {
+            int count = READ_UINT16();
+            Value array = build_array_from_stack(vm, count);
+            vm->sp -= count;
+            PUSH(array);
+            break;
+        }
+        case OP_HASH: {
+            int num_pairs = READ_UINT16();
+            Value hash;
+            if (!build_hash_from_stack(vm, num_pairs, &hash)) {
+                return runtime_error(vm, "unusable as hash key: %s", value_type_to_str(hash));
+            }
+            vm->sp -= 2 * num_pairs;
+            PUSH(hash);
+            break;
+        }
+        case OP_INDEX: {
+            IndexCache *cache = &frame->closure->function->index_caches[READ_UINT16()];
+            Value left = vm->sp[-2];
+            Value index = vm->sp[-1];
+            Value result;
+            if (IS_HASH(left) && IS_STRING(index)) {
+                Hash *hash = AS_HASH(left);
+                if (lookup_index_cache(cache, vm->heap->collections, hash, AS_OBJ(index), &result)) {
+                    vm->cache_stats.index_hits++;
+                } else {
+                    vm->cache_stats.index_misses++;
+                    if (!hash_get(hash, index, &result)) {
+                        result = NULL_VAL;
+                    }
+                    update_index_cache(cache, vm->heap->collections, hash, AS_OBJ(index), result);
+                }
+            } else if (index_value(vm, vm->sp - 2, &result) != VM_OK) {
+                return VM_RUNTIME_ERROR;
+            }
+            vm->sp -= 2;
+            PUSH(result);
+            break;
+        }
+        case OP_GET_BUILTIN:
+            PUSH(OBJ_VAL(&builtins[READ_BYTE()]));
+            break;
+        default:
+            return runtime_error(vm, "unknown opcode: %d", op);
+        }
+    }
+
+#undef PUSH
+#undef POP
+#undef PEEK
+#undef READ_BYTE
+#undef READ_UINT16
+#undef SAVE_IP
+#undef LOAD_FRAME
+}
+
+VMResult run_vm(VM *vm, FunctionProto *main)
+{
+    ensure_globals_capacity(vm, main->num_globals);
+    reset_stack(vm);
+    vm->last_popped = NULL_VAL;
+
+    // The prototype sits in the callee slot while making room, so a collection cannot free it
+    *vm->sp++ = OBJ_VAL(main);
+    maybe_collect_garbage(vm, sizeof(Closure));
+    Closure *closure = make_closure(vm->heap, main);
+    vm->sp[-1] = OBJ_VAL(closure);
+    if (!push_frame(vm, closure, vm->sp, frame_size(main))) {
+        return runtime_error(vm, "stack overflow");
+    }
+    return execute(vm, 0);
+}
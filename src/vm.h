@@ -0,0 +1,68 @@
+#ifndef VM_H
+#define VM_H
+
+#include "code.h"
+#include "globals.h"
+#include "object.h"
+#include <stddef.h>
+
+#define STACK_SIZE 65536
+#define MAX_FRAMES 4096
+
+// A call frame's locals are a contiguous window of the VM stack: `slots[0]` is the first parameter
+// and the callee itself sits just below it at `slots[-1]`
+typedef struct Frame {
+    Closure *closure;
+    uint8_t *ip;
+    Value *slots;
+} Frame;
+
+typedef enum VMResult {
+    VM_OK,
+    VM_RUNTIME_ERROR
+} VMResult;
+
+typedef struct InlineCacheStats {
+    size_t call_hits;
+    size_t call_misses;
+    size_t index_hits; // Hash reads by string key, see IndexCache
+    size_t index_misses;
+} InlineCacheStats;
+
+typedef struct JitStats {
+    size_t functions_compiled;
+    size_t functions_rejected;
+    size_t native_calls; // Calls from the interpreter into native code, not the calls within it
+    size_t deopts;
+} JitStats;
+
+typedef struct VM {
+    Heap *heap;
+    ValueArrayList *constants;
+
+    Value *stack;
+    Value *sp; // Points to the next free slot
+    Frame *frames;
+    int frame_count;
+
+    Value *globals;
+    size_t globals_capacity;
+
+    Upvalue *open_upvalues; // Sorted by stack address, highest first
+    Value last_popped;
+    char *error;
+
+    InlineCacheStats cache_stats;
+    bool jit_enabled; // Only has an effect in builds with the JIT
+    JitStats jit_stats;
+} VM;
+
+extern VM *make_vm(Heap *heap, ValueArrayList *constants);
+extern void cleanup_vm(VM *vm);
+extern VMResult run_vm(VM *vm, FunctionProto *main);
+extern Value get_last_popped(VM *vm);
+extern void ensure_globals_capacity(VM *vm, size_t count);
+extern InlineCacheStats get_inline_cache_stats(VM *vm);
+extern JitStats get_jit_stats(VM *vm);
+
+#endif // VM_H
@@ -0,0 +1,656 @@
+#include "compiler.h"
+#include "errors.h"
+#include "object.h"
+#include "parser.h"
+#include "single_pass.h"
+#include "test_utils.h"
+#include "vm.h"
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+INIT_TEST_HARNESS()
+
+typedef struct VMTest {
+    char *input;
+    const char *expected; // Inspected result, or the runtime error message
+} VMTest;
+
+// How run_source gets from source to bytecode
+typedef enum FrontEnd {
+    EAGER,
+    LAZY, // Top-level function bodies are only compiled when first called
+    SINGLE_PASS, // Compiled while parsing, see single_pass.h
+} FrontEnd;
+
+static const char *front_end_names[] = { "eager", "lazy", "single pass" };
+
+// Compiles and runs `input`, returning either the inspected result or the runtime error
+static char *run_source(char *input, FrontEnd front_end)
+{
+    Parser *parser = make_parser(input, NULL);
+    parser->lazy_functions = front_end == LAZY;
+    Program *program = front_end == SINGLE_PASS ? make_program(NULL) : parse_program(parser);
+    if (parser->errors->size != 0) {
+        printf("Parsing %s failed: %s\n", input, get_error_from_arraylist(parser->errors, 0));
+        assert(1 != 1);
+    }
+
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = front_end == SINGLE_PASS ? compile_single_pass(compiler, input) : compile_program(compiler, program);
+    if (main == NULL) {
+        printf("Compiling %s failed: %s\n", input, get_error_from_arraylist(compiler->errors, 0));
+        assert(1 != 1);
+    }
+
+    VM *vm = make_vm(heap, compiler->constants);
+    char *result;
+    if (run_vm(vm, main) == VM_OK) {
+        result = inspect_value(get_last_popped(vm));
+    } else {
+        result = strdup(vm->error);
+    }
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return result;
+}
+
+// Every program must behave the same however it is compiled
+static void run_vm_tests(VMTest *tests, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        for (FrontEnd front_end = EAGER; front_end <= SINGLE_PASS; front_end++) {
+            char *result = run_source(tests[i].input, front_end);
+            if (strcmp(result, tests[i].expected) != 0) {
+                printf("Input: %s\nFront end: %s\nExpected: %s\nGot: %s\n", tests[i].input, front_end_names[front_end], tests[i].expected, result);
+                assert(1 != 1);
+            }
+            free(result);
+        }
+    }
+}
+
+TEST_CASE(integer_arithmetic)
+{
+    VMTest tests[] = {
+        { "1", "1" },
+        { "1 + 2", "3" },
+        { "50 / 2 * 2 + 10 - 5", "55" },
+        { "5 * (2 + 10)", "60" },
+        { "-5 + 10", "5" },
+        { "-50 + 100 + -50", "0" },
+        { "(5 + 10 * 2 + 15 / 3) * 2 + -10", "50" },
+        { "2147483647 * 2147483647", "4611686014132420609" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(bignums)
+{
+    VMTest tests[] = {
+        // Results that do not fit in 64 bits are promoted, and demoted again once they fit
+        { "9223372036854775807 + 1", "9223372036854775808" },
+        { "-9223372036854775807 - 2", "-9223372036854775809" },
+        { "4294967296 * 4294967296", "18446744073709551616" },
+        { "let big = 4294967296 * 4294967296; big * big", "340282366920938463463374607431768211456" },
+        { "let big = 4294967296 * 4294967296; big - big", "0" },
+        { "let big = 9223372036854775807 + 1; big - 1", "9223372036854775807" },
+        { "let min = -9223372036854775807 - 1; -min", "9223372036854775808" },
+        { "let min = -9223372036854775807 - 1; min / -1", "9223372036854775808" },
+        { "let big = 4294967296 * 4294967296; -big", "-18446744073709551616" },
+        { "let big = 4294967296 * 4294967296; big * 4294967296 / 4294967296", "18446744073709551616" },
+        { "let big = 4294967296 * 4294967296; big / -7", "-2635249153387078802" },
+        { "let big = 4294967296 * 4294967296; 5 / big", "0" },
+        // Bignums compare by value
+        { "4294967296 * 4294967296 == 4294967296 * 4294967296", "true" },
+        { "4294967296 * 4294967296 != 4294967296 * 4294967297", "true" },
+        { "let big = 9223372036854775807 + 1; big > 9223372036854775807", "true" },
+        { "let big = 9223372036854775807 + 1; -big < -9223372036854775807", "true" },
+        { "let big = 9223372036854775807 + 1; big - 1 == 9223372036854775807", "true" },
+        { "let fact = fn(n) { if (n == 0) { 1 } else { n * fact(n - 1) } }; fact(30)", "265252859812191058636308480000000" },
+        { "let fib = fn(n) { let a = 0; let b = 1; let i = 0; while (i < n) { let t = b; let b = a + b; let a = t; let i = i + 1; } a }; fib(100)", "354224848179261915075" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(float_arithmetic)
+{
+    VMTest tests[] = {
+        { "1.5", "1.5" },
+        { "0.1 + 0.2", "0.30000000000000004" },
+        { "2.5 * 4.0", "10.0" },
+        { "-1.5 - 1e3", "-1001.5" },
+        { "1.0 / 3.0", "0.3333333333333333" },
+        // Integers are converted when the other operand is a float
+        { "1 + 0.5", "1.5" },
+        { "7 / 2.0", "3.5" },
+        { "9223372036854775807 + 1.0", "9.223372036854776e+18" },
+        { "let big = 4294967296 * 4294967296; big * 0.5", "9.223372036854776e+18" },
+        // Dividing a float by zero is not an error
+        { "1.0 / 0", "inf" },
+        { "-1 / 0.0", "-inf" },
+        { "0.0 / 0.0", "nan" },
+        { "-0.0", "-0.0" },
+        // Numbers compare by value whatever their type, NaN is unordered
+        { "1 == 1.0", "true" },
+        { "2.5 > 2", "true" },
+        { "9007199254740993 > 9007199254740992.0", "true" },
+        { "let big = 4294967296 * 4294967296; big == 18446744073709551616.0", "true" },
+        { "let nan = 0.0 / 0.0; [nan == nan, nan < 1, nan > 1, nan != nan]", "[false, false, false, true]" },
+        { "[1.5, 2, 0.25]", "[1.5, 2, 0.25]" },
+        { "let sum = fn(a, i, total) { if (i == len(a)) { total } else { sum(a, i + 1, total + a[i]) } }; sum([0.5, 0.25, 1], 0, 0)", "1.75" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(boolean_expressions)
+{
+    VMTest tests[] = {
+        { "true", "true" },
+        { "1 < 2", "true" },
+        { "1 > 2", "false" },
+        { "1 == 1", "true" },
+        { "1 != 2", "true" },
+        { "true == false", "false" },
+        { "(1 < 2) == true", "true" },
+        { "!true", "false" },
+        { "!!5", "true" },
+        { "!(if (false) { 5; })", "true" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(conditionals)
+{
+    VMTest tests[] = {
+        { "if (true) { 10 }", "10" },
+        { "if (true) { 10 } else { 20 }", "10" },
+        { "if (false) { 10 } else { 20 }", "20" },
+        { "if (1 > 2) { 10 }", "null" },
+        { "if (if (false) { 10 }) { 10 } else { 20 }", "20" },
+        { "if (true) { let a = 1; }", "null" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(global_let_statements)
+{
+    VMTest tests[] = {
+        { "let one = 1; one", "1" },
+        { "let one = 1; let two = one + one; one + two", "3" },
+        { "let a = 1; let a = a + 1; a", "2" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(function_calls)
+{
+    VMTest tests[] = {
+        { "let five = fn() { 5 }; five()", "5" },
+        { "let early = fn() { return 99; 100 }; early()", "99" },
+        { "let none = fn() { }; none()", "null" },
+        { "let identity = fn(a) { a }; identity(4)", "4" },
+        { "let sum = fn(a, b) { let c = a + b; c }; sum(1, 2) + sum(3, 4)", "10" },
+        { "let one = fn() { let one = 1; one }; let two = fn() { let two = 2; two }; one() + two()", "3" },
+        { "let global = 50; let minus = fn() { let num = 1; global - num }; minus() + minus()", "98" },
+        { "let returnsFn = fn() { fn() { 1 } }; returnsFn()()", "1" },
+        { "let unused = fn(a) { let b = 1; }; unused(1)", "null" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(closures)
+{
+    VMTest tests[] = {
+        { "let newClosure = fn(a) { fn() { a } }; let closure = newClosure(99); closure()", "99" },
+        { "let adder = fn(a, b) { fn(c) { a + b + c } }; let add = adder(1, 2); add(8)", "11" },
+        { "let f = fn(a) { fn(b) { fn(c) { a + b + c } } }; f(1)(2)(3)", "6" },
+        // Upvalues are closed over the value the variable had when its frame returned
+        { "let f = fn() { let a = 1; let get = fn() { a }; let a = 2; get }; f()()", "2" },
+        // Closures created in the same frame share the captured variable
+        { "let f = fn() { let a = 5; let g = fn() { a }; let h = fn() { a * 2 }; g() + h() }; f()", "15" },
+        { "let outer = fn() { let a = 1; let middle = fn() { fn() { a } }; middle() }; outer()()", "1" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(recursive_functions)
+{
+    VMTest tests[] = {
+        { "let fib = fn(n) { if (n < 2) { n } else { fib(n - 1) + fib(n - 2) } }; fib(20)", "6765" },
+        { "let count = fn(n) { if (n == 0) { 0 } else { count(n - 1) } }; count(1000)", "0" },
+        { "let wrapper = fn() { let inner = fn(n) { if (n == 0) { 0 } else { inner(n - 1) } }; inner(3) }; wrapper()", "0" },
+        { "let isEven = fn(n) { if (n == 0) { true } else { isOdd(n - 1) } }; let isOdd = fn(n) { if (n == 0) { false } else { isEven(n - 1) } }; isEven(10)", "true" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(tail_calls)
+{
+    // Far deeper than MAX_FRAMES, so each of these only works if tail calls reuse the frame
+    VMTest tests[] = {
+        { "let count = fn(n, acc) { if (n == 0) { acc } else { count(n - 1, acc + 1) } }; count(1000000, 0)", "1000000" },
+        { "let down = fn(n) { if (n == 0) { return true; } return down(n - 1); }; down(1000000)", "true" },
+        { "let isEven = fn(n) { if (n == 0) { true } else { isOdd(n - 1) } }; let isOdd = fn(n) { if (n == 0) { false } else { isEven(n - 1) } }; isEven(1000001)", "false" },
+        { "let make = fn(k) { let loop = fn(n, acc) { if (n == 0) { acc } else { loop(n - 1, acc + k) } }; loop }; make(3)(1000000, 0)", "3000000" },
+        { "let spin = fn(n) { if (n == 0) { let done = true; } else { let x = n; spin(x - 1) } }; spin(1000000)", "null" },
+        // The caller's captured variables are closed before its frame is handed over
+        { "let call = fn(g) { g() }; let f = fn(x) { let y = x * 2; call(fn() { x + y }) }; f(5)", "15" },
+        { "let call = fn(g, n) { if (n == 0) { g() } else { call(g, n - 1) } }; let f = fn(x) { call(fn() { x }, 10000) }; f(7)", "7" },
+        // Only calls whose result is returned as is are tail calls
+        { "let notTail = fn(n) { if (n == 0) { 0 } else { 0 + notTail(n - 1) } }; notTail(1000000)", "stack overflow" },
+        { "let f = fn(n) { let r = f(n); r }; f(1)", "stack overflow" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(loops)
+{
+    VMTest tests[] = {
+        { "let i = 0; let s = 0; while (i < 100) { let s = s + i; let i = i + 1; } s", "4950" },
+        { "let sum = fn(n) { let i = 0; let s = 0; while (i < n) { let i = i + 1; if (i == 3) { continue; } if (i > 8) { break; } let s = s + i; } s }; sum(100)", "33" },
+        { "let f = fn(n) { let i = 0; let c = 0; while (i < n) { let j = 0; while (true) { if (j == i) { break; } let j = j + 1; let c = c + 1; } let i = i + 1; } c }; f(10)", "45" },
+        { "let find = fn(n) { let i = 0; while (true) { if (i * i > n) { return i; } let i = i + 1; } }; find(50)", "8" },
+        { "let f = fn() { while (false) { 1 } }; f()", "null" },
+        { "while (false) { 1 }", "null" },
+        // Leaving a loop from inside an expression drops what the expression had pushed, so this
+        // runs in constant stack space
+        { "let f = fn() { let i = 0; let s = 0; while (i < 10) { let i = i + 1; let s = s + 100 * if (i > 3) { break; } else { i }; } s }; f()", "600" },
+        { "let f = fn(n) { let i = 0; while (i < n) { let i = i + 1; 1 + if (i > 0) { continue; } else { 0 }; } i }; f(1000000)", "1000000" },
+        // Leaving the loop from the left operand of `<`, which runs after the right one
+        { "let i = 0; while (i < 3) { let i = i + 1; if ((if (i == 2) { break } else { 1 }) < 2) { 5 } } i", "2" },
+        { "let f = fn() { let i = 0; let s = 0; while (i < 5) { let i = i + 1; if ((if (i < 3) { continue } else { i }) < (if (i > 3) { s } else { 9 })) { let s = s + i; } } s }; f()", "3" },
+        // Closures made before or inside a loop see the variable the loop keeps updating
+        { "let f = fn() { let i = 0; let g = fn() { i }; while (i < 5) { let i = i + 1; } g() }; f()", "5" },
+        { "let f = fn() { let i = 0; let g = 0; while (i < 5) { let g = fn() { i * 10 }; let i = i + 1; } g() }; f()", "50" },
+        { "let i = 0; while (true) { let i = i + 1; i * true; }", "type mismatch: INTEGER * BOOLEAN" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(arrays)
+{
+    VMTest tests[] = {
+        { "[]", "[]" },
+        { "[1, 2 * 2, 3 + 3]", "[1, 4, 6]" },
+        { "[1, 2, 3][0]", "1" },
+        { "[1, 2, 3][1 + 1]", "3" },
+        { "let a = [1, 2, 3]; a[0] + a[1] + a[2]", "6" },
+        { "let i = 0; [1][i]", "1" },
+        { "[1, 2, 3][3]", "null" },
+        { "[1, 2, 3][-1]", "null" },
+        { "[1, 2, 3][9223372036854775807 + 1]", "null" },
+        { "[[1, 2], [3, [4]]][1][1][0]", "4" },
+        { "[fn(x) { x * 2 }][0](21)", "42" },
+        // Pushing returns a new array, the old one is unchanged
+        { "let a = [1, 2]; let b = push(a, 3); [a, b]", "[[1, 2], [1, 2, 3]]" },
+        { "let a = []; let i = 0; while (i < 2000) { let a = push(a, i * i); let i = i + 1; } [len(a), a[0], a[31], a[32], a[1023], a[1024], a[1999]]", "[2000, 0, 961, 1024, 1046529, 1048576, 3996001]" },
+        { "let build = fn(n) { let a = []; let i = 0; while (i < n) { let a = push(a, i); let i = i + 1; } a }; let a = build(40000); let b = push(a, -1); [len(a), a[39999], b[40000], b[32767]]", "[40000, 39999, -1, 32767]" },
+        { "[first([7, 8, 9]), last([7, 8, 9]), rest([7, 8, 9])]", "[7, 9, [8, 9]]" },
+        { "[first([]), last([]), rest([]), rest([1])]", "[null, null, null, []]" },
+        { "let sum = fn(a) { if (len(a) == 0) { 0 } else { first(a) + sum(rest(a)) } }; sum([1, 2, 3, 4, 5])", "15" },
+        // Slices are views, pushing onto one that ends early copies it
+        { "let a = [1, 2, 3, 4, 5]; [slice(a, 1, 3), slice(a, -5, 2), slice(a, 3, 100), slice(a, 4, 2), slice(a, 0, 9223372036854775807 + 1), a]", "[[2, 3], [1, 2], [4, 5], [], [1, 2, 3, 4, 5], [1, 2, 3, 4, 5]]" },
+        { "let a = [1, 2, 3]; let b = slice(a, 0, 2); [push(b, 9), a, push(rest(a), 4), push(slice(a, 3, 3), true), rest(rest(rest(a)))]", "[[1, 2, 9], [1, 2, 3], [2, 3, 4], [true], []]" },
+        { "let a = []; let i = 0; while (i < 100000) { let a = push(a, i); let i = i + 1; } let total = fn(a, acc) { if (len(a) == 0) { acc } else { total(rest(a), acc + first(a)) } }; total(a, 0)", "4999950000" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, i); let i = i + 1; } let s = slice(a, 30, 70); [sum(s), min(s), max(rest(s)), map(slice(a, 997, 1000), fn(x) { x + 1 }), filter(s, fn(x) { x < 33 }), last(s)]", "[1980, 30, 69, [998, 999, 1000], [30, 31, 32], 69]" },
+        { "[1, 2] == [1, 2]", "false" },
+        { "let a = [1, 2]; a == a", "true" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(hashes)
+{
+    VMTest tests[] = {
+        { "{}", "{}" },
+        { "{1: 2}", "{1: 2}" },
+        { "{1: 2, 2: 3}[2]", "3" },
+        { "{1 + 1: 2 * 2, true: 5}[2]", "4" },
+        { "{true: 5}[true]", "5" },
+        { "{true: 5}[false]", "null" },
+        { "{1: 1, 1: 2}[1]", "2" },
+        { "len({1: 1, 1: 2, 2: 3})", "2" },
+        { "let big = 9223372036854775807 + 1; {big: 1}[9223372036854775807 + 1]", "1" },
+        { "{1: [1, 2]}[1][1]", "2" },
+        // Putting returns a new hash, the old one is unchanged
+        { "let h = {1: 1}; let g = put(h, 2, 2); [h[2], g[2], len(h), len(g)]", "[null, 2, 1, 2]" },
+        { "let h = {1: 1}; let g = put(h, 1, 5); [h[1], g[1], len(g)]", "[1, 5, 1]" },
+        { "let h = {}; let i = 0; while (i < 5000) { let h = put(h, i, i * 3); let i = i + 1; } let i = 0; let ok = true; while (i < 5000) { if (h[i] != i * 3) { let ok = false; } let i = i + 1; } [len(h), ok, h[5000]]", "[5000, true, null]" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(strings)
+{
+    VMTest tests[] = {
+        { "\"monkey\"", "monkey" },
+        { "\"\"", "" },
+        { "\"mon\" + \"key\" + \"\"", "monkey" },
+        { "\"tab\\tquote\\\"back\\\\slash\\n\"", "tab\tquote\"back\\slash\n" },
+        { "len(\"\\\"four\\\"\")", "6" },
+        { "\"a\" == \"a\"", "true" },
+        { "\"a\" != \"b\"", "true" },
+        { "\"ab\" == \"a\" + \"b\"", "true" },
+        { "\"1\" == 1", "false" },
+        { "let greet = fn(name) { \"hello \" + name }; [greet(\"a\"), greet(\"b\")]", "[hello a, hello b]" },
+        { "{\"one\": 1, \"two\": 2}[\"t\" + \"wo\"]", "2" },
+        { "{\"one\": 1}[\"three\"]", "null" },
+        { "let h = put({}, \"k\", 1); [h[\"k\"], len(h)]", "[1, 1]" },
+        { "let s = \"\"; let i = 0; while (i < 1000) { let s = s + \"ab\"; let i = i + 1; } len(s)", "2000" },
+        { "let s = \"\"; let i = 0; while (i < 1000) { let s = s + \"ab\"; let i = i + 1; } [s[0], s[1999], s[2000], s[-1]]", "[a, b, null, null]" },
+        { "let s = \"\"; let i = 0; while (i < 300) { let s = \"x\" + s + \"y\"; let i = i + 1; } [len(s), s[299] + s[300]]", "[600, xy]" },
+        { "let a = \"\"; let b = \"\"; let i = 0; while (i < 500) { let a = a + \"ab\"; let b = b + \"a\" + \"b\"; let i = i + 1; } [a == b, len({a: 1, b: 2})]", "[true, 1]" },
+        { "\"monkey\"[0] + \"monkey\"[5]", "my" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(builtins)
+{
+    VMTest tests[] = {
+        { "len([])", "0" },
+        { "len([1, [2, 3]])", "2" },
+        { "len", "builtin len" },
+        { "let f = len; f([1])", "1" },
+        { "let apply = fn(f, x) { f(x) }; apply(len, [1, 2, 3])", "3" },
+        { "let f = fn(a) { rest(a) }; f([1, 2])", "[2]" },
+        // Programs may shadow builtins
+        { "let len = fn(x) { 42 }; len([1])", "42" },
+        { "let f = fn(first) { first * 2 }; f(4)", "8" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+// Arrays of small integers are packed and the vector kernels run over them, other arrays and
+// other functions go element by element
+TEST_CASE(array_builtins)
+{
+    VMTest tests[] = {
+        { "[sum([]), sum([1, 2, 3]), min([]), max([])]", "[0, 6, null, null]" },
+        { "[min([3, -1, 2]), max([3, -1, 2]), min([7]), max([-7])]", "[-1, 3, 7, -7]" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, (500 - i) * 2); let i = i + 1; } [sum(a), min(a), max(a)]", "[1000, -998, 1000]" },
+        // Overflowing the packed sum carries on with bignums, which also count as integers
+        { "sum([9223372036854775807, 1, -5])", "9223372036854775803" },
+        { "sum([9223372036854775807, 9223372036854775807, 9223372036854775807, 9223372036854775807, 9223372036854775807, 2])", "46116860184273879037" },
+        { "let big = 9223372036854775807 + 1; [sum([big, -1]), min([1, big, -big]), max([1, big])]", "[9223372036854775807, -9223372036854775808, 9223372036854775808]" },
+        // Floats mix with integers as in arithmetic, the result stays an integer only if every element is one
+        { "[sum([0.5, 0.25]), min([1.5, -2.5, 0.5]), max([1.5, -2.5, 0.5])]", "[0.75, -2.5, 1.5]" },
+        { "[sum([1, 2.5, 3]), min([1.5, 2]), max([1.5, 2]), min([2, 1.5]), max([3, 2.5, 1])]", "[6.5, 1.5, 2, 1.5, 3]" },
+        { "let big = 9223372036854775807 + 1; [sum([big, 0.5]), max([1.5, big]), min([0.0, -big])]", "[9.223372036854776e+18, 9223372036854775808, -9223372036854775808]" },
+        { "let nan = 0.0 / 0.0; [min([1, nan, 0.5]), max([1, nan, 0.5])]", "[0.5, 1]" },
+        { "[map([1, 2, 3], fn(x) { x * 2 }), map([1, 2, 3], fn(x) { 10 - x }), map([1, 2], fn(x) { x - 10 }), map([1, 2], fn(x) { 1 + x })]", "[[2, 4, 6], [9, 8, 7], [-9, -8], [2, 3]]" },
+        { "map([1, 9223372036854775807], fn(x) { x + 1 })", "[2, 9223372036854775808]" },
+        { "map([-1, 4611686018427387904], fn(x) { x * 2 })", "[-2, 9223372036854775808]" },
+        { "[map([1, 2], fn(x) { [x] }), map([\"a\", \"b\"], fn(s) { s + \"!\" }), map([[1], [1, 2]], len), map([], 1)]", "[[[1], [2]], [a!, b!], [1, 2], []]" },
+        { "let f = fn(k) { map([1, 2], fn(x) { x * k }) }; f(3)", "[3, 6]" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, i); let i = i + 1; } let b = map(a, fn(x) { x * 3 }); [len(b), b[999], sum(b)]", "[1000, 2997, 1498500]" },
+        { "[filter([1, 5, 2, 8], fn(x) { x > 3 }), filter([1, 5, 2, 8], fn(x) { x < 3 }), filter([1, 5, 2, 8], fn(x) { 3 < x }), filter([1, 5, 2, 8], fn(x) { 3 > x })]", "[[5, 8], [1, 2], [5, 8], [1, 2]]" },
+        { "[filter([1, 2, 1], fn(x) { x == 1 }), filter([1, 2, 1], fn(x) { 1 != x }), filter([1, 2], fn(x) { x * 0 }), filter([1, true, \"a\"], fn(x) { x == true })]", "[[1, 1], [2], [1, 2], [true]]" },
+        { "let a = []; let i = 0; while (i < 1000) { let a = push(a, i); let i = i + 1; } let b = filter(a, fn(x) { x > 499 }); [len(b), b[0], b[499], sum(filter(a, fn(x) { x != 7 }))]", "[500, 500, 999, 499493]" },
+        // Functions called back may call builtins that call back in turn, recurse and allocate
+        { "map([1, 2], fn(x) { sum(map([x, x], fn(y) { y * x })) })", "[2, 8]" },
+        { "let fact = fn(n) { if (n == 0) { 1 } else { n * fact(n - 1) } }; map([3, 25], fact)", "[6, 15511210043330985984000000]" },
+        { "let a = []; let i = 0; while (i < 20000) { let a = push(a, i); let i = i + 1; } let b = map(a, fn(x) { \"n\" + \"x\" + [x][0] }); len(b)", "type mismatch: STRING + INTEGER" },
+        { "let a = []; let i = 0; while (i < 20000) { let a = push(a, i); let i = i + 1; } let b = map(a, fn(x) { [x, \"n\" + \"x\"] }); [len(b), b[19999]]", "[20000, [19999, nx]]" },
+        // Pushing something else copies a packed array into a generic one, the original stays packed
+        { "let a = [1, 2]; let b = push(a, \"x\"); [a, b, sum(a), push(a, 3)]", "[[1, 2], [1, 2, x], 3, [1, 2, 3]]" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(runtime_errors)
+{
+    VMTest tests[] = {
+        { "5 + true", "type mismatch: INTEGER + BOOLEAN" },
+        { "true + false", "unknown operator: BOOLEAN + BOOLEAN" },
+        { "-true", "unknown operator: -BOOLEAN" },
+        { "1 / 0", "division by zero" },
+        { "let big = 4294967296 * 4294967296; big / 0", "division by zero" },
+        { "let big = 4294967296 * 4294967296; big + true", "type mismatch: INTEGER + BOOLEAN" },
+        { "let big = 4294967296 * 4294967296; -big > false", "unknown operator: INTEGER > BOOLEAN" },
+        { "1()", "calling non-function: INTEGER" },
+        { "fn(a) { a }()", "wrong number of arguments: want=1, got=0" },
+        { "let loop = fn() { 1 + loop() }; loop()", "stack overflow" },
+        { "1[0]", "index operator not supported: INTEGER" },
+        { "[1][true]", "index operator not supported: ARRAY[BOOLEAN]" },
+        { "{1: 2}[fn() { 1 }]", "unusable as hash key: FUNCTION" },
+        { "{[1]: 2}", "unusable as hash key: ARRAY" },
+        { "len(1)", "argument to `len` not supported, got INTEGER" },
+        { "len([1], [2])", "wrong number of arguments: want=1, got=2" },
+        { "first({})", "argument to `first` must be ARRAY, got HASH" },
+        { "push(1, 1)", "argument to `push` must be ARRAY, got INTEGER" },
+        { "put([], 1, 1)", "argument to `put` must be HASH, got ARRAY" },
+        { "put({}, {}, 1)", "unusable as hash key: HASH" },
+        { "\"a\" - \"b\"", "unknown operator: STRING - STRING" },
+        { "\"a\" + 1", "type mismatch: STRING + INTEGER" },
+        { "\"a\"[true]", "index operator not supported: STRING[BOOLEAN]" },
+        { "sum(1)", "argument to `sum` must be ARRAY, got INTEGER" },
+        { "slice({}, 0, 1)", "argument to `slice` must be ARRAY, got HASH" },
+        { "slice([1], 0, \"a\")", "bounds of `slice` must be INTEGER, got STRING" },
+        { "sum([1, \"a\"])", "elements of `sum` argument must be INTEGER or FLOAT, got STRING" },
+        { "max([1, true])", "elements of `max` argument must be INTEGER or FLOAT, got BOOLEAN" },
+        { "map([1], 1)", "calling non-function: INTEGER" },
+        { "map([1], fn(a, b) { a })", "wrong number of arguments: want=2, got=1" },
+        { "filter([1], fn(x) { x > true })", "unknown operator: INTEGER > BOOLEAN" },
+        { "map([1], fn(x) { x + true })", "type mismatch: INTEGER + BOOLEAN" },
+        { "1.5 + true", "type mismatch: FLOAT + BOOLEAN" },
+        { "\"a\" * 2.0", "type mismatch: STRING * FLOAT" },
+        { "-\"a\" > 1.5", "unknown operator: -STRING" },
+        // `a < b` is `b > a`, so `b` runs first
+        { "-true < -\"a\"", "unknown operator: -STRING" },
+        { "\"a\" > 1.5", "unknown operator: STRING > FLOAT" },
+        { "[1][0.0]", "index operator not supported: ARRAY[FLOAT]" },
+        { "{1.5: 1}", "unusable as hash key: FLOAT" },
+        { "min([1.5, \"a\"])", "elements of `min` argument must be INTEGER or FLOAT, got STRING" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+}
+
+TEST_CASE(lazy_functions)
+{
+    // Errors in a skipped body only show once it is called, and not at all if it never is
+    VMTest tests[] = {
+        { "let broken = fn() { missing + 1 }; let fine = fn() { 2 }; fine()", "2" },
+        { "let broken = fn() { missing + 1 }; broken()", "cannot compile function broken: Identifier not found: missing" },
+        { "let broken = fn(x) { x + }; 1; broken(1)", "cannot compile function broken: No prefix parse function for } found" },
+        { "fn() { let a = 1; let a = ; }()", "cannot compile function anonymous: No prefix parse function for ; found" },
+        // Globals defined after the function are there by the time it is compiled
+        { "let f = fn() { g() * 2 }; let g = fn() { 21 }; f()", "42" },
+        // Inner functions are parsed along with the body that contains them and may capture from it
+        { "let f = fn(a) { let g = fn(b) { fn() { a + b } }; g(2) }; f(1)()", "3" },
+        { "let apply = fn(g, x) { g(x) }; apply(fn(y) { y * 3 }, 4) + apply(fn(y) { y * 3 }, 5)", "27" },
+        { "let s = fn() { \"}{\" }; let t = fn() { {\"k\": fn() { s() }} }; t()[\"k\"]()", "}{" },
+    };
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        char *result = run_source(tests[i].input, LAZY);
+        if (strcmp(result, tests[i].expected) != 0) {
+            printf("Input: %s\nExpected: %s\nGot: %s\n", tests[i].input, tests[i].expected, result);
+            assert(1 != 1);
+        }
+        free(result);
+    }
+
+    // A function defined by one run may be compiled during a later one
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+    char *inputs[] = { "let square = fn(x) { x * x }; let k = 3;", "square(k) + square(4)" };
+    Parser *parsers[2];
+    Program *programs[2];
+    for (int i = 0; i < 2; i++) {
+        parsers[i] = make_parser(inputs[i], NULL);
+        parsers[i]->lazy_functions = TRUE;
+        programs[i] = parse_program(parsers[i]);
+        FunctionProto *main = compile_program(compiler, programs[i]);
+        assert(main != NULL);
+        assert(run_vm(vm, main) == VM_OK);
+    }
+    assert(AS_INT(get_last_popped(vm)) == 25);
+    for (int i = 0; i < 2; i++) {
+        cleanup_program(programs[i]);
+        cleanup_parser(parsers[i]);
+    }
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+}
+
+// Runs `input` and returns the VM's inline cache counters
+static InlineCacheStats run_for_cache_stats(char *input)
+{
+    Parser *parser = make_parser(input, NULL);
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+
+    VM *vm = make_vm(heap, compiler->constants);
+    vm->jit_enabled = FALSE; // Native code does not go through the interpreter's caches
+    assert(run_vm(vm, main) == VM_OK);
+    InlineCacheStats stats = get_inline_cache_stats(vm);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+    return stats;
+}
+
+TEST_CASE(call_site_caches)
+{
+    // Each call site in the top-level code runs once and misses. The recursive call site
+    // misses on its first call and hits on the other 99.
+    InlineCacheStats stats = run_for_cache_stats("let count = fn(n) { if (n == 0) { 0 } else { count(n - 1) } }; count(100)");
+    assert(stats.call_misses == 1 + 1);
+    assert(stats.call_hits == 99);
+
+    // Closures made from the same function literal share a cache entry
+    stats = run_for_cache_stats("let adder = fn(a) { fn(b) { a + b } }; let call = fn(f) { f(1) }; let one = adder(1); let two = adder(2); call(one); call(two); call(one);");
+    assert(stats.call_misses == 5 + 1);
+    assert(stats.call_hits == 2);
+
+    // Rebinding the callee misses once for the new function, then the site caches both
+    stats = run_for_cache_stats("let one = fn() { 1 }; let two = fn() { 2 }; let call = fn() { f() }; let f = one; call(); call(); let f = two; call(); call(); let f = one; call();");
+    assert(stats.call_misses == 5 + 2);
+    assert(stats.call_hits == 3);
+}
+
+TEST_CASE(megamorphic_call_sites)
+{
+    VMTest tests[] = {
+        { "let call = fn(f) { f() }; call(fn() { 1 }) + call(fn() { 2 }) + call(fn() { 3 }) + call(fn() { 4 }) + call(fn() { 5 }) + call(fn() { 6 })", "21" },
+        { "let call = fn(f) { f() }; let a = fn() { 1 }; call(a); call(fn() { 2 }); call(fn() { 3 }); call(fn() { 4 }); call(fn() { 5 }); call(fn(x) { x })", "wrong number of arguments: want=1, got=0" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+
+    // A site caches up to four callees
+    InlineCacheStats stats = run_for_cache_stats("let call = fn(f) { f() }; let a = fn() { 1 }; call(fn() { 2 }); call(fn() { 3 }); call(fn() { 4 }); call(a); call(a);");
+    assert(stats.call_misses == 5 + 4);
+    assert(stats.call_hits == 1);
+
+    // The fifth callee makes it give up, after which every call there is a miss
+    stats = run_for_cache_stats("let call = fn(f) { f() }; let a = fn() { 1 }; call(fn() { 2 }); call(fn() { 3 }); call(fn() { 4 }); call(fn() { 5 }); call(a); call(a);");
+    assert(stats.call_misses == 6 + 6);
+    assert(stats.call_hits == 0);
+}
+
+TEST_CASE(index_site_caches)
+{
+    // A site reading the same hash by a literal key misses once, then hits
+    InlineCacheStats stats = run_for_cache_stats("let config = {\"key\": 7}; let s = 0; let i = 0; while (i < 100) { let s = s + config[\"key\"]; let i = i + 1; } s");
+    assert(stats.index_misses == 1);
+    assert(stats.index_hits == 99);
+
+    // Keys made at run time are other string objects, which miss but read the same entry
+    VMTest tests[] = {
+        { "let config = {\"key\": 7}; let get = fn(k) { config[k] }; get(\"key\") + get(\"ke\" + \"y\") + get(\"k\" + \"ey\")", "21" },
+        { "let config = {\"key\": 7}; let get = fn(k) { config[k] }; [get(\"key\"), get(\"other\"), get(\"key\"), get(\"other\")]", "[7, null, 7, null]" },
+        { "let get = fn(h) { h[\"k\"] }; get({\"k\": 1}) + get({\"k\": 2}) + get({\"k\": 3}) + get({\"k\": 4}) + get({\"k\": 5}) + get({\"k\": 6})", "21" },
+    };
+    run_vm_tests(tests, sizeof(tests) / sizeof(tests[0]));
+
+    // Misses on absent keys are cached too. Other indexes do not go through the cache.
+    stats = run_for_cache_stats("let h = {\"a\": 1, 2: 3}; let get = fn(k) { h[k] }; get(\"b\"); get(\"b\"); get(2); get(2); [1][0]; \"ab\"[1]");
+    assert(stats.index_misses == 1);
+    assert(stats.index_hits == 1);
+}
+
+TEST_CASE(megamorphic_index_sites)
+{
+    // A site caches up to four hash and key pairs
+    InlineCacheStats stats = run_for_cache_stats("let get = fn(h) { h[\"k\"] }; let a = {\"k\": 1}; let b = {\"k\": 2}; let c = {\"k\": 3}; let d = {\"k\": 4}; "
+                                                 "get(a); get(b); get(c); get(d); get(a); get(d)");
+    assert(stats.index_misses == 4);
+    assert(stats.index_hits == 2);
+
+    // The fifth makes it give up, after which every read there is a miss
+    stats = run_for_cache_stats("let get = fn(h, k) { h[k] }; let a = {\"k\": 1, \"l\": 2, \"m\": 3}; let b = {\"k\": 4}; "
+                                "get(a, \"k\"); get(a, \"l\"); get(a, \"m\"); get(b, \"k\"); get(b, \"l\"); get(a, \"k\"); get(b, \"k\")");
+    assert(stats.index_misses == 7);
+    assert(stats.index_hits == 0);
+}
+
+TEST_CASE(index_caches_across_collections)
+{
+    // Entries do not outlive a collection, which may move the values they hold out of the nursery
+    Parser *parser = make_parser("let config = {\"key\": [5]}; let s = 0; let i = 0; "
+                                 "while (i < 20) { let s = s + config[\"key\"][0]; let t = [i]; let i = i + 1; } s",
+        NULL);
+    Program *program = parse_program(parser);
+    Heap *heap = make_heap();
+    heap->stress = TRUE;
+    Compiler *compiler = make_compiler(heap);
+    FunctionProto *main = compile_program(compiler, program);
+    assert(main != NULL);
+    VM *vm = make_vm(heap, compiler->constants);
+    assert(run_vm(vm, main) == VM_OK);
+    assert(AS_INT(get_last_popped(vm)) == 100);
+    InlineCacheStats stats = get_inline_cache_stats(vm);
+    assert(stats.index_misses == 20);
+    assert(stats.index_hits == 0);
+
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+    cleanup_program(program);
+    cleanup_parser(parser);
+}
+
+TEST_CASE(globals_persist_across_runs)
+{
+    Heap *heap = make_heap();
+    Compiler *compiler = make_compiler(heap);
+    VM *vm = make_vm(heap, compiler->constants);
+
+    Parser *first_parser = make_parser("let counter = fn(a) { fn() { a } }; let c = counter(7);", NULL);
+    Program *first_program = parse_program(first_parser);
+    FunctionProto *first = compile_program(compiler, first_program);
+    assert(first != NULL);
+    assert(run_vm(vm, first) == VM_OK);
+
+    Parser *second_parser = make_parser("c() * 6", NULL);
+    Program *second_program = parse_program(second_parser);
+    FunctionProto *second = compile_program(compiler, second_program);
+    assert(second != NULL);
+    assert(run_vm(vm, second) == VM_OK);
+    assert(IS_INT(get_last_popped(vm)));
+    assert(AS_INT(get_last_popped(vm)) == 42);
+
+    cleanup_program(first_program);
+    cleanup_parser(first_parser);
+    cleanup_program(second_program);
+    cleanup_parser(second_parser);
+    cleanup_vm(vm);
+    cleanup_compiler(compiler);
+    cleanup_heap(heap);
+}
+
+RUN_TESTS()